@@ -66,4 +66,37 @@ HANDLE DOKANAPI DokanOpenRequestorToken(PDOKAN_FILE_INFO FileInfo) {
   }
   free(eventInfo);
   return handle;
-}
\ No newline at end of file
+}
+
+BOOL DOKANAPI DokanGetRequestorTokenIds(PDOKAN_FILE_INFO FileInfo,
+                                        PLUID AuthenticationId,
+                                        PLUID TokenId) {
+  PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)(UINT_PTR)FileInfo->DokanContext;
+  PCREATE_CONTEXT createContext;
+
+  if (ioEvent->EventContext == NULL ||
+      ioEvent->EventContext->MajorFunction != IRP_MJ_CREATE) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  createContext = &ioEvent->EventContext->Operation.Create;
+  if (createContext->TokenId.LowPart == 0 &&
+      createContext->TokenId.HighPart == 0) {
+    SetLastError(ERROR_NO_TOKEN);
+    return FALSE;
+  }
+  *AuthenticationId = createContext->AuthenticationId;
+  *TokenId = createContext->TokenId;
+  return TRUE;
+}
+
+BOOL DOKANAPI DokanIsAccessCheckedByDriver(PDOKAN_FILE_INFO FileInfo) {
+  PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)(UINT_PTR)FileInfo->DokanContext;
+
+  if (ioEvent->EventContext == NULL ||
+      ioEvent->EventContext->MajorFunction != IRP_MJ_CREATE) {
+    return FALSE;
+  }
+  return (ioEvent->EventContext->Operation.Create.Flags &
+          DOKAN_CREATE_ACCESS_CHECKED) != 0;
+}
@@ -21,14 +21,21 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "dokani.h"
+#include "dokan_dircache.h"
 
 VOID DispatchCleanup(PDOKAN_IO_EVENT IoEvent) {
+  // The driver already completed an asynchronous cleanup and expects no reply.
+  BOOL asynchronous =
+      (IoEvent->EventContext->FileFlags & DOKAN_ASYNC_CLEANUP) != 0;
+
   CheckFileName(IoEvent->EventContext->Operation.Cleanup.FileName);
 
-  CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+  if (!asynchronous) {
+    CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
+                         /*ClearBuffer=*/TRUE);
 
-  IoEvent->EventResult->Status = STATUS_SUCCESS; // return success at any case
+    IoEvent->EventResult->Status = STATUS_SUCCESS; // return success at any case
+  }
 
   DbgPrint("###Cleanup file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
            IoEvent->DokanOpenInfo,
@@ -36,12 +43,27 @@ VOID DispatchCleanup(PDOKAN_IO_EVENT IoEvent) {
                                           : -1,
            IoEvent);
 
+  ApplyDeferredBasicInformation(
+      IoEvent, IoEvent->EventContext->Operation.Cleanup.FileName,
+      &IoEvent->EventContext->Operation.Cleanup.DeferredBasicInfo);
+
   if (IoEvent->DokanInstance->DokanOperations->Cleanup) {
     // ignore return value
     IoEvent->DokanInstance->DokanOperations->Cleanup(
         IoEvent->EventContext->Operation.Cleanup.FileName,
         &IoEvent->DokanFileInfo);
   }
+  if (IoEvent->DokanFileInfo.DeleteOnClose ||
+      (IoEvent->DokanOpenInfo &&
+       IoEvent->DokanOpenInfo->WrittenBeforeCleanup)) {
+    InvalidateCachedDirList(
+        IoEvent->DokanInstance, IoEvent->EventContext->Operation.Cleanup.FileName,
+        wcslen(IoEvent->EventContext->Operation.Cleanup.FileName));
+  }
 
-  EventCompletion(IoEvent);
+  if (asynchronous) {
+    ReleaseDokanOpenInfo(IoEvent);
+  } else {
+    EventCompletion(IoEvent);
+  }
 }
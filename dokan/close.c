@@ -37,3 +37,40 @@ VOID DispatchClose(PDOKAN_IO_EVENT IoEvent) {
   // to reply from this so there is no need to send an EVENT_INFORMATION.
   ReleaseDokanOpenInfo(IoEvent);
 }
+
+VOID DispatchCloseBatch(PDOKAN_IO_EVENT IoEvent) {
+  PEVENT_CONTEXT eventContext = IoEvent->EventContext;
+  PCHAR end = (PCHAR)eventContext + eventContext->Length;
+  PDOKAN_CLOSE_BATCH batch =
+      (PDOKAN_CLOSE_BATCH)((PCHAR)eventContext + sizeof(EVENT_CONTEXT));
+  PDOKAN_CLOSE_BATCH_ENTRY entry = batch->Entries;
+
+  if (eventContext->Length <
+      sizeof(EVENT_CONTEXT) + FIELD_OFFSET(DOKAN_CLOSE_BATCH, Entries)) {
+    DbgPrint("Invalid close batch received.\n");
+    return;
+  }
+  // Each entry is closed as its own IRP_MJ_CLOSE event would have been.
+  for (ULONG i = 0; i < batch->EntryCount; ++i) {
+    if ((PCHAR)entry > end ||
+        (ULONG)(end - (PCHAR)entry) <
+            FIELD_OFFSET(DOKAN_CLOSE_BATCH_ENTRY, FileName) ||
+        entry->FileNameLength + sizeof(WCHAR) >
+            (ULONG)(end - (PCHAR)entry->FileName) ||
+        entry->NextEntryOffset <
+            FIELD_OFFSET(DOKAN_CLOSE_BATCH_ENTRY, FileName[0]) +
+                entry->FileNameLength + sizeof(WCHAR)) {
+      DbgPrint("Invalid close batch received.\n");
+      break;
+    }
+    CheckFileName(entry->FileName);
+    ZeroMemory(&IoEvent->DokanFileInfo, sizeof(DOKAN_FILE_INFO));
+    eventContext->Context = entry->Context;
+    eventContext->FileFlags = entry->FileFlags;
+    SetupIOEventForProcessing(IoEvent);
+    ReleaseDokanOpenInfoEx(IoEvent, entry->FileName);
+    entry = (PDOKAN_CLOSE_BATCH_ENTRY)((PCHAR)entry + entry->NextEntryOffset);
+  }
+  eventContext->Context = 0;
+  eventContext->FileFlags = 0;
+}
@@ -22,9 +22,89 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokani.h"
 #include "dokan_pool.h"
+#include "dokan_dircache.h"
 
 #include <assert.h>
 
+// Largest accepted DOKAN_OPTIONS.InlineDataSize.
+#define DOKAN_INLINE_DATA_MAX_SIZE (1024 * 64)
+
+// Translation tables of DokanMapKernelToUserCreateFileFlags.
+typedef struct _DOKAN_FLAG_MAPPING {
+  ULONG KernelFlags;
+  DWORD UserFlags;
+} DOKAN_FLAG_MAPPING;
+
+static const DOKAN_FLAG_MAPPING g_CreateOptionFlags[] = {
+    {FILE_WRITE_THROUGH, FILE_FLAG_WRITE_THROUGH},
+    {FILE_SEQUENTIAL_ONLY, FILE_FLAG_SEQUENTIAL_SCAN},
+    {FILE_RANDOM_ACCESS, FILE_FLAG_RANDOM_ACCESS},
+    {FILE_NO_INTERMEDIATE_BUFFERING, FILE_FLAG_NO_BUFFERING},
+    {FILE_OPEN_REPARSE_POINT, FILE_FLAG_OPEN_REPARSE_POINT},
+    {FILE_DELETE_ON_CLOSE, FILE_FLAG_DELETE_ON_CLOSE},
+    {FILE_OPEN_FOR_BACKUP_INTENT, FILE_FLAG_BACKUP_SEMANTICS},
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    {FILE_SESSION_AWARE, FILE_FLAG_SESSION_AWARE},
+#endif
+};
+
+// The specific rights are replaced by the generic right when all are asked.
+static const DOKAN_FLAG_MAPPING g_GenericAccessRights[] = {
+    {FILE_GENERIC_READ, GENERIC_READ},
+    {FILE_GENERIC_WRITE, GENERIC_WRITE},
+    {FILE_GENERIC_EXECUTE, GENERIC_EXECUTE},
+    {FILE_ALL_ACCESS, GENERIC_ALL},
+};
+
+// Indexed by the kernel disposition, from FILE_SUPERSEDE to FILE_OVERWRITE_IF.
+// The documentation isn't clear on the difference between replacing a file
+// and truncating it, so FILE_SUPERSEDE is mapped to create/truncate.
+static const DWORD g_CreationDispositions[] = {
+    CREATE_ALWAYS,     // FILE_SUPERSEDE
+    OPEN_EXISTING,     // FILE_OPEN
+    CREATE_NEW,        // FILE_CREATE
+    OPEN_ALWAYS,       // FILE_OPEN_IF
+    TRUNCATE_EXISTING, // FILE_OVERWRITE
+    CREATE_ALWAYS,     // FILE_OVERWRITE_IF
+};
+C_ASSERT(FILE_SUPERSEDE == 0 && FILE_OVERWRITE_IF == 5);
+
+VOID DOKANAPI DokanMapKernelToUserCreateFileFlags(
+    ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG CreateOptions,
+    ULONG CreateDisposition, ACCESS_MASK *outDesiredAccess,
+    DWORD *outFileAttributesAndFlags, DWORD *outCreationDisposition) {
+  ULONG i;
+
+  if (outFileAttributesAndFlags) {
+    *outFileAttributesAndFlags = FileAttributes;
+    for (i = 0; i < ARRAYSIZE(g_CreateOptionFlags); ++i) {
+      if (CreateOptions & g_CreateOptionFlags[i].KernelFlags) {
+        *outFileAttributesAndFlags |= g_CreateOptionFlags[i].UserFlags;
+      }
+    }
+  }
+
+  if (outCreationDisposition) {
+    *outCreationDisposition =
+        CreateDisposition < ARRAYSIZE(g_CreationDispositions)
+            ? g_CreationDispositions[CreateDisposition]
+            : 0;
+  }
+
+  if (outDesiredAccess) {
+    ACCESS_MASK replaced = 0;
+    *outDesiredAccess = DesiredAccess;
+    for (i = 0; i < ARRAYSIZE(g_GenericAccessRights); ++i) {
+      if ((DesiredAccess & g_GenericAccessRights[i].KernelFlags) ==
+          g_GenericAccessRights[i].KernelFlags) {
+        *outDesiredAccess |= g_GenericAccessRights[i].UserFlags;
+        replaced |= g_GenericAccessRights[i].KernelFlags;
+      }
+    }
+    *outDesiredAccess &= ~replaced;
+  }
+}
+
 VOID SetIOSecurityContext(PEVENT_CONTEXT EventContext,
                           PDOKAN_IO_SECURITY_CONTEXT ioSecurityContext) {
   PDOKAN_UNICODE_STRING_INTERMEDIATE intermediateObjName = NULL;
@@ -90,6 +170,53 @@ VOID SetIOSecurityContext(PEVENT_CONTEXT EventContext,
       EventContext->Operation.Create.SecurityContext.DesiredAccess;
 }
 
+// Copies the information given by ZwCreateFile into the reply for the driver
+// to fill its attribute cache with.
+static VOID FillCreateFileInfo(PDOKAN_IO_EVENT IoEvent) {
+  PBY_HANDLE_FILE_INFORMATION fileInfo =
+      &IoEvent->DokanFileInfo.CreateFileInformation;
+  PDOKAN_CREATE_FILE_INFO createInfo =
+      (PDOKAN_CREATE_FILE_INFO)IoEvent->EventResult->Buffer;
+
+  createInfo->CreationTime.LowPart = fileInfo->ftCreationTime.dwLowDateTime;
+  createInfo->CreationTime.HighPart = fileInfo->ftCreationTime.dwHighDateTime;
+  createInfo->LastAccessTime.LowPart = fileInfo->ftLastAccessTime.dwLowDateTime;
+  createInfo->LastAccessTime.HighPart =
+      fileInfo->ftLastAccessTime.dwHighDateTime;
+  createInfo->LastWriteTime.LowPart = fileInfo->ftLastWriteTime.dwLowDateTime;
+  createInfo->LastWriteTime.HighPart = fileInfo->ftLastWriteTime.dwHighDateTime;
+  createInfo->ChangeTime = createInfo->LastWriteTime;
+  createInfo->AllocationSize.HighPart = fileInfo->nFileSizeHigh;
+  createInfo->AllocationSize.LowPart = fileInfo->nFileSizeLow;
+  ALIGN_ALLOCATION_SIZE(&createInfo->AllocationSize,
+                        IoEvent->DokanInstance->DokanOptions);
+  createInfo->EndOfFile.HighPart = fileInfo->nFileSizeHigh;
+  createInfo->EndOfFile.LowPart = fileInfo->nFileSizeLow;
+  createInfo->FileAttributes = fileInfo->dwFileAttributes;
+  createInfo->NumberOfLinks = fileInfo->nNumberOfLinks;
+  IoEvent->EventResult->BufferLength = sizeof(DOKAN_CREATE_FILE_INFO);
+  // The start of the file copied by ZwCreateFile already follows.
+  if (IoEvent->DokanFileInfo.InlineData != NULL &&
+      IoEvent->EventResult->Operation.Create.Information == FILE_OPENED &&
+      !IoEvent->DokanFileInfo.IsDirectory) {
+    createInfo->InlineDataLength = min(IoEvent->DokanFileInfo.InlineDataLength,
+                                       IoEvent->DokanFileInfo.InlineDataSize);
+    IoEvent->EventResult->BufferLength += createInfo->InlineDataLength;
+  }
+}
+
+// Strips the last section of the file path.
+static VOID StripLastFileNameSection(WCHAR *FileName) {
+  WCHAR *lastP = NULL;
+  for (WCHAR *p = FileName; *p; p++) {
+    if ((*p == L'\\' || *p == L'/') && p[1])
+      lastP = p;
+  }
+  if (lastP) {
+    *lastP = 0;
+  }
+}
+
 BOOL CreateSuccesStatusCheck(NTSTATUS status, ULONG disposition) {
   if (NT_SUCCESS(status))
     return TRUE;
@@ -115,14 +242,26 @@ VOID DispatchCreate(PDOKAN_IO_EVENT IoEvent) {
   BOOL childExisted = TRUE;
   WCHAR *origFileName = NULL;
   DWORD origOptions;
+  ULONG inlineDataSize = 0;
 
   fileName = (WCHAR *)((PCHAR)&IoEvent->EventContext->Operation.Create +
                        IoEvent->EventContext->Operation.Create.FileNameOffset);
 
   CheckFileName(fileName);
 
-  CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+  // Room for the start of the file follows the attributes.
+  if (IoEvent->DokanInstance->DokanOptions->ReadAheadWindowSize > 0) {
+    inlineDataSize = min(IoEvent->DokanInstance->DokanOptions->InlineDataSize,
+                         DOKAN_INLINE_DATA_MAX_SIZE);
+  }
+  CreateDispatchCommon(IoEvent, sizeof(DOKAN_CREATE_FILE_INFO) + inlineDataSize,
+                       /*UseExtraMemoryPool=*/inlineDataSize > 0,
+                       /*ClearBuffer=*/TRUE);
+  if (inlineDataSize > 0) {
+    IoEvent->DokanFileInfo.InlineData =
+        IoEvent->EventResult->Buffer + sizeof(DOKAN_CREATE_FILE_INFO);
+    IoEvent->DokanFileInfo.InlineDataSize = inlineDataSize;
+  }
 
   assert(IoEvent->DokanOpenInfo == NULL);
 
@@ -157,30 +296,15 @@ VOID DispatchCreate(PDOKAN_IO_EVENT IoEvent) {
     // it look like it was
     // a regular request to open a directory.
     // https://msdn.microsoft.com/en-us/library/windows/hardware/ff548630(v=vs.85).aspx
+    // The name is only stripped once the target itself was probed below, so
+    // that it does not need to be copied.
 
-    origFileName = _wcsdup(fileName);
+    origFileName = fileName;
 
     options |= FILE_DIRECTORY_FILE;
     options &= ~FILE_NON_DIRECTORY_FILE;
 
     DbgPrint("SL_OPEN_TARGET_DIRECTORY specified\n");
-
-    // strip the last section of the file path
-    WCHAR *lastP = NULL;
-
-    for (WCHAR *p = fileName; *p; p++) {
-      if ((*p == L'\\' || *p == L'/') && p[1])
-        lastP = p;
-    }
-
-    if (lastP) {
-      *lastP = 0;
-    }
-
-    if (!fileName[0]) {
-      fileName[0] = '\\';
-      fileName[1] = 0;
-    }
   }
 
   DbgPrint("###Create file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
@@ -215,6 +339,14 @@ VOID DispatchCreate(PDOKAN_IO_EVENT IoEvent) {
       IoEvent->DokanFileInfo.IsDirectory = TRUE;
     }
 
+    if (origFileName) {
+      StripLastFileNameSection(fileName);
+      if (!fileName[0]) {
+        fileName[0] = '\\';
+        fileName[1] = 0;
+      }
+    }
+
     if (options & FILE_NON_DIRECTORY_FILE && options & FILE_DIRECTORY_FILE)
       status = STATUS_INVALID_PARAMETER;
     else
@@ -252,15 +384,7 @@ VOID DispatchCreate(PDOKAN_IO_EVENT IoEvent) {
         (IoEvent->EventContext->Operation.Create.SecurityContext.DesiredAccess &
          DELETE)) {
       DbgPrint("Delete failed, ask parent folder if we have the right\n");
-      // strip the last section of the file path
-      WCHAR *lastP = NULL;
-      for (WCHAR *p = fileName; *p; p++) {
-        if ((*p == L'\\' || *p == L'/') && p[1])
-          lastP = p;
-      }
-      if (lastP) {
-        *lastP = 0;
-      }
+      StripLastFileNameSection(fileName);
 
       SetIOSecurityContext(IoEvent->EventContext, &ioSecurityContext);
       ACCESS_MASK newDesiredAccess =
@@ -321,10 +445,24 @@ VOID DispatchCreate(PDOKAN_IO_EVENT IoEvent) {
 
     if (IoEvent->DokanFileInfo.IsDirectory)
       IoEvent->EventResult->Operation.Create.Flags |= DOKAN_FILE_DIRECTORY;
+    IoEvent->EventResult->Operation.Create.LeaseLevel =
+        IoEvent->DokanFileInfo.LeaseLevel;
+    IoEvent->EventResult->Operation.Create.LeaseDurationMs =
+        IoEvent->DokanFileInfo.LeaseDurationMs;
+    IoEvent->EventResult->Operation.Create.CacheHints =
+        IoEvent->DokanFileInfo.CacheHints;
+    IoEvent->EventResult->Operation.Create.ReadAheadGranularity =
+        IoEvent->DokanFileInfo.ReadAheadGranularity;
+    if (IoEvent->DokanFileInfo.HasCreateFileInformation) {
+      FillCreateFileInfo(IoEvent);
+    }
   }
 
-  if (origFileName)
-    free(origFileName);
+  if (NT_SUCCESS(IoEvent->EventResult->Status) &&
+      IoEvent->EventResult->Operation.Create.Information != FILE_OPENED) {
+    InvalidateCachedDirList(IoEvent->DokanInstance, fileName,
+                            wcslen(fileName));
+  }
 
   if (!NT_SUCCESS(IoEvent->EventResult->Status)) {
     IoEvent->EventResult->Context = 0;
@@ -24,6 +24,8 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "fileinfo.h"
 #include "list.h"
 #include "dokan_pool.h"
+#include "dokan_dircache.h"
+#include "dokan_pattern.h"
 
 #include <assert.h>
 
@@ -44,290 +46,114 @@ typedef struct _DOKAN_FIND_DATA {
   LIST_ENTRY ListEntry;
 } DOKAN_FIND_DATA, *PDOKAN_FIND_DATA;
 
-VOID DokanFillDirInfo(PFILE_DIRECTORY_INFORMATION Buffer,
-                      PWIN32_FIND_DATAW FindData, ULONG Index,
-                      PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
-}
-
-VOID DokanFillFullDirInfo(PFILE_FULL_DIR_INFORMATION Buffer,
-                          PWIN32_FIND_DATAW FindData, ULONG Index,
-                          PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->EaSize = 0;
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
-}
-
-VOID DokanFillIdFullDirInfo(PFILE_ID_FULL_DIR_INFORMATION Buffer,
-                            PWIN32_FIND_DATAW FindData, ULONG Index,
-                            PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->EaSize = 0;
-  Buffer->FileId.QuadPart = 0;
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
-}
-
-VOID DokanFillIdBothDirInfo(PFILE_ID_BOTH_DIR_INFORMATION Buffer,
-                            PWIN32_FIND_DATAW FindData, ULONG Index,
-                            PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-  Buffer->ShortNameLength = 0;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->EaSize = 0;
-  Buffer->FileId.QuadPart = 0;
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
-}
-
-VOID DokanFillIdExtdDirInfo(PFILE_ID_EXTD_DIR_INFO Buffer,
-                            PWIN32_FIND_DATAW FindData, ULONG Index,
-                            PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->EaSize = 0;
-  Buffer->ReparsePointTag = 0;
-  RtlFillMemory(&Buffer->FileId.Identifier, sizeof Buffer->FileId.Identifier, 0);
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+// Directory entries.
+//
+// Entries are written by a routine specific to the information class, from a
+// DOKAN_DIRECTORY_ENTRY that points to the name given by the file system or
+// to the one of a WIN32_FIND_DATAW. The reply buffer is zeroed by
+// CreateDispatchCommon, so only the fields that are not zero are written.
+
+typedef VOID (*PDOKAN_FILL_ENTRY_ROUTINE)(PVOID Buffer,
+                                          PDOKAN_DIRECTORY_ENTRY Entry);
+
+typedef struct _DOKAN_DIRECTORY_ENTRY_LAYOUT {
+  /** Offset of the FileName of the FILE_*_INFORMATION struct */
+  ULONG FileNameOffset;
+  /** Writes the fields past the ones of FILE_DIRECTORY_INFORMATION, if any */
+  PDOKAN_FILL_ENTRY_ROUTINE Fill;
+  /** Whether the struct starts like FILE_DIRECTORY_INFORMATION */
+  BOOL HasDirectoryInformation;
+} DOKAN_DIRECTORY_ENTRY_LAYOUT, *PDOKAN_DIRECTORY_ENTRY_LAYOUT;
+
+static VOID FillIdFullDirInfo(PVOID Buffer, PDOKAN_DIRECTORY_ENTRY Entry) {
+  ((PFILE_ID_FULL_DIR_INFORMATION)Buffer)->FileId.QuadPart =
+      (LONGLONG)Entry->FileId;
 }
 
-VOID DokanFillIdExtdBothDirInfo(PFILE_ID_EXTD_BOTH_DIR_INFORMATION Buffer,
-                            PWIN32_FIND_DATAW FindData, ULONG Index,
-                            PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-  Buffer->ShortNameLength = 0;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->EaSize = 0;
-  Buffer->ReparsePointTag = 0;
-  RtlFillMemory(&Buffer->FileId.Identifier, sizeof Buffer->FileId.Identifier, 0);
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+static VOID FillIdBothDirInfo(PVOID Buffer, PDOKAN_DIRECTORY_ENTRY Entry) {
+  ((PFILE_ID_BOTH_DIR_INFORMATION)Buffer)->FileId.QuadPart =
+      (LONGLONG)Entry->FileId;
 }
 
-VOID DokanFillBothDirInfo(PFILE_BOTH_DIR_INFORMATION Buffer,
-                          PWIN32_FIND_DATAW FindData, ULONG Index,
-                          PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileAttributes = FindData->dwFileAttributes;
-  Buffer->FileNameLength = nameBytes;
-  Buffer->ShortNameLength = 0;
-
-  Buffer->EndOfFile.HighPart = FindData->nFileSizeHigh;
-  Buffer->EndOfFile.LowPart = FindData->nFileSizeLow;
-  Buffer->AllocationSize.HighPart = FindData->nFileSizeHigh;
-  Buffer->AllocationSize.LowPart = FindData->nFileSizeLow;
-  ALIGN_ALLOCATION_SIZE(&Buffer->AllocationSize, DokanInstance->DokanOptions);
-
-  Buffer->CreationTime.HighPart = FindData->ftCreationTime.dwHighDateTime;
-  Buffer->CreationTime.LowPart = FindData->ftCreationTime.dwLowDateTime;
-
-  Buffer->LastAccessTime.HighPart = FindData->ftLastAccessTime.dwHighDateTime;
-  Buffer->LastAccessTime.LowPart = FindData->ftLastAccessTime.dwLowDateTime;
-
-  Buffer->LastWriteTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->LastWriteTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->ChangeTime.HighPart = FindData->ftLastWriteTime.dwHighDateTime;
-  Buffer->ChangeTime.LowPart = FindData->ftLastWriteTime.dwLowDateTime;
-
-  Buffer->EaSize = 0;
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+static VOID FillIdExtdDirInfo(PVOID Buffer, PDOKAN_DIRECTORY_ENTRY Entry) {
+  RtlCopyMemory(&((PFILE_ID_EXTD_DIR_INFO)Buffer)->FileId.Identifier,
+                &Entry->FileId, sizeof(Entry->FileId));
 }
 
-VOID DokanFillNamesInfo(PFILE_NAMES_INFORMATION Buffer,
-                        PWIN32_FIND_DATAW FindData, ULONG Index) {
-  ULONG nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  Buffer->FileIndex = Index;
-  Buffer->FileNameLength = nameBytes;
-
-  RtlCopyMemory(Buffer->FileName, FindData->cFileName, nameBytes);
+static VOID FillIdExtdBothDirInfo(PVOID Buffer, PDOKAN_DIRECTORY_ENTRY Entry) {
+  RtlCopyMemory(
+      &((PFILE_ID_EXTD_BOTH_DIR_INFORMATION)Buffer)->FileId.Identifier,
+      &Entry->FileId, sizeof(Entry->FileId));
 }
 
-ULONG
-DokanFillDirectoryInformation(FILE_INFORMATION_CLASS DirectoryInfo,
-                              PVOID Buffer, PULONG LengthRemaining,
-                              PWIN32_FIND_DATAW FindData, ULONG Index,
-                              PDOKAN_INSTANCE DokanInstance) {
-  ULONG nameBytes;
-  ULONG thisEntrySize;
-
-  nameBytes = (ULONG)wcslen(FindData->cFileName) * sizeof(WCHAR);
-
-  thisEntrySize = nameBytes;
-
+static DOKAN_DIRECTORY_ENTRY_LAYOUT DirInfoLayout = {
+    FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileName), NULL, TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT FullDirInfoLayout = {
+    FIELD_OFFSET(FILE_FULL_DIR_INFORMATION, FileName), NULL, TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT IdFullDirInfoLayout = {
+    FIELD_OFFSET(FILE_ID_FULL_DIR_INFORMATION, FileName), FillIdFullDirInfo,
+    TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT BothDirInfoLayout = {
+    FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION, FileName), NULL, TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT IdBothDirInfoLayout = {
+    FIELD_OFFSET(FILE_ID_BOTH_DIR_INFORMATION, FileName), FillIdBothDirInfo,
+    TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT IdExtdDirInfoLayout = {
+    FIELD_OFFSET(FILE_ID_EXTD_DIR_INFO, FileName), FillIdExtdDirInfo, TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT IdExtdBothDirInfoLayout = {
+    FIELD_OFFSET(FILE_ID_EXTD_BOTH_DIR_INFORMATION, FileName),
+    FillIdExtdBothDirInfo, TRUE};
+static DOKAN_DIRECTORY_ENTRY_LAYOUT NamesInfoLayout = {
+    FIELD_OFFSET(FILE_NAMES_INFORMATION, FileName), NULL, FALSE};
+
+// Returns the layout of the entries of DirectoryInfo, or NULL if it is not a
+// supported directory information class.
+static PDOKAN_DIRECTORY_ENTRY_LAYOUT
+GetDirectoryEntryLayout(FILE_INFORMATION_CLASS DirectoryInfo) {
   switch (DirectoryInfo) {
   case FileDirectoryInformation:
-    thisEntrySize += sizeof(FILE_DIRECTORY_INFORMATION);
-    break;
+    return &DirInfoLayout;
   case FileFullDirectoryInformation:
-    thisEntrySize += sizeof(FILE_FULL_DIR_INFORMATION);
-    break;
+    return &FullDirInfoLayout;
   case FileIdFullDirectoryInformation:
-    thisEntrySize += sizeof(FILE_ID_FULL_DIR_INFORMATION);
-    break;
+    return &IdFullDirInfoLayout;
   case FileNamesInformation:
-    thisEntrySize += sizeof(FILE_NAMES_INFORMATION);
-    break;
+    return &NamesInfoLayout;
   case FileBothDirectoryInformation:
-    thisEntrySize += sizeof(FILE_BOTH_DIR_INFORMATION);
-    break;
+    return &BothDirInfoLayout;
   case FileIdBothDirectoryInformation:
-    thisEntrySize += sizeof(FILE_ID_BOTH_DIR_INFORMATION);
-    break;
+    return &IdBothDirInfoLayout;
   case FileIdExtdDirectoryInformation:
-    thisEntrySize += sizeof(FILE_ID_EXTD_DIR_INFO);
-    break;
+    return &IdExtdDirInfoLayout;
   case FileIdExtdBothDirectoryInformation:
-    thisEntrySize += sizeof(FILE_ID_EXTD_BOTH_DIR_INFORMATION);
-    break;
+    return &IdExtdBothDirInfoLayout;
   default:
-    break;
+    return NULL;
   }
+}
+
+static VOID FindDataToDirectoryEntry(PWIN32_FIND_DATAW FindData,
+                                     PDOKAN_DIRECTORY_ENTRY Entry) {
+  Entry->FileAttributes = FindData->dwFileAttributes;
+  Entry->CreationTime = FindData->ftCreationTime;
+  Entry->LastAccessTime = FindData->ftLastAccessTime;
+  Entry->LastWriteTime = FindData->ftLastWriteTime;
+  Entry->FileSize =
+      ((ULONG64)FindData->nFileSizeHigh << 32) | FindData->nFileSizeLow;
+  Entry->FileId = 0;
+  Entry->FileNameLength = (ULONG)wcslen(FindData->cFileName);
+  Entry->FileName = FindData->cFileName;
+}
 
+// Writes Entry to Buffer if it fits in LengthRemaining. Returns the size taken,
+// or 0 if it does not fit.
+static ULONG
+DokanFillDirectoryEntry(PDOKAN_DIRECTORY_ENTRY_LAYOUT Layout, PVOID Buffer,
+                        PULONG LengthRemaining, PDOKAN_DIRECTORY_ENTRY Entry,
+                        ULONG Index, PDOKAN_INSTANCE DokanInstance) {
+  ULONG nameBytes = Entry->FileNameLength * sizeof(WCHAR);
   // Must be align on a 8-byte boundary.
-  thisEntrySize = QuadAlign(thisEntrySize);
+  ULONG thisEntrySize = QuadAlign(Layout->FileNameOffset + nameBytes);
 
   // no more memory, don't fill any more
   if (*LengthRemaining < thisEntrySize) {
@@ -335,36 +161,32 @@ DokanFillDirectoryInformation(FILE_INFORMATION_CLASS DirectoryInfo,
     return 0;
   }
 
-  RtlZeroMemory(Buffer, thisEntrySize);
-
-  switch (DirectoryInfo) {
-  case FileDirectoryInformation:
-    DokanFillDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;
-  case FileFullDirectoryInformation:
-    DokanFillFullDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;
-  case FileIdFullDirectoryInformation:
-    DokanFillIdFullDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;
-  case FileNamesInformation:
-    DokanFillNamesInfo(Buffer, FindData, Index);
-    break;
-  case FileBothDirectoryInformation:
-    DokanFillBothDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;
-  case FileIdBothDirectoryInformation:
-    DokanFillIdBothDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;
-  case FileIdExtdDirectoryInformation:
-    DokanFillIdExtdDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;
-  case FileIdExtdBothDirectoryInformation:
-    DokanFillIdExtdBothDirInfo(Buffer, FindData, Index, DokanInstance);
-    break;    
-  default:
-    break;
+  if (Layout->HasDirectoryInformation) {
+    PFILE_DIRECTORY_INFORMATION info = (PFILE_DIRECTORY_INFORMATION)Buffer;
+    info->FileIndex = Index;
+    info->FileAttributes = Entry->FileAttributes;
+    info->FileNameLength = nameBytes;
+    info->EndOfFile.QuadPart = (LONGLONG)Entry->FileSize;
+    info->AllocationSize.QuadPart = (LONGLONG)Entry->FileSize;
+    ALIGN_ALLOCATION_SIZE(&info->AllocationSize, DokanInstance->DokanOptions);
+    info->CreationTime.HighPart = Entry->CreationTime.dwHighDateTime;
+    info->CreationTime.LowPart = Entry->CreationTime.dwLowDateTime;
+    info->LastAccessTime.HighPart = Entry->LastAccessTime.dwHighDateTime;
+    info->LastAccessTime.LowPart = Entry->LastAccessTime.dwLowDateTime;
+    info->LastWriteTime.HighPart = Entry->LastWriteTime.dwHighDateTime;
+    info->LastWriteTime.LowPart = Entry->LastWriteTime.dwLowDateTime;
+    info->ChangeTime.HighPart = Entry->LastWriteTime.dwHighDateTime;
+    info->ChangeTime.LowPart = Entry->LastWriteTime.dwLowDateTime;
+    if (Layout->Fill) {
+      Layout->Fill(Buffer, Entry);
+    }
+  } else {
+    PFILE_NAMES_INFORMATION info = (PFILE_NAMES_INFORMATION)Buffer;
+    info->FileIndex = Index;
+    info->FileNameLength = nameBytes;
   }
+  RtlCopyMemory((PCHAR)Buffer + Layout->FileNameOffset, Entry->FileName,
+                nameBytes);
 
   *LengthRemaining -= thisEntrySize;
 
@@ -379,20 +201,51 @@ int WINAPI DokanFillFileData(PWIN32_FIND_DATAW FindData,
   return 0;
 }
 
+BOOL DOKANAPI DokanReserveFindData(ULONG EntryCount,
+                                   PDOKAN_FILE_INFO FileInfo) {
+  PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)(UINT_PTR)FileInfo->DokanContext;
+
+  if (!ioEvent->FillingFindData) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  // Room for "." and ".." was kept at the front by PopDirectoryList.
+  if (!DokanVector_Reserve((PDOKAN_VECTOR)FileInfo->ProcessingContext,
+                           EntryCount)) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  return TRUE;
+}
+
 // add entry which matches the pattern specifed in EventContext
 // to the buffer specifed in EventInfo
 //
-LONG MatchFiles(PDOKAN_IO_EVENT IoEvent, PDOKAN_VECTOR DirList) {
+// The scan starts at the entry *Position of DirList, *Index being the number of
+// entries matching the pattern before it, which must not be past the requested
+// FileIndex. They are updated to where the scan stopped, so that the next
+// query of the enumeration can continue from there.
+//
+LONG MatchFiles(PDOKAN_IO_EVENT IoEvent, PDOKAN_VECTOR DirList,
+                size_t *Position, PULONG Index) {
   ULONG lengthRemaining =
       IoEvent->EventContext->Operation.Directory.BufferLength;
   PVOID currentBuffer = IoEvent->EventResult->Buffer;
   PVOID lastBuffer = currentBuffer;
-  ULONG index = 0;
+  size_t position = *Position;
+  ULONG index = *Index;
   BOOL patternCheck = FALSE;
   PWCHAR pattern = NULL;
+  DOKAN_COMPILED_PATTERN compiledPattern;
   BOOL bufferOverFlow = FALSE;
   BOOL caseSensitive = IoEvent->DokanInstance->DokanOptions->Options &
                        DOKAN_OPTION_CASE_SENSITIVE;
+  PDOKAN_DIRECTORY_ENTRY_LAYOUT layout = GetDirectoryEntryLayout(
+      IoEvent->EventContext->Operation.Directory.FileInformationClass);
+  DOKAN_DIRECTORY_ENTRY entry;
+
+  assert(layout);
+  assert(index <= IoEvent->EventContext->Operation.Directory.FileIndex);
 
   if (IoEvent->EventContext->Operation.Directory.SearchPatternLength > 0) {
     pattern = (PWCHAR)((SIZE_T)&IoEvent->EventContext->Operation.Directory
@@ -405,24 +258,25 @@ LONG MatchFiles(PDOKAN_IO_EVENT IoEvent, PDOKAN_VECTOR DirList) {
       (!IoEvent->DokanInstance->DokanOperations->FindFilesWithPattern ||
        IoEvent->DokanOpenInfo->UnimplementedFindFilesWithPattern)) {
     patternCheck = TRUE;
+    CompilePattern(pattern, !caseSensitive, &compiledPattern);
   }
 
-  for (size_t i = 0; i < DokanVector_GetCount(DirList); ++i) {
-    PDOKAN_FIND_DATA find = (PDOKAN_FIND_DATA)DokanVector_GetItem(DirList, i);
+  for (; position < DokanVector_GetCount(DirList); ++position) {
+    PDOKAN_FIND_DATA find =
+        (PDOKAN_FIND_DATA)DokanVector_GetItem(DirList, position);
     DbgPrintW(L"FileMatch? : %s (%s,%d,%d)\n", find->FindData.cFileName,
               (pattern ? pattern : L"null"),
               IoEvent->EventContext->Operation.Directory.FileIndex, index);
 
+    FindDataToDirectoryEntry(&find->FindData, &entry);
     // pattern is not specified or pattern match is ignore cases
-    if (!patternCheck ||
-        DokanIsNameInExpression(pattern, find->FindData.cFileName,
-                                !caseSensitive)) {
+    if (!patternCheck || IsNameInPattern(&compiledPattern, entry.FileName,
+                                         entry.FileNameLength)) {
       if (IoEvent->EventContext->Operation.Directory.FileIndex <= index) {
         // index+1 is very important, should use next entry index
-        ULONG entrySize = DokanFillDirectoryInformation(
-            IoEvent->EventContext->Operation.Directory.FileInformationClass,
-            currentBuffer, &lengthRemaining, &find->FindData, index + 1,
-            IoEvent->DokanInstance);
+        ULONG entrySize =
+            DokanFillDirectoryEntry(layout, currentBuffer, &lengthRemaining,
+                                    &entry, index + 1, IoEvent->DokanInstance);
         // buffer is full
         if (entrySize == 0) {
           bufferOverFlow = TRUE;
@@ -435,6 +289,7 @@ LONG MatchFiles(PDOKAN_IO_EVENT IoEvent, PDOKAN_VECTOR DirList) {
 
           DbgPrint("  =>return single entry\n");
           index++;
+          position++;
           break;
         }
         DbgPrint("  =>return\n");
@@ -448,6 +303,8 @@ LONG MatchFiles(PDOKAN_IO_EVENT IoEvent, PDOKAN_VECTOR DirList) {
     }
   }
 
+  *Position = position;
+  *Index = index;
   // Since next of the last entry doesn't exist, clear next offset
   ((PFILE_BOTH_DIR_INFORMATION)lastBuffer)->NextEntryOffset = 0;
   // acctualy used length of buffer
@@ -507,7 +364,8 @@ VOID AddMissingCurrentAndParentFolder(PDOKAN_IO_EVENT IoEvent) {
     if (!parentFolder) {
       findData.cFileName[0] = '.';
       findData.cFileName[1] = '.';
-      // NULL written during ZeroMemory()
+      // NULL written during ZeroMemory(). Room for both entries was kept at
+      // the front of the list by PopDirectoryList.
       DokanVector_PushFront(dirList, &findData);
     }
     if (!currentFolder) {
@@ -519,11 +377,12 @@ VOID AddMissingCurrentAndParentFolder(PDOKAN_IO_EVENT IoEvent) {
 }
 
 NTSTATUS WriteDirectoryResults(PDOKAN_IO_EVENT EventInfo,
-                               PDOKAN_VECTOR dirList) {
+                               PDOKAN_VECTOR dirList, size_t *Position,
+                               PULONG Index) {
   // If this function is called then so far everything should be good
   assert(EventInfo->EventResult->Status == STATUS_SUCCESS);
   // Write the file info to the output buffer
-  int index = MatchFiles(EventInfo, dirList);
+  int index = MatchFiles(EventInfo, dirList, Position, Index);
   DbgPrint("WriteDirectoryResults() New directory index is %d.\n", index);
   // there is no matched file
   if (index < 0) {
@@ -553,6 +412,8 @@ VOID EndFindFilesCommon(PDOKAN_IO_EVENT IoEvent, NTSTATUS Status) {
   PDOKAN_VECTOR dirList =
       (PDOKAN_VECTOR)IoEvent->DokanFileInfo.ProcessingContext;
   PDOKAN_VECTOR oldDirList = NULL;
+  size_t position = 0;
+  ULONG index = 0;
 
   assert(IoEvent->EventResult->BufferLength == 0);
   assert(IoEvent->DokanFileInfo.ProcessingContext);
@@ -566,9 +427,11 @@ VOID EndFindFilesCommon(PDOKAN_IO_EVENT IoEvent, NTSTATUS Status) {
 
   if (Status == STATUS_SUCCESS) {
     AddMissingCurrentAndParentFolder(IoEvent);
-    Status = WriteDirectoryResults(IoEvent, dirList);
+    Status = WriteDirectoryResults(IoEvent, dirList, &position, &index);
     EnterCriticalSection(&IoEvent->DokanOpenInfo->CriticalSection);
     {
+      IoEvent->DokanOpenInfo->DirListPosition = position;
+      IoEvent->DokanOpenInfo->DirListIndex = index;
       if (IoEvent->DokanOpenInfo->DirList != dirList) {
         oldDirList = IoEvent->DokanOpenInfo->DirList;
         IoEvent->DokanOpenInfo->DirList = dirList;
@@ -603,6 +466,210 @@ VOID EndFindFilesCommon(PDOKAN_IO_EVENT IoEvent, NTSTATUS Status) {
   EventCompletion(IoEvent);
 }
 
+// Enumeration with FindFilesWithCursor.
+//
+// The entries given by the file system are written into the reply as they
+// come until it is full. The directory index given back to the driver is the
+// position in the listing of the next entry to give, "." and ".." taking the
+// first two positions of the directories other than the root.
+
+typedef struct _DOKAN_DIRECTORY_CURSOR {
+  PDOKAN_IO_EVENT IoEvent;
+  PDOKAN_DIRECTORY_ENTRY_LAYOUT Layout;
+  /** Pattern the entries are filtered with when PatternCheck is set */
+  BOOL PatternCheck;
+  DOKAN_COMPILED_PATTERN Pattern;
+  /** Number of positions taken by "." and ".." */
+  ULONG DotEntryCount;
+  PVOID CurrentBuffer;
+  PVOID LastBuffer;
+  ULONG LengthRemaining;
+  /** Position of the next entry to consume */
+  ULONG Index;
+  ULONG EntryCount;
+  /** Whether no more entry can be consumed */
+  BOOL Full;
+  /** Name of the last entry consumed from the file system */
+  WCHAR LastFileName[MAX_PATH];
+  BOOL HasLastFileName;
+} DOKAN_DIRECTORY_CURSOR, *PDOKAN_DIRECTORY_CURSOR;
+
+// Consumes the entry at the position of the cursor. Returns 1 if the reply is
+// full, in which case it is not consumed.
+static int AddCursorEntry(PDOKAN_DIRECTORY_CURSOR Cursor,
+                          PDOKAN_DIRECTORY_ENTRY Entry) {
+  PEVENT_CONTEXT eventContext = Cursor->IoEvent->EventContext;
+  if (Cursor->Full) {
+    return 1;
+  }
+  if (!Cursor->PatternCheck ||
+      IsNameInPattern(&Cursor->Pattern, Entry->FileName,
+                      Entry->FileNameLength)) {
+    ULONG entrySize = DokanFillDirectoryEntry(
+        Cursor->Layout, Cursor->CurrentBuffer, &Cursor->LengthRemaining, Entry,
+        Cursor->Index + 1, Cursor->IoEvent->DokanInstance);
+    if (entrySize == 0) {
+      Cursor->Full = TRUE;
+      return 1;
+    }
+    Cursor->LastBuffer = Cursor->CurrentBuffer;
+    ((PFILE_BOTH_DIR_INFORMATION)Cursor->CurrentBuffer)->NextEntryOffset =
+        entrySize;
+    Cursor->CurrentBuffer = (PCHAR)Cursor->CurrentBuffer + entrySize;
+    ++Cursor->EntryCount;
+    if (eventContext->Flags & SL_RETURN_SINGLE_ENTRY) {
+      Cursor->Full = TRUE;
+    }
+  }
+  ++Cursor->Index;
+  return 0;
+}
+
+static int WINAPI DokanFillDirectoryCursor(PDOKAN_DIRECTORY_ENTRY Entry,
+                                           PDOKAN_FILE_INFO FileInfo) {
+  PDOKAN_DIRECTORY_CURSOR cursor =
+      (PDOKAN_DIRECTORY_CURSOR)FileInfo->ProcessingContext;
+  assert(cursor);
+  if (cursor->Full) {
+    return 1;
+  }
+  if (Entry->FileNameLength == 0 || Entry->FileNameLength >= MAX_PATH) {
+    DbgPrint("Dokan Warning: FindFilesWithCursor gave an entry with an invalid "
+             "name length %lu.\n",
+             Entry->FileNameLength);
+    return 0;
+  }
+  // Listed by the library.
+  if (cursor->DotEntryCount && Entry->FileName[0] == L'.' &&
+      (Entry->FileNameLength == 1 ||
+       (Entry->FileNameLength == 2 && Entry->FileName[1] == L'.'))) {
+    ++cursor->Index;
+  } else if (AddCursorEntry(cursor, Entry)) {
+    return 1;
+  }
+  wcsncpy_s(cursor->LastFileName, MAX_PATH, Entry->FileName,
+            Entry->FileNameLength);
+  cursor->HasLastFileName = TRUE;
+  return cursor->Full;
+}
+
+// Answers the request with FindFilesWithCursor. Returns STATUS_NOT_IMPLEMENTED
+// without having answered if the file system does not implement it.
+static NTSTATUS FindFilesWithCursor(PDOKAN_IO_EVENT IoEvent,
+                                    PDOKAN_OPEN_INFO OpenInfo,
+                                    PWCHAR SearchPattern) {
+  PEVENT_CONTEXT eventContext = IoEvent->EventContext;
+  ULONG fileIndex = eventContext->Operation.Directory.FileIndex;
+  PWCHAR lastFileName = NULL;
+  DOKAN_DIRECTORY_CURSOR cursor;
+  DOKAN_DIRECTORY_ENTRY dotEntry;
+  NTSTATUS status = STATUS_SUCCESS;
+
+  ZeroMemory(&cursor, sizeof(DOKAN_DIRECTORY_CURSOR));
+  cursor.IoEvent = IoEvent;
+  cursor.Layout = GetDirectoryEntryLayout(
+      eventContext->Operation.Directory.FileInformationClass);
+  assert(cursor.Layout);
+  cursor.CurrentBuffer = IoEvent->EventResult->Buffer;
+  cursor.LastBuffer = cursor.CurrentBuffer;
+  cursor.LengthRemaining = eventContext->Operation.Directory.BufferLength;
+  cursor.Index = fileIndex;
+  if (SearchPattern && wcscmp(SearchPattern, L"*") != 0) {
+    cursor.PatternCheck = TRUE;
+    CompilePattern(SearchPattern,
+                   !(IoEvent->DokanInstance->DokanOptions->Options &
+                     DOKAN_OPTION_CASE_SENSITIVE),
+                   &cursor.Pattern);
+  }
+  if (wcscmp(eventContext->Operation.Directory.DirectoryName, L"\\") != 0 &&
+      !cursor.PatternCheck) {
+    cursor.DotEntryCount = 2;
+  }
+
+  // 1 - The dot entries.
+  if (cursor.Index < cursor.DotEntryCount) {
+    FILETIME systime;
+    ZeroMemory(&dotEntry, sizeof(DOKAN_DIRECTORY_ENTRY));
+    dotEntry.FileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+    // Folders times should ideally be the real current and parent folder times.
+    GetSystemTimeAsFileTime(&systime);
+    dotEntry.CreationTime = systime;
+    dotEntry.LastAccessTime = systime;
+    dotEntry.LastWriteTime = systime;
+    dotEntry.FileName = L"..";
+    if (cursor.Index == 0) {
+      dotEntry.FileNameLength = 1;
+      AddCursorEntry(&cursor, &dotEntry);
+    }
+    if (cursor.Index == 1) {
+      dotEntry.FileNameLength = 2;
+      AddCursorEntry(&cursor, &dotEntry);
+    }
+  }
+
+  // 2 - The entries of the file system, resuming from the name of the last one
+  // given to the handle if it stopped right there.
+  if (!cursor.Full) {
+    EnterCriticalSection(&OpenInfo->CriticalSection);
+    if (OpenInfo->CursorFileName && OpenInfo->CursorIndex == cursor.Index &&
+        cursor.Index > cursor.DotEntryCount) {
+      lastFileName = _wcsdup(OpenInfo->CursorFileName);
+    }
+    LeaveCriticalSection(&OpenInfo->CriticalSection);
+    IoEvent->DokanFileInfo.ProcessingContext = &cursor;
+    status = IoEvent->DokanInstance->DokanOperations->FindFilesWithCursor(
+        eventContext->Operation.Directory.DirectoryName,
+        SearchPattern ? SearchPattern : L"*",
+        cursor.Index - cursor.DotEntryCount, lastFileName,
+        DokanFillDirectoryCursor, &IoEvent->DokanFileInfo);
+    IoEvent->DokanFileInfo.ProcessingContext = NULL;
+    free(lastFileName);
+    if (status == STATUS_NOT_IMPLEMENTED) {
+      EnterCriticalSection(&OpenInfo->CriticalSection);
+      OpenInfo->UnimplementedFindFilesWithCursor = TRUE;
+      LeaveCriticalSection(&OpenInfo->CriticalSection);
+      // The entries only write the fields that are not zero.
+      ZeroMemory(IoEvent->EventResult->Buffer,
+                 eventContext->Operation.Directory.BufferLength -
+                     cursor.LengthRemaining);
+      return status;
+    }
+  }
+
+  if (status == STATUS_SUCCESS) {
+    if (cursor.EntryCount == 0) {
+      if (cursor.Full) {
+        status = STATUS_BUFFER_OVERFLOW;
+      } else if (fileIndex == 0) {
+        status = STATUS_NO_SUCH_FILE;
+      } else {
+        status = STATUS_NO_MORE_FILES;
+      }
+      cursor.Index = fileIndex;
+    } else {
+      // Since next of the last entry doesn't exist, clear next offset
+      ((PFILE_BOTH_DIR_INFORMATION)cursor.LastBuffer)->NextEntryOffset = 0;
+      IoEvent->EventResult->BufferLength =
+          eventContext->Operation.Directory.BufferLength -
+          cursor.LengthRemaining;
+      if (cursor.HasLastFileName) {
+        PWCHAR cursorFileName = _wcsdup(cursor.LastFileName);
+        EnterCriticalSection(&OpenInfo->CriticalSection);
+        free(OpenInfo->CursorFileName);
+        OpenInfo->CursorFileName = cursorFileName;
+        OpenInfo->CursorIndex = cursor.Index;
+        LeaveCriticalSection(&OpenInfo->CriticalSection);
+      }
+    }
+    IoEvent->EventResult->Operation.Directory.Index = cursor.Index;
+  }
+  DbgPrint("FindFilesWithCursor() stopped at index %lu with status 0x%x\n",
+           cursor.Index, status);
+  IoEvent->EventResult->Status = status;
+  EventCompletion(IoEvent);
+  return status;
+}
+
 VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
   PWCHAR searchPattern = NULL;
   NTSTATUS status = STATUS_SUCCESS;
@@ -611,6 +678,9 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
   BOOL forceScan = FALSE;
   PDOKAN_OPEN_INFO openInfo = IoEvent->DokanOpenInfo;
   BOOLEAN allocatedOpenInfo = FALSE;
+  BOOL fullListingPattern = FALSE;
+  BOOL fullListing = FALSE;
+  LONG64 dirListCacheGeneration = 0;
 
   DbgPrint(
       "###FindFiles file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
@@ -640,8 +710,8 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
 
   CreateDispatchCommon(IoEvent,
                        IoEvent->EventContext->Operation.Directory.BufferLength,
-                       /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*UseExtraMemoryPool=*/TRUE,
+                       /*ClearBuffer=*/TRUE);
 
   IoEvent->EventResult->Operation.Directory.Index =
       IoEvent->EventContext->Operation.Directory.FileIndex;
@@ -658,6 +728,16 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
     allocatedOpenInfo = TRUE;
   }
 
+  if (IoEvent->DokanInstance->DokanOperations->FindFilesWithCursor &&
+      !openInfo->UnimplementedFindFilesWithCursor &&
+      FindFilesWithCursor(IoEvent, openInfo, searchPattern) !=
+          STATUS_NOT_IMPLEMENTED) {
+    if (allocatedOpenInfo) {
+      PushFileOpenInfo(openInfo);
+    }
+    return;
+  }
+
   EnterCriticalSection(&openInfo->CriticalSection);
   {
     if (openInfo->DirList == NULL) {
@@ -679,7 +759,19 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
             ? TRUE
             : FALSE;
     if (!forceScan) {
-      status = WriteDirectoryResults(IoEvent, openInfo->DirList);
+      size_t position = 0;
+      ULONG index = 0;
+      // Continue from where the last query stopped, unless it asks for an
+      // earlier entry.
+      if (openInfo->DirListIndex <=
+          IoEvent->EventContext->Operation.Directory.FileIndex) {
+        position = openInfo->DirListPosition;
+        index = openInfo->DirListIndex;
+      }
+      status = WriteDirectoryResults(IoEvent, openInfo->DirList, &position,
+                                     &index);
+      openInfo->DirListPosition = position;
+      openInfo->DirListIndex = index;
     }
   }
   LeaveCriticalSection(&openInfo->CriticalSection);
@@ -705,7 +797,30 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
     return;
   }
 
+  // A full listing can answer the scan if the file system would be asked for
+  // one too, MatchFiles applying the pattern otherwise.
+  fullListingPattern = !searchPattern || wcscmp(searchPattern, L"*") == 0;
+  if (IsDirListCacheEnabled(IoEvent->DokanInstance)) {
+    BOOL usesFindFiles =
+        !IoEvent->DokanInstance->DokanOperations->FindFilesWithPattern ||
+        openInfo->UnimplementedFindFilesWithPattern;
+    if ((fullListingPattern || usesFindFiles) &&
+        GetCachedDirList(
+            IoEvent->DokanInstance,
+            IoEvent->EventContext->Operation.Directory.DirectoryName,
+            (PDOKAN_VECTOR)IoEvent->DokanFileInfo.ProcessingContext)) {
+      DbgPrint("  listing found in cache\n");
+      EndFindFilesCommon(IoEvent, STATUS_SUCCESS);
+      if (allocatedOpenInfo) {
+        PushFileOpenInfo(openInfo);
+      }
+      return;
+    }
+    dirListCacheGeneration = GetDirListCacheGeneration(IoEvent->DokanInstance);
+  }
+
   status = STATUS_NOT_IMPLEMENTED;
+  IoEvent->FillingFindData = TRUE;
 
   // Reminder: FindFilesWithPattern may not be implemented by returning STATUS_NOT_IMPLEMENTED.
   if (IoEvent->DokanInstance->DokanOperations->FindFilesWithPattern) {
@@ -713,6 +828,7 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
         IoEvent->EventContext->Operation.Directory.DirectoryName,
         searchPattern ? searchPattern : L"*", DokanFillFileData,
         &IoEvent->DokanFileInfo);
+    fullListing = fullListingPattern;
     if (status == STATUS_NOT_IMPLEMENTED) {
       EnterCriticalSection(&openInfo->CriticalSection);
       openInfo->UnimplementedFindFilesWithPattern = TRUE;
@@ -726,6 +842,15 @@ VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent) {
     status = IoEvent->DokanInstance->DokanOperations->FindFiles(
         IoEvent->EventContext->Operation.Directory.DirectoryName,
         DokanFillFileData, &IoEvent->DokanFileInfo);
+    fullListing = TRUE;
+  }
+  IoEvent->FillingFindData = FALSE;
+
+  if (status == STATUS_SUCCESS && fullListing) {
+    AddCachedDirList(IoEvent->DokanInstance,
+                     IoEvent->EventContext->Operation.Directory.DirectoryName,
+                     (PDOKAN_VECTOR)IoEvent->DokanFileInfo.ProcessingContext,
+                     dirListCacheGeneration);
   }
 
   if (status != STATUS_NOT_IMPLEMENTED) {
@@ -24,6 +24,12 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "fileinfo.h"
 #include "list.h"
 #include "dokan_pool.h"
+#include "dokan_ring.h"
+#include "dokan_dircache.h"
+#include "dokan_trace.h"
+#include "dokan_autoscale.h"
+#include "dokan_metrics.h"
+#include "dokan_recorder.h"
 
 #include <conio.h>
 #include <process.h>
@@ -32,10 +38,6 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <strsafe.h>
 #include <assert.h>
 
-#define DokanMapKernelBit(dest, src, userBit, kernelBit)                       \
-  if (((src) & (kernelBit)) == (kernelBit))                                    \
-  (dest) |= (userBit)
-
 // DokanOptions->DebugMode is ON?
 BOOL g_DebugMode = TRUE;
 
@@ -50,6 +52,11 @@ LIST_ENTRY g_InstanceList;
 
 volatile LONG g_DokanInitialized = 0;
 
+// {6EBEEBA8-F11F-403F-B83D-C54795F8B037}
+TRACELOGGING_DEFINE_PROVIDER(g_DokanTraceProvider, "Dokan.Library",
+                             (0x6ebeeba8, 0xf11f, 0x403f, 0xb8, 0x3d, 0xc5,
+                              0x47, 0x95, 0xf8, 0xb0, 0x37));
+
 VOID DOKANAPI DokanUseStdErr(BOOL Status) { g_UseStdErr = Status; }
 
 VOID DOKANAPI DokanDebugMode(BOOL Status) { g_DebugMode = Status; }
@@ -73,6 +80,14 @@ VOID DispatchDriverLogs(PDOKAN_IO_EVENT IoEvent) {
   }
 }
 
+// Answers a DOKAN_IRP_ECHO event of FSCTL_ECHO without calling the file
+// system.
+VOID DispatchEcho(PDOKAN_IO_EVENT IoEvent) {
+  CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
+                       /*ClearBuffer=*/TRUE);
+  IoEvent->EventResult->Status = STATUS_SUCCESS;
+}
+
 PDOKAN_INSTANCE
 NewDokanInstance() {
   PDOKAN_INSTANCE dokanInstance =
@@ -91,6 +106,7 @@ NewDokanInstance() {
                                               0x80000400);
 
   InitializeListHead(&dokanInstance->ListEntry);
+  InitializeSRWLock(&dokanInstance->RecorderLock);
 
   dokanInstance->DeviceClosedWaitHandle = CreateEvent(NULL, TRUE, FALSE, NULL);
   if (!dokanInstance->DeviceClosedWaitHandle) {
@@ -135,11 +151,14 @@ NewDokanInstance() {
     InsertTailList(&g_InstanceList, &dokanInstance->ListEntry);
   }
   LeaveCriticalSection(&g_InstanceCriticalSection);
+  InitializeDirListCache(dokanInstance);
   return dokanInstance;
 }
 
 VOID DeleteDokanInstance(PDOKAN_INSTANCE DokanInstance) {
   SetEvent(DokanInstance->DeviceClosedWaitHandle);
+  // The port threads queue work to the cleanup group until they are done.
+  StopOverlappedPulls(DokanInstance);
   if (DokanInstance->ThreadInfo.CleanupGroup) {
     CloseThreadpoolCleanupGroupMembers(DokanInstance->ThreadInfo.CleanupGroup,
                                        FALSE, DokanInstance);
@@ -147,7 +166,16 @@ VOID DeleteDokanInstance(PDOKAN_INSTANCE DokanInstance) {
     DokanInstance->ThreadInfo.CleanupGroup = NULL;
     DestroyThreadpoolEnvironment(
         &DokanInstance->ThreadInfo.CallbackEnvironment);
+    for (ULONG i = 0; i < DokanInstance->ThreadInfo.NodeCount; ++i) {
+      DestroyThreadpoolEnvironment(
+          &DokanInstance->ThreadInfo.NodeCallbackEnvironments[i]);
+    }
+    DokanInstance->ThreadInfo.NodeCount = 0;
   }
+  DeletePullThreadAutoscale(DokanInstance);
+  DeleteFlushGroup(DokanInstance);
+  DeleteInstanceMetrics(DokanInstance);
+  StopEventRecording(DokanInstance);
   if (DokanInstance->NotifyHandle &&
       DokanInstance->NotifyHandle != INVALID_HANDLE_VALUE) {
     CloseHandle(DokanInstance->NotifyHandle);
@@ -159,10 +187,13 @@ VOID DeleteDokanInstance(PDOKAN_INSTANCE DokanInstance) {
   if (DokanInstance->Device && DokanInstance->Device != INVALID_HANDLE_VALUE) {
     CloseHandle(DokanInstance->Device);
   }
+  // The driver releases the ring when the device handle is closed.
+  FreeEventRing(DokanInstance);
   if (DokanInstance->GlobalDevice &&
       DokanInstance->GlobalDevice != INVALID_HANDLE_VALUE) {
     CloseHandle(DokanInstance->GlobalDevice);
   }
+  DeleteDirListCache(DokanInstance);
   DeleteCriticalSection(&DokanInstance->CriticalSection);
   EnterCriticalSection(&g_InstanceCriticalSection);
   { RemoveEntryList(&DokanInstance->ListEntry); }
@@ -294,11 +325,142 @@ VOID SetupIOEventForProcessing(PDOKAN_IO_EVENT IoEvent) {
   if (IoEvent->EventContext->FileFlags & DOKAN_NOCACHE) {
     IoEvent->DokanFileInfo.Nocache = 1;
   }
+  if (IoEvent->EventContext->FileFlags & DOKAN_SEQUENTIAL_READ) {
+    IoEvent->DokanFileInfo.SequentialRead = 1;
+  }
+}
+
+// Fills the DOKAN_DISPATCH_INFO given to the dispatch hooks for EventContext.
+static VOID GetDispatchInfo(PEVENT_CONTEXT EventContext,
+                            PDOKAN_DISPATCH_INFO DispatchInfo) {
+  ZeroMemory(DispatchInfo, sizeof(DOKAN_DISPATCH_INFO));
+  DispatchInfo->MajorFunction = EventContext->MajorFunction;
+  DispatchInfo->MinorFunction = EventContext->MinorFunction;
+  DispatchInfo->SerialNumber = EventContext->SerialNumber;
+  DispatchInfo->ProcessId = EventContext->ProcessId;
+  switch (EventContext->MajorFunction) {
+  case IRP_MJ_CREATE:
+    DispatchInfo->FileName =
+        (LPCWSTR)((PCHAR)&EventContext->Operation.Create +
+                  EventContext->Operation.Create.FileNameOffset);
+    DispatchInfo->FileNameLength =
+        EventContext->Operation.Create.FileNameLength;
+    break;
+  case IRP_MJ_CLEANUP:
+    DispatchInfo->FileName = EventContext->Operation.Cleanup.FileName;
+    DispatchInfo->FileNameLength =
+        EventContext->Operation.Cleanup.FileNameLength;
+    break;
+  case IRP_MJ_CLOSE:
+    DispatchInfo->FileName = EventContext->Operation.Close.FileName;
+    DispatchInfo->FileNameLength = EventContext->Operation.Close.FileNameLength;
+    break;
+  case IRP_MJ_DIRECTORY_CONTROL:
+    DispatchInfo->FileName = EventContext->Operation.Directory.DirectoryName;
+    DispatchInfo->FileNameLength =
+        EventContext->Operation.Directory.DirectoryNameLength;
+    break;
+  case IRP_MJ_READ:
+    DispatchInfo->FileName = EventContext->Operation.Read.FileName;
+    DispatchInfo->FileNameLength = EventContext->Operation.Read.FileNameLength;
+    break;
+  case IRP_MJ_WRITE:
+    DispatchInfo->FileName = EventContext->Operation.Write.FileName;
+    DispatchInfo->FileNameLength = EventContext->Operation.Write.FileNameLength;
+    break;
+  case IRP_MJ_QUERY_INFORMATION:
+    DispatchInfo->FileName = EventContext->Operation.File.FileName;
+    DispatchInfo->FileNameLength = EventContext->Operation.File.FileNameLength;
+    break;
+  case IRP_MJ_SET_INFORMATION:
+    DispatchInfo->FileName = EventContext->Operation.SetFile.FileName;
+    DispatchInfo->FileNameLength =
+        EventContext->Operation.SetFile.FileNameLength;
+    break;
+  case IRP_MJ_LOCK_CONTROL:
+    DispatchInfo->FileName = EventContext->Operation.Lock.FileName;
+    DispatchInfo->FileNameLength = EventContext->Operation.Lock.FileNameLength;
+    break;
+  case IRP_MJ_FLUSH_BUFFERS:
+    DispatchInfo->FileName = EventContext->Operation.Flush.FileName;
+    DispatchInfo->FileNameLength = EventContext->Operation.Flush.FileNameLength;
+    break;
+  case IRP_MJ_FILE_SYSTEM_CONTROL:
+    if (EventContext->Operation.FsControlCode ==
+        FSCTL_DUPLICATE_EXTENTS_TO_FILE) {
+      DispatchInfo->FileName = EventContext->Operation.CopyRange.FileName;
+      DispatchInfo->FileNameLength =
+          EventContext->Operation.CopyRange.FileNameLength;
+    } else {
+      DispatchInfo->FileName = EventContext->Operation.Sparse.FileName;
+      DispatchInfo->FileNameLength =
+          EventContext->Operation.Sparse.FileNameLength;
+    }
+    break;
+  case IRP_MJ_QUERY_SECURITY:
+    DispatchInfo->FileName = EventContext->Operation.Security.FileName;
+    DispatchInfo->FileNameLength =
+        EventContext->Operation.Security.FileNameLength;
+    break;
+  case IRP_MJ_SET_SECURITY:
+    DispatchInfo->FileName = EventContext->Operation.SetSecurity.FileName;
+    DispatchInfo->FileNameLength =
+        EventContext->Operation.SetSecurity.FileNameLength;
+    break;
+  default:
+    break;
+  }
+}
+
+// Calls the post dispatch hook of a request dispatched from StartTicks. Its
+// file name is dropped when the request is pending, as the event context may
+// already be gone.
+static VOID CallPostDispatchHook(PDOKAN_DISPATCH_HOOKS Hooks,
+                                 PDOKAN_DISPATCH_INFO DispatchInfo,
+                                 LONG64 StartTicks, NTSTATUS Status) {
+  LARGE_INTEGER now;
+  if (!Hooks->PostDispatch) {
+    return;
+  }
+  QueryPerformanceCounter(&now);
+  DispatchInfo->ElapsedTicks = now.QuadPart - StartTicks;
+  DispatchInfo->Status = Status;
+  if (Status == STATUS_PENDING) {
+    DispatchInfo->FileName = NULL;
+    DispatchInfo->FileNameLength = 0;
+  }
+  Hooks->PostDispatch(DispatchInfo, Hooks->HookContext);
 }
 
-VOID DispatchEvent(PDOKAN_IO_EVENT ioEvent) {
+// Returns TRUE if the event was left pending by its callback, in which case it
+// belongs to DokanCompleteOperation and must no longer be accessed.
+BOOL DispatchEvent(PDOKAN_IO_EVENT ioEvent) {
+  PDOKAN_INSTANCE dokanInstance = ioEvent->DokanInstance;
+  ULONG serialNumber = ioEvent->EventContext->SerialNumber;
+  UCHAR majorFunction = ioEvent->EventContext->MajorFunction;
+  BOOL pending = FALSE;
+  BOOL measureBusyTime = IsPullThreadAutoscaleEnabled(dokanInstance);
+  struct _DOKAN_METRICS_STORE *metrics = dokanInstance->Metrics;
+  LONG64 queuedTime = ioEvent->QueuedTime;
+  PDOKAN_DISPATCH_HOOKS hooks = dokanInstance->DispatchHooks;
+  DOKAN_DISPATCH_INFO dispatchInfo;
+  LARGE_INTEGER start;
+  if (hooks) {
+    GetDispatchInfo(ioEvent->EventContext, &dispatchInfo);
+    if (hooks->PreDispatch) {
+      hooks->PreDispatch(&dispatchInfo, hooks->HookContext);
+    }
+  }
+  if (measureBusyTime || metrics || hooks) {
+    QueryPerformanceCounter(&start);
+  }
+  ioEvent->DispatchStartTime = metrics ? start.QuadPart : 0;
+  if (dokanInstance->Recorder) {
+    RecordEvent(dokanInstance, ioEvent->EventContext);
+  }
+  DOKAN_TRACE_DISPATCH_START(ioEvent->EventContext);
   SetupIOEventForProcessing(ioEvent);
-  switch (ioEvent->EventContext->MajorFunction) {
+  switch (majorFunction) {
   case IRP_MJ_CREATE:
     DispatchCreate(ioEvent);
     break;
@@ -312,10 +474,10 @@ VOID DispatchEvent(PDOKAN_IO_EVENT ioEvent) {
     DispatchDirectoryInformation(ioEvent);
     break;
   case IRP_MJ_READ:
-    DispatchRead(ioEvent);
+    pending = DispatchRead(ioEvent);
     break;
   case IRP_MJ_WRITE:
-    DispatchWrite(ioEvent);
+    pending = DispatchWrite(ioEvent);
     break;
   case IRP_MJ_QUERY_INFORMATION:
     DispatchQueryInformation(ioEvent);
@@ -330,7 +492,10 @@ VOID DispatchEvent(PDOKAN_IO_EVENT ioEvent) {
     DispatchSetInformation(ioEvent);
     break;
   case IRP_MJ_FLUSH_BUFFERS:
-    DispatchFlush(ioEvent);
+    pending = DispatchFlush(ioEvent);
+    break;
+  case IRP_MJ_FILE_SYSTEM_CONTROL:
+    DispatchFileSystemControl(ioEvent);
     break;
   case IRP_MJ_QUERY_SECURITY:
     DispatchQuerySecurity(ioEvent);
@@ -341,14 +506,50 @@ VOID DispatchEvent(PDOKAN_IO_EVENT ioEvent) {
   case DOKAN_IRP_LOG_MESSAGE:
     DispatchDriverLogs(ioEvent);
     break;
+  case DOKAN_IRP_CLOSE_BATCH:
+    DispatchCloseBatch(ioEvent);
+    break;
+  case DOKAN_IRP_ECHO:
+    DispatchEcho(ioEvent);
+    break;
   default:
     DokanDbgPrintW(L"Dokan Warning: Unsupported IRP 0x%x, event Info = 0x%p.\n",
                    ioEvent->EventContext->MajorFunction, ioEvent->EventContext);
     PushIoEventBuffer(ioEvent);
-    break;
+    DOKAN_TRACE_DISPATCH_STOP(serialNumber, majorFunction, NULL);
+    if (hooks) {
+      CallPostDispatchHook(hooks, &dispatchInfo, start.QuadPart,
+                           STATUS_INVALID_DEVICE_REQUEST);
+    }
+    return FALSE;
   }
+  // The stop, result and metrics of a pending event are recorded when it
+  // completes.
+  if (!pending) {
+    DOKAN_TRACE_DISPATCH_STOP(serialNumber, majorFunction,
+                              ioEvent->EventResult);
+    if (dokanInstance->Recorder && ioEvent->EventResult) {
+      RecordEventResult(dokanInstance, serialNumber, ioEvent->EventResult);
+    }
+  }
+  if (measureBusyTime) {
+    AddCallbackBusyTime(dokanInstance, start.QuadPart);
+  }
+  if (metrics && !pending) {
+    RecordDispatchMetrics(metrics, majorFunction, queuedTime, start.QuadPart,
+                          ioEvent->EventResult);
+  }
+  if (hooks) {
+    CallPostDispatchHook(
+        hooks, &dispatchInfo, start.QuadPart,
+        pending ? STATUS_PENDING
+                : (ioEvent->EventResult ? ioEvent->EventResult->Status
+                                        : STATUS_SUCCESS));
+  }
+  return pending;
 }
 
+
 VOID OnDeviceIoCtlFailed(PDOKAN_INSTANCE DokanInstance, DWORD Result) {
   if (!DokanInstance->FileSystemStopped) {
     DokanDbgPrintW(L"Dokan Fatal: Closing IO processing for dokan instance %s "
@@ -357,6 +558,10 @@ VOID OnDeviceIoCtlFailed(PDOKAN_INSTANCE DokanInstance, DWORD Result) {
   }
 
   if (InterlockedAdd(&DokanInstance->UnmountedCalled, 1) == 1) {
+    // Mounted is reported first when the mount point is still being created.
+    if (DokanInstance->MountPointWork) {
+      WaitForThreadpoolWorkCallbacks(DokanInstance->MountPointWork, FALSE);
+    }
     DokanNotifyUnmounted(DokanInstance);
   }
 
@@ -382,23 +587,73 @@ VOID FreeIoEventResult(PEVENT_INFORMATION EventResult, ULONG EventResultSize,
     FreeEventResult(EventResult);
   } else if (EventResultSize <= DOKAN_EVENT_INFO_DEFAULT_SIZE) {
     PushEventResult(EventResult);
-  } else if (EventResultSize <= DOKAN_EVENT_INFO_16K_SIZE) {
-    Push16KEventResult(EventResult);
-  } else if (EventResultSize <= DOKAN_EVENT_INFO_32K_SIZE) {
-    Push32KEventResult(EventResult);
-  } else if (EventResultSize <= DOKAN_EVENT_INFO_64K_SIZE) {
-    Push64KEventResult(EventResult);
-  } else if (EventResultSize <= DOKAN_EVENT_INFO_128K_SIZE) {
-    Push128KEventResult(EventResult);
   } else {
-    assert(FALSE);
+    PushSizedEventResult(EventResult, EventResultSize);
   }
 }
 
-VOID QueueIoEvent(PDOKAN_IO_EVENT IoEvent, PTP_WORK_CALLBACK Callback) {
+// Gives the instance a callback environment on the thread pool of each NUMA
+// node it uses, with DOKAN_OPTION_PROCESSOR_GROUP only the ones of the group.
+static VOID AddInstanceNodes(PDOKAN_INSTANCE DokanInstance,
+                             BOOL InProcessorGroup) {
+  DOKAN_INSTANCE_THREADINFO *threadInfo = &DokanInstance->ThreadInfo;
+  for (ULONG node = 0; node < GetPoolNodeCount(); ++node) {
+    PTP_CALLBACK_ENVIRON environment =
+        &threadInfo->NodeCallbackEnvironments[threadInfo->NodeCount];
+    if (InProcessorGroup && GetPoolNodeProcessorGroup(node) !=
+                                DokanInstance->DokanOptions->ProcessorGroup) {
+      continue;
+    }
+    InitializeThreadpoolEnvironment(environment);
+    SetThreadpoolCallbackPool(environment, GetNodeThreadPool(node));
+    SetThreadpoolCallbackCleanupGroup(environment, threadInfo->CleanupGroup,
+                                      NULL);
+    threadInfo->Nodes[threadInfo->NodeCount++] = node;
+  }
+}
+
+static VOID InitializeInstanceNodes(PDOKAN_INSTANCE DokanInstance) {
+  DOKAN_INSTANCE_THREADINFO *threadInfo = &DokanInstance->ThreadInfo;
+  if (GetPoolNodeCount() == 1 || DokanInstance->DokanOptions->SingleThread) {
+    return;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_PROCESSOR_GROUP) {
+    AddInstanceNodes(DokanInstance, /*InProcessorGroup=*/TRUE);
+    if (threadInfo->NodeCount == 0) {
+      DbgPrintW(L"Dokan Warning: No NUMA node in processor group %lu.\n",
+                DokanInstance->DokanOptions->ProcessorGroup);
+    }
+  }
+  if (threadInfo->NodeCount == 0) {
+    AddInstanceNodes(DokanInstance, /*InProcessorGroup=*/FALSE);
+  }
+  threadInfo->ThreadPool = GetNodeThreadPool(threadInfo->Nodes[0]);
+  SetThreadpoolCallbackPool(&threadInfo->CallbackEnvironment,
+                            threadInfo->ThreadPool);
+  DbgPrintW(L"Dokan: Processing events on %lu NUMA nodes\n",
+            threadInfo->NodeCount);
+}
+
+PTP_CALLBACK_ENVIRON GetNodeCallbackEnvironment(PDOKAN_INSTANCE DokanInstance,
+                                                PULONG Node) {
+  DOKAN_INSTANCE_THREADINFO *threadInfo = &DokanInstance->ThreadInfo;
+  for (ULONG i = 0; i < threadInfo->NodeCount; ++i) {
+    if (threadInfo->Nodes[i] == *Node) {
+      return &threadInfo->NodeCallbackEnvironments[i];
+    }
+  }
+  // CallbackEnvironment is on the pool of the first node of the instance, or
+  // of the system.
+  *Node = threadInfo->NodeCount > 0 ? threadInfo->Nodes[0] : 0;
+  return &threadInfo->CallbackEnvironment;
+}
+
+// Queues IoEvent to a thread pool of node IoEvent->Node.
+static VOID QueueIoEventToNode(PDOKAN_IO_EVENT IoEvent,
+                               PTP_WORK_CALLBACK Callback) {
   PTP_WORK work = CreateThreadpoolWork(
       Callback, IoEvent,
-      &IoEvent->DokanInstance->ThreadInfo.CallbackEnvironment);
+      GetNodeCallbackEnvironment(IoEvent->DokanInstance, &IoEvent->Node));
   if (!work) {
     DWORD lastError = GetLastError();
     DbgPrintW(L"Dokan Error: CreateThreadpoolWork() has returned error "
@@ -410,11 +665,26 @@ VOID QueueIoEvent(PDOKAN_IO_EVENT IoEvent, PTP_WORK_CALLBACK Callback) {
   SubmitThreadpoolWork(work);
 }
 
+VOID QueueIoEvent(PDOKAN_IO_EVENT IoEvent, PTP_WORK_CALLBACK Callback) {
+  // Events stay on the node of the thread that pulled them.
+  IoEvent->Node = GetCurrentPoolNode();
+  if (IoEvent->DokanInstance->Metrics) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    IoEvent->QueuedTime = now.QuadPart;
+  }
+  QueueIoEventToNode(IoEvent, Callback);
+}
+
 DWORD
-GetEventInfoSize(__in ULONG MajorFunction, __in PEVENT_INFORMATION EventInfo) {
-  if (MajorFunction == IRP_MJ_WRITE) {
-    // For writes only, the reply is a fixed size and the BufferLength inside it
-    // is the "bytes written" value as opposed to the reply size.
+GetEventInfoSize(__in PEVENT_CONTEXT EventContext,
+                 __in PEVENT_INFORMATION EventInfo) {
+  if (EventContext->MajorFunction == IRP_MJ_WRITE ||
+      (EventContext->MajorFunction == IRP_MJ_READ &&
+       EventContext->Operation.Read.MappedBuffer)) {
+    // For writes and zero-copy reads, the reply is a fixed size and the
+    // BufferLength inside it is the "bytes written" or "bytes read" value as
+    // opposed to the reply size.
     return sizeof(EVENT_INFORMATION);
   }
   return (DWORD)max((ULONG)sizeof(EVENT_INFORMATION),
@@ -438,7 +708,7 @@ DWORD SendAndPullEventInformation(PDOKAN_IO_EVENT IoEvent,
     eventInfoPollAllocated = IoEvent->PoolAllocated;
     inputBuffer = (PCHAR)eventInfo;
     eventInfoSize =
-        GetEventInfoSize(IoEvent->EventContext->MajorFunction, eventInfo);
+        GetEventInfoSize(IoEvent->EventContext, eventInfo);
     eventInfo->PullEventTimeoutMs =
         IoBatch->MainPullThread ? /*infinite*/ 0 : DOKAN_PULL_EVENT_TIMEOUT_MS;
     if (ReleaseBatchBuffers) {
@@ -460,7 +730,7 @@ DWORD SendAndPullEventInformation(PDOKAN_IO_EVENT IoEvent,
           inputBuffer,                    // Input Buffer to driver.
           eventInfoSize,                  // Length of input buffer in bytes.
           &IoBatch->EventContext[0],      // Output Buffer from driver.
-          BATCH_EVENT_CONTEXT_SIZE,       // Length of output buffer in bytes.
+          IoBatch->EventContextSize,      // Length of output buffer in bytes.
           &IoBatch->NumberOfBytesTransferred, // Bytes placed in buffer.
           NULL                                // asynchronous call
           )) {
@@ -482,6 +752,174 @@ DWORD SendAndPullEventInformation(PDOKAN_IO_EVENT IoEvent,
   return 0;
 }
 
+// Sends an event result without pulling new events. No output buffer is given
+// so the driver completes it without waiting for new events.
+DWORD SendEventInformation(PDOKAN_IO_EVENT IoEvent) {
+  DWORD bytesReturned = 0;
+  PEVENT_INFORMATION eventInfo = IoEvent->EventResult;
+  eventInfo->PullEventTimeoutMs = 0;
+  if (!DeviceIoControl(
+          IoEvent->DokanInstance->Device, FSCTL_EVENT_PROCESS_N_PULL,
+          eventInfo,
+          GetEventInfoSize(IoEvent->EventContext, eventInfo),
+          NULL, 0, &bytesReturned, NULL)) {
+    DWORD lastError = GetLastError();
+    if (!IoEvent->DokanInstance->FileSystemStopped) {
+      DokanDbgPrintW(
+          L"Dokan Error: Dokan device result ioctl failed with code %d.\n",
+          lastError);
+    }
+    return lastError;
+  }
+  return 0;
+}
+
+// Asynchronous completion.
+//
+// With DOKAN_OPTION_ASYNC_OPERATIONS, the dispatch functions that support it
+// give the event two references before calling the callback, one for
+// themselves and one for DokanCompleteOperation. When the callback returns
+// STATUS_PENDING, the dispatching thread drops its reference and moves on to
+// other events, unless DokanCompleteOperation already ran, in which case the
+// event is sent as if it had completed synchronously. Otherwise the later call
+// to DokanCompleteOperation sends the result and releases the event and its
+// batch.
+
+BOOL PrepareAsyncCompletion(PDOKAN_IO_EVENT IoEvent,
+                            PDOKAN_ASYNC_COMPLETION Completion,
+                            PVOID Context) {
+  if (!(IoEvent->DokanInstance->DokanOptions->Options &
+        DOKAN_OPTION_ASYNC_OPERATIONS)) {
+    return FALSE;
+  }
+  IoEvent->AsyncCompletion = Completion;
+  IoEvent->AsyncContext = Context;
+  IoEvent->AsyncReferences = 2;
+  return TRUE;
+}
+
+// Called by the dispatch function when the callback returned STATUS_PENDING.
+// Returns whether the operation is still pending.
+BOOL ReleaseAsyncDispatchReference(PDOKAN_IO_EVENT IoEvent) {
+  return InterlockedDecrement(&IoEvent->AsyncReferences) != 0;
+}
+
+// Sends the result of an event completed after its dispatch returned and
+// releases the event.
+static VOID SendAsyncEventResult(PDOKAN_IO_EVENT IoEvent) {
+  PDOKAN_INSTANCE dokanInstance = IoEvent->DokanInstance;
+  DWORD error = 0;
+  if (!PostEventRingCompletion(
+          dokanInstance, IoEvent->EventResult,
+          GetEventInfoSize(IoEvent->EventContext, IoEvent->EventResult))) {
+    error = SendEventInformation(IoEvent);
+  }
+  FreeIoEventResult(IoEvent->EventResult, IoEvent->EventResultSize,
+                    IoEvent->PoolAllocated);
+  PushIoBatchBuffer(IoEvent->IoBatch);
+  PushIoEventBuffer(IoEvent);
+  if (error) {
+    OnDeviceIoCtlFailed(dokanInstance, error);
+  }
+}
+
+VOID DOKANAPI DokanCompleteOperation(PDOKAN_FILE_INFO DokanFileInfo,
+                                     NTSTATUS Status, ULONG Information) {
+  PDOKAN_IO_EVENT ioEvent =
+      CONTAINING_RECORD(DokanFileInfo, DOKAN_IO_EVENT, DokanFileInfo);
+  assert(ioEvent->AsyncCompletion);
+  ioEvent->AsyncCompletion(ioEvent, Status, Information);
+  // Otherwise the dispatching thread is still to send the result.
+  if (InterlockedDecrement(&ioEvent->AsyncReferences) == 0) {
+    PDOKAN_INSTANCE dokanInstance = ioEvent->DokanInstance;
+    DOKAN_TRACE_DISPATCH_STOP(ioEvent->EventContext->SerialNumber,
+                              ioEvent->EventContext->MajorFunction,
+                              ioEvent->EventResult);
+    if (dokanInstance->Recorder) {
+      RecordEventResult(dokanInstance, ioEvent->EventContext->SerialNumber,
+                        ioEvent->EventResult);
+    }
+    if (dokanInstance->Metrics && ioEvent->DispatchStartTime != 0) {
+      RecordDispatchMetrics(dokanInstance->Metrics,
+                            ioEvent->EventContext->MajorFunction,
+                            ioEvent->QueuedTime, ioEvent->DispatchStartTime,
+                            ioEvent->EventResult);
+    }
+    SendAsyncEventResult(ioEvent);
+  }
+}
+
+// Adaptive IPC batching.
+//
+// The size of the buffer pulling a batch doubles when a pull comes back at
+// least half full, as the driver then likely had more to give, and halves when
+// it comes back less than an eighth full or empty. The batch is processed on
+// the pulling thread when the moving average of the event processing time says
+// it will take less than a handoff to the thread pool would cost.
+
+VOID UpdateIpcBatchSize(PDOKAN_INSTANCE DokanInstance, PDOKAN_IO_BATCH IoBatch) {
+  ULONG size = IoBatch->EventContextSize;
+  ULONG newSize = size;
+  if (IoBatch->NumberOfBytesTransferred >= size / 2) {
+    newSize = min(size * 2, DokanInstance->IpcBatchMaxSize);
+  } else if (IoBatch->NumberOfBytesTransferred < size / 8) {
+    newSize = max(size / 2, DokanInstance->IpcBatchMinSize);
+  }
+  if (newSize != size) {
+    InterlockedExchange(&DokanInstance->IpcBatchSize, (LONG)newSize);
+  }
+}
+
+BOOL ShouldDispatchBatchInline(PDOKAN_INSTANCE DokanInstance,
+                               LONG EventCount) {
+  LONG latencyNs = InterlockedAdd(&DokanInstance->IpcBatchEventLatencyNs, 0);
+  return (LONGLONG)latencyNs * EventCount <=
+         (LONGLONG)DOKAN_IPC_BATCH_INLINE_BUDGET_US * 1000;
+}
+
+// DispatchEvent, recording the time it took in the moving average of
+// DokanInstance->IpcBatchEventLatencyNs. Concurrent updates may lose a sample,
+// which does not matter for an estimate. Returns whether the event is pending.
+BOOL DispatchBatchedEvent(PDOKAN_IO_EVENT IoEvent) {
+  PDOKAN_INSTANCE dokanInstance = IoEvent->DokanInstance;
+  LARGE_INTEGER frequency, start, end;
+  BOOL pending;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&start);
+  pending = DispatchEvent(IoEvent);
+  QueryPerformanceCounter(&end);
+  LONG sampleNs = (LONG)min(
+      (end.QuadPart - start.QuadPart) * 1000000000 / frequency.QuadPart,
+      MAXLONG);
+  LONG latencyNs = InterlockedAdd(&dokanInstance->IpcBatchEventLatencyNs, 0);
+  InterlockedExchange(&dokanInstance->IpcBatchEventLatencyNs,
+                      latencyNs + (sampleNs - latencyNs) / 8);
+  return pending;
+}
+
+// Sends the result of a processed event, if it has one, without pulling and
+// releases the event. Returns the error of device IO, if any.
+static DWORD SendAndReleaseEvent(PDOKAN_IO_EVENT IoEvent) {
+  DWORD error = 0;
+  if (IoEvent->EventResult) {
+    error = SendEventInformation(IoEvent);
+    FreeIoEventResult(IoEvent->EventResult, IoEvent->EventResultSize,
+                      IoEvent->PoolAllocated);
+  }
+  PushIoBatchBuffer(IoEvent->IoBatch);
+  PushIoEventBuffer(IoEvent);
+  return error;
+}
+
+// Processes an event of a batch on the pulling thread and sends its result
+// without pulling. Returns the error of device IO, if any.
+DWORD DispatchBatchedEventInline(PDOKAN_IO_EVENT IoEvent) {
+  if (DispatchBatchedEvent(IoEvent)) {
+    return 0;
+  }
+  return SendAndReleaseEvent(IoEvent);
+}
+
 VOID CALLBACK DispatchBatchIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Parameter,
                                PTP_WORK Work) {
   UNREFERENCED_PARAMETER(Instance);
@@ -489,6 +927,7 @@ VOID CALLBACK DispatchBatchIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Para
 
   PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)Parameter;
   assert(ioEvent);
+  BindThreadToPoolNode(ioEvent->Node);
   PDOKAN_INSTANCE dokanInstance = ioEvent->DokanInstance;
   PDOKAN_IO_BATCH ioBatch = NULL;
   BOOL mainPullThread = ioEvent->EventContext == NULL;
@@ -499,21 +938,46 @@ VOID CALLBACK DispatchBatchIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Para
     // - New pool thread that just started with a dispatched event.
     // Note: Main pull thread does not have an EventContext when started.
     if (ioEvent && ioEvent->EventContext) {
-      DispatchEvent(ioEvent);
-      if (!ioEvent->EventResult) {
-        // Some events like Close() do not have event results.
+      BOOL pending = DispatchBatchedEvent(ioEvent);
+      if (pending || !ioEvent->EventResult) {
+        // Some events like Close() do not have event results, and pending
+        // events send theirs when they complete.
         // Release the resource and terminate here unless we are the main pulling thread.
-        PushIoBatchBuffer(ioEvent->IoBatch);
-        PushIoEventBuffer(ioEvent);
+        if (!pending) {
+          PushIoBatchBuffer(ioEvent->IoBatch);
+          PushIoEventBuffer(ioEvent);
+        }
         if (mainPullThread) {
           ioEvent = NULL;
           continue;
         }
         return;
       }
+    } else if (ioEvent) {
+      // The event the main pull thread was started with carries no request.
+      PushIoEventBuffer(ioEvent);
+      ioEvent = NULL;
     }
 
-    ioBatch = PopIoBatchBuffer();
+    // 5 - Main pull threads above the autoscaling target exit once their last
+    // result is sent.
+    if (mainPullThread && RetirePullThread(dokanInstance)) {
+      if (ioEvent) {
+        DWORD error = SendAndReleaseEvent(ioEvent);
+        if (error) {
+          OnDeviceIoCtlFailed(dokanInstance, error);
+        }
+      }
+      return;
+    }
+
+    ioBatch = AllocateIoBatchBuffer(
+        (ULONG)InterlockedAdd(&dokanInstance->IpcBatchSize, 0));
+    if (!ioBatch) {
+      DbgPrintW(L"Dokan Error: IoBatch allocation failed.\n");
+      OnDeviceIoCtlFailed(dokanInstance, ERROR_OUTOFMEMORY);
+      return;
+    }
     ioBatch->MainPullThread = mainPullThread;
     ioBatch->DokanInstance = dokanInstance;
 
@@ -523,6 +987,7 @@ VOID CALLBACK DispatchBatchIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Para
       HandleProcessIoFatalError(dokanInstance, ioBatch, error);
       return;
     }
+    UpdateIpcBatchSize(dokanInstance, ioBatch);
 
     // 2 - Terminate thread as nothing needs to be proceed unless we are the mainPullThread.
     if (!ioBatch->NumberOfBytesTransferred) {
@@ -545,6 +1010,8 @@ VOID CALLBACK DispatchBatchIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Para
     // 3 - Dispatch Events
     context = ioBatch->EventContext;
     LONG eventContextBatchCount = ioBatch->EventContextBatchCount;
+    BOOL dispatchInline =
+        ShouldDispatchBatchInline(dokanInstance, eventContextBatchCount);
     while (eventContextBatchCount) {
       ioEvent = PopIoEventBuffer();
       if (!ioEvent) {
@@ -559,9 +1026,18 @@ VOID CALLBACK DispatchBatchIoCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Para
       // It is unsafe to access the context from here after Queuing the event.
       context = (PEVENT_CONTEXT)((PCHAR)(context) + context->Length);
       // 4 - All batched events are dispatched to the thread pool except the last event that is executed on the current thread.
+      // Quick batches are entirely executed on the current thread instead.
       // Note: Single thread mode has batching disabled and therefore only has one event which is executed on the main thread.
       if (eventContextBatchCount) {
-        QueueIoEvent(ioEvent, DispatchBatchIoCallback);
+        if (dispatchInline) {
+          error = DispatchBatchedEventInline(ioEvent);
+          if (error) {
+            OnDeviceIoCtlFailed(dokanInstance, error);
+            return;
+          }
+        } else {
+          QueueIoEvent(ioEvent, DispatchBatchIoCallback);
+        }
       }
     }
   }
@@ -574,6 +1050,7 @@ VOID CALLBACK DispatchDedicatedIoCallback(PTP_CALLBACK_INSTANCE Instance,
 
   PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)Parameter;
   assert(ioEvent);
+  BindThreadToPoolNode(ioEvent->Node);
   PDOKAN_IO_BATCH ioBatch = PopIoBatchBuffer();
   ioBatch->MainPullThread = TRUE;
   ioBatch->DokanInstance = ioEvent->DokanInstance;
@@ -597,8 +1074,484 @@ VOID CALLBACK DispatchDedicatedIoCallback(PTP_CALLBACK_INSTANCE Instance,
     if (!ioBatch->NumberOfBytesTransferred) {
       continue;
     }
-    // 3 - Process event
-    DispatchEvent(ioEvent);
+    // 3 - Process event, and exit once its result is sent if the autoscaling
+    // retires the thread.
+    if (!DispatchEvent(ioEvent)) {
+      if (RetirePullThread(ioBatch->DokanInstance)) {
+        PDOKAN_INSTANCE dokanInstance = ioBatch->DokanInstance;
+        error = SendAndReleaseEvent(ioEvent);
+        if (error) {
+          OnDeviceIoCtlFailed(dokanInstance, error);
+        }
+        return;
+      }
+    } else {
+      // The pending event keeps its batch until it completes.
+      PDOKAN_INSTANCE dokanInstance = ioBatch->DokanInstance;
+      ioBatch = PopIoBatchBuffer();
+      ioEvent = PopIoEventBuffer();
+      if (!ioBatch || !ioEvent) {
+        DbgPrintW(L"Dokan Error: IoEvent allocation failed.\n");
+        if (ioBatch) {
+          PushIoBatchBuffer(ioBatch);
+        }
+        if (ioEvent) {
+          PushIoEventBuffer(ioEvent);
+        }
+        OnDeviceIoCtlFailed(dokanInstance, ERROR_OUTOFMEMORY);
+        return;
+      }
+      ioBatch->MainPullThread = TRUE;
+      ioBatch->DokanInstance = dokanInstance;
+      ioEvent->DokanInstance = dokanInstance;
+      ioEvent->EventContext = ioBatch->EventContext;
+      ioEvent->IoBatch = ioBatch;
+    }
+  }
+}
+
+VOID CALLBACK DispatchEventRingIoCallback(PTP_CALLBACK_INSTANCE Instance,
+                                          PVOID Parameter, PTP_WORK Work) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Work);
+
+  PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)Parameter;
+  assert(ioEvent);
+  BindThreadToPoolNode(ioEvent->Node);
+  PDOKAN_INSTANCE dokanInstance = ioEvent->DokanInstance;
+  HANDLE waitHandles[2] = {dokanInstance->EventRingSubmissionEvent,
+                           dokanInstance->DeviceClosedWaitHandle};
+  PushIoEventBuffer(ioEvent);
+
+  while (TRUE) {
+    // 1 - Take the next event posted by the driver or wait for one.
+    PDOKAN_IO_BATCH ioBatch = PopEventRingSubmission(dokanInstance);
+    if (!ioBatch) {
+      if (WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE) !=
+          WAIT_OBJECT_0) {
+        return;
+      }
+      continue;
+    }
+    // The submission event is auto-reset and only set once for a burst of
+    // events, so pass it on to another ring thread if there are more.
+    if (HasEventRingSubmission(dokanInstance)) {
+      SetEvent(dokanInstance->EventRingSubmissionEvent);
+    }
+
+    // 2 - Process event
+    ioEvent = PopIoEventBuffer();
+    if (!ioEvent) {
+      DbgPrintW(L"Dokan Error: IoEvent allocation failed.\n");
+      PushIoBatchBuffer(ioBatch);
+      OnDeviceIoCtlFailed(dokanInstance, ERROR_OUTOFMEMORY);
+      return;
+    }
+    ioEvent->DokanInstance = dokanInstance;
+    ioEvent->EventContext = ioBatch->EventContext;
+    ioEvent->IoBatch = ioBatch;
+    if (DispatchEvent(ioEvent)) {
+      continue;
+    }
+
+    // 3 - Send the result through the completion ring when it fits.
+    DWORD error = 0;
+    if (ioEvent->EventResult) {
+      if (!PostEventRingCompletion(
+              dokanInstance, ioEvent->EventResult,
+              GetEventInfoSize(ioEvent->EventContext, ioEvent->EventResult))) {
+        error = SendEventInformation(ioEvent);
+      }
+      FreeIoEventResult(ioEvent->EventResult, ioEvent->EventResultSize,
+                        ioEvent->PoolAllocated);
+    }
+    PushIoBatchBuffer(ioBatch);
+    PushIoEventBuffer(ioEvent);
+    if (error) {
+      OnDeviceIoCtlFailed(dokanInstance, error);
+      return;
+    }
+  }
+}
+
+BOOL QueueMainPullThread(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_IO_EVENT ioEvent = PopIoEventBuffer();
+  DOKAN_INSTANCE_THREADINFO *threadInfo = &DokanInstance->ThreadInfo;
+  LONG index;
+  if (!ioEvent) {
+    DokanDbgPrintW(L"Dokan Error: IoEvent allocation failed.");
+    return FALSE;
+  }
+  ioEvent->DokanInstance = DokanInstance;
+  // The main pull threads are spread over the nodes of the instance.
+  index = InterlockedIncrement(&DokanInstance->PullThreadsStarted) - 1;
+  if (threadInfo->NodeCount > 0) {
+    ioEvent->Node = threadInfo->Nodes[(ULONG)index % threadInfo->NodeCount];
+  }
+  InterlockedIncrement(&DokanInstance->PullThreadCount);
+  QueueIoEventToNode(ioEvent, (DokanInstance->DokanOptions->Options &
+                               DOKAN_OPTION_ALLOW_IPC_BATCHING)
+                                  ? DispatchBatchIoCallback
+                                  : DispatchDedicatedIoCallback);
+  return TRUE;
+}
+
+// Overlapped pulls.
+//
+// With DOKAN_OPTION_OVERLAPPED_PULL or DOKAN_OPTION_SHARED_DISPATCH, the
+// events of a mount are not pulled by main pull threads blocked in the driver.
+// The mount keeps PullQueueDepth FSCTL_EVENT_PULL_ASYNC pending on a handle
+// bound to a completion port, which the driver completes once it has events,
+// and whichever thread waiting on the port takes a completion processes the
+// batch. How many pulls wait in the driver is then unrelated to how many
+// threads there are. The port is the mount's own with
+// DOKAN_OPTION_OVERLAPPED_PULL, with MinThreads threads. With
+// DOKAN_OPTION_SHARED_DISPATCH it is a single one for all the mounts of the
+// process using that option, whose threads wait for all of them at once.
+//
+// A batch is processed by the thread that took it when it is quick, or its
+// events are handed to the thread pool of the mount otherwise, and only then
+// is the mount pulled again. A mount therefore never takes more than
+// PullQueueDepth of the shared threads however busy it is, and an idle one
+// takes none.
+
+static DOKAN_PULL_PORT g_SharedPullPort;
+// Guards g_SharedPullPort, which is started with the first instance using it
+// and stopped with the last one.
+static SRWLOCK g_SharedPullPortLock = SRWLOCK_INIT;
+static ULONG g_SharedPullPortInstances;
+
+static VOID ReleasePullReference(PDOKAN_INSTANCE DokanInstance) {
+  if (InterlockedDecrement(&DokanInstance->PullReferences) == 0) {
+    SetEvent(DokanInstance->PullIdleEvent);
+  }
+}
+
+// Pends a pull of the instance on its port. Returns the error of device IO,
+// if any.
+static DWORD PostOverlappedPull(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_IO_BATCH ioBatch;
+  DWORD error;
+
+  if (InterlockedAdd(&DokanInstance->PullStopping, 0)) {
+    return ERROR_OPERATION_ABORTED;
+  }
+  ioBatch = AllocateIoBatchBuffer(
+      (ULONG)InterlockedAdd(&DokanInstance->IpcBatchSize, 0));
+  if (!ioBatch) {
+    DbgPrintW(L"Dokan Error: IoBatch allocation failed.\n");
+    return ERROR_OUTOFMEMORY;
+  }
+  ioBatch->MainPullThread = TRUE;
+  ioBatch->DokanInstance = DokanInstance;
+  InterlockedIncrement(&DokanInstance->PullReferences);
+  if (!DeviceIoControl(DokanInstance->PullDevice, FSCTL_EVENT_PULL_ASYNC, NULL,
+                       0, &ioBatch->EventContext[0], ioBatch->EventContextSize,
+                       NULL, &ioBatch->Overlapped)) {
+    error = GetLastError();
+    if (error != ERROR_IO_PENDING) {
+      if (!DokanInstance->FileSystemStopped) {
+        DokanDbgPrintW(L"Dokan Error: Dokan device pull ioctl failed with "
+                       L"code %d.\n",
+                       error);
+      }
+      PushIoBatchBuffer(ioBatch);
+      ReleasePullReference(DokanInstance);
+      return error;
+    }
+  }
+  return 0;
+}
+
+VOID CALLBACK DispatchOverlappedIoCallback(PTP_CALLBACK_INSTANCE Instance,
+                                           PVOID Parameter, PTP_WORK Work) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Work);
+
+  PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)Parameter;
+  assert(ioEvent);
+  BindThreadToPoolNode(ioEvent->Node);
+  PDOKAN_INSTANCE dokanInstance = ioEvent->DokanInstance;
+  DWORD error = DispatchBatchedEventInline(ioEvent);
+  if (error) {
+    OnDeviceIoCtlFailed(dokanInstance, error);
+  }
+}
+
+// Processes the events of a batch pulled through a port, or hands them to the
+// thread pool of the instance if that would take too long. Returns the error
+// of device IO, if any.
+static DWORD DispatchOverlappedBatch(PDOKAN_IO_BATCH IoBatch) {
+  PDOKAN_INSTANCE dokanInstance = IoBatch->DokanInstance;
+  PEVENT_CONTEXT context = IoBatch->EventContext;
+  ULONG_PTR currentNumberOfBytesTransferred = IoBatch->NumberOfBytesTransferred;
+  LONG eventContextBatchCount;
+  BOOL dispatchInline;
+  DWORD error;
+
+  if (!currentNumberOfBytesTransferred) {
+    PushIoBatchBuffer(IoBatch);
+    return 0;
+  }
+  while (currentNumberOfBytesTransferred) {
+    ++IoBatch->EventContextBatchCount;
+    currentNumberOfBytesTransferred -= context->Length;
+    context = (PEVENT_CONTEXT)((PCHAR)(context) + context->Length);
+  }
+  context = IoBatch->EventContext;
+  eventContextBatchCount = IoBatch->EventContextBatchCount;
+  dispatchInline =
+      ShouldDispatchBatchInline(dokanInstance, eventContextBatchCount);
+  while (eventContextBatchCount) {
+    PDOKAN_IO_EVENT ioEvent = PopIoEventBuffer();
+    if (!ioEvent) {
+      DbgPrintW(L"Dokan Error: IoEvent allocation failed.\n");
+      return ERROR_OUTOFMEMORY;
+    }
+    ioEvent->DokanInstance = dokanInstance;
+    ioEvent->EventContext = context;
+    ioEvent->IoBatch = IoBatch;
+    --eventContextBatchCount;
+    // It is unsafe to access the context from here after dispatching the
+    // event.
+    context = (PEVENT_CONTEXT)((PCHAR)(context) + context->Length);
+    if (dispatchInline) {
+      error = DispatchBatchedEventInline(ioEvent);
+      if (error) {
+        return error;
+      }
+    } else {
+      QueueIoEvent(ioEvent, DispatchOverlappedIoCallback);
+    }
+  }
+  return 0;
+}
+
+// A thread of a pull port, taking the pulls completed on the port.
+static VOID CALLBACK PullPortCallback(PTP_CALLBACK_INSTANCE Instance,
+                                      PVOID Parameter, PTP_WORK Work) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Work);
+
+  HANDLE port = (HANDLE)Parameter;
+  DWORD numberOfBytesTransferred;
+  ULONG_PTR completionKey;
+  LPOVERLAPPED overlapped;
+
+  while (TRUE) {
+    BOOL succeeded =
+        GetQueuedCompletionStatus(port, &numberOfBytesTransferred,
+                                  &completionKey, &overlapped, INFINITE);
+    DWORD error = succeeded ? 0 : GetLastError();
+    // Only the packets posted to stop the threads come without a pull.
+    if (!overlapped) {
+      return;
+    }
+    PDOKAN_IO_BATCH ioBatch =
+        CONTAINING_RECORD(overlapped, DOKAN_IO_BATCH, Overlapped);
+    PDOKAN_INSTANCE dokanInstance = ioBatch->DokanInstance;
+    if (error) {
+      if (!dokanInstance->FileSystemStopped) {
+        DokanDbgPrintW(L"Dokan Error: Dokan device pull ioctl failed with "
+                       L"code %d.\n",
+                       error);
+      }
+      PushIoBatchBuffer(ioBatch);
+    } else {
+      ioBatch->NumberOfBytesTransferred = numberOfBytesTransferred;
+      if (dokanInstance->DokanOptions->Options &
+          DOKAN_OPTION_ALLOW_IPC_BATCHING) {
+        UpdateIpcBatchSize(dokanInstance, ioBatch);
+      }
+      error = DispatchOverlappedBatch(ioBatch);
+    }
+    // Pulling again only now keeps the instance within PullQueueDepth threads.
+    if (!error) {
+      error = PostOverlappedPull(dokanInstance);
+    }
+    if (error) {
+      OnDeviceIoCtlFailed(dokanInstance, error);
+    }
+    ReleasePullReference(dokanInstance);
+  }
+}
+
+// Creates the completion port of PullPort and starts ThreadCount threads
+// waiting on it in Pool.
+static BOOL StartPullPort(PDOKAN_PULL_PORT PullPort, PTP_POOL Pool,
+                          ULONG ThreadCount) {
+  TP_CALLBACK_ENVIRON environment;
+
+  PullPort->Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+  if (!PullPort->Port) {
+    DokanDbgPrintW(L"Dokan Error: CreateIoCompletionPort failed: %d\n",
+                   GetLastError());
+    return FALSE;
+  }
+  InitializeThreadpoolEnvironment(&environment);
+  SetThreadpoolCallbackPool(&environment, Pool);
+  SetThreadpoolCallbackRunsLong(&environment);
+  PullPort->Work =
+      CreateThreadpoolWork(PullPortCallback, PullPort->Port, &environment);
+  DestroyThreadpoolEnvironment(&environment);
+  if (!PullPort->Work) {
+    DokanDbgPrintW(L"Dokan Error: CreateThreadpoolWork failed: %d\n",
+                   GetLastError());
+    CloseHandle(PullPort->Port);
+    PullPort->Port = NULL;
+    return FALSE;
+  }
+  for (ULONG i = 0; i < ThreadCount; ++i) {
+    SubmitThreadpoolWork(PullPort->Work);
+  }
+  PullPort->ThreadCount = ThreadCount;
+  return TRUE;
+}
+
+static VOID StopPullPort(PDOKAN_PULL_PORT PullPort) {
+  if (!PullPort->Port) {
+    return;
+  }
+  for (ULONG i = 0; i < PullPort->ThreadCount; ++i) {
+    PostQueuedCompletionStatus(PullPort->Port, 0, 0, NULL);
+  }
+  WaitForThreadpoolWorkCallbacks(PullPort->Work, FALSE);
+  CloseThreadpoolWork(PullPort->Work);
+  PullPort->Work = NULL;
+  CloseHandle(PullPort->Port);
+  PullPort->Port = NULL;
+  PullPort->ThreadCount = 0;
+}
+
+// Binds Device to the shared port, starting it with the first instance.
+static BOOL BindSharedPullPort(HANDLE Device) {
+  BOOL bound = TRUE;
+  AcquireSRWLockExclusive(&g_SharedPullPortLock);
+  if (g_SharedPullPortInstances == 0) {
+    // One thread per processor of the system, within the main pull thread
+    // bounds.
+    ULONG threadCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+    threadCount = min(max(threadCount, DOKAN_MAIN_PULL_THREAD_COUNT_MIN),
+                      DOKAN_MAIN_PULL_THREAD_COUNT_MAX);
+    bound = StartPullPort(&g_SharedPullPort, GetThreadPool(), threadCount);
+    if (bound) {
+      DbgPrintW(L"Dokan: Started %lu shared dispatch threads\n", threadCount);
+    }
+  }
+  if (bound && !CreateIoCompletionPort(Device, g_SharedPullPort.Port, 0, 0)) {
+    DokanDbgPrintW(L"Dokan Error: CreateIoCompletionPort failed to bind the "
+                   L"device: %d\n",
+                   GetLastError());
+    if (g_SharedPullPortInstances == 0) {
+      StopPullPort(&g_SharedPullPort);
+    }
+    bound = FALSE;
+  }
+  if (bound) {
+    ++g_SharedPullPortInstances;
+  }
+  ReleaseSRWLockExclusive(&g_SharedPullPortLock);
+  return bound;
+}
+
+static VOID UnbindSharedPullPort() {
+  AcquireSRWLockExclusive(&g_SharedPullPortLock);
+  if (--g_SharedPullPortInstances == 0) {
+    StopPullPort(&g_SharedPullPort);
+  }
+  ReleaseSRWLockExclusive(&g_SharedPullPortLock);
+}
+
+BOOL StartOverlappedPulls(PDOKAN_INSTANCE DokanInstance, ULONG ThreadCount) {
+  PDOKAN_OPTIONS options = DokanInstance->DokanOptions;
+  BOOL shared = (options->Options & DOKAN_OPTION_SHARED_DISPATCH) != 0;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG depth;
+  HANDLE device;
+
+  if (shared) {
+    depth = options->SharedDispatchQuota
+                ? min(options->SharedDispatchQuota,
+                      DOKAN_SHARED_DISPATCH_QUOTA_MAX)
+                : DOKAN_SHARED_DISPATCH_DEFAULT_QUOTA;
+  } else {
+    depth = options->PullQueueDepth
+                ? min(options->PullQueueDepth, DOKAN_PULL_QUEUE_DEPTH_MAX)
+                : min(ThreadCount * 2, DOKAN_PULL_QUEUE_DEPTH_MAX);
+  }
+  DokanInstance->PullQueueDepth = depth;
+  DokanInstance->PullReferences = 1;
+  DokanInstance->PullIdleEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (!DokanInstance->PullIdleEvent) {
+    return FALSE;
+  }
+  GetRawDeviceName(DokanInstance->DeviceName, rawDeviceName, MAX_PATH);
+  device = CreateFile(rawDeviceName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                      NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+  if (device == INVALID_HANDLE_VALUE) {
+    DokanDbgPrintW(L"Dokan Error: CreatFile failed to open %s: %d\n",
+                   rawDeviceName, GetLastError());
+    return FALSE;
+  }
+
+  if (shared) {
+    if (!BindSharedPullPort(device)) {
+      CloseHandle(device);
+      return FALSE;
+    }
+    DokanInstance->PullPort = &g_SharedPullPort;
+  } else {
+    if (!StartPullPort(&DokanInstance->OwnPullPort,
+                       DokanInstance->ThreadInfo.ThreadPool, ThreadCount)) {
+      CloseHandle(device);
+      return FALSE;
+    }
+    DokanInstance->PullPort = &DokanInstance->OwnPullPort;
+    if (!CreateIoCompletionPort(device, DokanInstance->OwnPullPort.Port, 0,
+                                0)) {
+      DokanDbgPrintW(L"Dokan Error: CreateIoCompletionPort failed to bind "
+                     L"%s: %d\n",
+                     rawDeviceName, GetLastError());
+      CloseHandle(device);
+      return FALSE;
+    }
+  }
+  DokanInstance->PullDevice = device;
+
+  for (ULONG i = 0; i < depth; ++i) {
+    if (PostOverlappedPull(DokanInstance)) {
+      return FALSE;
+    }
+  }
+  DbgPrintW(L"Dokan: Using %lu overlapped pulls on %s with ipc batching: %d\n",
+            depth, shared ? L"the shared threads" : L"threads of the mount",
+            (options->Options & DOKAN_OPTION_ALLOW_IPC_BATCHING) != 0);
+  return TRUE;
+}
+
+VOID StopOverlappedPulls(PDOKAN_INSTANCE DokanInstance) {
+  if (DokanInstance->PullDevice) {
+    InterlockedExchange(&DokanInstance->PullStopping, TRUE);
+    ReleasePullReference(DokanInstance);
+    // A pull issued by a port thread while this runs is canceled on the next
+    // round.
+    do {
+      CancelIoEx(DokanInstance->PullDevice, NULL);
+    } while (WaitForSingleObject(DokanInstance->PullIdleEvent,
+                                 DOKAN_PULL_CANCEL_INTERVAL_MS) ==
+             WAIT_TIMEOUT);
+    CloseHandle(DokanInstance->PullDevice);
+    DokanInstance->PullDevice = NULL;
+  }
+  if (DokanInstance->PullPort == &g_SharedPullPort) {
+    UnbindSharedPullPort();
+  } else {
+    StopPullPort(&DokanInstance->OwnPullPort);
+  }
+  DokanInstance->PullPort = NULL;
+  if (DokanInstance->PullIdleEvent) {
+    CloseHandle(DokanInstance->PullIdleEvent);
+    DokanInstance->PullIdleEvent = NULL;
   }
 }
 
@@ -653,6 +1606,317 @@ VOID DOKANAPI DokanCloseHandle(_In_ DOKAN_HANDLE DokanInstance) {
   LeaveCriticalSection(&g_InstanceCriticalSection);
 }
 
+typedef struct _DOKAN_CLOSE_HANDLE_WORK {
+  DOKAN_HANDLE DokanInstance;
+  PDOKAN_CLOSE_HANDLE_CALLBACK Callback;
+  PVOID Context;
+} DOKAN_CLOSE_HANDLE_WORK, *PDOKAN_CLOSE_HANDLE_WORK;
+
+static VOID CALLBACK CloseHandleWork(_Inout_ PTP_CALLBACK_INSTANCE Instance,
+                                     _Inout_opt_ PVOID Context) {
+  PDOKAN_CLOSE_HANDLE_WORK work = Context;
+  UNREFERENCED_PARAMETER(Instance);
+  DokanCloseHandle(work->DokanInstance);
+  if (work->Callback) {
+    work->Callback(work->Context);
+  }
+  free(work);
+}
+
+BOOL DOKANAPI DokanCloseHandleAsync(_In_ DOKAN_HANDLE DokanInstance,
+                                    _In_opt_ PDOKAN_CLOSE_HANDLE_CALLBACK Callback,
+                                    _In_opt_ PVOID Context) {
+  PDOKAN_CLOSE_HANDLE_WORK work;
+  if (!DokanInstance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  work = malloc(sizeof(DOKAN_CLOSE_HANDLE_WORK));
+  if (work == NULL) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  work->DokanInstance = DokanInstance;
+  work->Callback = Callback;
+  work->Context = Context;
+  // The default pool, as the thread pool of the instance is released by it.
+  if (!TrySubmitThreadpoolCallback(CloseHandleWork, work, NULL)) {
+    DbgPrintW(L"Failed to submit the unmount work: %lu\n", GetLastError());
+    free(work);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL DOKANAPI DokanGetVolumeMetrics(_In_ DOKAN_HANDLE DokanInstance,
+                                    _Out_ PVOLUME_METRICS_EX Metrics) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  if (!instance || !Metrics) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  ZeroMemory(Metrics, sizeof(VOLUME_METRICS_EX));
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  if (!SendToDevice(rawDeviceName, FSCTL_GET_VOLUME_METRICS_EX, NULL, 0,
+                    Metrics, sizeof(VOLUME_METRICS_EX), &returnedLength)) {
+    DbgPrintW(L"Failed to get the volume metrics of %s\n",
+              instance->DeviceName);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL DOKANAPI DokanSetDispatchHooks(_In_ DOKAN_HANDLE DokanInstance,
+                                    _In_opt_ PDOKAN_DISPATCH_HOOKS Hooks) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  if (!instance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  InterlockedExchangePointer((PVOID volatile *)&instance->DispatchHooks,
+                             Hooks);
+  return TRUE;
+}
+
+// Replaces the answer to FsInformationClass queries cached by the driver with
+// the Length bytes of Buffer, or drops it if Length is 0.
+static BOOL SendVolumeInfoUpdate(DOKAN_INSTANCE *Instance,
+                                 FS_INFORMATION_CLASS FsInformationClass,
+                                 PVOID Buffer, ULONG Length) {
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  ULONG updateLength =
+      FIELD_OFFSET(DOKAN_VOLUME_INFO_UPDATE, Buffer[0]) + Length;
+  PDOKAN_VOLUME_INFO_UPDATE update = NULL;
+  BOOL result;
+
+  update = malloc(updateLength);
+  if (!update) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  update->FsInformationClass = FsInformationClass;
+  update->Length = Length;
+  if (Length > 0) {
+    memcpy_s(update->Buffer, Length, Buffer, Length);
+  }
+  GetRawDeviceName(Instance->DeviceName, rawDeviceName, MAX_PATH);
+  result = SendToDevice(rawDeviceName, FSCTL_UPDATE_VOLUME_INFO, update,
+                        updateLength, NULL, 0, &returnedLength);
+  if (!result) {
+    DbgPrintW(L"Failed to update the volume information of %s\n",
+              Instance->DeviceName);
+  }
+  free(update);
+  return result;
+}
+
+BOOL DOKANAPI DokanUpdateDiskFreeSpace(_In_ DOKAN_HANDLE DokanInstance,
+                                       ULONGLONG FreeBytesAvailable,
+                                       ULONGLONG TotalNumberOfBytes,
+                                       ULONGLONG TotalNumberOfFreeBytes) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  FILE_FS_SIZE_INFORMATION sizeInfo;
+  FILE_FS_FULL_SIZE_INFORMATION fullSizeInfo;
+  ULONG allocationUnitSize;
+  ULONG sectorSize;
+  if (!instance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  allocationUnitSize = instance->DokanOptions->AllocationUnitSize;
+  sectorSize = instance->DokanOptions->SectorSize;
+
+  ZeroMemory(&sizeInfo, sizeof(FILE_FS_SIZE_INFORMATION));
+  sizeInfo.TotalAllocationUnits.QuadPart =
+      TotalNumberOfBytes / allocationUnitSize;
+  sizeInfo.AvailableAllocationUnits.QuadPart =
+      FreeBytesAvailable / allocationUnitSize;
+  sizeInfo.SectorsPerAllocationUnit = allocationUnitSize / sectorSize;
+  sizeInfo.BytesPerSector = sectorSize;
+
+  ZeroMemory(&fullSizeInfo, sizeof(FILE_FS_FULL_SIZE_INFORMATION));
+  fullSizeInfo.TotalAllocationUnits.QuadPart =
+      TotalNumberOfBytes / allocationUnitSize;
+  fullSizeInfo.ActualAvailableAllocationUnits.QuadPart =
+      TotalNumberOfFreeBytes / allocationUnitSize;
+  fullSizeInfo.CallerAvailableAllocationUnits.QuadPart =
+      FreeBytesAvailable / allocationUnitSize;
+  fullSizeInfo.SectorsPerAllocationUnit = allocationUnitSize / sectorSize;
+  fullSizeInfo.BytesPerSector = sectorSize;
+
+  return SendVolumeInfoUpdate(instance, FileFsSizeInformation, &sizeInfo,
+                              sizeof(FILE_FS_SIZE_INFORMATION)) &&
+         SendVolumeInfoUpdate(instance, FileFsFullSizeInformation,
+                              &fullSizeInfo,
+                              sizeof(FILE_FS_FULL_SIZE_INFORMATION));
+}
+
+BOOL DOKANAPI DokanUpdateVolumeInformation(_In_ DOKAN_HANDLE DokanInstance) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  if (!instance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  return SendVolumeInfoUpdate(instance, FileFsVolumeInformation, NULL, 0) &&
+         SendVolumeInfoUpdate(instance, FileFsAttributeInformation, NULL, 0);
+}
+
+BOOL DOKANAPI DokanBreakLease(_In_ DOKAN_HANDLE DokanInstance,
+                              _In_ LPCWSTR FileName) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  size_t length;
+  ULONG inputLength;
+  PDOKAN_UNICODE_STRING_INTERMEDIATE fileName = NULL;
+  BOOL result;
+
+  if (!instance || FileName == NULL) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  length = wcslen(FileName) * sizeof(WCHAR);
+  if (length > MAXUSHORT) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  inputLength = (ULONG)(FIELD_OFFSET(DOKAN_UNICODE_STRING_INTERMEDIATE,
+                                     Buffer[0]) + length);
+  fileName = malloc(inputLength);
+  if (!fileName) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  fileName->Length = (USHORT)length;
+  fileName->MaximumLength = (USHORT)length;
+  CopyMemory(fileName->Buffer, FileName, length);
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  result = SendToDevice(rawDeviceName, FSCTL_BREAK_LEASE, fileName,
+                        inputLength, NULL, 0, &returnedLength);
+  if (!result) {
+    DbgPrintW(L"Failed to break the lease of %s\n", FileName);
+  }
+  free(fileName);
+  return result;
+}
+
+BOOL DOKANAPI DokanHydrateRange(_In_ DOKAN_HANDLE DokanInstance,
+                                _In_ LPCWSTR FileName, _In_ LONGLONG ByteOffset,
+                                _In_reads_bytes_(Length) LPCVOID Buffer,
+                                _In_ DWORD Length, _In_ BOOL EndOfFile) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  size_t length;
+  ULONG dataOffset;
+  PDOKAN_HYDRATE_RANGE range = NULL;
+  BOOL result;
+
+  if (!instance || FileName == NULL || Buffer == NULL || Length == 0 ||
+      ByteOffset < 0) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  length = wcslen(FileName) * sizeof(WCHAR);
+  if (length > MAXUSHORT) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  dataOffset = (ULONG)(FIELD_OFFSET(DOKAN_HYDRATE_RANGE, FileName[0]) + length);
+  if (Length > MAXULONG - dataOffset) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  range = malloc(dataOffset + Length);
+  if (!range) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  ZeroMemory(range, dataOffset);
+  range->ByteOffset.QuadPart = ByteOffset;
+  range->DataOffset = dataOffset;
+  range->DataLength = Length;
+  range->EndOfFile = EndOfFile ? TRUE : FALSE;
+  range->FileNameLength = (USHORT)length;
+  CopyMemory(range->FileName, FileName, length);
+  CopyMemory((PCHAR)range + dataOffset, Buffer, Length);
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  result = SendToDevice(rawDeviceName, FSCTL_HYDRATE_RANGE, range,
+                        dataOffset + Length, NULL, 0, &returnedLength);
+  if (!result) {
+    DbgPrintW(L"Failed to hydrate %lu bytes of %s\n", Length, FileName);
+  }
+  free(range);
+  return result;
+}
+
+BOOL DOKANAPI DokanEcho(_In_ DOKAN_HANDLE DokanInstance, _In_ ULONG EventCount,
+                        _Out_ PDOKAN_ECHO Result) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  BOOL result;
+
+  if (!instance || Result == NULL) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  ZeroMemory(Result, sizeof(DOKAN_ECHO));
+  Result->EventCount = EventCount;
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  result = SendToDevice(rawDeviceName, FSCTL_ECHO, Result, sizeof(DOKAN_ECHO),
+                        Result, sizeof(DOKAN_ECHO), &returnedLength);
+  if (!result) {
+    DbgPrintW(L"Failed to echo %lu events\n", EventCount);
+  }
+  return result;
+}
+
+BOOL DOKANAPI DokanGetVolumeProfile(_In_ DOKAN_HANDLE DokanInstance,
+                                    _In_ BOOL Reset,
+                                    _Out_ PDOKAN_VOLUME_PROFILE Profile) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG flags = Reset ? DOKAN_PROFILE_RESET : 0;
+  ULONG returnedLength = 0;
+  BOOL result;
+
+  if (!instance || Profile == NULL) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  result = SendToDevice(rawDeviceName, FSCTL_GET_VOLUME_PROFILE, &flags,
+                        sizeof(flags), Profile, sizeof(DOKAN_VOLUME_PROFILE),
+                        &returnedLength);
+  if (!result) {
+    DbgPrintW(L"Failed to get the volume profile\n");
+  }
+  return result;
+}
+
+BOOL DOKANAPI DokanGetDriverLogs(LONGLONG Cursor, PDOKAN_LOG_RECORD Records,
+                                 ULONG MaxRecords, PULONG RecordCount) {
+  ULONG returnedLength = 0;
+  BOOL result;
+
+  *RecordCount = 0;
+  if (MaxRecords == 0 || MaxRecords > MAXULONG / sizeof(DOKAN_LOG_RECORD)) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  result = SendToDevice(DOKAN_GLOBAL_DEVICE_NAME, FSCTL_GET_DRIVER_LOGS,
+                        &Cursor, sizeof(LONGLONG), Records,
+                        MaxRecords * sizeof(DOKAN_LOG_RECORD), &returnedLength);
+  if (result) {
+    *RecordCount = returnedLength / sizeof(DOKAN_LOG_RECORD);
+  }
+  return result;
+}
+
 int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
                        PDOKAN_OPERATIONS DokanOperations) {
   DOKAN_INSTANCE *instance = NULL;
@@ -667,6 +1931,45 @@ int DOKANAPI DokanMain(PDOKAN_OPTIONS DokanOptions,
   return returnCode;
 }
 
+static VOID NotifyMounted(PDOKAN_INSTANCE DokanInstance) {
+  // Here we should have been mounter by mountmanager thanks to
+  // IOCTL_MOUNTDEV_QUERY_SUGGESTED_LINK_NAME
+  DbgPrintW(L"Dokan Information: mounted: %s -> %s\n", DokanInstance->MountPoint,
+            DokanInstance->DeviceName);
+
+  if (DokanInstance->DokanOperations->Mounted) {
+    DOKAN_FILE_INFO fileInfo;
+    RtlZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
+    fileInfo.DokanOptions = DokanInstance->DokanOptions;
+    // Ignore return value
+    DokanInstance->DokanOperations->Mounted(DokanInstance->MountPoint,
+                                            &fileInfo);
+  }
+}
+
+// Creates the mount point of a volume already serving requests through its
+// device name, then reports it mounted.
+static BOOL PublishMountPoint(PDOKAN_INSTANCE DokanInstance) {
+  if (!DokanMount(DokanInstance, DokanInstance->DokanOptions)) {
+    DokanDbgPrint("Dokan Error: DokanMount Failed\n");
+    return FALSE;
+  }
+  NotifyMounted(DokanInstance);
+  return TRUE;
+}
+
+static VOID CALLBACK PublishMountPointCallback(PTP_CALLBACK_INSTANCE Instance,
+                                               PVOID Context, PTP_WORK Work) {
+  PDOKAN_INSTANCE dokanInstance = (PDOKAN_INSTANCE)Context;
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Work);
+  if (!PublishMountPoint(dokanInstance)) {
+    // The pull threads see the volume go away and end the instance as for
+    // any other unmount.
+    SendReleaseIRP(dokanInstance->DeviceName);
+  }
+}
+
 int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
                                    _In_ PDOKAN_OPERATIONS DokanOperations,
                                    _Out_ DOKAN_HANDLE *DokanInstance) {
@@ -725,6 +2028,18 @@ int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
 
   dokanInstance->DokanOptions = DokanOptions;
   dokanInstance->DokanOperations = DokanOperations;
+  if (DokanOptions->Version < DOKAN_OPTIONS_EXTENDED_VERSION) {
+    // Only read the fields the structures of the mount have.
+    RtlCopyMemory(&dokanInstance->CompatOptions, DokanOptions,
+                  FIELD_OFFSET(DOKAN_OPTIONS, IpcBatchMinSize));
+    RtlCopyMemory(&dokanInstance->CompatOperations, DokanOperations,
+                  FIELD_OFFSET(DOKAN_OPERATIONS, FindFilesWithCursor));
+    dokanInstance->DokanOptions = &dokanInstance->CompatOptions;
+    dokanInstance->DokanOperations = &dokanInstance->CompatOperations;
+    DokanOptions = dokanInstance->DokanOptions;
+    DokanOperations = dokanInstance->DokanOperations;
+  }
+  InitializeInstanceNodes(dokanInstance);
   dokanInstance->GlobalDevice =
       CreateFile(DOKAN_GLOBAL_DEVICE_NAME,           // lpFileName
                  0,                                  // dwDesiredAccess
@@ -762,6 +2077,9 @@ int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
              DokanOptions->UNCName);
   }
 
+  // Done by the pool threads while the driver starts the volume.
+  PrewarmPool();
+
   int result = DokanStart(dokanInstance);
   if (result != DOKAN_SUCCESS) {
     DeleteDokanInstance(dokanInstance);
@@ -786,6 +2104,14 @@ int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
     return DOKAN_DRIVER_INSTALL_ERROR;
   }
 
+  if (DokanOptions->Options & DOKAN_OPTION_SHARED_DISPATCH) {
+    DokanOptions->Options &= ~DOKAN_OPTION_EVENT_RING;
+  }
+  if ((DokanOptions->Options & DOKAN_OPTION_EVENT_RING) &&
+      !RegisterEventRing(dokanInstance)) {
+    DokanOptions->Options &= ~DOKAN_OPTION_EVENT_RING;
+  }
+
   DWORD_PTR processAffinityMask;
   DWORD_PTR systemAffinityMask;
   DWORD mainPullThreadCount = 0;
@@ -811,9 +2137,53 @@ int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
   }
   BOOLEAN allowIpcBatching =
       (BOOLEAN)(DokanOptions->Options & DOKAN_OPTION_ALLOW_IPC_BATCHING);
-  DbgPrintW(L"Dokan: Using %d main pull threads with ipc batching: %d\n",
-            mainPullThreadCount, allowIpcBatching);
-  for (DWORD x = 0; x < mainPullThreadCount; ++x) {
+  dokanInstance->IpcBatchMinSize =
+      DokanOptions->IpcBatchMinSize ? DokanOptions->IpcBatchMinSize
+                                    : DOKAN_IPC_BATCH_MIN_SIZE;
+  dokanInstance->IpcBatchMinSize =
+      min(max(dokanInstance->IpcBatchMinSize, DOKAN_IPC_BATCH_MIN_SIZE),
+          DOKAN_IPC_BATCH_MAX_SIZE);
+  dokanInstance->IpcBatchMaxSize =
+      DokanOptions->IpcBatchMaxSize ? DokanOptions->IpcBatchMaxSize
+                                    : DOKAN_IPC_BATCH_DEFAULT_MAX_SIZE;
+  dokanInstance->IpcBatchMaxSize =
+      min(max(dokanInstance->IpcBatchMaxSize, dokanInstance->IpcBatchMinSize),
+          DOKAN_IPC_BATCH_MAX_SIZE);
+  dokanInstance->IpcBatchSize = (LONG)dokanInstance->IpcBatchMaxSize;
+  // Until events are measured, only the batches of a single event are
+  // processed inline.
+  dokanInstance->IpcBatchEventLatencyNs = DOKAN_IPC_BATCH_INLINE_BUDGET_US * 1000;
+  BOOL overlappedPull =
+      (DokanOptions->Options &
+       (DOKAN_OPTION_OVERLAPPED_PULL | DOKAN_OPTION_SHARED_DISPATCH)) != 0;
+  if (DokanOptions->Options & DOKAN_OPTION_SHARED_DISPATCH) {
+    mainPullThreadCount = 0;
+  } else {
+    mainPullThreadCount =
+        InitializePullThreadAutoscale(dokanInstance, mainPullThreadCount);
+    if (overlappedPull) {
+      // The threads of the port are not autoscaled.
+      dokanInstance->MaxPullThreads = dokanInstance->MinPullThreads;
+    }
+    DbgPrintW(
+        L"Dokan: Using %d to %d main pull threads with ipc batching: %d\n",
+        mainPullThreadCount, dokanInstance->MaxPullThreads, allowIpcBatching);
+  }
+  if (overlappedPull) {
+    if (!StartOverlappedPulls(dokanInstance, mainPullThreadCount)) {
+      DeleteDokanInstance(dokanInstance);
+      return DOKAN_MOUNT_ERROR;
+    }
+  } else {
+    for (DWORD x = 0; x < mainPullThreadCount; ++x) {
+      if (!QueueMainPullThread(dokanInstance)) {
+        DeleteDokanInstance(dokanInstance);
+        return DOKAN_MOUNT_ERROR;
+      }
+    }
+  }
+  // Events that do not fit in the ring keep being pulled by the threads above.
+  for (DWORD x = 0; dokanInstance->EventRing && x < mainPullThreadCount; ++x) {
     PDOKAN_IO_EVENT ioEvent = PopIoEventBuffer();
     if (!ioEvent) {
       DokanDbgPrintW(L"Dokan Error: IoEvent allocation failed.");
@@ -821,12 +2191,18 @@ int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
       return DOKAN_MOUNT_ERROR;
     }
     ioEvent->DokanInstance = dokanInstance;
-    QueueIoEvent(ioEvent, allowIpcBatching
-                              ? DispatchBatchIoCallback
-                              : DispatchDedicatedIoCallback);
+    if (dokanInstance->ThreadInfo.NodeCount > 0) {
+      ioEvent->Node = dokanInstance->ThreadInfo
+                          .Nodes[x % dokanInstance->ThreadInfo.NodeCount];
+    }
+    QueueIoEventToNode(ioEvent, DispatchEventRingIoCallback);
   }
+  StartPullThreadAutoscale(dokanInstance);
+  StartFlushGroup(dokanInstance);
 
-  if (!DokanMount(dokanInstance, DokanOptions)) {
+  BOOL asyncMountPoint =
+      (DokanOptions->Options & DOKAN_OPTION_ASYNC_MOUNT_POINT) != 0;
+  if (!asyncMountPoint && !DokanMount(dokanInstance, DokanOptions)) {
     SendReleaseIRP(dokanInstance->DeviceName);
     DokanDbgPrint("Dokan Error: DokanMount Failed\n");
     DeleteDokanInstance(dokanInstance);
@@ -860,17 +2236,19 @@ int DOKANAPI DokanCreateFileSystem(_In_ PDOKAN_OPTIONS DokanOptions,
     DbgPrintW(L"Failed to open notify handle: %s\n", notify_path);
   }
 
-  // Here we should have been mounter by mountmanager thanks to
-  // IOCTL_MOUNTDEV_QUERY_SUGGESTED_LINK_NAME
-  DbgPrintW(L"Dokan Information: mounted: %s -> %s\n", dokanInstance->MountPoint,
-            dokanInstance->DeviceName);
-
-  if (DokanOperations->Mounted) {
-    DOKAN_FILE_INFO fileInfo;
-    RtlZeroMemory(&fileInfo, sizeof(DOKAN_FILE_INFO));
-    fileInfo.DokanOptions = DokanOptions;
-    // Ignore return value
-    DokanOperations->Mounted(dokanInstance->MountPoint, &fileInfo);
+  if (asyncMountPoint) {
+    dokanInstance->MountPointWork = CreateThreadpoolWork(
+        PublishMountPointCallback, dokanInstance,
+        &dokanInstance->ThreadInfo.CallbackEnvironment);
+  }
+  if (!asyncMountPoint) {
+    NotifyMounted(dokanInstance);
+  } else if (dokanInstance->MountPointWork) {
+    SubmitThreadpoolWork(dokanInstance->MountPointWork);
+  } else if (!PublishMountPoint(dokanInstance)) {
+    SendReleaseIRP(dokanInstance->DeviceName);
+    DeleteDokanInstance(dokanInstance);
+    return DOKAN_MOUNT_ERROR;
   }
 
   if (DokanInstance) {
@@ -924,7 +2302,7 @@ ULONG DispatchGetEventInformationLength(ULONG bufferSize) {
              FIELD_OFFSET(EVENT_INFORMATION, Buffer[0]) + bufferSize);
 }
 
-VOID CreateDispatchCommon(PDOKAN_IO_EVENT IoEvent, ULONG SizeOfEventInfo, BOOL UseExtraMemoryPool, BOOL ClearNonPoolBuffer) {
+VOID CreateDispatchCommon(PDOKAN_IO_EVENT IoEvent, ULONG SizeOfEventInfo, BOOL UseExtraMemoryPool, BOOL ClearBuffer) {
   assert(IoEvent != NULL);
   assert(IoEvent->EventResult == NULL && IoEvent->EventResultSize == 0);
 
@@ -934,22 +2312,13 @@ VOID CreateDispatchCommon(PDOKAN_IO_EVENT IoEvent, ULONG SizeOfEventInfo, BOOL U
     IoEvent->PoolAllocated = TRUE;
   } else {
     if (UseExtraMemoryPool) {
-      if (SizeOfEventInfo <= (16 * 1024)) {
-        IoEvent->EventResult = Pop16KEventResult();
-        IoEvent->EventResultSize = DOKAN_EVENT_INFO_16K_SIZE;
-        IoEvent->PoolAllocated = TRUE;
-      } else if (SizeOfEventInfo <= (32 * 1024)) {
-        IoEvent->EventResult = Pop32KEventResult();
-        IoEvent->EventResultSize = DOKAN_EVENT_INFO_32K_SIZE;
-        IoEvent->PoolAllocated = TRUE;
-      } else if (SizeOfEventInfo <= (64 * 1024)) {
-        IoEvent->EventResult = Pop64KEventResult();
-        IoEvent->EventResultSize = DOKAN_EVENT_INFO_64K_SIZE;
-        IoEvent->PoolAllocated = TRUE;
-      } else if (SizeOfEventInfo <= (128 * 1024)) {
-        IoEvent->EventResult = Pop128KEventResult();
-        IoEvent->EventResultSize = DOKAN_EVENT_INFO_128K_SIZE;
+      IoEvent->EventResult =
+          PopSizedEventResult(SizeOfEventInfo, &IoEvent->EventResultSize);
+      if (IoEvent->EventResult) {
         IoEvent->PoolAllocated = TRUE;
+        if (ClearBuffer) {
+          ZeroMemory(IoEvent->EventResult->Buffer, SizeOfEventInfo);
+        }
       }
     }
     if (IoEvent->EventResult == NULL) {
@@ -961,7 +2330,7 @@ VOID CreateDispatchCommon(PDOKAN_IO_EVENT IoEvent, ULONG SizeOfEventInfo, BOOL U
         return;
       }
       ZeroMemory(IoEvent->EventResult,
-                 ClearNonPoolBuffer
+                 ClearBuffer
                      ? IoEvent->EventResultSize
                      : FIELD_OFFSET(EVENT_INFORMATION, Buffer[0]));
     }
@@ -974,18 +2343,30 @@ VOID CreateDispatchCommon(PDOKAN_IO_EVENT IoEvent, ULONG SizeOfEventInfo, BOOL U
   IoEvent->EventResult->Context = IoEvent->EventContext->Context;
 }
 
-VOID ReleaseDokanOpenInfo(PDOKAN_IO_EVENT IoEvent) {
+VOID ReleaseDokanOpenInfoEx(PDOKAN_IO_EVENT IoEvent, LPCWSTR CloseFileName) {
   if (!IoEvent->DokanOpenInfo) {
     return;
   }
   EnterCriticalSection(&IoEvent->DokanOpenInfo->CriticalSection);
   IoEvent->DokanOpenInfo->UserContext = IoEvent->DokanFileInfo.Context;
   IoEvent->DokanOpenInfo->OpenCount--;
-  if (IoEvent->EventContext->MajorFunction == IRP_MJ_CLOSE) {
-    IoEvent->DokanOpenInfo->CloseFileName =
-        _wcsdup(IoEvent->EventContext->Operation.Close.FileName);
+  if (CloseFileName) {
+    IoEvent->DokanOpenInfo->CloseFileName = _wcsdup(CloseFileName);
     IoEvent->DokanOpenInfo->CloseUserContext = IoEvent->DokanFileInfo.Context;
-    IoEvent->DokanOpenInfo->OpenCount--;
+    // An asynchronous cleanup can come after the close. The handle is then
+    // released by the cleanup.
+    if ((IoEvent->EventContext->FileFlags & DOKAN_ASYNC_CLEANUP) &&
+        !IoEvent->DokanOpenInfo->AsyncCleanupDone) {
+      IoEvent->DokanOpenInfo->CloseWaitsForCleanup = TRUE;
+    } else {
+      IoEvent->DokanOpenInfo->OpenCount--;
+    }
+  } else if (IoEvent->EventContext->MajorFunction == IRP_MJ_CLEANUP &&
+             (IoEvent->EventContext->FileFlags & DOKAN_ASYNC_CLEANUP)) {
+    IoEvent->DokanOpenInfo->AsyncCleanupDone = TRUE;
+    if (IoEvent->DokanOpenInfo->CloseWaitsForCleanup) {
+      IoEvent->DokanOpenInfo->OpenCount--;
+    }
   }
   if (IoEvent->DokanOpenInfo->OpenCount > 0) {
     // We are still waiting for the Close event or there is another event running. We delay the Close event.
@@ -1016,6 +2397,13 @@ VOID ReleaseDokanOpenInfo(PDOKAN_IO_EVENT IoEvent) {
   }
 }
 
+VOID ReleaseDokanOpenInfo(PDOKAN_IO_EVENT IoEvent) {
+  ReleaseDokanOpenInfoEx(IoEvent,
+                         IoEvent->EventContext->MajorFunction == IRP_MJ_CLOSE
+                             ? IoEvent->EventContext->Operation.Close.FileName
+                             : NULL);
+}
+
 // ask driver to release all pending IRP to prepare for Unmount.
 BOOL SendReleaseIRP(LPCWSTR DeviceName) {
   ULONG returnedLength;
@@ -1115,6 +2503,37 @@ int DokanStart(_In_ PDOKAN_INSTANCE DokanInstance) {
   if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_ALLOW_IPC_BATCHING) {
     eventStart.Flags |= DOKAN_EVENT_ALLOW_IPC_BATCHING;
   }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_ZERO_COPY_READ) {
+    eventStart.Flags |= DOKAN_EVENT_ZERO_COPY_READ;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_ZERO_COPY_WRITE) {
+    eventStart.Flags |= DOKAN_EVENT_ZERO_COPY_WRITE;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_BATCH_CLOSE) {
+    eventStart.Flags |= DOKAN_EVENT_BATCH_CLOSE;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_DEFER_BASIC_INFO) {
+    eventStart.Flags |= DOKAN_EVENT_DEFER_BASIC_INFO;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_KERNEL_ACCESS_CHECK) {
+    eventStart.Flags |= DOKAN_EVENT_KERNEL_ACCESS_CHECK;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_HEARTBEAT_TIMEOUT) {
+    eventStart.Flags |= DOKAN_EVENT_HEARTBEAT_TIMEOUT;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_WRITE_THROUGH) {
+    eventStart.Flags |= DOKAN_EVENT_WRITE_THROUGH;
+  }
+  if (DokanInstance->DokanOptions->Options &
+      DOKAN_OPTION_COALESCE_NOTIFICATIONS) {
+    eventStart.Flags |= DOKAN_EVENT_COALESCE_NOTIFICATIONS;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_FILELOCK_HYBRID) {
+    eventStart.Flags |= DOKAN_EVENT_FILELOCK_HYBRID;
+  }
+  if (DokanInstance->DokanOptions->Options & DOKAN_OPTION_ASYNC_CLEANUP) {
+    eventStart.Flags |= DOKAN_EVENT_ASYNC_CLEANUP;
+  }
   if (driverLetter && mountManager &&
       !CheckDriveLetterAvailability(DokanInstance->MountPoint[0])) {
     eventStart.Flags |= DOKAN_EVENT_DRIVE_LETTER_IN_USE;
@@ -1144,6 +2563,31 @@ int DokanStart(_In_ PDOKAN_INSTANCE DokanInstance) {
 
   eventStart.IrpTimeout = DokanInstance->DokanOptions->Timeout;
   eventStart.FcbGarbageCollectionIntervalMs = 2000;
+  eventStart.MetadataLaneWeight = DokanInstance->DokanOptions->MetadataLaneWeight;
+  eventStart.FileInfoCacheTimeoutMs =
+      DokanInstance->DokanOptions->FileInfoCacheTimeoutMs;
+  eventStart.NegativeCacheTimeoutMs =
+      DokanInstance->DokanOptions->NegativeCacheTimeoutMs;
+  eventStart.VolumeInfoCacheTimeoutMs =
+      DokanInstance->DokanOptions->VolumeInfoCacheTimeoutMs;
+  eventStart.SecurityCacheTimeoutMs =
+      DokanInstance->DokanOptions->SecurityCacheTimeoutMs;
+  eventStart.ReadAheadWindowSize =
+      DokanInstance->DokanOptions->ReadAheadWindowSize;
+  eventStart.ReadAheadMemoryLimit =
+      DokanInstance->DokanOptions->ReadAheadMemoryLimit;
+  eventStart.WriteBehindMaxSize =
+      DokanInstance->DokanOptions->WriteBehindMaxSize;
+  eventStart.WriteBehindTimeoutMs =
+      DokanInstance->DokanOptions->WriteBehindTimeoutMs;
+  eventStart.FcbCacheMemoryLimit =
+      DokanInstance->DokanOptions->FcbCacheMemoryLimit;
+  eventStart.SectorSize = DokanInstance->DokanOptions->SectorSize;
+  eventStart.MaxTransferSize = DokanInstance->DokanOptions->MaxTransferSize;
+  eventStart.AllocationStepSize =
+      DokanInstance->DokanOptions->AllocationStepSize;
+  eventStart.ProfileSampleRate =
+      DokanInstance->DokanOptions->ProfileSampleRate;
 
   SendToDevice(DOKAN_GLOBAL_DEVICE_NAME, FSCTL_EVENT_START, &eventStart,
                sizeof(EVENT_START), &driverInfo, sizeof(EVENT_DRIVER_INFO),
@@ -1298,98 +2742,6 @@ BOOL WINAPI DllMain(HINSTANCE Instance, DWORD Reason, LPVOID Reserved) {
   return TRUE;
 }
 
-VOID DOKANAPI DokanMapKernelToUserCreateFileFlags(
-    ACCESS_MASK DesiredAccess, ULONG FileAttributes, ULONG CreateOptions,
-    ULONG CreateDisposition, ACCESS_MASK *outDesiredAccess,
-    DWORD *outFileAttributesAndFlags, DWORD *outCreationDisposition) {
-  BOOL genericRead = FALSE, genericWrite = FALSE, genericExecute = FALSE,
-       genericAll = FALSE;
-
-  if (outFileAttributesAndFlags) {
-
-    *outFileAttributesAndFlags = FileAttributes;
-
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_WRITE_THROUGH, FILE_WRITE_THROUGH);
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_SEQUENTIAL_SCAN, FILE_SEQUENTIAL_ONLY);
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_RANDOM_ACCESS, FILE_RANDOM_ACCESS);
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_NO_BUFFERING, FILE_NO_INTERMEDIATE_BUFFERING);
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_OPEN_REPARSE_POINT, FILE_OPEN_REPARSE_POINT);
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_DELETE_ON_CLOSE, FILE_DELETE_ON_CLOSE);
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_BACKUP_SEMANTICS, FILE_OPEN_FOR_BACKUP_INTENT);
-
-#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
-    DokanMapKernelBit(*outFileAttributesAndFlags, CreateOptions,
-                      FILE_FLAG_SESSION_AWARE, FILE_SESSION_AWARE);
-#endif
-  }
-
-  if (outCreationDisposition) {
-
-    switch (CreateDisposition) {
-    case FILE_CREATE:
-      *outCreationDisposition = CREATE_NEW;
-      break;
-    case FILE_OPEN:
-      *outCreationDisposition = OPEN_EXISTING;
-      break;
-    case FILE_OPEN_IF:
-      *outCreationDisposition = OPEN_ALWAYS;
-      break;
-    case FILE_OVERWRITE:
-      *outCreationDisposition = TRUNCATE_EXISTING;
-      break;
-    case FILE_SUPERSEDE:
-    // The documentation isn't clear on the difference between replacing a file
-    // and truncating it.
-    // For now we just map it to create/truncate
-    case FILE_OVERWRITE_IF:
-      *outCreationDisposition = CREATE_ALWAYS;
-      break;
-    default:
-      *outCreationDisposition = 0;
-      break;
-    }
-  }
-
-  if (outDesiredAccess) {
-
-    *outDesiredAccess = DesiredAccess;
-
-    if ((*outDesiredAccess & FILE_GENERIC_READ) == FILE_GENERIC_READ) {
-      *outDesiredAccess |= GENERIC_READ;
-      genericRead = TRUE;
-    }
-    if ((*outDesiredAccess & FILE_GENERIC_WRITE) == FILE_GENERIC_WRITE) {
-      *outDesiredAccess |= GENERIC_WRITE;
-      genericWrite = TRUE;
-    }
-    if ((*outDesiredAccess & FILE_GENERIC_EXECUTE) == FILE_GENERIC_EXECUTE) {
-      *outDesiredAccess |= GENERIC_EXECUTE;
-      genericExecute = TRUE;
-    }
-    if ((*outDesiredAccess & FILE_ALL_ACCESS) == FILE_ALL_ACCESS) {
-      *outDesiredAccess |= GENERIC_ALL;
-      genericAll = TRUE;
-    }
-
-    if (genericRead)
-      *outDesiredAccess &= ~FILE_GENERIC_READ;
-    if (genericWrite)
-      *outDesiredAccess &= ~FILE_GENERIC_WRITE;
-    if (genericExecute)
-      *outDesiredAccess &= ~FILE_GENERIC_EXECUTE;
-    if (genericAll)
-      *outDesiredAccess &= ~FILE_ALL_ACCESS;
-  }
-}
-
 VOID DOKANAPI DokanInit() {
   // ensure 64-bit alignment
   assert(FIELD_OFFSET(EVENT_INFORMATION, Buffer) % 8 == 0);
@@ -1413,6 +2765,16 @@ VOID DOKANAPI DokanInit() {
   EnterCriticalSection(&g_InstanceCriticalSection);
   { InitializePool(); }
   LeaveCriticalSection(&g_InstanceCriticalSection);
+  // Tracing is optional, the events are dropped if this fails.
+  (void)TraceLoggingRegister(g_DokanTraceProvider);
+}
+
+BOOL DOKANAPI DokanUseLargePages() {
+  if (InterlockedAdd(&g_DokanInitialized, 0) > 0) {
+    DbgPrint("Dokan Error: DokanUseLargePages called after DokanInit.\n");
+    return FALSE;
+  }
+  return EnablePoolLargePages();
 }
 
 VOID DOKANAPI DokanShutdown() {
@@ -1438,6 +2800,18 @@ VOID DOKANAPI DokanShutdown() {
   }
   LeaveCriticalSection(&g_InstanceCriticalSection);
   DeleteCriticalSection(&g_InstanceCriticalSection);
+  TraceLoggingUnregister(g_DokanTraceProvider);
+}
+
+// Drops the cached listings a notification about FilePath makes stale.
+static VOID InvalidateNotifiedPath(PDOKAN_INSTANCE DokanInstance,
+                                   LPCWSTR FilePath, size_t Length,
+                                   ULONG Action) {
+  if (Action == FILE_ACTION_RENAMED_OLD_NAME || Action == FILE_ACTION_REMOVED) {
+    InvalidateCachedDirListTree(DokanInstance, FilePath, Length);
+  } else {
+    InvalidateCachedDirList(DokanInstance, FilePath, Length);
+  }
 }
 
 BOOL DOKANAPI DokanNotifyPath(_In_ DOKAN_HANDLE DokanInstance,
@@ -1463,6 +2837,7 @@ BOOL DOKANAPI DokanNotifyPath(_In_ DOKAN_HANDLE DokanInstance,
     return FALSE;
   }
   ZeroMemory(pNotifyPath, inputLength);
+  InvalidateNotifiedPath(instance, FilePath + prefixSize, length, Action);
   pNotifyPath->CompletionFilter = CompletionFilter;
   pNotifyPath->Action = Action;
   pNotifyPath->Length = (USHORT)(length * sizeof(WCHAR));
@@ -1477,6 +2852,93 @@ BOOL DOKANAPI DokanNotifyPath(_In_ DOKAN_HANDLE DokanInstance,
   return TRUE;
 }
 
+static BOOL SendNotifyPathBatch(DOKAN_INSTANCE *Instance, PCHAR Buffer,
+                                ULONG Length) {
+  ULONG returnedLength;
+  if (!DeviceIoControl(Instance->NotifyHandle, FSCTL_NOTIFY_PATH_BATCH, Buffer,
+                       Length, NULL, 0, &returnedLength, NULL)) {
+    DbgPrint("Failed to send notify path batch command: %d\n",
+             GetLastError());
+    return FALSE;
+  }
+  return TRUE;
+}
+
+BOOL DOKANAPI DokanNotifyBatch(_In_ DOKAN_HANDLE DokanInstance,
+                               _In_reads_(Count) PDOKAN_NOTIFY_ENTRY Entries,
+                               _In_ ULONG Count) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  const size_t prefixSize = 2; // size of mount letter plus ":"
+  PDOKAN_NOTIFY_PATH_BATCH_ENTRY lastEntry = NULL;
+  PCHAR buffer = NULL;
+  size_t totalSize = 0;
+  ULONG bufferSize;
+  ULONG offset = 0;
+  BOOL success = TRUE;
+
+  if (!instance || !instance->NotifyHandle || (Count > 0 && !Entries)) {
+    return FALSE;
+  }
+  for (ULONG i = 0; i < Count; ++i) {
+    if (Entries[i].FilePath) {
+      totalSize += QuadAlign(FIELD_OFFSET(DOKAN_NOTIFY_PATH_BATCH_ENTRY, Buffer) +
+                             wcslen(Entries[i].FilePath) * sizeof(WCHAR));
+    }
+  }
+  if (totalSize == 0) {
+    return Count == 0;
+  }
+  bufferSize = (ULONG)min(totalSize, DOKAN_NOTIFY_PATH_BATCH_MAX_SIZE);
+  buffer = malloc(bufferSize);
+  if (buffer == NULL) {
+    DbgPrint("Failed to allocate NotifyPathBatch\n");
+    return FALSE;
+  }
+  for (ULONG i = 0; i < Count; ++i) {
+    LPCWSTR filePath = Entries[i].FilePath;
+    size_t length = filePath ? wcslen(filePath) : 0;
+    ULONG entrySize;
+    PDOKAN_NOTIFY_PATH_BATCH_ENTRY entry;
+    if (length <= prefixSize) {
+      success = FALSE;
+      continue;
+    }
+    // remove the mount letter and colon from length, for example: "G:"
+    length -= prefixSize;
+    entrySize = (ULONG)QuadAlign(
+        FIELD_OFFSET(DOKAN_NOTIFY_PATH_BATCH_ENTRY, Buffer) +
+        length * sizeof(WCHAR));
+    if (length * sizeof(WCHAR) > MAXUSHORT || entrySize > bufferSize) {
+      DbgPrint("Notify path too long:%ws\n", filePath);
+      success = FALSE;
+      continue;
+    }
+    if (offset + entrySize > bufferSize) {
+      success &= SendNotifyPathBatch(instance, buffer, offset);
+      offset = 0;
+      lastEntry = NULL;
+    }
+    entry = (PDOKAN_NOTIFY_PATH_BATCH_ENTRY)(buffer + offset);
+    ZeroMemory(entry, entrySize);
+    entry->CompletionFilter = Entries[i].CompletionFilter;
+    entry->Action = Entries[i].Action;
+    entry->Length = (USHORT)(length * sizeof(WCHAR));
+    CopyMemory(entry->Buffer, filePath + prefixSize, entry->Length);
+    if (lastEntry) {
+      lastEntry->NextEntryOffset = (ULONG)((PCHAR)entry - (PCHAR)lastEntry);
+    }
+    InvalidateNotifiedPath(instance, filePath + prefixSize, length,
+                           Entries[i].Action);
+    lastEntry = entry;
+    offset += entrySize;
+  }
+  if (offset > 0) {
+    success &= SendNotifyPathBatch(instance, buffer, offset);
+  }
+  free(buffer);
+  return success;
+}
+
 BOOL DOKANAPI DokanNotifyCreate(_In_ DOKAN_HANDLE DokanInstance,
                                 _In_ LPCWSTR FilePath, _In_ BOOL IsDirectory) {
   return DokanNotifyPath(DokanInstance, FilePath,
@@ -1509,13 +2971,17 @@ BOOL DOKANAPI DokanNotifyRename(_In_ DOKAN_HANDLE DokanInstance,
                                 _In_ LPCWSTR OldPath, _In_ LPCWSTR NewPath,
                                 _In_ BOOL IsDirectory,
                                 _In_ BOOL IsInSameDirectory) {
-  BOOL success = DokanNotifyPath(
-      DokanInstance, OldPath,
-      IsDirectory ? FILE_NOTIFY_CHANGE_DIR_NAME : FILE_NOTIFY_CHANGE_FILE_NAME,
-      IsInSameDirectory ? FILE_ACTION_RENAMED_OLD_NAME : FILE_ACTION_REMOVED);
-  success &= DokanNotifyPath(
-      DokanInstance, NewPath,
-      IsDirectory ? FILE_NOTIFY_CHANGE_DIR_NAME : FILE_NOTIFY_CHANGE_FILE_NAME,
-      IsInSameDirectory ? FILE_ACTION_RENAMED_NEW_NAME : FILE_ACTION_ADDED);
-  return success;
+  DOKAN_NOTIFY_ENTRY entries[2];
+  ULONG completionFilter =
+      IsDirectory ? FILE_NOTIFY_CHANGE_DIR_NAME : FILE_NOTIFY_CHANGE_FILE_NAME;
+  // Both names in one request so that no watcher sees one without the other.
+  entries[0].FilePath = OldPath;
+  entries[0].CompletionFilter = completionFilter;
+  entries[0].Action =
+      IsInSameDirectory ? FILE_ACTION_RENAMED_OLD_NAME : FILE_ACTION_REMOVED;
+  entries[1].FilePath = NewPath;
+  entries[1].CompletionFilter = completionFilter;
+  entries[1].Action =
+      IsInSameDirectory ? FILE_ACTION_RENAMED_NEW_NAME : FILE_ACTION_ADDED;
+  return DokanNotifyBatch(DokanInstance, entries, 2);
 }
@@ -56,7 +56,7 @@ extern "C" {
 /** @{ */
 
 /** The current Dokan version (200 means ver 2.0.0). \ref DOKAN_OPTIONS.Version */
-#define DOKAN_VERSION 220
+#define DOKAN_VERSION 230
 /** Minimum Dokan version (ver 2.0.0) accepted. */
 #define DOKAN_MINIMUM_COMPATIBLE_VERSION 200
 /** Driver file name including the DOKAN_MAJOR_API_VERSION */
@@ -131,6 +131,137 @@ extern "C" {
  * and userland filesystem taking time to process requests (like remote storage).
  */
 #define DOKAN_OPTION_ALLOW_IPC_BATCHING (1 << 12)
+/**
+ * Exchange events and their results with the driver through a shared memory
+ * ring instead of a DeviceIoControl per event when they are small enough.
+ * Larger events and results keep using the regular path. Ignored if the
+ * driver does not support it.
+ */
+#define DOKAN_OPTION_EVENT_RING (1 << 13)
+/**
+ * Let ReadFile write straight into the buffer of the application when it is
+ * page aligned, instead of into an intermediate buffer that the driver then
+ * copies. The buffer given to ReadFile can then be in use by the application
+ * as soon as the read completes and must not be accessed after returning.
+ */
+#define DOKAN_OPTION_ZERO_COPY_READ (1 << 14)
+/**
+ * Let WriteFile read straight from the buffer of the application when a write
+ * is too large to be carried by its event and the buffer is page aligned,
+ * instead of fetching it from the driver with an extra request and copy. The
+ * buffer given to WriteFile is then read-only and must not be accessed after
+ * returning. Requires Windows 8 or later, ignored otherwise.
+ */
+#define DOKAN_OPTION_ZERO_COPY_WRITE (1 << 15)
+/**
+ * Let \ref DOKAN_OPERATIONS.ReadFile, \ref DOKAN_OPERATIONS.WriteFile and
+ * \ref DOKAN_OPERATIONS.FlushFileBuffers return \c STATUS_PENDING and complete
+ * the operation later with \ref DokanCompleteOperation, so that the pool thread
+ * is free to take other requests meanwhile. Reads and writes are then not
+ * split by \ref DOKAN_OPTIONS.ParallelIoChunkSize.
+ */
+#define DOKAN_OPTION_ASYNC_OPERATIONS (1 << 16)
+/**
+ * Process the requests of the mount only on the NUMA nodes of the processor
+ * group \ref DOKAN_OPTIONS.ProcessorGroup. Only used on systems with several
+ * NUMA nodes, where every node has its own pool threads.
+ */
+#define DOKAN_OPTION_PROCESSOR_GROUP (1 << 17)
+/**
+ * Return from \ref DokanCreateFileSystem as soon as the driver has started the
+ * volume, which then serves requests through its device name, and create the
+ * mount point, notify the shell and call \ref DOKAN_OPERATIONS.Mounted in the
+ * background. Creating a folder mount point or broadcasting a new drive letter
+ * can take a while, and a failure to do so then unmounts the volume instead of
+ * failing the call.
+ */
+#define DOKAN_OPTION_ASYNC_MOUNT_POINT (1 << 18)
+/**
+ * Have the requests of the mount pulled by threads shared with the other mounts
+ * of the process using this option, instead of main pull threads of its own.
+ * The shared threads wait for the requests of all those mounts at once and
+ * handle at most \ref DOKAN_OPTIONS.SharedDispatchQuota batches of requests of
+ * a mount at a time, so that a busy mount does not hold up the others. Suits
+ * processes serving many mounts that are mostly idle. \ref DOKAN_OPTIONS.MinThreads
+ * and \ref DOKAN_OPTIONS.MaxThreads are then ignored, and so is
+ * \ref DOKAN_OPTION_EVENT_RING. The shared threads must not call
+ * \ref DokanCloseHandle.
+ */
+#define DOKAN_OPTION_SHARED_DISPATCH (1 << 19)
+/**
+ * Keep \ref DOKAN_OPTIONS.PullQueueDepth overlapped pulls of requests waiting in
+ * the driver, taken by whichever of the \ref DOKAN_OPTIONS.MinThreads threads of
+ * the mount is free when they complete, instead of having each thread block in
+ * the driver with a pull of its own. The number of pulls is then not tied to the
+ * number of threads. \ref DOKAN_OPTIONS.MaxThreads is ignored.
+ */
+#define DOKAN_OPTION_OVERLAPPED_PULL (1 << 20)
+/**
+ * Have the driver send closes in batches, after a few milliseconds or once a
+ * batch is full, instead of one request per handle. \ref DOKAN_OPERATIONS.CloseFile
+ * is then called a little later after the application closed the file.
+ */
+#define DOKAN_OPTION_BATCH_CLOSE (1 << 21)
+/**
+ * Have the driver complete \c FileBasicInformation sets itself and call
+ * \ref DOKAN_OPERATIONS.SetFileAttributes and \ref DOKAN_OPERATIONS.SetFileTime
+ * once with all the sets made meanwhile, before the next
+ * \ref DOKAN_OPERATIONS.Cleanup or \ref DOKAN_OPERATIONS.FlushFileBuffers of the
+ * file. Queries of the file return the held values, but directory listings and
+ * new handles only see them once applied, and a failure to apply them is not
+ * reported to the application.
+ */
+#define DOKAN_OPTION_DEFER_BASIC_INFO (1 << 22)
+/**
+ * Have the driver check the access asked by opens of existing files against the
+ * security descriptor it cached for them, see \ref DOKAN_OPTIONS.SecurityCacheTimeoutMs.
+ * \ref DokanIsAccessCheckedByDriver then tells \ref DOKAN_OPERATIONS.ZwCreateFile
+ * when the requestor was granted all of it, so that the file system can skip
+ * its own authorization. Opens the cache cannot grant are sent unchanged.
+ * The cache only holds the owner, group and DACL of a file once they were queried.
+ */
+#define DOKAN_OPTION_KERNEL_ACCESS_CHECK (1 << 23)
+/**
+ * Replace the timeout of each request by a liveness check of the whole file system:
+ * requests only time out once \ref DokanHeartbeat was not called for
+ * \ref DOKAN_OPTIONS.Timeout. The file system then calls it periodically from a
+ * thread that stops doing so when the file system is stuck, instead of calling
+ * \ref DokanResetTimeout for its long requests.
+ */
+#define DOKAN_OPTION_HEARTBEAT_TIMEOUT (1 << 24)
+/**
+ * Tell the driver that \ref DOKAN_OPERATIONS.WriteFile only returns once the data is durable,
+ * so that it completes the flushes of files without deferred changes itself, once the data
+ * cached for them was written, instead of calling \ref DOKAN_OPERATIONS.FlushFileBuffers.
+ */
+#define DOKAN_OPTION_WRITE_THROUGH (1 << 25)
+/**
+ * Have the driver hold the notifications of \ref DokanNotifyCreate and the other
+ * notify functions for a few milliseconds and report them together, merging repeated
+ * modifications of a file. When too many are held, the directory change waiters are
+ * woken to list their directories again instead.
+ */
+#define DOKAN_OPTION_COALESCE_NOTIFICATIONS (1 << 26)
+/**
+ * Have the driver grant the byte range locks that conflict with no other lock on the volume
+ * itself, and report them and the unlocks to \ref DOKAN_OPERATIONS.LockFile and
+ * \ref DOKAN_OPERATIONS.UnlockFile afterwards with \ref DOKAN_FILE_INFO.LockNotification set.
+ * Only the locks that conflict wait for LockFile, which can coordinate them with other machines,
+ * before the driver fails them or has them wait. Takes precedence over
+ * \ref DOKAN_OPTION_FILELOCK_USER_MODE.
+ */
+#define DOKAN_OPTION_FILELOCK_HYBRID (1 << 27)
+/**
+ * Have the driver complete the cleanups that do not delete the file, release byte range locks
+ * or end the last write access to the file without waiting for \ref DOKAN_OPERATIONS.Cleanup,
+ * so that closing such a handle does not wait for the file system. Cleanup is still called,
+ * possibly after CloseHandle returned, and always before \ref DOKAN_OPERATIONS.CloseFile.
+ * It can then also come after the next \ref DOKAN_OPERATIONS.ZwCreateFile of the same file, so
+ * the handles that denied some sharing to others are still cleaned up synchronously, for file
+ * systems that enforce the share mode with a backing handle closed in Cleanup. Any other state
+ * released in Cleanup must not make the next opens fail.
+ */
+#define DOKAN_OPTION_ASYNC_CLEANUP (1 << 28)
 
 /** @} */
 
@@ -142,7 +273,12 @@ typedef VOID *DOKAN_HANDLE, **PDOKAN_HANDLE;
  * \see DokanMain
  */
 typedef struct _DOKAN_OPTIONS {
-  /** Version of the Dokan features requested without dots (version "123" is equal to Dokan version 1.2.3). */
+  /**
+   * Version of the Dokan features requested without dots (version "123" is equal to Dokan version 1.2.3).
+   * The fields from \ref IpcBatchMinSize on, and the \ref DOKAN_OPERATIONS callbacks from
+   * \ref DOKAN_OPERATIONS.FindFilesWithCursor on, are only read with a version of 230 or above and
+   * are taken as 0 below.
+   */
   USHORT Version;
   /** Only use a single thread to process events. This is highly not recommended as can easily create a bottleneck. */
   BOOLEAN SingleThread;
@@ -172,6 +308,193 @@ typedef struct _DOKAN_OPTIONS {
   ULONG VolumeSecurityDescriptorLength;
   /** Optional Volume Security descriptor. See <a href="https://docs.microsoft.com/en-us/windows/win32/api/securitybaseapi/nf-securitybaseapi-initializesecuritydescriptor">InitializeSecurityDescriptor</a> */
   CHAR VolumeSecurityDescriptor[VOLUME_SECURITY_DESCRIPTOR_MAX_SIZE];
+  /**
+   * Smallest and largest size in bytes of the buffers used to pull batches of events from the driver
+   * with \ref DOKAN_OPTION_ALLOW_IPC_BATCHING. The size adapts between both to the load.
+   * Set 0 to use the defaults of 32KB and 128KB. The largest accepted size is 1MB.
+   */
+  ULONG IpcBatchMinSize;
+  ULONG IpcBatchMaxSize;
+  /**
+   * Number of metadata requests (create, cleanup, query information, directory listing...) the driver
+   * hands over for each bulk data request (read, write, flush) when both are waiting, so that file
+   * browsing stays responsive while large transfers are in progress.
+   * Set 0 to use the default of 8. The largest accepted weight is 1024.
+   */
+  ULONG MetadataLaneWeight;
+  /**
+   * Time in milliseconds during which the driver answers basic, standard and network open
+   * information queries of a file with what \ref DOKAN_OPERATIONS.GetFileInformation last returned
+   * for it, or \ref DOKAN_FILE_INFO.CreateFileInformation, without calling the file system again. Writes, attribute changes and the
+   * \ref DokanNotifyUpdate family of notifications invalidate it.
+   * Only enable it if the files do not change behind the back of the driver, or if showing
+   * attributes older by that time is acceptable. Set 0 to disable. The longest accepted time is 60s.
+   */
+  ULONG FileInfoCacheTimeoutMs;
+  /**
+   * Time in milliseconds during which the driver fails the opens of a path with
+   * STATUS_OBJECT_NAME_NOT_FOUND, without calling \ref DOKAN_OPERATIONS.ZwCreateFile, after
+   * the file system reported it missing. It only applies to opens that require the file to exist.
+   * Creates through the mount, renames and the \ref DokanNotifyCreate and \ref DokanNotifyRename
+   * notifications invalidate it. Only enable it if files are not created behind the back of
+   * the driver, or if missing them for that time is acceptable. Set 0 to disable. The longest
+   * accepted time is 60s.
+   */
+  ULONG NegativeCacheTimeoutMs;
+  /**
+   * Time in milliseconds during which the full listing of a directory returned by
+   * \ref DOKAN_OPERATIONS.FindFiles, or by \ref DOKAN_OPERATIONS.FindFilesWithPattern with "*",
+   * is reused for the scans of that directory made by any handle. Changes made through the mount
+   * and the \ref DokanNotifyPath family of notifications invalidate it. As with NTFS, the size
+   * and times of a file written through a handle show up in the listing once the handle is
+   * closed.
+   * Only enable it if the directories do not change behind the back of the library, or if
+   * listings older by that time are acceptable. Set 0 to disable.
+   */
+  ULONG DirectoryListCacheTimeoutMs;
+  /**
+   * Time in milliseconds during which the driver answers volume, attribute and free space
+   * queries with what \ref DOKAN_OPERATIONS.GetVolumeInformation and
+   * \ref DOKAN_OPERATIONS.GetDiskFreeSpace last returned, without calling the file system again.
+   * The file system can push new values at any time with \ref DokanUpdateDiskFreeSpace and
+   * \ref DokanUpdateVolumeInformation, which restarts that time.
+   * Set 0 to disable. The longest accepted time is 10 minutes.
+   */
+  ULONG VolumeInfoCacheTimeoutMs;
+  /**
+   * Time in milliseconds during which the driver answers security queries of a file with the
+   * descriptor \ref DOKAN_OPERATIONS.GetFileSecurity last returned for the same security
+   * information, without calling the file system again. This also answers locally the queries that
+   * only probe for the size of the descriptor. \ref DOKAN_OPERATIONS.SetFileSecurity, renames and
+   * the \ref DokanNotifyPath family of notifications invalidate it.
+   * Set 0 to disable. The longest accepted time is 60s.
+   */
+  ULONG SecurityCacheTimeoutMs;
+  /**
+   * Number of bytes the driver asks \ref DOKAN_OPERATIONS.ReadFile for past a non-cached or paging
+   * read once the handle reads the file sequentially. The surplus is kept by the driver to answer
+   * the next reads of the file without calling the file system, until a change made through the
+   * mount or a \ref DokanNotifyPath family notification drops it. ReadFile must therefore accept
+   * reads larger than what applications ask for.
+   * Set 0 to disable. The largest accepted size is 8MB.
+   */
+  ULONG ReadAheadWindowSize;
+  /**
+   * Most bytes the read-ahead windows of the mount can hold together.
+   * Set 0 to use the default of 64MB. The largest accepted limit is 1GB.
+   */
+  ULONG ReadAheadMemoryLimit;
+  /**
+   * Size of the buffer in which the driver holds back the small non-cached writes of a handle that
+   * each start where the previous one ended. They are completed right away and sent together to
+   * \ref DOKAN_OPERATIONS.WriteFile once the buffer is full, after \ref WriteBehindTimeoutMs, or
+   * before a flush, the cleanup of the handle, a write that does not follow or a read of the held
+   * range. Until then, size queries do not account for them. A failure of WriteFile for held writes
+   * is returned by the next write, flush or read of the handle.
+   * Set 0 to disable. The largest accepted size is 1MB.
+   */
+  ULONG WriteBehindMaxSize;
+  /**
+   * Longest time in milliseconds a write is held back. The age of the held writes is checked every
+   * few seconds, so it can be exceeded by that much.
+   * Set 0 to use the default of 1s. The longest accepted time is 60s.
+   */
+  ULONG WriteBehindTimeoutMs;
+  /**
+   * Most bytes the driver spends on keeping the state of closed files for their next open. Past
+   * it, the least recently closed files are forgotten right away rather than after a few seconds.
+   * Set 0 to use the default of 32MB. The largest accepted limit is 1GB.
+   */
+  ULONG FcbCacheMemoryLimit;
+  /**
+   * Size of the chunks in which reads and writes longer than it are split, to give the chunks to
+   * \ref DOKAN_OPERATIONS.ReadFile and \ref DOKAN_OPERATIONS.WriteFile concurrently on several
+   * pool threads. Chunks start at the file offsets that are multiples of the size, which is rounded
+   * down to a multiple of 4KB. The chunks of a request share its \ref DOKAN_FILE_INFO, so the
+   * callbacks must accept concurrent calls for the same handle. Writes to the end of file are not split.
+   * Set 0 to disable.
+   */
+  ULONG ParallelIoChunkSize;
+  /**
+   * Most threads, including the one that received the request, handling the chunks of a request
+   * split by \ref ParallelIoChunkSize at the same time.
+   * Set 0 to use the default of 4. The largest accepted value is 64.
+   */
+  ULONG ParallelIoMaxFanOut;
+  /**
+   * Processor group whose NUMA nodes process the requests of the mount with
+   * \ref DOKAN_OPTION_PROCESSOR_GROUP. Ignored if no node belongs to it.
+   */
+  ULONG ProcessorGroup;
+  /**
+   * Fewest threads waiting for requests from the driver, which also process the requests they
+   * pull. Set 0 to use one per processor of the process, between 2 and 16.
+   */
+  ULONG MinThreads;
+  /**
+   * Most threads waiting for requests from the driver. When above \ref MinThreads, threads are
+   * added while requests queue up in the driver and the callbacks keep the threads busy, and
+   * retired after their next request once the mount is idle. The current count is returned by
+   * \ref DokanGetThreadMetrics. Set 0 to keep \ref MinThreads threads. The largest accepted value
+   * is 256. Both are ignored with \ref SingleThread.
+   */
+  ULONG MaxThreads;
+  /**
+   * Most batches of requests of the mount the threads of \ref DOKAN_OPTION_SHARED_DISPATCH
+   * handle at the same time, which is also the number of pulls the mount keeps waiting in the
+   * driver. Set 0 to use the default of 2. The largest accepted value is 64.
+   */
+  ULONG SharedDispatchQuota;
+  /**
+   * Number of pulls of requests the mount keeps waiting in the driver with
+   * \ref DOKAN_OPTION_OVERLAPPED_PULL. Set 0 to use twice \ref MinThreads. The largest accepted
+   * value is 256.
+   */
+  ULONG PullQueueDepth;
+  /**
+   * Largest read or write the disk device of the mount advertises to applications that query its
+   * storage adapter with IOCTL_STORAGE_QUERY_PROPERTY, along with \ref SectorSize as its logical
+   * and physical sector size. Copy engines and databases sizing their I/O on it then issue
+   * transfers that large, which suits backends that prefer large I/O. It is not a limit:
+   * \ref DOKAN_OPERATIONS.ReadFile and \ref DOKAN_OPERATIONS.WriteFile still get any size. It is
+   * rounded down to a multiple of \ref SectorSize.
+   * Set 0 to use the default of 1MB. Values are brought between 64KB and 8MB.
+   */
+  ULONG MaxTransferSize;
+  /**
+   * Size of \ref DOKAN_FILE_INFO.InlineData, in which \ref DOKAN_OPERATIONS.ZwCreateFile can copy
+   * the start of the file it opens, so that the first reads of small files do not call
+   * \ref DOKAN_OPERATIONS.ReadFile. The data is kept with the read-ahead windows, so
+   * \ref ReadAheadWindowSize must be set as well.
+   * Set 0 to disable. The largest accepted size is 64KB.
+   */
+  ULONG InlineDataSize;
+  /**
+   * Time in milliseconds during which the flushes following a first one are grouped with it,
+   * to be made durable together by one call to \ref DOKAN_OPERATIONS.FlushFileBuffersGroup instead
+   * of one \ref DOKAN_OPERATIONS.FlushFileBuffers call each. Their completion is delayed by up to
+   * that time. Set 0, or leave FlushFileBuffersGroup NULL, to flush each handle on its own.
+   * The longest accepted time is 1 second.
+   */
+  ULONG FlushGroupWindowMs;
+  /**
+   * Step by which the allocation of a growing file is extended. An allocation set past the file
+   * size asks \ref DOKAN_OPERATIONS.SetAllocationSize for the next multiple of the step instead, and
+   * the sets that follow within it are completed by the driver without calling it. A file growing by
+   * small allocation sets then costs one call per step. Sets that may truncate the file always reach
+   * the file system.
+   * Only enable it if \ref DOKAN_OPERATIONS.SetAllocationSize never changes the file size for an
+   * allocation past it, as the rounded up allocation would otherwise grow the file by the step.
+   * Set 0 to disable. The largest accepted step is 64MB.
+   */
+  ULONG AllocationStepSize;
+  /**
+   * One in how many requests answered by the file system the driver samples to find the processes
+   * and the files that load the mount the most. See \ref DokanGetVolumeProfile. Each sample costs
+   * a copy of the file name and a short lock.
+   * Set 0 to disable.
+   */
+  ULONG ProfileSampleRate;
 } DOKAN_OPTIONS, *PDOKAN_OPTIONS;
 
 /**
@@ -214,6 +537,62 @@ typedef struct _DOKAN_FILE_INFO {
   UCHAR Nocache;
   /**  If \c TRUE, write to the current end of file instead of using the Offset parameter. */
   UCHAR WriteToEndOfFile;
+  /**
+   * Caching lease the file system grants on the file when \ref DOKAN_OPERATIONS.ZwCreateFile succeeds,
+   * for files it knows will not change behind the driver, such as read-mostly package caches.
+   * A combination of \c DOKAN_LEASE_ATTRIBUTES, to keep the attributes and security descriptor cached
+   * by the driver beyond \ref DOKAN_OPTIONS.FileInfoCacheTimeoutMs and \ref DOKAN_OPTIONS.SecurityCacheTimeoutMs,
+   * and \c DOKAN_LEASE_DATA, to read ahead of every non-cached read when
+   * \ref DOKAN_OPTIONS.ReadAheadWindowSize is set. Those caches must be enabled for the lease to have an effect.
+   * The lease can be revoked earlier with \ref DokanBreakLease.
+   */
+  ULONG LeaseLevel;
+  /** Time in milliseconds during which \ref LeaseLevel holds. The longest accepted time is 1 hour. */
+  ULONG LeaseDurationMs;
+  /**
+   * Information about the opened file that \ref DOKAN_OPERATIONS.ZwCreateFile can give on success,
+   * as \ref DOKAN_OPERATIONS.GetFileInformation would return it, by setting \ref HasCreateFileInformation.
+   * The driver then takes the file size from it and, when \ref DOKAN_OPTIONS.FileInfoCacheTimeoutMs is set,
+   * answers the following basic, standard and network open queries without calling GetFileInformation.
+   */
+  BY_HANDLE_FILE_INFORMATION CreateFileInformation;
+  /** Whether \ref CreateFileInformation was filled by \ref DOKAN_OPERATIONS.ZwCreateFile. */
+  UCHAR HasCreateFileInformation;
+  /**
+   * Buffer of \ref InlineDataSize bytes given to \ref DOKAN_OPERATIONS.ZwCreateFile when
+   * \ref DOKAN_OPTIONS.InlineDataSize is set, NULL otherwise. When it opens an existing file without
+   * overwriting it and sets \ref HasCreateFileInformation, ZwCreateFile can copy the start of the file
+   * there, the whole file if it fits, and set \ref InlineDataLength to the number of bytes copied.
+   * The driver then answers the first reads of that range itself.
+   */
+  PVOID InlineData;
+  ULONG InlineDataSize;
+  ULONG InlineDataLength;
+  /**
+   * Set for \ref DOKAN_OPERATIONS.LockFile and \ref DOKAN_OPERATIONS.UnlockFile when the driver
+   * already granted or released the range with \ref DOKAN_OPTION_FILELOCK_HYBRID. \ref Context
+   * is then not set, as the handle may already be closed, and the result is ignored.
+   */
+  UCHAR LockNotification;
+  /**
+   * Set for \ref DOKAN_OPERATIONS.ReadFile when the handle reads the file sequentially, so that the
+   * data following the read is likely to be read next. See \ref DokanHydrateRange.
+   */
+  UCHAR SequentialRead;
+  /**
+   * Cache hints \ref DOKAN_OPERATIONS.ZwCreateFile can give on success for the opened handle.
+   * A combination of \c DOKAN_CACHE_HINT_SEQUENTIAL, to read ahead of every non-cached read of the
+   * handle, \c DOKAN_CACHE_HINT_RANDOM and \c DOKAN_CACHE_HINT_NO_READ_AHEAD, to never read ahead
+   * of them, and \c DOKAN_CACHE_HINT_TEMPORARY, for files deleted soon after being written.
+   * The hints are also set as the matching flags of the file object. Read-ahead needs
+   * \ref DOKAN_OPTIONS.ReadAheadWindowSize.
+   */
+  ULONG CacheHints;
+  /**
+   * Read-ahead window of the handle, 0 for \ref DOKAN_OPTIONS.ReadAheadWindowSize.
+   * The largest accepted window is 8MB.
+   */
+  ULONG ReadAheadGranularity;
 } DOKAN_FILE_INFO, *PDOKAN_FILE_INFO;
 
 #define DOKAN_EXCEPTION_NOT_INITIALIZED 0x0f0ff0ff
@@ -226,6 +605,39 @@ typedef struct _DOKAN_FILE_INFO {
  */
 typedef int(WINAPI *PFillFindData)(PWIN32_FIND_DATAW, PDOKAN_FILE_INFO);
 
+/**
+ * \struct DOKAN_DIRECTORY_ENTRY
+ * \brief Directory entry given to \ref PFillDirectoryEntry
+ *
+ * Unlike WIN32_FIND_DATAW, the name is not copied in the entry but points to memory owned by
+ * the file system, and no short name is carried.
+ */
+typedef struct _DOKAN_DIRECTORY_ENTRY {
+  /** File attributes, see WIN32_FIND_DATAW.dwFileAttributes */
+  DWORD FileAttributes;
+  FILETIME CreationTime;
+  FILETIME LastAccessTime;
+  FILETIME LastWriteTime;
+  ULONG64 FileSize;
+  /** File id reported by the FileId classes, 0 if unknown */
+  ULONG64 FileId;
+  /** Length in characters of FileName, which has to be below MAX_PATH */
+  ULONG FileNameLength;
+  /**
+   * Name of the entry. It does not have to be null terminated and only has to stay valid during
+   * the call to \ref PFillDirectoryEntry.
+   */
+  LPCWSTR FileName;
+} DOKAN_DIRECTORY_ENTRY, *PDOKAN_DIRECTORY_ENTRY;
+
+/**
+ * \brief FillDirectoryEntry Used to add an entry in FindFilesWithCursor operation
+ *
+ * The entry is written straight into the reply of the request.
+ * \return 1 if buffer is full and the entry was not added, otherwise 0
+ */
+typedef int(WINAPI *PFillDirectoryEntry)(PDOKAN_DIRECTORY_ENTRY, PDOKAN_FILE_INFO);
+
 /**
  * \brief FillFindStreamData Used to add an entry in FindStreams
  * \return FALSE if the buffer is full, otherwise TRUE
@@ -333,6 +745,7 @@ typedef struct _DOKAN_OPERATIONS {
   *
   * \param FileName File path requested by the Kernel on the FileSystem.
   * \param Buffer Read buffer that has to be filled with the read result.
+  * With \ref DOKAN_OPTION_ZERO_COPY_READ it can be the buffer of the application itself.
   * \param BufferLength Buffer length and read size to continue with.
   * \param ReadLength Total data size that has been read.
   * \param Offset Offset from where the read has to be continued.
@@ -361,6 +774,7 @@ typedef struct _DOKAN_OPERATIONS {
   * 
   * \param FileName File path requested by the Kernel on the FileSystem.
   * \param Buffer Data that has to be written.
+  * With \ref DOKAN_OPTION_ZERO_COPY_WRITE it can be the read-only buffer of the application itself.
   * \param NumberOfBytesToWrite Buffer length and write size to continue with.
   * \param NumberOfBytesWritten Total number of bytes that have been written.
   * \param Offset Offset from where the write has to be continued.
@@ -408,6 +822,8 @@ typedef struct _DOKAN_OPERATIONS {
   * \ref DOKAN_OPERATIONS.FindFilesWithPattern is checked first. If it is not implemented or
   * returns \c STATUS_NOT_IMPLEMENTED, then FindFiles is called, if assigned.
   * It is recommended to have this implemented for performance reason.
+  * When the number of entries is known beforehand, \ref DokanReserveFindData avoids
+  * growing the listing as they are given.
   *
   * \param FileName File path requested by the Kernel on the FileSystem.
   * \param FillFindData Callback that has to be called with PWIN32_FIND_DATAW that contain file information.
@@ -580,7 +996,8 @@ typedef struct _DOKAN_OPERATIONS {
   * \brief LockFile Dokan API callback
   *
   * Lock file at a specific offset and data length.
-  * This is only used if \ref DOKAN_OPTION_FILELOCK_USER_MODE is enabled.
+  * This is only used if \ref DOKAN_OPTION_FILELOCK_USER_MODE or
+  * \ref DOKAN_OPTION_FILELOCK_HYBRID is enabled.
   *
   * \param FileName File path requested by the Kernel on the FileSystem.
   * \param ByteOffset Offset from where the lock has to be continued.
@@ -598,7 +1015,8 @@ typedef struct _DOKAN_OPERATIONS {
   * \brief UnlockFile Dokan API callback
   *
   * Unlock file at a specific offset and data length.
-  * This is only used if \ref DOKAN_OPTION_FILELOCK_USER_MODE is enabled.
+  * This is only used if \ref DOKAN_OPTION_FILELOCK_USER_MODE or
+  * \ref DOKAN_OPTION_FILELOCK_HYBRID is enabled.
   *
   * \param FileName File path requested by the Kernel on the FileSystem.
   * \param ByteOffset Offset from where the lock has to be continued.
@@ -771,6 +1189,158 @@ typedef struct _DOKAN_OPERATIONS {
     PVOID FindStreamContext,
     PDOKAN_FILE_INFO DokanFileInfo);
 
+  /**
+  * \brief FindFilesWithCursor Dokan API callback
+  *
+  * Lists the entries of a directory from a position, writing them straight into the reply of the
+  * request instead of collecting the whole listing first. It is checked before
+  * \ref DOKAN_OPERATIONS.FindFilesWithPattern and \ref DOKAN_OPERATIONS.FindFiles, which are used
+  * instead if it is not implemented or returns \c STATUS_NOT_IMPLEMENTED.
+  *
+  * FillDirectoryEntry has to be called for the entries of the directory in a stable order, starting
+  * with the one at position StartIndex of the listing, until it returns 1 once the reply is full.
+  * The entry it returned 1 for is not consumed and is given again by the next call. Entries that
+  * do not match the search pattern can be given, the library filters them out, but they count
+  * in the positions. "." and ".." are listed by the library and their entries are skipped.
+  *
+  * Each request of an enumeration ends up in a call, so the listing of a large directory never
+  * has to be held in memory. The directory listing cache of
+  * \ref DOKAN_OPTIONS.DirectoryListCacheTimeoutMs is not used.
+  *
+  * \param PathName Path requested by the Kernel on the FileSystem.
+  * \param SearchPattern Search pattern, see \ref DokanIsNameInExpression.
+  * \param StartIndex Position in the listing of the first entry to give.
+  * \param LastFileName Name of the entry at position StartIndex - 1 when the previous request of
+  * the handle stopped there, \c NULL otherwise. It can be used to resume the enumeration without
+  * counting StartIndex entries.
+  * \param FillDirectoryEntry Callback that has to be called with a \ref DOKAN_DIRECTORY_ENTRY for each entry.
+  * \param DokanFileInfo Information about the file or directory.
+  * \return \c STATUS_SUCCESS on success, including when the end of the directory is reached, or
+  * NTSTATUS appropriate to the request result.
+  * \see FindFiles
+  */
+  NTSTATUS(DOKAN_CALLBACK *FindFilesWithCursor)(LPCWSTR PathName,
+    LPCWSTR SearchPattern,
+    ULONG StartIndex,
+    LPCWSTR LastFileName,
+    PFillDirectoryEntry FillDirectoryEntry,
+    PDOKAN_FILE_INFO DokanFileInfo);
+
+  /**
+  * \brief CopyFileRange Dokan API callback
+  *
+  * Copies a range of a file of the volume into another one, or into another range of the same
+  * file, without the data going through the caller. It is the FSCTL_DUPLICATE_EXTENTS_TO_FILE
+  * (block cloning) request, which callers only try when \ref DOKAN_OPERATIONS.GetVolumeInformation
+  * reports \c FILE_SUPPORTS_BLOCK_REFCOUNTING and otherwise copy the data with reads and writes.
+  *
+  * The data cached by the system for the source range is written before the call and the cache of
+  * the target range is dropped after it. The target range is expected to be within the file,
+  * callers extend it beforehand.
+  *
+  * \param FileName File path requested by the Kernel on the FileSystem, the target of the copy.
+  * \param TargetOffset Offset in the target file to copy to.
+  * \param SourceFileName Path of the file to copy from, opened by the caller with read access. It
+  * can be \a FileName.
+  * \param SourceOffset Offset in the source file to copy from.
+  * \param Length Number of bytes to copy.
+  * \param DokanFileInfo Information about the target file.
+  * \return \c STATUS_SUCCESS on success or NTSTATUS appropriate to the request result.
+  * \see <a href="https://learn.microsoft.com/en-us/windows/win32/api/winioctl/ni-winioctl-fsctl_duplicate_extents_to_file">FSCTL_DUPLICATE_EXTENTS_TO_FILE (MSDN)</a>
+  */
+  NTSTATUS(DOKAN_CALLBACK *CopyFileRange)(LPCWSTR FileName,
+    LONGLONG TargetOffset,
+    LPCWSTR SourceFileName,
+    LONGLONG SourceOffset,
+    LONGLONG Length,
+    PDOKAN_FILE_INFO DokanFileInfo);
+
+  /**
+  * \brief SetSparseFile Dokan API callback
+  *
+  * Makes a file sparse or not, the FSCTL_SET_SPARSE request. A sparse file reports
+  * \c FILE_ATTRIBUTE_SPARSE_FILE in its attributes. Callers only send it when
+  * \ref DOKAN_OPERATIONS.GetVolumeInformation reports \c FILE_SUPPORTS_SPARSE_FILES.
+  *
+  * \param FileName File path requested by the Kernel on the FileSystem.
+  * \param Sparse Whether the file is made sparse.
+  * \param DokanFileInfo Information about the file.
+  * \return \c STATUS_SUCCESS on success or NTSTATUS appropriate to the request result.
+  * \see <a href="https://learn.microsoft.com/en-us/windows/win32/api/winioctl/ni-winioctl-fsctl_set_sparse">FSCTL_SET_SPARSE (MSDN)</a>
+  */
+  NTSTATUS(DOKAN_CALLBACK *SetSparseFile)(LPCWSTR FileName,
+    BOOL Sparse,
+    PDOKAN_FILE_INFO DokanFileInfo);
+
+  /**
+  * \brief ZeroFileRange Dokan API callback
+  *
+  * Zeroes a range of a file, the FSCTL_SET_ZERO_DATA request. The space of the range can be
+  * released, the range then is a hole that \ref DOKAN_OPERATIONS.QueryAllocatedRanges does not
+  * report. The file size does not change, the part of the range past the end of the file is
+  * ignored.
+  *
+  * The data cached by the system for the range is written before the call and dropped after it.
+  *
+  * \param FileName File path requested by the Kernel on the FileSystem.
+  * \param Offset Offset of the first byte to zero.
+  * \param Length Number of bytes to zero.
+  * \param DokanFileInfo Information about the file.
+  * \return \c STATUS_SUCCESS on success or NTSTATUS appropriate to the request result.
+  * \see <a href="https://learn.microsoft.com/en-us/windows/win32/api/winioctl/ni-winioctl-fsctl_set_zero_data">FSCTL_SET_ZERO_DATA (MSDN)</a>
+  */
+  NTSTATUS(DOKAN_CALLBACK *ZeroFileRange)(LPCWSTR FileName,
+    LONGLONG Offset,
+    LONGLONG Length,
+    PDOKAN_FILE_INFO DokanFileInfo);
+
+  /**
+  * \brief QueryAllocatedRanges Dokan API callback
+  *
+  * Lists the ranges of a file that hold data, the FSCTL_QUERY_ALLOCATED_RANGES request. Backup
+  * and copy tools use it to skip the holes of sparse files instead of reading their zeros.
+  * The ranges are given in increasing order, clipped to the queried range and to the file
+  * size. Ranges can be reported larger than the data they hold, reporting the whole file is
+  * always correct.
+  *
+  * The data cached by the system for the range is written before the call.
+  *
+  * \param FileName File path requested by the Kernel on the FileSystem.
+  * \param Offset Offset of the range to query.
+  * \param Length Length of the range to query.
+  * \param Ranges Buffer to fill with the allocated ranges.
+  * \param MaxRangeCount Number of ranges Ranges can hold.
+  * \param RangeCount Number of ranges written to Ranges.
+  * \param DokanFileInfo Information about the file.
+  * \return \c STATUS_SUCCESS on success, \c STATUS_BUFFER_OVERFLOW when Ranges is full and more
+  * ranges follow, or NTSTATUS appropriate to the request result.
+  * \see <a href="https://learn.microsoft.com/en-us/windows/win32/api/winioctl/ni-winioctl-fsctl_query_allocated_ranges">FSCTL_QUERY_ALLOCATED_RANGES (MSDN)</a>
+  */
+  NTSTATUS(DOKAN_CALLBACK *QueryAllocatedRanges)(LPCWSTR FileName,
+    LONGLONG Offset,
+    LONGLONG Length,
+    PFILE_ALLOCATED_RANGE_BUFFER Ranges,
+    DWORD MaxRangeCount,
+    LPDWORD RangeCount,
+    PDOKAN_FILE_INFO DokanFileInfo);
+
+  /**
+  * \brief FlushFileBuffersGroup Dokan API callback
+  *
+  * Makes the data written to all the given files durable at once, for the flushes grouped
+  * with \ref DOKAN_OPTIONS.FlushGroupWindowMs. Each of the flushes completes with the returned
+  * status. It is called from a thread pool thread and cannot complete asynchronously.
+  *
+  * \param FileNames File paths of the flushes, a file can appear more than once.
+  * \param DokanFileInfos Information about the files, in the same order.
+  * \param Count Number of flushes in the group.
+  * \return \c STATUS_SUCCESS on success or NTSTATUS appropriate to the request result.
+  * \see FlushFileBuffers
+  */
+  NTSTATUS(DOKAN_CALLBACK *FlushFileBuffersGroup)(LPCWSTR *FileNames,
+    PDOKAN_FILE_INFO *DokanFileInfos,
+    ULONG Count);
+
 } DOKAN_OPERATIONS, *PDOKAN_OPERATIONS;
 
 // clang-format on
@@ -831,6 +1401,19 @@ VOID DOKANAPI DokanInit();
  */
 VOID DOKANAPI DokanShutdown();
 
+/**
+ * \brief Allocate the big event results with large pages.
+ *
+ * Results of at least a large page, used by big reads and directory listings, are then backed by large
+ * pages when the system has some available, and by normal pages otherwise.
+ * \ref DokanInit also reserves a region of large pages from which the buffers pulling the events and
+ * the smaller results are carved, falling back to normal pages once it is exhausted.
+ * This needs to be called before \ref DokanInit and requires the process to hold SeLockMemoryPrivilege.
+ *
+ * \return \c TRUE if large pages will be used.
+ */
+BOOL DOKANAPI DokanUseLargePages();
+
 /**
  * \brief Mount a new Dokan Volume.
  *
@@ -917,6 +1500,30 @@ BOOL DOKANAPI DokanUnregisterWaitForFileSystemClosed(_In_ HANDLE WaitHandle,
  */
 VOID DOKANAPI DokanCloseHandle(_In_ DOKAN_HANDLE DokanInstance);
 
+/**
+ * \brief Callback of \ref DokanCloseHandleAsync.
+ *
+ * \param Context The context given to \ref DokanCloseHandleAsync.
+ */
+typedef VOID(DOKAN_CALLBACK *PDOKAN_CLOSE_HANDLE_CALLBACK)(_In_opt_ PVOID Context);
+
+/**
+ * \brief Unmount the Dokan instance without waiting.
+ *
+ * Same as \ref DokanCloseHandle, run from a worker thread of the process default thread pool.
+ * Callback is called from that thread once all resources of the \c DokanInstance are released,
+ * so that a process stopping several mounts, e.g. for a restart, can unmount them in parallel.
+ * The \c DokanInstance must not be used once this returns \c TRUE.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Callback Optional function called once the instance is unmounted and released.
+ * \param Context Context given to Callback.
+ * \return \c TRUE if the unmount was started, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanCloseHandleAsync(_In_ DOKAN_HANDLE DokanInstance,
+                                    _In_opt_ PDOKAN_CLOSE_HANDLE_CALLBACK Callback,
+                                    _In_opt_ PVOID Context);
+
 /**
  * \brief Unmount a Dokan device from a driver letter.
  *
@@ -977,6 +1584,31 @@ ULONG DOKANAPI DokanDriverVersion();
  */
 BOOL DOKANAPI DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO DokanFileInfo);
 
+/**
+ * \brief Extends the timeout of all the IO operations in progress on a volume.
+ *
+ * Does what \ref DokanResetTimeout does for each of them, in a single call to
+ * the driver, for example while the backend of the file system reconnects.
+ * Operations already given a longer timeout keep it.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Timeout Extended time in milliseconds requested.
+ * \return If the operation was successful.
+ */
+BOOL DOKANAPI DokanResetAllTimeouts(_In_ DOKAN_HANDLE DokanInstance,
+                                    ULONG Timeout);
+
+/**
+ * \brief Tells the driver that the file system is alive.
+ *
+ * Only for volumes mounted with \ref DOKAN_OPTION_HEARTBEAT_TIMEOUT, where it has
+ * to be called more often than \ref DOKAN_OPTIONS.Timeout for requests not to time out.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \return If the operation was successful.
+ */
+BOOL DOKANAPI DokanHeartbeat(_In_ DOKAN_HANDLE DokanInstance);
+
 /**
  * \brief Get the handle to Access Token.
  *
@@ -989,6 +1621,50 @@ BOOL DOKANAPI DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO DokanFileInfo);
  */
 HANDLE DOKANAPI DokanOpenRequestorToken(PDOKAN_FILE_INFO DokanFileInfo);
 
+/**
+ * \brief Get the ids of the Access Token of the requestor, without asking the driver for it.
+ *
+ * This method needs be called in \ref DOKAN_OPERATIONS.ZwCreateFile callback. A token id is never
+ * reused, so a token opened with \ref DokanOpenRequestorToken for a request can be kept and used
+ * again for the next requests with the same ids, instead of opening it each time.
+ *
+ * \param DokanFileInfo \ref DOKAN_FILE_INFO of the operation.
+ * \param AuthenticationId Receives the logon session of the token.
+ * \param TokenId Receives the unique id of the token.
+ * \return \c FALSE if the ids are unknown, in which case the token has to be opened.
+ */
+BOOL DOKANAPI DokanGetRequestorTokenIds(PDOKAN_FILE_INFO DokanFileInfo,
+                                        PLUID AuthenticationId,
+                                        PLUID TokenId);
+
+/**
+ * \brief Whether the driver already granted the access asked by the open.
+ *
+ * This method needs be called in \ref DOKAN_OPERATIONS.ZwCreateFile callback. It
+ * only returns \c TRUE with \ref DOKAN_OPTION_KERNEL_ACCESS_CHECK, for opens of
+ * existing files whose cached security descriptor grants the requestor all the
+ * desired access.
+ *
+ * \param DokanFileInfo \ref DOKAN_FILE_INFO of the operation.
+ * \return \c TRUE if the file system does not have to check the access itself.
+ */
+BOOL DOKANAPI DokanIsAccessCheckedByDriver(PDOKAN_FILE_INFO DokanFileInfo);
+
+/**
+ * \brief Makes room for the entries of the listing being given.
+ *
+ * This method can be called in \ref DOKAN_OPERATIONS.FindFiles and
+ * \ref DOKAN_OPERATIONS.FindFilesWithPattern callbacks, before calling FillFindData,
+ * with the number of entries the directory is expected to have. It is only a hint:
+ * more or fewer entries can still be given.
+ *
+ * \param EntryCount Number of entries expected.
+ * \param DokanFileInfo \ref DOKAN_FILE_INFO of the operation.
+ * \return \c FALSE if called outside of those callbacks or if the memory could not be allocated.
+ */
+BOOL DOKANAPI DokanReserveFindData(ULONG EntryCount,
+                                   PDOKAN_FILE_INFO DokanFileInfo);
+
 /**
  * \brief Get active Dokan mount points.
  *
@@ -1011,6 +1687,447 @@ PDOKAN_MOUNT_POINT_INFO DOKANAPI DokanGetMountPointList(BOOL uncOnly, PULONG nbR
  */
 VOID DOKANAPI DokanReleaseMountPointList(PDOKAN_MOUNT_POINT_INFO list);
 
+/**
+ * \brief Get the request metrics of a mounted Dokan volume.
+ *
+ * The driver counts, per IRP major function, the requests answered by the
+ * file system, the bytes they transferred and histograms of their latency,
+ * split between the time waiting to be pulled and the time spent in user mode.
+ * This is meant to be scraped periodically by a monitoring agent.
+ *
+ * \ref VOLUME_METRICS_EX.FcbCache also tells how often opens reuse the state the driver keeps for
+ * closed files, bounded by \ref DOKAN_OPTIONS.FcbCacheMemoryLimit.
+ * The allocation metrics at the end are driver wide: they tell how many requests were prepared
+ * without a pool allocation. \ref VOLUME_METRICS_EX.QueuedEvents is the number of requests waiting
+ * for the file system to pull them.
+ *
+ * A driver older than the DLL may fill less than the whole struct:
+ * \ref VOLUME_METRICS_EX.Version and \ref VOLUME_METRICS_EX.Length tell what
+ * was returned, and the rest is zeroed.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Metrics Receives the metrics of the volume.
+ * \return \c TRUE if the metrics were retrieved, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanGetVolumeMetrics(_In_ DOKAN_HANDLE DokanInstance,
+                                    _Out_ PVOLUME_METRICS_EX Metrics);
+
+/**
+ * \struct DOKAN_THREAD_METRICS
+ * \brief Threads of a mount waiting for requests from the driver.
+ * \see DokanGetThreadMetrics
+ */
+typedef struct _DOKAN_THREAD_METRICS {
+  /** Threads currently waiting for or processing requests pulled from the driver. */
+  ULONG Threads;
+  /** Number of threads the mount scales to, between MinThreads and MaxThreads. */
+  ULONG TargetThreads;
+  /** Bounds applied from \ref DOKAN_OPTIONS.MinThreads and \ref DOKAN_OPTIONS.MaxThreads. */
+  ULONG MinThreads;
+  ULONG MaxThreads;
+  /** Threads added and retired since the mount. */
+  ULONG64 ThreadsAdded;
+  ULONG64 ThreadsRetired;
+  /** Requests waiting in the driver when the thread count was last evaluated. */
+  ULONG64 QueuedEvents;
+  /** Percentage of the time of the threads spent in the callbacks over the last evaluation. */
+  ULONG BusyPercent;
+} DOKAN_THREAD_METRICS, *PDOKAN_THREAD_METRICS;
+
+/**
+ * \brief Get the thread metrics of a mounted Dokan volume.
+ *
+ * Tells how many threads the mount currently has waiting for requests, see
+ * \ref DOKAN_OPTIONS.MaxThreads.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Metrics Receives the thread metrics of the mount.
+ * \return \c TRUE if the metrics were retrieved, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanGetThreadMetrics(_In_ DOKAN_HANDLE DokanInstance,
+                                    _Out_ PDOKAN_THREAD_METRICS Metrics);
+
+/** Number of buckets of \ref DOKAN_DISPATCH_METRICS.LatencyHistogram */
+#define DOKAN_METRICS_HISTOGRAM_BUCKETS 24
+
+/**
+ * \enum DOKAN_METRICS_OPERATION
+ * \brief Index in \ref DOKAN_INSTANCE_METRICS.Operations of the requests of each kind.
+ */
+typedef enum _DOKAN_METRICS_OPERATION {
+  DokanMetricsCreate,
+  DokanMetricsCleanup,
+  DokanMetricsClose,
+  DokanMetricsDirectoryControl,
+  DokanMetricsRead,
+  DokanMetricsWrite,
+  DokanMetricsQueryInformation,
+  DokanMetricsSetInformation,
+  DokanMetricsQueryVolumeInformation,
+  DokanMetricsFlushBuffers,
+  DokanMetricsLockControl,
+  DokanMetricsQuerySecurity,
+  DokanMetricsSetSecurity,
+  /** Driver logs and any other request */
+  DokanMetricsOther,
+  DokanMetricsOperationCount
+} DOKAN_METRICS_OPERATION;
+
+/**
+ * \struct DOKAN_DISPATCH_METRICS
+ * \brief Requests of a kind dispatched to the callbacks of a mount.
+ * \see DokanGetInstanceMetrics
+ */
+typedef struct _DOKAN_DISPATCH_METRICS {
+  /** Requests dispatched. */
+  ULONG64 Count;
+  /** Requests whose callback returned another status than \c STATUS_SUCCESS. */
+  ULONG64 Failures;
+  /**
+   * Time spent dispatching the requests, callbacks included, and the longest of them.
+   * For operations left pending by their callback, only the time until the callback returned.
+   */
+  ULONG64 TotalTimeUs;
+  ULONG64 MaxTimeUs;
+  /** Requests that waited for a pool thread after being pulled, and their total wait. */
+  ULONG64 QueuedCount;
+  ULONG64 QueueTimeUs;
+  /** Bytes returned to the driver, which include the data read and written. */
+  ULONG64 Bytes;
+  /**
+   * Number of requests per dispatch time. Bucket 0 counts those below 1us, bucket N those from
+   * 2^(N-1) to 2^N us, and the last one everything longer.
+   */
+  ULONG64 LatencyHistogram[DOKAN_METRICS_HISTOGRAM_BUCKETS];
+} DOKAN_DISPATCH_METRICS, *PDOKAN_DISPATCH_METRICS;
+
+/**
+ * \struct DOKAN_POOL_METRICS
+ * \brief Reuse of the objects of an internal pool of dokan.dll.
+ */
+typedef struct _DOKAN_POOL_METRICS {
+  /** Objects taken from the pool. */
+  ULONG64 Hits;
+  /** Objects allocated because the pool was empty. */
+  ULONG64 Misses;
+} DOKAN_POOL_METRICS, *PDOKAN_POOL_METRICS;
+
+/**
+ * \struct DOKAN_INSTANCE_METRICS
+ * \brief Metrics recorded by dokan.dll for a mount.
+ * \see DokanGetInstanceMetrics
+ */
+typedef struct _DOKAN_INSTANCE_METRICS {
+  /** Time in milliseconds since the metrics are recorded. */
+  ULONG64 ElapsedMs;
+  /** Requests of each \ref DOKAN_METRICS_OPERATION. */
+  DOKAN_DISPATCH_METRICS Operations[DokanMetricsOperationCount];
+  /** Object pools, shared by all the mounts of the process. */
+  DOKAN_POOL_METRICS IoBatchPool;
+  DOKAN_POOL_METRICS IoEventPool;
+  DOKAN_POOL_METRICS EventResultPool;
+  DOKAN_POOL_METRICS OpenInfoPool;
+  DOKAN_POOL_METRICS DirectoryListPool;
+} DOKAN_INSTANCE_METRICS, *PDOKAN_INSTANCE_METRICS;
+
+/**
+ * \brief Get the metrics recorded by dokan.dll for a mounted Dokan volume.
+ *
+ * Tells how many requests of each kind were dispatched to the callbacks, how long they took,
+ * how long they waited for a thread and how many bytes they returned, next to the volume
+ * metrics of the driver returned by \ref DokanGetVolumeMetrics.
+ *
+ * Nothing is recorded until the first call, which starts the recording and returns zeros,
+ * so that mounts whose metrics are never read do not pay for them. The counters are updated
+ * without lock by the threads processing the requests and can be read at any time.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Metrics Receives the metrics of the mount.
+ * \return \c TRUE if the metrics were retrieved, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanGetInstanceMetrics(_In_ DOKAN_HANDLE DokanInstance,
+                                      _Out_ PDOKAN_INSTANCE_METRICS Metrics);
+
+/**
+ * \struct DOKAN_DISPATCH_INFO
+ * \brief Request given to the \ref DOKAN_DISPATCH_HOOKS of a mount.
+ */
+typedef struct _DOKAN_DISPATCH_INFO {
+  /** IRP major and minor function of the request. */
+  UCHAR MajorFunction;
+  UCHAR MinorFunction;
+  /** Serial number of the request, the same in the pre and post dispatch hooks. */
+  ULONG SerialNumber;
+  /** Process that issued the request. */
+  ULONG ProcessId;
+  /**
+   * Path of the file the request is about, not null terminated, and its length in bytes.
+   * NULL for volume requests, and in the post dispatch hook of requests left pending.
+   */
+  LPCWSTR FileName;
+  ULONG FileNameLength;
+  /**
+   * Post dispatch only: \c QueryPerformanceCounter ticks spent dispatching the request, and its
+   * status, \c STATUS_PENDING if the callback left it pending.
+   */
+  LONG64 ElapsedTicks;
+  NTSTATUS Status;
+} DOKAN_DISPATCH_INFO, *PDOKAN_DISPATCH_INFO;
+
+/**
+ * \brief Hook called by \ref DOKAN_DISPATCH_HOOKS around each request.
+ *
+ * \param DispatchInfo The request, only valid during the call.
+ * \param HookContext \ref DOKAN_DISPATCH_HOOKS.HookContext.
+ */
+typedef VOID(WINAPI *PDokanDispatchHook)(_In_ PDOKAN_DISPATCH_INFO DispatchInfo,
+                                         _In_opt_ PVOID HookContext);
+
+/**
+ * \struct DOKAN_DISPATCH_HOOKS
+ * \brief Instrumentation hooks called around the dispatch of each request to the callbacks.
+ * \see DokanSetDispatchHooks
+ */
+typedef struct _DOKAN_DISPATCH_HOOKS {
+  /** Called before the request is dispatched, can be NULL. */
+  PDokanDispatchHook PreDispatch;
+  /** Called once the callback returned, can be NULL. */
+  PDokanDispatchHook PostDispatch;
+  /** Given as is to the hooks. */
+  PVOID HookContext;
+} DOKAN_DISPATCH_HOOKS, *PDOKAN_DISPATCH_HOOKS;
+
+/**
+ * \brief Set the instrumentation hooks of a mounted Dokan volume.
+ *
+ * Lets a file system profile its requests in process, for example to find which paths or
+ * processes the time goes to, without changing dokan.dll. The hooks run on the thread
+ * dispatching the request, right before and right after it, and add to its latency: they
+ * have to be short and must not call back into the volume. Mounts without hooks only test
+ * a pointer per request.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Hooks The hooks, which must stay valid until the mount is closed, or NULL to remove
+ * them. Requests being dispatched when they are changed may still use the previous ones.
+ * \return \c TRUE if the hooks were set, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanSetDispatchHooks(_In_ DOKAN_HANDLE DokanInstance,
+                                    _In_opt_ PDOKAN_DISPATCH_HOOKS Hooks);
+
+/**
+ * \brief Start recording the requests of a mounted Dokan volume to a file.
+ *
+ * Every request dispatched to the callbacks is written with the thread dispatching it and when,
+ * followed by the status it was answered with, so that the stream can later be replayed with
+ * \ref DokanReplayEventRecording against another implementation, to reproduce a workload
+ * offline. The data of the writes is not recorded, only their length.
+ *
+ * Recording adds a copy of each request under a lock; mounts that are not recorded only test
+ * a pointer per request.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param FileName Path of the recording, replaced if it exists.
+ * \return \c TRUE if the recording started, \c FALSE if the file could not be created or the
+ * mount is already recorded.
+ * \see DokanStopEventRecording
+ */
+BOOL DOKANAPI DokanStartEventRecording(_In_ DOKAN_HANDLE DokanInstance,
+                                       _In_ LPCWSTR FileName);
+
+/**
+ * \brief Stop the recording started by \ref DokanStartEventRecording and close its file.
+ *
+ * Also done when the mount is closed.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \return \c TRUE if the recording was written completely, \c FALSE if it was not started or
+ * writing it failed.
+ */
+BOOL DOKANAPI DokanStopEventRecording(_In_ DOKAN_HANDLE DokanInstance);
+
+/** Replay the requests at the pace they were recorded instead of as fast as possible. */
+#define DOKAN_REPLAY_ORIGINAL_SPEED 1
+
+/**
+ * \struct DOKAN_REPLAY_RESULT
+ * \brief Outcome of \ref DokanReplayEventRecording.
+ */
+typedef struct _DOKAN_REPLAY_RESULT {
+  /** Requests dispatched. */
+  ULONG64 Events;
+  /** Requests on files opened before the recording started, which are not replayed. */
+  ULONG64 Skipped;
+  /** Requests answered with another status than they were when recorded. */
+  ULONG64 StatusMismatches;
+  /** Time the replay took, and the time the recorded requests spanned. */
+  ULONG64 ElapsedUs;
+  ULONG64 RecordedUs;
+} DOKAN_REPLAY_RESULT, *PDOKAN_REPLAY_RESULT;
+
+/**
+ * \brief Replay a recording of \ref DokanStartEventRecording against a file system.
+ *
+ * The requests are dispatched to DokanOperations in the order they were recorded, one at a
+ * time on the calling thread, without a mount: the file system only sees its callbacks being
+ * called as they were for the recorded mount. Writes carry zeros of the recorded length.
+ * Requests that need the driver, like opening the requestor token, fail, and handles still
+ * open at the end of the recording are not closed.
+ *
+ * \ref DokanInit must have been called.
+ *
+ * \param FileName Path of the recording.
+ * \param DokanOptions Options the file system is given. Asynchronous and zero-copy operations
+ * are not used during a replay.
+ * \param DokanOperations The callbacks to replay the requests on.
+ * \param Flags 0 to dispatch the requests as fast as possible, or \ref DOKAN_REPLAY_ORIGINAL_SPEED.
+ * \param Result Receives the outcome of the replay. Can be NULL.
+ * \return \c TRUE if the whole recording was replayed, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanReplayEventRecording(_In_ LPCWSTR FileName,
+                                        _In_ PDOKAN_OPTIONS DokanOptions,
+                                        _In_ PDOKAN_OPERATIONS DokanOperations,
+                                        _In_ ULONG Flags,
+                                        _Out_opt_ PDOKAN_REPLAY_RESULT Result);
+
+/**
+ * \brief Push the free space of a mounted Dokan volume to the driver.
+ *
+ * The values replace the answers to free space queries cached by the driver
+ * when \ref DOKAN_OPTIONS.VolumeInfoCacheTimeoutMs is set, so that a file
+ * system that knows when its usage changes can keep them accurate without
+ * being called back. It has no effect if the cache is disabled.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param FreeBytesAvailable Amount of available space.
+ * \param TotalNumberOfBytes Total size of storage space.
+ * \param TotalNumberOfFreeBytes Amount of free space.
+ * \return \c TRUE if the driver took the values, \c FALSE otherwise.
+ * \see DOKAN_OPERATIONS.GetDiskFreeSpace
+ */
+BOOL DOKANAPI DokanUpdateDiskFreeSpace(_In_ DOKAN_HANDLE DokanInstance,
+                                       ULONGLONG FreeBytesAvailable,
+                                       ULONGLONG TotalNumberOfBytes,
+                                       ULONGLONG TotalNumberOfFreeBytes);
+
+/**
+ * \brief Drop the volume information cached by the driver for a mounted Dokan volume.
+ *
+ * The next volume and attribute queries call \ref DOKAN_OPERATIONS.GetVolumeInformation
+ * again. Call it after the values it returns changed.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \return \c TRUE if the cached information was dropped, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanUpdateVolumeInformation(_In_ DOKAN_HANDLE DokanInstance);
+
+/**
+ * \brief Break the caching lease of a file of a mounted Dokan volume.
+ *
+ * Revokes the lease granted through \ref DOKAN_FILE_INFO.LeaseLevel before it expires
+ * and drops the attributes, security descriptor and data the driver cached for the file,
+ * so that the next requests call the file system again. Call it before or after changing the file.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param FileName Path of the file relative to the volume root, as given to \ref DOKAN_OPERATIONS.ZwCreateFile.
+ * \return \c TRUE if the lease was broken or the driver had nothing cached for the file, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanBreakLease(_In_ DOKAN_HANDLE DokanInstance,
+                              _In_ LPCWSTR FileName);
+
+/**
+ * \brief Hand data of an open file to the driver before it is read.
+ *
+ * Meant for file systems that fetch file contents from remote storage: once a file is opened, it
+ * can stream the data in from a background thread and hand each piece over as it arrives, instead
+ * of having \ref DOKAN_OPERATIONS.ReadFile wait for it. The driver keeps the data, appended to the
+ * previous piece when it follows it, up to the read-ahead window limit, and answers the reads of
+ * that range without calling ReadFile. \ref DOKAN_FILE_INFO.SequentialRead tells which reads are
+ * worth fetching ahead of. The data is dropped like read-ahead data when the file changes.
+ * Needs \ref DOKAN_OPTIONS.ReadAheadWindowSize.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param FileName Path of the file relative to the volume root, as given to \ref DOKAN_OPERATIONS.ZwCreateFile.
+ * \param ByteOffset Offset of the data in the file.
+ * \param Buffer The data.
+ * \param Length Size of the data in bytes.
+ * \param EndOfFile Whether the data ends at the end of the file.
+ * \return \c TRUE if the data was kept or the file is not open, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanHydrateRange(_In_ DOKAN_HANDLE DokanInstance,
+                                _In_ LPCWSTR FileName, _In_ LONGLONG ByteOffset,
+                                _In_reads_bytes_(Length) LPCVOID Buffer,
+                                _In_ DWORD Length, _In_ BOOL EndOfFile);
+
+/**
+ * \brief Measure the round trip of requests between the driver and this process.
+ *
+ * The driver sends EventCount requests to the mount one after the other. The library answers
+ * them without calling any \ref DOKAN_OPERATIONS, so their round trip is the cost of the
+ * transport alone, as a baseline for the latency of the file system operations. Must not be
+ * called from a callback of the mount when it has a single thread.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param EventCount Number of requests to send, at most \c DOKAN_ECHO_MAX_EVENT_COUNT.
+ * \param Result Receives the number of requests answered and their round trip times in microseconds.
+ * \return \c TRUE if all the requests were answered, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanEcho(_In_ DOKAN_HANDLE DokanInstance, _In_ ULONG EventCount,
+                        _Out_ PDOKAN_ECHO Result);
+
+/**
+ * \brief Get the processes and the files sampled the most on the mount.
+ *
+ * Requires \ref DOKAN_OPTIONS.ProfileSampleRate. The counts are approximate: an entry can inherit
+ * up to its \c Error samples from the entry it replaced.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Reset Whether to clear the profile once it is returned.
+ * \param Profile Receives the profile.
+ * \return \c TRUE if the profile was returned, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanGetVolumeProfile(_In_ DOKAN_HANDLE DokanInstance,
+                                    _In_ BOOL Reset,
+                                    _Out_ PDOKAN_VOLUME_PROFILE Profile);
+
+/**
+ * \brief Complete an operation whose callback returned \c STATUS_PENDING.
+ *
+ * Only \ref DOKAN_OPERATIONS.ReadFile, \ref DOKAN_OPERATIONS.WriteFile and
+ * \ref DOKAN_OPERATIONS.FlushFileBuffers can return \c STATUS_PENDING, when the mount has
+ * \ref DOKAN_OPTION_ASYNC_OPERATIONS. Until this is called, the arguments given to the callback,
+ * including the buffer and \ref DOKAN_FILE_INFO, stay valid. This can be called from any thread,
+ * even before the callback returns, and exactly once per pending operation. All the pending
+ * operations must be completed before \ref DokanCloseHandle.
+ *
+ * \param DokanFileInfo The \ref DOKAN_FILE_INFO given to the callback.
+ * \param Status What the callback would have returned had it completed the operation itself.
+ * \param Information What the callback would have returned in the length it outputs, 0 for flushes.
+ */
+VOID DOKANAPI DokanCompleteOperation(_In_ PDOKAN_FILE_INFO DokanFileInfo,
+                                     _In_ NTSTATUS Status,
+                                     _In_ ULONG Information);
+
+/**
+ * \brief Read the logs recorded by the driver.
+ *
+ * The driver keeps the last messages logged on each processor in fixed-size rings, recording the
+ * global logs once a volume was mounted with \ref DOKAN_OPTION_DISPATCH_DRIVER_LOGS.
+ * Older messages are overwritten, so the rings are best drained regularly by passing the
+ * \ref DOKAN_LOG_RECORD.Time of the last record read as the cursor of the next call,
+ * until no record is returned.
+ *
+ * \param Cursor Only the records logged after this time are returned. 0 returns all of them.
+ * \param Records Array receiving the records, from the oldest to the newest.
+ * \param MaxRecords Number of records the array can hold.
+ * \param RecordCount Number of records returned.
+ * \return \c TRUE if the records could be read, \c FALSE otherwise.
+ */
+BOOL DOKANAPI DokanGetDriverLogs(_In_ LONGLONG Cursor,
+                                 _Out_writes_to_(MaxRecords, *RecordCount)
+                                     PDOKAN_LOG_RECORD Records,
+                                 _In_ ULONG MaxRecords,
+                                 _Out_ PULONG RecordCount);
+
 /**
  * \brief Convert \ref DOKAN_OPERATIONS.ZwCreateFile parameters to <a href="https://msdn.microsoft.com/en-us/library/windows/desktop/aa363858(v=vs.85).aspx">CreateFile</a> parameters.
  *
@@ -1110,6 +2227,36 @@ BOOL DOKANAPI DokanNotifyRename(_In_ DOKAN_HANDLE DokanInstance,
                                 _In_ BOOL IsDirectory,
                                 _In_ BOOL IsInSameDirectory);
 
+/**
+ * \struct DOKAN_NOTIFY_ENTRY
+ * \brief Change notified with \ref DokanNotifyBatch
+ */
+typedef struct _DOKAN_NOTIFY_ENTRY {
+  /** Absolute path to the file or directory, including the mount-point of the file system. */
+  LPCWSTR FilePath;
+  /** FILE_NOTIFY_CHANGE_* flags of the change, such as \c FILE_NOTIFY_CHANGE_FILE_NAME. */
+  ULONG CompletionFilter;
+  /** FILE_ACTION_* value of the change, such as \c FILE_ACTION_ADDED. */
+  ULONG Action;
+} DOKAN_NOTIFY_ENTRY, *PDOKAN_NOTIFY_ENTRY;
+
+/**
+ * \brief Notify dokan of many changes at once.
+ *
+ * The changes are sent to the driver in as few requests as possible and reported in order.
+ * It is much cheaper than calling the other DokanNotify* functions for each of them when a large
+ * set of changes is applied, such as a remote change set being synchronized.
+ * A change identical to the one before it is only reported once.
+ *
+ * \param DokanInstance The dokan mount context created by \ref DokanCreateFileSystem .
+ * \param Entries Changes to notify.
+ * \param Count Number of entries of Entries.
+ * \return \c TRUE if all the notifications succeeded.
+ */
+BOOL DOKANAPI DokanNotifyBatch(_In_ DOKAN_HANDLE DokanInstance,
+                               _In_reads_(Count) PDOKAN_NOTIFY_ENTRY Entries,
+                               _In_ ULONG Count);
+
 /**@}*/
 
 /**
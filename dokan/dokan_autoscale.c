@@ -0,0 +1,245 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokan_autoscale.h"
+#include "dokan_pool.h"
+
+// Autoscaling of the main pull threads.
+//
+// When DOKAN_OPTIONS.MaxThreads is above MinThreads, a timer of the instance
+// compares every DOKAN_AUTOSCALE_INTERVAL_MS the number of events waiting in
+// the driver with the share of the time the main pull threads spent blocked in
+// the callbacks. Events queuing up while the threads are busy mean the
+// requests wait for a thread: the target thread count grows by the queue
+// depth, at most doubling per interval, and the missing threads are queued.
+// Once nothing is queued and the threads are mostly idle for
+// DOKAN_AUTOSCALE_IDLE_INTERVALS in a row, the target shrinks by one.
+//
+// A main pull thread above the target exits after sending the result of its
+// next event. Pulls without a result to send wait for events without timeout,
+// so a thread idle in the driver stays until traffic resumes.
+
+#define DOKAN_AUTOSCALE_INTERVAL_MS 250
+#define DOKAN_AUTOSCALE_BUSY_PERCENT 75
+#define DOKAN_AUTOSCALE_IDLE_PERCENT 25
+#define DOKAN_AUTOSCALE_IDLE_INTERVALS 8
+
+ULONG InitializePullThreadAutoscale(PDOKAN_INSTANCE DokanInstance,
+                                    ULONG DefaultThreadCount) {
+  PDOKAN_OPTIONS options = DokanInstance->DokanOptions;
+  ULONG minThreads = DefaultThreadCount;
+  ULONG maxThreads;
+
+  if (!options->SingleThread && options->MinThreads) {
+    minThreads = min(options->MinThreads, DOKAN_MAIN_PULL_THREAD_COUNT_LIMIT);
+  }
+  maxThreads = minThreads;
+  if (!options->SingleThread && options->MaxThreads) {
+    maxThreads = min(max(options->MaxThreads, minThreads),
+                     DOKAN_MAIN_PULL_THREAD_COUNT_LIMIT);
+  }
+  DokanInstance->MinPullThreads = minThreads;
+  DokanInstance->MaxPullThreads = maxThreads;
+  DokanInstance->PullThreadTarget = (LONG)minThreads;
+  return minThreads;
+}
+
+BOOL IsPullThreadAutoscaleEnabled(PDOKAN_INSTANCE DokanInstance) {
+  return DokanInstance->MaxPullThreads > DokanInstance->MinPullThreads;
+}
+
+VOID AddCallbackBusyTime(PDOKAN_INSTANCE DokanInstance, LONG64 StartTicks) {
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  InterlockedAdd64(&DokanInstance->CallbackBusyTicks,
+                   now.QuadPart - StartTicks);
+}
+
+BOOL RetirePullThread(PDOKAN_INSTANCE DokanInstance) {
+  LONG count;
+  if (!IsPullThreadAutoscaleEnabled(DokanInstance)) {
+    return FALSE;
+  }
+  count = InterlockedCompareExchange(&DokanInstance->PullThreadCount, 0, 0);
+  while (count > InterlockedCompareExchange(&DokanInstance->PullThreadTarget,
+                                            0, 0)) {
+    LONG previous = InterlockedCompareExchange(&DokanInstance->PullThreadCount,
+                                               count - 1, count);
+    if (previous == count) {
+      InterlockedIncrement64(&DokanInstance->PullThreadsRetired);
+      return TRUE;
+    }
+    count = previous;
+  }
+  return FALSE;
+}
+
+// Returns the number of events waiting in the driver, or -1 if the driver does
+// not tell.
+static LONG64 QueryQueuedEvents(PDOKAN_INSTANCE DokanInstance) {
+  PVOLUME_METRICS_EX metrics = DokanInstance->AutoscaleMetrics;
+  DWORD returnedLength = 0;
+  if (!DeviceIoControl(DokanInstance->Device, FSCTL_GET_VOLUME_METRICS_EX,
+                       NULL, 0, metrics, sizeof(VOLUME_METRICS_EX),
+                       &returnedLength, NULL) ||
+      metrics->Version < 4 ||
+      metrics->Length < FIELD_OFFSET(VOLUME_METRICS_EX, QueuedEvents) +
+                            sizeof(metrics->QueuedEvents)) {
+    return -1;
+  }
+  return (LONG64)metrics->QueuedEvents;
+}
+
+static VOID CALLBACK AutoscaleTimerCallback(PTP_CALLBACK_INSTANCE Instance,
+                                            PVOID Context, PTP_TIMER Timer) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Timer);
+
+  PDOKAN_INSTANCE dokanInstance = (PDOKAN_INSTANCE)Context;
+  LARGE_INTEGER now;
+  LONG64 busyTicks;
+  LONG64 elapsedTicks;
+  LONG64 queuedEvents;
+  LONG threads;
+  LONG target;
+  LONG busyPercent;
+
+  if (dokanInstance->FileSystemStopped) {
+    return;
+  }
+  QueryPerformanceCounter(&now);
+  busyTicks = InterlockedCompareExchange64(&dokanInstance->CallbackBusyTicks,
+                                           0, 0);
+  elapsedTicks = now.QuadPart - dokanInstance->AutoscaleLastTime;
+  threads = InterlockedCompareExchange(&dokanInstance->PullThreadCount, 0, 0);
+  if (elapsedTicks <= 0 || threads <= 0) {
+    return;
+  }
+  // Events dispatched to the thread pool count too, hence the cap.
+  busyPercent = (LONG)min(
+      (busyTicks - dokanInstance->AutoscaleLastBusyTicks) * 100 /
+          (elapsedTicks * threads),
+      100);
+  dokanInstance->AutoscaleLastBusyTicks = busyTicks;
+  dokanInstance->AutoscaleLastTime = now.QuadPart;
+  queuedEvents = QueryQueuedEvents(dokanInstance);
+  InterlockedExchange64(&dokanInstance->AutoscaleQueuedEvents, queuedEvents);
+  InterlockedExchange(&dokanInstance->AutoscaleBusyPercent, busyPercent);
+
+  target = InterlockedCompareExchange(&dokanInstance->PullThreadTarget, 0, 0);
+  if (busyPercent >= DOKAN_AUTOSCALE_BUSY_PERCENT && queuedEvents != 0 &&
+      (ULONG)target < dokanInstance->MaxPullThreads) {
+    // Without the queue depth from the driver, grow one thread at a time.
+    LONG added = (LONG)min(queuedEvents > 0 ? queuedEvents : 1, target);
+    added = min(max(added, 1),
+                (LONG)dokanInstance->MaxPullThreads - target);
+    dokanInstance->AutoscaleIdleIntervals = 0;
+    InterlockedExchange(&dokanInstance->PullThreadTarget, target + added);
+    DbgPrint("Dokan Information: Adding %d main pull threads to %d with %I64d "
+             "queued events and %d%% busy threads.\n",
+             added, threads, queuedEvents, busyPercent);
+    // Threads retiring meanwhile may leave fewer than the target, the next
+    // interval catches up.
+    threads = InterlockedCompareExchange(&dokanInstance->PullThreadCount, 0, 0);
+    while (threads < target + added) {
+      if (!QueueMainPullThread(dokanInstance)) {
+        break;
+      }
+      InterlockedIncrement64(&dokanInstance->PullThreadsAdded);
+      ++threads;
+    }
+  } else if (busyPercent < DOKAN_AUTOSCALE_IDLE_PERCENT && queuedEvents <= 0) {
+    if (++dokanInstance->AutoscaleIdleIntervals >=
+            DOKAN_AUTOSCALE_IDLE_INTERVALS &&
+        (ULONG)target > dokanInstance->MinPullThreads) {
+      dokanInstance->AutoscaleIdleIntervals = 0;
+      InterlockedExchange(&dokanInstance->PullThreadTarget, target - 1);
+    }
+  } else {
+    dokanInstance->AutoscaleIdleIntervals = 0;
+  }
+}
+
+VOID StartPullThreadAutoscale(PDOKAN_INSTANCE DokanInstance) {
+  ULARGE_INTEGER dueTime;
+  FILETIME fileDueTime;
+  LARGE_INTEGER now;
+
+  if (!IsPullThreadAutoscaleEnabled(DokanInstance)) {
+    return;
+  }
+  DokanInstance->AutoscaleMetrics = malloc(sizeof(VOLUME_METRICS_EX));
+  if (!DokanInstance->AutoscaleMetrics) {
+    DbgPrint("Dokan Warning: Failed to allocate the thread autoscale "
+             "buffer.\n");
+    return;
+  }
+  QueryPerformanceCounter(&now);
+  DokanInstance->AutoscaleLastTime = now.QuadPart;
+  DokanInstance->AutoscaleLastBusyTicks =
+      InterlockedCompareExchange64(&DokanInstance->CallbackBusyTicks, 0, 0);
+  DokanInstance->AutoscaleTimer = CreateThreadpoolTimer(
+      AutoscaleTimerCallback, DokanInstance,
+      &DokanInstance->ThreadInfo.CallbackEnvironment);
+  if (!DokanInstance->AutoscaleTimer) {
+    DbgPrint("Dokan Warning: Failed to create the thread autoscale timer: %d\n",
+             GetLastError());
+    return;
+  }
+  // Relative due time in 100 nanoseconds
+  dueTime.QuadPart =
+      (ULONGLONG)(-(LONGLONG)DOKAN_AUTOSCALE_INTERVAL_MS * 10000);
+  fileDueTime.dwHighDateTime = dueTime.HighPart;
+  fileDueTime.dwLowDateTime = dueTime.LowPart;
+  SetThreadpoolTimer(DokanInstance->AutoscaleTimer, &fileDueTime,
+                     DOKAN_AUTOSCALE_INTERVAL_MS, 0);
+}
+
+VOID DeletePullThreadAutoscale(PDOKAN_INSTANCE DokanInstance) {
+  DokanInstance->AutoscaleTimer = NULL;
+  free(DokanInstance->AutoscaleMetrics);
+  DokanInstance->AutoscaleMetrics = NULL;
+}
+
+BOOL DOKANAPI DokanGetThreadMetrics(_In_ DOKAN_HANDLE DokanInstance,
+                                    _Out_ PDOKAN_THREAD_METRICS Metrics) {
+  PDOKAN_INSTANCE instance = (PDOKAN_INSTANCE)DokanInstance;
+  if (!instance || !Metrics) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  ZeroMemory(Metrics, sizeof(DOKAN_THREAD_METRICS));
+  Metrics->Threads =
+      (ULONG)InterlockedCompareExchange(&instance->PullThreadCount, 0, 0);
+  Metrics->TargetThreads =
+      (ULONG)InterlockedCompareExchange(&instance->PullThreadTarget, 0, 0);
+  Metrics->MinThreads = instance->MinPullThreads;
+  Metrics->MaxThreads = instance->MaxPullThreads;
+  Metrics->ThreadsAdded = (ULONG64)InterlockedCompareExchange64(
+      &instance->PullThreadsAdded, 0, 0);
+  Metrics->ThreadsRetired = (ULONG64)InterlockedCompareExchange64(
+      &instance->PullThreadsRetired, 0, 0);
+  Metrics->QueuedEvents = (ULONG64)max(
+      InterlockedCompareExchange64(&instance->AutoscaleQueuedEvents, 0, 0), 0);
+  Metrics->BusyPercent =
+      (ULONG)InterlockedCompareExchange(&instance->AutoscaleBusyPercent, 0, 0);
+  return TRUE;
+}
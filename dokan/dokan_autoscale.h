@@ -0,0 +1,46 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DOKAN_AUTOSCALE_H_
+#define DOKAN_AUTOSCALE_H_
+
+#include "dokani.h"
+
+// Sets the bounds of the main pull threads of the instance from
+// DOKAN_OPTIONS.MinThreads and MaxThreads, DefaultThreadCount being used when
+// MinThreads is not set. Returns the number of main pull threads to start.
+ULONG InitializePullThreadAutoscale(PDOKAN_INSTANCE DokanInstance,
+                                    ULONG DefaultThreadCount);
+// Starts the controller once the main pull threads are queued. Does nothing if
+// the thread count is fixed.
+VOID StartPullThreadAutoscale(PDOKAN_INSTANCE DokanInstance);
+// Frees what the controller allocated. Its timer belongs to the cleanup group
+// of the instance, which must be closed first.
+VOID DeletePullThreadAutoscale(PDOKAN_INSTANCE DokanInstance);
+BOOL IsPullThreadAutoscaleEnabled(PDOKAN_INSTANCE DokanInstance);
+// Adds the performance counter ticks elapsed since StartTicks to the time spent
+// in the callbacks.
+VOID AddCallbackBusyTime(PDOKAN_INSTANCE DokanInstance, LONG64 StartTicks);
+// Returns whether the calling main pull thread has to exit, in which case it is
+// no longer counted as running.
+BOOL RetirePullThread(PDOKAN_INSTANCE DokanInstance);
+
+#endif
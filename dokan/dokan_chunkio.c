@@ -0,0 +1,206 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan_chunkio.h"
+#include "dokan_pool.h"
+
+// Parallel dispatch of large reads and writes.
+//
+// A read or write longer than DOKAN_OPTIONS.ParallelIoChunkSize is cut at the
+// file offsets that are multiples of the chunk size. The current thread and up
+// to DOKAN_OPTIONS.ParallelIoMaxFanOut - 1 works of the instance thread pool
+// take the chunks in turn and give each to ReadFile or WriteFile, straight into
+// the buffer of the event. The results are put back together in file order
+// once every chunk was handled, before the event is completed.
+//
+// As the current thread takes chunks too, the event never waits for a pool
+// thread to become available: the works that did not start by the time every
+// chunk was taken are cancelled.
+
+#define CHUNKED_IO_ALIGNMENT 4096
+#define CHUNKED_IO_DEFAULT_FAN_OUT 4
+#define CHUNKED_IO_MAX_FAN_OUT 64
+
+typedef struct _CHUNK_RESULT {
+  NTSTATUS Status;
+  ULONG TransferredLength;
+} CHUNK_RESULT, *PCHUNK_RESULT;
+
+typedef struct _CHUNKED_IO {
+  PDOKAN_IO_EVENT IoEvent;
+  LPCWSTR FileName;
+  PCHAR Buffer;
+  ULONG Length;
+  LONGLONG ByteOffset;
+  BOOL IsWrite;
+  ULONG ChunkSize;
+  ULONG ChunkCount;
+  /** Index of the next chunk to take */
+  volatile LONG NextChunk;
+  /** NUMA node of the pool threads taking chunks */
+  ULONG Node;
+  PCHUNK_RESULT Results;
+} CHUNKED_IO, *PCHUNKED_IO;
+
+static ULONG GetChunkSize(PDOKAN_INSTANCE DokanInstance) {
+  return DokanInstance->DokanOptions->ParallelIoChunkSize &
+         ~(ULONG)(CHUNKED_IO_ALIGNMENT - 1);
+}
+
+static ULONG GetFanOut(PDOKAN_INSTANCE DokanInstance) {
+  ULONG fanOut = DokanInstance->DokanOptions->ParallelIoMaxFanOut;
+  if (fanOut == 0) {
+    return CHUNKED_IO_DEFAULT_FAN_OUT;
+  }
+  return min(fanOut, CHUNKED_IO_MAX_FAN_OUT);
+}
+
+BOOL IsChunkedIo(PDOKAN_IO_EVENT IoEvent, ULONG Length) {
+  ULONG chunkSize = GetChunkSize(IoEvent->DokanInstance);
+  // Writes to the end of file have no offset to cut at, and the chunks cannot
+  // be left pending.
+  return chunkSize != 0 && Length > chunkSize &&
+         GetFanOut(IoEvent->DokanInstance) > 1 &&
+         !IoEvent->DokanFileInfo.WriteToEndOfFile &&
+         !(IoEvent->DokanInstance->DokanOptions->Options &
+           DOKAN_OPTION_ASYNC_OPERATIONS);
+}
+
+static VOID DispatchChunk(PCHUNKED_IO ChunkedIo, ULONG Index) {
+  PDOKAN_OPERATIONS operations =
+      ChunkedIo->IoEvent->DokanInstance->DokanOperations;
+  LONGLONG alignedOffset =
+      ChunkedIo->ByteOffset - ChunkedIo->ByteOffset % ChunkedIo->ChunkSize;
+  LONGLONG start = Index == 0 ? ChunkedIo->ByteOffset
+                              : alignedOffset + (LONGLONG)Index *
+                                                    ChunkedIo->ChunkSize;
+  LONGLONG end = min(alignedOffset + (LONGLONG)(Index + 1) *
+                                         ChunkedIo->ChunkSize,
+                     ChunkedIo->ByteOffset + ChunkedIo->Length);
+  PCHAR buffer = ChunkedIo->Buffer + (start - ChunkedIo->ByteOffset);
+  PCHUNK_RESULT result = &ChunkedIo->Results[Index];
+
+  if (ChunkedIo->IsWrite) {
+    result->Status = operations->WriteFile(
+        ChunkedIo->FileName, buffer, (DWORD)(end - start),
+        (LPDWORD)&result->TransferredLength, start,
+        &ChunkedIo->IoEvent->DokanFileInfo);
+  } else {
+    result->Status = operations->ReadFile(
+        ChunkedIo->FileName, buffer, (DWORD)(end - start),
+        (LPDWORD)&result->TransferredLength, start,
+        &ChunkedIo->IoEvent->DokanFileInfo);
+  }
+}
+
+static VOID DispatchChunks(PCHUNKED_IO ChunkedIo) {
+  for (;;) {
+    ULONG index = (ULONG)InterlockedIncrement(&ChunkedIo->NextChunk) - 1;
+    if (index >= ChunkedIo->ChunkCount) {
+      return;
+    }
+    DispatchChunk(ChunkedIo, index);
+  }
+}
+
+static VOID CALLBACK DispatchChunksCallback(PTP_CALLBACK_INSTANCE Instance,
+                                            PVOID Parameter, PTP_WORK Work) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Work);
+  BindThreadToPoolNode(((PCHUNKED_IO)Parameter)->Node);
+  DispatchChunks((PCHUNKED_IO)Parameter);
+}
+
+NTSTATUS DispatchChunkedIo(PDOKAN_IO_EVENT IoEvent, LPCWSTR FileName,
+                           PCHAR Buffer, ULONG Length, LONGLONG ByteOffset,
+                           BOOL IsWrite, PULONG TransferredLength) {
+  PTP_WORK works[CHUNKED_IO_MAX_FAN_OUT - 1];
+  PTP_CALLBACK_ENVIRON environment = NULL;
+  ULONG workCount = 0;
+  ULONG fanOut;
+  CHUNKED_IO chunkedIo;
+  NTSTATUS status = STATUS_SUCCESS;
+  ULONG i;
+
+  *TransferredLength = 0;
+  ZeroMemory(&chunkedIo, sizeof(CHUNKED_IO));
+  chunkedIo.IoEvent = IoEvent;
+  chunkedIo.FileName = FileName;
+  chunkedIo.Buffer = Buffer;
+  chunkedIo.Length = Length;
+  chunkedIo.ByteOffset = ByteOffset;
+  chunkedIo.IsWrite = IsWrite;
+  chunkedIo.ChunkSize = GetChunkSize(IoEvent->DokanInstance);
+  chunkedIo.ChunkCount =
+      (ULONG)((ByteOffset + Length - 1) / chunkedIo.ChunkSize -
+              ByteOffset / chunkedIo.ChunkSize + 1);
+  chunkedIo.Results = malloc(chunkedIo.ChunkCount * sizeof(CHUNK_RESULT));
+  if (!chunkedIo.Results) {
+    DbgPrint("Dokan Error: Failed to allocate the chunk results.\n");
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  fanOut = min(GetFanOut(IoEvent->DokanInstance), chunkedIo.ChunkCount);
+  // The chunks are handled on the node of the thread that received the request.
+  chunkedIo.Node = GetCurrentPoolNode();
+  environment =
+      GetNodeCallbackEnvironment(IoEvent->DokanInstance, &chunkedIo.Node);
+  for (; workCount < fanOut - 1; ++workCount) {
+    works[workCount] = CreateThreadpoolWork(DispatchChunksCallback, &chunkedIo,
+                                            environment);
+    if (!works[workCount]) {
+      DbgPrint("Dokan Warning: CreateThreadpoolWork() has returned error "
+               "code %u, dispatching fewer chunks in parallel.\n",
+               GetLastError());
+      break;
+    }
+    SubmitThreadpoolWork(works[workCount]);
+  }
+  DispatchChunks(&chunkedIo);
+  for (i = 0; i < workCount; ++i) {
+    // Every chunk was taken, the works that have not started have nothing to
+    // do.
+    WaitForThreadpoolWorkCallbacks(works[i], /*fCancelPendingCallbacks=*/TRUE);
+    CloseThreadpoolWork(works[i]);
+  }
+
+  for (i = 0; i < chunkedIo.ChunkCount; ++i) {
+    PCHUNK_RESULT result = &chunkedIo.Results[i];
+    ULONG chunkLength =
+        i == 0 ? (ULONG)min(chunkedIo.ChunkSize -
+                                ByteOffset % chunkedIo.ChunkSize,
+                            Length)
+               : min(chunkedIo.ChunkSize, Length - *TransferredLength);
+    // A read past the end of file only ends the data.
+    if (!IsWrite && i > 0 && result->Status == STATUS_END_OF_FILE) {
+      break;
+    }
+    if (result->Status != STATUS_SUCCESS) {
+      status = result->Status;
+      break;
+    }
+    *TransferredLength += result->TransferredLength;
+    if (result->TransferredLength < chunkLength) {
+      break;
+    }
+  }
+  free(chunkedIo.Results);
+  return status;
+}
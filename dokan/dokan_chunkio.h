@@ -0,0 +1,37 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_CHUNKIO_H_
+#define DOKAN_CHUNKIO_H_
+
+#include "dokani.h"
+
+// Whether a read or write of Length bytes should be split into chunks that are
+// given to the file system concurrently, see DOKAN_OPTIONS.ParallelIoChunkSize.
+BOOL IsChunkedIo(PDOKAN_IO_EVENT IoEvent, ULONG Length);
+// Calls ReadFile, or WriteFile if IsWrite is set, for each chunk of the Length
+// bytes of Buffer at ByteOffset, on up to DOKAN_OPTIONS.ParallelIoMaxFanOut
+// threads including the current one. Returns the first failure of a chunk, or
+// STATUS_SUCCESS with the bytes transferred up to the first short chunk.
+NTSTATUS DispatchChunkedIo(PDOKAN_IO_EVENT IoEvent, LPCWSTR FileName,
+                           PCHAR Buffer, ULONG Length, LONGLONG ByteOffset,
+                           BOOL IsWrite, PULONG TransferredLength);
+
+#endif
@@ -0,0 +1,439 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_CORO_HPP_
+#define DOKAN_CORO_HPP_
+
+// C++20 coroutine facade over the asynchronous completion of Dokan operations.
+//
+// ReadFile, WriteFile and FlushFileBuffers are written as coroutines returning
+// dokan::operation, and coroutine_operations<FileSystem>::fill() sets the
+// matching DOKAN_OPERATIONS callbacks. A callback starts its coroutine on the
+// pool thread that received the request. If the coroutine finishes without
+// suspending, the callback returns its result as usual. Otherwise the callback
+// returns STATUS_PENDING, and DokanCompleteOperation is called with the result
+// when the coroutine finishes on whichever thread resumed it. The mount must
+// therefore have DOKAN_OPTION_ASYNC_OPERATIONS, and DOKAN_OPTIONS.GlobalContext
+// must point to the FileSystem instance.
+//
+//   struct my_fs {
+//     dokan::iocp_executor executor;
+//     dokan::operation read_file(LPCWSTR file_name, LPVOID buffer,
+//                                DWORD buffer_length, LONGLONG offset,
+//                                PDOKAN_FILE_INFO dokan_file_info) {
+//       auto [error, bytes] = co_await executor.overlapped_io(
+//           [&](OVERLAPPED* overlapped) {
+//             return ::ReadFile(handle_of(dokan_file_info), buffer,
+//                               buffer_length, nullptr, overlapped);
+//           },
+//           offset);
+//       co_return dokan::result{DokanNtStatusFromWin32(error), bytes};
+//     }
+//   };
+//
+// Other callbacks cannot be left pending and use run_blocking() on their
+// coroutine instead.
+
+#include <dokan/dokan.h>
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace dokan {
+
+// Outcome of an operation: what the callback would have returned, and the
+// length it would have output, if any.
+struct result {
+  NTSTATUS status = STATUS_SUCCESS;
+  ULONG information = 0;
+};
+
+// Coroutine implementing a Dokan operation. It starts when the callback calls
+// start() and completes the Dokan request when it finishes.
+class operation {
+ public:
+  struct promise_type {
+    // How far the callback and the coroutine got. Whichever of the two gets
+    // second hands the result over and destroys the coroutine.
+    enum class state { running, pending, finished };
+
+    struct final_awaiter {
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+        promise_type& promise = handle.promise();
+        if (promise.state_.exchange(state::finished) != state::pending) {
+          return;
+        }
+        if (promise.done_event_) {
+          // run_blocking() takes the result and destroys the coroutine.
+          SetEvent(promise.done_event_);
+          return;
+        }
+        DokanCompleteOperation(promise.dokan_file_info_,
+                               promise.result_.status,
+                               promise.result_.information);
+        handle.destroy();
+      }
+      void await_resume() const noexcept {}
+    };
+
+    operation get_return_object() {
+      return operation(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void return_value(result value) { result_ = value; }
+    void unhandled_exception() noexcept {
+      result_ = {STATUS_INTERNAL_ERROR, 0};
+    }
+
+    PDOKAN_FILE_INFO dokan_file_info_ = nullptr;
+    // Set by run_blocking() to be signaled instead of completing the request.
+    HANDLE done_event_ = nullptr;
+    result result_;
+    std::atomic<state> state_{state::running};
+  };
+
+  operation(operation&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  operation(const operation&) = delete;
+  operation& operator=(const operation&) = delete;
+  ~operation() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  // Runs the coroutine until its first suspension. Returns its status and
+  // stores its length in Information if it finished, otherwise returns
+  // STATUS_PENDING and completes the request when it finishes.
+  NTSTATUS start(PDOKAN_FILE_INFO dokan_file_info,
+                 LPDWORD information = nullptr) && {
+    auto handle = std::exchange(handle_, nullptr);
+    promise_type& promise = handle.promise();
+    promise.dokan_file_info_ = dokan_file_info;
+    handle.resume();
+    if (promise.state_.exchange(promise_type::state::pending) !=
+        promise_type::state::finished) {
+      return STATUS_PENDING;
+    }
+    result value = promise.result_;
+    handle.destroy();
+    if (information) {
+      *information = value.information;
+    }
+    return value.status;
+  }
+
+  // Runs the coroutine and waits for it to finish, for callbacks that cannot
+  // return STATUS_PENDING.
+  result run_blocking() && {
+    auto handle = std::exchange(handle_, nullptr);
+    promise_type& promise = handle.promise();
+    promise.done_event_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!promise.done_event_) {
+      handle.destroy();
+      return {STATUS_INSUFFICIENT_RESOURCES, 0};
+    }
+    handle.resume();
+    if (promise.state_.exchange(promise_type::state::pending) !=
+        promise_type::state::finished) {
+      WaitForSingleObject(promise.done_event_, INFINITE);
+    }
+    CloseHandle(promise.done_event_);
+    result value = promise.result_;
+    handle.destroy();
+    return value;
+  }
+
+ private:
+  explicit operation(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Awaitable coroutine returning a T, to split an operation in smaller
+// coroutines. It starts when awaited and resumes its awaiter when it finishes.
+template <typename T>
+class task {
+ public:
+  struct promise_type {
+    struct final_awaiter {
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> handle) noexcept {
+        return handle.promise().continuation_;
+      }
+      void await_resume() const noexcept {}
+    };
+
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    template <typename U>
+    void return_value(U&& value) {
+      value_.emplace(std::forward<U>(value));
+    }
+    void unhandled_exception() noexcept {
+      exception_ = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation_;
+    std::optional<T> value_;
+    std::exception_ptr exception_;
+  };
+
+  task(task&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  ~task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) {
+    handle_.promise().continuation_ = awaiter;
+    return handle_;
+  }
+  T await_resume() {
+    if (handle_.promise().exception_) {
+      std::rethrow_exception(handle_.promise().exception_);
+    }
+    return std::move(*handle_.promise().value_);
+  }
+
+ private:
+  explicit task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Awaitable resuming the coroutine on a thread of the Win32 thread pool, or of
+// the pool of the given environment.
+class resume_on_thread_pool {
+ public:
+  explicit resume_on_thread_pool(PTP_CALLBACK_ENVIRON environment = nullptr)
+      : environment_(environment) {}
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> handle) noexcept {
+    // Resumed right away on the current thread if the pool is out of reach.
+    return TrySubmitThreadpoolCallback(&callback, handle.address(),
+                                       environment_) != FALSE;
+  }
+  void await_resume() const noexcept {}
+
+ private:
+  static VOID CALLBACK callback(PTP_CALLBACK_INSTANCE, PVOID context) {
+    std::coroutine_handle<>::from_address(context).resume();
+  }
+
+  PTP_CALLBACK_ENVIRON environment_;
+};
+
+// Completion port on which the threads calling run() resume the coroutines
+// scheduled on it and the ones waiting for an overlapped I/O of a handle
+// associated to it.
+class iocp_executor {
+ public:
+  iocp_executor()
+      : port_(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0)) {}
+  iocp_executor(const iocp_executor&) = delete;
+  iocp_executor& operator=(const iocp_executor&) = delete;
+  ~iocp_executor() {
+    if (port_) {
+      CloseHandle(port_);
+    }
+  }
+
+  // Whether the completion port could be created.
+  bool valid() const { return port_ != nullptr; }
+
+  // Makes the completions of the overlapped I/O of the handle resume their
+  // coroutine on the executor.
+  bool associate(HANDLE handle) {
+    return CreateIoCompletionPort(handle, port_, io_key, 0) != nullptr;
+  }
+
+  // Awaitable resuming the coroutine on a thread running the executor.
+  auto schedule() {
+    struct awaiter {
+      HANDLE port;
+      bool await_ready() const noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        return PostQueuedCompletionStatus(
+                   port, 0, schedule_key,
+                   static_cast<LPOVERLAPPED>(handle.address())) != FALSE;
+      }
+      void await_resume() const noexcept {}
+    };
+    return awaiter{port_};
+  }
+
+  // Result of an overlapped I/O: its Win32 error and the bytes transferred.
+  struct io_result {
+    DWORD error = ERROR_SUCCESS;
+    DWORD bytes = 0;
+  };
+
+  // Awaitable starting an overlapped I/O at Offset with Start(OVERLAPPED*),
+  // which returns the BOOL of the Win32 call, and resuming the coroutine when
+  // it completes. The handle must be associated to the executor.
+  template <typename Start>
+  auto overlapped_io(Start start, LONGLONG offset = 0) {
+    struct awaiter : io_operation {
+      awaiter(Start start, LONGLONG offset)
+          : io_operation{}, start(std::move(start)) {
+        this->Offset = static_cast<DWORD>(offset);
+        this->OffsetHigh = static_cast<DWORD>(offset >> 32);
+      }
+      Start start;
+      bool await_ready() const noexcept { return false; }
+      bool await_suspend(std::coroutine_handle<> handle) {
+        this->handle = handle;
+        if (start(static_cast<OVERLAPPED*>(this))) {
+          return true;
+        }
+        DWORD error = GetLastError();
+        if (error == ERROR_IO_PENDING) {
+          return true;
+        }
+        // Failed to start, so no completion is queued.
+        this->result.error = error;
+        return false;
+      }
+      io_result await_resume() const noexcept { return this->result; }
+    };
+    return awaiter(std::move(start), offset);
+  }
+
+  // Resumes the coroutines of the executor on the current thread until stop().
+  void run() {
+    for (;;) {
+      DWORD bytes = 0;
+      ULONG_PTR key = 0;
+      LPOVERLAPPED overlapped = nullptr;
+      BOOL success =
+          GetQueuedCompletionStatus(port_, &bytes, &key, &overlapped, INFINITE);
+      if (!overlapped) {
+        if (key == stop_key || !success) {
+          return;
+        }
+        continue;
+      }
+      if (key == schedule_key) {
+        std::coroutine_handle<>::from_address(overlapped).resume();
+        continue;
+      }
+      io_operation* operation = static_cast<io_operation*>(overlapped);
+      operation->result.error = success ? ERROR_SUCCESS : GetLastError();
+      operation->result.bytes = bytes;
+      operation->handle.resume();
+    }
+  }
+
+  // Makes a thread running the executor return. Call once per thread.
+  void stop() { PostQueuedCompletionStatus(port_, 0, stop_key, nullptr); }
+
+ private:
+  static constexpr ULONG_PTR io_key = 0;
+  static constexpr ULONG_PTR schedule_key = 1;
+  static constexpr ULONG_PTR stop_key = 2;
+
+  struct io_operation : OVERLAPPED {
+    std::coroutine_handle<> handle;
+    io_result result;
+  };
+
+  HANDLE port_;
+};
+
+// Sets the DOKAN_OPERATIONS callbacks of the coroutines FileSystem defines
+// among read_file, write_file and flush_file_buffers. DOKAN_OPTIONS.GlobalContext
+// must point to the FileSystem.
+template <typename FileSystem>
+struct coroutine_operations {
+  static void fill(DOKAN_OPERATIONS& operations) {
+    if constexpr (requires(FileSystem& fs) {
+                    fs.read_file(LPCWSTR{}, LPVOID{}, DWORD{}, LONGLONG{},
+                                 PDOKAN_FILE_INFO{});
+                  }) {
+      operations.ReadFile = &read_file;
+    }
+    if constexpr (requires(FileSystem& fs) {
+                    fs.write_file(LPCWSTR{}, LPCVOID{}, DWORD{}, LONGLONG{},
+                                  PDOKAN_FILE_INFO{});
+                  }) {
+      operations.WriteFile = &write_file;
+    }
+    if constexpr (requires(FileSystem& fs) {
+                    fs.flush_file_buffers(LPCWSTR{}, PDOKAN_FILE_INFO{});
+                  }) {
+      operations.FlushFileBuffers = &flush_file_buffers;
+    }
+  }
+
+ private:
+  static FileSystem& file_system(PDOKAN_FILE_INFO dokan_file_info) {
+    return *reinterpret_cast<FileSystem*>(
+        dokan_file_info->DokanOptions->GlobalContext);
+  }
+
+  static NTSTATUS DOKAN_CALLBACK read_file(LPCWSTR file_name, LPVOID buffer,
+                                           DWORD buffer_length,
+                                           LPDWORD read_length, LONGLONG offset,
+                                           PDOKAN_FILE_INFO dokan_file_info) {
+    return file_system(dokan_file_info)
+        .read_file(file_name, buffer, buffer_length, offset, dokan_file_info)
+        .start(dokan_file_info, read_length);
+  }
+
+  static NTSTATUS DOKAN_CALLBACK write_file(LPCWSTR file_name, LPCVOID buffer,
+                                            DWORD number_of_bytes_to_write,
+                                            LPDWORD number_of_bytes_written,
+                                            LONGLONG offset,
+                                            PDOKAN_FILE_INFO dokan_file_info) {
+    return file_system(dokan_file_info)
+        .write_file(file_name, buffer, number_of_bytes_to_write, offset,
+                    dokan_file_info)
+        .start(dokan_file_info, number_of_bytes_written);
+  }
+
+  static NTSTATUS DOKAN_CALLBACK flush_file_buffers(
+      LPCWSTR file_name, PDOKAN_FILE_INFO dokan_file_info) {
+    return file_system(dokan_file_info)
+        .flush_file_buffers(file_name, dokan_file_info)
+        .start(dokan_file_info);
+  }
+};
+
+}  // namespace dokan
+
+#endif  // DOKAN_CORO_HPP_
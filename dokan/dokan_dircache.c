@@ -0,0 +1,283 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan_dircache.h"
+
+#include <wctype.h>
+
+// Directory listing cache shared by all the opens of a mount.
+//
+// Full listings returned by FindFiles, or by FindFilesWithPattern with "*", are
+// kept by directory name for DOKAN_OPTIONS.DirectoryListCacheTimeoutMs. A new
+// scan of the directory by any handle is answered from them as long as the
+// file system would have been asked for a full listing too. Any change made
+// through the mount, and DokanNotifyPath, drops the listing of the changed
+// file and of its parent directory. A rename also drops the listings of all the
+// directories under the renamed one.
+//
+// Every change also bumps a generation, and a listing is only cached if no
+// change happened while the file system was producing it.
+
+#define DIR_LIST_CACHE_MAX_ENTRIES 256
+
+typedef struct _DIR_LIST_CACHE_ENTRY {
+  /** Link in DOKAN_INSTANCE.DirListCacheList, from the oldest to the newest */
+  LIST_ENTRY ListEntry;
+  /** Link in its bucket of DOKAN_INSTANCE.DirListCacheBuckets */
+  LIST_ENTRY BucketEntry;
+  ULONG Hash;
+  /** GetTickCount64 value when the listing was cached */
+  ULONGLONG Time;
+  PDOKAN_VECTOR DirList;
+  size_t DirectoryNameLength;
+  WCHAR DirectoryName[1];
+} DIR_LIST_CACHE_ENTRY, *PDIR_LIST_CACHE_ENTRY;
+
+static BOOL IsCaseSensitive(PDOKAN_INSTANCE DokanInstance) {
+  return DokanInstance->DokanOptions->Options & DOKAN_OPTION_CASE_SENSITIVE;
+}
+
+// Length of Name without trailing backslash, except for the root.
+static size_t GetNormalizedLength(LPCWSTR Name, size_t Length) {
+  while (Length > 1 && Name[Length - 1] == L'\\') {
+    --Length;
+  }
+  return Length;
+}
+
+static ULONG HashName(PDOKAN_INSTANCE DokanInstance, LPCWSTR Name,
+                      size_t Length) {
+  BOOL caseSensitive = IsCaseSensitive(DokanInstance);
+  ULONG hash = 2166136261;
+  for (size_t i = 0; i < Length; ++i) {
+    hash ^= caseSensitive ? Name[i] : towupper(Name[i]);
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+VOID InitializeDirListCache(PDOKAN_INSTANCE DokanInstance) {
+  (void)InitializeCriticalSectionAndSpinCount(
+      &DokanInstance->DirListCacheCriticalSection, 0x80000400);
+  InitializeListHead(&DokanInstance->DirListCacheList);
+  for (ULONG i = 0; i < DIR_LIST_CACHE_BUCKET_COUNT; ++i) {
+    InitializeListHead(&DokanInstance->DirListCacheBuckets[i]);
+  }
+}
+
+static VOID DeleteEntry(PDOKAN_INSTANCE DokanInstance,
+                        PDIR_LIST_CACHE_ENTRY Entry) {
+  RemoveEntryList(&Entry->ListEntry);
+  RemoveEntryList(&Entry->BucketEntry);
+  --DokanInstance->DirListCacheCount;
+  DokanVector_Free(Entry->DirList);
+  free(Entry);
+}
+
+VOID DeleteDirListCache(PDOKAN_INSTANCE DokanInstance) {
+  while (!IsListEmpty(&DokanInstance->DirListCacheList)) {
+    DeleteEntry(DokanInstance,
+                CONTAINING_RECORD(DokanInstance->DirListCacheList.Flink,
+                                  DIR_LIST_CACHE_ENTRY, ListEntry));
+  }
+  DeleteCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+}
+
+BOOL IsDirListCacheEnabled(PDOKAN_INSTANCE DokanInstance) {
+  return DokanInstance->DokanOptions->DirectoryListCacheTimeoutMs != 0;
+}
+
+// Must be called with DirListCacheCriticalSection held.
+static PDIR_LIST_CACHE_ENTRY FindEntry(PDOKAN_INSTANCE DokanInstance,
+                                       LPCWSTR Name, size_t Length) {
+  ULONG hash = HashName(DokanInstance, Name, Length);
+  PLIST_ENTRY bucket =
+      &DokanInstance->DirListCacheBuckets[hash % DIR_LIST_CACHE_BUCKET_COUNT];
+  BOOL caseSensitive = IsCaseSensitive(DokanInstance);
+
+  for (PLIST_ENTRY listEntry = bucket->Flink; listEntry != bucket;
+       listEntry = listEntry->Flink) {
+    PDIR_LIST_CACHE_ENTRY entry =
+        CONTAINING_RECORD(listEntry, DIR_LIST_CACHE_ENTRY, BucketEntry);
+    if (entry->Hash == hash && entry->DirectoryNameLength == Length &&
+        (caseSensitive ? wcsncmp(entry->DirectoryName, Name, Length)
+                       : _wcsnicmp(entry->DirectoryName, Name, Length)) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+BOOL GetCachedDirList(PDOKAN_INSTANCE DokanInstance, LPCWSTR DirectoryName,
+                      PDOKAN_VECTOR DirList) {
+  size_t length = GetNormalizedLength(DirectoryName, wcslen(DirectoryName));
+  ULONGLONG now = GetTickCount64();
+  BOOL found = FALSE;
+
+  if (!IsDirListCacheEnabled(DokanInstance) ||
+      DokanInstance->DirListCacheCount == 0) {
+    return FALSE;
+  }
+  EnterCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+  {
+    PDIR_LIST_CACHE_ENTRY entry =
+        FindEntry(DokanInstance, DirectoryName, length);
+    if (entry) {
+      if (now - entry->Time <
+          DokanInstance->DokanOptions->DirectoryListCacheTimeoutMs) {
+        found = DokanVector_GetCount(entry->DirList) == 0 ||
+                DokanVector_PushBackArray(
+                    DirList, DokanVector_GetItem(entry->DirList, 0),
+                    DokanVector_GetCount(entry->DirList));
+      } else {
+        DeleteEntry(DokanInstance, entry);
+      }
+    }
+  }
+  LeaveCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+  return found;
+}
+
+LONG64 GetDirListCacheGeneration(PDOKAN_INSTANCE DokanInstance) {
+  return InterlockedCompareExchange64(&DokanInstance->DirListCacheGeneration,
+                                      0, 0);
+}
+
+VOID AddCachedDirList(PDOKAN_INSTANCE DokanInstance, LPCWSTR DirectoryName,
+                      PDOKAN_VECTOR DirList, LONG64 Generation) {
+  size_t length = GetNormalizedLength(DirectoryName, wcslen(DirectoryName));
+  size_t count = DokanVector_GetCount(DirList);
+  PDIR_LIST_CACHE_ENTRY entry = NULL;
+  PDIR_LIST_CACHE_ENTRY oldEntry = NULL;
+
+  if (!IsDirListCacheEnabled(DokanInstance) ||
+      Generation != GetDirListCacheGeneration(DokanInstance)) {
+    return;
+  }
+  entry = malloc(sizeof(DIR_LIST_CACHE_ENTRY) + length * sizeof(WCHAR));
+  if (!entry) {
+    return;
+  }
+  entry->DirList =
+      DokanVector_AllocWithCapacity(DokanVector_GetItemSize(DirList), count);
+  if (!entry->DirList ||
+      (count > 0 && !DokanVector_PushBackArray(
+                        entry->DirList, DokanVector_GetItem(DirList, 0), count))) {
+    DbgPrint("Dokan Warning: Failed to copy the listing to cache it.\n");
+    if (entry->DirList) {
+      DokanVector_Free(entry->DirList);
+    }
+    free(entry);
+    return;
+  }
+  entry->Hash = HashName(DokanInstance, DirectoryName, length);
+  entry->Time = GetTickCount64();
+  entry->DirectoryNameLength = length;
+  wcsncpy_s(entry->DirectoryName, length + 1, DirectoryName, length);
+
+  EnterCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+  {
+    // Checked again under the lock as invalidations bump it while holding it.
+    if (Generation != GetDirListCacheGeneration(DokanInstance)) {
+      LeaveCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+      DokanVector_Free(entry->DirList);
+      free(entry);
+      return;
+    }
+    oldEntry = FindEntry(DokanInstance, DirectoryName, length);
+    if (oldEntry) {
+      DeleteEntry(DokanInstance, oldEntry);
+    }
+    InsertTailList(&DokanInstance->DirListCacheList, &entry->ListEntry);
+    InsertTailList(&DokanInstance->DirListCacheBuckets
+                        [entry->Hash % DIR_LIST_CACHE_BUCKET_COUNT],
+                   &entry->BucketEntry);
+    if (++DokanInstance->DirListCacheCount > DIR_LIST_CACHE_MAX_ENTRIES) {
+      DeleteEntry(DokanInstance,
+                  CONTAINING_RECORD(DokanInstance->DirListCacheList.Flink,
+                                    DIR_LIST_CACHE_ENTRY, ListEntry));
+    }
+  }
+  LeaveCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+}
+
+// Must be called with DirListCacheCriticalSection held.
+static VOID DeleteEntriesUnder(PDOKAN_INSTANCE DokanInstance, LPCWSTR Name,
+                               size_t Length) {
+  BOOL caseSensitive = IsCaseSensitive(DokanInstance);
+  PLIST_ENTRY listEntry = DokanInstance->DirListCacheList.Flink;
+
+  while (listEntry != &DokanInstance->DirListCacheList) {
+    PDIR_LIST_CACHE_ENTRY entry =
+        CONTAINING_RECORD(listEntry, DIR_LIST_CACHE_ENTRY, ListEntry);
+    listEntry = listEntry->Flink;
+    if (entry->DirectoryNameLength > Length &&
+        entry->DirectoryName[Length] == L'\\' &&
+        (caseSensitive ? wcsncmp(entry->DirectoryName, Name, Length)
+                       : _wcsnicmp(entry->DirectoryName, Name, Length)) == 0) {
+      DeleteEntry(DokanInstance, entry);
+    }
+  }
+}
+
+static VOID Invalidate(PDOKAN_INSTANCE DokanInstance, LPCWSTR FileName,
+                       size_t FileNameLength, BOOL Tree) {
+  size_t length = GetNormalizedLength(FileName, FileNameLength);
+  size_t parentLength = length;
+
+  if (!IsDirListCacheEnabled(DokanInstance)) {
+    return;
+  }
+  while (parentLength > 0 && FileName[parentLength - 1] != L'\\') {
+    --parentLength;
+  }
+  parentLength = GetNormalizedLength(FileName, parentLength);
+
+  EnterCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+  {
+    InterlockedIncrement64(&DokanInstance->DirListCacheGeneration);
+    if (DokanInstance->DirListCacheCount > 0) {
+      PDIR_LIST_CACHE_ENTRY entry = FindEntry(DokanInstance, FileName, length);
+      if (entry) {
+        DeleteEntry(DokanInstance, entry);
+      }
+      if (parentLength > 0) {
+        entry = FindEntry(DokanInstance, FileName, parentLength);
+        if (entry) {
+          DeleteEntry(DokanInstance, entry);
+        }
+      }
+      if (Tree) {
+        DeleteEntriesUnder(DokanInstance, FileName, length);
+      }
+    }
+  }
+  LeaveCriticalSection(&DokanInstance->DirListCacheCriticalSection);
+}
+
+VOID InvalidateCachedDirList(PDOKAN_INSTANCE DokanInstance, LPCWSTR FileName,
+                             size_t FileNameLength) {
+  Invalidate(DokanInstance, FileName, FileNameLength, /*Tree=*/FALSE);
+}
+
+VOID InvalidateCachedDirListTree(PDOKAN_INSTANCE DokanInstance,
+                                 LPCWSTR FileName, size_t FileNameLength) {
+  Invalidate(DokanInstance, FileName, FileNameLength, /*Tree=*/TRUE);
+}
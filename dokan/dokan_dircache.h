@@ -0,0 +1,50 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_DIRCACHE_H_
+#define DOKAN_DIRCACHE_H_
+
+#include "dokani.h"
+
+VOID InitializeDirListCache(PDOKAN_INSTANCE DokanInstance);
+VOID DeleteDirListCache(PDOKAN_INSTANCE DokanInstance);
+
+// Whether the listings of the instance are cached at all.
+BOOL IsDirListCacheEnabled(PDOKAN_INSTANCE DokanInstance);
+// Appends the cached full listing of DirectoryName to DirList and returns TRUE,
+// or returns FALSE if there is none that is recent enough.
+BOOL GetCachedDirList(PDOKAN_INSTANCE DokanInstance, LPCWSTR DirectoryName,
+                      PDOKAN_VECTOR DirList);
+// Returns the value to give to AddCachedDirList for a listing started now.
+LONG64 GetDirListCacheGeneration(PDOKAN_INSTANCE DokanInstance);
+// Keeps a copy of the full listing of DirectoryName obtained from the file
+// system, unless a change was made since Generation was taken.
+VOID AddCachedDirList(PDOKAN_INSTANCE DokanInstance, LPCWSTR DirectoryName,
+                      PDOKAN_VECTOR DirList, LONG64 Generation);
+// Drops the cached listings of the file named by the FileNameLength first
+// characters of FileName and of its parent directory, after a change to it.
+VOID InvalidateCachedDirList(PDOKAN_INSTANCE DokanInstance, LPCWSTR FileName,
+                             size_t FileNameLength);
+// Same as InvalidateCachedDirList, also dropping the listings of all the
+// directories under FileName, after it was renamed or removed.
+VOID InvalidateCachedDirListTree(PDOKAN_INSTANCE DokanInstance,
+                                 LPCWSTR FileName, size_t FileNameLength);
+
+#endif
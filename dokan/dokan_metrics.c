@@ -0,0 +1,216 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokan_metrics.h"
+#include "dokan_pool.h"
+
+// Per-operation metrics of an instance.
+//
+// DispatchEvent times every event and adds it to the counters of its
+// operation with interlocked operations only, once DokanGetInstanceMetrics
+// allocated them. Until then DOKAN_INSTANCE.Metrics is NULL and dispatching
+// only tests it. The object pools count their hits and misses from then on
+// too, for all the instances of the process.
+
+typedef struct _DOKAN_OPERATION_COUNTERS {
+  volatile LONG64 Count;
+  volatile LONG64 Failures;
+  volatile LONG64 TotalTicks;
+  volatile LONG64 MaxTicks;
+  volatile LONG64 QueuedCount;
+  volatile LONG64 QueueTicks;
+  volatile LONG64 Bytes;
+  volatile LONG64 LatencyHistogram[DOKAN_METRICS_HISTOGRAM_BUCKETS];
+} DOKAN_OPERATION_COUNTERS, *PDOKAN_OPERATION_COUNTERS;
+
+typedef struct _DOKAN_METRICS_STORE {
+  /** Performance counter frequency and value when the recording started */
+  LONG64 Frequency;
+  LONG64 StartTime;
+  DOKAN_OPERATION_COUNTERS Operations[DokanMetricsOperationCount];
+} DOKAN_METRICS_STORE, *PDOKAN_METRICS_STORE;
+
+static DOKAN_METRICS_OPERATION GetMetricsOperation(UCHAR MajorFunction) {
+  switch (MajorFunction) {
+  case IRP_MJ_CREATE:
+    return DokanMetricsCreate;
+  case IRP_MJ_CLEANUP:
+    return DokanMetricsCleanup;
+  case IRP_MJ_CLOSE:
+  case DOKAN_IRP_CLOSE_BATCH:
+    return DokanMetricsClose;
+  case IRP_MJ_DIRECTORY_CONTROL:
+    return DokanMetricsDirectoryControl;
+  case IRP_MJ_READ:
+    return DokanMetricsRead;
+  case IRP_MJ_WRITE:
+    return DokanMetricsWrite;
+  case IRP_MJ_QUERY_INFORMATION:
+    return DokanMetricsQueryInformation;
+  case IRP_MJ_SET_INFORMATION:
+    return DokanMetricsSetInformation;
+  case IRP_MJ_QUERY_VOLUME_INFORMATION:
+    return DokanMetricsQueryVolumeInformation;
+  case IRP_MJ_FLUSH_BUFFERS:
+    return DokanMetricsFlushBuffers;
+  case IRP_MJ_LOCK_CONTROL:
+    return DokanMetricsLockControl;
+  case IRP_MJ_QUERY_SECURITY:
+    return DokanMetricsQuerySecurity;
+  case IRP_MJ_SET_SECURITY:
+    return DokanMetricsSetSecurity;
+  default:
+    return DokanMetricsOther;
+  }
+}
+
+static ULONG64 TicksToUs(PDOKAN_METRICS_STORE Metrics, LONG64 Ticks) {
+  ULONG64 ticks = (ULONG64)max(Ticks, 0);
+  ULONG64 frequency = (ULONG64)Metrics->Frequency;
+  // Split to not overflow on long totals.
+  return ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency;
+}
+
+static ULONG GetHistogramBucket(ULONG64 Us) {
+  ULONG bucket = 0;
+  while (Us && bucket < DOKAN_METRICS_HISTOGRAM_BUCKETS - 1) {
+    Us >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+VOID RecordDispatchMetrics(PDOKAN_METRICS_STORE Metrics, UCHAR MajorFunction,
+                           LONG64 QueuedTime, LONG64 StartTicks,
+                           PEVENT_INFORMATION EventResult) {
+  PDOKAN_OPERATION_COUNTERS counters =
+      &Metrics->Operations[GetMetricsOperation(MajorFunction)];
+  LARGE_INTEGER now;
+  LONG64 ticks;
+  LONG64 maxTicks;
+
+  QueryPerformanceCounter(&now);
+  ticks = now.QuadPart - StartTicks;
+  InterlockedIncrement64(&counters->Count);
+  InterlockedAdd64(&counters->TotalTicks, ticks);
+  InterlockedIncrement64(&counters->LatencyHistogram[GetHistogramBucket(
+      TicksToUs(Metrics, ticks))]);
+  maxTicks = counters->MaxTicks;
+  while (ticks > maxTicks) {
+    LONG64 previous =
+        InterlockedCompareExchange64(&counters->MaxTicks, ticks, maxTicks);
+    if (previous == maxTicks) {
+      break;
+    }
+    maxTicks = previous;
+  }
+  // Events queued before the recording started are not accounted as such.
+  if (QueuedTime != 0 && QueuedTime >= Metrics->StartTime) {
+    InterlockedIncrement64(&counters->QueuedCount);
+    InterlockedAdd64(&counters->QueueTicks, StartTicks - QueuedTime);
+  }
+  if (EventResult) {
+    if (EventResult->Status != STATUS_SUCCESS) {
+      InterlockedIncrement64(&counters->Failures);
+    }
+    InterlockedAdd64(&counters->Bytes, EventResult->BufferLength);
+  }
+}
+
+VOID DeleteInstanceMetrics(PDOKAN_INSTANCE DokanInstance) {
+  free(DokanInstance->Metrics);
+  DokanInstance->Metrics = NULL;
+}
+
+static PDOKAN_METRICS_STORE
+StartInstanceMetrics(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_METRICS_STORE metrics;
+  PDOKAN_METRICS_STORE previous;
+  LARGE_INTEGER value;
+
+  metrics = calloc(1, sizeof(DOKAN_METRICS_STORE));
+  if (!metrics) {
+    return NULL;
+  }
+  QueryPerformanceFrequency(&value);
+  metrics->Frequency = value.QuadPart;
+  QueryPerformanceCounter(&value);
+  metrics->StartTime = value.QuadPart;
+  previous = InterlockedCompareExchangePointer(&DokanInstance->Metrics,
+                                               metrics, NULL);
+  if (previous) {
+    // Started by a concurrent call.
+    free(metrics);
+    return previous;
+  }
+  EnablePoolMetrics();
+  return metrics;
+}
+
+BOOL DOKANAPI DokanGetInstanceMetrics(_In_ DOKAN_HANDLE DokanInstance,
+                                      _Out_ PDOKAN_INSTANCE_METRICS Metrics) {
+  PDOKAN_INSTANCE instance = (PDOKAN_INSTANCE)DokanInstance;
+  PDOKAN_METRICS_STORE metrics;
+  LARGE_INTEGER now;
+
+  if (!instance || !Metrics) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  ZeroMemory(Metrics, sizeof(DOKAN_INSTANCE_METRICS));
+  metrics = instance->Metrics;
+  if (!metrics) {
+    metrics = StartInstanceMetrics(instance);
+    if (!metrics) {
+      SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+      return FALSE;
+    }
+  }
+  QueryPerformanceCounter(&now);
+  Metrics->ElapsedMs =
+      TicksToUs(metrics, now.QuadPart - metrics->StartTime) / 1000;
+  for (ULONG i = 0; i < DokanMetricsOperationCount; ++i) {
+    PDOKAN_OPERATION_COUNTERS counters = &metrics->Operations[i];
+    PDOKAN_DISPATCH_METRICS operation = &Metrics->Operations[i];
+    operation->Count =
+        (ULONG64)InterlockedCompareExchange64(&counters->Count, 0, 0);
+    operation->Failures =
+        (ULONG64)InterlockedCompareExchange64(&counters->Failures, 0, 0);
+    operation->TotalTimeUs = TicksToUs(
+        metrics, InterlockedCompareExchange64(&counters->TotalTicks, 0, 0));
+    operation->MaxTimeUs = TicksToUs(
+        metrics, InterlockedCompareExchange64(&counters->MaxTicks, 0, 0));
+    operation->QueuedCount =
+        (ULONG64)InterlockedCompareExchange64(&counters->QueuedCount, 0, 0);
+    operation->QueueTimeUs = TicksToUs(
+        metrics, InterlockedCompareExchange64(&counters->QueueTicks, 0, 0));
+    operation->Bytes =
+        (ULONG64)InterlockedCompareExchange64(&counters->Bytes, 0, 0);
+    for (ULONG bucket = 0; bucket < DOKAN_METRICS_HISTOGRAM_BUCKETS;
+         ++bucket) {
+      operation->LatencyHistogram[bucket] =
+          (ULONG64)InterlockedCompareExchange64(
+              &counters->LatencyHistogram[bucket], 0, 0);
+    }
+  }
+  GetPoolMetrics(Metrics);
+  return TRUE;
+}
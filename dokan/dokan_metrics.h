@@ -0,0 +1,36 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_METRICS_H_
+#define DOKAN_METRICS_H_
+
+#include "dokani.h"
+
+// Records an event dispatched from StartTicks until now, which was queued to a
+// pool thread at QueuedTime or 0. EventResult is NULL for events without a
+// result. Events left pending are recorded once DokanCompleteOperation sends
+// their result.
+VOID RecordDispatchMetrics(struct _DOKAN_METRICS_STORE *Metrics,
+                           UCHAR MajorFunction, LONG64 QueuedTime,
+                           LONG64 StartTicks, PEVENT_INFORMATION EventResult);
+// Frees the metrics once no event of the instance can be dispatched.
+VOID DeleteInstanceMetrics(PDOKAN_INSTANCE DokanInstance);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokan_pattern.h"
+
+#include <wctype.h>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define DOKAN_PATTERN_SSE2
+#endif
+
+// Compiled search patterns.
+//
+// The most common patterns are matched without the generic matcher: "*",
+// names without wildcards, "prefix*", "*.ext" and "*part*". Names are upcased
+// once when the case is ignored, instead of for every comparison, eight
+// characters at a time for ASCII. The other patterns go to
+// DokanIsNameInExpression with both sides upcased.
+
+static BOOL IsWildcard(WCHAR Char) {
+  return Char == L'*' || Char == L'?' || Char == L'<' || Char == L'>' ||
+         Char == L'"';
+}
+
+// Upcases the Length characters of Source like towupper into Destination.
+static VOID UpcaseChars(LPCWSTR Source, size_t Length, PWCHAR Destination) {
+  size_t i = 0;
+#ifdef DOKAN_PATTERN_SSE2
+  const __m128i nonAsciiMask = _mm_set1_epi16((short)0xFF80);
+  const __m128i beforeLowerA = _mm_set1_epi16(L'a' - 1);
+  const __m128i afterLowerZ = _mm_set1_epi16(L'z' + 1);
+  const __m128i caseBit = _mm_set1_epi16(0x20);
+  for (; i + 8 <= Length; i += 8) {
+    __m128i chars = _mm_loadu_si128((const __m128i *)(Source + i));
+    __m128i nonAscii = _mm_and_si128(chars, nonAsciiMask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(nonAscii, _mm_setzero_si128())) !=
+        0xFFFF) {
+      for (size_t j = i; j < i + 8; ++j) {
+        Destination[j] = towupper(Source[j]);
+      }
+      continue;
+    }
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi16(chars, beforeLowerA),
+                                  _mm_cmplt_epi16(chars, afterLowerZ));
+    _mm_storeu_si128((__m128i *)(Destination + i),
+                     _mm_sub_epi16(chars, _mm_and_si128(lower, caseBit)));
+  }
+#endif
+  for (; i < Length; ++i) {
+    Destination[i] = towupper(Source[i]);
+  }
+}
+
+// Returns whether the Length characters of Literal are found in the
+// NameLength characters of Name.
+static BOOL ContainsLiteral(LPCWSTR Name, size_t NameLength, LPCWSTR Literal,
+                            size_t Length) {
+  size_t last;
+  size_t i = 0;
+  if (NameLength < Length) {
+    return FALSE;
+  }
+  last = NameLength - Length;
+#ifdef DOKAN_PATTERN_SSE2
+  {
+    // Only the positions starting with the first character of the literal are
+    // compared.
+    const __m128i first = _mm_set1_epi16((short)Literal[0]);
+    for (; i + 8 <= last + 1; i += 8) {
+      __m128i chars = _mm_loadu_si128((const __m128i *)(Name + i));
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chars, first));
+      while (mask) {
+        unsigned long bit;
+        _BitScanForward(&bit, (unsigned long)mask);
+        if (wmemcmp(Name + i + bit / 2, Literal, Length) == 0) {
+          return TRUE;
+        }
+        // Both bytes of the character are set.
+        mask &= ~(3 << bit);
+      }
+    }
+  }
+#endif
+  for (; i <= last; ++i) {
+    if (Name[i] == Literal[0] && wmemcmp(Name + i, Literal, Length) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+VOID CompilePattern(LPCWSTR Expression, BOOL IgnoreCase,
+                    PDOKAN_COMPILED_PATTERN Pattern) {
+  size_t length = wcslen(Expression);
+  size_t start = 0;
+  size_t end = length;
+  BOOL leadingStar;
+  BOOL trailingStar;
+
+  ZeroMemory(Pattern, FIELD_OFFSET(DOKAN_COMPILED_PATTERN, Literal));
+  Pattern->Expression = Expression;
+  Pattern->IgnoreCase = IgnoreCase;
+  Pattern->LiteralLength = 0;
+  Pattern->LiteralTooLong = FALSE;
+  if (length == 1 && Expression[0] == L'*') {
+    Pattern->Kind = DokanPatternAll;
+    return;
+  }
+  if (length >= MAX_PATH) {
+    Pattern->Kind = DokanPatternExpression;
+    Pattern->LiteralTooLong = TRUE;
+    return;
+  }
+
+  leadingStar = length > 1 && Expression[0] == L'*';
+  trailingStar = length > 1 && Expression[length - 1] == L'*';
+  if (leadingStar) {
+    ++start;
+  }
+  if (trailingStar) {
+    --end;
+  }
+  Pattern->Kind = DokanPatternExpression;
+  if (start < end) {
+    size_t i = start;
+    while (i < end && !IsWildcard(Expression[i])) {
+      ++i;
+    }
+    if (i == end) {
+      if (leadingStar && trailingStar) {
+        Pattern->Kind = DokanPatternContains;
+      } else if (leadingStar) {
+        Pattern->Kind = DokanPatternSuffix;
+      } else if (trailingStar) {
+        Pattern->Kind = DokanPatternPrefix;
+      } else {
+        Pattern->Kind = DokanPatternLiteral;
+      }
+    }
+  } else if (length == 0) {
+    Pattern->Kind = DokanPatternLiteral;
+  }
+  if (Pattern->Kind == DokanPatternExpression) {
+    start = 0;
+    end = length;
+  }
+  Pattern->LiteralLength = end - start;
+  if (IgnoreCase) {
+    UpcaseChars(Expression + start, Pattern->LiteralLength, Pattern->Literal);
+  } else {
+    wmemcpy(Pattern->Literal, Expression + start, Pattern->LiteralLength);
+  }
+  Pattern->Literal[Pattern->LiteralLength] = L'\0';
+}
+
+BOOL IsNameInPattern(PDOKAN_COMPILED_PATTERN Pattern, LPCWSTR Name,
+                     size_t NameLength) {
+  WCHAR nameCopy[MAX_PATH];
+  size_t length = Pattern->LiteralLength;
+
+  if (Pattern->Kind == DokanPatternAll) {
+    return TRUE;
+  }
+  if (NameLength >= MAX_PATH) {
+    return FALSE;
+  }
+  if (Pattern->IgnoreCase) {
+    UpcaseChars(Name, NameLength, nameCopy);
+    nameCopy[NameLength] = L'\0';
+    Name = nameCopy;
+  } else if (Pattern->Kind == DokanPatternExpression) {
+    wmemcpy(nameCopy, Name, NameLength);
+    nameCopy[NameLength] = L'\0';
+    Name = nameCopy;
+  }
+  if (Pattern->Kind == DokanPatternExpression) {
+    // The generic matcher can step up to one character per character of the
+    // expression past the terminating null character, which has to read as
+    // null characters.
+    size_t padding = Pattern->LiteralTooLong
+                         ? MAX_PATH - 1 - NameLength
+                         : min(Pattern->LiteralLength, MAX_PATH - 1 - NameLength);
+    wmemset(nameCopy + NameLength + 1, L'\0', padding);
+  }
+  if (Pattern->LiteralTooLong) {
+    return DokanIsNameInExpression(Pattern->Expression, Name,
+                                   Pattern->IgnoreCase);
+  }
+
+  switch (Pattern->Kind) {
+  case DokanPatternLiteral:
+    return NameLength == length && wmemcmp(Name, Pattern->Literal, length) == 0;
+  case DokanPatternPrefix:
+    return NameLength >= length &&
+           wmemcmp(Name, Pattern->Literal, length) == 0;
+  case DokanPatternSuffix:
+    return NameLength >= length &&
+           wmemcmp(Name + NameLength - length, Pattern->Literal, length) == 0;
+  case DokanPatternContains:
+    return ContainsLiteral(Name, NameLength, Pattern->Literal, length);
+  default:
+    return DokanIsNameInExpression(Pattern->Literal, Name, FALSE);
+  }
+}
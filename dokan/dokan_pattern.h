@@ -0,0 +1,68 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DOKAN_PATTERN_H_
+#define DOKAN_PATTERN_H_
+
+#include "dokani.h"
+
+typedef enum _DOKAN_PATTERN_KIND {
+  /** "*" */
+  DokanPatternAll,
+  /** No wildcard, the name has to be the literal */
+  DokanPatternLiteral,
+  /** "literal*" */
+  DokanPatternPrefix,
+  /** "*literal", like "*.txt" */
+  DokanPatternSuffix,
+  /** "*literal*" */
+  DokanPatternContains,
+  /** Anything else, matched like DokanIsNameInExpression */
+  DokanPatternExpression,
+} DOKAN_PATTERN_KIND;
+
+/**
+ * Search pattern parsed once to be matched against the names of a listing
+ * with the same result as DokanIsNameInExpression.
+ */
+typedef struct _DOKAN_COMPILED_PATTERN {
+  DOKAN_PATTERN_KIND Kind;
+  BOOL IgnoreCase;
+  /** Pattern given to CompilePattern, which must outlive the compiled one */
+  LPCWSTR Expression;
+  /**
+   * Literal part of the fast paths, or the whole expression, upcased with
+   * IgnoreCase. Expressions that do not fit are matched from Expression.
+   */
+  WCHAR Literal[MAX_PATH];
+  size_t LiteralLength;
+  BOOL LiteralTooLong;
+} DOKAN_COMPILED_PATTERN, *PDOKAN_COMPILED_PATTERN;
+
+VOID CompilePattern(LPCWSTR Expression, BOOL IgnoreCase,
+                    PDOKAN_COMPILED_PATTERN Pattern);
+// Same as DokanIsNameInExpression(Pattern->Expression, Name,
+// Pattern->IgnoreCase) for the NameLength characters of Name, which need no
+// terminating null character. NameLength must be less than MAX_PATH.
+BOOL IsNameInPattern(PDOKAN_COMPILED_PATTERN Pattern, LPCWSTR Name,
+                     size_t NameLength);
+
+#endif
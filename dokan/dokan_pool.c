@@ -25,267 +25,725 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <assert.h>
 #include <threadpoolapiset.h>
 
+// Object pools.
+//
+// Each pool keeps its free objects in a lock-free SLIST_HEADER, linked through
+// an SLIST_ENTRY overlaying the first bytes of the object (which are reset
+// when it is popped again), or through DOKAN_OPEN_INFO.PoolEntry and
+// DOKAN_POOLED_DIRECTORY_LIST.PoolEntry for the objects whose start must be
+// kept. On top of that, every thread keeps up to ThreadCacheSize objects of
+// each pool in a cache stored in its fiber local storage, so that the
+// push and pop of a request processed by a single thread do not touch the
+// shared lists. The caches are flushed back to the lists when their thread
+// exits.
+//
+// Event results bigger than DOKAN_EVENT_INFO_DEFAULT_SIZE come from size
+// classes whose sizes, header included, are the powers of two up to
+// DOKAN_EVENT_RESULT_MAX_CLASS_SHIFT. The classes are not cached by threads
+// and are trimmed every DOKAN_EVENT_RESULT_TRIM_INTERVAL_MS, freeing the
+// results kept beyond what the peak use of the last interval would need. With
+// DokanUseLargePages, the classes of at least a large page are allocated with
+// large pages when available.
+//
+// DokanUseLargePages also reserves at DokanInit an arena of
+// DOKAN_LARGE_PAGE_ARENA_SIZE bytes of large pages, from which the batch
+// buffers and the results of the smaller classes are carved. The arena memory
+// is never given back: what its objects would free goes to a free list of their
+// pool type, from which they are carved again first. Objects are allocated
+// normally once the arena is exhausted or when it could not be reserved, and
+// the event ring copies its events into the same batch buffers.
+//
+// On systems with several NUMA nodes, each node gets its own thread pool,
+// whose threads are kept on the processors of the node, and its own object
+// pools, used by the threads running on the node. Buffers are then mostly
+// touched first, and thus backed, on the node that processes them.
+
 #define DOKAN_IO_BATCH_POOL_SIZE 1024
 #define DOKAN_IO_EVENT_POOL_SIZE 1024
-#define DOKAN_IO_EXTRA_EVENT_POOL_SIZE 128
+// Memory that each event result size class can keep unused, within
+// DOKAN_EVENT_RESULT_CLASS_MIN_DEPTH and DOKAN_EVENT_RESULT_CLASS_MAX_DEPTH
+// results.
+#define DOKAN_EVENT_RESULT_CLASS_POOL_MEMORY (32 * 1024 * 1024)
+#define DOKAN_EVENT_RESULT_CLASS_MIN_DEPTH 2
+#define DOKAN_EVENT_RESULT_CLASS_MAX_DEPTH 128
 #define DOKAN_DIRECTORY_LIST_POOL_SIZE 128
+// Size of the large page arena reserved with DokanUseLargePages, rounded up to
+// the large page size.
+#define DOKAN_LARGE_PAGE_ARENA_SIZE (64 * 1024 * 1024)
+#define DOKAN_LARGE_PAGE_ARENA_ALIGNMENT 64
+
+// Maximum number of objects of a pool kept by each thread.
+#define DOKAN_POOL_THREAD_CACHE_SIZE 4
+
+// Objects PrewarmPool keeps ready in the shared lists of each node: an event
+// buffer, a result and an open info for every request the first pulls of a
+// mount can bring, and a batch buffer for every main pull thread.
+#define DOKAN_POOL_PREWARM_IO_EVENTS (DOKAN_MAIN_PULL_THREAD_COUNT_MAX * 2)
+#define DOKAN_POOL_PREWARM_IO_BATCHES DOKAN_MAIN_PULL_THREAD_COUNT_MAX
+
+typedef enum _DOKAN_POOL_TYPE {
+  DokanPoolIoBatch,
+  DokanPoolIoEvent,
+  DokanPoolEventResult,
+  DokanPoolFileOpenInfo,
+  DokanPoolDirectoryList,
+  /** First of the DOKAN_EVENT_RESULT_CLASS_COUNT event result size classes */
+  DokanPoolSizedEventResult,
+  DokanPoolTypeCount = DokanPoolSizedEventResult + DOKAN_EVENT_RESULT_CLASS_COUNT
+} DOKAN_POOL_TYPE;
+
+typedef struct _DOKAN_OBJECT_POOL {
+  SLIST_HEADER FreeList;
+  /** Approximate maximum number of objects kept in FreeList */
+  USHORT MaxDepth;
+  /** Number of objects kept by each thread, at most DOKAN_POOL_THREAD_CACHE_SIZE */
+  ULONG ThreadCacheSize;
+} DOKAN_OBJECT_POOL, *PDOKAN_OBJECT_POOL;
+
+typedef struct _DOKAN_POOL_THREAD_CACHE {
+  /** Node + 1 whose processors the thread was bound to, 0 if none */
+  ULONG BoundNode;
+  ULONG Count[DokanPoolTypeCount];
+  PSLIST_ENTRY Entries[DokanPoolTypeCount][DOKAN_POOL_THREAD_CACHE_SIZE];
+} DOKAN_POOL_THREAD_CACHE, *PDOKAN_POOL_THREAD_CACHE;
+
+typedef struct _DOKAN_EVENT_RESULT_CLASS {
+  /** Size of the results of the class, header included */
+  SIZE_T Size;
+  /** Whether the results are allocated with VirtualAlloc and large pages */
+  BOOL LargePages;
+  /** Whether the results are carved from the large page arena */
+  BOOL Arena;
+  /** Number of results of the class currently popped */
+  volatile LONG InUse;
+  /** Highest InUse since the last trim */
+  volatile LONG PeakInUse;
+} DOKAN_EVENT_RESULT_CLASS, *PDOKAN_EVENT_RESULT_CLASS;
+
+// A directory list vector with what is needed to link it in its pool.
+typedef struct _DOKAN_POOLED_DIRECTORY_LIST {
+  SLIST_ENTRY PoolEntry;
+  DOKAN_VECTOR DirectoryList;
+} DOKAN_POOLED_DIRECTORY_LIST, *PDOKAN_POOLED_DIRECTORY_LIST;
 
 // Global thread pool
 PTP_POOL g_ThreadPool = NULL;
 
-// Global vector of event buffers
-PDOKAN_VECTOR g_IoBatchBufferPool = NULL;
-CRITICAL_SECTION g_IoBatchBufferCriticalSection;
+// Global object pools of each node
+static DOKAN_OBJECT_POOL g_ObjectPools[DOKAN_MAX_NUMA_NODES][DokanPoolTypeCount];
 
-PDOKAN_VECTOR g_IoEventBufferPool = NULL;
-CRITICAL_SECTION g_IoEventBufferCriticalSection;
+// Number of nodes with their own thread pool and object pools
+static ULONG g_PoolNodeCount = 1;
+// Thread pool of each node, the one of the first node being g_ThreadPool
+static PTP_POOL g_NodeThreadPools[DOKAN_MAX_NUMA_NODES];
+// Processors of each node
+static GROUP_AFFINITY g_NodeAffinities[DOKAN_MAX_NUMA_NODES];
+// Node of each processor, indexed by group * 64 + number
+static PUSHORT g_ProcessorNodes = NULL;
+static USHORT g_ProcessorGroupCount = 0;
 
-PDOKAN_VECTOR g_EventResultPool = NULL;
-CRITICAL_SECTION g_EventResultCriticalSection;
+// FLS index of the DOKAN_POOL_THREAD_CACHE of each thread
+static DWORD g_PoolThreadCacheIndex = FLS_OUT_OF_INDEXES;
 
-PDOKAN_VECTOR g_16KEventResultPool = NULL;
-CRITICAL_SECTION g_16KEventResultCriticalSection;
+static DOKAN_EVENT_RESULT_CLASS g_EventResultClasses
+    [DOKAN_EVENT_RESULT_CLASS_COUNT];
 
-PDOKAN_VECTOR g_32KEventResultPool = NULL;
-CRITICAL_SECTION g_32KEventResultCriticalSection;
+// Whether DokanUseLargePages was called
+static BOOL g_UseLargePages = FALSE;
 
-PDOKAN_VECTOR g_64KEventResultPool = NULL;
-CRITICAL_SECTION g_64KEventResultCriticalSection;
+// Large page arena reserved by InitializePool with DokanUseLargePages
+static PUCHAR g_LargePageArena = NULL;
+static SIZE_T g_LargePageArenaSize = 0;
+// Bytes of the arena already carved
+static volatile LONG64 g_LargePageArenaUsed = 0;
+// Arena objects of each pool type given back, to be carved again first
+static SLIST_HEADER g_LargePageArenaFreeLists[DokanPoolTypeCount];
 
-PDOKAN_VECTOR g_128KEventResultPool = NULL;
-CRITICAL_SECTION g_128KEventResultCriticalSection;
+// Hits and misses of each pool, counted once DokanGetInstanceMetrics was called
+static volatile LONG g_PoolMetricsEnabled = FALSE;
+static volatile LONG64 g_PoolHits[DokanPoolTypeCount];
+static volatile LONG64 g_PoolMisses[DokanPoolTypeCount];
 
-PDOKAN_VECTOR g_FileInfoPool = NULL;
-CRITICAL_SECTION g_FileInfoCriticalSection;
+// Periodic trim of the event result size classes
+static TP_CALLBACK_ENVIRON g_PoolCallbackEnvironment;
+static PTP_TIMER g_EventResultTrimTimer = NULL;
 
-PDOKAN_VECTOR g_DirectoryListPool = NULL;
-CRITICAL_SECTION g_DirectoryListCriticalSection;
+// Work of each node run by PrewarmPool, on a thread of the node
+static PTP_WORK g_PrewarmWorks[DOKAN_MAX_NUMA_NODES];
 
 PTP_POOL GetThreadPool() { return g_ThreadPool; }
 
+static BOOL IsLargePageArenaMemory(PVOID Memory) {
+  return g_LargePageArena && (PUCHAR)Memory >= g_LargePageArena &&
+         (PUCHAR)Memory < g_LargePageArena + g_LargePageArenaSize;
+}
+
+static VOID InitializeLargePageArena() {
+  SIZE_T largePageMinimum = GetLargePageMinimum();
+  SIZE_T size;
+  for (ULONG type = 0; type < DokanPoolTypeCount; ++type) {
+    InitializeSListHead(&g_LargePageArenaFreeLists[type]);
+  }
+  g_LargePageArenaUsed = 0;
+  if (!g_UseLargePages || largePageMinimum == 0) {
+    return;
+  }
+  size = (DOKAN_LARGE_PAGE_ARENA_SIZE + largePageMinimum - 1) &
+         ~(largePageMinimum - 1);
+  g_LargePageArena = (PUCHAR)VirtualAlloc(
+      NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  if (!g_LargePageArena) {
+    DokanDbgPrint("Dokan Warning: Failed to reserve the large page arena, "
+                  "using normal pages: %d\n",
+                  GetLastError());
+    return;
+  }
+  g_LargePageArenaSize = size;
+}
+
+static VOID CleanupLargePageArena() {
+  if (g_LargePageArena) {
+    VirtualFree(g_LargePageArena, 0, MEM_RELEASE);
+    g_LargePageArena = NULL;
+    g_LargePageArenaSize = 0;
+  }
+}
+
+// Returns an object of Size bytes of the pool Type from the large page arena,
+// or NULL when there is no arena or it is exhausted.
+static PVOID AllocateLargePageArenaMemory(DOKAN_POOL_TYPE Type, SIZE_T Size) {
+  PVOID memory;
+  LONG64 offset;
+  if (!g_LargePageArena) {
+    return NULL;
+  }
+  memory = InterlockedPopEntrySList(&g_LargePageArenaFreeLists[Type]);
+  if (memory) {
+    return memory;
+  }
+  Size = (Size + DOKAN_LARGE_PAGE_ARENA_ALIGNMENT - 1) &
+         ~((SIZE_T)DOKAN_LARGE_PAGE_ARENA_ALIGNMENT - 1);
+  if ((SIZE_T)g_LargePageArenaUsed + Size > g_LargePageArenaSize) {
+    return NULL;
+  }
+  offset = InterlockedExchangeAdd64(&g_LargePageArenaUsed, (LONG64)Size);
+  if ((SIZE_T)offset + Size > g_LargePageArenaSize) {
+    // Lost the race for the end of the arena, which stays unused.
+    return NULL;
+  }
+  return g_LargePageArena + offset;
+}
+
+// Gives back an object of the pool Type to the arena if it was carved from it.
+static BOOL FreeLargePageArenaMemory(DOKAN_POOL_TYPE Type, PVOID Memory) {
+  if (!IsLargePageArenaMemory(Memory)) {
+    return FALSE;
+  }
+  InterlockedPushEntrySList(&g_LargePageArenaFreeLists[Type],
+                            (PSLIST_ENTRY)Memory);
+  return TRUE;
+}
+
+static PDOKAN_IO_BATCH AllocateIoBatchMemory() {
+  PDOKAN_IO_BATCH ioBatch = (PDOKAN_IO_BATCH)AllocateLargePageArenaMemory(
+      DokanPoolIoBatch, DOKAN_IO_BATCH_SIZE);
+  if (!ioBatch) {
+    ioBatch = (PDOKAN_IO_BATCH)malloc(DOKAN_IO_BATCH_SIZE);
+  }
+  return ioBatch;
+}
+
 VOID FreeIoEventBuffer(PDOKAN_IO_EVENT IoEvent) {
   if (IoEvent) {
     free(IoEvent);
   }
 }
 
-int InitializePool() {
-  (void)InitializeCriticalSectionAndSpinCount(&g_IoBatchBufferCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_IoEventBufferCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_EventResultCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_16KEventResultCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_32KEventResultCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_64KEventResultCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_128KEventResultCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_FileInfoCriticalSection,
-                                              0x80000400);
-  (void)InitializeCriticalSectionAndSpinCount(&g_DirectoryListCriticalSection,
-                                              0x80000400);
+static VOID FreeDirectoryList(PDOKAN_POOLED_DIRECTORY_LIST DirectoryList) {
+  if (DirectoryList) {
+    DokanVector_Free(&DirectoryList->DirectoryList);
+    free(DirectoryList);
+  }
+}
 
-  if (g_ThreadPool) {
-    DokanDbgPrint("Dokan Error: Thread pool has already been created.\n");
-    return DOKAN_DRIVER_INSTALL_ERROR;
+static VOID FreeSizedEventResult(PDOKAN_EVENT_RESULT_CLASS Class,
+                                 PEVENT_INFORMATION EventResult) {
+  if (FreeLargePageArenaMemory(
+          DokanPoolSizedEventResult + (ULONG)(Class - g_EventResultClasses),
+          EventResult)) {
+    return;
+  }
+  if (Class->LargePages) {
+    VirtualFree(EventResult, 0, MEM_RELEASE);
+  } else {
+    free(EventResult);
   }
+}
 
-  // It seems this is only needed if LoadLibrary() and FreeLibrary() are used and it should be called by the exe
-  // SetThreadpoolCallbackLibrary(&g_ThreadPoolCallbackEnvironment, hModule);
-  g_ThreadPool = CreateThreadpool(NULL);
-  if (!g_ThreadPool) {
-    DokanDbgPrint("Dokan Error: Failed to create thread pool.\n");
-    return DOKAN_DRIVER_INSTALL_ERROR;
+// Frees an unused object of the pool Type from its pool entry.
+static VOID FreePoolEntry(DOKAN_POOL_TYPE Type, PSLIST_ENTRY Entry) {
+  if (Type >= DokanPoolSizedEventResult) {
+    FreeSizedEventResult(
+        &g_EventResultClasses[Type - DokanPoolSizedEventResult],
+        (PEVENT_INFORMATION)Entry);
+    return;
   }
+  switch (Type) {
+  case DokanPoolIoBatch:
+    FreeIoBatchBuffer((PDOKAN_IO_BATCH)Entry);
+    break;
+  case DokanPoolIoEvent:
+    FreeIoEventBuffer((PDOKAN_IO_EVENT)Entry);
+    break;
+  case DokanPoolFileOpenInfo:
+    FreeFileOpenInfo(CONTAINING_RECORD(Entry, DOKAN_OPEN_INFO, PoolEntry));
+    break;
+  case DokanPoolDirectoryList:
+    FreeDirectoryList(
+        CONTAINING_RECORD(Entry, DOKAN_POOLED_DIRECTORY_LIST, PoolEntry));
+    break;
+  default:
+    FreeEventResult((PEVENT_INFORMATION)Entry);
+    break;
+  }
+}
 
-  g_IoBatchBufferPool =
-      DokanVector_AllocWithCapacity(sizeof(PVOID), DOKAN_IO_BATCH_POOL_SIZE);
-  g_IoEventBufferPool =
-      DokanVector_AllocWithCapacity(sizeof(PVOID), DOKAN_IO_EVENT_POOL_SIZE);
-  g_EventResultPool =
-      DokanVector_AllocWithCapacity(sizeof(PVOID), DOKAN_IO_EVENT_POOL_SIZE);
-  g_16KEventResultPool = DokanVector_AllocWithCapacity(
-      sizeof(PVOID), DOKAN_IO_EXTRA_EVENT_POOL_SIZE);
-  g_32KEventResultPool = DokanVector_AllocWithCapacity(
-      sizeof(PVOID), DOKAN_IO_EXTRA_EVENT_POOL_SIZE);
-  g_64KEventResultPool = DokanVector_AllocWithCapacity(
-      sizeof(PVOID), DOKAN_IO_EXTRA_EVENT_POOL_SIZE);
-  g_128KEventResultPool = DokanVector_AllocWithCapacity(
-      sizeof(PVOID), DOKAN_IO_EXTRA_EVENT_POOL_SIZE);
-  g_FileInfoPool =
-      DokanVector_AllocWithCapacity(sizeof(PVOID), DOKAN_IO_EVENT_POOL_SIZE);
-  g_DirectoryListPool = DokanVector_AllocWithCapacity(
-      sizeof(PVOID), DOKAN_DIRECTORY_LIST_POOL_SIZE);
-  return DOKAN_SUCCESS;
+static VOID InitializeObjectPool(DOKAN_POOL_TYPE Type, USHORT MaxDepth,
+                                 ULONG ThreadCacheSize) {
+  for (ULONG node = 0; node < DOKAN_MAX_NUMA_NODES; ++node) {
+    InitializeSListHead(&g_ObjectPools[node][Type].FreeList);
+    g_ObjectPools[node][Type].MaxDepth = MaxDepth;
+    g_ObjectPools[node][Type].ThreadCacheSize = ThreadCacheSize;
+  }
 }
 
-VOID CleanupPool() {
-  if (g_ThreadPool) {
-    CloseThreadpool(g_ThreadPool);
-    g_ThreadPool = NULL;
+ULONG GetPoolNodeCount() { return g_PoolNodeCount; }
+
+PTP_POOL GetNodeThreadPool(ULONG Node) {
+  return Node < g_PoolNodeCount ? g_NodeThreadPools[Node] : g_ThreadPool;
+}
+
+USHORT GetPoolNodeProcessorGroup(ULONG Node) {
+  return Node < g_PoolNodeCount ? g_NodeAffinities[Node].Group : 0;
+}
+
+ULONG GetCurrentPoolNode() {
+  PROCESSOR_NUMBER processor;
+  ULONG node;
+  if (g_PoolNodeCount == 1) {
+    return 0;
+  }
+  GetCurrentProcessorNumberEx(&processor);
+  if (processor.Group >= g_ProcessorGroupCount || processor.Number >= 64) {
+    return 0;
+  }
+  node = g_ProcessorNodes[processor.Group * 64 + processor.Number];
+  return node < g_PoolNodeCount ? node : 0;
+}
+
+// Creates the thread pools of the nodes other than the first one, whose pool
+// is g_ThreadPool. Nothing is done on systems with a single node.
+static VOID InitializePoolNodes() {
+  ULONG highestNode = 0;
+  ULONG nodeCount = 0;
+
+  g_NodeThreadPools[0] = g_ThreadPool;
+  g_PoolNodeCount = 1;
+  if (!GetNumaHighestNodeNumber(&highestNode) || highestNode == 0) {
+    return;
   }
-  //////////////////// IO batch buffer object pool ////////////////////
-  {
-    EnterCriticalSection(&g_IoBatchBufferCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_IoBatchBufferPool); ++i) {
-        FreeIoBatchBuffer(
-            *(PDOKAN_IO_BATCH *)DokanVector_GetItem(g_IoBatchBufferPool, i));
+  g_ProcessorGroupCount = GetActiveProcessorGroupCount();
+  g_ProcessorNodes =
+      (PUSHORT)calloc((SIZE_T)g_ProcessorGroupCount * 64, sizeof(USHORT));
+  if (!g_ProcessorNodes) {
+    return;
+  }
+  for (USHORT group = 0; group < g_ProcessorGroupCount; ++group) {
+    DWORD processorCount = min(GetActiveProcessorCount(group), 64);
+    for (DWORD number = 0; number < processorCount; ++number) {
+      PROCESSOR_NUMBER processor = {group, (BYTE)number, 0};
+      USHORT node = 0;
+      if (GetNumaProcessorNodeEx(&processor, &node) && node != MAXUSHORT) {
+        g_ProcessorNodes[group * 64 + number] = node % DOKAN_MAX_NUMA_NODES;
       }
-      DokanVector_Free(g_IoBatchBufferPool);
-      g_IoBatchBufferPool = NULL;
     }
-    LeaveCriticalSection(&g_IoBatchBufferCriticalSection);
-    DeleteCriticalSection(&g_IoBatchBufferCriticalSection);
   }
-
-  //////////////////// IO event buffer object pool ////////////////////
-  {
-    EnterCriticalSection(&g_IoEventBufferCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_IoEventBufferPool); ++i) {
-        FreeIoEventBuffer(
-            *(PDOKAN_IO_EVENT *)DokanVector_GetItem(g_IoEventBufferPool, i));
+  // Nodes past DOKAN_MAX_NUMA_NODES share the pools of the first ones.
+  nodeCount = min(highestNode + 1, DOKAN_MAX_NUMA_NODES);
+  for (ULONG node = 0; node < nodeCount; ++node) {
+    if (!GetNumaNodeProcessorMaskEx((USHORT)node, &g_NodeAffinities[node])) {
+      RtlZeroMemory(&g_NodeAffinities[node], sizeof(GROUP_AFFINITY));
+    }
+    if (node > 0) {
+      g_NodeThreadPools[node] = CreateThreadpool(NULL);
+      if (!g_NodeThreadPools[node]) {
+        DokanDbgPrint("Dokan Warning: Failed to create the thread pool of "
+                      "node %lu.\n",
+                      node);
+        break;
       }
-      DokanVector_Free(g_IoEventBufferPool);
-      g_IoEventBufferPool = NULL;
     }
-    LeaveCriticalSection(&g_IoEventBufferCriticalSection);
-    DeleteCriticalSection(&g_IoEventBufferCriticalSection);
+    g_PoolNodeCount = node + 1;
   }
+  DbgPrint("Dokan: Using %lu NUMA node pools\n", g_PoolNodeCount);
+}
 
-  //////////////////// Event result object pool ////////////////////
-  {
-    EnterCriticalSection(&g_EventResultCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_EventResultPool); ++i) {
-        FreeEventResult(
-            *(PEVENT_INFORMATION *)DokanVector_GetItem(g_EventResultPool, i));
-      }
-      DokanVector_Free(g_EventResultPool);
-      g_EventResultPool = NULL;
+static VOID CleanupPoolNodes() {
+  for (ULONG node = 1; node < g_PoolNodeCount; ++node) {
+    CloseThreadpool(g_NodeThreadPools[node]);
+    g_NodeThreadPools[node] = NULL;
+  }
+  g_NodeThreadPools[0] = NULL;
+  g_PoolNodeCount = 1;
+  if (g_ProcessorNodes) {
+    free(g_ProcessorNodes);
+    g_ProcessorNodes = NULL;
+  }
+  g_ProcessorGroupCount = 0;
+}
+
+// Gives the objects cached by a thread back to the shared lists. Called by the
+// system when the thread exits or when the FLS index is freed.
+static VOID NTAPI FlushPoolThreadCache(PVOID Data) {
+  PDOKAN_POOL_THREAD_CACHE cache = (PDOKAN_POOL_THREAD_CACHE)Data;
+  ULONG node = 0;
+  if (!cache) {
+    return;
+  }
+  node = GetCurrentPoolNode();
+  for (ULONG type = 0; type < DokanPoolTypeCount; ++type) {
+    for (ULONG i = 0; i < cache->Count[type]; ++i) {
+      InterlockedPushEntrySList(&g_ObjectPools[node][type].FreeList,
+                                cache->Entries[type][i]);
     }
-    LeaveCriticalSection(&g_EventResultCriticalSection);
-    DeleteCriticalSection(&g_EventResultCriticalSection);
   }
+  free(cache);
+}
 
-  {
-    EnterCriticalSection(&g_16KEventResultCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_16KEventResultPool); ++i) {
-        FreeEventResult(*(PEVENT_INFORMATION *)DokanVector_GetItem(
-            g_16KEventResultPool, i));
+static PDOKAN_POOL_THREAD_CACHE GetPoolThreadCache(BOOL Create) {
+  PDOKAN_POOL_THREAD_CACHE cache = NULL;
+  if (g_PoolThreadCacheIndex == FLS_OUT_OF_INDEXES) {
+    return NULL;
+  }
+  cache = (PDOKAN_POOL_THREAD_CACHE)FlsGetValue(g_PoolThreadCacheIndex);
+  if (cache || !Create) {
+    return cache;
+  }
+  cache = (PDOKAN_POOL_THREAD_CACHE)calloc(1, sizeof(DOKAN_POOL_THREAD_CACHE));
+  if (cache && !FlsSetValue(g_PoolThreadCacheIndex, cache)) {
+    free(cache);
+    cache = NULL;
+  }
+  return cache;
+}
+
+// Returns an unused object of the pool Type or NULL if there is none.
+static PSLIST_ENTRY PopPoolEntry(DOKAN_POOL_TYPE Type) {
+  PDOKAN_POOL_THREAD_CACHE cache = GetPoolThreadCache(FALSE);
+  PSLIST_ENTRY entry;
+  if (cache && cache->Count[Type] > 0) {
+    entry = cache->Entries[Type][--cache->Count[Type]];
+  } else {
+    entry = InterlockedPopEntrySList(
+        &g_ObjectPools[GetCurrentPoolNode()][Type].FreeList);
+  }
+  if (g_PoolMetricsEnabled) {
+    InterlockedIncrement64(entry ? &g_PoolHits[Type] : &g_PoolMisses[Type]);
+  }
+  return entry;
+}
+
+// Keeps an unused object in the pool Type. Returns FALSE if the pool is full,
+// in which case the caller has to free the object.
+static BOOL PushPoolEntry(DOKAN_POOL_TYPE Type, PSLIST_ENTRY Entry) {
+  PDOKAN_OBJECT_POOL pool = &g_ObjectPools[GetCurrentPoolNode()][Type];
+  PDOKAN_POOL_THREAD_CACHE cache = GetPoolThreadCache(TRUE);
+  if (cache && cache->Count[Type] < pool->ThreadCacheSize) {
+    cache->Entries[Type][cache->Count[Type]++] = Entry;
+    return TRUE;
+  }
+  // The depth can be exceeded by concurrent pushes, which is fine for a bound.
+  if (QueryDepthSList(&pool->FreeList) >= pool->MaxDepth) {
+    return FALSE;
+  }
+  InterlockedPushEntrySList(&pool->FreeList, Entry);
+  return TRUE;
+}
+
+VOID BindThreadToPoolNode(ULONG Node) {
+  PDOKAN_POOL_THREAD_CACHE cache = NULL;
+  if (g_PoolNodeCount == 1 || Node >= g_PoolNodeCount ||
+      g_NodeAffinities[Node].Mask == 0) {
+    return;
+  }
+  cache = GetPoolThreadCache(TRUE);
+  if (cache && cache->BoundNode == Node + 1) {
+    return;
+  }
+  if (!SetThreadGroupAffinity(GetCurrentThread(), &g_NodeAffinities[Node],
+                              NULL)) {
+    DbgPrint("Dokan Warning: Failed to bind thread to node %lu: %d\n", Node,
+             GetLastError());
+    return;
+  }
+  if (cache) {
+    cache->BoundNode = Node + 1;
+  }
+}
+
+// Frees the results of every size class kept beyond what would be needed to
+// reach again the peak use since the last trim.
+static VOID CALLBACK TrimEventResults(PTP_CALLBACK_INSTANCE Instance,
+                                      PVOID Context, PTP_TIMER Timer) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Context);
+  UNREFERENCED_PARAMETER(Timer);
+  for (ULONG i = 0; i < DOKAN_EVENT_RESULT_CLASS_COUNT; ++i) {
+    PDOKAN_EVENT_RESULT_CLASS resultClass = &g_EventResultClasses[i];
+    LONG inUse = InterlockedCompareExchange(&resultClass->InUse, 0, 0);
+    LONG peak = InterlockedExchange(&resultClass->PeakInUse, inUse);
+    LONG keep = max(peak - inUse, 0);
+    for (ULONG node = 0; node < g_PoolNodeCount; ++node) {
+      PDOKAN_OBJECT_POOL pool =
+          &g_ObjectPools[node][DokanPoolSizedEventResult + i];
+      LONG depth = (LONG)QueryDepthSList(&pool->FreeList);
+      // What is kept is taken from the first nodes.
+      while (depth-- > keep) {
+        PSLIST_ENTRY entry = InterlockedPopEntrySList(&pool->FreeList);
+        if (!entry) {
+          break;
+        }
+        FreeSizedEventResult(resultClass, (PEVENT_INFORMATION)entry);
       }
-      DokanVector_Free(g_16KEventResultPool);
-      g_16KEventResultPool = NULL;
+      keep = max(keep - (LONG)QueryDepthSList(&pool->FreeList), 0);
     }
-    LeaveCriticalSection(&g_16KEventResultCriticalSection);
-    DeleteCriticalSection(&g_16KEventResultCriticalSection);
   }
+}
 
-  {
-    EnterCriticalSection(&g_32KEventResultCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_32KEventResultPool); ++i) {
-        FreeEventResult(*(PEVENT_INFORMATION *)DokanVector_GetItem(
-            g_32KEventResultPool, i));
-      }
-      DokanVector_Free(g_32KEventResultPool);
-      g_32KEventResultPool = NULL;
+// Allocates objects of Size bytes in the shared list of the pool Type of Node
+// until it holds Count of them. The objects are cleared so that their pages
+// are backed by the node of the calling thread.
+static VOID PrewarmObjectPool(ULONG Node, DOKAN_POOL_TYPE Type, SIZE_T Size,
+                              USHORT Count) {
+  PDOKAN_OBJECT_POOL pool = &g_ObjectPools[Node][Type];
+  while (QueryDepthSList(&pool->FreeList) < min(Count, pool->MaxDepth)) {
+    PSLIST_ENTRY entry = Type == DokanPoolIoBatch
+                             ? (PSLIST_ENTRY)AllocateIoBatchMemory()
+                             : (PSLIST_ENTRY)malloc(Size);
+    if (!entry) {
+      return;
     }
-    LeaveCriticalSection(&g_32KEventResultCriticalSection);
-    DeleteCriticalSection(&g_32KEventResultCriticalSection);
+    RtlZeroMemory(entry, Size);
+    InterlockedPushEntrySList(&pool->FreeList, entry);
   }
+}
 
-  {
-    EnterCriticalSection(&g_64KEventResultCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_64KEventResultPool); ++i) {
-        FreeEventResult(*(PEVENT_INFORMATION *)DokanVector_GetItem(
-            g_64KEventResultPool, i));
-      }
-      DokanVector_Free(g_64KEventResultPool);
-      g_64KEventResultPool = NULL;
+// Same as PrewarmObjectPool for the DOKAN_OPEN_INFO, linked through PoolEntry
+// and initialized by AllocateFileOpenInfo.
+static VOID PrewarmFileOpenInfoPool(ULONG Node, USHORT Count) {
+  PDOKAN_OBJECT_POOL pool = &g_ObjectPools[Node][DokanPoolFileOpenInfo];
+  while (QueryDepthSList(&pool->FreeList) < min(Count, pool->MaxDepth)) {
+    PDOKAN_OPEN_INFO fileInfo = AllocateFileOpenInfo();
+    if (!fileInfo) {
+      return;
     }
-    LeaveCriticalSection(&g_64KEventResultCriticalSection);
-    DeleteCriticalSection(&g_64KEventResultCriticalSection);
+    InterlockedPushEntrySList(&pool->FreeList, &fileInfo->PoolEntry);
   }
+}
 
-  {
-    EnterCriticalSection(&g_128KEventResultCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_128KEventResultPool); ++i) {
-        FreeEventResult(*(PEVENT_INFORMATION *)DokanVector_GetItem(
-            g_128KEventResultPool, i));
-      }
-      DokanVector_Free(g_128KEventResultPool);
-      g_128KEventResultPool = NULL;
+static VOID CALLBACK PrewarmPoolCallback(PTP_CALLBACK_INSTANCE Instance,
+                                         PVOID Context, PTP_WORK Work) {
+  ULONG node = (ULONG)(ULONG_PTR)Context;
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Work);
+  PrewarmObjectPool(node, DokanPoolIoEvent, sizeof(DOKAN_IO_EVENT),
+                    DOKAN_POOL_PREWARM_IO_EVENTS);
+  PrewarmObjectPool(node, DokanPoolEventResult, DOKAN_EVENT_INFO_DEFAULT_SIZE,
+                    DOKAN_POOL_PREWARM_IO_EVENTS);
+  PrewarmObjectPool(node, DokanPoolIoBatch, DOKAN_IO_BATCH_SIZE,
+                    DOKAN_POOL_PREWARM_IO_BATCHES);
+  PrewarmFileOpenInfoPool(node, DOKAN_POOL_PREWARM_IO_EVENTS);
+}
+
+// Creates the PrewarmPool work of each node, bound to the thread pool of the
+// node.
+static VOID InitializePrewarmWorks() {
+  for (ULONG node = 0; node < g_PoolNodeCount; ++node) {
+    TP_CALLBACK_ENVIRON environment;
+    InitializeThreadpoolEnvironment(&environment);
+    SetThreadpoolCallbackPool(&environment, g_NodeThreadPools[node]);
+    g_PrewarmWorks[node] = CreateThreadpoolWork(
+        PrewarmPoolCallback, (PVOID)(ULONG_PTR)node, &environment);
+    DestroyThreadpoolEnvironment(&environment);
+  }
+}
+
+static VOID CleanupPrewarmWorks() {
+  for (ULONG node = 0; node < DOKAN_MAX_NUMA_NODES; ++node) {
+    if (g_PrewarmWorks[node]) {
+      WaitForThreadpoolWorkCallbacks(g_PrewarmWorks[node], FALSE);
+      CloseThreadpoolWork(g_PrewarmWorks[node]);
+      g_PrewarmWorks[node] = NULL;
     }
-    LeaveCriticalSection(&g_128KEventResultCriticalSection);
-    DeleteCriticalSection(&g_128KEventResultCriticalSection);
   }
+}
 
-  //////////////////// File info object pool ////////////////////
-  {
-    EnterCriticalSection(&g_FileInfoCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_FileInfoPool); ++i) {
-        FreeFileOpenInfo(
-            *(PDOKAN_OPEN_INFO *)DokanVector_GetItem(g_FileInfoPool, i));
-      }
-      DokanVector_Free(g_FileInfoPool);
-      g_FileInfoPool = NULL;
+VOID PrewarmPool() {
+  for (ULONG node = 0; node < g_PoolNodeCount; ++node) {
+    if (g_PrewarmWorks[node]) {
+      SubmitThreadpoolWork(g_PrewarmWorks[node]);
     }
-    LeaveCriticalSection(&g_FileInfoCriticalSection);
-    DeleteCriticalSection(&g_FileInfoCriticalSection);
   }
+}
 
-  //////////////////// Directory list pool ////////////////////
-  {
-    EnterCriticalSection(&g_DirectoryListCriticalSection);
-    {
-      for (size_t i = 0; i < DokanVector_GetCount(g_DirectoryListPool); ++i) {
-        DokanVector_Free(
-            *(PDOKAN_VECTOR *)DokanVector_GetItem(g_DirectoryListPool, i));
+static VOID InitializeEventResultClasses() {
+  SIZE_T largePageMinimum = g_UseLargePages ? GetLargePageMinimum() : 0;
+  for (ULONG i = 0; i < DOKAN_EVENT_RESULT_CLASS_COUNT; ++i) {
+    PDOKAN_EVENT_RESULT_CLASS resultClass = &g_EventResultClasses[i];
+    SIZE_T depth;
+    resultClass->Size = (SIZE_T)1 << (DOKAN_EVENT_RESULT_MIN_CLASS_SHIFT + i);
+    resultClass->LargePages =
+        largePageMinimum != 0 && resultClass->Size >= largePageMinimum;
+    // The larger classes get large pages of their own.
+    resultClass->Arena = g_LargePageArena != NULL && !resultClass->LargePages;
+    resultClass->InUse = 0;
+    resultClass->PeakInUse = 0;
+    depth = DOKAN_EVENT_RESULT_CLASS_POOL_MEMORY / resultClass->Size;
+    depth = max(depth, DOKAN_EVENT_RESULT_CLASS_MIN_DEPTH);
+    depth = min(depth, DOKAN_EVENT_RESULT_CLASS_MAX_DEPTH);
+    InitializeObjectPool(DokanPoolSizedEventResult + i, (USHORT)depth, 0);
+  }
+}
+
+int InitializePool() {
+  if (g_ThreadPool) {
+    DokanDbgPrint("Dokan Error: Thread pool has already been created.\n");
+    return DOKAN_DRIVER_INSTALL_ERROR;
+  }
+
+  // The big buffers are only cached once per thread.
+  InitializeObjectPool(DokanPoolIoBatch, DOKAN_IO_BATCH_POOL_SIZE, 1);
+  InitializeObjectPool(DokanPoolIoEvent, DOKAN_IO_EVENT_POOL_SIZE,
+                       DOKAN_POOL_THREAD_CACHE_SIZE);
+  InitializeObjectPool(DokanPoolEventResult, DOKAN_IO_EVENT_POOL_SIZE,
+                       DOKAN_POOL_THREAD_CACHE_SIZE);
+  InitializeObjectPool(DokanPoolFileOpenInfo, DOKAN_IO_EVENT_POOL_SIZE,
+                       DOKAN_POOL_THREAD_CACHE_SIZE);
+  InitializeObjectPool(DokanPoolDirectoryList, DOKAN_DIRECTORY_LIST_POOL_SIZE,
+                       1);
+  InitializeLargePageArena();
+  InitializeEventResultClasses();
+
+  // Without thread caches the pools only use the shared lists.
+  g_PoolThreadCacheIndex = FlsAlloc(FlushPoolThreadCache);
+  if (g_PoolThreadCacheIndex == FLS_OUT_OF_INDEXES) {
+    DokanDbgPrint("Dokan Warning: Failed to allocate the pool thread cache "
+                  "index: %d\n",
+                  GetLastError());
+  }
+
+  // It seems this is only needed if LoadLibrary() and FreeLibrary() are used and it should be called by the exe
+  // SetThreadpoolCallbackLibrary(&g_ThreadPoolCallbackEnvironment, hModule);
+  g_ThreadPool = CreateThreadpool(NULL);
+  if (!g_ThreadPool) {
+    DokanDbgPrint("Dokan Error: Failed to create thread pool.\n");
+    return DOKAN_DRIVER_INSTALL_ERROR;
+  }
+  InitializePoolNodes();
+  InitializePrewarmWorks();
+
+  InitializeThreadpoolEnvironment(&g_PoolCallbackEnvironment);
+  SetThreadpoolCallbackPool(&g_PoolCallbackEnvironment, g_ThreadPool);
+  g_EventResultTrimTimer = CreateThreadpoolTimer(TrimEventResults, NULL,
+                                                 &g_PoolCallbackEnvironment);
+  if (g_EventResultTrimTimer) {
+    ULARGE_INTEGER dueTime;
+    FILETIME fileDueTime;
+    // Relative due time in 100 nanoseconds
+    dueTime.QuadPart =
+        (ULONGLONG)(-(LONGLONG)DOKAN_EVENT_RESULT_TRIM_INTERVAL_MS * 10000);
+    fileDueTime.dwHighDateTime = dueTime.HighPart;
+    fileDueTime.dwLowDateTime = dueTime.LowPart;
+    SetThreadpoolTimer(g_EventResultTrimTimer, &fileDueTime,
+                       DOKAN_EVENT_RESULT_TRIM_INTERVAL_MS, 1000);
+  } else {
+    DokanDbgPrint("Dokan Warning: Failed to create the event result trim "
+                  "timer: %d\n",
+                  GetLastError());
+  }
+  return DOKAN_SUCCESS;
+}
+
+VOID CleanupPool() {
+  if (g_EventResultTrimTimer) {
+    SetThreadpoolTimer(g_EventResultTrimTimer, NULL, 0, 0);
+    WaitForThreadpoolTimerCallbacks(g_EventResultTrimTimer, TRUE);
+    CloseThreadpoolTimer(g_EventResultTrimTimer);
+    g_EventResultTrimTimer = NULL;
+  }
+  CleanupPrewarmWorks();
+  if (g_ThreadPool) {
+    DestroyThreadpoolEnvironment(&g_PoolCallbackEnvironment);
+    CleanupPoolNodes();
+    CloseThreadpool(g_ThreadPool);
+    g_ThreadPool = NULL;
+  }
+  // Freeing the index flushes the caches of all the threads.
+  if (g_PoolThreadCacheIndex != FLS_OUT_OF_INDEXES) {
+    FlsFree(g_PoolThreadCacheIndex);
+    g_PoolThreadCacheIndex = FLS_OUT_OF_INDEXES;
+  }
+  for (ULONG node = 0; node < DOKAN_MAX_NUMA_NODES; ++node) {
+    for (ULONG type = 0; type < DokanPoolTypeCount; ++type) {
+      PSLIST_ENTRY entry =
+          InterlockedFlushSList(&g_ObjectPools[node][type].FreeList);
+      while (entry) {
+        PSLIST_ENTRY next = entry->Next;
+        FreePoolEntry((DOKAN_POOL_TYPE)type, entry);
+        entry = next;
       }
-      DokanVector_Free(g_DirectoryListPool);
-      g_DirectoryListPool = NULL;
     }
-    LeaveCriticalSection(&g_DirectoryListCriticalSection);
-    DeleteCriticalSection(&g_DirectoryListCriticalSection);
   }
-
-  //////////////////// Object pool cleanup finished ////////////////////
+  CleanupLargePageArena();
 }
 
 /////////////////// DOKAN_IO_BATCH ///////////////////
 PDOKAN_IO_BATCH PopIoBatchBuffer() {
-  PDOKAN_IO_BATCH ioBatch = NULL;
-  EnterCriticalSection(&g_IoBatchBufferCriticalSection);
-  {
-    if (DokanVector_GetCount(g_IoBatchBufferPool) > 0) {
-      ioBatch =
-          *(PDOKAN_IO_BATCH *)DokanVector_GetLastItem(g_IoBatchBufferPool);
-      DokanVector_PopBack(g_IoBatchBufferPool);
-    }
-  }
-  LeaveCriticalSection(&g_IoBatchBufferCriticalSection);
+  PDOKAN_IO_BATCH ioBatch = (PDOKAN_IO_BATCH)PopPoolEntry(DokanPoolIoBatch);
   if (!ioBatch) {
-    ioBatch = (PDOKAN_IO_BATCH)malloc(DOKAN_IO_BATCH_SIZE);
+    ioBatch = AllocateIoBatchMemory();
   }
   if (ioBatch) {
     RtlZeroMemory(ioBatch, FIELD_OFFSET(DOKAN_IO_BATCH, EventContext));
     ioBatch->PoolAllocated = TRUE;
+    ioBatch->EventContextSize = BATCH_EVENT_CONTEXT_SIZE;
+  }
+  return ioBatch;
+}
+
+// Returns a batch buffer able to pull EventContextSize bytes of events. Sizes
+// above the pool buffer size are allocated on their own.
+PDOKAN_IO_BATCH AllocateIoBatchBuffer(ULONG EventContextSize) {
+  PDOKAN_IO_BATCH ioBatch = NULL;
+  if (EventContextSize <= BATCH_EVENT_CONTEXT_SIZE) {
+    ioBatch = PopIoBatchBuffer();
+    if (ioBatch) {
+      ioBatch->EventContextSize = EventContextSize;
+    }
+    return ioBatch;
+  }
+  ioBatch = (PDOKAN_IO_BATCH)malloc(
+      (SIZE_T)FIELD_OFFSET(DOKAN_IO_BATCH, EventContext) + EventContextSize);
+  if (ioBatch) {
+    RtlZeroMemory(ioBatch, FIELD_OFFSET(DOKAN_IO_BATCH, EventContext));
+    ioBatch->PoolAllocated = FALSE;
+    ioBatch->EventContextSize = EventContextSize;
   }
   return ioBatch;
 }
 
 VOID FreeIoBatchBuffer(PDOKAN_IO_BATCH IoBatch) {
-  if (IoBatch) {
+  if (IoBatch && !FreeLargePageArenaMemory(DokanPoolIoBatch, IoBatch)) {
     free(IoBatch);
   }
 }
@@ -297,35 +755,15 @@ VOID PushIoBatchBuffer(PDOKAN_IO_BATCH IoBatch) {
   if (currentEventContextBatchCount > 0) {
     return;
   }
-  if (!IoBatch->PoolAllocated) {
-    FreeIoBatchBuffer(IoBatch);
-    return;
-  }
-  EnterCriticalSection(&g_IoBatchBufferCriticalSection);
-  {
-    if (DokanVector_GetCount(g_IoBatchBufferPool) < DOKAN_IO_BATCH_POOL_SIZE) {
-      DokanVector_PushBack(g_IoBatchBufferPool, &IoBatch);
-      IoBatch = NULL;
-    }
-  }
-  LeaveCriticalSection(&g_IoBatchBufferCriticalSection);
-  if (IoBatch) {
+  if (!IoBatch->PoolAllocated ||
+      !PushPoolEntry(DokanPoolIoBatch, (PSLIST_ENTRY)IoBatch)) {
     FreeIoBatchBuffer(IoBatch);
   }
 }
 
 /////////////////// DOKAN_IO_EVENT ///////////////////
 PDOKAN_IO_EVENT PopIoEventBuffer() {
-  PDOKAN_IO_EVENT ioEvent = NULL;
-  EnterCriticalSection(&g_IoEventBufferCriticalSection);
-  {
-    if (DokanVector_GetCount(g_IoEventBufferPool) > 0) {
-      ioEvent =
-          *(PDOKAN_IO_EVENT *)DokanVector_GetLastItem(g_IoEventBufferPool);
-      DokanVector_PopBack(g_IoEventBufferPool);
-    }
-  }
-  LeaveCriticalSection(&g_IoEventBufferCriticalSection);
+  PDOKAN_IO_EVENT ioEvent = (PDOKAN_IO_EVENT)PopPoolEntry(DokanPoolIoEvent);
   if (!ioEvent) {
     ioEvent = (PDOKAN_IO_EVENT)malloc(sizeof(DOKAN_IO_EVENT));
   }
@@ -337,31 +775,15 @@ PDOKAN_IO_EVENT PopIoEventBuffer() {
 
 VOID PushIoEventBuffer(PDOKAN_IO_EVENT IoEvent) {
   assert(IoEvent);
-  EnterCriticalSection(&g_IoEventBufferCriticalSection);
-  {
-    if (DokanVector_GetCount(g_IoEventBufferPool) < DOKAN_IO_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_IoEventBufferPool, &IoEvent);
-      IoEvent = NULL;
-    }
-  }
-  LeaveCriticalSection(&g_IoEventBufferCriticalSection);
-  if (IoEvent) {
+  if (!PushPoolEntry(DokanPoolIoEvent, (PSLIST_ENTRY)IoEvent)) {
     FreeIoEventBuffer(IoEvent);
   }
 }
 
 /////////////////// EVENT_INFORMATION ///////////////////
 PEVENT_INFORMATION PopEventResult() {
-  PEVENT_INFORMATION eventResult = NULL;
-  EnterCriticalSection(&g_EventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_EventResultPool) > 0) {
-      eventResult =
-          *(PEVENT_INFORMATION *)DokanVector_GetLastItem(g_EventResultPool);
-      DokanVector_PopBack(g_EventResultPool);
-    }
-  }
-  LeaveCriticalSection(&g_EventResultCriticalSection);
+  PEVENT_INFORMATION eventResult =
+      (PEVENT_INFORMATION)PopPoolEntry(DokanPoolEventResult);
   if (!eventResult) {
     eventResult = (PEVENT_INFORMATION)malloc(DOKAN_EVENT_INFO_DEFAULT_SIZE);
   }
@@ -379,198 +801,182 @@ VOID FreeEventResult(PEVENT_INFORMATION EventResult) {
 
 VOID PushEventResult(PEVENT_INFORMATION EventResult) {
   assert(EventResult);
-  EnterCriticalSection(&g_EventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_EventResultPool) < DOKAN_IO_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_EventResultPool, &EventResult);
-      EventResult = NULL;
-    }
-  }
-  LeaveCriticalSection(&g_EventResultCriticalSection);
-  if (EventResult) {
+  if (!PushPoolEntry(DokanPoolEventResult, (PSLIST_ENTRY)EventResult)) {
     FreeEventResult(EventResult);
   }
 }
 
-/////////////////// EVENT_INFORMATION 16K ///////////////////
-PEVENT_INFORMATION Pop16KEventResult() {
-  PEVENT_INFORMATION eventResult = NULL;
-  EnterCriticalSection(&g_16KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_16KEventResultPool) > 0) {
-      eventResult =
-          *(PEVENT_INFORMATION *)DokanVector_GetLastItem(g_16KEventResultPool);
-      DokanVector_PopBack(g_16KEventResultPool);
+/////////////////// EVENT_INFORMATION size classes ///////////////////
+// Returns the index of the smallest class of at least Size bytes.
+static BOOL GetEventResultClass(SIZE_T Size, PULONG Index) {
+  ULONG shift = DOKAN_EVENT_RESULT_MIN_CLASS_SHIFT;
+  while (((SIZE_T)1 << shift) < Size) {
+    if (++shift > DOKAN_EVENT_RESULT_MAX_CLASS_SHIFT) {
+      return FALSE;
     }
   }
-  LeaveCriticalSection(&g_16KEventResultCriticalSection);
-  if (!eventResult) {
-    eventResult = (PEVENT_INFORMATION)malloc(DOKAN_EVENT_INFO_16K_SIZE);
-  }
-  if (eventResult) {
-    RtlZeroMemory(eventResult, FIELD_OFFSET(EVENT_INFORMATION, Buffer));
-  }
-  return eventResult;
+  *Index = shift - DOKAN_EVENT_RESULT_MIN_CLASS_SHIFT;
+  return TRUE;
 }
 
-VOID Push16KEventResult(PEVENT_INFORMATION EventResult) {
-  assert(EventResult);
-  EnterCriticalSection(&g_16KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_16KEventResultPool) <
-        DOKAN_IO_EXTRA_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_16KEventResultPool, &EventResult);
-      EventResult = NULL;
+static PEVENT_INFORMATION AllocateSizedEventResult(
+    PDOKAN_EVENT_RESULT_CLASS Class) {
+  PVOID eventResult = NULL;
+  if (Class->Arena) {
+    eventResult = AllocateLargePageArenaMemory(
+        DokanPoolSizedEventResult + (ULONG)(Class - g_EventResultClasses),
+        Class->Size);
+    if (eventResult) {
+      return (PEVENT_INFORMATION)eventResult;
     }
   }
-  LeaveCriticalSection(&g_16KEventResultCriticalSection);
-  if (EventResult) {
-    FreeEventResult(EventResult);
-  }
-}
-
-/////////////////// EVENT_INFORMATION 32K ///////////////////
-PEVENT_INFORMATION Pop32KEventResult() {
-  PEVENT_INFORMATION eventResult = NULL;
-  EnterCriticalSection(&g_32KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_32KEventResultPool) > 0) {
-      eventResult =
-          *(PEVENT_INFORMATION *)DokanVector_GetLastItem(g_32KEventResultPool);
-      DokanVector_PopBack(g_32KEventResultPool);
-    }
+  if (!Class->LargePages) {
+    return (PEVENT_INFORMATION)malloc(Class->Size);
   }
-  LeaveCriticalSection(&g_32KEventResultCriticalSection);
+  eventResult =
+      VirtualAlloc(NULL, Class->Size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                   PAGE_READWRITE);
   if (!eventResult) {
-    eventResult = (PEVENT_INFORMATION)malloc(DOKAN_EVENT_INFO_32K_SIZE);
-  }
-  if (eventResult) {
-    RtlZeroMemory(eventResult, FIELD_OFFSET(EVENT_INFORMATION, Buffer));
+    // Large pages run out as the physical memory gets fragmented.
+    eventResult = VirtualAlloc(NULL, Class->Size, MEM_RESERVE | MEM_COMMIT,
+                               PAGE_READWRITE);
   }
-  return eventResult;
+  return (PEVENT_INFORMATION)eventResult;
 }
 
-VOID Push32KEventResult(PEVENT_INFORMATION EventResult) {
-  assert(EventResult);
-  EnterCriticalSection(&g_32KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_32KEventResultPool) <
-        DOKAN_IO_EXTRA_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_32KEventResultPool, &EventResult);
-      EventResult = NULL;
-    }
-  }
-  LeaveCriticalSection(&g_32KEventResultCriticalSection);
-  if (EventResult) {
-    FreeEventResult(EventResult);
-  }
-}
-
-/////////////////// EVENT_INFORMATION 64K ///////////////////
-PEVENT_INFORMATION Pop64KEventResult() {
+PEVENT_INFORMATION PopSizedEventResult(ULONG BufferSize,
+                                       PULONG EventResultSize) {
+  PDOKAN_EVENT_RESULT_CLASS resultClass = NULL;
   PEVENT_INFORMATION eventResult = NULL;
-  EnterCriticalSection(&g_64KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_64KEventResultPool) > 0) {
-      eventResult =
-          *(PEVENT_INFORMATION *)DokanVector_GetLastItem(g_64KEventResultPool);
-      DokanVector_PopBack(g_64KEventResultPool);
-    }
-  }
-  LeaveCriticalSection(&g_64KEventResultCriticalSection);
+  ULONG index = 0;
+  LONG inUse = 0;
+  if (!GetEventResultClass(
+          (SIZE_T)FIELD_OFFSET(EVENT_INFORMATION, Buffer) + BufferSize,
+          &index)) {
+    return NULL;
+  }
+  resultClass = &g_EventResultClasses[index];
+  eventResult =
+      (PEVENT_INFORMATION)PopPoolEntry(DokanPoolSizedEventResult + index);
   if (!eventResult) {
-    eventResult = (PEVENT_INFORMATION)malloc(DOKAN_EVENT_INFO_64K_SIZE);
+    eventResult = AllocateSizedEventResult(resultClass);
+    if (!eventResult) {
+      return NULL;
+    }
   }
-  if (eventResult) {
-    RtlZeroMemory(eventResult, FIELD_OFFSET(EVENT_INFORMATION, Buffer));
+  inUse = InterlockedIncrement(&resultClass->InUse);
+  for (LONG peak = resultClass->PeakInUse; inUse > peak;
+       peak = resultClass->PeakInUse) {
+    if (InterlockedCompareExchange(&resultClass->PeakInUse, inUse, peak) ==
+        peak) {
+      break;
+    }
   }
+  RtlZeroMemory(eventResult, FIELD_OFFSET(EVENT_INFORMATION, Buffer));
+  *EventResultSize = (ULONG)resultClass->Size;
   return eventResult;
 }
 
-VOID Push64KEventResult(PEVENT_INFORMATION EventResult) {
+VOID PushSizedEventResult(PEVENT_INFORMATION EventResult,
+                          ULONG EventResultSize) {
+  PDOKAN_EVENT_RESULT_CLASS resultClass = NULL;
+  ULONG index = 0;
   assert(EventResult);
-  EnterCriticalSection(&g_64KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_64KEventResultPool) <
-        DOKAN_IO_EXTRA_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_64KEventResultPool, &EventResult);
-      EventResult = NULL;
-    }
+  if (!GetEventResultClass(EventResultSize, &index)) {
+    assert(FALSE);
+    return;
   }
-  LeaveCriticalSection(&g_64KEventResultCriticalSection);
-  if (EventResult) {
-    FreeEventResult(EventResult);
+  resultClass = &g_EventResultClasses[index];
+  assert(resultClass->Size == EventResultSize);
+  InterlockedDecrement(&resultClass->InUse);
+  if (!PushPoolEntry(DokanPoolSizedEventResult + index,
+                     (PSLIST_ENTRY)EventResult)) {
+    FreeSizedEventResult(resultClass, EventResult);
   }
 }
 
-/////////////////// EVENT_INFORMATION 128K ///////////////////
-PEVENT_INFORMATION Pop128KEventResult() {
-  PEVENT_INFORMATION eventResult = NULL;
-  EnterCriticalSection(&g_128KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_128KEventResultPool) > 0) {
-      eventResult =
-          *(PEVENT_INFORMATION *)DokanVector_GetLastItem(g_128KEventResultPool);
-      DokanVector_PopBack(g_128KEventResultPool);
-    }
-  }
-  LeaveCriticalSection(&g_128KEventResultCriticalSection);
-  if (!eventResult) {
-    eventResult = (PEVENT_INFORMATION)malloc(DOKAN_EVENT_INFO_128K_SIZE);
-  }
-  if (eventResult) {
-    RtlZeroMemory(eventResult, FIELD_OFFSET(EVENT_INFORMATION, Buffer));
-  }
-  return eventResult;
+// Gives the calling process the right to lock pages in memory, required by
+// large pages.
+static BOOL EnableLockMemoryPrivilege() {
+  HANDLE token = NULL;
+  TOKEN_PRIVILEGES privileges;
+  BOOL enabled = FALSE;
+  if (!OpenProcessToken(GetCurrentProcess(),
+                        TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+    return FALSE;
+  }
+  privileges.PrivilegeCount = 1;
+  privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  if (LookupPrivilegeValueW(NULL, SE_LOCK_MEMORY_NAME,
+                            &privileges.Privileges[0].Luid) &&
+      AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)) {
+    // ERROR_NOT_ALL_ASSIGNED when the process does not hold the privilege.
+    enabled = GetLastError() == ERROR_SUCCESS;
+  }
+  CloseHandle(token);
+  return enabled;
 }
 
-VOID Push128KEventResult(PEVENT_INFORMATION EventResult) {
-  assert(EventResult);
-  EnterCriticalSection(&g_128KEventResultCriticalSection);
-  {
-    if (DokanVector_GetCount(g_128KEventResultPool) <
-        DOKAN_IO_EXTRA_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_128KEventResultPool, &EventResult);
-      EventResult = NULL;
-    }
+BOOL EnablePoolLargePages() {
+  if (g_ThreadPool) {
+    DokanDbgPrint("Dokan Error: Large pages must be enabled before DokanInit.\n");
+    return FALSE;
   }
-  LeaveCriticalSection(&g_128KEventResultCriticalSection);
-  if (EventResult) {
-    FreeEventResult(EventResult);
+  if (GetLargePageMinimum() == 0 || !EnableLockMemoryPrivilege()) {
+    DokanDbgPrint("Dokan Warning: Large pages are not available: %d\n",
+                  GetLastError());
+    return FALSE;
   }
+  g_UseLargePages = TRUE;
+  return TRUE;
 }
 
 /////////////////// DOKAN_OPEN_INFO ///////////////////
+PDOKAN_OPEN_INFO AllocateFileOpenInfo() {
+  PDOKAN_OPEN_INFO fileInfo =
+      (PDOKAN_OPEN_INFO)malloc(sizeof(DOKAN_OPEN_INFO));
+  if (!fileInfo) {
+    return NULL;
+  }
+  RtlZeroMemory(fileInfo, sizeof(DOKAN_OPEN_INFO));
+  // Without debug info, initializing the lock does not allocate either.
+  (void)InitializeCriticalSectionEx(&fileInfo->CriticalSection, 0,
+                                    CRITICAL_SECTION_NO_DEBUG_INFO);
+  return fileInfo;
+}
+
 PDOKAN_OPEN_INFO PopFileOpenInfo() {
   PDOKAN_OPEN_INFO fileInfo = NULL;
-  EnterCriticalSection(&g_FileInfoCriticalSection);
-  {
-    if (DokanVector_GetCount(g_FileInfoPool) > 0) {
-      fileInfo = *(PDOKAN_OPEN_INFO *)DokanVector_GetLastItem(g_FileInfoPool);
-      DokanVector_PopBack(g_FileInfoPool);
-    }
+  PSLIST_ENTRY entry = PopPoolEntry(DokanPoolFileOpenInfo);
+  if (entry) {
+    fileInfo = CONTAINING_RECORD(entry, DOKAN_OPEN_INFO, PoolEntry);
   }
-  LeaveCriticalSection(&g_FileInfoCriticalSection);
   if (!fileInfo) {
-    fileInfo = (PDOKAN_OPEN_INFO)malloc(sizeof(DOKAN_OPEN_INFO));
+    fileInfo = AllocateFileOpenInfo();
     if (!fileInfo) {
       DokanDbgPrint("Dokan Error: Failed to allocate DOKAN_OPEN_INFO.\n");
       return NULL;
     }
-    RtlZeroMemory(fileInfo, sizeof(DOKAN_OPEN_INFO));
-    InitializeCriticalSection(&fileInfo->CriticalSection);
   }
   if (fileInfo) {
     fileInfo->DokanInstance = NULL;
     fileInfo->DirList = NULL;
     fileInfo->DirListSearchPattern= NULL;
     fileInfo->UnimplementedFindFilesWithPattern = FALSE;
+    fileInfo->UnimplementedFindFilesWithCursor = FALSE;
+    fileInfo->CursorIndex = 0;
+    fileInfo->CursorFileName = NULL;
+    fileInfo->DirListPosition = 0;
+    fileInfo->DirListIndex = 0;
     fileInfo->UserContext = 0;
     fileInfo->EventId = 0;
     fileInfo->IsDirectory = FALSE;
     fileInfo->OpenCount = 0;
     fileInfo->CloseFileName = NULL;
     fileInfo->CloseUserContext = 0;
+    fileInfo->AsyncCleanupDone = FALSE;
+    fileInfo->CloseWaitsForCleanup = FALSE;
+    fileInfo->WrittenBeforeCleanup = FALSE;
     fileInfo->EventContext = NULL;
   }
   return fileInfo;
@@ -585,11 +991,17 @@ VOID CleanupFileOpenInfo(PDOKAN_OPEN_INFO FileInfo) {
       free(FileInfo->DirListSearchPattern);
       FileInfo->DirListSearchPattern = NULL;
     }
+    if (FileInfo->CursorFileName) {
+      free(FileInfo->CursorFileName);
+      FileInfo->CursorFileName = NULL;
+    }
 
     if (FileInfo->DirList) {
       dirList = FileInfo->DirList;
       FileInfo->DirList = NULL;
     }
+    FileInfo->DirListPosition = 0;
+    FileInfo->DirListIndex = 0;
   }
   LeaveCriticalSection(&FileInfo->CriticalSection);
   if (dirList) {
@@ -608,55 +1020,67 @@ VOID FreeFileOpenInfo(PDOKAN_OPEN_INFO FileInfo) {
 VOID PushFileOpenInfo(PDOKAN_OPEN_INFO FileInfo) {
   assert(FileInfo);
   CleanupFileOpenInfo(FileInfo);
-  EnterCriticalSection(&g_FileInfoCriticalSection);
-  {
-    if (DokanVector_GetCount(g_FileInfoPool) < DOKAN_IO_EVENT_POOL_SIZE) {
-      DokanVector_PushBack(g_FileInfoPool, &FileInfo);
-      FileInfo = NULL;
-    }
-  }
-  LeaveCriticalSection(&g_FileInfoCriticalSection);
-  if (FileInfo) {
+  if (!PushPoolEntry(DokanPoolFileOpenInfo, &FileInfo->PoolEntry)) {
     FreeFileOpenInfo(FileInfo);
   }
 }
 
 /////////////////// Directory list ///////////////////
 PDOKAN_VECTOR PopDirectoryList() {
-  PDOKAN_VECTOR directoryList = NULL;
-  EnterCriticalSection(&g_DirectoryListCriticalSection);
-  {
-    if (DokanVector_GetCount(g_DirectoryListPool) > 0) {
-      directoryList =
-          *(PDOKAN_VECTOR *)DokanVector_GetLastItem(g_DirectoryListPool);
-      DokanVector_PopBack(g_DirectoryListPool);
+  PDOKAN_POOLED_DIRECTORY_LIST directoryList = NULL;
+  PSLIST_ENTRY entry = PopPoolEntry(DokanPoolDirectoryList);
+  if (entry) {
+    directoryList =
+        CONTAINING_RECORD(entry, DOKAN_POOLED_DIRECTORY_LIST, PoolEntry);
+  } else {
+    directoryList = (PDOKAN_POOLED_DIRECTORY_LIST)malloc(
+        sizeof(DOKAN_POOLED_DIRECTORY_LIST));
+    if (!directoryList) {
+      return NULL;
+    }
+    if (!DokanVector_Init(&directoryList->DirectoryList,
+                          sizeof(WIN32_FIND_DATAW))) {
+      free(directoryList);
+      return NULL;
     }
   }
-  LeaveCriticalSection(&g_DirectoryListCriticalSection);
-  if (!directoryList) {
-    directoryList = DokanVector_Alloc(sizeof(WIN32_FIND_DATAW));
-  }
-  if (directoryList) {
-    DokanVector_Clear(directoryList);
-  }
-  return directoryList;
+  DokanVector_Clear(&directoryList->DirectoryList);
+  // For AddMissingCurrentAndParentFolder to add "." and ".." without moving
+  // the listing.
+  DokanVector_ReserveFront(&directoryList->DirectoryList, 2);
+  return &directoryList->DirectoryList;
 }
 
 VOID PushDirectoryList(PDOKAN_VECTOR DirectoryList) {
   assert(DirectoryList);
   assert(DokanVector_GetItemSize(DirectoryList) == sizeof(WIN32_FIND_DATAW));
-  EnterCriticalSection(&g_DirectoryListCriticalSection);
-  {
-    if (DokanVector_GetCount(g_DirectoryListPool) <
-        DOKAN_DIRECTORY_LIST_POOL_SIZE) {
-      DokanVector_PushBack(g_DirectoryListPool, &DirectoryList);
-      DirectoryList = NULL;
-    }
-  }
-  LeaveCriticalSection(&g_DirectoryListCriticalSection);
-  if (DirectoryList) {
-    DokanVector_Free(DirectoryList);
+  PDOKAN_POOLED_DIRECTORY_LIST directoryList = CONTAINING_RECORD(
+      DirectoryList, DOKAN_POOLED_DIRECTORY_LIST, DirectoryList);
+  if (!PushPoolEntry(DokanPoolDirectoryList, &directoryList->PoolEntry)) {
+    FreeDirectoryList(directoryList);
   }
 }
 
-/////////////////// Push/Pop pattern finished ///////////////////
\ No newline at end of file
+/////////////////// Push/Pop pattern finished ///////////////////
+
+VOID EnablePoolMetrics() { InterlockedExchange(&g_PoolMetricsEnabled, TRUE); }
+
+static VOID GetPoolTypeMetrics(DOKAN_POOL_TYPE Type,
+                               PDOKAN_POOL_METRICS Metrics) {
+  Metrics->Hits +=
+      (ULONG64)InterlockedCompareExchange64(&g_PoolHits[Type], 0, 0);
+  Metrics->Misses +=
+      (ULONG64)InterlockedCompareExchange64(&g_PoolMisses[Type], 0, 0);
+}
+
+VOID GetPoolMetrics(PDOKAN_INSTANCE_METRICS Metrics) {
+  GetPoolTypeMetrics(DokanPoolIoBatch, &Metrics->IoBatchPool);
+  GetPoolTypeMetrics(DokanPoolIoEvent, &Metrics->IoEventPool);
+  GetPoolTypeMetrics(DokanPoolEventResult, &Metrics->EventResultPool);
+  for (ULONG i = 0; i < DOKAN_EVENT_RESULT_CLASS_COUNT; ++i) {
+    GetPoolTypeMetrics(DokanPoolSizedEventResult + i,
+                       &Metrics->EventResultPool);
+  }
+  GetPoolTypeMetrics(DokanPoolFileOpenInfo, &Metrics->OpenInfoPool);
+  GetPoolTypeMetrics(DokanPoolDirectoryList, &Metrics->DirectoryListPool);
+}
\ No newline at end of file
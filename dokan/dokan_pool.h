@@ -27,25 +27,63 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define DOKAN_PULL_EVENT_TIMEOUT_MS 100
 #define DOKAN_MAIN_PULL_THREAD_COUNT_MAX 16
 #define DOKAN_MAIN_PULL_THREAD_COUNT_MIN 2
+// Most main pull threads accepted from DOKAN_OPTIONS.MinThreads and MaxThreads
+#define DOKAN_MAIN_PULL_THREAD_COUNT_LIMIT 256
+// Pulls each mount keeps pending with DOKAN_OPTION_SHARED_DISPATCH, by default
+// and at most from DOKAN_OPTIONS.SharedDispatchQuota.
+#define DOKAN_SHARED_DISPATCH_DEFAULT_QUOTA 2
+#define DOKAN_SHARED_DISPATCH_QUOTA_MAX 64
+// Most pulls a mount keeps pending with DOKAN_OPTION_OVERLAPPED_PULL.
+#define DOKAN_PULL_QUEUE_DEPTH_MAX 256
+// Interval at which a stopping mount cancels the overlapped pulls issued
+// meanwhile.
+#define DOKAN_PULL_CANCEL_INTERVAL_MS 50
 #define BATCH_EVENT_CONTEXT_SIZE (EVENT_CONTEXT_MAX_SIZE * 4)
 #define DOKAN_IO_BATCH_SIZE                                                    \
   ((SIZE_T)(FIELD_OFFSET(DOKAN_IO_BATCH, EventContext)) +                      \
    BATCH_EVENT_CONTEXT_SIZE)
 
-#define DOKAN_EVENT_INFO_16K_SIZE                                              \
-  (FIELD_OFFSET(EVENT_INFORMATION, Buffer) + (16 * 1024))
-#define DOKAN_EVENT_INFO_32K_SIZE                                              \
-  (FIELD_OFFSET(EVENT_INFORMATION, Buffer) + (32 * 1024))
-#define DOKAN_EVENT_INFO_64K_SIZE                                              \
-  (FIELD_OFFSET(EVENT_INFORMATION, Buffer) + (64 * 1024))
-#define DOKAN_EVENT_INFO_128K_SIZE                                             \
-  (FIELD_OFFSET(EVENT_INFORMATION, Buffer) + (128 * 1024))
+// Bounds and defaults of the size of the buffers pulling batches of events
+// with DOKAN_OPTION_ALLOW_IPC_BATCHING. The size adapts between
+// DOKAN_OPTIONS.IpcBatchMinSize and IpcBatchMaxSize to the observed load.
+#define DOKAN_IPC_BATCH_MIN_SIZE EVENT_CONTEXT_MAX_SIZE
+#define DOKAN_IPC_BATCH_MAX_SIZE (EVENT_CONTEXT_MAX_SIZE * 32)
+#define DOKAN_IPC_BATCH_DEFAULT_MAX_SIZE BATCH_EVENT_CONTEXT_SIZE
+// Batches expected to be processed within that time by the pulling thread are
+// not dispatched to the thread pool.
+#define DOKAN_IPC_BATCH_INLINE_BUDGET_US 50
+
+// Size classes of the event results bigger than DOKAN_EVENT_INFO_DEFAULT_SIZE.
+// Their sizes, header included, are the powers of two from 8KB to 64MB.
+#define DOKAN_EVENT_RESULT_MIN_CLASS_SHIFT 13
+#define DOKAN_EVENT_RESULT_MAX_CLASS_SHIFT 26
+#define DOKAN_EVENT_RESULT_CLASS_COUNT                                         \
+  (DOKAN_EVENT_RESULT_MAX_CLASS_SHIFT - DOKAN_EVENT_RESULT_MIN_CLASS_SHIFT + 1)
+// Interval at which the unused results of each class above the peak use of
+// the interval are freed.
+#define DOKAN_EVENT_RESULT_TRIM_INTERVAL_MS (10 * 1000)
 
 PTP_POOL GetThreadPool();
+
+// NUMA nodes. Systems with several nodes get a thread pool and object pools
+// for each, up to DOKAN_MAX_NUMA_NODES. There is a single node otherwise.
+ULONG GetPoolNodeCount();
+PTP_POOL GetNodeThreadPool(ULONG Node);
+USHORT GetPoolNodeProcessorGroup(ULONG Node);
+// Node of the processor running the calling thread.
+ULONG GetCurrentPoolNode();
+// Keeps the calling thread on the processors of Node.
+VOID BindThreadToPoolNode(ULONG Node);
 int InitializePool();
 VOID CleanupPool();
+// Fills the shared lists of every node with the buffers the first requests of
+// a mount need, on the threads of the node and without waiting for them. Used
+// while the driver starts a new mount so that its first requests do not
+// allocate.
+VOID PrewarmPool();
 
 PDOKAN_IO_BATCH PopIoBatchBuffer();
+PDOKAN_IO_BATCH AllocateIoBatchBuffer(ULONG EventContextSize);
 VOID PushIoBatchBuffer(PDOKAN_IO_BATCH IoBatch);
 VOID FreeIoBatchBuffer(PDOKAN_IO_BATCH IoBatch);
 
@@ -57,16 +95,21 @@ PEVENT_INFORMATION PopEventResult();
 VOID PushEventResult(PEVENT_INFORMATION EventResult);
 VOID FreeEventResult(PEVENT_INFORMATION EventResult);
 
-// Event with extra memory allocated for events holding additional data. 
-PEVENT_INFORMATION Pop16KEventResult();
-VOID Push16KEventResult(PEVENT_INFORMATION EventResult);
-PEVENT_INFORMATION Pop32KEventResult();
-VOID Push32KEventResult(PEVENT_INFORMATION EventResult);
-PEVENT_INFORMATION Pop64KEventResult();
-VOID Push64KEventResult(PEVENT_INFORMATION EventResult);
-PEVENT_INFORMATION Pop128KEventResult();
-VOID Push128KEventResult(PEVENT_INFORMATION EventResult);
-
+// Event with extra memory allocated for events holding additional data, from
+// the smallest size class with a buffer of at least BufferSize bytes. Only the
+// header is cleared. EventResultSize receives the size of the class. Returns
+// NULL if BufferSize is above the biggest class.
+PEVENT_INFORMATION PopSizedEventResult(ULONG BufferSize,
+                                       PULONG EventResultSize);
+VOID PushSizedEventResult(PEVENT_INFORMATION EventResult,
+                          ULONG EventResultSize);
+// Allocates the size classes of at least a large page with large pages. Must be
+// called before InitializePool.
+BOOL EnablePoolLargePages();
+
+// Allocates a DOKAN_OPEN_INFO outside of the pool. Its lock is initialized
+// there once and kept while the object goes through the pool.
+PDOKAN_OPEN_INFO AllocateFileOpenInfo();
 PDOKAN_OPEN_INFO PopFileOpenInfo();
 VOID PushFileOpenInfo(PDOKAN_OPEN_INFO FileInfo);
 VOID FreeFileOpenInfo(PDOKAN_OPEN_INFO FileInfo);
@@ -74,4 +117,9 @@ VOID FreeFileOpenInfo(PDOKAN_OPEN_INFO FileInfo);
 PDOKAN_VECTOR PopDirectoryList();
 VOID PushDirectoryList(PDOKAN_VECTOR DirectoryList);
 
+// Starts counting the hits and misses of the pools, which GetPoolMetrics adds
+// to Metrics. The sized event results are accounted as EventResultPool.
+VOID EnablePoolMetrics();
+VOID GetPoolMetrics(PDOKAN_INSTANCE_METRICS Metrics);
+
 #endif
@@ -0,0 +1,637 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokan_recorder.h"
+#include "dokan_pool.h"
+
+#include <assert.h>
+
+// Requests are appended to a buffer under the lock of the recorder, which is
+// written out when full or when the recording stops.
+#define DOKAN_RECORDER_BUFFER_SIZE (1024 * 1024)
+
+#define DOKAN_RECORD_ALIGN(Length) (((Length) + 7) & ~7)
+
+typedef struct _DOKAN_RECORDER {
+  CRITICAL_SECTION Lock;
+  HANDLE File;
+  LONG64 StartTime;
+  // Set once a write failed, nothing is recorded anymore then.
+  BOOL Failed;
+  ULONG Used;
+  UCHAR Buffer[DOKAN_RECORDER_BUFFER_SIZE];
+} DOKAN_RECORDER, *PDOKAN_RECORDER;
+
+static VOID WriteRecorderFile(PDOKAN_RECORDER Recorder, PVOID Data,
+                              ULONG Length) {
+  DWORD written = 0;
+  if (Recorder->Failed || Length == 0) {
+    return;
+  }
+  if (!WriteFile(Recorder->File, Data, Length, &written, NULL) ||
+      written != Length) {
+    DokanDbgPrint("Dokan Error: Writing the event recording failed: %d\n",
+                  GetLastError());
+    Recorder->Failed = TRUE;
+  }
+}
+
+static VOID FlushRecorder(PDOKAN_RECORDER Recorder) {
+  WriteRecorderFile(Recorder, Recorder->Buffer, Recorder->Used);
+  Recorder->Used = 0;
+}
+
+static VOID WriteRecord(PDOKAN_RECORDER Recorder, DOKAN_RECORD_TYPE Type,
+                        ULONG SerialNumber, PVOID Data, ULONG DataLength) {
+  static const UCHAR padding[8] = {0};
+  DOKAN_RECORD record;
+  LARGE_INTEGER now;
+  ULONG length = DOKAN_RECORD_ALIGN(sizeof(DOKAN_RECORD) + DataLength);
+
+  record.Length = length;
+  record.Type = (USHORT)Type;
+  record.Reserved = 0;
+  record.SerialNumber = SerialNumber;
+  record.ThreadId = GetCurrentThreadId();
+  EnterCriticalSection(&Recorder->Lock);
+  // Taken under the lock for the records to be in time order.
+  QueryPerformanceCounter(&now);
+  record.Time = now.QuadPart - Recorder->StartTime;
+  if (Recorder->Used + length > DOKAN_RECORDER_BUFFER_SIZE) {
+    FlushRecorder(Recorder);
+  }
+  if (length <= DOKAN_RECORDER_BUFFER_SIZE) {
+    PUCHAR buffer = Recorder->Buffer + Recorder->Used;
+    RtlCopyMemory(buffer, &record, sizeof(DOKAN_RECORD));
+    RtlCopyMemory(buffer + sizeof(DOKAN_RECORD), Data, DataLength);
+    RtlZeroMemory(buffer + sizeof(DOKAN_RECORD) + DataLength,
+                  length - sizeof(DOKAN_RECORD) - DataLength);
+    Recorder->Used += length;
+  } else {
+    WriteRecorderFile(Recorder, &record, sizeof(DOKAN_RECORD));
+    WriteRecorderFile(Recorder, Data, DataLength);
+    WriteRecorderFile(Recorder, (PVOID)padding,
+                      length - sizeof(DOKAN_RECORD) - DataLength);
+  }
+  LeaveCriticalSection(&Recorder->Lock);
+}
+
+VOID RecordEvent(PDOKAN_INSTANCE DokanInstance, PEVENT_CONTEXT EventContext) {
+  PDOKAN_RECORDER recorder;
+  ULONG length = EventContext->Length;
+  if (EventContext->MajorFunction == IRP_MJ_WRITE) {
+    // Only what precedes the data, which may not even be in the event.
+    length = min(length,
+                 (ULONG)FIELD_OFFSET(EVENT_CONTEXT, Operation.Write.FileName) +
+                     EventContext->Operation.Write.FileNameLength +
+                     sizeof(WCHAR));
+  }
+  AcquireSRWLockShared(&DokanInstance->RecorderLock);
+  recorder = DokanInstance->Recorder;
+  if (recorder && !recorder->Failed) {
+    WriteRecord(recorder, DokanRecordEvent, EventContext->SerialNumber,
+                EventContext, length);
+  }
+  ReleaseSRWLockShared(&DokanInstance->RecorderLock);
+}
+
+VOID RecordEventResult(PDOKAN_INSTANCE DokanInstance, ULONG SerialNumber,
+                       PEVENT_INFORMATION EventResult) {
+  PDOKAN_RECORDER recorder;
+  DOKAN_RECORD_RESULT result;
+  result.Status = EventResult->Status;
+  result.BufferLength = EventResult->BufferLength;
+  result.Context = EventResult->Context;
+  AcquireSRWLockShared(&DokanInstance->RecorderLock);
+  recorder = DokanInstance->Recorder;
+  if (recorder && !recorder->Failed) {
+    WriteRecord(recorder, DokanRecordResult, SerialNumber, &result,
+                sizeof(result));
+  }
+  ReleaseSRWLockShared(&DokanInstance->RecorderLock);
+}
+
+BOOL StopEventRecording(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_RECORDER recorder;
+  BOOL success;
+  AcquireSRWLockExclusive(&DokanInstance->RecorderLock);
+  recorder = DokanInstance->Recorder;
+  DokanInstance->Recorder = NULL;
+  ReleaseSRWLockExclusive(&DokanInstance->RecorderLock);
+  if (!recorder) {
+    return FALSE;
+  }
+  FlushRecorder(recorder);
+  success = !recorder->Failed;
+  CloseHandle(recorder->File);
+  DeleteCriticalSection(&recorder->Lock);
+  free(recorder);
+  return success;
+}
+
+BOOL DOKANAPI DokanStartEventRecording(_In_ DOKAN_HANDLE DokanInstance,
+                                       _In_ LPCWSTR FileName) {
+  PDOKAN_INSTANCE instance = (PDOKAN_INSTANCE)DokanInstance;
+  PDOKAN_RECORDER recorder;
+  DOKAN_RECORDING_HEADER header;
+  LARGE_INTEGER value;
+  BOOL started = FALSE;
+
+  if (!instance || !FileName) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  recorder = malloc(sizeof(DOKAN_RECORDER));
+  if (!recorder) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  ZeroMemory(recorder, FIELD_OFFSET(DOKAN_RECORDER, Buffer));
+  recorder->File = CreateFileW(FileName, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (recorder->File == INVALID_HANDLE_VALUE) {
+    DokanDbgPrintW(L"Dokan Error: Cannot create the event recording %s: %d\n",
+                   FileName, GetLastError());
+    free(recorder);
+    return FALSE;
+  }
+  InitializeCriticalSection(&recorder->Lock);
+  ZeroMemory(&header, sizeof(header));
+  header.Magic = DOKAN_RECORDING_MAGIC;
+  header.Version = DOKAN_RECORDING_VERSION;
+  header.DokanVersion = DOKAN_VERSION;
+  QueryPerformanceFrequency(&value);
+  header.Frequency = value.QuadPart;
+  QueryPerformanceCounter(&value);
+  header.StartTime = value.QuadPart;
+  recorder->StartTime = header.StartTime;
+  WriteRecorderFile(recorder, &header, sizeof(header));
+
+  AcquireSRWLockExclusive(&instance->RecorderLock);
+  if (!instance->Recorder && !recorder->Failed) {
+    instance->Recorder = recorder;
+    started = TRUE;
+  }
+  ReleaseSRWLockExclusive(&instance->RecorderLock);
+  if (!started) {
+    CloseHandle(recorder->File);
+    DeleteCriticalSection(&recorder->Lock);
+    free(recorder);
+    SetLastError(ERROR_INVALID_FUNCTION);
+  }
+  return started;
+}
+
+BOOL DOKANAPI DokanStopEventRecording(_In_ DOKAN_HANDLE DokanInstance) {
+  if (!DokanInstance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  return StopEventRecording((PDOKAN_INSTANCE)DokanInstance);
+}
+
+/////////////////// Replay ///////////////////
+
+// Reads the records of a recording through a buffer that grows to hold the
+// largest of them.
+typedef struct _DOKAN_RECORDING_READER {
+  HANDLE File;
+  PUCHAR Buffer;
+  ULONG Size;
+  ULONG Start;
+  ULONG End;
+} DOKAN_RECORDING_READER, *PDOKAN_RECORDING_READER;
+
+// Makes the next Length bytes available at Buffer + Start. Returns FALSE at the
+// end of the file or on error.
+static BOOL FillRecordingReader(PDOKAN_RECORDING_READER Reader, ULONG Length) {
+  if (Reader->End - Reader->Start >= Length) {
+    return TRUE;
+  }
+  memmove(Reader->Buffer, Reader->Buffer + Reader->Start,
+          Reader->End - Reader->Start);
+  Reader->End -= Reader->Start;
+  Reader->Start = 0;
+  if (Length > Reader->Size) {
+    PUCHAR buffer = realloc(Reader->Buffer, Length);
+    if (!buffer) {
+      SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+      return FALSE;
+    }
+    Reader->Buffer = buffer;
+    Reader->Size = Length;
+  }
+  while (Reader->End < Length) {
+    DWORD read = 0;
+    if (!ReadFile(Reader->File, Reader->Buffer + Reader->End,
+                  Reader->Size - Reader->End, &read, NULL)) {
+      return FALSE;
+    }
+    if (read == 0) {
+      SetLastError(ERROR_HANDLE_EOF);
+      return FALSE;
+    }
+    Reader->End += read;
+  }
+  return TRUE;
+}
+
+// Returns the next record, or NULL at the end of the recording or if it is
+// truncated, in which case Truncated is set.
+static PDOKAN_RECORD ReadRecord(PDOKAN_RECORDING_READER Reader,
+                                PBOOL Truncated) {
+  PDOKAN_RECORD record;
+  *Truncated = FALSE;
+  if (!FillRecordingReader(Reader, sizeof(DOKAN_RECORD))) {
+    *Truncated = Reader->End != Reader->Start;
+    return NULL;
+  }
+  record = (PDOKAN_RECORD)(Reader->Buffer + Reader->Start);
+  if (record->Length < sizeof(DOKAN_RECORD) ||
+      !FillRecordingReader(Reader, record->Length)) {
+    *Truncated = TRUE;
+    return NULL;
+  }
+  record = (PDOKAN_RECORD)(Reader->Buffer + Reader->Start);
+  Reader->Start += record->Length;
+  return record;
+}
+
+// Map from the handle contexts or serial numbers of the recording to what the
+// replay got for them, with open addressing.
+typedef struct _DOKAN_REPLAY_MAP_ENTRY {
+  ULONG64 Key;
+  ULONG64 Value;
+  NTSTATUS Status;
+  UCHAR MajorFunction;
+  BOOLEAN Used;
+} DOKAN_REPLAY_MAP_ENTRY, *PDOKAN_REPLAY_MAP_ENTRY;
+
+typedef struct _DOKAN_REPLAY_MAP {
+  PDOKAN_REPLAY_MAP_ENTRY Entries;
+  // Power of two
+  ULONG Capacity;
+  ULONG Count;
+} DOKAN_REPLAY_MAP, *PDOKAN_REPLAY_MAP;
+
+static ULONG GetReplayMapSlot(PDOKAN_REPLAY_MAP Map, ULONG64 Key) {
+  return (ULONG)((Key * 0x9E3779B97F4A7C15ULL) >> 32) & (Map->Capacity - 1);
+}
+
+static PDOKAN_REPLAY_MAP_ENTRY FindReplayMapEntry(PDOKAN_REPLAY_MAP Map,
+                                                  ULONG64 Key) {
+  ULONG slot;
+  if (!Map->Capacity) {
+    return NULL;
+  }
+  for (slot = GetReplayMapSlot(Map, Key); Map->Entries[slot].Used;
+       slot = (slot + 1) & (Map->Capacity - 1)) {
+    if (Map->Entries[slot].Key == Key) {
+      return &Map->Entries[slot];
+    }
+  }
+  return NULL;
+}
+
+static PDOKAN_REPLAY_MAP_ENTRY InsertReplayMapEntry(PDOKAN_REPLAY_MAP Map,
+                                                    ULONG64 Key) {
+  PDOKAN_REPLAY_MAP_ENTRY entry = FindReplayMapEntry(Map, Key);
+  ULONG slot;
+  if (entry) {
+    return entry;
+  }
+  if ((Map->Count + 1) * 2 > Map->Capacity) {
+    DOKAN_REPLAY_MAP grown;
+    grown.Capacity = Map->Capacity ? Map->Capacity * 2 : 1024;
+    grown.Count = 0;
+    grown.Entries = calloc(grown.Capacity, sizeof(DOKAN_REPLAY_MAP_ENTRY));
+    if (!grown.Entries) {
+      return NULL;
+    }
+    for (ULONG i = 0; i < Map->Capacity; ++i) {
+      if (Map->Entries[i].Used) {
+        *InsertReplayMapEntry(&grown, Map->Entries[i].Key) = Map->Entries[i];
+      }
+    }
+    free(Map->Entries);
+    *Map = grown;
+  }
+  for (slot = GetReplayMapSlot(Map, Key); Map->Entries[slot].Used;
+       slot = (slot + 1) & (Map->Capacity - 1)) {
+  }
+  entry = &Map->Entries[slot];
+  ZeroMemory(entry, sizeof(DOKAN_REPLAY_MAP_ENTRY));
+  entry->Key = Key;
+  entry->Used = TRUE;
+  ++Map->Count;
+  return entry;
+}
+
+static VOID RemoveReplayMapEntry(PDOKAN_REPLAY_MAP Map,
+                                 PDOKAN_REPLAY_MAP_ENTRY Entry) {
+  ULONG mask = Map->Capacity - 1;
+  ULONG hole = (ULONG)(Entry - Map->Entries);
+  ULONG slot = hole;
+  Map->Entries[hole].Used = FALSE;
+  --Map->Count;
+  // Moves back the entries that probed past the hole.
+  while (TRUE) {
+    ULONG home;
+    slot = (slot + 1) & mask;
+    if (!Map->Entries[slot].Used) {
+      return;
+    }
+    home = GetReplayMapSlot(Map, Map->Entries[slot].Key);
+    if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+      Map->Entries[hole] = Map->Entries[slot];
+      Map->Entries[slot].Used = FALSE;
+      hole = slot;
+    }
+  }
+}
+
+static ULONG64 ReplayTicksToUs(LONG64 Ticks, LONG64 Frequency) {
+  ULONG64 ticks = (ULONG64)max(Ticks, 0);
+  ULONG64 frequency = (ULONG64)Frequency;
+  return ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency;
+}
+
+typedef struct _DOKAN_REPLAY {
+  PDOKAN_INSTANCE DokanInstance;
+  // Recorded handle contexts to the ones of the replay
+  DOKAN_REPLAY_MAP Contexts;
+  // Serial numbers of the replayed requests waiting for their recorded result
+  DOKAN_REPLAY_MAP Results;
+  PDOKAN_REPLAY_RESULT Result;
+} DOKAN_REPLAY, *PDOKAN_REPLAY;
+
+// Dispatches the recorded EventContext of DataLength bytes. Returns FALSE if
+// it could not be allocated.
+static BOOL ReplayEvent(PDOKAN_REPLAY Replay, PEVENT_CONTEXT EventContext,
+                        ULONG DataLength) {
+  PDOKAN_IO_BATCH ioBatch;
+  PDOKAN_IO_EVENT ioEvent;
+  PEVENT_CONTEXT eventContext;
+  PDOKAN_REPLAY_MAP_ENTRY entry;
+  ULONG length = DataLength;
+  ULONG64 context = 0;
+  BOOL success = TRUE;
+
+  if (DataLength < FIELD_OFFSET(EVENT_CONTEXT, Operation)) {
+    return TRUE;
+  }
+  if (EventContext->MajorFunction == DOKAN_IRP_CLOSE_BATCH) {
+    // The contexts of the batch are not mapped to those of the replay.
+    ++Replay->Result->Skipped;
+    return TRUE;
+  }
+  if (EventContext->Context) {
+    entry = FindReplayMapEntry(&Replay->Contexts, EventContext->Context);
+    if (!entry) {
+      // The file was opened before the recording started.
+      ++Replay->Result->Skipped;
+      return TRUE;
+    }
+    context = entry->Value;
+  }
+  if (EventContext->MajorFunction == IRP_MJ_WRITE) {
+    // Zeros of the recorded length follow the file name.
+    length = DOKAN_RECORD_ALIGN(DataLength) +
+             EventContext->Operation.Write.BufferLength;
+  }
+  ioBatch = AllocateIoBatchBuffer(length);
+  ioEvent = PopIoEventBuffer();
+  if (!ioBatch || !ioEvent) {
+    if (ioBatch) {
+      PushIoBatchBuffer(ioBatch);
+    }
+    if (ioEvent) {
+      PushIoEventBuffer(ioEvent);
+    }
+    return FALSE;
+  }
+  eventContext = ioBatch->EventContext;
+  RtlCopyMemory(eventContext, EventContext, DataLength);
+  eventContext->Length = length;
+  eventContext->Context = context;
+  switch (eventContext->MajorFunction) {
+  case IRP_MJ_READ:
+    eventContext->Operation.Read.MappedBuffer = 0;
+    break;
+  case IRP_MJ_WRITE:
+    eventContext->Operation.Write.MappedBuffer = 0;
+    eventContext->Operation.Write.RequestLength = 0;
+    eventContext->Operation.Write.BufferOffset = DOKAN_RECORD_ALIGN(DataLength);
+    RtlZeroMemory((PCHAR)eventContext + DataLength, length - DataLength);
+    break;
+  }
+  ioBatch->DokanInstance = Replay->DokanInstance;
+  ioEvent->DokanInstance = Replay->DokanInstance;
+  ioEvent->EventContext = eventContext;
+  ioEvent->IoBatch = ioBatch;
+  ++Replay->Result->Events;
+  if (DispatchEvent(ioEvent)) {
+    // Not expected without DOKAN_OPTION_ASYNC_OPERATIONS. The event belongs to
+    // its completion now.
+    return TRUE;
+  }
+  if (EventContext->MajorFunction == IRP_MJ_CLOSE && EventContext->Context) {
+    entry = FindReplayMapEntry(&Replay->Contexts, EventContext->Context);
+    if (entry) {
+      RemoveReplayMapEntry(&Replay->Contexts, entry);
+    }
+  }
+  if (ioEvent->EventResult) {
+    entry =
+        InsertReplayMapEntry(&Replay->Results, EventContext->SerialNumber);
+    if (entry) {
+      entry->Value = ioEvent->EventResult->Context;
+      entry->Status = ioEvent->EventResult->Status;
+      entry->MajorFunction = EventContext->MajorFunction;
+    } else {
+      success = FALSE;
+    }
+    FreeIoEventResult(ioEvent->EventResult, ioEvent->EventResultSize,
+                      ioEvent->PoolAllocated);
+  }
+  PushIoBatchBuffer(ioBatch);
+  PushIoEventBuffer(ioEvent);
+  return success;
+}
+
+// Compares the recorded result of a request with the one of the replay, and
+// maps the handle contexts of the creates.
+static BOOL ReplayEventResult(PDOKAN_REPLAY Replay, ULONG SerialNumber,
+                              PDOKAN_RECORD_RESULT RecordResult) {
+  PDOKAN_REPLAY_MAP_ENTRY entry =
+      FindReplayMapEntry(&Replay->Results, SerialNumber);
+  NTSTATUS status;
+  UCHAR majorFunction;
+  ULONG64 context;
+  if (!entry) {
+    return TRUE;
+  }
+  status = entry->Status;
+  majorFunction = entry->MajorFunction;
+  context = entry->Value;
+  RemoveReplayMapEntry(&Replay->Results, entry);
+  if (status != RecordResult->Status) {
+    ++Replay->Result->StatusMismatches;
+  }
+  if (majorFunction == IRP_MJ_CREATE && RecordResult->Context && context) {
+    entry = InsertReplayMapEntry(&Replay->Contexts, RecordResult->Context);
+    if (!entry) {
+      return FALSE;
+    }
+    entry->Value = context;
+  }
+  return TRUE;
+}
+
+BOOL DOKANAPI DokanReplayEventRecording(_In_ LPCWSTR FileName,
+                                        _In_ PDOKAN_OPTIONS DokanOptions,
+                                        _In_ PDOKAN_OPERATIONS DokanOperations,
+                                        _In_ ULONG Flags,
+                                        _Out_opt_ PDOKAN_REPLAY_RESULT Result) {
+  DOKAN_RECORDING_READER reader;
+  DOKAN_RECORDING_HEADER header;
+  DOKAN_REPLAY replay;
+  DOKAN_REPLAY_RESULT result;
+  DOKAN_OPTIONS options;
+  PDOKAN_RECORD record;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER start;
+  LARGE_INTEGER now;
+  LONG64 firstTime = -1;
+  LONG64 lastTime = 0;
+  BOOL truncated = FALSE;
+  BOOL success = TRUE;
+  DWORD error = ERROR_SUCCESS;
+
+  if (!FileName || !DokanOptions || !DokanOperations) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  ZeroMemory(&result, sizeof(result));
+  ZeroMemory(&reader, sizeof(reader));
+  reader.File = CreateFileW(FileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (reader.File == INVALID_HANDLE_VALUE) {
+    return FALSE;
+  }
+  reader.Size = DOKAN_RECORDER_BUFFER_SIZE;
+  reader.Buffer = malloc(reader.Size);
+  if (!reader.Buffer || !FillRecordingReader(&reader, sizeof(header))) {
+    error = reader.Buffer ? ERROR_BAD_FORMAT : ERROR_NOT_ENOUGH_MEMORY;
+    free(reader.Buffer);
+    CloseHandle(reader.File);
+    SetLastError(error);
+    return FALSE;
+  }
+  RtlCopyMemory(&header, reader.Buffer, sizeof(header));
+  reader.Start = sizeof(header);
+  if (header.Magic != DOKAN_RECORDING_MAGIC ||
+      header.Version != DOKAN_RECORDING_VERSION || header.Frequency <= 0) {
+    free(reader.Buffer);
+    CloseHandle(reader.File);
+    SetLastError(ERROR_BAD_FORMAT);
+    return FALSE;
+  }
+
+  options = *DokanOptions;
+  options.Options &= ~(DOKAN_OPTION_ASYNC_OPERATIONS | DOKAN_OPTION_EVENT_RING |
+                       DOKAN_OPTION_ZERO_COPY_READ |
+                       DOKAN_OPTION_ZERO_COPY_WRITE | DOKAN_OPTION_BATCH_CLOSE);
+  options.FlushGroupWindowMs = 0;
+  ZeroMemory(&replay, sizeof(replay));
+  replay.Result = &result;
+  replay.DokanInstance = NewDokanInstance();
+  if (!replay.DokanInstance) {
+    free(reader.Buffer);
+    CloseHandle(reader.File);
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+  replay.DokanInstance->DokanOptions = &options;
+  replay.DokanInstance->DokanOperations = DokanOperations;
+  if (options.MountPoint) {
+    wcscpy_s(replay.DokanInstance->MountPoint,
+             sizeof(replay.DokanInstance->MountPoint) / sizeof(WCHAR),
+             options.MountPoint);
+  }
+
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&start);
+  while (success && (record = ReadRecord(&reader, &truncated)) != NULL) {
+    PVOID data = record + 1;
+    ULONG dataLength = record->Length - sizeof(DOKAN_RECORD);
+    if (firstTime < 0) {
+      firstTime = record->Time;
+    }
+    lastTime = max(lastTime, record->Time);
+    if (record->Type == DokanRecordEvent) {
+      if (Flags & DOKAN_REPLAY_ORIGINAL_SPEED) {
+        LONG64 target =
+            start.QuadPart + (LONG64)((double)(record->Time - firstTime) *
+                                      frequency.QuadPart / header.Frequency);
+        QueryPerformanceCounter(&now);
+        if (target > now.QuadPart) {
+          DWORD waitMs =
+              (DWORD)((target - now.QuadPart) * 1000 / frequency.QuadPart);
+          if (waitMs) {
+            Sleep(waitMs);
+          }
+        }
+      }
+      success = ReplayEvent(&replay, (PEVENT_CONTEXT)data, dataLength);
+    } else if (record->Type == DokanRecordResult &&
+               dataLength >= sizeof(DOKAN_RECORD_RESULT)) {
+      success = ReplayEventResult(&replay, record->SerialNumber,
+                                  (PDOKAN_RECORD_RESULT)data);
+    }
+    if (!success) {
+      error = ERROR_NOT_ENOUGH_MEMORY;
+    }
+  }
+  if (success && truncated) {
+    success = FALSE;
+    error = ERROR_HANDLE_EOF;
+  }
+  QueryPerformanceCounter(&now);
+  result.ElapsedUs =
+      ReplayTicksToUs(now.QuadPart - start.QuadPart, frequency.QuadPart);
+  if (firstTime >= 0) {
+    result.RecordedUs = ReplayTicksToUs(lastTime - firstTime, header.Frequency);
+  }
+  if (Result) {
+    *Result = result;
+  }
+
+  DeleteDokanInstance(replay.DokanInstance);
+  free(replay.Contexts.Entries);
+  free(replay.Results.Entries);
+  free(reader.Buffer);
+  CloseHandle(reader.File);
+  if (!success) {
+    SetLastError(error);
+  }
+  return success;
+}
@@ -0,0 +1,82 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DOKAN_RECORDER_H_
+#define DOKAN_RECORDER_H_
+
+#include "dokani.h"
+
+// Recordings of DokanStartEventRecording are a DOKAN_RECORDING_HEADER followed
+// by records, each a DOKAN_RECORD and its data, aligned on 8 bytes:
+// - DokanRecordEvent: the EVENT_CONTEXT of a request, without the data of
+//   writes.
+// - DokanRecordResult: the DOKAN_RECORD_RESULT of a request that was not left
+//   pending.
+
+#define DOKAN_RECORDING_MAGIC 0x43455244 // "DREC"
+#define DOKAN_RECORDING_VERSION 1
+
+typedef struct _DOKAN_RECORDING_HEADER {
+  ULONG Magic;
+  ULONG Version;
+  // DOKAN_VERSION of the recording library
+  ULONG DokanVersion;
+  ULONG Reserved;
+  // Performance counter frequency and value when the recording started
+  LONG64 Frequency;
+  LONG64 StartTime;
+} DOKAN_RECORDING_HEADER, *PDOKAN_RECORDING_HEADER;
+
+typedef enum _DOKAN_RECORD_TYPE {
+  DokanRecordEvent = 1,
+  DokanRecordResult = 2,
+} DOKAN_RECORD_TYPE;
+
+typedef struct _DOKAN_RECORD {
+  // Size of the record, data included
+  ULONG Length;
+  USHORT Type;
+  USHORT Reserved;
+  ULONG SerialNumber;
+  // Thread that dispatched the request
+  ULONG ThreadId;
+  // Performance counter ticks since DOKAN_RECORDING_HEADER.StartTime
+  LONG64 Time;
+} DOKAN_RECORD, *PDOKAN_RECORD;
+
+typedef struct _DOKAN_RECORD_RESULT {
+  NTSTATUS Status;
+  ULONG BufferLength;
+  // Handle context given to the driver, which the next requests on the file
+  // carry in EVENT_CONTEXT.Context when the request is a create
+  ULONG64 Context;
+} DOKAN_RECORD_RESULT, *PDOKAN_RECORD_RESULT;
+
+// Records the request of EventContext, before it is dispatched.
+VOID RecordEvent(PDOKAN_INSTANCE DokanInstance, PEVENT_CONTEXT EventContext);
+// Records the answer of a request that was not left pending.
+VOID RecordEventResult(PDOKAN_INSTANCE DokanInstance, ULONG SerialNumber,
+                       PEVENT_INFORMATION EventResult);
+// Stops the recording of the instance, if any. Returns FALSE if the recording
+// could not be written completely.
+BOOL StopEventRecording(PDOKAN_INSTANCE DokanInstance);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan_ring.h"
+#include "dokan_pool.h"
+
+#include <assert.h>
+
+BOOL RegisterEventRing(PDOKAN_INSTANCE DokanInstance) {
+  EVENT_RING_REGISTER ringRegister;
+  PEVENT_RING_HEADER header;
+  ULONG slotCount = EVENT_RING_DEFAULT_SLOT_COUNT;
+  DWORD bytesReturned = 0;
+
+  // VirtualAlloc memory is page aligned as required by the driver.
+  header = (PEVENT_RING_HEADER)VirtualAlloc(
+      NULL, EVENT_RING_SIZE(slotCount), MEM_COMMIT | MEM_RESERVE,
+      PAGE_READWRITE);
+  if (!header) {
+    DbgPrintW(L"Dokan Error: Event ring allocation failed with error %d\n",
+              GetLastError());
+    return FALSE;
+  }
+  for (ULONG i = 0; i < slotCount; ++i) {
+    EVENT_RING_SUBMISSION_SLOT(header, slotCount, i)->Sequence = (LONG)i;
+    EVENT_RING_COMPLETION_SLOT(header, slotCount, i)->Sequence = (LONG)i;
+  }
+  DokanInstance->EventRingSubmissionEvent =
+      CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!DokanInstance->EventRingSubmissionEvent) {
+    DbgPrintW(L"Dokan Error: Event ring event creation failed with error %d\n",
+              GetLastError());
+    VirtualFree(header, 0, MEM_RELEASE);
+    return FALSE;
+  }
+
+  ZeroMemory(&ringRegister, sizeof(EVENT_RING_REGISTER));
+  ringRegister.Address = (ULONG64)(ULONG_PTR)header;
+  ringRegister.SubmissionEvent =
+      (ULONG64)(ULONG_PTR)DokanInstance->EventRingSubmissionEvent;
+  ringRegister.SlotCount = slotCount;
+  if (!DeviceIoControl(DokanInstance->Device, FSCTL_EVENT_RING_REGISTER,
+                       &ringRegister, sizeof(EVENT_RING_REGISTER), NULL, 0,
+                       &bytesReturned, NULL)) {
+    // Older drivers do not know about the ring.
+    DbgPrintW(L"Dokan Warning: Event ring registration failed with error %d, "
+              L"falling back to event pulling only.\n",
+              GetLastError());
+    CloseHandle(DokanInstance->EventRingSubmissionEvent);
+    DokanInstance->EventRingSubmissionEvent = NULL;
+    VirtualFree(header, 0, MEM_RELEASE);
+    return FALSE;
+  }
+
+  DokanInstance->EventRing = header;
+  DokanInstance->EventRingSlotCount = slotCount;
+  DbgPrintW(L"Dokan: Event ring registered with %d slots\n", slotCount);
+  return TRUE;
+}
+
+VOID FreeEventRing(PDOKAN_INSTANCE DokanInstance) {
+  if (DokanInstance->EventRing) {
+    VirtualFree(DokanInstance->EventRing, 0, MEM_RELEASE);
+    DokanInstance->EventRing = NULL;
+  }
+  if (DokanInstance->EventRingSubmissionEvent) {
+    CloseHandle(DokanInstance->EventRingSubmissionEvent);
+    DokanInstance->EventRingSubmissionEvent = NULL;
+  }
+}
+
+PDOKAN_IO_BATCH PopEventRingSubmission(PDOKAN_INSTANCE DokanInstance) {
+  PEVENT_RING_HEADER header = DokanInstance->EventRing;
+  ULONG slotCount = DokanInstance->EventRingSlotCount;
+  PEVENT_RING_SLOT slot;
+  PDOKAN_IO_BATCH ioBatch;
+  LONG position;
+  LONG sequence;
+
+  for (;;) {
+    position = header->SubmissionHead;
+    slot = EVENT_RING_SUBMISSION_SLOT(header, slotCount, position);
+    sequence = slot->Sequence;
+    if (sequence == position + 1) {
+      if (InterlockedCompareExchange(&header->SubmissionHead, position + 1,
+                                     position) == position) {
+        break;
+      }
+    } else if (sequence - (position + 1) < 0) {
+      // Nothing posted yet at this position.
+      return NULL;
+    }
+    // Another thread took this position; try the next one.
+  }
+
+  ioBatch = PopIoBatchBuffer();
+  if (ioBatch) {
+    assert(slot->Length <= EVENT_RING_SLOT_DATA_SIZE);
+    RtlCopyMemory(ioBatch->EventContext, slot->Data, slot->Length);
+    ioBatch->NumberOfBytesTransferred = slot->Length;
+    ioBatch->EventContextBatchCount = 1;
+    ioBatch->DokanInstance = DokanInstance;
+  }
+  // Hand the slot back to the driver, even if we lost the event. Its IRP will
+  // then time out like an unanswered one.
+  InterlockedExchange(&slot->Sequence, position + (LONG)slotCount);
+  return ioBatch;
+}
+
+BOOL HasEventRingSubmission(PDOKAN_INSTANCE DokanInstance) {
+  PEVENT_RING_HEADER header = DokanInstance->EventRing;
+  LONG position = header->SubmissionHead;
+  return EVENT_RING_SUBMISSION_SLOT(header, DokanInstance->EventRingSlotCount,
+                                    position)
+             ->Sequence == position + 1;
+}
+
+BOOL PostEventRingCompletion(PDOKAN_INSTANCE DokanInstance,
+                             PEVENT_INFORMATION EventInfo,
+                             DWORD EventInfoSize) {
+  PEVENT_RING_HEADER header = DokanInstance->EventRing;
+  ULONG slotCount = DokanInstance->EventRingSlotCount;
+  PEVENT_RING_SLOT slot;
+  LONG position;
+  LONG sequence;
+  DWORD bytesReturned = 0;
+
+  if (!header || EventInfoSize > EVENT_RING_SLOT_DATA_SIZE) {
+    return FALSE;
+  }
+  for (;;) {
+    position = header->CompletionTail;
+    slot = EVENT_RING_COMPLETION_SLOT(header, slotCount, position);
+    sequence = slot->Sequence;
+    if (sequence == position) {
+      if (InterlockedCompareExchange(&header->CompletionTail, position + 1,
+                                     position) == position) {
+        break;
+      }
+    } else if (sequence - position < 0) {
+      // The driver has not drained this slot yet: the ring is full.
+      return FALSE;
+    }
+  }
+
+  RtlCopyMemory(slot->Data, EventInfo, EventInfoSize);
+  slot->Length = EventInfoSize;
+  InterlockedExchange(&slot->Sequence, position + 1);
+
+  // Only the thread that raises the doorbell needs to wake up the driver; the
+  // others are picked up by the drain it triggers.
+  if (InterlockedCompareExchange(&header->CompletionDoorbell, 1, 0) == 0) {
+    if (!DeviceIoControl(DokanInstance->Device, FSCTL_EVENT_RING_DOORBELL,
+                         NULL, 0, NULL, 0, &bytesReturned, NULL)) {
+      if (!DokanInstance->FileSystemStopped) {
+        DokanDbgPrintW(L"Dokan Error: Event ring doorbell failed with code "
+                       L"%d.\n",
+                       GetLastError());
+      }
+    }
+  }
+  return TRUE;
+}
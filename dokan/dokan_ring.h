@@ -0,0 +1,44 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_RING_H_
+#define DOKAN_RING_H_
+
+#include "dokani.h"
+
+// Shares an event ring with the driver. Returns FALSE if the driver refused it,
+// in which case the instance keeps using FSCTL_EVENT_PROCESS_N_PULL only.
+BOOL RegisterEventRing(PDOKAN_INSTANCE DokanInstance);
+// Frees the ring memory. Must only be called once the device handle is closed.
+VOID FreeEventRing(PDOKAN_INSTANCE DokanInstance);
+
+// Takes the next event posted by the driver and returns it in a batch buffer
+// holding this single event, or NULL if the submission ring is empty.
+PDOKAN_IO_BATCH PopEventRingSubmission(PDOKAN_INSTANCE DokanInstance);
+// Whether the driver has posted an event that was not taken yet.
+BOOL HasEventRingSubmission(PDOKAN_INSTANCE DokanInstance);
+// Posts an event result to the completion ring. Returns FALSE if it does not
+// fit in a slot or the ring is full, in which case the caller has to send it
+// through FSCTL_EVENT_PROCESS_N_PULL.
+BOOL PostEventRingCompletion(PDOKAN_INSTANCE DokanInstance,
+                             PEVENT_INFORMATION EventInfo,
+                             DWORD EventInfoSize);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOKAN_TRACE_H_
+#define DOKAN_TRACE_H_
+
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+// Manifest-free TraceLogging provider "Dokan.Library" of dokan.dll, registered
+// by DokanInit. Its events are close to free when no session listens to it.
+TRACELOGGING_DECLARE_PROVIDER(g_DokanTraceProvider);
+
+// Keyword of the events following the dispatch of the driver events.
+#define DOKAN_TRACE_KEYWORD_DISPATCH 0x1
+
+// Start of the dispatch of the event SerialNumber to the file system
+// callbacks.
+#define DOKAN_TRACE_DISPATCH_START(EventContext)                               \
+  TraceLoggingWrite(                                                           \
+      g_DokanTraceProvider, "DispatchStart",                                   \
+      TraceLoggingOpcode(WINEVENT_OPCODE_START),                               \
+      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                               \
+      TraceLoggingKeyword(DOKAN_TRACE_KEYWORD_DISPATCH),                       \
+      TraceLoggingUInt32((EventContext)->SerialNumber, "SerialNumber"),        \
+      TraceLoggingUInt8((EventContext)->MajorFunction, "MajorFunction"),       \
+      TraceLoggingUInt32((EventContext)->ProcessId, "ProcessId"))
+
+// End of the dispatch, with the status and buffer length of the result, if
+// the event has one.
+#define DOKAN_TRACE_DISPATCH_STOP(SerialNumber, MajorFunction, EventResult)    \
+  TraceLoggingWrite(                                                           \
+      g_DokanTraceProvider, "DispatchStop",                                    \
+      TraceLoggingOpcode(WINEVENT_OPCODE_STOP),                                \
+      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                               \
+      TraceLoggingKeyword(DOKAN_TRACE_KEYWORD_DISPATCH),                       \
+      TraceLoggingUInt32((SerialNumber), "SerialNumber"),                      \
+      TraceLoggingUInt8((MajorFunction), "MajorFunction"),                     \
+      TraceLoggingNTStatus((EventResult) ? (EventResult)->Status : 0,          \
+                           "Status"),                                          \
+      TraceLoggingUInt32((EventResult) ? (EventResult)->BufferLength : 0,      \
+                         "Bytes"))
+
+#endif
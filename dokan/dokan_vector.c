@@ -29,6 +29,11 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 // Increases the internal capacity of the vector.
 BOOL DokanVector_Grow(PDOKAN_VECTOR Vector, size_t MinimumIncrease);
 
+// Start of the allocation of the vector.
+static PVOID GetBuffer(PDOKAN_VECTOR Vector) {
+  return ((BYTE *)Vector->Items) - Vector->FrontItems * Vector->ItemSize;
+}
+
 // Creates a new instance of DOKAN_VECTOR with default values.
 PDOKAN_VECTOR DokanVector_Alloc(size_t ItemSize) {
   assert(ItemSize > 0);
@@ -50,6 +55,7 @@ PDOKAN_VECTOR DokanVector_Alloc(size_t ItemSize) {
   vector->ItemCount = 0;
   vector->ItemSize = ItemSize;
   vector->MaxItems = DEFAULT_ITEM_COUNT;
+  vector->FrontItems = 0;
   vector->IsStackAllocated = FALSE;
   return vector;
 }
@@ -79,26 +85,57 @@ PDOKAN_VECTOR DokanVector_AllocWithCapacity(size_t ItemSize, size_t MaxItems) {
   vector->ItemCount = 0;
   vector->ItemSize = ItemSize;
   vector->MaxItems = MaxItems;
+  vector->FrontItems = 0;
   vector->IsStackAllocated = FALSE;
   return vector;
 }
 
+// Initializes a DOKAN_VECTOR whose storage is owned by the caller.
+BOOL DokanVector_Init(PDOKAN_VECTOR Vector, size_t ItemSize) {
+  assert(Vector && ItemSize > 0);
+  if (ItemSize == 0) {
+    DbgPrintW(L"Cannot initialize a DOKAN_VECTOR with an ItemSize of 0.\n");
+    return FALSE;
+  }
+  Vector->Items = malloc(ItemSize * DEFAULT_ITEM_COUNT);
+  if (!Vector->Items) {
+    DbgPrintW(L"DOKAN_VECTOR Items allocation failed.\n");
+    return FALSE;
+  }
+  Vector->ItemCount = 0;
+  Vector->ItemSize = ItemSize;
+  Vector->MaxItems = DEFAULT_ITEM_COUNT;
+  Vector->FrontItems = 0;
+  Vector->IsStackAllocated = TRUE;
+  return TRUE;
+}
+
 // Releases the memory associated with a DOKAN_VECTOR;
 VOID DokanVector_Free(PDOKAN_VECTOR Vector) {
   if (!Vector) {
     return;
   }
   if (Vector->Items) {
-    free(Vector->Items);
+    free(GetBuffer(Vector));
   }
   if (!Vector->IsStackAllocated) {
     free(Vector);
   }
 }
 
-// Appends an item to the vector at the Front. Expensive, please use PushBack instead.
+// Appends an item to the vector at the Front. Moves the whole vector unless
+// room was kept with DokanVector_ReserveFront, please use PushBack otherwise.
 BOOL DokanVector_PushFront(PDOKAN_VECTOR Vector, PVOID Item) {
   assert(Vector && Item);
+  if (Vector->FrontItems > 0) {
+    Vector->Items = ((BYTE *)Vector->Items) - Vector->ItemSize;
+    --Vector->FrontItems;
+    ++Vector->MaxItems;
+    memcpy_s((BYTE *)Vector->Items, Vector->MaxItems * Vector->ItemSize, Item,
+             Vector->ItemSize);
+    ++Vector->ItemCount;
+    return TRUE;
+  }
   if (Vector->ItemCount + 1 >= Vector->MaxItems) {
     if (!DokanVector_Grow(Vector, 1)) {
       return FALSE;
@@ -116,6 +153,38 @@ BOOL DokanVector_PushFront(PDOKAN_VECTOR Vector, PVOID Item) {
   return TRUE;
 }
 
+// Keeps room for Count items before the first one.
+BOOL DokanVector_ReserveFront(PDOKAN_VECTOR Vector, size_t Count) {
+  assert(Vector);
+  if (Vector->FrontItems >= Count) {
+    return TRUE;
+  }
+  Count -= Vector->FrontItems;
+  if (Vector->ItemCount + Count >= Vector->MaxItems) {
+    if (!DokanVector_Grow(Vector, Count)) {
+      return FALSE;
+    }
+  }
+  if (Vector->ItemCount > 0) {
+    memmove_s(((BYTE *)Vector->Items) + Count * Vector->ItemSize,
+              (Vector->MaxItems - Count) * Vector->ItemSize, Vector->Items,
+              Vector->ItemCount * Vector->ItemSize);
+  }
+  Vector->Items = ((BYTE *)Vector->Items) + Count * Vector->ItemSize;
+  Vector->MaxItems -= Count;
+  Vector->FrontItems += Count;
+  return TRUE;
+}
+
+// Makes room for Count items in total.
+BOOL DokanVector_Reserve(PDOKAN_VECTOR Vector, size_t Count) {
+  assert(Vector);
+  if (Count < Vector->MaxItems) {
+    return TRUE;
+  }
+  return DokanVector_Grow(Vector, Count - Vector->MaxItems + 1);
+}
+
 // Appends an item to the vector.
 BOOL DokanVector_PushBack(PDOKAN_VECTOR Vector, PVOID Item) {
   assert(Vector && Item);
@@ -168,10 +237,15 @@ VOID DokanVector_PopBackArray(PDOKAN_VECTOR Vector, size_t Count) {
   }
 }
 
-// Clears all items in the vector.
+// Clears all items in the vector, dropping the room kept at the front.
 VOID DokanVector_Clear(PDOKAN_VECTOR Vector) {
   assert(Vector);
   Vector->ItemCount = 0;
+  if (Vector->Items) {
+    Vector->Items = GetBuffer(Vector);
+  }
+  Vector->MaxItems += Vector->FrontItems;
+  Vector->FrontItems = 0;
 }
 
 // Retrieves the item at the specified index
@@ -210,9 +284,12 @@ BOOL DokanVector_Grow(PDOKAN_VECTOR Vector, size_t MinimumIncrease) {
   if (newSize <= Vector->MaxItems + MinimumIncrease) {
     newSize = Vector->MaxItems + MinimumIncrease + MinimumIncrease;
   }
-  PVOID newItems = realloc(Vector->Items, newSize * Vector->ItemSize);
-  if (newItems) {
-    Vector->Items = newItems;
+  PVOID newBuffer =
+      realloc(Vector->Items ? GetBuffer(Vector) : NULL,
+              (Vector->FrontItems + newSize) * Vector->ItemSize);
+  if (newBuffer) {
+    Vector->Items =
+        ((BYTE *)newBuffer) + Vector->FrontItems * Vector->ItemSize;
     Vector->MaxItems = newSize;
     return TRUE;
   }
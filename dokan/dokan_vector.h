@@ -23,10 +23,14 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define DOKAN_VECTOR_H_
 
 typedef struct _DOKAN_VECTOR {
+  // First item. The allocation starts FrontItems items before it.
   PVOID Items;
   size_t ItemCount;
   size_t ItemSize;
+  // Capacity from Items on.
   size_t MaxItems;
+  // Free items kept before Items, for PushFront not to move the vector.
+  size_t FrontItems;
   BOOL IsStackAllocated;
 } DOKAN_VECTOR, *PDOKAN_VECTOR;
 
@@ -36,12 +40,25 @@ DOKAN_VECTOR *DokanVector_Alloc(size_t ItemSize);
 // Creates a new instance of DOKAN_VECTOR with default values.
 DOKAN_VECTOR *DokanVector_AllocWithCapacity(size_t ItemSize, size_t MaxItems);
 
+// Initializes a DOKAN_VECTOR whose storage is owned by the caller, like one
+// embedded in another structure. DokanVector_Free only releases its items.
+BOOL DokanVector_Init(PDOKAN_VECTOR Vector, size_t ItemSize);
+
 // Releases the memory associated with a DOKAN_VECTOR;
 VOID DokanVector_Free(PDOKAN_VECTOR Vector);
 
-// Appends an item to the vector at the Front. Expensive, please use PushBack instead.
+// Appends an item to the vector at the Front. Moves the whole vector unless
+// room was kept with DokanVector_ReserveFront, please use PushBack otherwise.
 BOOL DokanVector_PushFront(PDOKAN_VECTOR Vector, PVOID Item);
 
+// Keeps room for Count items before the first one, for as many PushFront. Only
+// cheap while the vector is empty.
+BOOL DokanVector_ReserveFront(PDOKAN_VECTOR Vector, size_t Count);
+
+// Makes room for Count items in total, so that pushing that many does not
+// reallocate the vector again.
+BOOL DokanVector_Reserve(PDOKAN_VECTOR Vector, size_t Count);
+
 // Appends an item to the vector.
 BOOL DokanVector_PushBack(PDOKAN_VECTOR Vector, PVOID Item);
 
@@ -54,7 +71,7 @@ VOID DokanVector_PopBack(PDOKAN_VECTOR Vector);
 // Removes multiple items from the end of the vector.
 VOID DokanVector_PopBackArray(PDOKAN_VECTOR Vector, size_t Count);
 
-// Clears all items in the vector.
+// Clears all items in the vector, dropping the room kept at the front.
 VOID DokanVector_Clear(PDOKAN_VECTOR Vector);
 
 // Retrieves the item at the specified index
@@ -37,12 +37,44 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
+/** Number of hash buckets of the directory listing cache of an instance */
+#define DIR_LIST_CACHE_BUCKET_COUNT 64
+
+/** Most NUMA nodes getting their own thread pool and object pools */
+#define DOKAN_MAX_NUMA_NODES 16
+
+/**
+ * First DOKAN_OPTIONS.Version whose header has the DOKAN_OPTIONS fields from IpcBatchMinSize and the
+ * DOKAN_OPERATIONS callbacks from FindFilesWithCursor. Older mounts pass structures ending before.
+ */
+#define DOKAN_OPTIONS_EXTENDED_VERSION 230
+
 typedef struct _DOKAN_INSTANCE_THREADINFO {
   PTP_POOL ThreadPool;
   PTP_CLEANUP_GROUP CleanupGroup;
   TP_CALLBACK_ENVIRON CallbackEnvironment;
+  /**
+   * Number of NUMA nodes whose thread pools process the events of the
+   * instance, 0 on systems with a single node where only CallbackEnvironment
+   * is used. CallbackEnvironment is then the one of the first of them.
+   */
+  ULONG NodeCount;
+  /** Node of each of NodeCallbackEnvironments */
+  ULONG Nodes[DOKAN_MAX_NUMA_NODES];
+  TP_CALLBACK_ENVIRON NodeCallbackEnvironments[DOKAN_MAX_NUMA_NODES];
 } DOKAN_INSTANCE_THREADINFO;
 
+/**
+ * \struct DOKAN_PULL_PORT
+ * \brief Completion port of overlapped pulls and the threads waiting on it
+ */
+typedef struct _DOKAN_PULL_PORT {
+  HANDLE Port;
+  /** Work whose callbacks are the threads, submitted once for each */
+  PTP_WORK Work;
+  ULONG ThreadCount;
+} DOKAN_PULL_PORT, *PDOKAN_PULL_PORT;
+
 /**
  * \struct DOKAN_INSTANCE
  * \brief Dokan mount instance informations
@@ -72,6 +104,12 @@ typedef struct _DOKAN_INSTANCE {
   PDOKAN_OPTIONS DokanOptions;
   /** DOKAN_OPERATIONS linked to the mount */
   PDOKAN_OPERATIONS DokanOperations;
+  /**
+   * Copies of the DOKAN_OPTIONS and DOKAN_OPERATIONS of a mount built against a header older than
+   * DOKAN_OPTIONS_EXTENDED_VERSION, used instead of them. The fields appended since are 0.
+   */
+  DOKAN_OPTIONS CompatOptions;
+  DOKAN_OPERATIONS CompatOperations;
   /** Current list entry informations */
   LIST_ENTRY ListEntry;
   /** Global Dokan Kernel device handle */
@@ -86,6 +124,11 @@ typedef struct _DOKAN_INSTANCE {
   HANDLE NotifyHandle;
   /** Handle of the Keepalive file opened at mount */
   HANDLE KeepaliveHandle;
+  /**
+   * Work creating the mount point with DOKAN_OPTION_ASYNC_MOUNT_POINT, NULL
+   * otherwise
+   */
+  PTP_WORK MountPointWork;
   /** Whether the filesystem was intentionally stopped */
   BOOL FileSystemStopped;
   /**
@@ -93,6 +136,97 @@ typedef struct _DOKAN_INSTANCE {
    * Only the first incrementer thread will call it.
    */
   LONG UnmountedCalled;
+  /**
+   * Event ring shared with the driver when DOKAN_OPTION_EVENT_RING is set and
+   * the driver accepted it, NULL otherwise.
+   */
+  PEVENT_RING_HEADER EventRing;
+  /** Slot count of each ring of EventRing */
+  ULONG EventRingSlotCount;
+  /** Auto-reset event signaled by the driver when it posts to EventRing */
+  HANDLE EventRingSubmissionEvent;
+  /**
+   * Size of the buffers pulling batches of events with
+   * DOKAN_OPTION_ALLOW_IPC_BATCHING. It adapts between IpcBatchMinSize and
+   * IpcBatchMaxSize to how full the previous pulls came back.
+   */
+  LONG IpcBatchSize;
+  ULONG IpcBatchMinSize;
+  ULONG IpcBatchMaxSize;
+  /** Moving average of the time in nanoseconds taken to process an event */
+  LONG IpcBatchEventLatencyNs;
+  /**
+   * Main pull threads running, and the number they are scaled to between
+   * MinPullThreads and MaxPullThreads, see dokan_autoscale.c.
+   */
+  LONG PullThreadCount;
+  LONG PullThreadTarget;
+  ULONG MinPullThreads;
+  ULONG MaxPullThreads;
+  /** Main pull threads started since the mount, used to pick their node */
+  LONG PullThreadsStarted;
+  LONG64 PullThreadsAdded;
+  LONG64 PullThreadsRetired;
+  /** Performance counter ticks spent in DispatchEvent by all the threads */
+  LONG64 CallbackBusyTicks;
+  /** Timer of the controller, NULL when the thread count is fixed */
+  PTP_TIMER AutoscaleTimer;
+  /** Buffer of the controller queries, and what they last found */
+  PVOLUME_METRICS_EX AutoscaleMetrics;
+  LONG64 AutoscaleLastBusyTicks;
+  LONG64 AutoscaleLastTime;
+  ULONG AutoscaleIdleIntervals;
+  LONG64 AutoscaleQueuedEvents;
+  LONG AutoscaleBusyPercent;
+  /**
+   * With DOKAN_OPTION_OVERLAPPED_PULL or DOKAN_OPTION_SHARED_DISPATCH, the
+   * handle pulling the events of the mount, bound to the completion port of
+   * PullPort, and how many pulls it keeps pending. PullReferences counts the
+   * pulls pending or being processed plus one for the mount until it stops,
+   * and PullIdleEvent is set once they are all done. PullPort is OwnPullPort
+   * or the port shared by the instances of the process, see "Overlapped pulls"
+   * in dokan.c.
+   */
+  HANDLE PullDevice;
+  ULONG PullQueueDepth;
+  LONG PullReferences;
+  LONG PullStopping;
+  HANDLE PullIdleEvent;
+  PDOKAN_PULL_PORT PullPort;
+  DOKAN_PULL_PORT OwnPullPort;
+  /**
+   * Directory listings shared by all the opens, see dokan_dircache.c.
+   * The lists and the count are guarded by DirListCacheCriticalSection.
+   */
+  CRITICAL_SECTION DirListCacheCriticalSection;
+  LIST_ENTRY DirListCacheList;
+  LIST_ENTRY DirListCacheBuckets[DIR_LIST_CACHE_BUCKET_COUNT];
+  LONG DirListCacheCount;
+  /** Bumped on every change that invalidates listings */
+  LONG64 DirListCacheGeneration;
+  /**
+   * Per-operation metrics, allocated by the first DokanGetInstanceMetrics
+   * call and only recorded from then on, see dokan_metrics.c.
+   */
+  struct _DOKAN_METRICS_STORE *volatile Metrics;
+  /** Hooks set by DokanSetDispatchHooks, NULL if none */
+  PDOKAN_DISPATCH_HOOKS volatile DispatchHooks;
+  /**
+   * Recording started by DokanStartEventRecording, NULL if none. Taken shared
+   * by the dispatching threads to record and exclusive to stop, see
+   * dokan_recorder.c.
+   */
+  struct _DOKAN_RECORDER *volatile Recorder;
+  SRWLOCK RecorderLock;
+  /**
+   * Flush events waiting for the group commit of
+   * DOKAN_OPTIONS.FlushGroupWindowMs, NULL when flushes are not grouped, and
+   * the timer ending the group. Guarded by FlushGroupCriticalSection, see
+   * flush.c.
+   */
+  CRITICAL_SECTION FlushGroupCriticalSection;
+  PDOKAN_VECTOR FlushGroup;
+  PTP_TIMER FlushGroupTimer;
 } DOKAN_INSTANCE, *PDOKAN_INSTANCE;
 
 /**
@@ -102,6 +236,8 @@ typedef struct _DOKAN_INSTANCE {
  * This is created in CreateFile and will be freed in CloseFile.
  */
 typedef struct _DOKAN_OPEN_INFO {
+  /** Link in the free list of its pool while unused */
+  SLIST_ENTRY PoolEntry;
   CRITICAL_SECTION CriticalSection;
   /** Dokan instance linked to the open */
   PDOKAN_INSTANCE DokanInstance;
@@ -109,6 +245,20 @@ typedef struct _DOKAN_OPEN_INFO {
   PWCHAR DirListSearchPattern;
   /** Whether the FindFilesWithPattern has returned STATUS_NOT_IMPLEMENTED */
   BOOLEAN UnimplementedFindFilesWithPattern;
+  /** Whether the FindFilesWithCursor has returned STATUS_NOT_IMPLEMENTED */
+  BOOLEAN UnimplementedFindFilesWithCursor;
+  /**
+   * Directory index the last FindFilesWithCursor enumeration stopped at, and
+   * the name of the entry right before it
+   */
+  ULONG CursorIndex;
+  PWCHAR CursorFileName;
+  /**
+   * Position in DirList the last enumeration stopped at, and the number of
+   * entries matching its pattern before it
+   */
+  size_t DirListPosition;
+  ULONG DirListIndex;
   /** User Context see DOKAN_FILE_INFO.Context */
   LONG64 UserContext;
   /** Event Id */
@@ -120,6 +270,17 @@ typedef struct _DOKAN_OPEN_INFO {
   /** Used when dispatching the close once the OpenCount drops to 0 **/
   LPWSTR CloseFileName;
   LONG64 CloseUserContext;
+  /**
+   * Whether the asynchronous cleanup of the handle was handled, and whether
+   * its close came first and waits for it
+   */
+  BOOL AsyncCleanupDone;
+  BOOL CloseWaitsForCleanup;
+  /**
+   * Whether the handle was written to, which changes the size and times shown
+   * by the cached listing of its parent once the handle is cleaned up
+   */
+  BOOL WrittenBeforeCleanup;
   /** Event context */
   PEVENT_CONTEXT EventContext;
 } DOKAN_OPEN_INFO, *PDOKAN_OPEN_INFO;
@@ -140,6 +301,8 @@ typedef struct _DOKAN_IO_BATCH {
   PDOKAN_INSTANCE DokanInstance;
   /** Size read from kernel that is hold in EventContext */
   DWORD NumberOfBytesTransferred;
+  /** Size of the EventContext buffer that can be filled by the kernel */
+  DWORD EventContextSize;
   /** Whether it is used by the Main pull thread that wait indefinitely in kernel compared to volatile pool threads */
   BOOL MainPullThread;
   /**
@@ -153,6 +316,11 @@ typedef struct _DOKAN_IO_BATCH {
    * When it reaches 0, the buffer is free or pushed to the memory pool.
    */
   LONG EventContextBatchCount;
+  /**
+   * Overlapped pull of the batch with DOKAN_OPTION_OVERLAPPED_PULL or
+   * DOKAN_OPTION_SHARED_DISPATCH
+   */
+  OVERLAPPED Overlapped;
   /**
    * The actual buffer used to pull events from kernel.
    * It may contain multiple EVENT_CONTEXT depending on what the kernel has to offer right now.
@@ -168,9 +336,21 @@ typedef struct _DOKAN_IO_BATCH {
  * Use to track one of the even pulled by DOKAN_IO_BATCH while it is being processed by the FileSystem.
  * The EventContext is owned by the DOKAN_IO_BATCH and not this instance.
  */
+struct _DOKAN_IO_EVENT;
+
+/**
+ * Finishes an event whose callback returned STATUS_PENDING once the file system
+ * calls DokanCompleteOperation, as the dispatch function would have done with
+ * the values the callback returned.
+ */
+typedef VOID (*PDOKAN_ASYNC_COMPLETION)(struct _DOKAN_IO_EVENT *IoEvent,
+                                        NTSTATUS Status, ULONG Information);
+
 typedef struct _DOKAN_IO_EVENT {
   /** Dokan instance linked to the event */
   PDOKAN_INSTANCE DokanInstance;
+  /** NUMA node of the thread pool the event was queued to by QueueIoEvent */
+  ULONG Node;
   /** Optional open information for the event context */
   PDOKAN_OPEN_INFO DokanOpenInfo;
   /**
@@ -194,6 +374,31 @@ typedef struct _DOKAN_IO_EVENT {
    * When it is free, the EventContext of this IoEvent is no longer safe to access.
    */
   PDOKAN_IO_BATCH IoBatch;
+  /** Routine finishing the event if its callback completes asynchronously */
+  PDOKAN_ASYNC_COMPLETION AsyncCompletion;
+  /**
+   * Whether FindFiles or FindFilesWithPattern is filling the DOKAN_VECTOR held
+   * by DokanFileInfo.ProcessingContext, see DokanReserveFindData.
+   */
+  BOOL FillingFindData;
+  /** Dispatch function data needed by AsyncCompletion */
+  PVOID AsyncContext;
+  /**
+   * References held on an event that may complete asynchronously by the
+   * dispatching thread and by DokanCompleteOperation. The last one to release
+   * its reference sends the result.
+   */
+  LONG AsyncReferences;
+  /**
+   * Performance counter value when the event was queued to a pool thread
+   * while metrics are recorded, 0 otherwise.
+   */
+  LONG64 QueuedTime;
+  /**
+   * Performance counter value when the dispatch of the event started while
+   * metrics are recorded, 0 otherwise. Kept for DokanCompleteOperation.
+   */
+  LONG64 DispatchStartTime;
 } DOKAN_IO_EVENT, *PDOKAN_IO_EVENT;
 
 #define IOEVENT_RESULT_BUFFER_SIZE(ioEvent)                                    \
@@ -204,6 +409,16 @@ typedef struct _DOKAN_IO_EVENT {
 
 int DokanStart(_In_ PDOKAN_INSTANCE DokanInstance);
 
+PDOKAN_INSTANCE NewDokanInstance();
+
+VOID DeleteDokanInstance(PDOKAN_INSTANCE DokanInstance);
+
+// Returns TRUE if the event was left pending by its callback.
+BOOL DispatchEvent(PDOKAN_IO_EVENT ioEvent);
+
+VOID FreeIoEventResult(PEVENT_INFORMATION EventResult, ULONG EventResultSize,
+                       BOOL PoolAllocated);
+
 BOOL SendToDevice(LPCWSTR DeviceName, DWORD IoControlCode, PVOID InputBuffer,
                   ULONG InputLength, PVOID OutputBuffer, ULONG OutputLength,
                   PULONG ReturnedLength);
@@ -221,8 +436,34 @@ BOOL IsMountPointDriveLetter(LPCWSTR mountPoint);
 
 VOID EventCompletion(PDOKAN_IO_EVENT EventInfo);
 
+BOOL PrepareAsyncCompletion(PDOKAN_IO_EVENT IoEvent,
+                            PDOKAN_ASYNC_COMPLETION Completion, PVOID Context);
+
+BOOL ReleaseAsyncDispatchReference(PDOKAN_IO_EVENT IoEvent);
+
+// Returns the callback environment of the thread pool of NUMA node Node if the
+// instance uses it. Otherwise Node receives the node of the returned default
+// environment.
+PTP_CALLBACK_ENVIRON GetNodeCallbackEnvironment(PDOKAN_INSTANCE DokanInstance,
+                                                PULONG Node);
+
+// Queues a new main pull thread of the instance on its next node. Returns FALSE
+// if it could not be allocated.
+BOOL QueueMainPullThread(PDOKAN_INSTANCE DokanInstance);
+
+// Pends the overlapped pulls of the instance on its own completion port
+// waited on by ThreadCount threads, or with DOKAN_OPTION_SHARED_DISPATCH on
+// the port shared by the instances of the process, which is started with the
+// first one. Returns FALSE on failure.
+BOOL StartOverlappedPulls(PDOKAN_INSTANCE DokanInstance, ULONG ThreadCount);
+
+// Cancels the pulls of the instance started by StartOverlappedPulls and waits
+// for the port threads to be done with them, stopping the threads of its port
+// when nothing else uses them. Must not be called from a port thread.
+VOID StopOverlappedPulls(PDOKAN_INSTANCE DokanInstance);
+
 VOID CreateDispatchCommon(PDOKAN_IO_EVENT IoEvent, ULONG SizeOfEventInfo,
-                          BOOL UseExtraMemoryPool, BOOL ClearNonPoolBuffer);
+                          BOOL UseExtraMemoryPool, BOOL ClearBuffer);
 
 VOID DispatchDirectoryInformation(PDOKAN_IO_EVENT IoEvent);
 
@@ -232,17 +473,34 @@ VOID DispatchQueryVolumeInformation(PDOKAN_IO_EVENT IoEvent);
 
 VOID DispatchSetInformation(PDOKAN_IO_EVENT IoEvent);
 
-VOID DispatchRead(PDOKAN_IO_EVENT IoEvent);
+BOOL DispatchRead(PDOKAN_IO_EVENT IoEvent);
 
-VOID DispatchWrite(PDOKAN_IO_EVENT IoEvent);
+BOOL DispatchWrite(PDOKAN_IO_EVENT IoEvent);
 
 VOID DispatchCreate(PDOKAN_IO_EVENT IoEvent);
 
 VOID DispatchClose(PDOKAN_IO_EVENT IoEvent);
 
+VOID DispatchCloseBatch(PDOKAN_IO_EVENT IoEvent);
+
 VOID DispatchCleanup(PDOKAN_IO_EVENT IoEvent);
 
-VOID DispatchFlush(PDOKAN_IO_EVENT IoEvent);
+BOOL DispatchFlush(PDOKAN_IO_EVENT IoEvent);
+
+// Creates the group commit timer of the instance when
+// DOKAN_OPTIONS.FlushGroupWindowMs is set, see flush.c.
+VOID StartFlushGroup(PDOKAN_INSTANCE DokanInstance);
+
+// Makes the flushes still waiting for their group durable and frees the group.
+// The timer must be closed.
+VOID DeleteFlushGroup(PDOKAN_INSTANCE DokanInstance);
+
+// Applies the times and attributes the driver held for the file with
+// DOKAN_OPTION_DEFER_BASIC_INFO, before a cleanup or a flush.
+VOID ApplyDeferredBasicInformation(PDOKAN_IO_EVENT IoEvent, LPCWSTR FileName,
+                                   PDOKAN_DEFERRED_BASIC_INFO DeferredInfo);
+
+VOID DispatchFileSystemControl(PDOKAN_IO_EVENT IoEvent);
 
 VOID DispatchLock(PDOKAN_IO_EVENT IoEvent);
 
@@ -256,8 +514,15 @@ BOOL SendGlobalReleaseIRP(LPCWSTR MountPoint);
 
 VOID CheckFileName(LPWSTR FileName);
 
+// Takes a reference on the open info of the event and fills its DokanFileInfo.
+VOID SetupIOEventForProcessing(PDOKAN_IO_EVENT IoEvent);
+
 VOID ReleaseDokanOpenInfo(PDOKAN_IO_EVENT IoEvent);
 
+// Releases the open info of the event, as closed with CloseFileName when it is
+// not NULL.
+VOID ReleaseDokanOpenInfoEx(PDOKAN_IO_EVENT IoEvent, LPCWSTR CloseFileName);
+
 VOID DokanNotifyUnmounted(PDOKAN_INSTANCE DokanInstance);
 
 #ifdef __cplusplus
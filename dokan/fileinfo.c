@@ -477,7 +477,7 @@ VOID DispatchQueryInformation(PDOKAN_IO_EVENT IoEvent) {
   CreateDispatchCommon(IoEvent,
                        IoEvent->EventContext->Operation.File.BufferLength,
                        /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*ClearBuffer=*/TRUE);
 
   if (IoEvent->EventContext->Operation.File.FileInformationClass ==
       FileStreamInformation) {
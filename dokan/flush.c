@@ -22,13 +22,184 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokani.h"
 
-VOID DispatchFlush(PDOKAN_IO_EVENT IoEvent) {
+static VOID CompleteFlush(PDOKAN_IO_EVENT IoEvent, NTSTATUS Status,
+                          ULONG Information) {
+  UNREFERENCED_PARAMETER(Information);
+
+  if (Status == STATUS_NOT_IMPLEMENTED) {
+    IoEvent->EventResult->Status = STATUS_SUCCESS;
+  } else {
+    IoEvent->EventResult->Status =
+        Status != STATUS_SUCCESS ? STATUS_NOT_SUPPORTED : STATUS_SUCCESS;
+  }
+
+  EventCompletion(IoEvent);
+}
+
+// Group commit.
+//
+// With DOKAN_OPTIONS.FlushGroupWindowMs and
+// DOKAN_OPERATIONS.FlushFileBuffersGroup, the first flush of a group arms the
+// FlushGroupTimer of the instance and the flushes arriving before it fires join
+// the group. The group is then made durable by one FlushFileBuffersGroup call,
+// from the timer or from the thread whose flush filled the group, and all its
+// flushes complete with the result. The events wait like the ones of an
+// asynchronous callback, their single reference held by the group.
+
+#define DOKAN_FLUSH_GROUP_MAX_WINDOW_MS 1000
+#define DOKAN_FLUSH_GROUP_MAX_SIZE 256
+
+// Flushes the events of Group and sends their result.
+static VOID RunFlushGroup(PDOKAN_INSTANCE DokanInstance, PDOKAN_VECTOR Group) {
+  ULONG count = (ULONG)DokanVector_GetCount(Group);
+  LPCWSTR *fileNames;
+  PDOKAN_FILE_INFO *fileInfos;
+  NTSTATUS status = STATUS_NO_MEMORY;
+  ULONG i;
+
+  if (count == 0) {
+    return;
+  }
+  fileNames = malloc(count * sizeof(LPCWSTR));
+  fileInfos = malloc(count * sizeof(PDOKAN_FILE_INFO));
+  if (fileNames && fileInfos) {
+    for (i = 0; i < count; ++i) {
+      PDOKAN_IO_EVENT ioEvent =
+          *(PDOKAN_IO_EVENT *)DokanVector_GetItem(Group, i);
+      fileNames[i] = ioEvent->EventContext->Operation.Flush.FileName;
+      fileInfos[i] = &ioEvent->DokanFileInfo;
+    }
+    DbgPrint("###FlushGroup of %lu files\n", count);
+    status = DokanInstance->DokanOperations->FlushFileBuffersGroup(
+        fileNames, fileInfos, count);
+  }
+  for (i = 0; i < count; ++i) {
+    PDOKAN_IO_EVENT ioEvent =
+        *(PDOKAN_IO_EVENT *)DokanVector_GetItem(Group, i);
+    DokanCompleteOperation(&ioEvent->DokanFileInfo, status, 0);
+  }
+  free(fileNames);
+  free(fileInfos);
+}
+
+// Takes the events of the current group, to run them out of the lock.
+// FlushGroupCriticalSection must be held.
+static PDOKAN_VECTOR TakeFlushGroup(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_VECTOR group = DokanInstance->FlushGroup;
+  DokanInstance->FlushGroup = DokanVector_AllocWithCapacity(
+      sizeof(PDOKAN_IO_EVENT), DokanVector_GetCapacity(group));
+  if (!DokanInstance->FlushGroup) {
+    // The events are run at once and the next flushes are not grouped.
+    DbgPrint("Dokan Warning: Failed to allocate a new flush group.\n");
+  }
+  return group;
+}
+
+static VOID CALLBACK FlushGroupTimerCallback(PTP_CALLBACK_INSTANCE Instance,
+                                             PVOID Context, PTP_TIMER Timer) {
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Timer);
+
+  PDOKAN_INSTANCE dokanInstance = (PDOKAN_INSTANCE)Context;
+  PDOKAN_VECTOR group = NULL;
+
+  EnterCriticalSection(&dokanInstance->FlushGroupCriticalSection);
+  if (dokanInstance->FlushGroup &&
+      DokanVector_GetCount(dokanInstance->FlushGroup) > 0) {
+    group = TakeFlushGroup(dokanInstance);
+  }
+  LeaveCriticalSection(&dokanInstance->FlushGroupCriticalSection);
+  if (group) {
+    RunFlushGroup(dokanInstance, group);
+    DokanVector_Free(group);
+  }
+}
+
+VOID StartFlushGroup(PDOKAN_INSTANCE DokanInstance) {
+  if (DokanInstance->DokanOptions->FlushGroupWindowMs == 0 ||
+      !DokanInstance->DokanOperations->FlushFileBuffersGroup) {
+    return;
+  }
+  // Only armed by the first flush of a group.
+  DokanInstance->FlushGroupTimer = CreateThreadpoolTimer(
+      FlushGroupTimerCallback, DokanInstance,
+      &DokanInstance->ThreadInfo.CallbackEnvironment);
+  if (!DokanInstance->FlushGroupTimer) {
+    DbgPrint("Dokan Warning: Failed to create the flush group timer: %d\n",
+             GetLastError());
+    return;
+  }
+  InitializeCriticalSection(&DokanInstance->FlushGroupCriticalSection);
+  DokanInstance->FlushGroup = DokanVector_Alloc(sizeof(PDOKAN_IO_EVENT));
+}
+
+VOID DeleteFlushGroup(PDOKAN_INSTANCE DokanInstance) {
+  PDOKAN_VECTOR group = DokanInstance->FlushGroup;
+
+  if (!DokanInstance->FlushGroupTimer) {
+    return;
+  }
+  DokanInstance->FlushGroup = NULL;
+  // Closed with the cleanup group of the instance.
+  DokanInstance->FlushGroupTimer = NULL;
+  if (group) {
+    RunFlushGroup(DokanInstance, group);
+    DokanVector_Free(group);
+  }
+  DeleteCriticalSection(&DokanInstance->FlushGroupCriticalSection);
+}
+
+// Adds the flush to the current group. Returns FALSE if flushes are not
+// grouped, in which case the event is left to the caller.
+static BOOL JoinFlushGroup(PDOKAN_IO_EVENT IoEvent) {
+  PDOKAN_INSTANCE dokanInstance = IoEvent->DokanInstance;
+  PDOKAN_VECTOR group = NULL;
+  ULARGE_INTEGER dueTime;
+  FILETIME fileDueTime;
+  size_t count;
+
+  if (!dokanInstance->FlushGroupTimer) {
+    return FALSE;
+  }
+  EnterCriticalSection(&dokanInstance->FlushGroupCriticalSection);
+  if (!dokanInstance->FlushGroup ||
+      !DokanVector_PushBack(dokanInstance->FlushGroup, &IoEvent)) {
+    LeaveCriticalSection(&dokanInstance->FlushGroupCriticalSection);
+    return FALSE;
+  }
+  IoEvent->AsyncCompletion = CompleteFlush;
+  IoEvent->AsyncContext = NULL;
+  IoEvent->AsyncReferences = 1;
+  count = DokanVector_GetCount(dokanInstance->FlushGroup);
+  if (count >= DOKAN_FLUSH_GROUP_MAX_SIZE) {
+    group = TakeFlushGroup(dokanInstance);
+  } else if (count == 1) {
+    // Relative due time in 100 nanoseconds
+    dueTime.QuadPart = (ULONGLONG)(
+        -(LONGLONG)min(dokanInstance->DokanOptions->FlushGroupWindowMs,
+                       DOKAN_FLUSH_GROUP_MAX_WINDOW_MS) *
+        10000);
+    fileDueTime.dwHighDateTime = dueTime.HighPart;
+    fileDueTime.dwLowDateTime = dueTime.LowPart;
+    SetThreadpoolTimer(dokanInstance->FlushGroupTimer, &fileDueTime, 0, 0);
+  }
+  LeaveCriticalSection(&dokanInstance->FlushGroupCriticalSection);
+  // The timer then finds the group empty.
+  if (group) {
+    RunFlushGroup(dokanInstance, group);
+    DokanVector_Free(group);
+  }
+  return TRUE;
+}
+
+BOOL DispatchFlush(PDOKAN_IO_EVENT IoEvent) {
+  BOOL async = FALSE;
   NTSTATUS status;
 
   CheckFileName(IoEvent->EventContext->Operation.Flush.FileName);
 
   CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*ClearBuffer=*/TRUE);
 
   DbgPrint("###Flush file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
            IoEvent->DokanOpenInfo,
@@ -36,19 +207,25 @@ VOID DispatchFlush(PDOKAN_IO_EVENT IoEvent) {
                                           : -1,
            IoEvent);
 
+  ApplyDeferredBasicInformation(
+      IoEvent, IoEvent->EventContext->Operation.Flush.FileName,
+      &IoEvent->EventContext->Operation.Flush.DeferredBasicInfo);
+
+  if (JoinFlushGroup(IoEvent)) {
+    return TRUE;
+  }
+
   if (IoEvent->DokanInstance->DokanOperations->FlushFileBuffers) {
+    async = PrepareAsyncCompletion(IoEvent, CompleteFlush, NULL);
     status = IoEvent->DokanInstance->DokanOperations->FlushFileBuffers(
         IoEvent->EventContext->Operation.Flush.FileName, &IoEvent->DokanFileInfo);
   } else {
     status = STATUS_NOT_IMPLEMENTED;
   }
 
-  if (status == STATUS_NOT_IMPLEMENTED) {
-    IoEvent->EventResult->Status = STATUS_SUCCESS;
-  } else {
-    IoEvent->EventResult->Status =
-        status != STATUS_SUCCESS ? STATUS_NOT_SUPPORTED : STATUS_SUCCESS;
+  if (async && status == STATUS_PENDING) {
+    return ReleaseAsyncDispatchReference(IoEvent);
   }
-
-  EventCompletion(IoEvent);
+  CompleteFlush(IoEvent, status, 0);
+  return FALSE;
 }
@@ -0,0 +1,120 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokani.h"
+
+// FSCTL_DUPLICATE_EXTENTS_TO_FILE
+static VOID DispatchCopyRange(PDOKAN_IO_EVENT IoEvent) {
+  PCOPY_RANGE_CONTEXT copyRange = &IoEvent->EventContext->Operation.CopyRange;
+  LPWSTR sourceFileName =
+      (LPWSTR)((PCHAR)copyRange + copyRange->SourceFileNameOffset);
+  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+
+  CheckFileName(copyRange->FileName);
+  CheckFileName(sourceFileName);
+
+  CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
+                       /*ClearBuffer=*/TRUE);
+
+  DbgPrint("###CopyRange file handle = 0x%p, eventID = %04d, event Info = "
+           "0x%p\n",
+           IoEvent->DokanOpenInfo,
+           IoEvent->DokanOpenInfo != NULL ? IoEvent->DokanOpenInfo->EventId
+                                          : -1,
+           IoEvent);
+
+  if (IoEvent->DokanInstance->DokanOperations->CopyFileRange) {
+    status = IoEvent->DokanInstance->DokanOperations->CopyFileRange(
+        copyRange->FileName, copyRange->TargetOffset.QuadPart, sourceFileName,
+        copyRange->SourceOffset.QuadPart, copyRange->Length.QuadPart,
+        &IoEvent->DokanFileInfo);
+  }
+  IoEvent->EventResult->Status = status;
+}
+
+// FSCTL_SET_SPARSE, FSCTL_SET_ZERO_DATA and FSCTL_QUERY_ALLOCATED_RANGES
+static VOID DispatchSparse(PDOKAN_IO_EVENT IoEvent) {
+  PSPARSE_CONTEXT sparse = &IoEvent->EventContext->Operation.Sparse;
+  PDOKAN_OPERATIONS operations = IoEvent->DokanInstance->DokanOperations;
+  NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+
+  CheckFileName(sparse->FileName);
+
+  CreateDispatchCommon(IoEvent, sparse->BufferLength,
+                       /*UseExtraMemoryPool=*/FALSE, /*ClearBuffer=*/TRUE);
+
+  DbgPrint("###Sparse 0x%x file handle = 0x%p, eventID = %04d, event Info = "
+           "0x%p\n",
+           sparse->FsControlCode, IoEvent->DokanOpenInfo,
+           IoEvent->DokanOpenInfo != NULL ? IoEvent->DokanOpenInfo->EventId
+                                          : -1,
+           IoEvent);
+
+  switch (sparse->FsControlCode) {
+    case FSCTL_SET_SPARSE:
+      if (operations->SetSparseFile) {
+        status = operations->SetSparseFile(sparse->FileName, sparse->SetSparse,
+                                           &IoEvent->DokanFileInfo);
+      }
+      break;
+
+    case FSCTL_SET_ZERO_DATA:
+      if (operations->ZeroFileRange) {
+        status = operations->ZeroFileRange(
+            sparse->FileName, sparse->Offset.QuadPart, sparse->Length.QuadPart,
+            &IoEvent->DokanFileInfo);
+      }
+      break;
+
+    case FSCTL_QUERY_ALLOCATED_RANGES:
+      if (operations->QueryAllocatedRanges) {
+        DWORD maxRangeCount =
+            sparse->BufferLength / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        DWORD rangeCount = 0;
+        status = operations->QueryAllocatedRanges(
+            sparse->FileName, sparse->Offset.QuadPart, sparse->Length.QuadPart,
+            (PFILE_ALLOCATED_RANGE_BUFFER)IoEvent->EventResult->Buffer,
+            maxRangeCount, &rangeCount, &IoEvent->DokanFileInfo);
+        if (status == STATUS_SUCCESS || status == STATUS_BUFFER_OVERFLOW) {
+          IoEvent->EventResult->BufferLength =
+              min(rangeCount, maxRangeCount) *
+              sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        }
+      }
+      break;
+  }
+  IoEvent->EventResult->Status = status;
+}
+
+VOID DispatchFileSystemControl(PDOKAN_IO_EVENT IoEvent) {
+  if (IoEvent->EventContext->Operation.FsControlCode ==
+      FSCTL_DUPLICATE_EXTENTS_TO_FILE) {
+    DispatchCopyRange(IoEvent);
+  } else {
+    DispatchSparse(IoEvent);
+  }
+
+  // Same answer as the driver gives for the requests it does not support, so
+  // that callers fall back to doing without them.
+  if (IoEvent->EventResult->Status == STATUS_NOT_IMPLEMENTED) {
+    IoEvent->EventResult->Status = STATUS_INVALID_DEVICE_REQUEST;
+  }
+  EventCompletion(IoEvent);
+}
@@ -23,13 +23,38 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "dokani.h"
 #include "fileinfo.h"
 
+// Reports a lock or unlock the driver already did. No reply is sent.
+static VOID DispatchLockNotification(PDOKAN_IO_EVENT IoEvent) {
+  PDOKAN_OPERATIONS operations = IoEvent->DokanInstance->DokanOperations;
+  PLOCK_CONTEXT lock = &IoEvent->EventContext->Operation.Lock;
+
+  DbgPrint("###LockNotification %d\n", IoEvent->EventContext->MinorFunction);
+
+  IoEvent->DokanFileInfo.LockNotification = TRUE;
+  if (IoEvent->EventContext->MinorFunction == IRP_MN_LOCK &&
+      operations->LockFile) {
+    operations->LockFile(lock->FileName, lock->ByteOffset.QuadPart,
+                         lock->Length.QuadPart, &IoEvent->DokanFileInfo);
+  } else if (IoEvent->EventContext->MinorFunction == IRP_MN_UNLOCK_SINGLE &&
+             operations->UnlockFile) {
+    operations->UnlockFile(lock->FileName, lock->ByteOffset.QuadPart,
+                           lock->Length.QuadPart, &IoEvent->DokanFileInfo);
+  }
+  IoEvent->DokanFileInfo.LockNotification = FALSE;
+}
+
 VOID DispatchLock(PDOKAN_IO_EVENT IoEvent) {
   NTSTATUS status;
 
   CheckFileName(IoEvent->EventContext->Operation.Lock.FileName);
 
+  if (IoEvent->EventContext->Operation.Lock.Flags & DOKAN_LOCK_NOTIFICATION) {
+    DispatchLockNotification(IoEvent);
+    return;
+  }
+
   CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*ClearBuffer=*/TRUE);
 
   DbgPrint("###Lock file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
            IoEvent->DokanOpenInfo,
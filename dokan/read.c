@@ -21,17 +21,45 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "dokani.h"
+#include "dokan_chunkio.h"
 
-VOID DispatchRead(PDOKAN_IO_EVENT IoEvent) {
+static VOID CompleteRead(PDOKAN_IO_EVENT IoEvent, NTSTATUS Status,
+                         ULONG ReadLength) {
+  IoEvent->EventResult->BufferLength = 0;
+  IoEvent->EventResult->Status = Status;
+
+  if (Status == STATUS_SUCCESS) {
+    if (ReadLength == 0) {
+      IoEvent->EventResult->Status = STATUS_END_OF_FILE;
+    } else {
+      IoEvent->EventResult->BufferLength = ReadLength;
+      IoEvent->EventResult->Operation.Read.CurrentByteOffset.QuadPart =
+          IoEvent->EventContext->Operation.Read.ByteOffset.QuadPart +
+          ReadLength;
+    }
+  }
+
+  EventCompletion(IoEvent);
+}
+
+BOOL DispatchRead(PDOKAN_IO_EVENT IoEvent) {
   ULONG readLength = 0;
+  PVOID buffer;
+  BOOL async = FALSE;
   NTSTATUS status = STATUS_NOT_IMPLEMENTED;
+  // The driver has mapped the buffer of the application for us to read into.
+  PVOID mappedBuffer =
+      (PVOID)(ULONG_PTR)IoEvent->EventContext->Operation.Read.MappedBuffer;
 
   CheckFileName(IoEvent->EventContext->Operation.Read.FileName);
 
   CreateDispatchCommon(IoEvent,
-                       IoEvent->EventContext->Operation.Read.BufferLength,
+                       mappedBuffer
+                           ? 0
+                           : IoEvent->EventContext->Operation.Read.BufferLength,
                        /*UseExtraMemoryPool=*/TRUE,
-                       /*ClearNonPoolBuffer=*/FALSE);
+                       /*ClearBuffer=*/FALSE);
+  buffer = mappedBuffer ? mappedBuffer : IoEvent->EventResult->Buffer;
 
   DbgPrint("###Read file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
            IoEvent->DokanOpenInfo,
@@ -39,28 +67,26 @@ VOID DispatchRead(PDOKAN_IO_EVENT IoEvent) {
                                           : -1,
            IoEvent);
 
-  if (IoEvent->DokanInstance->DokanOperations->ReadFile) {
+  if (IoEvent->DokanInstance->DokanOperations->ReadFile &&
+      IsChunkedIo(IoEvent,
+                  IoEvent->EventContext->Operation.Read.BufferLength)) {
+    status = DispatchChunkedIo(
+        IoEvent, IoEvent->EventContext->Operation.Read.FileName, buffer,
+        IoEvent->EventContext->Operation.Read.BufferLength,
+        IoEvent->EventContext->Operation.Read.ByteOffset.QuadPart,
+        /*IsWrite=*/FALSE, &readLength);
+  } else if (IoEvent->DokanInstance->DokanOperations->ReadFile) {
+    async = PrepareAsyncCompletion(IoEvent, CompleteRead, NULL);
     status = IoEvent->DokanInstance->DokanOperations->ReadFile(
-        IoEvent->EventContext->Operation.Read.FileName,
-        IoEvent->EventResult->Buffer,
+        IoEvent->EventContext->Operation.Read.FileName, buffer,
         IoEvent->EventContext->Operation.Read.BufferLength, &readLength,
         IoEvent->EventContext->Operation.Read.ByteOffset.QuadPart,
         &IoEvent->DokanFileInfo);
   }
 
-  IoEvent->EventResult->BufferLength = 0;
-  IoEvent->EventResult->Status = status;
-
-  if (status == STATUS_SUCCESS) {
-    if (readLength == 0) {
-      IoEvent->EventResult->Status = STATUS_END_OF_FILE;
-    } else {
-      IoEvent->EventResult->BufferLength = readLength;
-      IoEvent->EventResult->Operation.Read.CurrentByteOffset.QuadPart =
-          IoEvent->EventContext->Operation.Read.ByteOffset.QuadPart +
-          readLength;
-    }
+  if (async && status == STATUS_PENDING) {
+    return ReleaseAsyncDispatchReference(IoEvent);
   }
-
-  EventCompletion(IoEvent);
+  CompleteRead(IoEvent, status, readLength);
+  return FALSE;
 }
@@ -136,7 +136,7 @@ VOID DispatchQuerySecurity(PDOKAN_IO_EVENT IoEvent) {
   CreateDispatchCommon(IoEvent,
                        IoEvent->EventContext->Operation.Security.BufferLength,
                        /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*ClearBuffer=*/TRUE);
 
   DbgPrint("###GetFileSecurity file handle = 0x%p, eventID = %04d, event Info "
            "= 0x%p\n",
@@ -187,7 +187,7 @@ VOID DispatchSetSecurity(PDOKAN_IO_EVENT IoEvent) {
   CheckFileName(IoEvent->EventContext->Operation.SetSecurity.FileName);
 
   CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*ClearBuffer=*/TRUE);
 
   DbgPrint(
       "###SetSecurity file handle = 0x%p, eventID = %04d, event Info = 0x%p\n",
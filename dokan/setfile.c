@@ -24,6 +24,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <stdlib.h>
 #include "dokani.h"
 #include "fileinfo.h"
+#include "dokan_dircache.h"
 
 NTSTATUS
 DokanSetAllocationInformation(PEVENT_CONTEXT EventContext,
@@ -52,15 +53,14 @@ DokanSetAllocationInformation(PEVENT_CONTEXT EventContext,
   return status;
 }
 
-NTSTATUS
-DokanSetBasicInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
-                         PDOKAN_OPERATIONS DokanOperations) {
+// Applies the given times and attributes to the file.
+static NTSTATUS ApplyBasicInformation(LPCWSTR FileName,
+                                      PFILE_BASIC_INFORMATION BasicInfo,
+                                      PDOKAN_FILE_INFO FileInfo,
+                                      PDOKAN_OPERATIONS DokanOperations) {
   FILETIME creation, lastAccess, lastWrite;
   NTSTATUS status;
 
-  PFILE_BASIC_INFORMATION basicInfo = (PFILE_BASIC_INFORMATION)(
-      (PCHAR)EventContext + EventContext->Operation.SetFile.BufferOffset);
-
   if (!DokanOperations->SetFileAttributes)
     return STATUS_NOT_IMPLEMENTED;
 
@@ -68,22 +68,54 @@ DokanSetBasicInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
     return STATUS_NOT_IMPLEMENTED;
 
   status = DokanOperations->SetFileAttributes(
-      EventContext->Operation.SetFile.FileName, basicInfo->FileAttributes,
-      FileInfo);
+      FileName, BasicInfo->FileAttributes, FileInfo);
 
   if (status != STATUS_SUCCESS)
     return status;
 
-  creation.dwLowDateTime = basicInfo->CreationTime.LowPart;
-  creation.dwHighDateTime = basicInfo->CreationTime.HighPart;
-  lastAccess.dwLowDateTime = basicInfo->LastAccessTime.LowPart;
-  lastAccess.dwHighDateTime = basicInfo->LastAccessTime.HighPart;
-  lastWrite.dwLowDateTime = basicInfo->LastWriteTime.LowPart;
-  lastWrite.dwHighDateTime = basicInfo->LastWriteTime.HighPart;
+  creation.dwLowDateTime = BasicInfo->CreationTime.LowPart;
+  creation.dwHighDateTime = BasicInfo->CreationTime.HighPart;
+  lastAccess.dwLowDateTime = BasicInfo->LastAccessTime.LowPart;
+  lastAccess.dwHighDateTime = BasicInfo->LastAccessTime.HighPart;
+  lastWrite.dwLowDateTime = BasicInfo->LastWriteTime.LowPart;
+  lastWrite.dwHighDateTime = BasicInfo->LastWriteTime.HighPart;
 
-  return DokanOperations->SetFileTime(EventContext->Operation.SetFile.FileName,
-                                      &creation, &lastAccess, &lastWrite,
-                                      FileInfo);
+  return DokanOperations->SetFileTime(FileName, &creation, &lastAccess,
+                                      &lastWrite, FileInfo);
+}
+
+NTSTATUS
+DokanSetBasicInformation(PEVENT_CONTEXT EventContext, PDOKAN_FILE_INFO FileInfo,
+                         PDOKAN_OPERATIONS DokanOperations) {
+  PFILE_BASIC_INFORMATION basicInfo = (PFILE_BASIC_INFORMATION)(
+      (PCHAR)EventContext + EventContext->Operation.SetFile.BufferOffset);
+
+  return ApplyBasicInformation(EventContext->Operation.SetFile.FileName,
+                               basicInfo, FileInfo, DokanOperations);
+}
+
+VOID ApplyDeferredBasicInformation(PDOKAN_IO_EVENT IoEvent, LPCWSTR FileName,
+                                   PDOKAN_DEFERRED_BASIC_INFO DeferredInfo) {
+  FILE_BASIC_INFORMATION basicInfo;
+  NTSTATUS status;
+
+  if (DeferredInfo->Count == 0) {
+    return;
+  }
+  basicInfo.CreationTime = DeferredInfo->CreationTime;
+  basicInfo.LastAccessTime = DeferredInfo->LastAccessTime;
+  basicInfo.LastWriteTime = DeferredInfo->LastWriteTime;
+  basicInfo.ChangeTime = DeferredInfo->ChangeTime;
+  basicInfo.FileAttributes = DeferredInfo->FileAttributes;
+  DbgPrint("  apply %lu deferred basic information sets\n",
+           DeferredInfo->Count);
+  // The sets were already completed, so a failure can only be logged.
+  status = ApplyBasicInformation(FileName, &basicInfo, &IoEvent->DokanFileInfo,
+                                 IoEvent->DokanInstance->DokanOperations);
+  if (status != STATUS_SUCCESS) {
+    DbgPrint("  deferred basic information failed 0x%x\n", status);
+  }
+  InvalidateCachedDirList(IoEvent->DokanInstance, FileName, wcslen(FileName));
 }
 
 NTSTATUS
@@ -212,10 +244,10 @@ VOID DispatchSetInformation(PDOKAN_IO_EVENT IoEvent) {
                                         .BufferOffset);
     CreateDispatchCommon(IoEvent, renameInfo->FileNameLength,
                          /*UseExtraMemoryPool=*/FALSE,
-                         /*ClearNonPoolBuffer=*/TRUE);
+                         /*ClearBuffer=*/TRUE);
   } else {
     CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                         /*ClearNonPoolBuffer=*/TRUE);
+                         /*ClearBuffer=*/TRUE);
   }
 
   CheckFileName(IoEvent->EventContext->Operation.SetFile.FileName);
@@ -279,6 +311,18 @@ VOID DispatchSetInformation(PDOKAN_IO_EVENT IoEvent) {
   IoEvent->EventResult->Status = status;
 
   if (status == STATUS_SUCCESS) {
+    if (fileInformationClass == FileRenameInformation ||
+        fileInformationClass == FileRenameInformationEx) {
+      InvalidateCachedDirListTree(
+          IoEvent->DokanInstance,
+          IoEvent->EventContext->Operation.SetFile.FileName,
+          wcslen(IoEvent->EventContext->Operation.SetFile.FileName));
+    } else {
+      InvalidateCachedDirList(
+          IoEvent->DokanInstance,
+          IoEvent->EventContext->Operation.SetFile.FileName,
+          wcslen(IoEvent->EventContext->Operation.SetFile.FileName));
+    }
     if (fileInformationClass == FileDispositionInformation ||
         fileInformationClass == FileDispositionInformationEx) {
       IoEvent->EventResult->Operation.Delete.DeleteOnClose =
@@ -293,6 +337,8 @@ VOID DispatchSetInformation(PDOKAN_IO_EVENT IoEvent) {
       IoEvent->EventResult->BufferLength = renameInfo->FileNameLength;
       CopyMemory(IoEvent->EventResult->Buffer, renameInfo->FileName,
                  renameInfo->FileNameLength);
+      InvalidateCachedDirList(IoEvent->DokanInstance, renameInfo->FileName,
+                              renameInfo->FileNameLength / sizeof(WCHAR));
     }
   }
 
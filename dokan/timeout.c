@@ -55,4 +55,43 @@ BOOL DOKANAPI DokanResetTimeout(ULONG Timeout, PDOKAN_FILE_INFO FileInfo) {
   }
   free(eventInfo);
   return status;
-}
\ No newline at end of file
+}
+
+BOOL DOKANAPI DokanResetAllTimeouts(_In_ DOKAN_HANDLE DokanInstance,
+                                    ULONG Timeout) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  BOOL status;
+
+  if (!instance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  status = SendToDevice(rawDeviceName, FSCTL_RESET_ALL_TIMEOUTS, &Timeout,
+                        sizeof(Timeout), NULL, 0, &returnedLength);
+  if (!status) {
+    DbgPrintW(L"Failed to Reset all Timeouts with timeout: %04d\n", Timeout);
+  }
+  return status;
+}
+
+BOOL DOKANAPI DokanHeartbeat(_In_ DOKAN_HANDLE DokanInstance) {
+  DOKAN_INSTANCE *instance = (DOKAN_INSTANCE *)DokanInstance;
+  WCHAR rawDeviceName[MAX_PATH];
+  ULONG returnedLength = 0;
+  BOOL status;
+
+  if (!instance) {
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+  GetRawDeviceName(instance->DeviceName, rawDeviceName, MAX_PATH);
+  status = SendToDevice(rawDeviceName, FSCTL_HEARTBEAT, NULL, 0, NULL, 0,
+                        &returnedLength);
+  if (!status) {
+    DbgPrintW(L"Failed to send Heartbeat\n");
+  }
+  return status;
+}
@@ -22,6 +22,8 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokani.h"
 #include "dokan_pool.h"
+#include "dokan_chunkio.h"
+#include "dokan_dircache.h"
 
 #include <assert.h>
 
@@ -56,13 +58,52 @@ DWORD SendWriteRequest(PDOKAN_IO_EVENT IoEvent, ULONG WriteEventContextLength,
   return 0;
 }
 
-VOID DispatchWrite(PDOKAN_IO_EVENT IoEvent) {
+static VOID FinishWrite(PDOKAN_IO_EVENT IoEvent, PDOKAN_IO_BATCH WriteIoBatch,
+                        NTSTATUS Status, ULONG WrittenLength) {
+  IoEvent->EventResult->Status = Status;
+  IoEvent->EventResult->BufferLength = 0;
+
+  if (Status == STATUS_SUCCESS) {
+    // The size and times shown by the listing of the parent change. Like NTFS
+    // does for its directory entries, they are only updated at the cleanup of
+    // the handle, rather than taking the cache lock on every write. Paging
+    // writes can come after it.
+    if (IoEvent->DokanFileInfo.PagingIo || !IoEvent->DokanOpenInfo) {
+      InvalidateCachedDirList(
+          IoEvent->DokanInstance,
+          WriteIoBatch->EventContext->Operation.Write.FileName,
+          wcslen(WriteIoBatch->EventContext->Operation.Write.FileName));
+    } else {
+      IoEvent->DokanOpenInfo->WrittenBeforeCleanup = TRUE;
+    }
+    IoEvent->EventResult->BufferLength = WrittenLength;
+    IoEvent->EventResult->Operation.Write.CurrentByteOffset.QuadPart =
+        WriteIoBatch->EventContext->Operation.Write.ByteOffset.QuadPart +
+        WrittenLength;
+  }
+
+  if (WriteIoBatch != IoEvent->IoBatch) {
+    PushIoBatchBuffer(WriteIoBatch);
+  }
+
+  EventCompletion(IoEvent);
+}
+
+static VOID CompleteWrite(PDOKAN_IO_EVENT IoEvent, NTSTATUS Status,
+                          ULONG WrittenLength) {
+  FinishWrite(IoEvent, (PDOKAN_IO_BATCH)IoEvent->AsyncContext, Status,
+              WrittenLength);
+}
+
+BOOL DispatchWrite(PDOKAN_IO_EVENT IoEvent) {
   PDOKAN_IO_BATCH writeIoBatch = IoEvent->IoBatch;
   ULONG writtenLength = 0;
+  PCHAR buffer;
+  BOOL async = FALSE;
   NTSTATUS status;
 
   CreateDispatchCommon(IoEvent, 0, /*UseExtraMemoryPool=*/FALSE,
-                       /*ClearNonPoolBuffer=*/TRUE);
+                       /*ClearBuffer=*/TRUE);
 
   CheckFileName(IoEvent->EventContext->Operation.Write.FileName);
   DbgPrint(
@@ -94,16 +135,32 @@ VOID DispatchWrite(PDOKAN_IO_EVENT IoEvent) {
                  error, IoEvent->EventResult->Status);
       }
       EventCompletion(IoEvent);
-      return;
+      return FALSE;
     }
   }
 
+  // The driver may have mapped the buffer of the application for us instead.
+  if (writeIoBatch->EventContext->Operation.Write.MappedBuffer != 0) {
+    buffer = (PCHAR)(ULONG_PTR)
+                 writeIoBatch->EventContext->Operation.Write.MappedBuffer;
+  } else {
+    buffer = (PCHAR)writeIoBatch->EventContext +
+             writeIoBatch->EventContext->Operation.Write.BufferOffset;
+  }
+
   // for the case SendWriteRequest success
-  if (IoEvent->DokanInstance->DokanOperations->WriteFile) {
+  if (IoEvent->DokanInstance->DokanOperations->WriteFile &&
+      IsChunkedIo(IoEvent,
+                  writeIoBatch->EventContext->Operation.Write.BufferLength)) {
+    status = DispatchChunkedIo(
+        IoEvent, writeIoBatch->EventContext->Operation.Write.FileName, buffer,
+        writeIoBatch->EventContext->Operation.Write.BufferLength,
+        writeIoBatch->EventContext->Operation.Write.ByteOffset.QuadPart,
+        /*IsWrite=*/TRUE, &writtenLength);
+  } else if (IoEvent->DokanInstance->DokanOperations->WriteFile) {
+    async = PrepareAsyncCompletion(IoEvent, CompleteWrite, writeIoBatch);
     status = IoEvent->DokanInstance->DokanOperations->WriteFile(
-        writeIoBatch->EventContext->Operation.Write.FileName,
-        (PCHAR)writeIoBatch->EventContext +
-            writeIoBatch->EventContext->Operation.Write.BufferOffset,
+        writeIoBatch->EventContext->Operation.Write.FileName, buffer,
         writeIoBatch->EventContext->Operation.Write.BufferLength,
         &writtenLength,
         writeIoBatch->EventContext->Operation.Write.ByteOffset.QuadPart,
@@ -112,19 +169,9 @@ VOID DispatchWrite(PDOKAN_IO_EVENT IoEvent) {
     status = STATUS_NOT_IMPLEMENTED;
   }
 
-  IoEvent->EventResult->Status = status;
-  IoEvent->EventResult->BufferLength = 0;
-
-  if (status == STATUS_SUCCESS) {
-    IoEvent->EventResult->BufferLength = writtenLength;
-    IoEvent->EventResult->Operation.Write.CurrentByteOffset.QuadPart =
-        writeIoBatch->EventContext->Operation.Write.ByteOffset.QuadPart +
-        writtenLength;
-  }
-
-  if (writeIoBatch != IoEvent->IoBatch) {
-    PushIoBatchBuffer(writeIoBatch);
+  if (async && status == STATUS_PENDING) {
+    return ReleaseAsyncDispatchReference(IoEvent);
   }
-
-  EventCompletion(IoEvent);
+  FinishWrite(IoEvent, writeIoBatch, status, writtenLength);
+  return FALSE;
 }
@@ -0,0 +1,724 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../samples/dokan_nullfs/nullfs.h"
+
+// Measures the overhead of Dokan itself.
+//
+// The null file system of samples/dokan_nullfs is mounted with each
+// configuration of the matrix, and the workloads are run against its \file
+// and \dir for a fixed time. Each workload prints one record with its
+// throughput and the p50/p99 latency of its operations, as JSON lines or CSV.
+//
+// The requests of the first configuration can also be recorded with /e, and a
+// recording replayed against the null file system with /r, to measure the
+// cost of the dispatch alone on a captured workload.
+
+#define BENCH_DEFAULT_DURATION_MS 5000
+#define BENCH_DEFAULT_ENTRY_COUNT 10000
+#define BENCH_MAX_CLIENTS 64
+#define BENCH_MAX_THREAD_COUNTS 8
+// Latencies recorded per workload, shared between the client threads. Only
+// the first operations of a long run are sampled past it.
+#define BENCH_MAX_SAMPLES (1 << 20)
+#define BENCH_MAX_IO_SIZE (1024 * 1024)
+
+typedef enum _BENCH_OUTPUT_FORMAT {
+  BENCH_OUTPUT_JSON = 0,
+  BENCH_OUTPUT_CSV,
+} BENCH_OUTPUT_FORMAT;
+
+typedef struct _BENCH_CONFIG {
+  WCHAR Name[32];
+  BOOLEAN SingleThread;
+  BOOL IpcBatching;
+  BOOL AsyncOperations;
+  // Both 0 for the default of the library.
+  ULONG Threads;
+} BENCH_CONFIG, *PBENCH_CONFIG;
+
+typedef struct _BENCH_CLIENT BENCH_CLIENT, *PBENCH_CLIENT;
+
+typedef BOOL (*PBENCH_OPERATION)(PBENCH_CLIENT Client);
+
+typedef struct _BENCH_WORKLOAD {
+  LPCWSTR Name;
+  PBENCH_OPERATION Operation;
+  // 0 for the workloads that do not go through a handle of \file.
+  ULONG IoSize;
+  BOOL Random;
+  BOOL Write;
+} BENCH_WORKLOAD, *PBENCH_WORKLOAD;
+
+struct _BENCH_CLIENT {
+  const BENCH_WORKLOAD *Workload;
+  HANDLE Thread;
+  HANDLE File;
+  PVOID Buffer;
+  ULONG64 Random;
+  LONGLONG NextOffset;
+  PLONGLONG Samples;
+  ULONG SampleCapacity;
+  ULONG SampleCount;
+  ULONG64 Operations;
+  DWORD Error;
+};
+
+typedef struct _BENCH_RESULT {
+  ULONG64 Operations;
+  double Seconds;
+  double OperationsPerSecond;
+  double MiBPerSecond;
+  double P50Us;
+  double P99Us;
+  DWORD Error;
+} BENCH_RESULT, *PBENCH_RESULT;
+
+static ULONG g_EntryCount = BENCH_DEFAULT_ENTRY_COUNT;
+static ULONG g_DurationMs = BENCH_DEFAULT_DURATION_MS;
+static ULONG g_ClientCount = 1;
+static BENCH_OUTPUT_FORMAT g_OutputFormat = BENCH_OUTPUT_JSON;
+static LPCWSTR g_WorkloadFilter;
+static LPCWSTR g_RecordingPath;
+static BOOL g_AsyncOperations;
+static LARGE_INTEGER g_Frequency;
+static DOKAN_OPERATIONS g_Operations;
+static DOKAN_HANDLE g_Instance;
+static volatile LONG g_Stop;
+static HANDLE g_StartEvent;
+static HANDLE g_MountedEvent;
+static WCHAR g_MountPoint[MAX_PATH] = L"N:\\";
+static WCHAR g_FilePath[MAX_PATH];
+static WCHAR g_DirPattern[MAX_PATH];
+
+static NTSTATUS DOKAN_CALLBACK BenchMounted(LPCWSTR MountPoint,
+                                            PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(MountPoint);
+  UNREFERENCED_PARAMETER(DokanFileInfo);
+  SetEvent(g_MountedEvent);
+  return STATUS_SUCCESS;
+}
+
+//
+// Workloads
+//
+
+static ULONG64 NextRandom(PBENCH_CLIENT Client) {
+  // xorshift64
+  Client->Random ^= Client->Random << 13;
+  Client->Random ^= Client->Random >> 7;
+  Client->Random ^= Client->Random << 17;
+  return Client->Random;
+}
+
+static BOOL CreateCloseOperation(PBENCH_CLIENT Client) {
+  HANDLE handle = CreateFileW(
+      g_FilePath, FILE_READ_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  UNREFERENCED_PARAMETER(Client);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return FALSE;
+  }
+  CloseHandle(handle);
+  return TRUE;
+}
+
+static BOOL IoOperation(PBENCH_CLIENT Client) {
+  const BENCH_WORKLOAD *workload = Client->Workload;
+  OVERLAPPED overlapped;
+  LONGLONG offset;
+  DWORD transferred = 0;
+  BOOL result;
+
+  if (workload->Random) {
+    offset = (LONGLONG)(NextRandom(Client) %
+                        (NULLFS_FILE_SIZE / workload->IoSize)) *
+             workload->IoSize;
+  } else {
+    offset = Client->NextOffset;
+    Client->NextOffset = (offset + workload->IoSize) % NULLFS_FILE_SIZE;
+  }
+  ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+  overlapped.Offset = (DWORD)offset;
+  overlapped.OffsetHigh = (DWORD)(offset >> 32);
+  if (workload->Write) {
+    result = WriteFile(Client->File, Client->Buffer, workload->IoSize,
+                       &transferred, &overlapped);
+  } else {
+    result = ReadFile(Client->File, Client->Buffer, workload->IoSize,
+                      &transferred, &overlapped);
+  }
+  if (result && transferred != workload->IoSize) {
+    SetLastError(ERROR_HANDLE_EOF);
+    return FALSE;
+  }
+  return result;
+}
+
+static BOOL EnumerateOperation(PBENCH_CLIENT Client) {
+  WIN32_FIND_DATAW findData;
+  ULONG count = 0;
+  HANDLE find;
+  UNREFERENCED_PARAMETER(Client);
+
+  find = FindFirstFileExW(g_DirPattern, FindExInfoBasic, &findData,
+                          FindExSearchNameMatch, NULL,
+                          FIND_FIRST_EX_LARGE_FETCH);
+  if (find == INVALID_HANDLE_VALUE) {
+    return FALSE;
+  }
+  do {
+    ++count;
+  } while (FindNextFileW(find, &findData));
+  FindClose(find);
+  // "." and ".." are listed too.
+  if (count != g_EntryCount + 2) {
+    SetLastError(ERROR_INVALID_DATA);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// A request answered by the library without reaching the file system, for the
+// cost of the transport alone.
+static BOOL EchoOperation(PBENCH_CLIENT Client) {
+  DOKAN_ECHO echo;
+  UNREFERENCED_PARAMETER(Client);
+
+  return DokanEcho(g_Instance, 1, &echo);
+}
+
+static const BENCH_WORKLOAD g_Workloads[] = {
+    {L"echo", EchoOperation, 0, FALSE, FALSE},
+    {L"create_close", CreateCloseOperation, 0, FALSE, FALSE},
+    {L"read_4k_random", IoOperation, 4096, TRUE, FALSE},
+    {L"read_1m_sequential", IoOperation, 1024 * 1024, FALSE, FALSE},
+    {L"write_4k_random", IoOperation, 4096, TRUE, TRUE},
+    {L"write_1m_sequential", IoOperation, 1024 * 1024, FALSE, TRUE},
+    {L"enumerate", EnumerateOperation, 0, FALSE, FALSE},
+};
+
+static DWORD WINAPI ClientThread(LPVOID Parameter) {
+  PBENCH_CLIENT client = (PBENCH_CLIENT)Parameter;
+  LARGE_INTEGER start, end;
+
+  WaitForSingleObject(g_StartEvent, INFINITE);
+  while (!InterlockedCompareExchange(&g_Stop, 0, 0)) {
+    QueryPerformanceCounter(&start);
+    if (!client->Workload->Operation(client)) {
+      client->Error = GetLastError();
+      break;
+    }
+    QueryPerformanceCounter(&end);
+    if (client->SampleCount < client->SampleCapacity) {
+      client->Samples[client->SampleCount++] = end.QuadPart - start.QuadPart;
+    }
+    ++client->Operations;
+  }
+  return 0;
+}
+
+// Opens \file without caching so that every read and write reaches Dokan.
+static BOOL OpenClientFile(PBENCH_CLIENT Client, ULONG Index) {
+  Client->File = CreateFileW(
+      g_FilePath, GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+      OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+  if (Client->File == INVALID_HANDLE_VALUE) {
+    Client->File = NULL;
+    return FALSE;
+  }
+  // The clients of a sequential workload do not read the same ranges.
+  Client->NextOffset = ((NULLFS_FILE_SIZE / g_ClientCount) * Index) &
+                        ~(LONGLONG)(BENCH_MAX_IO_SIZE - 1);
+  return TRUE;
+}
+
+static int CompareSamples(const void *Left, const void *Right) {
+  LONGLONG left = *(const LONGLONG *)Left;
+  LONGLONG right = *(const LONGLONG *)Right;
+  return left < right ? -1 : left > right;
+}
+
+static double TicksToUs(LONGLONG Ticks) {
+  return (double)Ticks * 1000000.0 / (double)g_Frequency.QuadPart;
+}
+
+static VOID ComputePercentiles(PBENCH_CLIENT Clients, PBENCH_RESULT Result) {
+  PLONGLONG samples = Clients[0].Samples;
+  ULONG count = 0;
+
+  // The samples of all the clients are in a single allocation, moved together
+  // before sorting.
+  for (ULONG i = 0; i < g_ClientCount; ++i) {
+    MoveMemory(samples + count, Clients[i].Samples,
+               Clients[i].SampleCount * sizeof(LONGLONG));
+    count += Clients[i].SampleCount;
+  }
+  if (count == 0) {
+    return;
+  }
+  qsort(samples, count, sizeof(LONGLONG), CompareSamples);
+  Result->P50Us = TicksToUs(samples[(count - 1) * 50 / 100]);
+  Result->P99Us = TicksToUs(samples[(ULONG)((count - 1) * 99ULL / 100)]);
+}
+
+static BOOL RunWorkload(const BENCH_WORKLOAD *Workload, PBENCH_RESULT Result) {
+  BENCH_CLIENT clients[BENCH_MAX_CLIENTS];
+  PLONGLONG samples;
+  LARGE_INTEGER start, end;
+  BOOL success = FALSE;
+  ULONG started = 0;
+
+  ZeroMemory(Result, sizeof(BENCH_RESULT));
+  ZeroMemory(clients, sizeof(clients));
+  samples = malloc(BENCH_MAX_SAMPLES * sizeof(LONGLONG));
+  if (!samples) {
+    Result->Error = ERROR_NOT_ENOUGH_MEMORY;
+    return FALSE;
+  }
+  ResetEvent(g_StartEvent);
+  InterlockedExchange(&g_Stop, 0);
+
+  for (; started < g_ClientCount; ++started) {
+    PBENCH_CLIENT client = &clients[started];
+    client->Workload = Workload;
+    client->Random = 0x9E3779B97F4A7C15ULL * (started + 1);
+    client->SampleCapacity = BENCH_MAX_SAMPLES / g_ClientCount;
+    client->Samples = samples + (SIZE_T)client->SampleCapacity * started;
+    if (Workload->IoSize) {
+      // Page aligned, as required by FILE_FLAG_NO_BUFFERING.
+      client->Buffer = VirtualAlloc(NULL, Workload->IoSize,
+                                    MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+      if (!client->Buffer || !OpenClientFile(client, started)) {
+        Result->Error = GetLastError();
+        goto cleanup;
+      }
+    }
+    client->Thread = CreateThread(NULL, 0, ClientThread, client, 0, NULL);
+    if (!client->Thread) {
+      Result->Error = GetLastError();
+      goto cleanup;
+    }
+  }
+
+  QueryPerformanceCounter(&start);
+  SetEvent(g_StartEvent);
+  Sleep(g_DurationMs);
+  InterlockedExchange(&g_Stop, 1);
+  for (ULONG i = 0; i < started; ++i) {
+    WaitForSingleObject(clients[i].Thread, INFINITE);
+  }
+  QueryPerformanceCounter(&end);
+
+  Result->Seconds = (double)(end.QuadPart - start.QuadPart) /
+                    (double)g_Frequency.QuadPart;
+  for (ULONG i = 0; i < started; ++i) {
+    Result->Operations += clients[i].Operations;
+    if (clients[i].Error != ERROR_SUCCESS) {
+      Result->Error = clients[i].Error;
+    }
+  }
+  Result->OperationsPerSecond = (double)Result->Operations / Result->Seconds;
+  Result->MiBPerSecond = Result->OperationsPerSecond * Workload->IoSize /
+                         (1024.0 * 1024.0);
+  ComputePercentiles(clients, Result);
+  success = Result->Error == ERROR_SUCCESS;
+
+cleanup:
+  // Threads still waiting for the start when the setup failed.
+  InterlockedExchange(&g_Stop, 1);
+  SetEvent(g_StartEvent);
+  for (ULONG i = 0; i <= started && i < g_ClientCount; ++i) {
+    if (clients[i].Thread) {
+      WaitForSingleObject(clients[i].Thread, INFINITE);
+      CloseHandle(clients[i].Thread);
+    }
+    if (clients[i].File) {
+      CloseHandle(clients[i].File);
+    }
+    if (clients[i].Buffer) {
+      VirtualFree(clients[i].Buffer, 0, MEM_RELEASE);
+    }
+  }
+  free(samples);
+  return success;
+}
+
+//
+// Output
+//
+
+static VOID PrintHeader() {
+  if (g_OutputFormat == BENCH_OUTPUT_CSV) {
+    fwprintf(stdout,
+             L"dokan_version,driver_version,config,single_thread,ipc_batching,"
+             L"async,threads,clients,workload,entries,ops,seconds,ops_per_sec,"
+             L"mib_per_sec,p50_us,p99_us,error\n");
+  }
+}
+
+static VOID PrintResult(const BENCH_CONFIG *Config,
+                        const BENCH_WORKLOAD *Workload,
+                        const BENCH_RESULT *Result) {
+  ULONG entries = Workload->Operation == EnumerateOperation ? g_EntryCount : 0;
+
+  if (g_OutputFormat == BENCH_OUTPUT_CSV) {
+    fwprintf(stdout,
+             L"%lu,%lu,%ls,%d,%d,%d,%lu,%lu,%ls,%lu,%llu,%.3f,%.1f,%.2f,%.2f,"
+             L"%.2f,%lu\n",
+             DokanVersion(), DokanDriverVersion(), Config->Name,
+             Config->SingleThread ? 1 : 0, Config->IpcBatching ? 1 : 0,
+             Config->AsyncOperations ? 1 : 0, Config->Threads, g_ClientCount, Workload->Name, entries,
+             Result->Operations, Result->Seconds, Result->OperationsPerSecond,
+             Result->MiBPerSecond, Result->P50Us, Result->P99Us,
+             Result->Error);
+  } else {
+    fwprintf(stdout,
+             L"{\"dokan_version\":%lu,\"driver_version\":%lu,\"config\":\"%ls\","
+             L"\"single_thread\":%ls,\"ipc_batching\":%ls,\"async\":%ls,"
+             L"\"threads\":%lu,"
+             L"\"clients\":%lu,\"workload\":\"%ls\",\"entries\":%lu,"
+             L"\"ops\":%llu,\"seconds\":%.3f,\"ops_per_sec\":%.1f,"
+             L"\"mib_per_sec\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f,"
+             L"\"error\":%lu}\n",
+             DokanVersion(), DokanDriverVersion(), Config->Name,
+             Config->SingleThread ? L"true" : L"false",
+             Config->IpcBatching ? L"true" : L"false",
+             Config->AsyncOperations ? L"true" : L"false", Config->Threads,
+             g_ClientCount, Workload->Name, entries, Result->Operations,
+             Result->Seconds, Result->OperationsPerSecond,
+             Result->MiBPerSecond, Result->P50Us, Result->P99Us,
+             Result->Error);
+  }
+  fflush(stdout);
+}
+
+//
+// Configurations
+//
+
+static BOOL RunConfig(const BENCH_CONFIG *Config) {
+  DOKAN_OPTIONS dokanOptions;
+  DOKAN_HANDLE instance;
+  BENCH_RESULT result;
+  BOOL success = TRUE;
+  int status;
+
+  ZeroMemory(&dokanOptions, sizeof(DOKAN_OPTIONS));
+  dokanOptions.Version = DOKAN_VERSION;
+  dokanOptions.SingleThread = Config->SingleThread;
+  dokanOptions.MountPoint = g_MountPoint;
+  dokanOptions.MinThreads = Config->Threads;
+  dokanOptions.MaxThreads = Config->Threads;
+  if (Config->IpcBatching) {
+    dokanOptions.Options |= DOKAN_OPTION_ALLOW_IPC_BATCHING;
+  }
+  if (Config->AsyncOperations) {
+    dokanOptions.Options |= DOKAN_OPTION_ASYNC_OPERATIONS;
+  }
+
+  ResetEvent(g_MountedEvent);
+  status = DokanCreateFileSystem(&dokanOptions, &g_Operations, &instance);
+  if (status != DOKAN_SUCCESS) {
+    fwprintf(stderr, L"Failed to mount %ls for %ls: %d\n", g_MountPoint,
+             Config->Name, status);
+    return FALSE;
+  }
+  WaitForSingleObject(g_MountedEvent, 10 * 1000);
+  g_Instance = instance;
+  if (g_RecordingPath) {
+    if (!DokanStartEventRecording(instance, g_RecordingPath)) {
+      fwprintf(stderr, L"Failed to record %ls to %ls: %lu\n", Config->Name,
+               g_RecordingPath, GetLastError());
+      success = FALSE;
+    }
+    // Only the first configuration is recorded.
+    g_RecordingPath = NULL;
+  }
+
+  for (ULONG i = 0; i < ARRAYSIZE(g_Workloads); ++i) {
+    if (g_WorkloadFilter && _wcsicmp(g_WorkloadFilter, g_Workloads[i].Name)) {
+      continue;
+    }
+    if (!RunWorkload(&g_Workloads[i], &result)) {
+      fwprintf(stderr, L"%ls failed with %ls: %lu\n", g_Workloads[i].Name,
+               Config->Name, result.Error);
+      success = FALSE;
+    }
+    PrintResult(Config, &g_Workloads[i], &result);
+  }
+
+  g_Instance = NULL;
+  DokanCloseHandle(instance);
+  return success;
+}
+
+static VOID SetConfig(PBENCH_CONFIG Config, BOOLEAN SingleThread,
+                      BOOL IpcBatching, BOOL AsyncOperations, ULONG Threads) {
+  Config->SingleThread = SingleThread;
+  Config->IpcBatching = IpcBatching;
+  Config->AsyncOperations = AsyncOperations;
+  Config->Threads = Threads;
+  if (SingleThread) {
+    wcscpy_s(Config->Name, ARRAYSIZE(Config->Name), L"single");
+  } else if (Threads == 0) {
+    wcscpy_s(Config->Name, ARRAYSIZE(Config->Name), L"default");
+  } else {
+    swprintf_s(Config->Name, ARRAYSIZE(Config->Name), L"threads%lu", Threads);
+  }
+  if (IpcBatching) {
+    wcscat_s(Config->Name, ARRAYSIZE(Config->Name), L"-batch");
+  }
+  if (AsyncOperations) {
+    wcscat_s(Config->Name, ARRAYSIZE(Config->Name), L"-async");
+  }
+}
+
+static BOOL RunConfigs(BOOLEAN SingleThread, BOOL IpcBatching, ULONG Threads) {
+  BENCH_CONFIG config;
+  BOOL success;
+
+  SetConfig(&config, SingleThread, IpcBatching, FALSE, Threads);
+  success = RunConfig(&config);
+  if (g_AsyncOperations) {
+    SetConfig(&config, SingleThread, IpcBatching, TRUE, Threads);
+    success &= RunConfig(&config);
+  }
+  return success;
+}
+
+static BOOL ReplayRecording(LPCWSTR RecordingPath, ULONG Flags) {
+  DOKAN_OPTIONS dokanOptions;
+  DOKAN_REPLAY_RESULT result;
+  BOOL success;
+
+  ZeroMemory(&dokanOptions, sizeof(DOKAN_OPTIONS));
+  dokanOptions.Version = DOKAN_VERSION;
+  dokanOptions.MountPoint = g_MountPoint;
+  ZeroMemory(&result, sizeof(result));
+  success = DokanReplayEventRecording(RecordingPath, &dokanOptions,
+                                      &g_Operations, Flags, &result);
+  if (!success) {
+    fwprintf(stderr, L"Failed to replay %ls: %lu\n", RecordingPath,
+             GetLastError());
+  }
+  fwprintf(stdout,
+           L"{\"original_speed\":%ls,\"events\":%llu,"
+           L"\"skipped\":%llu,\"status_mismatches\":%llu,\"seconds\":%.3f,"
+           L"\"recorded_seconds\":%.3f,\"ops_per_sec\":%.1f}\n",
+           (Flags & DOKAN_REPLAY_ORIGINAL_SPEED) ? L"true" : L"false",
+           result.Events, result.Skipped, result.StatusMismatches,
+           result.ElapsedUs / 1e6, result.RecordedUs / 1e6,
+           result.ElapsedUs ? result.Events * 1e6 / result.ElapsedUs : 0);
+  fflush(stdout);
+  return success;
+}
+
+static BOOL ParseThreadCounts(LPCWSTR Value, PULONG ThreadCounts,
+                              PULONG Count) {
+  LPCWSTR current = Value;
+  *Count = 0;
+  while (*current) {
+    PWCHAR end;
+    ULONG threads = wcstoul(current, &end, 10);
+    if (end == current || threads > 256 ||
+        *Count == BENCH_MAX_THREAD_COUNTS) {
+      return FALSE;
+    }
+    ThreadCounts[(*Count)++] = threads;
+    current = *end == L',' ? end + 1 : end;
+    if (*end != L',' && *end != L'\0') {
+      return FALSE;
+    }
+  }
+  return *Count > 0;
+}
+
+static int ShowUsage() {
+  fprintf(stderr,
+          "dokan_bench [options]\n"
+          "\n"
+          "Mounts a null file system with each configuration and measures:\n"
+          "  echo, create_close, read_4k_random, read_1m_sequential,\n"
+          "  write_4k_random, write_1m_sequential, enumerate\n"
+          "\n"
+          "  /l MountPoint (ex. /l N)      Mount point, N:\\ by default.\n"
+          "  /d DurationMs (ex. /d 5000)   Time each workload runs.\n"
+          "  /c Clients (ex. /c 4)         Client threads issuing requests.\n"
+          "  /n Entries (ex. /n 10000)     Entries of the enumerated directory.\n"
+          "  /t Threads (ex. /t 0,4,16)    Pool thread counts of the matrix,\n"
+          "                                0 for the library default. Each is\n"
+          "                                run with and without IPC batching,\n"
+          "                                after a single thread run.\n"
+          "  /y                            Also run each configuration with\n"
+          "                                async operations.\n"
+          "  /w Workload                   Only run this workload.\n"
+          "  /f json|csv                   Output format, JSON lines by default.\n"
+          "  /e Recording                  Record the requests of the first\n"
+          "                                configuration to this file.\n"
+          "  /r Recording                  Replay a recording against the null\n"
+          "                                file system instead, as fast as\n"
+          "                                possible.\n"
+          "  /o                            Replay at the recorded pace.\n");
+  return EXIT_FAILURE;
+}
+
+int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
+  ULONG threadCounts[BENCH_MAX_THREAD_COUNTS] = {0, 4, 16};
+  ULONG threadCountCount = 3;
+  LPCWSTR replayPath = NULL;
+  ULONG replayFlags = 0;
+  BOOL success = TRUE;
+
+  for (ULONG command = 1; command < argc; command++) {
+    switch (towlower(argv[command][1])) {
+    case L'l':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      wcscpy_s(g_MountPoint, ARRAYSIZE(g_MountPoint), argv[command]);
+      break;
+    case L'd':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      g_DurationMs = wcstoul(argv[command], NULL, 10);
+      break;
+    case L'c':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      g_ClientCount = wcstoul(argv[command], NULL, 10);
+      if (g_ClientCount == 0 || g_ClientCount > BENCH_MAX_CLIENTS) {
+        return ShowUsage();
+      }
+      break;
+    case L'n':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      g_EntryCount = wcstoul(argv[command], NULL, 10);
+      if (g_EntryCount > NULLFS_MAX_ENTRY_COUNT) {
+        return ShowUsage();
+      }
+      break;
+    case L't':
+      command++;
+      if (command >= argc ||
+          !ParseThreadCounts(argv[command], threadCounts, &threadCountCount)) {
+        return ShowUsage();
+      }
+      break;
+    case L'w':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      g_WorkloadFilter = argv[command];
+      break;
+    case L'y':
+      g_AsyncOperations = TRUE;
+      break;
+    case L'e':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      g_RecordingPath = argv[command];
+      break;
+    case L'r':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      replayPath = argv[command];
+      break;
+    case L'o':
+      replayFlags |= DOKAN_REPLAY_ORIGINAL_SPEED;
+      break;
+    case L'f':
+      command++;
+      if (command >= argc) {
+        return ShowUsage();
+      }
+      if (_wcsicmp(argv[command], L"csv") == 0) {
+        g_OutputFormat = BENCH_OUTPUT_CSV;
+      } else if (_wcsicmp(argv[command], L"json") != 0) {
+        return ShowUsage();
+      }
+      break;
+    default:
+      return ShowUsage();
+    }
+  }
+
+  // A single letter is a drive.
+  if (wcslen(g_MountPoint) == 1) {
+    wcscat_s(g_MountPoint, ARRAYSIZE(g_MountPoint), L":\\");
+  } else if (g_MountPoint[wcslen(g_MountPoint) - 1] != L'\\') {
+    wcscat_s(g_MountPoint, ARRAYSIZE(g_MountPoint), L"\\");
+  }
+  swprintf_s(g_FilePath, ARRAYSIZE(g_FilePath), L"%lsfile", g_MountPoint);
+  swprintf_s(g_DirPattern, ARRAYSIZE(g_DirPattern), L"%lsdir\\*",
+             g_MountPoint);
+
+  QueryPerformanceFrequency(&g_Frequency);
+  g_StartEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  g_MountedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (!g_StartEvent || !g_MountedEvent) {
+    fwprintf(stderr, L"Failed to create events: %lu\n", GetLastError());
+    return EXIT_FAILURE;
+  }
+
+  NullFsInitialize(g_EntryCount, &g_Operations);
+  g_Operations.Mounted = BenchMounted;
+
+  DokanInit();
+  if (replayPath) {
+    success = ReplayRecording(replayPath, replayFlags);
+  } else {
+    PrintHeader();
+    success &= RunConfigs(TRUE, FALSE, 0);
+    for (ULONG i = 0; i < threadCountCount; ++i) {
+      success &= RunConfigs(FALSE, FALSE, threadCounts[i]);
+      success &= RunConfigs(FALSE, TRUE, threadCounts[i]);
+    }
+  }
+  DokanShutdown();
+
+  CloseHandle(g_StartEvent);
+  CloseHandle(g_MountedEvent);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -34,6 +34,8 @@ THE SOFTWARE.
 #include "../dokan/dokanc.h"
 #include <ShlObj.h>
 
+#include "stats.h"
+
 #define DOKAN_DRIVER_FULL_PATH                                                 \
   L"%SystemRoot%\\system32\\drivers\\dokan" DOKAN_MAJOR_API_VERSION L".sys"
 
@@ -44,6 +46,8 @@ int ShowUsage() {
           "dokanctl /i [d|n|a]\n"
           "dokanctl /r [d|n|a]\n"
           "dokanctl /v\n"
+          "dokanctl /s MountPoint [text|csv|json]\n"
+          "dokanctl /p MountPoint [reset]\n"
           "\n"
           "Example:\n"
           "  /u M                : Unmount M: drive\n"
@@ -54,7 +58,11 @@ int ShowUsage() {
           "  /r n                : Remove network provider\n"
           "  /l a                : List current mount points\n"
           "  /d [0-7]            : Enable Kernel Debug output\n"
-          "  /v                  : Print Dokan version\n");
+          "  /v                  : Print Dokan version\n"
+          "  /s M                : Show the request statistics of M: drive\n"
+          "  /s M json           : Same, as one JSON object per second\n"
+          "  /p M                : Show the processes and files sampled the\n"
+          "                        most on M: drive\n");
   return EXIT_FAILURE;
 }
 
@@ -131,9 +139,17 @@ int __cdecl wmain(int argc, PWCHAR argv[]) {
 
   ExpandEnvironmentStringsW(DOKAN_DRIVER_FULL_PATH, driverFullPath, MAX_PATH);
 
-  fwprintf(stdout, L"Driver path: '%ls'\n", driverFullPath);
-
   WCHAR option = GetOption(argc, argv, 1);
+  if (argc > 1 && _wcsicmp(argv[1], L"/stats") == 0) {
+    option = L's';
+  } else if (argc > 1 && _wcsicmp(argv[1], L"/profile") == 0) {
+    option = L'p';
+  }
+
+  // Statistics keep stdout for their CSV or JSON output.
+  if (option != L's') {
+    fwprintf(stdout, L"Driver path: '%ls'\n", driverFullPath);
+  }
   if (option == L'\0' || option == L'?') {
     return ShowUsage();
   }
@@ -228,6 +244,37 @@ int __cdecl wmain(int argc, PWCHAR argv[]) {
     DokanReleaseMountPointList(dokanMountPointInfo);
   } break;
 
+  case L's': {
+    STATS_FORMAT format = StatsFormatText;
+    if (argc < 3) {
+      return DefaultCaseOption();
+    }
+    if (argc > 3) {
+      if (_wcsicmp(argv[3], L"csv") == 0) {
+        format = StatsFormatCsv;
+      } else if (_wcsicmp(argv[3], L"json") == 0) {
+        format = StatsFormatJson;
+      } else if (_wcsicmp(argv[3], L"text") != 0) {
+        return DefaultCaseOption();
+      }
+    }
+    return ShowStats(argv[2], format);
+  }
+
+  case L'p': {
+    BOOL reset = FALSE;
+    if (argc < 3) {
+      return DefaultCaseOption();
+    }
+    if (argc > 3) {
+      if (_wcsicmp(argv[3], L"reset") != 0) {
+        return DefaultCaseOption();
+      }
+      reset = TRUE;
+    }
+    return ShowProfile(argv[2], reset);
+  }
+
   case L'v': {
     fprintf(stdout, "dokanctl : %s %s\n", __DATE__, __TIME__);
     fprintf(stdout, "Dokan version : %ld\n", DokanVersion());
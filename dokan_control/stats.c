@@ -0,0 +1,510 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../dokan/dokan.h"
+
+// "top" of a mounted volume from the metrics the driver keeps for it, see
+// FSCTL_GET_VOLUME_METRICS_EX. The metrics recorded by dokan.dll with
+// DokanGetInstanceMetrics belong to the file system process and are not
+// reachable from here; the user mode latency of the driver covers the same
+// time from the other side.
+
+#define STATS_INTERVAL_MS 1000
+
+static volatile LONG g_StatsStop = FALSE;
+
+static LPCWSTR g_MajorFunctionNames[DOKAN_METRICS_MAJOR_FUNCTION_COUNT] = {
+    L"Create",
+    L"CreateNamedPipe",
+    L"Close",
+    L"Read",
+    L"Write",
+    L"QueryInformation",
+    L"SetInformation",
+    L"QueryEa",
+    L"SetEa",
+    L"FlushBuffers",
+    L"QueryVolumeInformation",
+    L"SetVolumeInformation",
+    L"DirectoryControl",
+    L"FileSystemControl",
+    L"DeviceControl",
+    L"InternalDeviceControl",
+    L"Shutdown",
+    L"LockControl",
+    L"Cleanup",
+    L"CreateMailslot",
+    L"QuerySecurity",
+    L"SetSecurity",
+    L"Power",
+    L"SystemControl",
+    L"DeviceChange",
+    L"QueryQuota",
+    L"SetQuota",
+    L"Pnp",
+};
+
+static BOOL WINAPI StatsCtrlHandler(DWORD CtrlType) {
+  switch (CtrlType) {
+  case CTRL_C_EVENT:
+  case CTRL_BREAK_EVENT:
+  case CTRL_CLOSE_EVENT:
+    InterlockedExchange(&g_StatsStop, TRUE);
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+// Removes the \DosDevices\ or \??\ prefix and the trailing backslash of
+// MountPoint, and completes a lone drive letter, so that the mount points
+// given by the user and the ones listed by the driver compare equal.
+static VOID NormalizeMountPoint(LPCWSTR MountPoint, LPWSTR Result,
+                                size_t ResultMaxChars) {
+  static LPCWSTR prefixes[] = {L"\\DosDevices\\", L"\\??\\"};
+  size_t length;
+  for (ULONG i = 0; i < ARRAYSIZE(prefixes); ++i) {
+    size_t prefixLength = wcslen(prefixes[i]);
+    if (_wcsnicmp(MountPoint, prefixes[i], prefixLength) == 0) {
+      MountPoint += prefixLength;
+      break;
+    }
+  }
+  wcscpy_s(Result, ResultMaxChars, MountPoint);
+  length = wcslen(Result);
+  if (length > 1 && Result[length - 1] == L'\\') {
+    Result[--length] = L'\0';
+  }
+  if (length == 1 && length + 1 < ResultMaxChars) {
+    Result[1] = L':';
+    Result[2] = L'\0';
+  }
+}
+
+// Finds the device of the volume mounted on MountPoint.
+static BOOL GetMountPointDevice(LPCWSTR MountPoint, LPWSTR DeviceName,
+                                size_t DeviceNameMaxChars) {
+  WCHAR wanted[MAX_PATH];
+  WCHAR current[MAX_PATH];
+  ULONG count = 0;
+  BOOL found = FALSE;
+  PDOKAN_MOUNT_POINT_INFO mountPoints = DokanGetMountPointList(FALSE, &count);
+  if (!mountPoints) {
+    return FALSE;
+  }
+  NormalizeMountPoint(MountPoint, wanted, MAX_PATH);
+  for (ULONG i = 0; i < count && !found; ++i) {
+    NormalizeMountPoint(mountPoints[i].MountPoint, current, MAX_PATH);
+    if (_wcsicmp(wanted, current) == 0) {
+      wcscpy_s(DeviceName, DeviceNameMaxChars, L"\\\\.");
+      wcscat_s(DeviceName, DeviceNameMaxChars, mountPoints[i].DeviceName);
+      found = TRUE;
+    }
+  }
+  DokanReleaseMountPointList(mountPoints);
+  return found;
+}
+
+static BOOL QueryVolumeMetrics(HANDLE Device, PVOLUME_METRICS_EX Metrics) {
+  DWORD returnedLength = 0;
+  ZeroMemory(Metrics, sizeof(VOLUME_METRICS_EX));
+  return DeviceIoControl(Device, FSCTL_GET_VOLUME_METRICS_EX, NULL, 0, Metrics,
+                         sizeof(VOLUME_METRICS_EX), &returnedLength, NULL);
+}
+
+// Upper bound in microseconds of the Percentile of the requests counted by the
+// difference between two latency histograms, 0 if there were none.
+static ULONG64 GetLatencyPercentile(const ULONG64 *Current,
+                                    const ULONG64 *Previous,
+                                    double Percentile) {
+  ULONG64 total = 0;
+  ULONG64 seen = 0;
+  for (ULONG i = 0; i < DOKAN_LATENCY_BUCKET_COUNT; ++i) {
+    total += Current[i] - Previous[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  for (ULONG i = 0; i < DOKAN_LATENCY_BUCKET_COUNT; ++i) {
+    seen += Current[i] - Previous[i];
+    if ((double)seen >= Percentile * total) {
+      return 1ULL << i;
+    }
+  }
+  return 1ULL << (DOKAN_LATENCY_BUCKET_COUNT - 1);
+}
+
+static double GetRatio(ULONG64 Part, ULONG64 Total) {
+  return Total ? (double)Part / Total : 0;
+}
+
+// What is shown of a request kind for an interval.
+typedef struct _STATS_OPERATION {
+  LPCWSTR Name;
+  double RequestsPerSec;
+  double MiBPerSec;
+  ULONG64 P50Us;
+  ULONG64 P99Us;
+  ULONG64 UserModeP99Us;
+  ULONG64 QueuedP99Us;
+} STATS_OPERATION, *PSTATS_OPERATION;
+
+// What is shown of the volume for an interval.
+typedef struct _STATS_VOLUME {
+  ULONG64 QueuedEvents;
+  ULONG64 Fcbs;
+  ULONG64 FcbCacheCount;
+  ULONG64 FcbCacheBytes;
+  double FcbCacheHitRatio;
+  double EventContextHitRatio;
+  double IrpEntryHitRatio;
+  ULONG OperationCount;
+  STATS_OPERATION Operations[DOKAN_METRICS_MAJOR_FUNCTION_COUNT];
+} STATS_VOLUME, *PSTATS_VOLUME;
+
+static VOID ComputeStats(PVOLUME_METRICS_EX Current,
+                         PVOLUME_METRICS_EX Previous, double Seconds,
+                         PSTATS_VOLUME Stats) {
+  ULONG64 allocations = 0;
+  ULONG64 hits = 0;
+  ZeroMemory(Stats, sizeof(STATS_VOLUME));
+  Stats->QueuedEvents = Current->QueuedEvents;
+  Stats->Fcbs =
+      Current->Volume.FcbAllocations - Current->Volume.FcbDeletions;
+  Stats->FcbCacheCount = Current->FcbCache.Count;
+  Stats->FcbCacheBytes = Current->FcbCache.Bytes;
+  Stats->FcbCacheHitRatio = GetRatio(
+      Current->FcbCache.Hits - Previous->FcbCache.Hits,
+      Current->FcbCache.Hits - Previous->FcbCache.Hits +
+          Current->FcbCache.Misses - Previous->FcbCache.Misses);
+  for (ULONG i = 0; i < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT; ++i) {
+    allocations += Current->EventContextLookaside[i].Allocations -
+                   Previous->EventContextLookaside[i].Allocations;
+    hits += Current->EventContextLookaside[i].Hits -
+            Previous->EventContextLookaside[i].Hits;
+  }
+  allocations += Current->EventContextPoolAllocations -
+                 Previous->EventContextPoolAllocations;
+  Stats->EventContextHitRatio = GetRatio(hits, allocations);
+  Stats->IrpEntryHitRatio = GetRatio(
+      Current->IrpEntryLookaside.Hits - Previous->IrpEntryLookaside.Hits,
+      Current->IrpEntryLookaside.Allocations -
+          Previous->IrpEntryLookaside.Allocations);
+  for (ULONG i = 0;
+       i < min(Current->MajorFunctionCount, DOKAN_METRICS_MAJOR_FUNCTION_COUNT);
+       ++i) {
+    PDOKAN_OPERATION_METRICS current = &Current->Operations[i];
+    PDOKAN_OPERATION_METRICS previous = &Previous->Operations[i];
+    PSTATS_OPERATION operation;
+    if (current->Requests == previous->Requests) {
+      continue;
+    }
+    operation = &Stats->Operations[Stats->OperationCount++];
+    operation->Name = g_MajorFunctionNames[i];
+    operation->RequestsPerSec =
+        (current->Requests - previous->Requests) / Seconds;
+    operation->MiBPerSec =
+        (current->Bytes - previous->Bytes) / Seconds / (1024 * 1024);
+    operation->P50Us = GetLatencyPercentile(current->TotalLatency,
+                                            previous->TotalLatency, 0.5);
+    operation->P99Us = GetLatencyPercentile(current->TotalLatency,
+                                            previous->TotalLatency, 0.99);
+    operation->UserModeP99Us = GetLatencyPercentile(
+        current->UserModeLatency, previous->UserModeLatency, 0.99);
+    operation->QueuedP99Us = GetLatencyPercentile(
+        current->QueuedLatency, previous->QueuedLatency, 0.99);
+  }
+}
+
+static VOID ClearConsole() {
+  HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+  CONSOLE_SCREEN_BUFFER_INFO info;
+  COORD origin = {0, 0};
+  DWORD written;
+  if (!GetConsoleScreenBufferInfo(console, &info)) {
+    // Not a console, keep appending.
+    fwprintf(stdout, L"\n");
+    return;
+  }
+  FillConsoleOutputCharacterW(console, L' ', info.dwSize.X * info.dwSize.Y,
+                              origin, &written);
+  FillConsoleOutputAttribute(console, info.wAttributes,
+                             info.dwSize.X * info.dwSize.Y, origin, &written);
+  SetConsoleCursorPosition(console, origin);
+}
+
+static VOID PrintStatsText(LPCWSTR MountPoint, PSTATS_VOLUME Stats) {
+  ClearConsole();
+  fwprintf(stdout,
+           L"Dokan volume %ls - refreshed every %d ms, Ctrl+C to quit\n\n",
+           MountPoint, STATS_INTERVAL_MS);
+  fwprintf(stdout,
+           L"Queued requests: %llu  FCBs: %llu  FCB cache: %llu (%llu KB, "
+           L"%.1f%% hits)\n",
+           Stats->QueuedEvents, Stats->Fcbs, Stats->FcbCacheCount,
+           Stats->FcbCacheBytes / 1024, Stats->FcbCacheHitRatio * 100);
+  fwprintf(stdout,
+           L"Lookaside hits: event contexts %.1f%%  IRP entries %.1f%%\n\n",
+           Stats->EventContextHitRatio * 100, Stats->IrpEntryHitRatio * 100);
+  fwprintf(stdout, L"%-24ls %10ls %10ls %10ls %10ls %10ls %10ls\n",
+           L"Operation", L"req/s", L"MiB/s", L"p50 us", L"p99 us",
+           L"user p99", L"queue p99");
+  for (ULONG i = 0; i < Stats->OperationCount; ++i) {
+    PSTATS_OPERATION operation = &Stats->Operations[i];
+    fwprintf(stdout, L"%-24ls %10.0f %10.2f %10llu %10llu %10llu %10llu\n",
+             operation->Name, operation->RequestsPerSec, operation->MiBPerSec,
+             operation->P50Us, operation->P99Us, operation->UserModeP99Us,
+             operation->QueuedP99Us);
+  }
+  fflush(stdout);
+}
+
+static VOID PrintStatsCsv(ULONG64 TimeMs, PSTATS_VOLUME Stats) {
+  for (ULONG i = 0; i < Stats->OperationCount; ++i) {
+    PSTATS_OPERATION operation = &Stats->Operations[i];
+    fwprintf(stdout,
+             L"%llu,%ls,%.1f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.4f,"
+             L"%.4f,%.4f\n",
+             TimeMs, operation->Name, operation->RequestsPerSec,
+             operation->MiBPerSec, operation->P50Us, operation->P99Us,
+             operation->UserModeP99Us, operation->QueuedP99Us,
+             Stats->QueuedEvents, Stats->Fcbs, Stats->FcbCacheCount,
+             Stats->FcbCacheHitRatio, Stats->EventContextHitRatio,
+             Stats->IrpEntryHitRatio);
+  }
+  fflush(stdout);
+}
+
+static VOID PrintJsonString(LPCWSTR Value) {
+  fputwc(L'"', stdout);
+  for (; *Value; ++Value) {
+    if (*Value == L'"' || *Value == L'\\') {
+      fputwc(L'\\', stdout);
+    }
+    fputwc(*Value, stdout);
+  }
+  fputwc(L'"', stdout);
+}
+
+static VOID PrintStatsJson(ULONG64 TimeMs, LPCWSTR MountPoint,
+                           PSTATS_VOLUME Stats) {
+  fwprintf(stdout, L"{\"time_ms\":%llu,\"mount_point\":", TimeMs);
+  PrintJsonString(MountPoint);
+  fwprintf(stdout,
+           L",\"queued_events\":%llu,\"fcbs\":%llu,\"fcb_cache_count\":%llu,"
+           L"\"fcb_cache_bytes\":%llu,\"fcb_cache_hit_ratio\":%.4f,"
+           L"\"event_context_hit_ratio\":%.4f,\"irp_entry_hit_ratio\":%.4f,"
+           L"\"operations\":[",
+           Stats->QueuedEvents, Stats->Fcbs, Stats->FcbCacheCount,
+           Stats->FcbCacheBytes, Stats->FcbCacheHitRatio,
+           Stats->EventContextHitRatio, Stats->IrpEntryHitRatio);
+  for (ULONG i = 0; i < Stats->OperationCount; ++i) {
+    PSTATS_OPERATION operation = &Stats->Operations[i];
+    fwprintf(stdout,
+             L"%ls{\"name\":\"%ls\",\"requests_per_sec\":%.1f,"
+             L"\"mib_per_sec\":%.3f,\"p50_us\":%llu,\"p99_us\":%llu,"
+             L"\"user_mode_p99_us\":%llu,\"queued_p99_us\":%llu}",
+             i ? L"," : L"", operation->Name, operation->RequestsPerSec,
+             operation->MiBPerSec, operation->P50Us, operation->P99Us,
+             operation->UserModeP99Us, operation->QueuedP99Us);
+  }
+  fwprintf(stdout, L"]}\n");
+  fflush(stdout);
+}
+
+int ShowStats(LPCWSTR MountPoint, STATS_FORMAT Format) {
+  WCHAR deviceName[MAX_PATH];
+  HANDLE device;
+  VOLUME_METRICS_EX metrics[2];
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER start;
+  LARGE_INTEGER times[2];
+  ULONG current = 0;
+
+  if (!GetMountPointDevice(MountPoint, deviceName, MAX_PATH)) {
+    fwprintf(stderr, L"No Dokan volume is mounted on %ls\n", MountPoint);
+    return EXIT_FAILURE;
+  }
+  device = CreateFileW(deviceName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                       OPEN_EXISTING, 0, NULL);
+  if (device == INVALID_HANDLE_VALUE) {
+    fwprintf(stderr, L"Cannot open %ls: %lu\n", deviceName, GetLastError());
+    return EXIT_FAILURE;
+  }
+  if (!QueryVolumeMetrics(device, &metrics[current])) {
+    fwprintf(stderr, L"Cannot get the metrics of %ls: %lu\n", MountPoint,
+             GetLastError());
+    CloseHandle(device);
+    return EXIT_FAILURE;
+  }
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&start);
+  times[current] = start;
+  SetConsoleCtrlHandler(StatsCtrlHandler, TRUE);
+  if (Format == StatsFormatCsv) {
+    fwprintf(stdout,
+             L"time_ms,operation,requests_per_sec,mib_per_sec,p50_us,p99_us,"
+             L"user_mode_p99_us,queued_p99_us,queued_events,fcbs,"
+             L"fcb_cache_count,fcb_cache_hit_ratio,event_context_hit_ratio,"
+             L"irp_entry_hit_ratio\n");
+  }
+  while (!g_StatsStop) {
+    STATS_VOLUME stats;
+    ULONG previous = current;
+    ULONG64 timeMs;
+    Sleep(STATS_INTERVAL_MS);
+    current = 1 - current;
+    if (!QueryVolumeMetrics(device, &metrics[current])) {
+      // The volume was unmounted.
+      fwprintf(stderr, L"Cannot get the metrics of %ls: %lu\n", MountPoint,
+               GetLastError());
+      break;
+    }
+    QueryPerformanceCounter(&times[current]);
+    ComputeStats(&metrics[current], &metrics[previous],
+                 (double)(times[current].QuadPart - times[previous].QuadPart) /
+                     frequency.QuadPart,
+                 &stats);
+    timeMs = (times[current].QuadPart - start.QuadPart) * 1000 /
+             frequency.QuadPart;
+    switch (Format) {
+    case StatsFormatCsv:
+      PrintStatsCsv(timeMs, &stats);
+      break;
+    case StatsFormatJson:
+      PrintStatsJson(timeMs, MountPoint, &stats);
+      break;
+    default:
+      PrintStatsText(MountPoint, &stats);
+      break;
+    }
+  }
+  SetConsoleCtrlHandler(StatsCtrlHandler, FALSE);
+  CloseHandle(device);
+  return EXIT_SUCCESS;
+}
+
+// Sorts the used entries by decreasing samples and returns their count.
+static ULONG SortProfileEntries(PDOKAN_PROFILE_ENTRY Entries,
+                                PDOKAN_PROFILE_ENTRY Sorted[]) {
+  ULONG count = 0;
+  for (ULONG i = 0; i < DOKAN_PROFILE_TOP_COUNT; ++i) {
+    ULONG j = count;
+    if (Entries[i].Samples == 0) {
+      continue;
+    }
+    ++count;
+    for (; j > 0 && Sorted[j - 1]->Samples < Entries[i].Samples; --j) {
+      Sorted[j] = Sorted[j - 1];
+    }
+    Sorted[j] = &Entries[i];
+  }
+  return count;
+}
+
+static VOID PrintMajorFunctions(ULONG MajorFunctions) {
+  BOOL first = TRUE;
+  for (ULONG i = 0; i < DOKAN_METRICS_MAJOR_FUNCTION_COUNT; ++i) {
+    if (MajorFunctions & (1 << i)) {
+      fwprintf(stdout, L"%ls%ls", first ? L"" : L",", g_MajorFunctionNames[i]);
+      first = FALSE;
+    }
+  }
+}
+
+static VOID PrintProfileEntries(LPCWSTR Title, PDOKAN_PROFILE_ENTRY Entries,
+                                ULONG64 TotalSamples) {
+  PDOKAN_PROFILE_ENTRY sorted[DOKAN_PROFILE_TOP_COUNT];
+  ULONG count = SortProfileEntries(Entries, sorted);
+
+  fwprintf(stdout, L"\n%ls\n%10ls %8ls %8ls %10ls %8ls  %ls\n", Title,
+           L"samples", L"share", L"error", L"avg us", L"pid",
+           L"operations / file");
+  for (ULONG i = 0; i < count; ++i) {
+    PDOKAN_PROFILE_ENTRY entry = sorted[i];
+    fwprintf(stdout, L"%10llu %7.1f%% %8llu %10llu %8lu  ", entry->Samples,
+             GetRatio(entry->Samples, TotalSamples) * 100, entry->Error,
+             entry->TotalLatency / (entry->Samples - entry->Error),
+             entry->ProcessId);
+    PrintMajorFunctions(entry->MajorFunctions);
+    if (entry->FileNameLength > 0) {
+      fwprintf(stdout, L" %.*ls",
+               (int)(entry->FileNameLength / sizeof(WCHAR)), entry->FileName);
+    }
+    fwprintf(stdout, L"\n");
+  }
+}
+
+int ShowProfile(LPCWSTR MountPoint, BOOL Reset) {
+  WCHAR deviceName[MAX_PATH];
+  HANDLE device;
+  ULONG flags = Reset ? DOKAN_PROFILE_RESET : 0;
+  DWORD returnedLength = 0;
+  PDOKAN_VOLUME_PROFILE profile;
+  BOOL result;
+
+  if (!GetMountPointDevice(MountPoint, deviceName, MAX_PATH)) {
+    fwprintf(stderr, L"No Dokan volume is mounted on %ls\n", MountPoint);
+    return EXIT_FAILURE;
+  }
+  device = CreateFileW(deviceName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                       OPEN_EXISTING, 0, NULL);
+  if (device == INVALID_HANDLE_VALUE) {
+    fwprintf(stderr, L"Cannot open %ls: %lu\n", deviceName, GetLastError());
+    return EXIT_FAILURE;
+  }
+  profile = malloc(sizeof(DOKAN_VOLUME_PROFILE));
+  if (profile == NULL) {
+    CloseHandle(device);
+    return EXIT_FAILURE;
+  }
+  result = DeviceIoControl(device, FSCTL_GET_VOLUME_PROFILE, &flags,
+                           sizeof(flags), profile, sizeof(DOKAN_VOLUME_PROFILE),
+                           &returnedLength, NULL);
+  CloseHandle(device);
+  if (!result) {
+    fwprintf(stderr, L"Cannot get the profile of %ls: %lu\n", MountPoint,
+             GetLastError());
+    free(profile);
+    return EXIT_FAILURE;
+  }
+  if (profile->SampleRate == 0) {
+    fwprintf(stdout, L"Dokan volume %ls is not profiled\n", MountPoint);
+  } else {
+    fwprintf(stdout,
+             L"Dokan volume %ls - %llu samples, one per %lu requests\n",
+             MountPoint, profile->Samples, profile->SampleRate);
+    PrintProfileEntries(L"Processes", profile->Processes, profile->Samples);
+    PrintProfileEntries(L"Files", profile->Files, profile->Samples);
+  }
+  free(profile);
+  return EXIT_SUCCESS;
+}
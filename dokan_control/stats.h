@@ -0,0 +1,46 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef DOKANCTL_STATS_H_
+#define DOKANCTL_STATS_H_
+
+#include <windows.h>
+
+typedef enum _STATS_FORMAT {
+  StatsFormatText,
+  StatsFormatCsv,
+  StatsFormatJson,
+} STATS_FORMAT;
+
+// Shows the request statistics of the Dokan volume mounted on MountPoint,
+// refreshed every second until Ctrl+C.
+int ShowStats(LPCWSTR MountPoint, STATS_FORMAT Format);
+
+// Shows the processes and the files sampled the most on the Dokan volume
+// mounted on MountPoint, and clears them if Reset is set.
+int ShowProfile(LPCWSTR MountPoint, BOOL Reset);
+
+#endif // DOKANCTL_STATS_H_
@@ -39,6 +39,10 @@ struct fuse_config
   unsigned long allocationUnitSize;
   unsigned long sectorSize;
   unsigned long max_read;
+  double attr_timeout;
+  double entry_timeout;
+  unsigned long max_threads;
+  unsigned long max_idle_threads;
 };
 
 struct fuse_session
@@ -81,6 +85,7 @@ struct fuse
 
 	struct fuse_operations ops;
 	void *user_data;
+	std::unique_ptr<impl_lowlevel> lowlevel; // Set by fuse_lowlevel_new()
 
 	fuse() : within_loop(), user_data()
 	{
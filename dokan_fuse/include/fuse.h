@@ -451,6 +451,39 @@ struct fuse_operations {
 	int (*win_set_attributes) (const char *fn, uint32_t attr);
 	int (*win_set_times) (const char *fn, struct fuse_file_info *, const FILETIME *create, const FILETIME *access, const FILETIME *modified);
 #endif
+
+	/**
+	 * Write contents of buffer to an open file
+	 *
+	 * Similar to the write() method, but data is supplied in a
+	 * generic buffer.  Use fuse_buf_copy() to transfer data to
+	 * the destination.
+	 *
+	 * Introduced in version 2.9
+	 */
+	int (*write_buf) (const char *, struct fuse_bufvec *buf, FUSE_OFF_T off,
+			  struct fuse_file_info *);
+
+	/**
+	 * Store data from an open file in a buffer
+	 *
+	 * Similar to the read() method, but data is stored and
+	 * returned in a generic buffer.
+	 *
+	 * No actual copying of data has to take place, the source
+	 * file descriptor may simply be stored in the buffer for
+	 * later data transfer.  Dokan then reads from that descriptor
+	 * straight into the buffer of the request.
+	 *
+	 * The buffer must be allocated dynamically and stored at the
+	 * location pointed to by bufp.  If the buffer contains memory
+	 * regions, they too must be allocated using malloc().  The
+	 * allocated memory will be freed by the caller.
+	 *
+	 * Introduced in version 2.9
+	 */
+	int (*read_buf) (const char *, struct fuse_bufvec **bufp,
+			 size_t size, FUSE_OFF_T off, struct fuse_file_info *);
 };
 
 /** Extra context that may be needed by some filesystems
@@ -473,6 +506,12 @@ struct fuse_context {
 
 	/** Private filesystem data */
 	void *private_data;
+
+#ifdef _WIN32
+	/** Worker threads currently running a filesystem operation,
+	    including the caller.  See the max_threads option */
+	unsigned int active_threads;
+#endif
 };
 
 /**
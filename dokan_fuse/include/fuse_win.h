@@ -112,6 +112,7 @@ typedef struct timespec timestruc_t;
 typedef unsigned int mode_t;
 typedef unsigned short nlink_t;
 typedef unsigned int pid_t;
+typedef SSIZE_T ssize_t;
 typedef unsigned int gid_t;
 typedef unsigned int uid_t;
 typedef unsigned int blksize_t;
@@ -3,14 +3,21 @@
 
 #include "../../dokan/dokan.h"
 #include "fuse.h"
+#include "fuse_lowlevel.h"
 #include "utils.h"
 #include <string>
 #include <vector>
 #include <memory>
 #include <map>
+#include <unordered_map>
 
 #define CHECKED(arg) if (0);else {int __res=arg; if (__res<0) return __res;}
 #define MAX_READ_SIZE (65536)
+#define MAX_ATTR_CACHE_ENTRIES (65536)
+#define MAX_LINK_CACHE_ENTRIES (65536)
+#define FILE_LOCKS_SHARDS (32)
+#define MAX_LOOKUP_CACHE_ENTRIES (65536)
+#define LOWLEVEL_READDIR_SIZE (65536)
 
 class impl_fuse_context;
 struct impl_chain_link;
@@ -18,20 +25,164 @@ struct impl_chain_link;
 class impl_file_handle;
 class impl_file_lock;
 
+/*
+	Open files by name, split in shards picked by the hash of the name so
+	that opens of unrelated files do not wait on each other. Each
+	impl_file_lock remembers the hash of its name.
+*/
 class impl_file_locks
 {
 private:
-	typedef std::map<std::string, impl_file_lock *> file_locks_t;
-	file_locks_t file_locks;
-	CRITICAL_SECTION lock;
+	typedef std::unordered_map<std::string, impl_file_lock *> file_locks_t;
+	struct shard
+	{
+		file_locks_t file_locks;
+		CRITICAL_SECTION lock;
+	};
+	shard shards[FILE_LOCKS_SHARDS];
+
+	shard &shard_for(size_t hash) { return shards[hash % FILE_LOCKS_SHARDS]; }
 public:
-	impl_file_locks() { InitializeCriticalSection(&lock); }
-	~impl_file_locks() { DeleteCriticalSection(&lock); };
+	impl_file_locks();
+	~impl_file_locks();
 	impl_file_locks(impl_file_locks &other) = delete;
 	impl_file_locks &operator=(const impl_file_locks &other) = delete;
+	static size_t hash_name(const std::string &name) { return std::hash<std::string>()(name); }
 	int get_file(const std::string &name, bool is_dir, DWORD access_mode, DWORD shared_mode, std::unique_ptr<impl_file_handle>& out);
 	void renamed_file(const std::string &name,const std::string &new_name);
-	void remove_file(const std::string& name);
+	void remove_file(const std::string& name, size_t hash);
+};
+
+/*
+	Attributes reported by the readdir filler, kept for attr_timeout so
+	that the opens and stats following a listing do not call getattr
+	again for every entry.
+*/
+class impl_attr_cache
+{
+private:
+	struct entry
+	{
+		struct FUSE_STAT st;
+		ULONGLONG expires;
+	};
+	typedef std::map<std::string, entry> entries_t;
+	entries_t entries;
+	ULONGLONG timeout_ms;
+	CRITICAL_SECTION lock;
+
+	void purge_expired_unlocked(ULONGLONG now);
+public:
+	impl_attr_cache(double attr_timeout);
+	~impl_attr_cache() { DeleteCriticalSection(&lock); };
+	impl_attr_cache(impl_attr_cache &other) = delete;
+	impl_attr_cache &operator=(const impl_attr_cache &other) = delete;
+	bool enabled() const { return timeout_ms != 0; }
+	void put(const std::string &name, const struct FUSE_STAT &st);
+	bool get(const std::string &name, struct FUSE_STAT *st);
+	void forget(const std::string &name);
+	void forget_subtree(const std::string &name);
+};
+
+/*
+	Symlink resolution kept for entry_timeout: the target of each link,
+	and a negative entry for names known not to be links, so that opens
+	through deep symlinked trees do not call getattr and readlink on
+	every component each time.
+*/
+class impl_link_cache
+{
+private:
+	struct entry
+	{
+		bool is_link;
+		std::string target;
+		ULONGLONG expires;
+	};
+	typedef std::map<std::string, entry> entries_t;
+	entries_t entries;
+	ULONGLONG timeout_ms;
+	CRITICAL_SECTION lock;
+
+	void put(const std::string &name, bool is_link, const std::string &target);
+	void purge_expired_unlocked(ULONGLONG now);
+public:
+	impl_link_cache(double entry_timeout);
+	~impl_link_cache() { DeleteCriticalSection(&lock); };
+	impl_link_cache(impl_link_cache &other) = delete;
+	impl_link_cache &operator=(const impl_link_cache &other) = delete;
+	bool enabled() const { return timeout_ms != 0; }
+	void put_link(const std::string &name, const std::string &target) { put(name, true, target); }
+	void put_not_link(const std::string &name) { put(name, false, std::string()); }
+	bool get(const std::string &name, bool *is_link, std::string *target);
+	void forget(const std::string &name);
+	void forget_subtree(const std::string &name);
+};
+
+/*
+	Runs fuse_lowlevel_ops behind the path based fuse_operations the
+	bridge calls. Names map to inodes for the entry_timeout of their
+	lookup and inodes keep their attributes for attr_timeout. An inode
+	is forgotten, with all its lookups, once no cached name and no open
+	file refer to it anymore.
+*/
+class impl_lowlevel
+{
+public:
+	// What the fh of a file opened through the bridge points to
+	struct open_file
+	{
+		fuse_ino_t ino;
+		uint64_t fh;
+	};
+private:
+	struct name_entry
+	{
+		fuse_ino_t ino; // 0 for a negative entry
+		ULONGLONG expires;
+	};
+	struct inode_entry
+	{
+		unsigned long nlookup;
+		unsigned long refs; // cached names and open files
+		struct FUSE_STAT attr;
+		ULONGLONG attr_expires;
+	};
+	typedef std::map<std::string, name_entry> names_t;
+	typedef std::unordered_map<fuse_ino_t, inode_entry> inodes_t;
+	typedef std::vector<std::pair<fuse_ino_t, unsigned long> > forgets_t;
+
+	struct fuse_lowlevel_ops ops_;
+	void *userdata_;
+	names_t names;
+	inodes_t inodes;
+	CRITICAL_SECTION lock;
+
+	void unref_unlocked(fuse_ino_t ino, forgets_t *forgets);
+	void erase_unlocked(names_t::iterator first, names_t::iterator last, forgets_t *forgets);
+	void purge_expired_unlocked(ULONGLONG now, forgets_t *forgets);
+	void forget(const forgets_t &forgets);
+	int lookup(fuse_ino_t parent, const std::string &name, const std::string &base, fuse_ino_t *ino, bool pin);
+public:
+	impl_lowlevel(const struct fuse_lowlevel_ops *ops, size_t op_size, void *userdata);
+	~impl_lowlevel() { DeleteCriticalSection(&lock); };
+	impl_lowlevel(impl_lowlevel &other) = delete;
+	impl_lowlevel &operator=(const impl_lowlevel &other) = delete;
+
+	const struct fuse_lowlevel_ops &ops() const { return ops_; }
+	void *userdata() const { return userdata_; }
+	struct fuse_operations make_operations() const;
+
+	int resolve(const std::string &name, fuse_ino_t *ino, bool pin = false);
+	int resolve_parent(const std::string &name, fuse_ino_t *parent, std::string *base);
+	void remember(const std::string &name, const struct fuse_entry_param &e, bool pin);
+	void unpin(fuse_ino_t ino);
+	void forget_name(const std::string &name);
+	void forget_subtree(const std::string &name);
+
+	bool get_attr(fuse_ino_t ino, struct FUSE_STAT *st);
+	void set_attr(fuse_ino_t ino, const struct FUSE_STAT &st, double attr_timeout);
+	void invalidate_attr(fuse_ino_t ino);
 };
 
 struct impl_chain_link
@@ -49,6 +200,7 @@ struct impl_chain_link
 class impl_chain_guard
 {
 	impl_chain_link link;
+	impl_fuse_context *counted_; // Set on the outermost frame of the thread
 public:
 	impl_chain_guard(impl_fuse_context* ctx, int caller_pid);
 	~impl_chain_guard();
@@ -84,12 +236,16 @@ class impl_fuse_context
 	unsigned long max_read_;
 
 	impl_file_locks file_locks;
+	impl_attr_cache attr_cache_;
+	impl_link_cache link_cache_;
+	volatile LONG active_threads_;
 public:
 	impl_fuse_context(fuse *fuse, const struct fuse_operations *ops,
 			void *user_data, bool debug, unsigned int filemask,
 			unsigned int dirmask, const char *fsname,
 			const char *volname, const char *uncname,
-			unsigned long max_read);
+			unsigned long max_read, double attr_timeout,
+			double entry_timeout);
 
 	bool debug() const {return debug_;}
 
@@ -109,6 +265,8 @@ public:
 
     static int convert_flags(DWORD Flags);
 
+	int cached_getattr(const std::string &name, struct FUSE_STAT *stbuf);
+
 	int resolve_symlink(const std::string &name, std::string *res);
 	int check_and_resolve(std::string *name);
 
@@ -124,6 +282,12 @@ public:
 		PFillFindData delegate = nullptr;
 		PWalkDirectoryWithSetFuseContext delegateSetFuseContext = nullptr;
 		std::vector<std::string> getdir_data; //Used only in walk_directory_getdir()
+		// Used only by find_files_with_cursor()
+		PFillDirectoryEntry cursor_delegate = nullptr;
+		ULONG skip = 0; // Entries still to pass over before the start index
+		ULONG index = 0; // Position of the next entry in the listing
+		FUSE_OFF_T offset = 0; // readdir offset of the next entry, 0 if unknown
+		bool full = false; // The reply is full
 	};
 	static int walk_directory(void *buf, const char *name,
 		const struct FUSE_STAT *stbuf, FUSE_OFF_T off);
@@ -139,6 +303,14 @@ public:
         PWalkDirectoryWithSetFuseContext walk_set_fuse_context,
 		PDOKAN_FILE_INFO dokan_file_info);
 
+	// Lists the directory from start_index, resuming readdir at the offset
+	// the previous call on the handle stopped at when the file system gives
+	// offsets. Returns -ENOSYS without readdir.
+	int find_files_with_cursor(LPCWSTR file_name, ULONG start_index,
+		PFillDirectoryEntry fill_directory_entry,
+		PWalkDirectoryWithSetFuseContext walk_set_fuse_context,
+		PDOKAN_FILE_INFO dokan_file_info);
+
 	int open_directory(LPCWSTR file_name, PDOKAN_FILE_INFO dokan_file_info);
 
 	int cleanup(LPCWSTR file_name, PDOKAN_FILE_INFO dokan_file_info);
@@ -210,6 +382,7 @@ class impl_file_lock
 	friend class impl_file_handle;
 	friend class impl_file_locks;
 	std::string name_;
+	size_t hash_;
 	impl_file_locks* locks;
 	impl_file_handle *first;
 	CRITICAL_SECTION lock;
@@ -218,7 +391,7 @@ class impl_file_lock
 	int lock_file(impl_file_handle *file, long long start, long long len, bool mark=true);
 	int unlock_file(impl_file_handle *file, long long start, long long len);
 public:
-	impl_file_lock(impl_file_locks* _locks, const std::string& name): name_(name), locks(_locks), first(nullptr) { InitializeCriticalSection(&lock); }
+	impl_file_lock(impl_file_locks* _locks, const std::string& name, size_t hash): name_(name), hash_(hash), locks(_locks), first(nullptr) { InitializeCriticalSection(&lock); }
 	~impl_file_lock() { DeleteCriticalSection(&lock); };
 	impl_file_lock(impl_file_lock &other) = delete;
 	impl_file_lock &operator=(const impl_file_lock &other) = delete;
@@ -237,6 +410,10 @@ class impl_file_handle
 	impl_file_handle *next_file;
 	impl_file_lock *file_lock;
 	DWORD shared_mode_;
+	// Position in the listing and readdir offset the last
+	// find_files_with_cursor() stopped at
+	ULONG readdir_index_;
+	FUSE_OFF_T readdir_offset_;
 	typedef std::map<long long, long long> locks_t;
 	locks_t locks;
 	impl_file_handle(bool is_dir, DWORD shared_mode);
@@ -255,6 +432,8 @@ public:
 	int check_lock(long long start, long long len) { return file_lock->lock_file(this, start, len, false); }
 	int lock(long long start, long long len) { return file_lock->lock_file(this, start, len); }
 	int unlock(long long start, long long len) { return file_lock->unlock_file(this, start, len); }
+	FUSE_OFF_T readdir_offset(ULONG index) const { return index == readdir_index_ ? readdir_offset_ : 0; }
+	void set_readdir_cursor(ULONG index, FUSE_OFF_T offset) { readdir_index_ = index; readdir_offset_ = offset; };
 };
 
 #endif // FUSEMAIN_H_
@@ -12,6 +12,7 @@ extern "C" {
 #endif
 void utf8_to_wchar_buf_old(const char *src, wchar_t *res, int maxlen);
 int utf8_to_wchar_buf(const char *src, wchar_t *res, int maxlen);
+int wchar_to_unix_utf8_buf(const wchar_t *src, char *res, int maxlen);
 
 FILETIME unixTimeToFiletime(time_t t);
 time_t filetimeToUnixTime(const FILETIME *ft);
@@ -24,6 +25,7 @@ bool is_filetime_set(const FILETIME *ft);
 std::string wchar_to_utf8_cstr(const wchar_t *str);
 
 std::string unixify(const std::string &str);
+std::string unixify_wchar(const wchar_t *str);
 std::string extract_file_name(const std::string &str);
 std::string extract_dir_name(const std::string &str);
 
@@ -58,6 +58,26 @@ FuseFindFiles(LPCWSTR FileName,
       impl->find_files(FileName, FillFindData, &WalkDirectoryWithSetFuseContext, DokanFileInfo));
 }
 
+static NTSTATUS DOKAN_CALLBACK
+FuseFindFilesWithCursor(LPCWSTR PathName, LPCWSTR SearchPattern,
+                        ULONG StartIndex, LPCWSTR LastFileName,
+                        PFillDirectoryEntry FillDirectoryEntry,
+                        PDOKAN_FILE_INFO DokanFileInfo) {
+  impl_fuse_context *impl = the_impl;
+  if (impl->debug())
+    FPRINTF(stderr, "FindFilesWithCursor: %ls from %lu\n", PathName,
+            StartIndex);
+
+  impl_chain_guard guard(impl, DokanFileInfo->ProcessId);
+  int res = impl->find_files_with_cursor(PathName, StartIndex,
+                                         FillDirectoryEntry,
+                                         &WalkDirectoryWithSetFuseContext,
+                                         DokanFileInfo);
+  if (res == -ENOSYS)
+    return STATUS_NOT_IMPLEMENTED;
+  return errno_to_ntstatus_error(res);
+}
+
 static void DOKAN_CALLBACK FuseCleanup(LPCWSTR FileName,
                                        PDOKAN_FILE_INFO DokanFileInfo) {
   impl_fuse_context *impl = the_impl;
@@ -474,6 +494,8 @@ static DOKAN_OPERATIONS dokanOperations = {
     FuseUnmounted,
     nullptr, // GetFileSecurity
     nullptr, // SetFileSecurity
+    nullptr, // FindStreams
+    FuseFindFilesWithCursor,
 };
 
 int do_fuse_loop(struct fuse *fs, bool mt) {
@@ -493,7 +515,8 @@ int do_fuse_loop(struct fuse *fs, bool mt) {
 
   impl_fuse_context impl(fs, &fs->ops, fs->user_data, fs->conf.debug != 0,
                          fileumask, dirumask, fs->conf.fsname, fs->conf.volname,
-                         fs->conf.uncname, fs->conf.max_read);
+                         fs->conf.uncname, fs->conf.max_read,
+                         fs->conf.attr_timeout, fs->conf.entry_timeout);
 
   // Parse Dokan options
   PDOKAN_OPTIONS dokanOptions = static_cast<PDOKAN_OPTIONS>(malloc(sizeof(DOKAN_OPTIONS)));
@@ -528,6 +551,17 @@ int do_fuse_loop(struct fuse *fs, bool mt) {
   dokanOptions->Version = DOKAN_VERSION;
   dokanOptions->MountPoint = mount;
   dokanOptions->SingleThread = !mt;
+  // Ignored by Dokan for a single threaded loop. Dokan raises MaxThreads to
+  // MinThreads, so bound the idle threads to keep max_threads a hard limit
+  ULONG maxIdleThreads = fs->conf.max_idle_threads;
+  if (fs->conf.max_threads) {
+    if (maxIdleThreads == 0)
+      maxIdleThreads = FUSE_THREAD_COUNT; // Same default as libfuse
+    if (maxIdleThreads > fs->conf.max_threads)
+      maxIdleThreads = fs->conf.max_threads;
+  }
+  dokanOptions->MinThreads = maxIdleThreads;
+  dokanOptions->MaxThreads = fs->conf.max_threads;
   dokanOptions->Timeout = fs->conf.timeoutInSec * 1000;
   dokanOptions->AllocationUnitSize = fs->conf.allocationUnitSize;
   dokanOptions->SectorSize = fs->conf.sectorSize;
@@ -622,6 +656,10 @@ static const struct fuse_opt fuse_lib_opts[] = {
     FUSE_LIB_OPT("alloc_unit_size=%lu", allocationUnitSize, 0),
     FUSE_LIB_OPT("sector_size=%lu", sectorSize, 0),
     FUSE_LIB_OPT("max_read=%lu", max_read, MAX_READ_SIZE),
+    FUSE_LIB_OPT("attr_timeout=%lf", attr_timeout, 0),
+    FUSE_LIB_OPT("entry_timeout=%lf", entry_timeout, 0),
+    FUSE_LIB_OPT("max_threads=%lu", max_threads, 0),
+    FUSE_LIB_OPT("max_idle_threads=%lu", max_idle_threads, 0),
     FUSE_LIB_OPT("-n", networkDrive, 1),
     FUSE_LIB_OPT("-m", mountManager, 1),
     FUSE_LIB_OPT("-p", removableDrive, 1),
@@ -642,6 +680,10 @@ static void fuse_lib_help(void) {
       "    -o alloc_unit_size=M   set allocation unit size\n"
       "    -o sector_size=M       set sector size\n"
       "    -o max_read=M          set max read size. 0 for not infinite\n"
+      "    -o attr_timeout=T      cache timeout for attributes (1.0s)\n"
+      "    -o entry_timeout=T     cache timeout for symlink resolution (1.0s)\n"
+      "    -o max_threads=N       most worker threads (default: fixed pool)\n"
+      "    -o max_idle_threads=N  worker threads kept when idle (default: per CPU)\n"
       "    -n                     use network drive\n"
       "    -m                     use mount manager\n"
       "    -p                     use removable drive\n"
@@ -735,6 +777,10 @@ struct fuse *fuse_new(struct fuse_chan *ch, struct fuse_args *args,
          op_size > sizeof(safe_ops) ? sizeof(safe_ops) : op_size);
   res->ops = safe_ops;
 
+  // Same default as libfuse
+  res->conf.attr_timeout = 1.0;
+  res->conf.entry_timeout = 1.0;
+
   // Get debug param and filesystem name
   if (fuse_opt_parse(args, &res->conf, fuse_lib_opts, fuse_lib_opt_proc) == -1)
     return nullptr;
@@ -743,6 +789,19 @@ struct fuse *fuse_new(struct fuse_chan *ch, struct fuse_args *args,
   return res.release();
 }
 
+struct fuse *fuse_lowlevel_new(struct fuse_chan *ch, struct fuse_args *args,
+                               const struct fuse_lowlevel_ops *op,
+                               size_t op_size, void *userdata) {
+  std::unique_ptr<impl_lowlevel> ll(new impl_lowlevel(op, op_size, userdata));
+  // The bridge calls the path based adapters with the lowlevel context as
+  // its private data
+  fuse_operations ops = ll->make_operations();
+  struct fuse *res = fuse_new(ch, args, &ops, sizeof(ops), ll.get());
+  if (res != nullptr)
+    res->lowlevel.reset(ll.release());
+  return res;
+}
+
 void fuse_exit(struct fuse *f) {
   // A hack - unmount the attached filesystem, it will cause the loop to end
   if (f == nullptr || !f->ch.get() || f->ch->mountpoint.empty())
@@ -0,0 +1,253 @@
+#include <windows.h>
+#include "fuse.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifdef __CYGWIN__
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+size_t fuse_buf_size(const struct fuse_bufvec *bufv)
+{
+	size_t i;
+	size_t size = 0;
+
+	for (i = 0; i < bufv->count; i++) {
+		if (bufv->buf[i].size == (size_t)-1)
+			size = (size_t)-1;
+		else if (size != (size_t)-1)
+			size += bufv->buf[i].size;
+	}
+
+	return size;
+}
+
+/* Single read or write on the descriptor of buf, at off bytes into it */
+static ssize_t fuse_buf_fd_io(const struct fuse_buf *buf, void *mem,
+			      size_t len, size_t off, int write_op)
+{
+#ifdef __CYGWIN__
+	ssize_t res;
+
+	if (buf->flags & FUSE_BUF_FD_SEEK) {
+		FUSE_OFF_T pos = buf->pos + off;
+		res = write_op ? pwrite(buf->fd, mem, len, pos)
+			       : pread(buf->fd, mem, len, pos);
+	} else {
+		res = write_op ? write(buf->fd, mem, len)
+			       : read(buf->fd, mem, len);
+	}
+	return res < 0 ? -errno : res;
+#else
+	HANDLE handle = (HANDLE)_get_osfhandle(buf->fd);
+	OVERLAPPED overlapped;
+	LPOVERLAPPED poverlapped = NULL;
+	DWORD done = 0;
+	BOOL ok;
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return -EBADF;
+	if (len > MAXDWORD)
+		len = MAXDWORD;
+
+	/* Positioned I/O does not move the shared descriptor offset, so
+	   concurrent requests on the same descriptor do not race */
+	if (buf->flags & FUSE_BUF_FD_SEEK) {
+		ULARGE_INTEGER pos;
+		pos.QuadPart = (ULONGLONG)(buf->pos + off);
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = pos.LowPart;
+		overlapped.OffsetHigh = pos.HighPart;
+		poverlapped = &overlapped;
+	}
+
+	if (write_op)
+		ok = WriteFile(handle, mem, (DWORD)len, &done, poverlapped);
+	else
+		ok = ReadFile(handle, mem, (DWORD)len, &done, poverlapped);
+	if (!ok) {
+		switch (GetLastError()) {
+		case ERROR_HANDLE_EOF:
+		case ERROR_BROKEN_PIPE:
+			return 0;
+		case ERROR_ACCESS_DENIED:
+			return -EACCES;
+		case ERROR_INVALID_HANDLE:
+			return -EBADF;
+		case ERROR_DISK_FULL:
+			return -ENOSPC;
+		default:
+			return -EIO;
+		}
+	}
+	return done;
+#endif
+}
+
+/* Transfers up to len bytes where one side is a descriptor and the other
+   memory, honouring FUSE_BUF_FD_RETRY */
+static ssize_t fuse_buf_fd_copy(const struct fuse_buf *fdbuf, size_t fdoff,
+				void *mem, size_t len, int write_op)
+{
+	ssize_t copied = 0;
+
+	while (len) {
+		ssize_t res = fuse_buf_fd_io(fdbuf, mem, len, fdoff, write_op);
+		if (res < 0) {
+			if (!copied)
+				return res;
+			break;
+		}
+		if (res == 0)
+			break;
+
+		copied += res;
+		if (!(fdbuf->flags & FUSE_BUF_FD_RETRY))
+			break;
+
+		fdoff += res;
+		mem = (char *)mem + res;
+		len -= res;
+	}
+
+	return copied;
+}
+
+/* Both sides are descriptors, go through a bounce buffer */
+static ssize_t fuse_buf_fd_to_fd(const struct fuse_buf *dst, size_t dst_off,
+				 const struct fuse_buf *src, size_t src_off,
+				 size_t len)
+{
+	char buf[4096];
+	ssize_t copied = 0;
+
+	while (len) {
+		size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+		ssize_t res = fuse_buf_fd_copy(src, src_off, buf, chunk, 0);
+		ssize_t written;
+		if (res < 0) {
+			if (!copied)
+				return res;
+			break;
+		}
+		if (res == 0)
+			break;
+
+		written = fuse_buf_fd_copy(dst, dst_off, buf, res, 1);
+		if (written < 0) {
+			if (!copied)
+				return written;
+			break;
+		}
+		if (written == 0)
+			break;
+
+		copied += written;
+		if (written < res)
+			break;
+
+		src_off += res;
+		dst_off += res;
+		len -= res;
+	}
+
+	return copied;
+}
+
+static ssize_t fuse_buf_copy_one(const struct fuse_buf *dst, size_t dst_off,
+				 const struct fuse_buf *src, size_t src_off,
+				 size_t len)
+{
+	int src_is_fd = src->flags & FUSE_BUF_IS_FD;
+	int dst_is_fd = dst->flags & FUSE_BUF_IS_FD;
+
+	if (!src_is_fd && !dst_is_fd) {
+		char *dstmem = (char *)dst->mem + dst_off;
+		char *srcmem = (char *)src->mem + src_off;
+
+		if (dstmem != srcmem)
+			memmove(dstmem, srcmem, len);
+		return len;
+	}
+	if (!dst_is_fd)
+		return fuse_buf_fd_copy(src, src_off, (char *)dst->mem + dst_off,
+					len, 0);
+	if (!src_is_fd)
+		return fuse_buf_fd_copy(dst, dst_off, (char *)src->mem + src_off,
+					len, 1);
+	return fuse_buf_fd_to_fd(dst, dst_off, src, src_off, len);
+}
+
+static const struct fuse_buf *fuse_bufvec_current(struct fuse_bufvec *bufv)
+{
+	if (bufv->idx < bufv->count)
+		return &bufv->buf[bufv->idx];
+	else
+		return NULL;
+}
+
+static int fuse_bufvec_advance(struct fuse_bufvec *bufv, size_t len)
+{
+	const struct fuse_buf *buf = fuse_bufvec_current(bufv);
+
+	bufv->off += len;
+	if (bufv->off == buf->size) {
+		if (bufv->idx == bufv->count)
+			return 0;
+		bufv->idx++;
+		if (bufv->idx == bufv->count)
+			return 0;
+		bufv->off = 0;
+	}
+	return 1;
+}
+
+ssize_t fuse_buf_copy(struct fuse_bufvec *dstv, struct fuse_bufvec *srcv,
+		      enum fuse_buf_copy_flags flags)
+{
+	size_t copied = 0;
+
+	(void)flags;
+
+	if (dstv == srcv)
+		return fuse_buf_size(dstv);
+
+	for (;;) {
+		const struct fuse_buf *src = fuse_bufvec_current(srcv);
+		const struct fuse_buf *dst = fuse_bufvec_current(dstv);
+		size_t src_len;
+		size_t dst_len;
+		size_t len;
+		ssize_t res;
+
+		if (src == NULL || dst == NULL)
+			break;
+
+		src_len = src->size - srcv->off;
+		dst_len = dst->size - dstv->off;
+		len = src_len < dst_len ? src_len : dst_len;
+
+		res = fuse_buf_copy_one(dst, dstv->off, src, srcv->off, len);
+		if (res < 0) {
+			if (!copied)
+				return res;
+			break;
+		}
+		copied += res;
+
+		if (!fuse_bufvec_advance(srcv, res) ||
+		    !fuse_bufvec_advance(dstv, res))
+			break;
+
+		if ((size_t)res < len)
+			break;
+	}
+
+	return copied;
+}
@@ -0,0 +1,869 @@
+#define WIN32_NO_STATUS
+#include <windows.h>
+#undef WIN32_NO_STATUS
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <iterator>
+
+#include "fusemain.h"
+#include "utils.h"
+
+///////////////////////////////////////////////////////////////////////////////////////
+////// Requests and replies
+///////////////////////////////////////////////////////////////////////////////////////
+
+// Every request is answered before the lowlevel method returns, so the reply
+// is written straight into the buffers of the adapter that made the request
+struct fuse_req {
+  impl_lowlevel *ll;
+  fuse_ctx ctx;
+  bool replied;
+  int res;
+
+  struct fuse_entry_param *entry;
+  struct FUSE_STAT *attr;
+  double attr_timeout;
+  struct fuse_file_info *fi;
+  char *buf;   // read, readdir and readlink
+  size_t size; // Capacity of buf, then the size of the reply
+  size_t count;
+  struct statvfs *stbuf;
+
+  explicit fuse_req(impl_lowlevel *_ll)
+      : ll(_ll), replied(false), res(-EIO), entry(nullptr), attr(nullptr),
+        attr_timeout(0), fi(nullptr), buf(nullptr), size(0), count(0),
+        stbuf(nullptr) {
+    memset(&ctx, 0, sizeof(ctx));
+    fuse_context *context = fuse_get_context();
+    if (context != nullptr) {
+      ctx.uid = context->uid;
+      ctx.gid = context->gid;
+      ctx.pid = context->pid;
+    }
+  }
+
+  // Methods that did not reply fail with EIO
+  int result() const { return replied ? res : -EIO; }
+
+  int reply(int err) {
+    if (replied)
+      return -EINVAL;
+    replied = true;
+    res = err;
+    return 0;
+  }
+};
+
+struct impl_dirent {
+  uint64_t ino;
+  uint64_t off;
+  uint32_t namelen;
+  uint32_t type;
+  char name[1];
+};
+
+#define DIRENT_NAME_OFFSET offsetof(impl_dirent, name)
+#define DIRENT_ALIGN(x)                                                        \
+  (((x) + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+int fuse_reply_err(fuse_req_t req, int err) { return req->reply(-err); }
+
+void fuse_reply_none(fuse_req_t req) { req->reply(0); }
+
+int fuse_reply_entry(fuse_req_t req, const struct fuse_entry_param *e) {
+  if (req->entry == nullptr)
+    return req->reply(-EIO);
+  *req->entry = *e;
+  return req->reply(0);
+}
+
+int fuse_reply_create(fuse_req_t req, const struct fuse_entry_param *e,
+                      const struct fuse_file_info *fi) {
+  if (req->entry == nullptr || req->fi == nullptr)
+    return req->reply(-EIO);
+  *req->entry = *e;
+  *req->fi = *fi;
+  return req->reply(0);
+}
+
+int fuse_reply_attr(fuse_req_t req, const struct FUSE_STAT *attr,
+                    double attr_timeout) {
+  if (req->attr == nullptr)
+    return req->reply(-EIO);
+  *req->attr = *attr;
+  req->attr_timeout = attr_timeout;
+  return req->reply(0);
+}
+
+int fuse_reply_readlink(fuse_req_t req, const char *link) {
+  if (req->buf == nullptr || req->size == 0)
+    return req->reply(-EIO);
+  // Truncated like the readlink() of fuse_operations
+  strncpy(req->buf, link, req->size - 1);
+  req->buf[req->size - 1] = '\0';
+  return req->reply(0);
+}
+
+int fuse_reply_open(fuse_req_t req, const struct fuse_file_info *fi) {
+  if (req->fi == nullptr)
+    return req->reply(-EIO);
+  req->fi->fh = fi->fh;
+  req->fi->direct_io = fi->direct_io;
+  req->fi->keep_cache = fi->keep_cache;
+  return req->reply(0);
+}
+
+int fuse_reply_write(fuse_req_t req, size_t count) {
+  req->count = count;
+  return req->reply(0);
+}
+
+int fuse_reply_buf(fuse_req_t req, const char *buf, size_t size) {
+  if (req->buf == nullptr)
+    return req->reply(-EIO);
+  if (size > req->size)
+    size = req->size;
+  if (size != 0)
+    memcpy(req->buf, buf, size);
+  req->size = size;
+  return req->reply(0);
+}
+
+int fuse_reply_statfs(fuse_req_t req, const struct statvfs *stbuf) {
+  if (req->stbuf == nullptr)
+    return req->reply(-EIO);
+  *req->stbuf = *stbuf;
+  return req->reply(0);
+}
+
+size_t fuse_add_direntry(fuse_req_t req, char *buf, size_t bufsize,
+                         const char *name, const struct FUSE_STAT *stbuf,
+                         FUSE_OFF_T off) {
+  (void)req;
+  size_t namelen = strlen(name);
+  size_t entsize = DIRENT_ALIGN(DIRENT_NAME_OFFSET + namelen);
+  if (buf == nullptr || entsize > bufsize)
+    return entsize;
+
+  impl_dirent *dirent = reinterpret_cast<impl_dirent *>(buf);
+  dirent->ino = stbuf->st_ino;
+  dirent->off = off;
+  dirent->namelen = static_cast<uint32_t>(namelen);
+  dirent->type = (stbuf->st_mode & 0170000) >> 12;
+  memcpy(dirent->name, name, namelen);
+  memset(buf + DIRENT_NAME_OFFSET + namelen, 0,
+         entsize - DIRENT_NAME_OFFSET - namelen);
+  return entsize;
+}
+
+void *fuse_req_userdata(fuse_req_t req) { return req->ll->userdata(); }
+
+const struct fuse_ctx *fuse_req_ctx(fuse_req_t req) { return &req->ctx; }
+
+///////////////////////////////////////////////////////////////////////////////////////
+////// Lookup cache
+///////////////////////////////////////////////////////////////////////////////////////
+static ULONGLONG timeout_to_ms(double timeout) {
+  return timeout > 0 ? static_cast<ULONGLONG>(timeout * 1000) : 0;
+}
+
+impl_lowlevel::impl_lowlevel(const struct fuse_lowlevel_ops *ops,
+                             size_t op_size, void *userdata)
+    : userdata_(userdata) {
+  memset(&ops_, 0, sizeof(ops_));
+  memcpy(&ops_, ops, op_size > sizeof(ops_) ? sizeof(ops_) : op_size);
+  InitializeCriticalSection(&lock);
+}
+
+void impl_lowlevel::unref_unlocked(fuse_ino_t ino, forgets_t *forgets) {
+  inodes_t::iterator i = inodes.find(ino);
+  if (i == inodes.end() || --i->second.refs != 0)
+    return;
+  forgets->push_back(std::make_pair(ino, i->second.nlookup));
+  inodes.erase(i);
+}
+
+void impl_lowlevel::erase_unlocked(names_t::iterator first,
+                                   names_t::iterator last,
+                                   forgets_t *forgets) {
+  for (names_t::iterator i = first; i != last; ++i) {
+    if (i->second.ino != 0)
+      unref_unlocked(i->second.ino, forgets);
+  }
+  names.erase(first, last);
+}
+
+void impl_lowlevel::purge_expired_unlocked(ULONGLONG now,
+                                           forgets_t *forgets) {
+  names_t::iterator i = names.begin();
+  while (i != names.end()) {
+    if (i->second.expires <= now) {
+      if (i->second.ino != 0)
+        unref_unlocked(i->second.ino, forgets);
+      i = names.erase(i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+void impl_lowlevel::forget(const forgets_t &forgets) {
+  if (!ops_.forget)
+    return;
+  for (forgets_t::const_iterator i = forgets.begin(); i != forgets.end();
+       ++i) {
+    fuse_req req(this);
+    ops_.forget(&req, i->first, i->second);
+  }
+}
+
+int impl_lowlevel::lookup(fuse_ino_t parent, const std::string &name,
+                          const std::string &base, fuse_ino_t *ino,
+                          bool pin) {
+  if (!ops_.lookup)
+    return -ENOSYS;
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+  fuse_req req(this);
+  req.entry = &e;
+  ops_.lookup(&req, parent, base.c_str());
+  CHECKED(req.result());
+
+  remember(name, e, pin);
+  if (e.ino == 0)
+    return -ENOENT;
+  *ino = e.ino;
+  return 0;
+}
+
+int impl_lowlevel::resolve(const std::string &name, fuse_ino_t *ino,
+                           bool pin) {
+  if (name.empty() || name == "/") {
+    *ino = FUSE_ROOT_ID;
+    return 0;
+  }
+  if (*name.rbegin() == '/')
+    return resolve(name.substr(0, name.length() - 1), ino, pin);
+
+  EnterCriticalSection(&lock);
+  names_t::iterator i = names.find(name);
+  if (i != names.end() && i->second.expires > GetTickCount64()) {
+    *ino = i->second.ino;
+    if (*ino != 0 && pin)
+      ++inodes[*ino].refs;
+    LeaveCriticalSection(&lock);
+    return *ino != 0 ? 0 : -ENOENT;
+  }
+  LeaveCriticalSection(&lock);
+
+  fuse_ino_t parent;
+  std::string base;
+  CHECKED(resolve_parent(name, &parent, &base));
+  int res = lookup(parent, name, base, ino, pin);
+  unpin(parent);
+  return res;
+}
+
+// The parent stays pinned until the caller unpins it, so that it is not
+// forgotten while a child is being looked up or created in it
+int impl_lowlevel::resolve_parent(const std::string &name, fuse_ino_t *parent,
+                                  std::string *base) {
+  std::string::size_type pos = name.rfind('/');
+  if (pos == std::string::npos) {
+    *base = name;
+    *parent = FUSE_ROOT_ID;
+    return 0;
+  }
+  *base = name.substr(pos + 1);
+  return resolve(pos == 0 ? "/" : name.substr(0, pos), parent, true);
+}
+
+void impl_lowlevel::remember(const std::string &name,
+                             const struct fuse_entry_param &e, bool pin) {
+  forgets_t forgets;
+  ULONGLONG now = GetTickCount64();
+  EnterCriticalSection(&lock);
+  if (names.size() >= MAX_LOOKUP_CACHE_ENTRIES) {
+    purge_expired_unlocked(now, &forgets);
+    // Still full of live entries: start over rather than scanning for the
+    // oldest each time
+    if (names.size() >= MAX_LOOKUP_CACHE_ENTRIES)
+      erase_unlocked(names.begin(), names.end(), &forgets);
+  }
+
+  if (e.ino != 0) {
+    inode_entry &node = inodes[e.ino];
+    ++node.nlookup;
+    node.refs += pin ? 2 : 1;
+    node.attr = e.attr;
+    node.attr_expires = now + timeout_to_ms(e.attr_timeout);
+  }
+
+  names_t::iterator i = names.find(name);
+  if (i != names.end())
+    erase_unlocked(i, std::next(i), &forgets);
+  // A positive entry is kept even when already expired, it holds the
+  // lookup count until it is purged
+  if (e.ino != 0 || e.entry_timeout > 0) {
+    name_entry &entry = names[name];
+    entry.ino = e.ino;
+    entry.expires = now + timeout_to_ms(e.entry_timeout);
+  }
+  LeaveCriticalSection(&lock);
+  forget(forgets);
+}
+
+void impl_lowlevel::unpin(fuse_ino_t ino) {
+  if (ino == FUSE_ROOT_ID)
+    return;
+
+  forgets_t forgets;
+  EnterCriticalSection(&lock);
+  unref_unlocked(ino, &forgets);
+  LeaveCriticalSection(&lock);
+  forget(forgets);
+}
+
+void impl_lowlevel::forget_name(const std::string &name) {
+  forgets_t forgets;
+  EnterCriticalSection(&lock);
+  names_t::iterator i = names.find(name);
+  if (i != names.end())
+    erase_unlocked(i, std::next(i), &forgets);
+  LeaveCriticalSection(&lock);
+  forget(forgets);
+}
+
+void impl_lowlevel::forget_subtree(const std::string &name) {
+  // Children sort between "name/" and "name0", '0' following '/'
+  forgets_t forgets;
+  EnterCriticalSection(&lock);
+  names_t::iterator i = names.find(name);
+  if (i != names.end())
+    erase_unlocked(i, std::next(i), &forgets);
+  erase_unlocked(names.lower_bound(name + '/'), names.lower_bound(name + '0'),
+                 &forgets);
+  LeaveCriticalSection(&lock);
+  forget(forgets);
+}
+
+bool impl_lowlevel::get_attr(fuse_ino_t ino, struct FUSE_STAT *st) {
+  bool found = false;
+  EnterCriticalSection(&lock);
+  inodes_t::iterator i = inodes.find(ino);
+  if (i != inodes.end() && i->second.attr_expires > GetTickCount64()) {
+    *st = i->second.attr;
+    found = true;
+  }
+  LeaveCriticalSection(&lock);
+  return found;
+}
+
+void impl_lowlevel::set_attr(fuse_ino_t ino, const struct FUSE_STAT &st,
+                             double attr_timeout) {
+  EnterCriticalSection(&lock);
+  inodes_t::iterator i = inodes.find(ino);
+  if (i != inodes.end()) {
+    i->second.attr = st;
+    i->second.attr_expires = GetTickCount64() + timeout_to_ms(attr_timeout);
+  }
+  LeaveCriticalSection(&lock);
+}
+
+void impl_lowlevel::invalidate_attr(fuse_ino_t ino) {
+  EnterCriticalSection(&lock);
+  inodes_t::iterator i = inodes.find(ino);
+  if (i != inodes.end())
+    i->second.attr_expires = 0;
+  LeaveCriticalSection(&lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+////// Path based adapters
+///////////////////////////////////////////////////////////////////////////////////////
+static impl_lowlevel *the_lowlevel() {
+  return static_cast<impl_lowlevel *>(fuse_get_context()->private_data);
+}
+
+static impl_lowlevel::open_file *open_file_of(struct fuse_file_info *fi) {
+  // Handles the bridge did not open through us carry 0 or -1
+  if (fi == nullptr || fi->fh == 0 || fi->fh == static_cast<uint64_t>(-1))
+    return nullptr;
+  return reinterpret_cast<impl_lowlevel::open_file *>(fi->fh);
+}
+
+// Inode of an open file without resolving its name, and the file info
+// carrying the fh set by the lowlevel open
+static int file_ino(impl_lowlevel *ll, const char *path,
+                    struct fuse_file_info *fi, fuse_ino_t *ino,
+                    struct fuse_file_info *ll_fi) {
+  if (fi != nullptr)
+    *ll_fi = *fi;
+  else
+    memset(ll_fi, 0, sizeof(*ll_fi));
+
+  impl_lowlevel::open_file *file = open_file_of(fi);
+  if (file != nullptr) {
+    *ino = file->ino;
+    ll_fi->fh = file->fh;
+    return 0;
+  }
+  ll_fi->fh = 0;
+  return ll->resolve(path, ino);
+}
+
+static void *ll_init(struct fuse_conn_info *conn) {
+  impl_lowlevel *ll = the_lowlevel();
+  if (ll->ops().init)
+    ll->ops().init(ll->userdata(), conn);
+  return ll;
+}
+
+static void ll_destroy(void *private_data) {
+  impl_lowlevel *ll = static_cast<impl_lowlevel *>(private_data);
+  if (ll->ops().destroy)
+    ll->ops().destroy(ll->userdata());
+}
+
+static int ll_getattr(const char *path, struct FUSE_STAT *stbuf) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  CHECKED(ll->resolve(path, &ino));
+  if (ll->get_attr(ino, stbuf))
+    return 0;
+  if (!ll->ops().getattr)
+    return -ENOSYS;
+
+  fuse_req req(ll);
+  req.attr = stbuf;
+  ll->ops().getattr(&req, ino, nullptr);
+  CHECKED(req.result());
+  ll->set_attr(ino, *stbuf, req.attr_timeout);
+  return 0;
+}
+
+static int ll_readlink(const char *path, char *buf, size_t size) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  CHECKED(ll->resolve(path, &ino));
+
+  fuse_req req(ll);
+  req.buf = buf;
+  req.size = size;
+  ll->ops().readlink(&req, ino);
+  return req.result();
+}
+
+// Shared by mknod and mkdir, which reply with the new entry
+template <typename Create>
+static int ll_new_entry(impl_lowlevel *ll, const char *path, Create create) {
+  fuse_ino_t parent;
+  std::string base;
+  CHECKED(ll->resolve_parent(path, &parent, &base));
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+  fuse_req req(ll);
+  req.entry = &e;
+  create(&req, parent, base.c_str());
+  int res = req.result();
+  if (res == 0)
+    ll->remember(path, e, false);
+  ll->unpin(parent);
+  return res;
+}
+
+static int ll_mknod(const char *path, mode_t mode, dev_t rdev) {
+  impl_lowlevel *ll = the_lowlevel();
+  return ll_new_entry(ll, path, [&](fuse_req_t req, fuse_ino_t parent,
+                                    const char *name) {
+    ll->ops().mknod(req, parent, name, mode, rdev);
+  });
+}
+
+static int ll_mkdir(const char *path, mode_t mode) {
+  impl_lowlevel *ll = the_lowlevel();
+  return ll_new_entry(ll, path, [&](fuse_req_t req, fuse_ino_t parent,
+                                    const char *name) {
+    ll->ops().mkdir(req, parent, name, mode);
+  });
+}
+
+static int ll_unlink(const char *path) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t parent;
+  std::string base;
+  CHECKED(ll->resolve_parent(path, &parent, &base));
+
+  fuse_req req(ll);
+  ll->ops().unlink(&req, parent, base.c_str());
+  int res = req.result();
+  if (res == 0)
+    ll->forget_name(path);
+  ll->unpin(parent);
+  return res;
+}
+
+static int ll_rmdir(const char *path) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t parent;
+  std::string base;
+  CHECKED(ll->resolve_parent(path, &parent, &base));
+
+  fuse_req req(ll);
+  ll->ops().rmdir(&req, parent, base.c_str());
+  int res = req.result();
+  if (res == 0)
+    ll->forget_subtree(path);
+  ll->unpin(parent);
+  return res;
+}
+
+static int ll_rename(const char *from, const char *to) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t parent, newparent;
+  std::string base, newbase;
+  CHECKED(ll->resolve_parent(from, &parent, &base));
+  int res = ll->resolve_parent(to, &newparent, &newbase);
+  if (res < 0) {
+    ll->unpin(parent);
+    return res;
+  }
+
+  fuse_req req(ll);
+  ll->ops().rename(&req, parent, base.c_str(), newparent, newbase.c_str());
+  res = req.result();
+  if (res == 0) {
+    ll->forget_subtree(from);
+    ll->forget_subtree(to);
+  }
+  ll->unpin(newparent);
+  ll->unpin(parent);
+  return res;
+}
+
+static int ll_setattr(const char *path, struct FUSE_STAT *attr, int to_set,
+                      struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  struct FUSE_STAT stbuf = {0};
+  fuse_req req(ll);
+  req.attr = &stbuf;
+  ll->ops().setattr(&req, ino, attr, to_set, fi ? &ll_fi : nullptr);
+  int res = req.result();
+  if (res == 0)
+    ll->set_attr(ino, stbuf, req.attr_timeout);
+  else
+    ll->invalidate_attr(ino);
+  return res;
+}
+
+static int ll_truncate(const char *path, FUSE_OFF_T size) {
+  struct FUSE_STAT attr = {0};
+  attr.st_size = size;
+  return ll_setattr(path, &attr, FUSE_SET_ATTR_SIZE, nullptr);
+}
+
+static int ll_ftruncate(const char *path, FUSE_OFF_T size,
+                        struct fuse_file_info *fi) {
+  struct FUSE_STAT attr = {0};
+  attr.st_size = size;
+  return ll_setattr(path, &attr, FUSE_SET_ATTR_SIZE, fi);
+}
+
+static int ll_utimens(const char *path, const struct timespec tv[2]) {
+  struct FUSE_STAT attr = {0};
+  attr.st_atim = tv[0];
+  attr.st_mtim = tv[1];
+  return ll_setattr(path, &attr, FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME,
+                    nullptr);
+}
+
+// Shared by open and opendir: the inode stays pinned until release, and fh
+// points to it together with the fh of the lowlevel open
+static int ll_do_open(const char *path, struct fuse_file_info *fi,
+                      bool is_dir) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  CHECKED(ll->resolve(path, &ino, true));
+
+  fuse_file_info ll_fi = *fi;
+  ll_fi.fh = 0;
+  void (*open_method)(fuse_req_t, fuse_ino_t, struct fuse_file_info *) =
+      is_dir ? ll->ops().opendir : ll->ops().open;
+  int res = 0;
+  if (open_method) {
+    fuse_req req(ll);
+    req.fi = &ll_fi;
+    open_method(&req, ino, &ll_fi);
+    res = req.result();
+  } else if (is_dir) {
+    // Without opendir() we can at least refuse files
+    struct FUSE_STAT stbuf = {0};
+    res = ll_getattr(path, &stbuf);
+    if (res == 0 && (stbuf.st_mode & S_IFDIR) != S_IFDIR)
+      res = -ENOTDIR;
+  }
+  if (res < 0) {
+    ll->unpin(ino);
+    return res;
+  }
+
+  impl_lowlevel::open_file *file = new impl_lowlevel::open_file;
+  file->ino = ino;
+  file->fh = ll_fi.fh;
+  fi->fh = reinterpret_cast<uint64_t>(file);
+  fi->direct_io = ll_fi.direct_io;
+  fi->keep_cache = ll_fi.keep_cache;
+  return 0;
+}
+
+static int ll_do_release(struct fuse_file_info *fi, bool is_dir) {
+  impl_lowlevel *ll = the_lowlevel();
+  impl_lowlevel::open_file *file = open_file_of(fi);
+  if (file == nullptr)
+    return 0;
+
+  void (*release_method)(fuse_req_t, fuse_ino_t, struct fuse_file_info *) =
+      is_dir ? ll->ops().releasedir : ll->ops().release;
+  if (release_method) {
+    fuse_file_info ll_fi = *fi;
+    ll_fi.fh = file->fh;
+    fuse_req req(ll);
+    release_method(&req, file->ino, &ll_fi);
+  }
+  ll->unpin(file->ino);
+  delete file;
+  fi->fh = 0;
+  return 0;
+}
+
+static int ll_open(const char *path, struct fuse_file_info *fi) {
+  return ll_do_open(path, fi, false);
+}
+
+static int ll_release(const char *path, struct fuse_file_info *fi) {
+  (void)path;
+  return ll_do_release(fi, false);
+}
+
+static int ll_opendir(const char *path, struct fuse_file_info *fi) {
+  return ll_do_open(path, fi, true);
+}
+
+static int ll_releasedir(const char *path, struct fuse_file_info *fi) {
+  (void)path;
+  return ll_do_release(fi, true);
+}
+
+static int ll_read(const char *path, char *buf, size_t size, FUSE_OFF_T off,
+                   struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  fuse_req req(ll);
+  req.buf = buf;
+  req.size = size;
+  ll->ops().read(&req, ino, size, off, &ll_fi);
+  CHECKED(req.result());
+  return static_cast<int>(req.size);
+}
+
+static int ll_write(const char *path, const char *buf, size_t size,
+                    FUSE_OFF_T off, struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  fuse_req req(ll);
+  ll->ops().write(&req, ino, buf, size, off, &ll_fi);
+  ll->invalidate_attr(ino);
+  CHECKED(req.result());
+  return static_cast<int>(req.count);
+}
+
+static int ll_flush(const char *path, struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  fuse_req req(ll);
+  ll->ops().flush(&req, ino, &ll_fi);
+  return req.result();
+}
+
+static int ll_fsync(const char *path, int datasync,
+                    struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  fuse_req req(ll);
+  ll->ops().fsync(&req, ino, datasync, &ll_fi);
+  return req.result();
+}
+
+static int ll_fsyncdir(const char *path, int datasync,
+                       struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  fuse_req req(ll);
+  ll->ops().fsyncdir(&req, ino, datasync, &ll_fi);
+  return req.result();
+}
+
+static int ll_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                      FUSE_OFF_T offset, struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  fuse_file_info ll_fi;
+  CHECKED(file_ino(ll, path, fi, &ino, &ll_fi));
+
+  std::vector<char> data(LOWLEVEL_READDIR_SIZE);
+  FUSE_OFF_T off = offset;
+  for (;;) {
+    fuse_req req(ll);
+    req.buf = data.data();
+    req.size = data.size();
+    ll->ops().readdir(&req, ino, data.size(), off, &ll_fi);
+    CHECKED(req.result());
+    if (req.size == 0)
+      return 0;
+
+    bool more = true;
+    for (size_t pos = 0; pos + DIRENT_NAME_OFFSET <= req.size;) {
+      const impl_dirent *dirent =
+          reinterpret_cast<const impl_dirent *>(&data[pos]);
+      std::string name(dirent->name, dirent->namelen);
+      // Only the type is known here, the attributes come from lookup
+      // The offset of the next entry lets the caller resume after this one
+      int res = filler(buf, name.c_str(), nullptr, dirent->off);
+      if (res != 0)
+        return res < 0 ? res : 0;
+      off = dirent->off;
+      // No offsets: the whole directory came in this buffer
+      if (off == 0)
+        more = false;
+      pos += DIRENT_ALIGN(DIRENT_NAME_OFFSET + dirent->namelen);
+    }
+    if (!more)
+      return 0;
+  }
+}
+
+static int ll_statfs(const char *path, struct statvfs *stbuf) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  CHECKED(ll->resolve(path, &ino));
+
+  fuse_req req(ll);
+  req.stbuf = stbuf;
+  ll->ops().statfs(&req, ino);
+  return req.result();
+}
+
+static int ll_access(const char *path, int mask) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t ino;
+  CHECKED(ll->resolve(path, &ino));
+
+  fuse_req req(ll);
+  ll->ops().access(&req, ino, mask);
+  return req.result();
+}
+
+static int ll_create(const char *path, mode_t mode,
+                     struct fuse_file_info *fi) {
+  impl_lowlevel *ll = the_lowlevel();
+  fuse_ino_t parent;
+  std::string base;
+  CHECKED(ll->resolve_parent(path, &parent, &base));
+
+  struct fuse_entry_param e;
+  memset(&e, 0, sizeof(e));
+  fuse_file_info ll_fi = *fi;
+  ll_fi.fh = 0;
+  fuse_req req(ll);
+  req.entry = &e;
+  req.fi = &ll_fi;
+  ll->ops().create(&req, parent, base.c_str(), mode, &ll_fi);
+  int res = req.result();
+  if (res == 0 && e.ino == 0)
+    res = -EIO;
+  if (res == 0) {
+    // Pinned for the open file until release
+    ll->remember(path, e, true);
+    impl_lowlevel::open_file *file = new impl_lowlevel::open_file;
+    file->ino = e.ino;
+    file->fh = ll_fi.fh;
+    fi->fh = reinterpret_cast<uint64_t>(file);
+    fi->direct_io = ll_fi.direct_io;
+    fi->keep_cache = ll_fi.keep_cache;
+  }
+  ll->unpin(parent);
+  return res;
+}
+
+struct fuse_operations impl_lowlevel::make_operations() const {
+  struct fuse_operations ops;
+  memset(&ops, 0, sizeof(ops));
+  ops.init = &ll_init;
+  ops.destroy = &ll_destroy;
+  ops.getattr = &ll_getattr;
+  ops.open = &ll_open;
+  ops.release = &ll_release;
+  ops.opendir = &ll_opendir;
+  ops.releasedir = &ll_releasedir;
+  // Leave the others unset so that the bridge falls back as it does for
+  // path based filesystems missing them
+  if (ops_.readlink)
+    ops.readlink = &ll_readlink;
+  if (ops_.mknod)
+    ops.mknod = &ll_mknod;
+  if (ops_.mkdir)
+    ops.mkdir = &ll_mkdir;
+  if (ops_.unlink)
+    ops.unlink = &ll_unlink;
+  if (ops_.rmdir)
+    ops.rmdir = &ll_rmdir;
+  if (ops_.rename)
+    ops.rename = &ll_rename;
+  if (ops_.setattr) {
+    ops.truncate = &ll_truncate;
+    ops.ftruncate = &ll_ftruncate;
+    ops.utimens = &ll_utimens;
+  }
+  if (ops_.read)
+    ops.read = &ll_read;
+  if (ops_.write)
+    ops.write = &ll_write;
+  if (ops_.flush)
+    ops.flush = &ll_flush;
+  if (ops_.fsync)
+    ops.fsync = &ll_fsync;
+  if (ops_.readdir)
+    ops.readdir = &ll_readdir;
+  if (ops_.fsyncdir)
+    ops.fsyncdir = &ll_fsyncdir;
+  if (ops_.statfs)
+    ops.statfs = &ll_statfs;
+  if (ops_.access)
+    ops.access = &ll_access;
+  if (ops_.create)
+    ops.create = &ll_create;
+  return ops;
+}
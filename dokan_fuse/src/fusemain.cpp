@@ -42,11 +42,22 @@ __declspec(thread) impl_chain_link *cur_impl_chain_link = nullptr;
 static __thread impl_chain_link *cur_impl_chain_link = NULL;
 #endif
 
-impl_chain_guard::impl_chain_guard(impl_fuse_context *ctx, int caller_pid) {
+impl_chain_guard::impl_chain_guard(impl_fuse_context *ctx, int caller_pid)
+    : counted_(nullptr) {
   link.call_ctx_.pid = caller_pid;
   link.call_ctx_.private_data = ctx->user_data_;
   link.call_ctx_.fuse = ctx->fuse_;
 
+  // Reentrant calls run on a thread that is already counted
+  if (cur_impl_chain_link == nullptr) {
+    counted_ = ctx;
+    link.call_ctx_.active_threads =
+        static_cast<unsigned int>(InterlockedIncrement(&ctx->active_threads_));
+  } else {
+    link.call_ctx_.active_threads =
+        static_cast<unsigned int>(ctx->active_threads_);
+  }
+
   link.prev_link_ = cur_impl_chain_link;
 
   // Push current context on the chain stack.
@@ -58,6 +69,8 @@ impl_chain_guard::~impl_chain_guard() {
   if (&link != cur_impl_chain_link)
     abort(); //"FUSE frames stack is damaged!"
   cur_impl_chain_link = link.prev_link_;
+  if (counted_ != nullptr)
+    InterlockedDecrement(&counted_->active_threads_);
 }
 
 struct fuse_context *fuse_get_context(void) {
@@ -74,10 +87,13 @@ impl_fuse_context::impl_fuse_context(fuse *fuse,
                                      void *user_data, bool debug,
                                      unsigned int filemask,
                                      unsigned int dirmask, const char *fsname,
-    const char *volname, const char *uncname, unsigned long max_read)
+    const char *volname, const char *uncname, unsigned long max_read,
+    double attr_timeout, double entry_timeout)
     : ops_(*ops), user_data_(user_data), fuse_(fuse), debug_(debug),
       filemask_(filemask), dirmask_(dirmask), fsname_(fsname),
-      volname_(volname), uncname_(uncname), max_read_(max_read) // Use current user data
+      volname_(volname), uncname_(uncname), max_read_(max_read), // Use current user data
+      attr_cache_(attr_timeout), link_cache_(entry_timeout),
+      active_threads_(0)
 {
   // Reset connection info
   memset(&conn_info_, 0, sizeof(fuse_conn_info));
@@ -107,7 +123,7 @@ int impl_fuse_context::cast_from_longlong(LONGLONG src, FUSE_OFF_T *res) {
 int impl_fuse_context::do_open_dir(LPCWSTR FileName,
                                    PDOKAN_FILE_INFO DokanFileInfo) {
   if (ops_.opendir) {
-    std::string fname = unixify(wchar_to_utf8_cstr(FileName));
+    std::string fname = unixify_wchar(FileName);
     std::unique_ptr<impl_file_handle> file;
     // TODO access_mode
     CHECKED(file_locks.get_file(
@@ -131,7 +147,7 @@ int impl_fuse_context::do_open_file(LPCWSTR FileName, DWORD share_mode,
                                     PDOKAN_FILE_INFO DokanFileInfo) {
   if (!ops_.open)
     return -EINVAL;
-  std::string fname = unixify(wchar_to_utf8_cstr(FileName));
+  std::string fname = unixify_wchar(FileName);
   CHECKED(check_and_resolve(&fname));
 
   std::unique_ptr<impl_file_handle> file;
@@ -150,7 +166,7 @@ int impl_fuse_context::do_open_file(LPCWSTR FileName, DWORD share_mode,
 
 int impl_fuse_context::do_delete_directory(LPCWSTR file_name,
                                            PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
 
   if (!ops_.rmdir || !ops_.getattr)
     return -EINVAL;
@@ -166,11 +182,18 @@ int impl_fuse_context::do_delete_directory(LPCWSTR file_name,
   // A special case: symlinks are deleted by unlink, not rmdir
   struct FUSE_STAT stbuf = {0};
   CHECKED(ops_.getattr(fname.c_str(), &stbuf));
-  if (S_ISLNK(stbuf.st_mode) && ops_.unlink)
-    return ops_.unlink(fname.c_str());
+  if (S_ISLNK(stbuf.st_mode) && ops_.unlink) {
+    CHECKED(ops_.unlink(fname.c_str()));
+    attr_cache_.forget(fname);
+    link_cache_.forget(fname);
+    return 0;
+  }
 
   // Ok, try to rmdir it.
-  return ops_.rmdir(fname.c_str());
+  CHECKED(ops_.rmdir(fname.c_str()));
+  attr_cache_.forget_subtree(fname);
+  link_cache_.forget_subtree(fname);
+  return 0;
 }
 
 int impl_fuse_context::do_delete_file(LPCWSTR file_name,
@@ -179,8 +202,11 @@ int impl_fuse_context::do_delete_file(LPCWSTR file_name,
     return -EINVAL;
 
   // Note: we do not try to resolve symlink target
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
-  return ops_.unlink(fname.c_str());
+  std::string fname = unixify_wchar(file_name);
+  CHECKED(ops_.unlink(fname.c_str()));
+  attr_cache_.forget(fname);
+  link_cache_.forget(fname);
+  return 0;
 }
 
 int impl_fuse_context::do_create_file(LPCWSTR FileName, DWORD Disposition,
@@ -191,7 +217,7 @@ int impl_fuse_context::do_create_file(LPCWSTR FileName, DWORD Disposition,
 // Flags = DesiredAccess
 // share_mode = ShareAccess
 {
-  std::string fname = unixify(wchar_to_utf8_cstr(FileName));
+  std::string fname = unixify_wchar(FileName);
 
   // Create file?
   if (Disposition != FILE_CREATE && Disposition != FILE_SUPERSEDE &&
@@ -205,6 +231,8 @@ int impl_fuse_context::do_create_file(LPCWSTR FileName, DWORD Disposition,
       return -EINVAL;
 
     CHECKED(ops_.mknod(fname.c_str(), filemask_, 0));
+    attr_cache_.forget(fname);
+    link_cache_.forget(fname);
 
     return do_open_file(FileName, share_mode, Flags, DokanFileInfo);
   }
@@ -218,6 +246,8 @@ int impl_fuse_context::do_create_file(LPCWSTR FileName, DWORD Disposition,
       convert_flags(Flags); // TODO: these flags should be OK for new files?
 
   CHECKED(ops_.create(fname.c_str(), filemask_, &finfo));
+  attr_cache_.forget(fname);
+  link_cache_.forget(fname);
 
   file->set_finfo(finfo);
   DokanFileInfo->Context = reinterpret_cast<ULONG64>(file.release());
@@ -239,26 +269,51 @@ int impl_fuse_context::resolve_symlink(const std::string &name,
   if (!ops_.readlink)
     return -EINVAL;
 
+  bool is_link;
+  if (link_cache_.get(name, &is_link, res) && is_link)
+    return 0;
+
   char buf[MAX_PATH * 2] = {0};
   CHECKED(ops_.readlink(name.c_str(), buf, MAX_PATH * 2));
+  std::string target;
   if (buf[0] == '/')
-    *res = buf;
+    target = buf;
   else {
     // TODO: add full path normalization here
-    *res = extract_dir_name(name) + buf;
+    target = extract_dir_name(name) + buf;
   }
+  link_cache_.put_link(name, target);
+  *res = target;
 
   return 0;
 }
 
+int impl_fuse_context::cached_getattr(const std::string &name,
+                                      struct FUSE_STAT *stbuf) {
+  if (attr_cache_.get(name, stbuf))
+    return 0;
+  return ops_.getattr(name.c_str(), stbuf);
+}
+
 int impl_fuse_context::check_and_resolve(std::string *name) {
   if (!ops_.getattr)
     return -EINVAL;
 
+  // The name was known to exist when it was cached
+  bool is_link;
+  std::string target;
+  if (link_cache_.get(*name, &is_link, &target)) {
+    if (is_link)
+      *name = target;
+    return 0;
+  }
+
   struct FUSE_STAT stat = {0};
-  CHECKED(ops_.getattr(name->c_str(), &stat));
+  CHECKED(cached_getattr(*name, &stat));
   if (S_ISLNK(stat.st_mode)) {
     CHECKED(resolve_symlink(*name, name));
+  } else {
+    link_cache_.put_not_link(*name);
   }
 
   return 0;
@@ -276,6 +331,19 @@ int impl_fuse_context::walk_directory(void *buf, const char *name,
     return wd->delegateSetFuseContext(wd->DokanFileInfo,buf, name,stbuf, off);
   }
 
+  if (wd->cursor_delegate != nullptr) {
+    // The file system may go on after the reply is full if it ignores
+    // offsets; the entries are dropped and the next request lists them again.
+    if (wd->full)
+      return 1;
+    if (wd->skip > 0) {
+      --wd->skip;
+      ++wd->index;
+      wd->offset = off;
+      return 0;
+    }
+  }
+
   impl_fuse_context* ctx = wd->ctx;
   PFillFindData p_fill_find_data = wd->delegate;
   PDOKAN_FILE_INFO DokanFileInfo = wd->DokanFileInfo;
@@ -305,6 +373,11 @@ int impl_fuse_context::walk_directory(void *buf, const char *name,
   else if (ctx->ops_.getattr) {
     CHECKED(ctx->ops_.getattr((dirname + name).c_str(), &stat));
   }
+  if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+    ctx->attr_cache_.put(dirname + name, stat);
+    if (!S_ISLNK(stat.st_mode))
+      ctx->link_cache_.put_not_link(dirname + name);
+  }
 
   if (S_ISLNK(stat.st_mode)
       && ctx->ops_.getattr) {
@@ -321,6 +394,24 @@ int impl_fuse_context::walk_directory(void *buf, const char *name,
   if (attrs != 0xFFFFFFFFu)
     find_data.dwFileAttributes = attrs;
 
+  if (wd->cursor_delegate != nullptr) {
+    DOKAN_DIRECTORY_ENTRY entry = {0};
+    entry.FileAttributes = find_data.dwFileAttributes;
+    entry.CreationTime = find_data.ftCreationTime;
+    entry.LastAccessTime = find_data.ftLastAccessTime;
+    entry.LastWriteTime = find_data.ftLastWriteTime;
+    entry.FileSize =
+        (static_cast<ULONG64>(find_data.nFileSizeHigh) << 32) | find_data.nFileSizeLow;
+    entry.FileName = find_data.cFileName;
+    entry.FileNameLength = static_cast<ULONG>(wcslen(find_data.cFileName));
+    if (wd->cursor_delegate(&entry, DokanFileInfo)) {
+      wd->full = true;
+      return 1;
+    }
+    ++wd->index;
+    wd->offset = off;
+    return 0;
+  }
   return p_fill_find_data(&find_data, DokanFileInfo);
 }
 
@@ -338,7 +429,7 @@ int impl_fuse_context::find_files(LPCWSTR file_name,
   if ((!ops_.readdir && !ops_.getdir) || !ops_.getattr)
     return -EINVAL;
 
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
   CHECKED(check_and_resolve(&fname));
 
   walk_data wd;
@@ -377,9 +468,55 @@ int impl_fuse_context::find_files(LPCWSTR file_name,
   return 0;
 }
 
+int impl_fuse_context::find_files_with_cursor(
+    LPCWSTR file_name, ULONG start_index,
+    PFillDirectoryEntry fill_directory_entry,
+    PWalkDirectoryWithSetFuseContext walk_set_fuse_context,
+    PDOKAN_FILE_INFO dokan_file_info) {
+  // getdir() has no offsets: find_files() lists the whole directory instead
+  if (!ops_.readdir)
+    return -ENOSYS;
+  if (!ops_.getattr)
+    return -EINVAL;
+
+  std::string fname = unixify_wchar(file_name);
+  CHECKED(check_and_resolve(&fname));
+
+  walk_data wd;
+  wd.ctx = this;
+  wd.dirname = fname;
+  if (*fname.rbegin() != '/')
+    wd.dirname.append("/");
+  wd.delegateSetFuseContext = walk_set_fuse_context;
+  wd.DokanFileInfo = dokan_file_info;
+  wd.cursor_delegate = fill_directory_entry;
+
+  impl_file_handle *hndl =
+      reinterpret_cast<impl_file_handle *>(dokan_file_info->Context);
+  // Resume at the offset the previous request of the handle stopped at,
+  // otherwise list from the start and pass over the entries before it
+  FUSE_OFF_T offset =
+      hndl != nullptr && start_index != 0 ? hndl->readdir_offset(start_index) : 0;
+  if (offset != 0) {
+    wd.index = start_index;
+    wd.offset = offset;
+  } else {
+    wd.skip = start_index;
+  }
+
+  int res;
+  if (hndl != nullptr) {
+    fuse_file_info finfo(hndl->make_finfo());
+    res = ops_.readdir(fname.c_str(), &wd, &walk_directory, offset, &finfo);
+    hndl->set_readdir_cursor(wd.index, wd.offset);
+  } else
+    res = ops_.readdir(fname.c_str(), &wd, &walk_directory, offset, nullptr);
+  return res;
+}
+
 int impl_fuse_context::open_directory(LPCWSTR file_name,
                                       PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
 
   if (ops_.opendir)
     return do_open_dir(file_name, dokan_file_info);
@@ -387,7 +524,7 @@ int impl_fuse_context::open_directory(LPCWSTR file_name,
   // We don't have opendir(), so the most we can do is make sure
   // that the target is indeed a directory
   struct FUSE_STAT st = {0};
-  CHECKED(ops_.getattr(fname.c_str(), &st));
+  CHECKED(cached_getattr(fname, &st));
   if (S_ISLNK(st.st_mode)) {
     std::string resolved;
     CHECKED(resolve_symlink(fname, &resolved));
@@ -432,12 +569,15 @@ int impl_fuse_context::cleanup(LPCWSTR file_name,
 
 int impl_fuse_context::create_directory(LPCWSTR file_name,
                                         PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
 
   if (!ops_.mkdir)
     return -EINVAL;
 
-  return ops_.mkdir(fname.c_str(), dirmask_);
+  CHECKED(ops_.mkdir(fname.c_str(), dirmask_));
+  attr_cache_.forget(fname);
+  link_cache_.forget(fname);
+  return 0;
 }
 
 int impl_fuse_context::readdir_filler_set_has_files(void *buf, const char *name,
@@ -464,7 +604,7 @@ int impl_fuse_context::getdir_filler_set_has_files(fuse_dirh_t hndl, const char
 
 int impl_fuse_context::delete_directory(LPCWSTR file_name,
                                         PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
   if (!ops_.getattr || !ops_.rmdir || (!ops_.readdir && !ops_.getdir))
     return -EINVAL;
 
@@ -509,7 +649,7 @@ win_error impl_fuse_context::create_file(LPCWSTR file_name, DWORD access_mode,
                                          DWORD flags_and_attributes,
                                          ULONG CreateOptions,
                                          PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
   dokan_file_info->Context = 0;
 
   if (!ops_.getattr)
@@ -517,7 +657,7 @@ win_error impl_fuse_context::create_file(LPCWSTR file_name, DWORD access_mode,
 
   struct FUSE_STAT stbuf = {0};
   // Check if the target file/directory exists
-  if (ops_.getattr(fname.c_str(), &stbuf) < 0) {
+  if (cached_getattr(fname, &stbuf) < 0) {
     // Nope.
     if (dokan_file_info->IsDirectory)
       return -EINVAL; // We can't create directories using CreateFile
@@ -553,6 +693,7 @@ win_error impl_fuse_context::create_file(LPCWSTR file_name, DWORD access_mode,
         if (!ops_.truncate)
           return -EINVAL;
         CHECKED(ops_.truncate(fname.c_str(), 0));
+        attr_cache_.forget(fname);
       } else if (creation_disposition == FILE_CREATE) {
         return win_error(STATUS_OBJECT_NAME_COLLISION, true);
       }
@@ -584,13 +725,41 @@ int impl_fuse_context::close_file(LPCWSTR file_name,
   return flush_err;
 }
 
+// Fills buffer from read_buf, which may hand back descriptors instead of
+// memory, so the data is read from them straight into the request buffer.
+static int read_buf_into(const struct fuse_operations &ops, const char *name,
+                         char *buffer, size_t size, FUSE_OFF_T off,
+                         fuse_file_info *finfo) {
+  fuse_bufvec *src = nullptr;
+  int res = ops.read_buf(name, &src, size, off, finfo);
+  if (res < 0)
+    return res;
+  if (!src)
+    return -EIO;
+
+  fuse_bufvec dst = {};
+  dst.count = 1;
+  dst.buf[0].size = size;
+  dst.buf[0].mem = buffer;
+  dst.buf[0].fd = -1;
+  ssize_t copied =
+      fuse_buf_copy(&dst, src, static_cast<fuse_buf_copy_flags>(0));
+
+  for (size_t i = 0; i < src->count; ++i) {
+    if (!(src->buf[i].flags & FUSE_BUF_IS_FD))
+      free(src->buf[i].mem);
+  }
+  free(src);
+  return static_cast<int>(copied);
+}
+
 int impl_fuse_context::read_file(LPCWSTR /*file_name*/, LPVOID buffer,
                                  DWORD num_bytes_to_read, LPDWORD read_bytes,
                                  LONGLONG offset,
                                  PDOKAN_FILE_INFO dokan_file_info) {
   // Please note, that we ignore file_name here, because it might
   // have been retargeted by a symlink.
-  if (!ops_.read)
+  if (!ops_.read && !ops_.read_buf)
     return -EINVAL;
 
   *read_bytes = 0; // Conform to ReadFile semantics
@@ -617,9 +786,13 @@ int impl_fuse_context::read_file(LPCWSTR /*file_name*/, LPVOID buffer,
     if (max_read_ && to_read > max_read_)
       to_read = max_read_;
 
-    int res = ops_.read(file_name.c_str(), static_cast<char *>(buffer), to_read,
-                        off,
-                        &finfo);
+    int res;
+    if (ops_.read_buf)
+      res = read_buf_into(ops_, file_name.c_str(), static_cast<char *>(buffer),
+                          to_read, off, &finfo);
+    else
+      res = ops_.read(file_name.c_str(), static_cast<char *>(buffer), to_read,
+                      off, &finfo);
     if (res < 0)
       return res; // Error
     if (res == 0)
@@ -643,7 +816,7 @@ int impl_fuse_context::write_file(LPCWSTR /*file_name*/, LPCVOID buffer,
 
   *num_bytes_written = 0; // Conform to ReadFile semantics
 
-  if (!ops_.write)
+  if (!ops_.write && !ops_.write_buf)
     return -EINVAL;
 
   impl_file_handle *hndl =
@@ -671,10 +844,22 @@ int impl_fuse_context::write_file(LPCWSTR /*file_name*/, LPCVOID buffer,
   CHECKED(cast_from_longlong(offset, &off));
 
   fuse_file_info finfo(hndl->make_finfo());
-  int res = ops_.write(hndl->get_name().c_str(), static_cast<const char *>(buffer),
-                       num_bytes_to_write, off, &finfo);
+  int res;
+  if (ops_.write_buf) {
+    fuse_bufvec src = {};
+    src.count = 1;
+    src.buf[0].size = num_bytes_to_write;
+    src.buf[0].mem = const_cast<LPVOID>(buffer);
+    src.buf[0].fd = -1;
+    res = ops_.write_buf(hndl->get_name().c_str(), &src, off, &finfo);
+  } else {
+    res = ops_.write(hndl->get_name().c_str(),
+                     static_cast<const char *>(buffer), num_bytes_to_write,
+                     off, &finfo);
+  }
   if (res < 0)
     return res; // Error
+  attr_cache_.forget(hndl->get_name());
 
   // OK!
   *num_bytes_written = res;
@@ -706,13 +891,13 @@ int impl_fuse_context::flush_file_buffers(LPCWSTR /*file_name*/,
 int impl_fuse_context::get_file_information(
     LPCWSTR file_name, LPBY_HANDLE_FILE_INFORMATION handle_file_information,
     PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
 
   if (!ops_.getattr)
     return -EINVAL;
 
   struct FUSE_STAT st = {0};
-  CHECKED(ops_.getattr(fname.c_str(), &st));
+  CHECKED(cached_getattr(fname, &st));
   if (S_ISLNK(st.st_mode)) {
     std::string resolved;
     CHECKED(resolve_symlink(fname, &resolved));
@@ -735,7 +920,7 @@ int impl_fuse_context::get_file_information(
 
 int impl_fuse_context::delete_file(LPCWSTR file_name,
                                    PDOKAN_FILE_INFO dokan_file_info) {
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
 
   if (!ops_.getattr)
     return -EINVAL;
@@ -750,8 +935,8 @@ int impl_fuse_context::move_file(LPCWSTR file_name, LPCWSTR new_file_name,
   if (!ops_.rename || !ops_.getattr)
     return -EINVAL;
 
-  std::string name = unixify(wchar_to_utf8_cstr(file_name));
-  std::string new_name = unixify(wchar_to_utf8_cstr(new_file_name));
+  std::string name = unixify_wchar(file_name);
+  std::string new_name = unixify_wchar(new_file_name);
 
   struct FUSE_STAT stbuf = {0};
   if (ops_.getattr(new_name.c_str(), &stbuf) != -ENOENT) {
@@ -764,6 +949,8 @@ int impl_fuse_context::move_file(LPCWSTR file_name, LPCWSTR new_file_name,
     if (!ops_.unlink)
       return -EINVAL;
     CHECKED(ops_.unlink(new_name.c_str()));
+    attr_cache_.forget(new_name);
+    link_cache_.forget(new_name);
   }
 
   // this can happen cause DeleteFile in Windows can return success even if
@@ -774,6 +961,10 @@ int impl_fuse_context::move_file(LPCWSTR file_name, LPCWSTR new_file_name,
 
   CHECKED(ops_.rename(name.c_str(), new_name.c_str()));
   file_locks.renamed_file(name, new_name);
+  attr_cache_.forget_subtree(name);
+  attr_cache_.forget_subtree(new_name);
+  link_cache_.forget_subtree(name);
+  link_cache_.forget_subtree(new_name);
   return 0;
 }
 
@@ -837,19 +1028,23 @@ int impl_fuse_context::set_end_of_file(LPCWSTR file_name, LONGLONG byte_offset,
                                        PDOKAN_FILE_INFO dokan_file_info) {
   FUSE_OFF_T off;
   CHECKED(cast_from_longlong(byte_offset, &off));
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
   CHECKED(check_and_resolve(&fname));
 
   impl_file_handle *hndl =
       reinterpret_cast<impl_file_handle *>(dokan_file_info->Context);
   if (hndl && ops_.ftruncate) {
     fuse_file_info finfo(hndl->make_finfo());
-    return ops_.ftruncate(hndl->get_name().c_str(), off, &finfo);
+    CHECKED(ops_.ftruncate(hndl->get_name().c_str(), off, &finfo));
+    attr_cache_.forget(hndl->get_name());
+    return 0;
   }
 
   if (!ops_.truncate)
     return -EINVAL;
-  return ops_.truncate(fname.c_str(), off);
+  CHECKED(ops_.truncate(fname.c_str(), off));
+  attr_cache_.forget(fname);
+  return 0;
 }
 
 int impl_fuse_context::set_file_attributes(LPCWSTR file_name,
@@ -863,9 +1058,10 @@ int impl_fuse_context::set_file_attributes(LPCWSTR file_name,
   // time
   // setting from FAR Manager.
   if (ops_.win_set_attributes) {
-    std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+    std::string fname = unixify_wchar(file_name);
     CHECKED(check_and_resolve(&fname));
-    return ops_.win_set_attributes(fname.c_str(), file_attributes);
+    CHECKED(ops_.win_set_attributes(fname.c_str(), file_attributes));
+    attr_cache_.forget(fname);
   }
   return 0;
 }
@@ -892,28 +1088,33 @@ int impl_fuse_context::set_file_time(PCWSTR file_name,
     return -EINVAL;
 
   if (ops_.win_set_times) {
-    std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+    std::string fname = unixify_wchar(file_name);
     CHECKED(check_and_resolve(&fname));
 
     impl_file_handle *hndl =
         reinterpret_cast<impl_file_handle *>(dokan_file_info->Context);
-    if (!hndl)
-      return ops_.win_set_times(fname.c_str(), nullptr, creation_time,
-                                last_access_time, last_write_time);
+    if (!hndl) {
+      CHECKED(ops_.win_set_times(fname.c_str(), nullptr, creation_time,
+                                 last_access_time, last_write_time));
+      attr_cache_.forget(fname);
+      return 0;
+    }
 
     if (hndl->is_dir())
       return -EACCES;
 
     fuse_file_info finfo(hndl->make_finfo());
 
-    return ops_.win_set_times(fname.c_str(), &finfo, creation_time,
-                              last_access_time, last_write_time);
+    CHECKED(ops_.win_set_times(fname.c_str(), &finfo, creation_time,
+                               last_access_time, last_write_time));
+    attr_cache_.forget(fname);
+    return 0;
   }
 
   if (!ops_.getattr)
     return -EINVAL;
 
-  std::string fname = unixify(wchar_to_utf8_cstr(file_name));
+  std::string fname = unixify_wchar(file_name);
   CHECKED(check_and_resolve(&fname));
 
   struct FUSE_STAT st = {0};
@@ -929,7 +1130,7 @@ int impl_fuse_context::set_file_time(PCWSTR file_name,
     CHECKED(helper_set_time_struct(last_write_time, st.st_mtim.tv_sec,
                                    &(tv[1].tv_sec)));
 
-    return ops_.utimens(fname.c_str(), tv);
+    CHECKED(ops_.utimens(fname.c_str(), tv));
   } else {
     struct utimbuf ut = {0};
     // Access time
@@ -939,8 +1140,10 @@ int impl_fuse_context::set_file_time(PCWSTR file_name,
     CHECKED(helper_set_time_struct(last_write_time, st.st_mtim.tv_sec,
                                    &(ut.modtime)));
 
-    return ops_.utime(fname.c_str(), &ut);
+    CHECKED(ops_.utime(fname.c_str(), &ut));
   }
+  attr_cache_.forget(fname);
+  return 0;
 }
 
 int impl_fuse_context::get_disk_free_space(PULONGLONG free_bytes_available,
@@ -1001,6 +1204,167 @@ int impl_fuse_context::unmounted(PDOKAN_FILE_INFO DokanFileInfo) {
   return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////
+////// Attribute cache
+///////////////////////////////////////////////////////////////////////////////////////
+impl_attr_cache::impl_attr_cache(double attr_timeout)
+    : timeout_ms(attr_timeout > 0 ? static_cast<ULONGLONG>(attr_timeout * 1000)
+                                  : 0) {
+  InitializeCriticalSection(&lock);
+}
+
+void impl_attr_cache::purge_expired_unlocked(ULONGLONG now) {
+  entries_t::iterator i = entries.begin();
+  while (i != entries.end()) {
+    if (i->second.expires <= now)
+      i = entries.erase(i);
+    else
+      ++i;
+  }
+}
+
+void impl_attr_cache::put(const std::string &name, const struct FUSE_STAT &st) {
+  if (!enabled())
+    return;
+
+  ULONGLONG now = GetTickCount64();
+  EnterCriticalSection(&lock);
+  if (entries.size() >= MAX_ATTR_CACHE_ENTRIES) {
+    purge_expired_unlocked(now);
+    // Still full of live entries: a huge listing, start over rather than
+    // scanning for the oldest each time
+    if (entries.size() >= MAX_ATTR_CACHE_ENTRIES)
+      entries.clear();
+  }
+  entry &e = entries[name];
+  e.st = st;
+  e.expires = now + timeout_ms;
+  LeaveCriticalSection(&lock);
+}
+
+bool impl_attr_cache::get(const std::string &name, struct FUSE_STAT *st) {
+  if (!enabled())
+    return false;
+
+  bool found = false;
+  EnterCriticalSection(&lock);
+  entries_t::iterator i = entries.find(name);
+  if (i != entries.end()) {
+    if (i->second.expires > GetTickCount64()) {
+      *st = i->second.st;
+      found = true;
+    } else {
+      entries.erase(i);
+    }
+  }
+  LeaveCriticalSection(&lock);
+  return found;
+}
+
+void impl_attr_cache::forget(const std::string &name) {
+  if (!enabled())
+    return;
+
+  EnterCriticalSection(&lock);
+  entries.erase(name);
+  LeaveCriticalSection(&lock);
+}
+
+void impl_attr_cache::forget_subtree(const std::string &name) {
+  if (!enabled())
+    return;
+
+  // Children sort between "name/" and "name0", '0' following '/'
+  std::string first = name + '/';
+  std::string last = name + '0';
+  EnterCriticalSection(&lock);
+  entries.erase(name);
+  entries.erase(entries.lower_bound(first), entries.lower_bound(last));
+  LeaveCriticalSection(&lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+////// Symlink cache
+///////////////////////////////////////////////////////////////////////////////////////
+impl_link_cache::impl_link_cache(double entry_timeout)
+    : timeout_ms(entry_timeout > 0
+                     ? static_cast<ULONGLONG>(entry_timeout * 1000)
+                     : 0) {
+  InitializeCriticalSection(&lock);
+}
+
+void impl_link_cache::purge_expired_unlocked(ULONGLONG now) {
+  entries_t::iterator i = entries.begin();
+  while (i != entries.end()) {
+    if (i->second.expires <= now)
+      i = entries.erase(i);
+    else
+      ++i;
+  }
+}
+
+void impl_link_cache::put(const std::string &name, bool is_link,
+                          const std::string &target) {
+  if (!enabled())
+    return;
+
+  ULONGLONG now = GetTickCount64();
+  EnterCriticalSection(&lock);
+  if (entries.size() >= MAX_LINK_CACHE_ENTRIES) {
+    purge_expired_unlocked(now);
+    if (entries.size() >= MAX_LINK_CACHE_ENTRIES)
+      entries.clear();
+  }
+  entry &e = entries[name];
+  e.is_link = is_link;
+  e.target = target;
+  e.expires = now + timeout_ms;
+  LeaveCriticalSection(&lock);
+}
+
+bool impl_link_cache::get(const std::string &name, bool *is_link,
+                          std::string *target) {
+  if (!enabled())
+    return false;
+
+  bool found = false;
+  EnterCriticalSection(&lock);
+  entries_t::iterator i = entries.find(name);
+  if (i != entries.end()) {
+    if (i->second.expires > GetTickCount64()) {
+      *is_link = i->second.is_link;
+      if (i->second.is_link)
+        *target = i->second.target;
+      found = true;
+    } else {
+      entries.erase(i);
+    }
+  }
+  LeaveCriticalSection(&lock);
+  return found;
+}
+
+void impl_link_cache::forget(const std::string &name) {
+  if (!enabled())
+    return;
+
+  EnterCriticalSection(&lock);
+  entries.erase(name);
+  LeaveCriticalSection(&lock);
+}
+
+void impl_link_cache::forget_subtree(const std::string &name) {
+  if (!enabled())
+    return;
+
+  std::string first = name + '/';
+  std::string last = name + '0';
+  EnterCriticalSection(&lock);
+  entries.erase(name);
+  entries.erase(entries.lower_bound(first), entries.lower_bound(last));
+  LeaveCriticalSection(&lock);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////
 ////// File lock
 ///////////////////////////////////////////////////////////////////////////////////////
@@ -1017,28 +1381,41 @@ static DWORD required_share(DWORD access_mode) {
   return share;
 }
 
+impl_file_locks::impl_file_locks() {
+  for (shard &s : shards)
+    InitializeCriticalSection(&s.lock);
+}
+
+impl_file_locks::~impl_file_locks() {
+  for (shard &s : shards)
+    DeleteCriticalSection(&s.lock);
+}
+
 int impl_file_locks::get_file(const std::string &name, bool is_dir,
                               DWORD access_mode, DWORD shared_mode,
                               std::unique_ptr<impl_file_handle> &file) {
   int res = 0;
   file.reset(new impl_file_handle(is_dir, shared_mode));
 
+  size_t hash = hash_name(name);
+  shard &s = shard_for(hash);
+
   // check previous files with same names
   impl_file_lock *lock, *old_lock = nullptr;
-  EnterCriticalSection(&this->lock);
-  file_locks_t::iterator i = file_locks.find(name);
-  if (i != file_locks.end()) {
+  EnterCriticalSection(&s.lock);
+  file_locks_t::iterator i = s.file_locks.find(name);
+  if (i != s.file_locks.end()) {
     old_lock = lock = i->second;
     EnterCriticalSection(&lock->lock);
   } else {
-    lock = new impl_file_lock(this, name);
-    file_locks[name] = lock;
+    lock = new impl_file_lock(this, name, hash);
+    s.file_locks[name] = lock;
     lock->add_file_unlocked(file.get());
   }
   file->file_lock = lock;
 
   if (!old_lock) {
-    LeaveCriticalSection(&this->lock);
+    LeaveCriticalSection(&s.lock);
     return res;
   }
 
@@ -1055,7 +1432,7 @@ int impl_file_locks::get_file(const std::string &name, bool is_dir,
     lock->add_file_unlocked(file.get());
   }
   LeaveCriticalSection(&lock->lock);
-  LeaveCriticalSection(&this->lock);
+  LeaveCriticalSection(&s.lock);
   return res;
 }
 
@@ -1085,18 +1462,19 @@ void impl_file_lock::remove_file(impl_file_handle *file) {
   if (first_locked)
     return;
 
-  locks->remove_file(name_);
+  locks->remove_file(name_, hash_);
 }
 
-void impl_file_locks::remove_file(const std::string &name) {
-  EnterCriticalSection(&lock);
-  file_locks_t::iterator i = file_locks.find(name);
-  if (i != file_locks.end() && !i->second->first) {
+void impl_file_locks::remove_file(const std::string &name, size_t hash) {
+  shard &s = shard_for(hash);
+  EnterCriticalSection(&s.lock);
+  file_locks_t::iterator i = s.file_locks.find(name);
+  if (i != s.file_locks.end() && !i->second->first) {
     if (i->second)
       delete i->second;
-    file_locks.erase(i);
+    s.file_locks.erase(i);
   }
-  LeaveCriticalSection(&lock);
+  LeaveCriticalSection(&s.lock);
 }
 
 void impl_file_locks::renamed_file(const std::string &name,
@@ -1104,18 +1482,31 @@ void impl_file_locks::renamed_file(const std::string &name,
   if (name == new_name)
     return;
 
-  EnterCriticalSection(&lock);
+  size_t new_hash = hash_name(new_name);
+  shard &from = shard_for(hash_name(name));
+  shard &to = shard_for(new_hash);
+
+  // Always take two shards in the same order
+  shard *first_shard = &from < &to ? &from : &to;
+  shard *second_shard = &from < &to ? &to : &from;
+  EnterCriticalSection(&first_shard->lock);
+  if (second_shard != first_shard)
+    EnterCriticalSection(&second_shard->lock);
   // TODO what happen if new_name exists ??
-  file_locks_t::iterator i = file_locks.find(name);
-  if (i != file_locks.end()) {
+  file_locks_t::iterator i = from.file_locks.find(name);
+  if (i != from.file_locks.end()) {
     impl_file_lock *lock = i->second;
     EnterCriticalSection(&lock->lock);
     lock->name_ = new_name;
+    lock->hash_ = new_hash;
     LeaveCriticalSection(&lock->lock);
-    file_locks[new_name] = lock;
-    file_locks.erase(i);
+    // Erase first, inserting may rehash and invalidate i
+    from.file_locks.erase(i);
+    to.file_locks[new_name] = lock;
   }
-  LeaveCriticalSection(&lock);
+  if (second_shard != first_shard)
+    LeaveCriticalSection(&second_shard->lock);
+  LeaveCriticalSection(&first_shard->lock);
 }
 
 int impl_file_lock::lock_file(impl_file_handle *file, long long start,
@@ -1179,7 +1570,8 @@ int impl_file_lock::unlock_file(impl_file_handle *file, long long start,
 ////// File handle
 ///////////////////////////////////////////////////////////////////////////////////////
 impl_file_handle::impl_file_handle(bool is_dir, DWORD shared_mode)
-    : is_dir_(is_dir), open_flags_(0), fh_(-1), next_file(nullptr), file_lock(nullptr), shared_mode_(shared_mode) {}
+    : is_dir_(is_dir), open_flags_(0), fh_(-1), next_file(nullptr), file_lock(nullptr), shared_mode_(shared_mode),
+      readdir_index_(0), readdir_offset_(0) {}
 
 impl_file_handle::~impl_file_handle() { file_lock->remove_file(this); }
 
@@ -5,12 +5,85 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include "utils.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define UTILS_SSE2 1
+#endif
+
+// Paths shorter than this are converted without touching the heap
+#define UNIX_PATH_STACK_SIZE 1024
+
+// Widens the ASCII prefix of src (len bytes) into res and returns its length
+static size_t ascii_to_wchar(const char *src, size_t len, wchar_t *res) {
+  size_t i = 0;
+#ifdef UTILS_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= len; i += 16) {
+    __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    if (_mm_movemask_epi8(bytes) != 0) // A byte with the high bit set
+      break;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(res + i),
+                     _mm_unpacklo_epi8(bytes, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(res + i + 8),
+                     _mm_unpackhi_epi8(bytes, zero));
+  }
+#endif
+  for (; i < len; ++i) {
+    unsigned char ch = static_cast<unsigned char>(src[i]);
+    if (ch >= 0x80)
+      break;
+    res[i] = ch;
+  }
+  return i;
+}
+
+// Narrows the ASCII prefix of src (len characters) into res, turning
+// backslashes into slashes on the way, and returns its length
+static size_t ascii_to_unix_utf8(const wchar_t *src, size_t len, char *res) {
+  size_t i = 0;
+#ifdef UTILS_SSE2
+  const __m128i high = _mm_set1_epi16(static_cast<short>(0xff80));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i slash = _mm_set1_epi8('/');
+  for (; i + 16 <= len; i += 16) {
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+    __m128i wide = _mm_and_si128(_mm_or_si128(lo, hi), high);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(wide, zero)) != 0xffff)
+      break;
+    __m128i bytes = _mm_packus_epi16(lo, hi);
+    __m128i sep = _mm_cmpeq_epi8(bytes, backslash);
+    bytes = _mm_or_si128(_mm_andnot_si128(sep, bytes), _mm_and_si128(sep, slash));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(res + i), bytes);
+  }
+#endif
+  for (; i < len; ++i) {
+    wchar_t ch = src[i];
+    if (ch >= 0x80)
+      break;
+    res[i] = ch == L'\\' ? '/' : static_cast<char>(ch);
+  }
+  return i;
+}
 
 int utf8_to_wchar_buf(const char* src, wchar_t* res, int maxlen) {
   if (res == nullptr || maxlen <= 0)
     return -1;
 
-  int ln = MultiByteToWideChar(CP_UTF8, 0, src, -1, res, maxlen);
+  size_t len = strlen(src);
+  size_t ascii = 0;
+  if (len < static_cast<size_t>(maxlen))
+    ascii = ascii_to_wchar(src, len, res);
+  if (ascii == len) {
+    res[len] = L'\0';
+    return static_cast<int>(len + 1);
+  }
+
+  int ln = MultiByteToWideChar(CP_UTF8, 0, src + ascii, -1, res + ascii,
+                               maxlen - static_cast<int>(ascii));
   if (ln <= 0) {
     *res = L'\0';
     return -1;
@@ -18,13 +91,47 @@ int utf8_to_wchar_buf(const char* src, wchar_t* res, int maxlen) {
 
   // This api replaces illegal sequences with U+FFFD,
   // so we mark the conversion as failed.
-  for (size_t i = 0; i < ln; i++) {
+  for (size_t i = ascii; i < ascii + ln; i++) {
     if (res[i] == 0xfffd) {
       *res = L'\0';
       return -1;
     }
   }
-  return ln;
+  return static_cast<int>(ascii) + ln;
+}
+
+// Same result as unixify(wchar_to_utf8_cstr(src)) written into res.
+// Returns the length without the terminating null, -1 if it does not fit.
+int wchar_to_unix_utf8_buf(const wchar_t *src, char *res, int maxlen) {
+  if (res == nullptr || maxlen <= 0)
+    return -1;
+
+  size_t len = wcslen(src);
+  size_t n = 0;
+  if (len < static_cast<size_t>(maxlen))
+    n = ascii_to_unix_utf8(src, len, res);
+  if (n < len) {
+    int room = maxlen - 1 - static_cast<int>(n);
+    int ln = room > 0 ? WideCharToMultiByte(CP_UTF8, 0, src + n,
+                                            static_cast<int>(len - n), res + n,
+                                            room, nullptr, nullptr)
+                      : 0;
+    if (ln <= 0) {
+      *res = '\0';
+      return -1;
+    }
+    // A backslash byte can only be a backslash in UTF-8
+    for (size_t i = n; i < n + ln; ++i) {
+      if (res[i] == '\\')
+        res[i] = '/';
+    }
+    n += ln;
+  }
+  // Remove the trailing slash
+  if (n > 1 && res[n - 1] == '/')
+    --n;
+  res[n] = '\0';
+  return static_cast<int>(n);
 }
 
 void utf8_to_wchar_buf_old(const char *src, wchar_t *res, int maxlen) {
@@ -76,6 +183,14 @@ std::string unixify(const std::string &str) {
   return res;
 }
 
+std::string unixify_wchar(const wchar_t *str) {
+  char buf[UNIX_PATH_STACK_SIZE];
+  int ln = wchar_to_unix_utf8_buf(str, buf, UNIX_PATH_STACK_SIZE);
+  if (ln >= 0)
+    return std::string(buf, ln);
+  return unixify(wchar_to_utf8_cstr(str));
+}
+
 FILETIME unixTimeToFiletime(time_t t) {
   // Note that LONGLONG is a 64-bit value
   LONGLONG ll;
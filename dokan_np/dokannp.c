@@ -26,7 +26,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 */
 
-#include "../dokan/dokan.h"
+#include "../dokan/dokanc.h"
 #include <malloc.h>
 #include <npapi.h>
 #include <stdio.h>
@@ -56,6 +56,167 @@ static VOID DokanDbgPrintW(LPCWSTR format, ...) {
 
 #define DbgPrintW(format, ...) DokanDbgPrintW(format, __VA_ARGS__)
 
+// Mount point list shared by the provider entry points of the process.
+// Explorer calls them many times while browsing the network tree, so the list
+// is only fetched again from the driver once the FSCTL_MOUNTPOINT_LIST_CHANGE
+// request armed with its generation has completed. A caller keeps its
+// reference on the list it got even after a newer one replaced it.
+typedef struct _NP_MOUNT_POINT_LIST {
+  LONG RefCount;
+  ULONG Count;
+  PDOKAN_MOUNT_POINT_INFO Entries;
+} NP_MOUNT_POINT_LIST, *PNP_MOUNT_POINT_LIST;
+
+static SRWLOCK g_MountPointListLock = SRWLOCK_INIT;
+// The cached list. Valid while g_ChangePending is set and the change request
+// has not completed.
+static PNP_MOUNT_POINT_LIST g_MountPointList = NULL;
+// Overlapped handle on the global device and the completion port it is bound
+// to. Binding the handle to a port keeps the change request pending when the
+// thread that issued it exits.
+static HANDLE g_GlobalDevice = INVALID_HANDLE_VALUE;
+static HANDLE g_ChangePort = NULL;
+static OVERLAPPED g_ChangeOverlapped;
+static ULONG g_ChangeGeneration = 0;
+static BOOL g_ChangePending = FALSE;
+
+static VOID NpReleaseMountPointList(PNP_MOUNT_POINT_LIST List) {
+  if (List != NULL && InterlockedDecrement(&List->RefCount) == 0) {
+    DokanReleaseMountPointList(List->Entries);
+    HeapFree(GetProcessHeap(), 0, List);
+  }
+}
+
+static BOOL NpIsMountPointListValid() {
+  return g_MountPointList != NULL && g_ChangePending &&
+         !HasOverlappedIoCompleted(&g_ChangeOverlapped);
+}
+
+// Opens the global device the change requests are sent to, if not done yet.
+static BOOL NpOpenChangeDevice() {
+  if (g_GlobalDevice != INVALID_HANDLE_VALUE) {
+    return TRUE;
+  }
+  HANDLE device = CreateFile(DOKAN_GLOBAL_DEVICE_NAME, 0,
+                             FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                             OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+  if (device == INVALID_HANDLE_VALUE) {
+    DbgPrintW(L"NpOpenChangeDevice CreateFile failed %d\n", GetLastError());
+    return FALSE;
+  }
+  // Requests completing synchronously queue nothing to the port, so the only
+  // packets are those of the pending change requests.
+  HANDLE port = CreateIoCompletionPort(device, NULL, 0, 1);
+  if (port == NULL ||
+      !SetFileCompletionNotificationModes(
+          device, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS)) {
+    DbgPrintW(L"NpOpenChangeDevice port setup failed %d\n", GetLastError());
+    if (port != NULL) {
+      CloseHandle(port);
+    }
+    CloseHandle(device);
+    return FALSE;
+  }
+  g_GlobalDevice = device;
+  g_ChangePort = port;
+  return TRUE;
+}
+
+// Waits for the change request to complete and takes its packet off the port.
+static VOID NpCompleteChangeRequest() {
+  DWORD bytes;
+  ULONG_PTR key;
+  LPOVERLAPPED overlapped;
+  GetQueuedCompletionStatus(g_ChangePort, &bytes, &key, &overlapped, INFINITE);
+  g_ChangePending = FALSE;
+}
+
+// Returns a reference on the current mount point list, to be released with
+// NpReleaseMountPointList, or NULL on failure. The list is fetched from the
+// driver only when it changed since the cached one was fetched, or when the
+// driver cannot tell.
+static PNP_MOUNT_POINT_LIST NpAcquireMountPointList() {
+  PNP_MOUNT_POINT_LIST list = NULL;
+
+  AcquireSRWLockShared(&g_MountPointListLock);
+  if (NpIsMountPointListValid()) {
+    list = g_MountPointList;
+    InterlockedIncrement(&list->RefCount);
+  }
+  ReleaseSRWLockShared(&g_MountPointListLock);
+  if (list != NULL) {
+    return list;
+  }
+
+  AcquireSRWLockExclusive(&g_MountPointListLock);
+  if (NpIsMountPointListValid()) {
+    // Refreshed by another thread in the meantime.
+    list = g_MountPointList;
+    InterlockedIncrement(&list->RefCount);
+    ReleaseSRWLockExclusive(&g_MountPointListLock);
+    return list;
+  }
+  if (g_ChangePending) {
+    NpCompleteChangeRequest();
+  }
+  NpReleaseMountPointList(g_MountPointList);
+  g_MountPointList = NULL;
+
+  // The generation is read before the list so that a change in between
+  // completes the next change request right away.
+  ULONG generation = 0;
+  DWORD returnedLength = 0;
+  ZeroMemory(&g_ChangeOverlapped, sizeof(g_ChangeOverlapped));
+  BOOL notify = NpOpenChangeDevice() &&
+                DeviceIoControl(g_GlobalDevice, FSCTL_MOUNTPOINT_LIST_CHANGE,
+                                NULL, 0, &generation, sizeof(generation),
+                                &returnedLength, &g_ChangeOverlapped);
+
+  list = HeapAlloc(GetProcessHeap(), 0, sizeof(NP_MOUNT_POINT_LIST));
+  if (list == NULL) {
+    ReleaseSRWLockExclusive(&g_MountPointListLock);
+    return NULL;
+  }
+  list->RefCount = 1;
+  // The driver returns no list when there is no mount point.
+  list->Entries = DokanGetMountPointList(FALSE, &list->Count);
+
+  if (notify) {
+    g_ChangeGeneration = generation;
+    if (!DeviceIoControl(g_GlobalDevice, FSCTL_MOUNTPOINT_LIST_CHANGE,
+                         &generation, sizeof(generation), &g_ChangeGeneration,
+                         sizeof(g_ChangeGeneration), NULL,
+                         &g_ChangeOverlapped) &&
+        GetLastError() == ERROR_IO_PENDING) {
+      g_ChangePending = TRUE;
+      g_MountPointList = list;
+      InterlockedIncrement(&list->RefCount);
+    }
+  }
+  ReleaseSRWLockExclusive(&g_MountPointListLock);
+  return list;
+}
+
+BOOL WINAPI DllMain(HINSTANCE Instance, DWORD Reason, LPVOID Reserved) {
+  UNREFERENCED_PARAMETER(Instance);
+
+  // On process exit the pending request goes away with the process.
+  if (Reason == DLL_PROCESS_DETACH && Reserved == NULL) {
+    if (g_ChangePending) {
+      CancelIoEx(g_GlobalDevice, &g_ChangeOverlapped);
+      NpCompleteChangeRequest();
+    }
+    NpReleaseMountPointList(g_MountPointList);
+    g_MountPointList = NULL;
+    if (g_GlobalDevice != INVALID_HANDLE_VALUE) {
+      CloseHandle(g_ChangePort);
+      CloseHandle(g_GlobalDevice);
+      g_GlobalDevice = INVALID_HANDLE_VALUE;
+    }
+  }
+  return TRUE;
+}
+
 DWORD APIENTRY NPGetCaps(DWORD Index) {
   DWORD rc = 0;
   DbgPrintW(L"NPGetCaps %d\n", Index);
@@ -227,14 +388,15 @@ DWORD APIENTRY NPAddConnection3(__in HWND WndOwner,
 DWORD APIENTRY NPCancelConnection(__in LPWSTR Name, __in BOOL Force) {
   DbgPrintW(L"NpCancelConnection %s %d\n", Name, Force);
 
-  ULONG nbRead = 0;
   WCHAR dosDevice[] = L"\\DosDevices\\C:";
-  PDOKAN_MOUNT_POINT_INFO dokanMountPointInfo =
-      DokanGetMountPointList(FALSE, &nbRead);
-  if (dokanMountPointInfo == NULL) {
+  PNP_MOUNT_POINT_LIST mountPointList = NpAcquireMountPointList();
+  if (mountPointList == NULL || mountPointList->Count == 0) {
     DbgPrintW(L"NpGetConnection DokanGetMountPointList failed\n");
+    NpReleaseMountPointList(mountPointList);
     return WN_NOT_CONNECTED;
   }
+  ULONG nbRead = mountPointList->Count;
+  PDOKAN_MOUNT_POINT_INFO dokanMountPointInfo = mountPointList->Entries;
 
   dosDevice[12] = Name[0];
 
@@ -242,7 +404,7 @@ DWORD APIENTRY NPCancelConnection(__in LPWSTR Name, __in BOOL Force) {
     if (wcscmp(dokanMountPointInfo[i].MountPoint, dosDevice) == 0) {
       if (dokanMountPointInfo[i].MountOptions &
           DOKAN_EVENT_ENABLE_NETWORK_UNMOUNT) {
-        DokanReleaseMountPointList(dokanMountPointInfo);
+        NpReleaseMountPointList(mountPointList);
         if (DokanRemoveMountPoint(Name)) {
           DbgPrintW(L"NpCancelConnection: DokanRemoveMountPoint succeeded\n");
           return WN_SUCCESS;
@@ -254,6 +416,7 @@ DWORD APIENTRY NPCancelConnection(__in LPWSTR Name, __in BOOL Force) {
     }
   }
 
+  NpReleaseMountPointList(mountPointList);
   DbgPrintW(L"NpCancelConnection Disconnect was ignored\n");
 
   return WN_NO_ERROR;
@@ -263,14 +426,15 @@ DWORD APIENTRY NPGetConnection(__in LPWSTR LocalName, __out LPWSTR RemoteName,
                                __inout LPDWORD BufferSize) {
   DbgPrintW(L"NpGetConnection %s, %d\n", LocalName, *BufferSize);
 
-  ULONG nbRead = 0;
   WCHAR dosDevice[] = L"\\DosDevices\\C:";
-  PDOKAN_MOUNT_POINT_INFO dokanMountPointInfo =
-      DokanGetMountPointList(FALSE, &nbRead);
-  if (dokanMountPointInfo == NULL) {
+  PNP_MOUNT_POINT_LIST mountPointList = NpAcquireMountPointList();
+  if (mountPointList == NULL || mountPointList->Count == 0) {
     DbgPrintW(L"NpGetConnection DokanGetMountPointList failed\n");
+    NpReleaseMountPointList(mountPointList);
     return WN_NOT_CONNECTED;
   }
+  ULONG nbRead = mountPointList->Count;
+  PDOKAN_MOUNT_POINT_INFO dokanMountPointInfo = mountPointList->Entries;
 
   DWORD currentSessionId;
   if (!ProcessIdToSessionId(GetCurrentProcessId(), &currentSessionId)) {
@@ -284,7 +448,7 @@ DWORD APIENTRY NPGetConnection(__in LPWSTR LocalName, __out LPWSTR RemoteName,
         dokanMountPointInfo[i].SessionId == currentSessionId) &&
         wcscmp(dokanMountPointInfo[i].MountPoint, dosDevice) == 0) {
       if (wcscmp(dokanMountPointInfo[i].UNCName, L"") == 0) {
-        DokanReleaseMountPointList(dokanMountPointInfo);
+        NpReleaseMountPointList(mountPointList);
         // No UNC, always return success
         if (*BufferSize == 0)
           return WN_MORE_DATA;
@@ -298,17 +462,17 @@ DWORD APIENTRY NPGetConnection(__in LPWSTR LocalName, __out LPWSTR RemoteName,
           (lstrlenW(dokanMountPointInfo[i].UNCName) + 2) * sizeof(WCHAR);
       if (len > *BufferSize) {
         *BufferSize = len;
-        DokanReleaseMountPointList(dokanMountPointInfo);
+        NpReleaseMountPointList(mountPointList);
         return WN_MORE_DATA;
       }
       RemoteName[0] = L'\\';
       CopyMemory(&RemoteName[1], dokanMountPointInfo[i].UNCName, len);
       *BufferSize = len;
-      DokanReleaseMountPointList(dokanMountPointInfo);
+      NpReleaseMountPointList(mountPointList);
       return WN_SUCCESS;
     }
   }
-  DokanReleaseMountPointList(dokanMountPointInfo);
+  NpReleaseMountPointList(mountPointList);
   return WN_NOT_CONNECTED;
 }
 
@@ -598,13 +762,14 @@ DWORD APIENTRY NPEnumResource(__in HANDLE Enum, __in LPDWORD Count,
   ULONG cEntriesCopied = 0;
   PWCHAR pStrings = (PWCHAR)((PBYTE)Buffer + *BufferSize);
   PWCHAR pDst;
-  ULONG nbRead = 0;
-  PDOKAN_MOUNT_POINT_INFO dokanMountPointInfo =
-      DokanGetMountPointList(TRUE, &nbRead);
-  if (dokanMountPointInfo == NULL) {
+  PNP_MOUNT_POINT_LIST mountPointList = NpAcquireMountPointList();
+  if (mountPointList == NULL || mountPointList->Count == 0) {
     DbgPrintW(L"NPEnumResource DokanGetMountPointList failed\n");
+    NpReleaseMountPointList(mountPointList);
     return WN_NO_MORE_ENTRIES;
   }
+  ULONG nbRead = mountPointList->Count;
+  PDOKAN_MOUNT_POINT_INFO dokanMountPointInfo = mountPointList->Entries;
 
   DWORD processId = GetCurrentProcessId();
   DWORD sessionId = 0;
@@ -621,8 +786,9 @@ DWORD APIENTRY NPEnumResource(__in HANDLE Enum, __in LPDWORD Count,
       continue;
     }
     if (wcscmp(dokanMountPointInfo[pCtx->index].UNCName, L"") == 0) {
-      DbgPrintW(L"NPEnumResource: end reached at index %lu\n", pCtx->index);
-      break;
+      // The shared list also holds the mount points without UNC name.
+      pCtx->index++;
+      continue;
     }
 
     if (pCtx->dwScope == RESOURCE_CONNECTED) {
@@ -777,7 +943,7 @@ DWORD APIENTRY NPEnumResource(__in HANDLE Enum, __in LPDWORD Count,
       dwStatus = WN_NO_MORE_ENTRIES;
     } else {
       DbgPrintW(L"NPEnumResource: invalid dwScope 0x%x\n", pCtx->dwScope);
-      DokanReleaseMountPointList(dokanMountPointInfo);
+      NpReleaseMountPointList(mountPointList);
       return WN_BAD_HANDLE;
     }
   }
@@ -785,8 +951,7 @@ DWORD APIENTRY NPEnumResource(__in HANDLE Enum, __in LPDWORD Count,
   *Count = cEntriesCopied;
 
   if (cEntriesCopied == 0 && dwStatus == WN_SUCCESS) {
-    if (pCtx->index >= nbRead ||
-        wcscmp(dokanMountPointInfo[pCtx->index].UNCName, L"") == 0) {
+    if (pCtx->index >= nbRead) {
       dwStatus = WN_NO_MORE_ENTRIES;
     } else {
       DbgPrintW(L"NPEnumResource: More Data Needed - %d\n", cbEntry);
@@ -797,7 +962,7 @@ DWORD APIENTRY NPEnumResource(__in HANDLE Enum, __in LPDWORD Count,
 
   DbgPrintW(L"NPEnumResource: Entries returned %d, dwStatus 0x%08X\n",
             cEntriesCopied, dwStatus);
-  DokanReleaseMountPointList(dokanMountPointInfo);
+  NpReleaseMountPointList(mountPointList);
   return dwStatus;
 }
 
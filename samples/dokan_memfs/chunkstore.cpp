@@ -0,0 +1,239 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "chunkstore.h"
+#include "memfs_log.h"
+
+#include <cstring>
+
+namespace memfs {
+data_chunk::data_chunk() : data(std::make_unique<uint8_t[]>(size)) {
+  chunk_store::get().add(*this);
+}
+
+data_chunk::data_chunk(int64_t image_slot)
+    : sequence(1), image_slot(image_slot) {}
+
+data_chunk::~data_chunk() { chunk_store::get().remove(*this); }
+
+chunk_write_lock::chunk_write_lock(data_chunk& c,
+                                   std::unique_lock<std::shared_mutex> lock)
+    : _chunk(c), _lock(std::move(lock)) {
+  _chunk.sequence.fetch_add(1, std::memory_order_relaxed);
+  // Readers seeing the data written must see the odd sequence
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+chunk_write_lock::~chunk_write_lock() {
+  _chunk.sequence.fetch_add(1, std::memory_order_release);
+}
+
+chunk_store& chunk_store::get() {
+  static chunk_store store;
+  return store;
+}
+
+chunk_store::~chunk_store() {
+  if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+  if (_image != INVALID_HANDLE_VALUE) CloseHandle(_image);
+}
+
+void chunk_store::set_budget(uint64_t budget) {
+  WCHAR temp_path[MAX_PATH];
+  WCHAR file_name[MAX_PATH];
+  if (!GetTempPathW(MAX_PATH, temp_path) ||
+      !GetTempFileNameW(temp_path, L"mfs", 0, file_name))
+    throw std::runtime_error("Failed to get a backing file name");
+  HANDLE file = CreateFileW(
+      file_name, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Failed to create the backing file");
+
+  std::scoped_lock lock(_mutex);
+  if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+  _file = file;
+  _budget = budget;
+  SPDLOG_INFO(L"Memory budget {} bytes spilled to {}", budget, file_name);
+}
+
+void chunk_store::set_image(HANDLE image) {
+  std::scoped_lock lock(_mutex);
+  if (_image != INVALID_HANDLE_VALUE) CloseHandle(_image);
+  _image = image;
+}
+
+std::shared_lock<std::shared_mutex> chunk_store::lock_shared(data_chunk& c) {
+  for (;;) {
+    std::shared_lock chunk_lock(c.mutex);
+    if (c.data) {
+      touch(c);
+      return chunk_lock;
+    }
+    chunk_lock.unlock();
+    // Spilled or in the image - read it. It can be spilled again before we
+    // get the shared lock back, in which case we retry.
+    std::unique_lock chunk_write_lock(c.mutex);
+    if (!c.data) load(c);
+  }
+}
+
+chunk_write_lock chunk_store::lock(data_chunk& c) {
+  std::unique_lock chunk_lock(c.mutex);
+  if (c.data)
+    touch(c);
+  else
+    load(c);
+  // The image copy is stale once written
+  c.image_slot = -1;
+  return chunk_write_lock(c, std::move(chunk_lock));
+}
+
+bool chunk_store::try_read(data_chunk& c, void* buffer, size_t offset,
+                           size_t length) {
+  if (_budget) return false;
+  const uint32_t sequence = c.sequence.load(std::memory_order_acquire);
+  if (sequence & 1) return false;
+  // Without budget the data stays resident once loaded, a concurrent write
+  // can only make the copy torn, which the sequence check detects.
+  memcpy(buffer, c.data.get() + offset, length);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return c.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+void chunk_store::add(data_chunk& c) {
+  _resident_bytes += data_chunk::size;
+  if (!_budget) return;
+  std::scoped_lock lock(_mutex);
+  c.lru = _lru.insert(_lru.begin(), &c);
+  c.in_lru = true;
+  evict(&c);
+}
+
+void chunk_store::remove(data_chunk& c) {
+  // Only in the image file, never accounted
+  if (!c.data && c.slot < 0) return;
+  if (!_budget) {
+    _resident_bytes -= data_chunk::size;
+    return;
+  }
+  std::scoped_lock lock(_mutex);
+  if (c.in_lru) _lru.erase(c.lru);
+  if (c.data) {
+    _resident_bytes -= data_chunk::size;
+  } else {
+    _free_slots.push_back(c.slot);
+    _spilled_bytes -= data_chunk::size;
+  }
+}
+
+void chunk_store::load(data_chunk& c) {
+  std::scoped_lock lock(_mutex);
+  auto data = std::make_unique<uint8_t[]>(data_chunk::size);
+  const bool spilled = c.slot >= 0;
+  OVERLAPPED overlapped = {};
+  const uint64_t offset =
+      spilled ? static_cast<uint64_t>(c.slot) * data_chunk::size
+              : data_chunk::image_offset(c.image_slot);
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD read = 0;
+  if (!ReadFile(spilled ? _file : _image, data.get(), data_chunk::size, &read,
+                &overlapped) ||
+      read != data_chunk::size) {
+    // The data is lost, better crash than serve zeros
+    SPDLOG_ERROR(L"Failed to read back chunk {} / {}: {}", c.slot,
+                 c.image_slot, GetLastError());
+    throw std::runtime_error("Failed to read back a chunk");
+  }
+  c.data = std::move(data);
+  c.sequence.fetch_add(1, std::memory_order_release);
+  if (spilled) {
+    _free_slots.push_back(c.slot);
+    c.slot = -1;
+    _spilled_bytes -= data_chunk::size;
+  }
+  _resident_bytes += data_chunk::size;
+  if (!_budget) return;
+  c.lru = _lru.insert(_lru.begin(), &c);
+  c.in_lru = true;
+  evict(&c);
+}
+
+void chunk_store::touch(data_chunk& c) {
+  if (!_budget) return;
+  std::scoped_lock lock(_mutex);
+  if (c.in_lru) _lru.splice(_lru.begin(), _lru, c.lru);
+}
+
+void chunk_store::evict(data_chunk* current) {
+  auto it = _lru.end();
+  while (_resident_bytes > _budget && it != _lru.begin()) {
+    data_chunk* c = *--it;
+    // Skip chunks in use, they are recently used anyway. Waiting for them
+    // would invert the chunk / store lock order.
+    if (c == current || !c->mutex.try_lock()) continue;
+    std::unique_lock chunk_lock(c->mutex, std::adopt_lock);
+
+    // Unmodified since read from the image, it can be read from it again
+    if (c->image_slot >= 0) {
+      c->sequence.fetch_add(1, std::memory_order_relaxed);
+      c->data.reset();
+      c->in_lru = false;
+      it = _lru.erase(it);
+      _resident_bytes -= data_chunk::size;
+      continue;
+    }
+
+    int64_t slot;
+    if (!_free_slots.empty()) {
+      slot = _free_slots.back();
+      _free_slots.pop_back();
+    } else {
+      slot = _slot_count++;
+    }
+    OVERLAPPED overlapped = {};
+    const uint64_t offset = static_cast<uint64_t>(slot) * data_chunk::size;
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    if (!WriteFile(_file, c->data.get(), data_chunk::size, &written,
+                   &overlapped) ||
+        written != data_chunk::size) {
+      SPDLOG_ERROR(L"Failed to spill chunk: {}", GetLastError());
+      _free_slots.push_back(slot);
+      return;
+    }
+    c->sequence.fetch_add(1, std::memory_order_relaxed);
+    c->data.reset();
+    c->slot = slot;
+    c->in_lru = false;
+    it = _lru.erase(it);
+    _resident_bytes -= data_chunk::size;
+    _spilled_bytes += data_chunk::size;
+  }
+}
+}  // namespace memfs
@@ -0,0 +1,152 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef CHUNKSTORE_H_
+#define CHUNKSTORE_H_
+
+#include <Windows.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace memfs {
+
+// Fixed size block of file data. Its memory is accounted by chunk_store and
+// can be spilled to the backing file when over the memory budget, or dropped
+// when it is unmodified since read from the image file.
+// Access data only through chunk_store::lock / lock_shared / try_read.
+struct data_chunk {
+  static constexpr size_t size = 64 * 1024;
+
+  data_chunk();
+  // Chunk stored at image_slot of the image file and read on first access.
+  explicit data_chunk(int64_t image_slot);
+  ~data_chunk();
+
+  // Offset of image_slot in the image file, whose first block holds the
+  // image header.
+  static uint64_t image_offset(int64_t image_slot) {
+    return static_cast<uint64_t>(image_slot + 1) * size;
+  }
+  data_chunk(const data_chunk&) = delete;
+  data_chunk& operator=(const data_chunk&) = delete;
+
+  std::shared_mutex mutex;
+  // Odd while data is not resident or being written, bumped by each write.
+  // Lets readers copy the data without the lock and check it did not change.
+  std::atomic<uint32_t> sequence = 0;
+  // mutex need to be aquired
+  // nullptr while spilled or not read from the image yet
+  std::unique_ptr<uint8_t[]> data;
+  // Slot of the image file holding the same data, -1 once written since.
+  int64_t image_slot = -1;
+  // chunk_store lock need to be aquired
+  // Position in the backing file while spilled
+  int64_t slot = -1;
+  bool in_lru = false;
+  std::list<data_chunk*>::iterator lru;
+};
+
+// Exclusive lock of a chunk, seen by optimistic readers as a write in
+// progress until released.
+class chunk_write_lock {
+ public:
+  chunk_write_lock(data_chunk& c, std::unique_lock<std::shared_mutex> lock);
+  ~chunk_write_lock();
+  chunk_write_lock(const chunk_write_lock&) = delete;
+  chunk_write_lock& operator=(const chunk_write_lock&) = delete;
+
+ private:
+  data_chunk& _chunk;
+  std::unique_lock<std::shared_mutex> _lock;
+};
+
+// Memory budget of the file data of all memfs volumes of the process.
+// Once over budget, the least recently used chunks are written to a backing
+// file and their memory is released. They are read back on the next access.
+class chunk_store {
+ public:
+  static chunk_store& get();
+
+  // Limit the resident file data to budget bytes and spill the rest to a
+  // temporary backing file. Must be called before any data is written.
+  void set_budget(uint64_t budget);
+
+  // Set the image file the chunks created with an image slot are read from.
+  // The store owns and closes it.
+  void set_image(HANDLE image);
+  HANDLE image() { return _image; }
+
+  // Lock c with its data resident, to read it.
+  std::shared_lock<std::shared_mutex> lock_shared(data_chunk& c);
+  // Lock c with its data resident, to write it.
+  chunk_write_lock lock(data_chunk& c);
+  // Copy length bytes at offset of c without locking it. Return false if c
+  // is not resident or was written meanwhile, the copy must then be redone
+  // under lock_shared. Never succeeds with a budget, as the data could be
+  // released during the copy.
+  bool try_read(data_chunk& c, void* buffer, size_t offset, size_t length);
+
+  uint64_t resident_bytes() { return _resident_bytes; }
+  uint64_t spilled_bytes() { return _spilled_bytes; }
+
+ private:
+  friend struct data_chunk;
+
+  chunk_store() = default;
+  ~chunk_store();
+
+  void add(data_chunk& c);
+  void remove(data_chunk& c);
+  // Read back the data of c, locked exclusively.
+  void load(data_chunk& c);
+  // Move c to the front of the LRU.
+  void touch(data_chunk& c);
+  // Spill the coldest chunks other than current until under budget.
+  // _mutex need to be aquired
+  void evict(data_chunk* current);
+
+  uint64_t _budget = 0;
+  std::atomic<uint64_t> _resident_bytes = 0;
+  std::atomic<uint64_t> _spilled_bytes = 0;
+
+  std::mutex _mutex;
+  // _mutex need to be aquired
+  HANDLE _file = INVALID_HANDLE_VALUE;
+  HANDLE _image = INVALID_HANDLE_VALUE;
+  std::list<data_chunk*> _lru;  // Most recently used first
+  std::vector<int64_t> _free_slots;
+  int64_t _slot_count = 0;
+};
+}  // namespace memfs
+
+#endif  // CHUNKSTORE_H_
@@ -0,0 +1,271 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "filedata.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace memfs {
+template <typename F>
+void chunked_data::for_each_chunk(uint64_t offset, size_t length, F copy) {
+  size_t position = 0;
+  auto it = _chunks.lower_bound(offset / chunk_size);
+  while (position < length) {
+    const uint64_t index = offset / chunk_size;
+    const size_t chunk_offset = static_cast<size_t>(offset % chunk_size);
+    const size_t chunk_length =
+        (std::min)(chunk_size - chunk_offset, length - position);
+    while (it != _chunks.end() && it->first < index) ++it;
+    chunk* c = (it != _chunks.end() && it->first == index) ? it->second.get()
+                                                           : nullptr;
+    copy(c, chunk_offset, chunk_length, position);
+    position += chunk_length;
+    offset += chunk_length;
+  }
+}
+
+bool chunked_data::is_owned(uint64_t offset, size_t length) {
+  const uint64_t first = offset / chunk_size;
+  const uint64_t last = (offset + length - 1) / chunk_size;
+  auto it = _chunks.find(first);
+  for (uint64_t index = first; index <= last; ++index, ++it) {
+    if (it == _chunks.end() || it->first != index) return false;
+    // Chunks are only shared with _mutex exclusively held, so the count can
+    // only drop while we hold it shared.
+    if (it->second.use_count() > 1) return false;
+  }
+  return true;
+}
+
+std::shared_ptr<chunked_data::chunk>& chunked_data::own_chunk(uint64_t index) {
+  auto& c = _chunks[index];
+  if (!c) {
+    c = std::make_shared<chunk>();
+  } else if (c.use_count() > 1) {
+    auto copy = std::make_shared<chunk>();
+    {
+      auto copy_lock = chunk_store::get().lock(*copy);
+      auto chunk_lock = chunk_store::get().lock_shared(*c);
+      memcpy(copy->data.get(), c->data.get(), chunk_size);
+    }
+    c = std::move(copy);
+  }
+  return c;
+}
+
+size_t chunked_data::read(void* buffer, size_t length, uint64_t offset) {
+  // Sealed content never changes
+  std::shared_lock lock(_mutex, std::defer_lock);
+  if (!_sealed.load(std::memory_order_acquire)) lock.lock();
+  if (offset >= _size) return 0;
+  length = static_cast<size_t>((std::min)(
+      static_cast<uint64_t>(length), _size - offset));
+  auto out = static_cast<uint8_t*>(buffer);
+  for_each_chunk(offset, length,
+                 [out](chunk* c, size_t chunk_offset, size_t chunk_length,
+                       size_t position) {
+                   if (!c) {
+                     memset(out + position, 0, chunk_length);
+                     return;
+                   }
+                   auto& store = chunk_store::get();
+                   if (store.try_read(*c, out + position, chunk_offset,
+                                      chunk_length))
+                     return;
+                   auto chunk_lock = store.lock_shared(*c);
+                   memcpy(out + position, c->data.get() + chunk_offset,
+                          chunk_length);
+                 });
+  return length;
+}
+
+void chunked_data::write(const void* buffer, size_t length, uint64_t offset) {
+  if (!length) return;
+  auto in = static_cast<const uint8_t*>(buffer);
+  auto copy = [in](chunk* c, size_t chunk_offset, size_t chunk_length,
+                   size_t position) {
+    auto chunk_lock = chunk_store::get().lock(*c);
+    memcpy(c->data.get() + chunk_offset, in + position, chunk_length);
+  };
+
+  // Overwrite of owned chunks inside the file only locks those chunks
+  {
+    std::shared_lock lock(_mutex);
+    if (offset + length <= _size && is_owned(offset, length)) {
+      for_each_chunk(offset, length, copy);
+      return;
+    }
+  }
+
+  std::unique_lock lock(_mutex);
+  const uint64_t last = (offset + length - 1) / chunk_size;
+  for (uint64_t index = offset / chunk_size; index <= last; ++index)
+    own_chunk(index);
+  _size = (std::max)(_size, offset + length);
+  for_each_chunk(offset, length, copy);
+}
+
+uint64_t chunked_data::size() {
+  std::shared_lock lock(_mutex, std::defer_lock);
+  if (!_sealed.load(std::memory_order_acquire)) lock.lock();
+  return _size;
+}
+
+void chunked_data::resize(uint64_t size) {
+  std::unique_lock lock(_mutex);
+  if (size < _size) {
+    // Drop the chunks past the end and zero the tail of the last one so that
+    // growing the file again reads zeros
+    _chunks.erase(_chunks.lower_bound((size + chunk_size - 1) / chunk_size),
+                  _chunks.end());
+    if (_chunks.count(size / chunk_size)) {
+      auto& c = own_chunk(size / chunk_size);
+      const size_t chunk_offset = static_cast<size_t>(size % chunk_size);
+      auto chunk_lock = chunk_store::get().lock(*c);
+      memset(c->data.get() + chunk_offset, 0, chunk_size - chunk_offset);
+    }
+  }
+  _size = size;
+}
+
+void chunked_data::zero_range(uint64_t offset, uint64_t length) {
+  std::unique_lock lock(_mutex);
+  if (offset >= _size) return;
+  const uint64_t end = offset + (std::min)(length, _size - offset);
+  // Chunks [first, last) are covered whole
+  const uint64_t first = (offset + chunk_size - 1) / chunk_size;
+  const uint64_t last = end / chunk_size;
+  auto zero = [this](uint64_t from, uint64_t to) {
+    const uint64_t index = from / chunk_size;
+    if (from >= to || !_chunks.count(index)) return;
+    auto& c = own_chunk(index);
+    auto chunk_lock = chunk_store::get().lock(*c);
+    memset(c->data.get() + from % chunk_size, 0,
+           static_cast<size_t>(to - from));
+  };
+  if (first > last) {
+    zero(offset, end);
+    return;
+  }
+  _chunks.erase(_chunks.lower_bound(first), _chunks.lower_bound(last));
+  zero(offset, first * chunk_size);
+  zero(last * chunk_size, end);
+}
+
+void chunked_data::add_image_chunk(uint64_t index, int64_t image_slot) {
+  std::unique_lock lock(_mutex);
+  _chunks[index] = std::make_shared<chunk>(image_slot);
+}
+
+void chunked_data::seal() { _sealed.store(true, std::memory_order_release); }
+
+void chunked_data::copy_range(chunked_data& source, uint64_t source_offset,
+                              uint64_t offset, uint64_t length) {
+  const uint64_t source_size = source.size();
+  if (source_offset >= source_size) return;
+  length = (std::min)(length, source_size - source_offset);
+
+  std::vector<uint8_t> buffer;
+  auto copy = [&](uint64_t count) {
+    buffer.resize(chunk_size);
+    while (count) {
+      const size_t read = source.read(
+          buffer.data(),
+          static_cast<size_t>((std::min)(count, uint64_t{chunk_size})),
+          source_offset);
+      if (!read) {
+        length = 0;
+        return;
+      }
+      write(buffer.data(), read, offset);
+      source_offset += read;
+      offset += read;
+      length -= read;
+      count -= read;
+    }
+  };
+
+  if (source_offset % chunk_size != offset % chunk_size) {
+    copy(length);
+    return;
+  }
+  if (offset % chunk_size)
+    copy((std::min)(length, uint64_t{chunk_size} - offset % chunk_size));
+
+  const uint64_t whole = length / chunk_size;
+  if (whole) {
+    const uint64_t source_first = source_offset / chunk_size;
+    const uint64_t first = offset / chunk_size;
+    // Collected before placing them, the ranges can overlap in one content
+    std::map<uint64_t, std::shared_ptr<chunk>> shared;
+    auto collect = [&] {
+      for (auto it = source._chunks.lower_bound(source_first);
+           it != source._chunks.end() && it->first < source_first + whole;
+           ++it)
+        shared.emplace(it->first - source_first + first, it->second);
+    };
+    auto place = [&] {
+      _chunks.erase(_chunks.lower_bound(first),
+                    _chunks.lower_bound(first + whole));
+      _chunks.merge(shared);
+      _size = (std::max)(_size, (first + whole) * chunk_size);
+    };
+    if (&source == this) {
+      std::unique_lock lock(_mutex);
+      collect();
+      place();
+    } else {
+      {
+        std::unique_lock source_lock(source._mutex);
+        collect();
+      }
+      std::unique_lock lock(_mutex);
+      place();
+    }
+    source_offset += whole * chunk_size;
+    offset += whole * chunk_size;
+    length -= whole * chunk_size;
+  }
+  if (length) copy(length);
+}
+
+void chunked_data::share_from(chunked_data& source) {
+  if (&source == this) return;
+  std::map<uint64_t, std::shared_ptr<chunk>> chunks;
+  uint64_t size;
+  {
+    std::unique_lock source_lock(source._mutex);
+    chunks = source._chunks;
+    size = source._size;
+  }
+  std::unique_lock lock(_mutex);
+  _chunks.swap(chunks);
+  _size = size;
+}
+}  // namespace memfs
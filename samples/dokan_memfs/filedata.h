@@ -0,0 +1,134 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef FILEDATA_H_
+#define FILEDATA_H_
+
+#include "chunkstore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+
+namespace memfs {
+
+// Sparse content of a file, stored in fixed size chunks allocated on first
+// write. Ranges without a chunk are holes that read as zeros.
+// Reads and writes inside the file size only lock the chunks they touch, the
+// whole content is locked only when chunks are added or the size changes.
+// Chunks can be shared between copies of the content and are copied on the
+// first write to them.
+// Reads first copy chunks without locking them and only lock the ones written
+// meanwhile. Sealed content is read without any lock.
+// The information can safely be accessed from any thread.
+class chunked_data {
+ public:
+  static constexpr size_t chunk_size = data_chunk::size;
+
+  // Read up to length bytes at offset and return the number of bytes read.
+  size_t read(void* buffer, size_t length, uint64_t offset);
+  // Write length bytes at offset, growing the content if needed.
+  void write(const void* buffer, size_t length, uint64_t offset);
+
+  uint64_t size();
+  void resize(uint64_t size);
+
+  // Replace the content by a copy of source sharing its chunks.
+  void share_from(chunked_data& source);
+  // Copy up to length bytes of source at source_offset to offset, growing the
+  // content if needed. The chunks of the range are shared when both offsets
+  // are at the same place in their chunk.
+  void copy_range(chunked_data& source, uint64_t source_offset,
+                  uint64_t offset, uint64_t length);
+  // Zero up to length bytes at offset inside the content. The chunks covered
+  // whole are dropped and become holes.
+  void zero_range(uint64_t offset, uint64_t length);
+  // Call callback(offset, length) on each range of [offset, offset + length)
+  // inside the content that is stored in chunks, in order, until it returns
+  // false. Adjacent chunks make one range.
+  template <typename F>
+  void for_each_allocated_range(uint64_t offset, uint64_t length, F callback) {
+    std::shared_lock lock(_mutex, std::defer_lock);
+    if (!_sealed.load(std::memory_order_acquire)) lock.lock();
+    if (offset >= _size) return;
+    const uint64_t end = offset + (std::min)(length, _size - offset);
+    uint64_t range_offset = 0;
+    uint64_t range_end = 0;
+    for (auto it = _chunks.lower_bound(offset / chunk_size);
+         it != _chunks.end() && it->first * chunk_size < end; ++it) {
+      const uint64_t start = (std::max)(offset, it->first * chunk_size);
+      const uint64_t stop = (std::min)(end, (it->first + 1) * chunk_size);
+      if (range_end != range_offset && range_end != start) {
+        if (!callback(range_offset, range_end - range_offset)) return;
+        range_offset = start;
+      } else if (range_end == range_offset) {
+        range_offset = start;
+      }
+      range_end = stop;
+    }
+    if (range_end != range_offset)
+      callback(range_offset, range_end - range_offset);
+  }
+  // Mark the content as never written again so that reads skip locking.
+  // Must be called before the content is shared with readers.
+  void seal();
+
+  // Add the chunk at index, stored at image_slot of the image file. Used to
+  // load an image, before resize to the file size.
+  void add_image_chunk(uint64_t index, int64_t image_slot);
+  // Call callback(index, chunk) on each allocated chunk.
+  template <typename F>
+  void for_each_allocated_chunk(F callback) {
+    std::shared_lock lock(_mutex);
+    for (const auto& [index, c] : _chunks) callback(index, *c);
+  }
+
+ private:
+  using chunk = data_chunk;
+
+  // Whether all chunks of [offset, offset + length) are allocated and not
+  // shared with another content.
+  bool is_owned(uint64_t offset, size_t length);
+  // Return the chunk at index allocated and not shared. _mutex need to be
+  // aquired exclusively.
+  std::shared_ptr<chunk>& own_chunk(uint64_t index);
+  // Call copy(chunk, offset in chunk, length in chunk, position in range) for
+  // each chunk of [offset, offset + length), with a nullptr chunk for holes.
+  template <typename F>
+  void for_each_chunk(uint64_t offset, size_t length, F copy);
+
+  std::shared_mutex _mutex;
+  // _mutex need to be aquired, exclusively to modify them or share the chunks
+  std::map<uint64_t, std::shared_ptr<chunk>> _chunks;  // By chunk index
+  uint64_t _size = 0;
+  std::atomic<bool> _sealed = false;
+};
+}  // namespace memfs
+
+#endif  // FILEDATA_H_
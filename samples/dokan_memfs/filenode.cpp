@@ -26,10 +26,83 @@ THE SOFTWARE.
 */
 
 #include "filenode.h"
+#include "memfs_log.h"
 
-#include <spdlog/spdlog.h>
+#include <string_view>
 
 namespace memfs {
+namespace {
+// Interned security descriptors by hash of their content. An entry is
+// removed by the deleter of its descriptor.
+struct descriptor_entry {
+  std::weak_ptr<byte[]> descriptor;
+  const byte* data;
+  DWORD size;
+};
+
+struct descriptor_table {
+  std::mutex mutex;
+  // mutex need to be aquired
+  std::unordered_multimap<size_t, descriptor_entry> entries;
+};
+
+descriptor_table& get_descriptor_table() {
+  // Never destroyed as nodes can outlive the static destructors
+  static descriptor_table* table = new descriptor_table();
+  return *table;
+}
+}  // namespace
+
+void security_informations::SetDescriptor(const void* securitydescriptor,
+                                          DWORD size) {
+  auto& table = get_descriptor_table();
+  const size_t hash = std::hash<std::string_view>{}(std::string_view(
+      static_cast<const char*>(securitydescriptor), size));
+  // Released after the table lock as its deleter takes it
+  std::shared_ptr<byte[]> previous = std::move(descriptor);
+
+  std::scoped_lock lock(table.mutex);
+  auto range = table.entries.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const auto& entry = it->second;
+    if (entry.size != size || memcmp(entry.data, securitydescriptor, size))
+      continue;
+    // Expired entries are being removed by their deleter
+    if (auto shared = entry.descriptor.lock()) {
+      descriptor = std::move(shared);
+      descriptor_size = size;
+      return;
+    }
+  }
+
+  auto data = new byte[size];
+  memcpy(data, securitydescriptor, size);
+  descriptor = std::shared_ptr<byte[]>(data, [hash](byte* data) {
+    auto& table = get_descriptor_table();
+    {
+      std::scoped_lock lock(table.mutex);
+      auto range = table.entries.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.data == data) {
+          table.entries.erase(it);
+          break;
+        }
+      }
+    }
+    delete[] data;
+  });
+  descriptor_size = size;
+  table.entries.emplace(hash, descriptor_entry{descriptor, data, size});
+}
+
+std::shared_ptr<filenode> filenode::create(
+    const std::wstring& filename, bool is_directory, DWORD file_attr,
+    const PDOKAN_IO_SECURITY_CONTEXT security_context) {
+  return std::allocate_shared<filenode>(slab_allocator<filenode>(), filename,
+                                        is_directory, file_attr,
+                                        security_context);
+}
+
 filenode::filenode(const std::wstring& filename, bool is_directory,
                    DWORD file_attr,
                    const PDOKAN_IO_SECURITY_CONTEXT security_context)
@@ -38,21 +111,16 @@ filenode::filenode(const std::wstring& filename, bool is_directory,
   times.reset();
 
   if (security_context && security_context->AccessState.SecurityDescriptor) {
-    spdlog::info(L"{} : Attach SecurityDescriptor", filename);
+    SPDLOG_INFO(L"{} : Attach SecurityDescriptor", filename);
     security.SetDescriptor(security_context->AccessState.SecurityDescriptor);
   }
 }
 
 DWORD filenode::read(LPVOID buffer, DWORD bufferlength, LONGLONG offset) {
-  std::shared_lock lock(_data_mutex);
-  if (static_cast<size_t>(offset + bufferlength) > _data.size())
-    bufferlength = (_data.size() > static_cast<size_t>(offset))
-                       ? static_cast<DWORD>(_data.size() - offset)
-                       : 0;
-  if (bufferlength)
-    memcpy(buffer, &_data[static_cast<size_t>(offset)], bufferlength);
-  spdlog::info(L"Read {} : BufferLength {} Offset {}", get_filename(),
-               bufferlength, offset);
+  bufferlength = static_cast<DWORD>(
+      _data.read(buffer, bufferlength, static_cast<uint64_t>(offset)));
+  SPDLOG_INFO(L"Read {} : BufferLength {} Offset {}", get_filename(),
+              bufferlength, offset);
   return bufferlength;
 }
 
@@ -60,49 +128,146 @@ DWORD filenode::write(LPCVOID buffer, DWORD number_of_bytes_to_write,
                       LONGLONG offset) {
   if (!number_of_bytes_to_write) return 0;
 
-  std::unique_lock lock(_data_mutex);
-  if (static_cast<size_t>(offset + number_of_bytes_to_write) > _data.size())
-    _data.resize(static_cast<size_t>(offset + number_of_bytes_to_write));
-
-  spdlog::info(L"Write {} : NumberOfBytesToWrite {} Offset {}", get_filename(),
-               number_of_bytes_to_write, offset);
-  memcpy(&_data[static_cast<size_t>(offset)], buffer, number_of_bytes_to_write);
+  SPDLOG_INFO(L"Write {} : NumberOfBytesToWrite {} Offset {}", get_filename(),
+              number_of_bytes_to_write, offset);
+  _data.write(buffer, number_of_bytes_to_write, static_cast<uint64_t>(offset));
   return number_of_bytes_to_write;
 }
 
+void filenode::copy_range(filenode& source, LONGLONG source_offset,
+                          LONGLONG offset, LONGLONG length) {
+  SPDLOG_INFO(L"CopyRange {} : Length {} Offset {} from {} Offset {}",
+              get_filename(), length, offset, source.get_filename(),
+              source_offset);
+  _data.copy_range(source._data, static_cast<uint64_t>(source_offset),
+                   static_cast<uint64_t>(offset),
+                   static_cast<uint64_t>(length));
+}
+
+void filenode::zero_range(LONGLONG offset, LONGLONG length) {
+  SPDLOG_INFO(L"ZeroRange {} : Length {} Offset {}", get_filename(), length,
+              offset);
+  _data.zero_range(static_cast<uint64_t>(offset),
+                   static_cast<uint64_t>(length));
+}
+
+DWORD filenode::get_allocated_ranges(LONGLONG offset, LONGLONG length,
+                                     PFILE_ALLOCATED_RANGE_BUFFER ranges,
+                                     DWORD max_count, bool& more) {
+  DWORD count = 0;
+  more = false;
+  _data.for_each_allocated_range(
+      static_cast<uint64_t>(offset), static_cast<uint64_t>(length),
+      [&](uint64_t range_offset, uint64_t range_length) {
+        if (count == max_count) {
+          more = true;
+          return false;
+        }
+        ranges[count].FileOffset.QuadPart =
+            static_cast<LONGLONG>(range_offset);
+        ranges[count].Length.QuadPart = static_cast<LONGLONG>(range_length);
+        ++count;
+        return true;
+      });
+  SPDLOG_INFO(L"AllocatedRanges {} : Length {} Offset {} Count {}",
+              get_filename(), length, offset, count);
+  return count;
+}
+
 const LONGLONG filenode::get_filesize() {
-  std::shared_lock lock(_data_mutex);
   return static_cast<LONGLONG>(_data.size());
 }
 
 void filenode::set_endoffile(const LONGLONG& byte_offset) {
-  std::unique_lock lock(_data_mutex);
-  _data.resize(static_cast<size_t>(byte_offset));
+  _data.resize(static_cast<uint64_t>(byte_offset));
 }
 
 const std::wstring filenode::get_filename() {
-  std::shared_lock lock(_fileName_mutex);
-  return _fileName;
+  std::shared_ptr<filenode> parent;
+  std::wstring name;
+  {
+    std::shared_lock lock(_fileName_mutex);
+    parent = _parent.lock();
+    name = _fileName;
+  }
+  if (main_stream) return main_stream->get_filename() + L":" + name;
+  // Root or node not added yet
+  if (!parent) return name;
+  auto filename = parent->get_filename();
+  if (filename.back() != L'\\') filename += L'\\';
+  return filename + name;
 }
 
-void filenode::set_filename(const std::wstring& f) {
+void filenode::set_link(const std::shared_ptr<filenode>& parent,
+                        const std::wstring& name) {
   std::unique_lock lock(_fileName_mutex);
-  _fileName = f;
+  _parent = parent;
+  _fileName = name;
+}
+
+std::shared_ptr<filenode> filenode::find_child(std::wstring_view name) {
+  std::shared_lock lock(_children_mutex);
+  auto it = _children.find(name);
+  return (it != _children.end()) ? it->second : nullptr;
+}
+
+std::shared_ptr<filenode> filenode::clone(
+    const std::shared_ptr<filenode>& parent,
+    const std::shared_ptr<filenode>& main, bool sealed) {
+  auto f = create(std::wstring(), false, 0, nullptr);
+  f->is_directory = is_directory.load();
+  f->attributes = attributes.load();
+  f->fileindex = fileindex;
+  f->main_stream = main;
+  f->times.creation = times.creation.load();
+  f->times.lastaccess = times.lastaccess.load();
+  f->times.lastwrite = times.lastwrite.load();
+  f->security.CopyFrom(security);
+  f->_data.share_from(_data);
+  if (sealed) f->_data.seal();
+  {
+    std::shared_lock lock(_fileName_mutex);
+    f->_fileName = _fileName;
+  }
+  f->_parent = parent;
+
+  for (const auto& [stream_name, stream] : get_streams())
+    f->add_stream(stream_name, stream->clone(nullptr, f, sealed));
+  std::shared_lock lock(_children_mutex);
+  for (const auto& [name, child] : _children)
+    f->_children[name] = child->clone(f, nullptr, sealed);
+  return f;
+}
+
+std::shared_ptr<filenode> filenode::find_stream(
+    std::wstring_view stream_name) {
+  if (_stream_count.load(std::memory_order_acquire) == 0) return nullptr;
+  std::shared_lock lock(_streams_mutex);
+  if (!_streams) return nullptr;
+  auto it = _streams->find(stream_name);
+  return (it != _streams->end()) ? it->second : nullptr;
 }
 
-void filenode::add_stream(const std::shared_ptr<filenode>& stream) {
-  std::unique_lock lock(_data_mutex);
-  _streams[stream->get_filename()] = stream;
+void filenode::add_stream(const std::wstring& stream_name,
+                          const std::shared_ptr<filenode>& stream) {
+  std::unique_lock lock(_streams_mutex);
+  if (!_streams) _streams = std::make_unique<nodes_by_name>();
+  (*_streams)[stream_name] = stream;
+  _stream_count.store(_streams->size(), std::memory_order_release);
 }
 
-void filenode::remove_stream(const std::shared_ptr<filenode>& stream) {
-  std::unique_lock lock(_data_mutex);
-  _streams.erase(stream->get_filename());
+void filenode::remove_stream(const std::wstring& stream_name,
+                             const std::shared_ptr<filenode>& stream) {
+  std::unique_lock lock(_streams_mutex);
+  if (!_streams) return;
+  auto it = _streams->find(stream_name);
+  if (it != _streams->end() && it->second == stream) _streams->erase(it);
+  _stream_count.store(_streams->size(), std::memory_order_release);
 }
 
-std::unordered_map<std::wstring, std::shared_ptr<filenode> >
-filenode::get_streams() {
-  std::shared_lock lock(_data_mutex);
-  return _streams;
+filenode::nodes_by_name filenode::get_streams() {
+  std::shared_lock lock(_streams_mutex);
+  if (!_streams) return {};
+  return *_streams;
 }
 }  // namespace memfs
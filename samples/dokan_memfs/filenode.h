@@ -31,21 +31,28 @@ THE SOFTWARE.
 #include <dokan/dokan.h>
 #include <dokan/fileinfo.h>
 
+#include "filedata.h"
 #include "memfs_helper.h"
+#include "slab.h"
 
 #include <WinBase.h>
 #include <atomic>
 #include <filesystem>
+#include <map>
 #include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 namespace memfs {
 
 // Safe class wrapping a Win32 Security Descriptor
+// Descriptors are interned: nodes with the same descriptor, most often
+// inherited from their parent, share one read-only copy.
 struct security_informations : std::shared_mutex {
-  std::unique_ptr<byte[]> descriptor = nullptr;
+  // Never modified, SetDescriptor replaces it.
+  std::shared_ptr<byte[]> descriptor = nullptr;
   DWORD descriptor_size = 0;
 
   security_informations() = default;
@@ -54,9 +61,15 @@ struct security_informations : std::shared_mutex {
 
   void SetDescriptor(PSECURITY_DESCRIPTOR securitydescriptor) {
     if (!securitydescriptor) return;
-    descriptor_size = GetSecurityDescriptorLength(securitydescriptor);
-    descriptor = std::make_unique<byte[]>(descriptor_size);
-    memcpy(descriptor.get(), securitydescriptor, descriptor_size);
+    SetDescriptor(securitydescriptor,
+                  GetSecurityDescriptorLength(securitydescriptor));
+  }
+  void SetDescriptor(const void* securitydescriptor, DWORD size);
+  // Share the descriptor of other.
+  void CopyFrom(security_informations& other) {
+    std::shared_lock lock(other);
+    descriptor = other.descriptor;
+    descriptor_size = other.descriptor_size;
   }
 };
 
@@ -94,20 +107,44 @@ class filenode {
 
   filenode(const filenode& f) = delete;
 
+  // Nodes by name, looked up without building a std::wstring.
+  using nodes_by_name =
+      std::map<std::wstring, std::shared_ptr<filenode>, std::less<> >;
+
+  // Allocate a filenode and its reference count in one slab block.
+  static std::shared_ptr<filenode> create(
+      const std::wstring& filename, bool is_directory, DWORD file_attr,
+      const PDOKAN_IO_SECURITY_CONTEXT security_context);
+
   DWORD read(LPVOID buffer, DWORD bufferlength, LONGLONG offset);
   DWORD write(LPCVOID buffer, DWORD number_of_bytes_to_write, LONGLONG offset);
+  // Copy up to length bytes of source at source_offset to offset, sharing the
+  // data with source where it can.
+  void copy_range(filenode& source, LONGLONG source_offset, LONGLONG offset,
+                  LONGLONG length);
+
+  // Zero length bytes at offset, the chunks covered whole become holes.
+  void zero_range(LONGLONG offset, LONGLONG length);
+  // Fill ranges with up to max_count ranges of [offset, offset + length) that
+  // are not holes and return their count. more is set when some did not fit.
+  DWORD get_allocated_ranges(LONGLONG offset, LONGLONG length,
+                             PFILE_ALLOCATED_RANGE_BUFFER ranges,
+                             DWORD max_count, bool& more);
 
   const LONGLONG get_filesize();
   void set_endoffile(const LONGLONG& byte_offset);
 
-  // Filename can during a move so we need to protect it behind a lock
+  // Filename is built from the node names up to the root, as a move of the
+  // node or any of its parents changes it.
   const std::wstring get_filename();
-  void set_filename(const std::wstring& filename);
 
-  // Alternated streams
-  void add_stream(const std::shared_ptr<filenode>& stream);
-  void remove_stream(const std::shared_ptr<filenode>& stream);
-  std::unordered_map<std::wstring, std::shared_ptr<filenode> > get_streams();
+  // Alternated streams by stream name (bar for \foo:bar)
+  std::shared_ptr<filenode> find_stream(std::wstring_view stream_name);
+  void add_stream(const std::wstring& stream_name,
+                  const std::shared_ptr<filenode>& stream);
+  void remove_stream(const std::wstring& stream_name,
+                     const std::shared_ptr<filenode>& stream);
+  nodes_by_name get_streams();
 
   // No lock needed above
   std::atomic<bool> is_directory = false;
@@ -119,16 +156,42 @@ class filenode {
   security_informations security;
 
  private:
-  filenode() = default;
-
-  std::shared_mutex _data_mutex;
-  // _data_mutex need to be aquired
-  std::vector<uint8_t> _data;
-  std::unordered_map<std::wstring, std::shared_ptr<filenode> > _streams;
+  // fs_filenodes links the nodes in the filesystem hierarchy
+  friend class fs_filenodes;
+  friend class memfs_image;
+
+  std::shared_ptr<filenode> find_child(std::wstring_view name);
+  // Return a copy of the node and its subtree sharing the data, linked to
+  // parent or main_stream. A sealed copy is never written.
+  std::shared_ptr<filenode> clone(const std::shared_ptr<filenode>& parent,
+                                  const std::shared_ptr<filenode>& main_stream,
+                                  bool sealed);
+  void set_link(const std::shared_ptr<filenode>& parent,
+                const std::wstring& name);
+
+  chunked_data _data;
+
+  std::shared_mutex _streams_mutex;
+  // _streams_mutex need to be aquired
+  // Allocated with the first alternate stream, most files have none.
+  std::unique_ptr<nodes_by_name> _streams;
+  // Size of _streams, read without lock so that the lookups of a stream on a
+  // file without any, like the :Zone.Identifier probes, take no lock.
+  std::atomic<size_t> _stream_count = 0;
 
   std::shared_mutex _fileName_mutex;
   // _fileName_mutex need to be aquired
+  // Name in the parent directory, or in the main stream for an alternate
+  // stream. Holds the full filename until the node is added.
   std::wstring _fileName;
+  std::weak_ptr<filenode> _parent;
+
+  std::shared_mutex _children_mutex;
+  // _children_mutex need to be aquired
+  // Directory content by name
+  nodes_by_name _children;
+  // Set when the directory is removed so that no child is added anymore.
+  bool _removed = false;
 };
 }  // namespace memfs
 
@@ -26,9 +26,9 @@ THE SOFTWARE.
 */
 
 #include "filenodes.h"
+#include "memfs_log.h"
 
 #include <sddl.h>
-#include <spdlog/spdlog.h>
 
 namespace memfs {
 fs_filenodes::fs_filenodes() {
@@ -80,76 +80,197 @@ fs_filenodes::fs_filenodes() {
   if (!ConvertStringSecurityDescriptorToSecurityDescriptor(
           final_buffer, SDDL_REVISION_1, &security_descriptor, &size))
     throw std::runtime_error("Failed init root resources");
-  auto fileNode = std::make_shared<filenode>(L"\\", true,
-                                             FILE_ATTRIBUTE_DIRECTORY, nullptr);
+  auto fileNode = filenode::create(L"\\", true, FILE_ATTRIBUTE_DIRECTORY,
+                                   nullptr);
   fileNode->security.SetDescriptor(security_descriptor);
   LocalFree(security_descriptor);
 
-  _filenodes[L"\\"] = fileNode;
-  _directoryPaths.emplace(L"\\", std::set<std::shared_ptr<filenode>>());
+  _root = fileNode;
+}
+
+fs_filenodes::fs_filenodes(std::shared_ptr<filenode> root,
+                           LONGLONG fileindex_count)
+    : _fs_fileindex_count(fileindex_count), _root(std::move(root)) {}
+
+fs_filenodes::~fs_filenodes() {
+  {
+    std::lock_guard lock(_reaper_mutex);
+    _reaper_stop = true;
+  }
+  _reaper_cv.notify_one();
+  if (_reaper.joinable()) _reaper.join();
+}
+
+void fs_filenodes::reap(std::shared_ptr<filenode> f) {
+  {
+    std::lock_guard lock(_reaper_mutex);
+    _reaper_queue.push_back(std::move(f));
+    if (!_reaper.joinable())
+      _reaper = std::thread(&fs_filenodes::reaper_thread, this);
+  }
+  _reaper_cv.notify_one();
+}
+
+void fs_filenodes::reaper_thread() {
+  std::unique_lock lock(_reaper_mutex);
+  for (;;) {
+    _reaper_cv.wait(lock,
+                    [this] { return _reaper_stop || !_reaper_queue.empty(); });
+    if (_reaper_queue.empty()) return;
+    auto pending = std::move(_reaper_queue);
+    _reaper_queue.clear();
+    lock.unlock();
+
+    // Directories are emptied before being released so that a deep tree is
+    // not freed through recursive destructors. They are marked removed so
+    // that a file created in parallel in a detached directory is not kept.
+    size_t count = 0;
+    while (!pending.empty()) {
+      auto f = std::move(pending.back());
+      pending.pop_back();
+      ++count;
+      if (!f->is_directory) continue;
+      std::unique_lock children_lock(f->_children_mutex);
+      f->_removed = true;
+      for (auto& [name, child] : f->_children)
+        pending.push_back(std::move(child));
+      f->_children.clear();
+    }
+    SPDLOG_INFO(L"Released {} removed filenodes", count);
+
+    lock.lock();
+  }
+}
+
+std::unique_ptr<fs_filenodes> fs_filenodes::snapshot() {
+  std::unique_lock lock(_tree_mutex);
+  SPDLOG_INFO(L"Snapshot");
+  return std::unique_ptr<fs_filenodes>(new fs_filenodes(
+      std::atomic_load(&_root)->clone(nullptr, nullptr, true),
+      _fs_fileindex_count));
+}
+
+void fs_filenodes::restore(fs_filenodes& snapshot) {
+  std::shared_ptr<filenode> root;
+  {
+    std::shared_lock snapshot_lock(snapshot._tree_mutex);
+    root =
+        std::atomic_load(&snapshot._root)->clone(nullptr, nullptr, false);
+  }
+  // FileIndex count is kept as it is so that the indexes of the files still
+  // opened in the current hierarchy are not reused.
+  std::unique_lock lock(_tree_mutex);
+  SPDLOG_INFO(L"Restore snapshot");
+  root = std::atomic_exchange(&_root, root);
+  reap(std::move(root));
+}
+
+std::shared_ptr<filenode> fs_filenodes::find_container(
+    const std::wstring& filename,
+    const std::pair<std::wstring, std::wstring>& stream_names) {
+  if (!stream_names.second.empty()) {
+    auto main_stream_name =
+        memfs_helper::GetFileNameStreamLess(filename, stream_names);
+    return find(main_stream_name);
+  }
+  auto parent = find(memfs_helper::GetParentPath(filename));
+  return (parent && parent->is_directory) ? parent : nullptr;
 }
 
 NTSTATUS fs_filenodes::add(const std::shared_ptr<filenode> &f,
                   std::optional<std::pair<std::wstring, std::wstring>> stream_names) {
-  std::scoped_lock lock(_filesnodes_mutex);
+  std::shared_lock lock(_tree_mutex);
 
   if (f->fileindex == 0)  // previous init
     f->fileindex = _fs_fileindex_count++;
   const auto filename = f->get_filename();
   const auto parent_path = memfs_helper::GetParentPath(filename);
 
-  // Does target folder exist
-  if (!_directoryPaths.count(parent_path)) {
-    spdlog::warn(L"Add: No directory: {} exist FilePath: {}", parent_path,
-                 filename);
-    return STATUS_OBJECT_PATH_NOT_FOUND;
-  }
-
   if (!stream_names.has_value())
     stream_names = memfs_helper::GetStreamNames(filename);
-  if (!stream_names.value().second.empty()) {
-    auto &stream_names_value = stream_names.value();
-    spdlog::info(
+  auto &stream_names_value = stream_names.value();
+  if (!stream_names_value.second.empty()) {
+    SPDLOG_INFO(
         L"Add file: {} is an alternate stream {} and has {} as main stream",
         filename, stream_names_value.second, stream_names_value.first);
-    auto main_stream_name =
-        memfs_helper::GetFileNameStreamLess(filename, stream_names_value);
-    auto main_f = find(main_stream_name);
-    if (!main_f)
-      return STATUS_OBJECT_PATH_NOT_FOUND;
-    main_f->add_stream(f);
-    f->main_stream = main_f;
-    f->fileindex = main_f->fileindex;
   }
 
-  // If we have a folder, we add it to our directoryPaths
-  if (f->is_directory && !_directoryPaths.count(filename))
-    _directoryPaths.emplace(filename, std::set<std::shared_ptr<filenode>>());
+  // Does target folder or main stream exist
+  auto container = find_container(filename, stream_names_value);
+  if (!container) {
+    SPDLOG_WARN(L"Add: No directory: {} exist FilePath: {}", parent_path,
+                filename);
+    return STATUS_OBJECT_PATH_NOT_FOUND;
+  }
 
-  // Add our file to the fileNodes and directoryPaths
-  auto previous_f = _filenodes[filename];
-  _filenodes[filename] = f;
-  _directoryPaths[parent_path].insert(f);
-  if (previous_f)
-    _directoryPaths[parent_path].erase(previous_f);
+  const bool is_stream = !stream_names_value.second.empty();
+  auto status = link(container,
+                     is_stream ? stream_names_value.second
+                               : memfs_helper::GetFileName(filename),
+                     is_stream, f);
+  if (status != STATUS_SUCCESS) return status;
 
-  spdlog::info(L"Add file: {} in folder: {}", filename, parent_path);
+  SPDLOG_INFO(L"Add file: {} in folder: {}", filename, parent_path);
   return STATUS_SUCCESS;
 }
 
-std::shared_ptr<filenode> fs_filenodes::find(const std::wstring& filename) {
-  std::scoped_lock lock(_filesnodes_mutex);
-  auto fileNode = _filenodes.find(filename);
-  return (fileNode != _filenodes.end()) ? fileNode->second : nullptr;
+NTSTATUS fs_filenodes::link(const std::shared_ptr<filenode>& container,
+                            const std::wstring& name, bool is_stream,
+                            const std::shared_ptr<filenode>& f) {
+  if (is_stream) {
+    // Alternate stream of container
+    f->set_link(nullptr, name);
+    f->main_stream = container;
+    f->fileindex = container->fileindex;
+    container->add_stream(name, f);
+    return STATUS_SUCCESS;
+  }
+
+  std::unique_lock lock(container->_children_mutex);
+  // The directory was removed since we found it
+  if (container->_removed) return STATUS_OBJECT_PATH_NOT_FOUND;
+  f->set_link(container, name);
+  f->main_stream = nullptr;
+  container->_children[name] = f;
+  return STATUS_SUCCESS;
 }
 
-std::set<std::shared_ptr<filenode>> fs_filenodes::list_folder(
-    const std::wstring& fileName) {
-  std::scoped_lock lock(_filesnodes_mutex);
+void fs_filenodes::unlink(const std::shared_ptr<filenode>& container,
+                          const std::wstring& name, bool is_stream,
+                          const std::shared_ptr<filenode>& f) {
+  if (!container) return;
+  if (is_stream) {
+    container->remove_stream(name, f);
+    return;
+  }
+  std::unique_lock lock(container->_children_mutex);
+  auto it = container->_children.find(name);
+  if (it != container->_children.end() && it->second == f)
+    container->_children.erase(it);
+}
+
+std::shared_ptr<filenode> fs_filenodes::find(const std::wstring& filename) {
+  // Parsed in place, this runs for every open
+  const auto [path, stream_name] = memfs_helper::SplitStreamName(filename);
+
+  // Walk down the hierarchy from the root, one directory lock at a time
+  auto f = std::atomic_load(&_root);
+  size_t pos = 1;
+  while (f && pos < path.length()) {
+    auto end = path.find(L'\\', pos);
+    if (end == std::wstring_view::npos) end = path.length();
+    f = f->find_child(path.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  if (!f || stream_name.empty()) return f;
+  return f->find_stream(stream_name);
+}
 
-  auto it = _directoryPaths.find(fileName);
-  return (it != _directoryPaths.end()) ? it->second
-                                       : std::set<std::shared_ptr<filenode>>();
+bool fs_filenodes::is_empty_folder(const std::wstring& filename) {
+  auto directory = find(filename);
+  if (!directory || !directory->is_directory) return true;
+  std::shared_lock lock(directory->_children_mutex);
+  return directory->_children.empty();
 }
 
 void fs_filenodes::remove(const std::wstring& filename) {
@@ -159,44 +280,52 @@ void fs_filenodes::remove(const std::wstring& filename) {
 void fs_filenodes::remove(const std::shared_ptr<filenode>& f) {
   if (!f) return;
 
-  std::scoped_lock lock(_filesnodes_mutex);
-  auto fileName = f->get_filename();
-  spdlog::info(L"Remove: {}", fileName);
-
-  // Remove node from fileNodes and directoryPaths
-  _filenodes.erase(fileName);
-  _directoryPaths[memfs_helper::GetParentPath(fileName)].erase(f);
+  std::shared_lock lock(_tree_mutex);
+  remove_locked(f);
+}
 
-  // if it was a directory we need to remove it from directoryPaths
-  if (f->is_directory) {
-    // but first we need to remove the directory content by looking recursively
-    // into it
-    auto files = list_folder(fileName);
-    for (const auto& file : files) remove(file);
+void fs_filenodes::remove_locked(const std::shared_ptr<filenode>& f) {
+  if (!f) return;
 
-    _directoryPaths.erase(fileName);
+  auto fileName = f->get_filename();
+  SPDLOG_INFO(L"Remove: {}", fileName);
+
+  // Remove node from its directory or main stream
+  std::shared_ptr<filenode> container;
+  std::wstring name;
+  const bool is_stream = f->main_stream != nullptr;
+  {
+    std::shared_lock name_lock(f->_fileName_mutex);
+    container = is_stream ? f->main_stream : f->_parent.lock();
+    name = f->_fileName;
   }
+  unlink(container, name, is_stream, f);
 
-  // Cleanup streams
-  if (f->main_stream) {
-    // Is an alternate stream
-    f->main_stream->remove_stream(f);
-  } else {
-    // Is a main stream
-    // Remove possible alternate stream
-    for (const auto& [stream_name, node] : f->get_streams())
-      remove(stream_name);
+  // A directory is detached with its content, which is no longer reachable
+  // from the root. It is marked removed so no new file is added to it.
+  if (f->is_directory) {
+    std::unique_lock children_lock(f->_children_mutex);
+    f->_removed = true;
   }
+
+  // Alternate streams are only reachable from their main stream and go away
+  // with it.
+  reap(f);
 }
 
 NTSTATUS fs_filenodes::move(const std::wstring& old_filename,
                             const std::wstring& new_filename,
                             BOOL replace_if_existing) {
+  std::unique_lock lock(_tree_mutex);
+
   auto f = find(old_filename);
   auto new_f = find(new_filename);
 
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
 
+  // Move on itself
+  if (new_f == f) return STATUS_SUCCESS;
+
   // Cannot move to an existing destination without replace flag
   if (!replace_if_existing && new_f) return STATUS_OBJECT_NAME_COLLISION;
 
@@ -209,55 +338,50 @@ NTSTATUS fs_filenodes::move(const std::wstring& old_filename,
     return STATUS_ACCESS_DENIED;
 
   auto newParent_path = memfs_helper::GetParentPath(new_filename);
-
-  std::scoped_lock lock(_filesnodes_mutex);
-  if (!_directoryPaths.count(newParent_path)) {
-    spdlog::warn(L"Move: No directory: {} exist FilePath: {}", newParent_path,
-                 new_filename);
+  const auto stream_names = memfs_helper::GetStreamNames(new_filename);
+  auto container = find_container(new_filename, stream_names);
+  if (!container) {
+    SPDLOG_WARN(L"Move: No directory: {} exist FilePath: {}", newParent_path,
+                new_filename);
     return STATUS_OBJECT_PATH_NOT_FOUND;
   }
 
-  // Remove destination
-  remove(new_f);
-
-  // Update current node with new data
-  const auto fileName = f->get_filename();
-  auto oldParentPath = memfs_helper::GetParentPath(fileName);
-  f->set_filename(new_filename);
-
-  // Move fileNode
-  // 1 - by removing current not with oldName as key
-  add(f, {});
-
-  // 2 - If fileNode is a Dir we move content to destination
+  // A directory cannot be moved as an alternate stream or into itself
+  const bool is_stream = !stream_names.second.empty();
   if (f->is_directory) {
-    // recurse remove sub folders/files
-    auto files = list_folder(old_filename);
-    for (const auto& file : files) {
-      const auto sub_fileName = file->get_filename();
-      auto newSubFileName = std::filesystem::path(new_filename)
-                                .append(memfs_helper::GetFileName(sub_fileName))
-                                .wstring();
-      auto n = move(sub_fileName, newSubFileName, replace_if_existing);
-      if (n != STATUS_SUCCESS) {
-        spdlog::warn(
-            L"Move: Subfolder file move {} to {} replaceIfExisting {} failed: "
-            L"{}",
-            sub_fileName, newSubFileName, replace_if_existing, n);
-        return n;  // That's bad...we have not done a full move
-      }
+    if (is_stream) return STATUS_ACCESS_DENIED;
+    for (auto parent = container; parent; parent = parent->_parent.lock()) {
+      if (parent == f) return STATUS_ACCESS_DENIED;
     }
+  }
 
-    // remove folder from directories
-    _directoryPaths.erase(old_filename);
+  // Remove destination
+  remove_locked(new_f);
+
+  std::shared_ptr<filenode> old_container;
+  std::wstring old_name;
+  const bool old_is_stream = f->main_stream != nullptr;
+  {
+    std::shared_lock name_lock(f->_fileName_mutex);
+    old_container = old_is_stream ? f->main_stream : f->_parent.lock();
+    old_name = f->_fileName;
   }
 
-  // 3 - Remove fileNode link with oldFilename
-  _filenodes.erase(old_filename);
-  if (oldParentPath != newParent_path)  // Same folder destination
-    _directoryPaths[oldParentPath].erase(f);
+  // Link the node at its new place before unlinking it from the old one so
+  // that it can always be found during the move. Its whole subtree follows.
+  const auto name = is_stream ? stream_names.second
+                              : memfs_helper::GetFileName(new_filename);
+  auto status = link(container, name, is_stream, f);
+  if (status != STATUS_SUCCESS) {
+    SPDLOG_WARN(L"Move: {} to {} failed: {}", old_filename, new_filename,
+                status);
+    return status;
+  }
+  if (old_container != container || old_is_stream != is_stream ||
+      old_name != name)
+    unlink(old_container, old_name, old_is_stream, f);
 
-  spdlog::info(L"Move file: {} to folder: {}", old_filename, new_filename);
+  SPDLOG_INFO(L"Move file: {} to folder: {}", old_filename, new_filename);
   return STATUS_SUCCESS;
 }
 }  // namespace memfs
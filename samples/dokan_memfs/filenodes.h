@@ -30,8 +30,12 @@ THE SOFTWARE.
 
 #include "filenode.h"
 
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
 
 #include <optional>
 #include <iostream>
@@ -45,6 +49,7 @@ namespace memfs {
 class fs_filenodes {
  public:
   fs_filenodes();
+  ~fs_filenodes();
 
   // Add a new filenode to the filesystem hierarchy.
   // The file will directly be visible on the filesystem.
@@ -56,13 +61,36 @@ class fs_filenodes {
   // Return the filenode linked to the filename if present.
   std::shared_ptr<filenode> find(const std::wstring& filename);
 
-  // Return all filenode of the directory scope give in param.
-  std::set<std::shared_ptr<filenode>> list_folder(const std::wstring& filename);
+  // Call callback(name, filenode) on each filenode of the directory scope
+  // give in param, in place with the directory locked. Return false if the
+  // directory does not exist.
+  template <typename F>
+  bool list_folder(const std::wstring& filename, F callback) {
+    auto directory = find(filename);
+    if (!directory || !directory->is_directory) return false;
+    std::shared_lock lock(directory->_children_mutex);
+    for (const auto& [name, child] : directory->_children)
+      callback(name, child);
+    return true;
+  }
+
+  // Return whether the directory give in param has no filenode.
+  bool is_empty_folder(const std::wstring& filename);
+
+  // Return a copy of the filesystem hierarchy sharing the file data, which is
+  // copied on write. Only the metadata of the nodes is duplicated.
+  // Its file data is sealed and must never be written, it is meant to be
+  // mounted read-only.
+  std::unique_ptr<fs_filenodes> snapshot();
+  // Reset the filesystem hierarchy to a copy of snapshot.
+  void restore(fs_filenodes& snapshot);
 
   // Remove filenode from the filesystem hierarchy.
   // If the filenode has alternated streams attached, they will also be removed.
-  // If the filenode is a directory not empty, all sub filenode will be removed
-  // recursively.
+  // If the filenode is a directory not empty, its whole subtree is detached
+  // with it in one step. The removed filenodes and their data are released by
+  // a background thread, so the cost does not depend on the subtree or file
+  // size.
   void remove(const std::wstring& filename);
   void remove(const std::shared_ptr<filenode>& filenode);
 
@@ -79,19 +107,50 @@ class fs_filenodes {
       std::wstring real_filename);
 
  private:
+  friend class memfs_image;
+
+  fs_filenodes(std::shared_ptr<filenode> root, LONGLONG fileindex_count);
+
   // Global FS FileIndex count.
   // Note: Alternated stream and main stream share the same FileIndex.
   std::atomic<LONGLONG> _fs_fileindex_count = 1;
 
-  // Mutex need to be aquired when using fileNodes / directoryPaths.
-  std::recursive_mutex _filesnodes_mutex;
-  // Global map of filename / filenode for all the filesystem.
-  std::unordered_map<std::wstring, std::shared_ptr<filenode>> _filenodes;
-  // Directory map of directoryname / sub filenodes in the scope.
-  // A directory \foo with 2 files bar and coco will have one entry:
-  // first: foo - second: set filenode { bar, coco }
-  std::unordered_map<std::wstring, std::set<std::shared_ptr<filenode>>>
-      _directoryPaths;
+  // Return the directory holding filename, or its main stream when filename
+  // is an alternate stream.
+  std::shared_ptr<filenode> find_container(
+      const std::wstring& filename,
+      const std::pair<std::wstring, std::wstring>& stream_names);
+  // Put filenode in container under name, as an alternate stream of it if
+  // is_stream.
+  NTSTATUS link(const std::shared_ptr<filenode>& container,
+                const std::wstring& name, bool is_stream,
+                const std::shared_ptr<filenode>& filenode);
+  // Take filenode out of container if still under name.
+  static void unlink(const std::shared_ptr<filenode>& container,
+                     const std::wstring& name, bool is_stream,
+                     const std::shared_ptr<filenode>& filenode);
+  void remove_locked(const std::shared_ptr<filenode>& filenode);
+  // Queue a filenode taken out of the hierarchy to the reaper thread, which is
+  // started on first use.
+  void reap(std::shared_ptr<filenode> filenode);
+  void reaper_thread();
+
+  // Taken shared by add and remove, which only lock the directory they
+  // modify, and exclusive by move so that concurrent moves cannot create a
+  // cycle. find and list_folder do not take it.
+  std::shared_mutex _tree_mutex;
+  // Root of the filesystem hierarchy. Each directory filenode holds its
+  // children by name and each main stream its alternate streams, so a move is
+  // a relink of the moved filenode whatever its subtree size.
+  // Accessed atomically as restore replaces it.
+  std::shared_ptr<filenode> _root;
+
+  // Filenodes removed from the hierarchy and not yet released.
+  std::mutex _reaper_mutex;
+  std::condition_variable _reaper_cv;
+  std::vector<std::shared_ptr<filenode>> _reaper_queue;
+  bool _reaper_stop = false;
+  std::thread _reaper;
 };
 }  // namespace memfs
 
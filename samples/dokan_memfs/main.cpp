@@ -26,8 +26,13 @@ THE SOFTWARE.
 */
 
 #include "memfs.h"
+#include "memfs_image.h"
+#include "memfs_log.h"
 
-#include <spdlog/spdlog.h>
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include <thread>
 
 void show_usage() {
   // clang-format off
@@ -42,7 +47,14 @@ void show_usage() {
                 "  /d (enable debug output)\t\t\t Enable debug output to an attached debugger.\n"
                 "  /i (Timeout in Milliseconds ex. /i 30000)\t Timeout until a running operation is aborted and the device is unmounted.\n"
                 "  /x (network unmount)\t\t\t\t Allows unmounting network drive from file explorer\n"
-                "  /e Enable Driver Logs\t\t\t\t Forward Kernel logs to userland.\n\n"
+                "  /e Enable Driver Logs\t\t\t\t Forward Kernel logs to userland.\n"
+                "  /v LogLevel (ex. /v warn)\t\t\t Log level: trace, debug, info, warn, error, critical or off. Default is info with /d, error otherwise.\n"
+                "\t\t\t\t\t\t Levels under the build threshold (warn for release builds) are compiled out.\n"
+                "  /b Memory budget in MB (ex. /b 4096)\t\t File data over the budget is spilled to a temporary file.\n"
+                "  /p ImageFile (ex. /p C:\\memfs.img)\t\t Load the volume from the image file and save it back on unmount.\n"
+                "  /s MountPoint (ex. /s n)\t\t\t Snapshot mount point. Enter s in the console to mount a read-only snapshot\n\t\t\t\t\t\t of the volume there and r to restore the volume to the last snapshot.\n"
+                "  /j Options (ex. /j 0x200000)\t\t\t Additional DOKAN_OPTION_* flags, e.g. for the options that have no switch.\n"
+                "  /k Cache timeout in Milliseconds (ex. /k 1000)\t Cache missing paths and directory listings for that time.\n\n"
                 "Examples:\n"
                 "\tmemfs.exe \t\t\t# Mount as a local filesystem into a drive of letter M:\\.\n"
                 "\tmemfs.exe /l P:\t\t\t# Mount as a local filesystem into a drive of letter P:\\.\n"
@@ -72,6 +84,9 @@ BOOL WINAPI ctrl_handler(DWORD dw_ctrl_type) {
 int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
   try {
     dokan_memfs = std::make_shared<memfs::memfs>();
+    ULONGLONG memory_budget = 0;
+    std::wstring image_path;
+    std::string log_level;
     // Parse arguments
     for (ULONG i = 1; i < argc; ++i) {
       std::wstring arg = argv[i];
@@ -98,10 +113,24 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
         std::wstring extra_arg = argv[++i];
         if (arg == L"/i") {
           dokan_memfs->timeout = std::stoul(extra_arg);
+        } else if (arg == L"/v") {
+          for (auto c : extra_arg) log_level += static_cast<char>(c);
+        } else if (arg == L"/p") {
+          image_path = extra_arg;
+        } else if (arg == L"/b") {
+          memory_budget = std::stoull(extra_arg) * 1024 * 1024;
+        } else if (arg == L"/j") {
+          dokan_memfs->extra_options = std::stoul(extra_arg, nullptr, 0);
+        } else if (arg == L"/k") {
+          dokan_memfs->cache_timeout = std::stoul(extra_arg);
         } else if (arg == L"/l") {
           wcscpy_s(dokan_memfs->mount_point,
                    sizeof(dokan_memfs->mount_point) / sizeof(WCHAR),
                    extra_arg.c_str());
+        } else if (arg == L"/s") {
+          wcscpy_s(dokan_memfs->snapshot_mount_point,
+                   sizeof(dokan_memfs->snapshot_mount_point) / sizeof(WCHAR),
+                   extra_arg.c_str());
         } else if (arg == L"/n") {
           dokan_memfs->network_drive = true;
           wcscpy_s(dokan_memfs->unc_name,
@@ -110,17 +139,56 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
         }
       }
     }
+    // Log from a background thread so that the I/O path only queues messages
+    spdlog::init_thread_pool(8192, 1);
+    spdlog::set_default_logger(
+        spdlog::stdout_color_mt<spdlog::async_factory>("memfs"));
+    if (!log_level.empty())
+      spdlog::set_level(spdlog::level::from_str(log_level));
+    else if (!dokan_memfs->debug_log)
+      spdlog::set_level(spdlog::level::err);
+
     if (!SetConsoleCtrlHandler(ctrl_handler, TRUE)) {
       spdlog::error("Control Handler is not set: {}", GetLastError());
     }
+    if (memory_budget) memfs::chunk_store::get().set_budget(memory_budget);
+    if (!image_path.empty())
+      dokan_memfs->fs_filenodes = memfs::memfs_image::load(image_path);
     DokanInit();
     // Start the memory filesystem
     dokan_memfs->start();
+    if (dokan_memfs->snapshot_mount_point[0] != L'\0') {
+      // Snapshot commands read from the console until the volume is unmounted
+      std::thread([] {
+        std::wstring command;
+        while (std::getline(std::wcin, command)) {
+          try {
+            if (command == L"s")
+              dokan_memfs->take_snapshot();
+            else if (command == L"r")
+              dokan_memfs->restore_snapshot();
+          } catch (const std::exception& ex) {
+            spdlog::error("Snapshot command failure: {}", ex.what());
+          }
+        }
+      }).detach();
+    }
     dokan_memfs->wait();
+    if (!image_path.empty())
+      memfs::memfs_image::save(*dokan_memfs->fs_filenodes);
+    if (memory_budget) {
+      auto& store = memfs::chunk_store::get();
+      std::wcout << L"File data resident: " << store.resident_bytes()
+                 << L" bytes, spilled: " << store.spilled_bytes() << L" bytes"
+                 << std::endl;
+    }
     DokanShutdown();
   } catch (const std::exception& ex) {
     spdlog::error("dokan_memfs failure: {}", ex.what());
+    spdlog::shutdown();
     return 1;
   }
+  // Flush the async logger
+  spdlog::shutdown();
   return 0;
 }
\ No newline at end of file
@@ -26,12 +26,12 @@ THE SOFTWARE.
 */
 
 #include "memfs.h"
-
-#include <spdlog/spdlog.h>
+#include "memfs_log.h"
 
 namespace memfs {
 void memfs::start() {
-  fs_filenodes = std::make_unique<::memfs::fs_filenodes>();
+  // A snapshot comes with its filenodes
+  if (!fs_filenodes) fs_filenodes = std::make_unique<::memfs::fs_filenodes>();
 
   DOKAN_OPTIONS dokan_options;
   ZeroMemory(&dokan_options, sizeof(DOKAN_OPTIONS));
@@ -45,8 +45,6 @@ void memfs::start() {
     if (dispatch_driver_logs) {
       dokan_options.Options |= DOKAN_OPTION_DISPATCH_DRIVER_LOGS;
     }
-  } else {
-    spdlog::set_level(spdlog::level::err);
   }
   // Mount type
   if (network_drive) {
@@ -66,6 +64,11 @@ void memfs::start() {
     dokan_options.Options |= DOKAN_OPTION_CURRENT_SESSION;
   }
   
+  if (read_only) dokan_options.Options |= DOKAN_OPTION_WRITE_PROTECT;
+  dokan_options.Options |= extra_options;
+  dokan_options.NegativeCacheTimeoutMs = cache_timeout;
+  dokan_options.DirectoryListCacheTimeoutMs = cache_timeout;
+
   dokan_options.Timeout = timeout;
   dokan_options.GlobalContext = reinterpret_cast<ULONG64>(this);
 
@@ -89,7 +92,7 @@ void memfs::start() {
     case DOKAN_VERSION_ERROR:
       throw std::runtime_error("Version error");
     default:
-      spdlog::error(L"DokanMain failed with {}", status);
+      SPDLOG_ERROR(L"DokanMain failed with {}", status);
       throw std::runtime_error("Unknown error"); // add error status
   }
 }
@@ -98,8 +101,46 @@ void memfs::wait() {
   DokanWaitForFileSystemClosed(instance, INFINITE);
   // Release instance resources
   DokanCloseHandle(instance);
+
+  std::scoped_lock lock(_snapshot_mutex);
+  if (_snapshot) {
+    _snapshot->stop();
+    _snapshot->wait();
+    _snapshot.reset();
+  }
 }
 
 void memfs::stop() { DokanRemoveMountPoint(mount_point); }
 
+void memfs::take_snapshot() {
+  std::scoped_lock lock(_snapshot_mutex);
+  if (_snapshot) {
+    _snapshot->stop();
+    _snapshot->wait();
+    _snapshot.reset();
+  }
+
+  auto snapshot = std::make_shared<memfs>();
+  wcscpy_s(snapshot->mount_point, snapshot_mount_point);
+  snapshot->single_thread = single_thread;
+  snapshot->removable_drive = removable_drive;
+  snapshot->current_session = current_session;
+  snapshot->debug_log = debug_log;
+  snapshot->timeout = timeout;
+  snapshot->read_only = true;
+  snapshot->fs_filenodes = fs_filenodes->snapshot();
+  snapshot->start();
+  _snapshot = snapshot;
+  SPDLOG_INFO(L"Snapshot mounted at {}", snapshot_mount_point);
+}
+
+void memfs::restore_snapshot() {
+  std::scoped_lock lock(_snapshot_mutex);
+  if (!_snapshot) {
+    SPDLOG_WARN(L"No snapshot to restore");
+    return;
+  }
+  fs_filenodes->restore(*_snapshot->fs_filenodes);
+}
+
 } // namespace memfs
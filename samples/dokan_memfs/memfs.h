@@ -36,6 +36,7 @@ THE SOFTWARE.
 
 #include <WinBase.h>
 #include <iostream>
+#include <mutex>
 
 namespace memfs {
 class memfs {
@@ -46,6 +47,12 @@ class memfs {
   void wait();
   void stop();
 
+  // Mount a read-only snapshot of the filesystem at snapshot_mount_point,
+  // replacing the previous one.
+  void take_snapshot();
+  // Reset the filesystem to the last snapshot taken.
+  void restore_snapshot();
+
   DOKAN_HANDLE instance = nullptr;
 
   // FileSystem mount options
@@ -58,10 +65,21 @@ class memfs {
   bool debug_log = false;
   bool enable_network_unmount = false;
   bool dispatch_driver_logs = false;
+  bool read_only = false;
   ULONG timeout = 0;
+  // DOKAN_OPTION_* flags added to the ones above
+  ULONG extra_options = 0;
+  // Time missing paths and directory listings are cached for
+  ULONG cache_timeout = 0;
+  WCHAR snapshot_mount_point[MAX_PATH] = L"";
 
   // Memory FileSystem runtime context.
   std::unique_ptr<fs_filenodes> fs_filenodes;
+
+ private:
+  std::mutex _snapshot_mutex;
+  // _snapshot_mutex need to be aquired
+  std::shared_ptr<memfs> _snapshot;
 };
 }  // namespace memfs
 
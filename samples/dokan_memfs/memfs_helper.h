@@ -30,6 +30,7 @@ THE SOFTWARE.
 
 #include <Windows.h>
 #include <string>
+#include <string_view>
 #include <filesystem>
 
 namespace memfs {
@@ -102,6 +103,18 @@ class memfs_helper {
     return std::pair<std::wstring, std::wstring>(main_stream, alternate_stream);
   }
 
+  // Same split as GetStreamNames without copying: for \dir\foo:bar, first is
+  // the path of the main stream \dir\foo and second the stream name bar,
+  // empty when there is none. The views point into filename.
+  static inline std::pair<std::wstring_view, std::wstring_view>
+  SplitStreamName(std::wstring_view filename) {
+    const auto name_pos = filename.find_last_of(L'\\') + 1;
+    const auto stream_pos = filename.find(L':', name_pos);
+    if (stream_pos == std::wstring_view::npos)
+      return {filename, std::wstring_view()};
+    return {filename.substr(0, stream_pos), filename.substr(stream_pos + 1)};
+  }
+
   // Return the filename without any stream informations.
   // <filename>:<stream name>:<stream type>
   static inline std::wstring GetFileNameStreamLess(
@@ -0,0 +1,355 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "memfs_image.h"
+#include "memfs_log.h"
+
+#include <algorithm>
+
+namespace memfs {
+namespace {
+constexpr uint32_t image_magic = 0x4953464D;  // MFSI
+constexpr uint32_t image_version = 1;
+constexpr uint32_t no_parent = 0xFFFFFFFF;
+
+constexpr uint32_t node_directory = 1;
+constexpr uint32_t node_stream = 2;
+
+struct image_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t chunk_size;
+  // 0 while a save is in progress
+  uint32_t node_count;
+  uint64_t slot_count;
+  uint64_t table_offset;
+  uint64_t table_size;
+};
+
+// Followed by chunk_count image_chunk, the name and the security descriptor,
+// aligned on 8 bytes.
+struct image_node {
+  uint32_t length;
+  uint32_t parent;
+  uint32_t flags;
+  uint32_t attributes;
+  int64_t fileindex;
+  int64_t creation;
+  int64_t lastaccess;
+  int64_t lastwrite;
+  uint64_t size;
+  uint32_t chunk_count;
+  uint32_t name_length;  // In characters
+  uint32_t security_length;
+  uint32_t reserved;
+};
+
+struct image_chunk {
+  uint64_t index;
+  int64_t slot;
+};
+
+bool read_at(HANDLE file, void* buffer, DWORD length, uint64_t offset) {
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD read = 0;
+  return ReadFile(file, buffer, length, &read, &overlapped) && read == length;
+}
+
+bool write_at(HANDLE file, const void* buffer, DWORD length, uint64_t offset) {
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD written = 0;
+  return WriteFile(file, buffer, length, &written, &overlapped) &&
+         written == length;
+}
+}  // namespace
+
+std::unique_ptr<fs_filenodes> memfs_image::load(const std::wstring& path) {
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Failed to open the image file");
+  chunk_store::get().set_image(file);
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size))
+    throw std::runtime_error("Failed to get the image file size");
+  if (!file_size.QuadPart) {
+    SPDLOG_INFO(L"Image: {} is new", path);
+    return nullptr;
+  }
+
+  image_header header;
+  if (!read_at(file, &header, sizeof(header), 0) ||
+      header.magic != image_magic || header.version != image_version ||
+      header.chunk_size != data_chunk::size)
+    throw std::runtime_error("Invalid image file");
+  if (!header.node_count)
+    throw std::runtime_error("Image file was not completely saved");
+  if (header.table_offset != data_chunk::image_offset(header.slot_count) ||
+      header.table_offset + header.table_size >
+          static_cast<uint64_t>(file_size.QuadPart))
+    throw std::runtime_error("Invalid image file");
+
+  // Map the node table, from the allocation granularity below it
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  const uint64_t map_offset =
+      header.table_offset -
+      header.table_offset % system_info.dwAllocationGranularity;
+  HANDLE mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) throw std::runtime_error("Failed to map the image file");
+  auto view = static_cast<const uint8_t*>(MapViewOfFile(
+      mapping, FILE_MAP_READ, static_cast<DWORD>(map_offset >> 32),
+      static_cast<DWORD>(map_offset),
+      static_cast<SIZE_T>(header.table_offset - map_offset +
+                          header.table_size)));
+  // The view keeps the mapping alive
+  CloseHandle(mapping);
+  if (!view) throw std::runtime_error("Failed to map the image file");
+
+  std::unique_ptr<fs_filenodes> filenodes;
+  try {
+    filenodes = load_nodes(view + (header.table_offset - map_offset),
+                           header.table_size, header.node_count,
+                           header.slot_count);
+  } catch (...) {
+    UnmapViewOfFile(view);
+    throw;
+  }
+  UnmapViewOfFile(view);
+  SPDLOG_INFO(L"Image: {} loaded {} nodes", path, header.node_count);
+  return filenodes;
+}
+
+std::unique_ptr<fs_filenodes> memfs_image::load_nodes(const uint8_t* table,
+                                                      uint64_t table_size,
+                                                      uint32_t node_count,
+                                                      uint64_t slot_count) {
+  std::vector<std::shared_ptr<filenode>> nodes;
+  nodes.reserve(node_count);
+  LONGLONG max_fileindex = 0;
+  uint64_t position = 0;
+  for (uint32_t i = 0; i < node_count; ++i) {
+    if (position + sizeof(image_node) > table_size)
+      throw std::runtime_error("Invalid image node table");
+    auto node = reinterpret_cast<const image_node*>(table + position);
+    auto chunks = reinterpret_cast<const image_chunk*>(node + 1);
+    auto name = reinterpret_cast<const WCHAR*>(chunks + node->chunk_count);
+    auto security =
+        reinterpret_cast<const uint8_t*>(name + node->name_length);
+    if (sizeof(image_node) +
+                static_cast<uint64_t>(node->chunk_count) *
+                    sizeof(image_chunk) +
+                static_cast<uint64_t>(node->name_length) * sizeof(WCHAR) +
+                node->security_length >
+            node->length ||
+        position + node->length > table_size ||
+        (i == 0) != (node->parent == no_parent) ||
+        (i && node->parent >= i) ||
+        (i == 0 && !(node->flags & node_directory)))
+      throw std::runtime_error("Invalid image node table");
+
+    auto f = filenode::create(std::wstring(), false, 0, nullptr);
+    f->is_directory = (node->flags & node_directory) != 0;
+    f->attributes = node->attributes;
+    f->fileindex = node->fileindex;
+    f->times.creation = node->creation;
+    f->times.lastaccess = node->lastaccess;
+    f->times.lastwrite = node->lastwrite;
+    f->_fileName.assign(name, node->name_length);
+    if (node->security_length)
+      f->security.SetDescriptor(security, node->security_length);
+    for (uint32_t c = 0; c < node->chunk_count; ++c) {
+      if (chunks[c].slot < 0 ||
+          static_cast<uint64_t>(chunks[c].slot) >= slot_count ||
+          chunks[c].index >= (node->size + data_chunk::size - 1) /
+                                 data_chunk::size)
+        throw std::runtime_error("Invalid image chunk");
+      f->_data.add_image_chunk(chunks[c].index, chunks[c].slot);
+    }
+    f->_data.resize(node->size);
+
+    if (i) {
+      auto& parent = nodes[node->parent];
+      if (node->flags & node_stream) {
+        f->main_stream = parent;
+        parent->add_stream(f->_fileName, f);
+      } else {
+        if (!parent->is_directory)
+          throw std::runtime_error("Invalid image node table");
+        f->_parent = parent;
+        parent->_children[f->_fileName] = f;
+      }
+    }
+    max_fileindex = (std::max)(max_fileindex, f->fileindex);
+    nodes.push_back(f);
+    position += node->length;
+  }
+  return std::unique_ptr<fs_filenodes>(
+      new fs_filenodes(nodes[0], max_fileindex + 1));
+}
+
+void memfs_image::collect_nodes(
+    const std::shared_ptr<filenode>& f, uint32_t parent,
+    std::vector<std::pair<std::shared_ptr<filenode>, uint32_t>>& nodes) {
+  const auto index = static_cast<uint32_t>(nodes.size());
+  nodes.emplace_back(f, parent);
+  for (const auto& [stream_name, stream] : f->get_streams())
+    nodes.emplace_back(stream, index);
+  std::shared_lock lock(f->_children_mutex);
+  for (const auto& [name, child] : f->_children)
+    collect_nodes(child, index, nodes);
+}
+
+void memfs_image::save(fs_filenodes& filenodes) {
+  auto& store = chunk_store::get();
+  HANDLE file = store.image();
+  if (file == INVALID_HANDLE_VALUE) return;
+
+  image_header header = {};
+  if (!read_at(file, &header, sizeof(header), 0) ||
+      header.magic != image_magic)
+    header.slot_count = 0;
+  const uint64_t previous_slot_count = header.slot_count;
+  header.magic = image_magic;
+  header.version = image_version;
+  header.chunk_size = data_chunk::size;
+  // Mark the image incomplete until the new node table is written, as the
+  // chunks can overwrite the previous one.
+  header.node_count = 0;
+  if (!write_at(file, &header, sizeof(header), 0))
+    throw std::runtime_error("Failed to write the image header");
+
+  std::vector<std::pair<std::shared_ptr<filenode>, uint32_t>> nodes;
+  collect_nodes(std::atomic_load(&filenodes._root), no_parent, nodes);
+
+  // Image slots still holding the data of an unmodified chunk
+  std::vector<bool> used(static_cast<size_t>(previous_slot_count));
+  for (const auto& [f, parent] : nodes) {
+    f->_data.for_each_allocated_chunk([&](uint64_t, data_chunk& c) {
+      std::shared_lock chunk_lock(c.mutex);
+      if (c.image_slot >= 0 &&
+          static_cast<uint64_t>(c.image_slot) < previous_slot_count)
+        used[static_cast<size_t>(c.image_slot)] = true;
+    });
+  }
+
+  // Write back the chunks written since load, in the free slots first
+  uint64_t slot_count = previous_slot_count;
+  uint64_t next_free_slot = 0;
+  uint64_t written_chunks = 0;
+  for (const auto& [f, parent] : nodes) {
+    f->_data.for_each_allocated_chunk([&](uint64_t, data_chunk& c) {
+      {
+        std::shared_lock chunk_lock(c.mutex);
+        if (c.image_slot >= 0) return;
+      }
+      while (next_free_slot < previous_slot_count &&
+             used[static_cast<size_t>(next_free_slot)])
+        ++next_free_slot;
+      const auto slot = static_cast<int64_t>(
+          next_free_slot < previous_slot_count ? next_free_slot++
+                                               : slot_count++);
+      auto chunk_lock = store.lock(c);
+      if (!write_at(file, c.data.get(), data_chunk::size,
+                    data_chunk::image_offset(slot)))
+        throw std::runtime_error("Failed to write the image data");
+      c.image_slot = slot;
+      ++written_chunks;
+    });
+  }
+
+  // Node table
+  std::vector<uint8_t> table;
+  for (const auto& [f, parent] : nodes) {
+    std::vector<image_chunk> chunks;
+    f->_data.for_each_allocated_chunk([&](uint64_t index, data_chunk& c) {
+      std::shared_lock chunk_lock(c.mutex);
+      chunks.push_back({index, c.image_slot});
+    });
+    std::wstring name;
+    {
+      std::shared_lock name_lock(f->_fileName_mutex);
+      name = f->_fileName;
+    }
+    std::shared_lock security_lock(f->security);
+
+    image_node node = {};
+    node.parent = parent;
+    node.flags = (f->is_directory ? node_directory : 0) |
+                 (f->main_stream ? node_stream : 0);
+    node.attributes = f->attributes;
+    node.fileindex = f->fileindex;
+    node.creation = f->times.creation;
+    node.lastaccess = f->times.lastaccess;
+    node.lastwrite = f->times.lastwrite;
+    node.size = static_cast<uint64_t>(f->get_filesize());
+    node.chunk_count = static_cast<uint32_t>(chunks.size());
+    node.name_length = static_cast<uint32_t>(name.length());
+    node.security_length = f->security.descriptor_size;
+    node.length = static_cast<uint32_t>(
+        (sizeof(node) + chunks.size() * sizeof(image_chunk) +
+         name.length() * sizeof(WCHAR) + node.security_length + 7) &
+        ~static_cast<size_t>(7));
+
+    const size_t position = table.size();
+    table.resize(position + node.length);
+    uint8_t* record = table.data() + position;
+    memcpy(record, &node, sizeof(node));
+    record += sizeof(node);
+    memcpy(record, chunks.data(), chunks.size() * sizeof(image_chunk));
+    record += chunks.size() * sizeof(image_chunk);
+    memcpy(record, name.data(), name.length() * sizeof(WCHAR));
+    record += name.length() * sizeof(WCHAR);
+    if (node.security_length)
+      memcpy(record, f->security.descriptor.get(), node.security_length);
+  }
+
+  header.slot_count = slot_count;
+  header.table_offset =
+      data_chunk::image_offset(static_cast<int64_t>(slot_count));
+  header.table_size = table.size();
+  LARGE_INTEGER end;
+  end.QuadPart = static_cast<LONGLONG>(header.table_offset + table.size());
+  if (!write_at(file, table.data(), static_cast<DWORD>(table.size()),
+                header.table_offset) ||
+      !SetFilePointerEx(file, end, nullptr, FILE_BEGIN) ||
+      !SetEndOfFile(file) || !FlushFileBuffers(file))
+    throw std::runtime_error("Failed to write the image node table");
+
+  header.node_count = static_cast<uint32_t>(nodes.size());
+  if (!write_at(file, &header, sizeof(header), 0) || !FlushFileBuffers(file))
+    throw std::runtime_error("Failed to write the image header");
+  SPDLOG_INFO(L"Image: saved {} nodes, wrote back {} chunks", nodes.size(),
+              written_chunks);
+}
+}  // namespace memfs
@@ -0,0 +1,69 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef MEMFS_IMAGE_H_
+#define MEMFS_IMAGE_H_
+
+#include "filenodes.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace memfs {
+// Persistent image of a memfs volume, so that a restart does not have to
+// rebuild its content.
+// Loading maps the node table of the image and builds the hierarchy from it,
+// the file data stays in the image file and is read on first access. Saving
+// only writes back the chunks written since the image was loaded.
+//
+// Image file layout, in blocks of data_chunk::size:
+//   block 0        image_header
+//   blocks 1 - n   chunk data, by image slot
+//   after          node table, one record per filenode in preorder with the
+//                  index of its parent directory or main stream
+class memfs_image {
+ public:
+  // Open the image file at path, created if missing, and return the
+  // filesystem it holds or nullptr if it is new.
+  static std::unique_ptr<fs_filenodes> load(const std::wstring& path);
+  // Write filenodes back to the image file opened by load.
+  static void save(fs_filenodes& filenodes);
+
+ private:
+  static std::unique_ptr<fs_filenodes> load_nodes(const uint8_t* table,
+                                                  uint64_t table_size,
+                                                  uint32_t node_count,
+                                                  uint64_t slot_count);
+  // Append filenode, its streams and its subtree to nodes.
+  static void collect_nodes(
+      const std::shared_ptr<filenode>& filenode, uint32_t parent,
+      std::vector<std::pair<std::shared_ptr<filenode>, uint32_t>>& nodes);
+};
+}  // namespace memfs
+
+#endif  // MEMFS_IMAGE_H_
@@ -27,9 +27,9 @@ THE SOFTWARE.
 
 #include "memfs_operations.h"
 #include "memfs_helper.h"
+#include "memfs_log.h"
 
 #include <sddl.h>
-#include <spdlog/spdlog.h>
 #include <iostream>
 #include <mutex>
 #include <sstream>
@@ -48,8 +48,8 @@ static NTSTATUS create_main_stream(
   auto main_stream_name =
       memfs_helper::GetFileNameStreamLess(filename, stream_names);
   if (!fs_filenodes->find(main_stream_name)) {
-    spdlog::info(L"create_main_stream: we create the maing stream {}", main_stream_name);
-    auto n = fs_filenodes->add(std::make_shared<filenode>(main_stream_name, false,
+    SPDLOG_INFO(L"create_main_stream: we create the maing stream {}", main_stream_name);
+    auto n = fs_filenodes->add(filenode::create(main_stream_name, false,
                                    file_attributes_and_flags, security_context),
         {});
     if (n != STATUS_SUCCESS) return n;
@@ -78,7 +78,7 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
   auto f = filenodes->find(filename_str);
   auto stream_names = memfs_helper::GetStreamNames(filename_str);
 
-  spdlog::info(L"CreateFile: {} with node: {}", filename_str, (f != nullptr));
+  SPDLOG_INFO(L"CreateFile: {} with node: {}", filename_str, (f != nullptr));
 
   // We only support filename length under 255.
   // See GetVolumeInformation - MaximumComponentLength
@@ -100,17 +100,17 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
   // TODO Use AccessCheck to check security rights
 
   if (dokanfileinfo->IsDirectory) {
-    spdlog::info(L"CreateFile: {} is a Directory", filename_str);
+    SPDLOG_INFO(L"CreateFile: {} is a Directory", filename_str);
 
     if (creation_disposition == CREATE_NEW ||
         creation_disposition == OPEN_ALWAYS) {
-      spdlog::info(L"CreateFile: {} create Directory", filename_str);
+      SPDLOG_INFO(L"CreateFile: {} create Directory", filename_str);
       // Cannot create a stream as directory.
       if (!stream_names.second.empty()) return STATUS_NOT_A_DIRECTORY;
 
       if (f) return STATUS_OBJECT_NAME_COLLISION;
 
-      auto newfileNode = std::make_shared<filenode>(
+      auto newfileNode = filenode::create(
           filename_str, true, FILE_ATTRIBUTE_DIRECTORY, security_context);
       return filenodes->add(newfileNode, stream_names);
     }
@@ -118,9 +118,9 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
     if (f && !f->is_directory) return STATUS_NOT_A_DIRECTORY;
     if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
 
-    spdlog::info(L"CreateFile: {} open Directory", filename_str);
+    SPDLOG_INFO(L"CreateFile: {} open Directory", filename_str);
   } else {
-    spdlog::info(L"CreateFile: {} is a File", filename_str);
+    SPDLOG_INFO(L"CreateFile: {} is a File", filename_str);
 
     // Cannot overwrite an hidden or system file.
     if (f && (((!(file_attributes_and_flags & FILE_ATTRIBUTE_HIDDEN) &&
@@ -172,7 +172,7 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
 
     switch (creation_disposition) {
       case CREATE_ALWAYS: {
-        spdlog::info(L"CreateFile: {} CREATE_ALWAYS", filename_str);
+        SPDLOG_INFO(L"CreateFile: {} CREATE_ALWAYS", filename_str);
         /*
          * Creates a new file, always.
          *
@@ -190,7 +190,7 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
         }
 
         auto n =
-            filenodes->add(std::make_shared<filenode>(filename_str, false,
+            filenodes->add(filenode::create(filename_str, false,
                                                       file_attributes_and_flags,
                                                       security_context),
                            stream_names);
@@ -204,7 +204,7 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
         if (f) return STATUS_OBJECT_NAME_COLLISION;
       } break;
       case CREATE_NEW: {
-        spdlog::info(L"CreateFile: {} CREATE_NEW", filename_str);
+        SPDLOG_INFO(L"CreateFile: {} CREATE_NEW", filename_str);
         /*
          * Creates a new file, only if it does not already exist.
          */
@@ -219,20 +219,20 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
           if (n != STATUS_SUCCESS) return n;
         }
 
-        auto n = filenodes->add(std::make_shared<filenode>(filename_str, false,
+        auto n = filenodes->add(filenode::create(filename_str, false,
                                                       file_attributes_and_flags,
                                                       security_context),
                            stream_names);
         if (n != STATUS_SUCCESS) return n;
       } break;
       case OPEN_ALWAYS: {
-        spdlog::info(L"CreateFile: {} OPEN_ALWAYS", filename_str);
+        SPDLOG_INFO(L"CreateFile: {} OPEN_ALWAYS", filename_str);
         /*
          * Opens a file, always.
          */
 
         if (!f) {
-          auto n = filenodes->add(std::make_shared<filenode>(
+          auto n = filenodes->add(filenode::create(
               filename_str, false, file_attributes_and_flags,
                                  security_context),
                              stream_names);
@@ -244,7 +244,7 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
         }
       } break;
       case OPEN_EXISTING: {
-        spdlog::info(L"CreateFile: {} OPEN_EXISTING", filename_str);
+        SPDLOG_INFO(L"CreateFile: {} OPEN_EXISTING", filename_str);
         /*
          * Opens a file or device, only if it exists.
          * If the specified file or device does not exist, the function fails
@@ -257,7 +257,7 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
         }
       } break;
       case TRUNCATE_EXISTING: {
-        spdlog::info(L"CreateFile: {} TRUNCATE_EXISTING", filename_str);
+        SPDLOG_INFO(L"CreateFile: {} TRUNCATE_EXISTING", filename_str);
         /*
          * Opens a file and truncates it so that its size is zero bytes, only if
          * it exists. If the specified file does not exist, the function fails
@@ -270,8 +270,8 @@ memfs_createfile(LPCWSTR filename, PDOKAN_IO_SECURITY_CONTEXT security_context,
         f->attributes = file_attributes_and_flags;
       } break;
       default:
-        spdlog::info(L"CreateFile: {} Unknown CreationDisposition {}",
-                     filename_str, creation_disposition);
+        SPDLOG_INFO(L"CreateFile: {} Unknown CreationDisposition {}",
+                    filename_str, creation_disposition);
         break;
     }
   }
@@ -292,10 +292,10 @@ static void DOKAN_CALLBACK memfs_cleanup(LPCWSTR filename,
                                          PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"Cleanup: {}", filename_str);
+  SPDLOG_INFO(L"Cleanup: {}", filename_str);
   if (dokanfileinfo->DeleteOnClose) {
     // Delete happens during cleanup and not in close event.
-    spdlog::info(L"\tDeleteOnClose: {}", filename_str);
+    SPDLOG_INFO(L"\tDeleteOnClose: {}", filename_str);
     filenodes->remove(filename_str);
   }
 }
@@ -304,7 +304,7 @@ static void DOKAN_CALLBACK memfs_closeFile(LPCWSTR filename,
                                            PDOKAN_FILE_INFO /*dokanfileinfo*/) {
   auto filename_str = std::wstring(filename);
   // Here we should release all resources from the createfile context if we had.
-  spdlog::info(L"CloseFile: {}", filename_str);
+  SPDLOG_INFO(L"CloseFile: {}", filename_str);
 }
 
 static NTSTATUS DOKAN_CALLBACK memfs_readfile(LPCWSTR filename, LPVOID buffer,
@@ -314,13 +314,13 @@ static NTSTATUS DOKAN_CALLBACK memfs_readfile(LPCWSTR filename, LPVOID buffer,
                                               PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"ReadFile: {}", filename_str);
+  SPDLOG_INFO(L"ReadFile: {}", filename_str);
   auto f = filenodes->find(filename_str);
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
 
   *readlength = f->read(buffer, bufferlength, offset);
-  spdlog::info(L"\tBufferLength: {} offset: {} readlength: {}", bufferlength,
-               offset, *readlength);
+  SPDLOG_INFO(L"\tBufferLength: {} offset: {} readlength: {}", bufferlength,
+              offset, *readlength);
   return STATUS_SUCCESS;
 }
 
@@ -331,7 +331,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_writefile(LPCWSTR filename, LPCVOID buffer,
                                                PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"WriteFile: {}", filename_str);
+  SPDLOG_INFO(L"WriteFile: {}", filename_str);
   auto f = filenodes->find(filename_str);
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
 
@@ -346,8 +346,8 @@ static NTSTATUS DOKAN_CALLBACK memfs_writefile(LPCWSTR filename, LPCVOID buffer,
     // We return STATUS_SUCCESS when offset is beyond fileSize
     // and write the maximum we are allowed to.
     if (offset >= file_size) {
-      spdlog::info(L"\tPagingIo Outside offset: {} FileSize: {}", offset,
-                   file_size);
+      SPDLOG_INFO(L"\tPagingIo Outside offset: {} FileSize: {}", offset,
+                  file_size);
       *number_of_bytes_written = 0;
       return STATUS_SUCCESS;
     }
@@ -361,13 +361,13 @@ static NTSTATUS DOKAN_CALLBACK memfs_writefile(LPCWSTR filename, LPCVOID buffer,
         number_of_bytes_to_write = static_cast<DWORD>(bytes);
       }
     }
-    spdlog::info(L"\tPagingIo number_of_bytes_to_write: {}",
-                 number_of_bytes_to_write);
+    SPDLOG_INFO(L"\tPagingIo number_of_bytes_to_write: {}",
+                number_of_bytes_to_write);
   }
 
   *number_of_bytes_written = f->write(buffer, number_of_bytes_to_write, offset);
 
-  spdlog::info(
+  SPDLOG_INFO(
       L"\tNumberOfBytesToWrite {} offset: {} number_of_bytes_written: {}",
       number_of_bytes_to_write, offset, *number_of_bytes_written);
   return STATUS_SUCCESS;
@@ -377,7 +377,7 @@ static NTSTATUS DOKAN_CALLBACK
 memfs_flushfilebuffers(LPCWSTR filename, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"FlushFileBuffers: {}", filename_str);
+  SPDLOG_INFO(L"FlushFileBuffers: {}", filename_str);
   auto f = filenodes->find(filename_str);
   // Nothing to flush, we directly write the content into our buffer.
 
@@ -392,7 +392,7 @@ memfs_getfileInformation(LPCWSTR filename, LPBY_HANDLE_FILE_INFORMATION buffer,
                          PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"GetFileInformation: {}", filename_str);
+  SPDLOG_INFO(L"GetFileInformation: {}", filename_str);
   auto f = filenodes->find(filename_str);
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
   buffer->dwFileAttributes = f->attributes;
@@ -408,7 +408,7 @@ memfs_getfileInformation(LPCWSTR filename, LPBY_HANDLE_FILE_INFORMATION buffer,
   buffer->nNumberOfLinks = 1;
   buffer->dwVolumeSerialNumber = g_volumserial;
 
-  spdlog::info(
+  SPDLOG_INFO(
       L"GetFileInformation: {} Attributes: {:x} Times: Creation {:x} "
       L"LastAccess {:x} LastWrite {:x} FileSize {} NumberOfLinks {} "
       L"VolumeSerialNumber {:x}",
@@ -424,15 +424,13 @@ static NTSTATUS DOKAN_CALLBACK memfs_findfiles(LPCWSTR filename,
                                                PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  auto files = filenodes->list_folder(filename_str);
   WIN32_FIND_DATAW findData;
-  spdlog::info(L"FindFiles: {}", filename_str);
+  SPDLOG_INFO(L"FindFiles: {}", filename_str);
   ZeroMemory(&findData, sizeof(WIN32_FIND_DATAW));
-  for (const auto& f : files) {
-    if (f->main_stream) continue; // Do not list File Streams
-    const auto fileNodeName = memfs_helper::GetFileName(f->get_filename());
+  filenodes->list_folder(filename_str, [&](const std::wstring& fileNodeName,
+                                           const std::shared_ptr<filenode>& f) {
     if (fileNodeName.size() > MAX_PATH)
-      continue;
+      return;
     std::copy(fileNodeName.begin(), fileNodeName.end(),
               std::begin(findData.cFileName));
     findData.cFileName[fileNodeName.length()] = '\0';
@@ -444,13 +442,13 @@ static NTSTATUS DOKAN_CALLBACK memfs_findfiles(LPCWSTR filename,
     auto file_size = f->get_filesize();
     memfs_helper::LlongToDwLowHigh(file_size, findData.nFileSizeLow,
                                    findData.nFileSizeHigh);
-    spdlog::info(
+    SPDLOG_INFO(
         L"FindFiles: {} fileNode: {} Attributes: {} Times: Creation {} "
         L"LastAccess {} LastWrite {} FileSize {}",
         filename_str, fileNodeName, findData.dwFileAttributes,
         f->times.creation, f->times.lastaccess, f->times.lastwrite, file_size);
     fill_finddata(&findData, dokanfileinfo);
-  }
+  });
   return STATUS_SUCCESS;
 }
 
@@ -459,8 +457,8 @@ static NTSTATUS DOKAN_CALLBACK memfs_setfileattributes(
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
   auto f = filenodes->find(filename_str);
-  spdlog::info(L"SetFileAttributes: {} fileattributes {}", filename_str,
-               fileattributes);
+  SPDLOG_INFO(L"SetFileAttributes: {} fileattributes {}", filename_str,
+              fileattributes);
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
 
   // from https://docs.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-setfileattributesw
@@ -491,7 +489,7 @@ memfs_setfiletime(LPCWSTR filename, CONST FILETIME* creationtime,
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
   auto f = filenodes->find(filename_str);
-  spdlog::info(L"SetFileTime: {}", filename_str);
+  SPDLOG_INFO(L"SetFileTime: {}", filename_str);
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
   if (creationtime && !filetimes::empty(creationtime))
     f->times.creation = memfs_helper::FileTimeToLlong(*creationtime);
@@ -508,7 +506,7 @@ memfs_deletefile(LPCWSTR filename, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
   auto f = filenodes->find(filename_str);
-  spdlog::info(L"DeleteFile: {}", filename_str);
+  SPDLOG_INFO(L"DeleteFile: {}", filename_str);
 
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
 
@@ -524,9 +522,9 @@ static NTSTATUS DOKAN_CALLBACK
 memfs_deletedirectory(LPCWSTR filename, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"DeleteDirectory: {}", filename_str);
+  SPDLOG_INFO(L"DeleteDirectory: {}", filename_str);
 
-  if (filenodes->list_folder(filename_str).size())
+  if (!filenodes->is_empty_folder(filename_str))
     return STATUS_DIRECTORY_NOT_EMPTY;
 
   // Here prepare and check if the directory can be deleted
@@ -542,7 +540,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_movefile(LPCWSTR filename,
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
   auto new_filename_str = std::wstring(new_filename);
-  spdlog::info(L"MoveFile: {} to {}", filename_str, new_filename_str);
+  SPDLOG_INFO(L"MoveFile: {} to {}", filename_str, new_filename_str);
   memfs_helper::RemoveStreamType(new_filename_str);
   auto new_stream_names = memfs_helper::GetStreamNames(new_filename_str);
   if (new_stream_names.first.empty()) {
@@ -554,7 +552,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_movefile(LPCWSTR filename,
         memfs_helper::GetFileNameStreamLess(filename, stream_names) +
                        L":" + new_stream_names.second;
   }
-  spdlog::info(L"MoveFile: after {} to {}", filename_str, new_filename_str);
+  SPDLOG_INFO(L"MoveFile: after {} to {}", filename_str, new_filename_str);
   return filenodes->move(filename_str, new_filename_str, replace_if_existing);
 }
 
@@ -562,7 +560,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_setendoffile(
     LPCWSTR filename, LONGLONG ByteOffset, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"SetEndOfFile: {} ByteOffset {}", filename_str, ByteOffset);
+  SPDLOG_INFO(L"SetEndOfFile: {} ByteOffset {}", filename_str, ByteOffset);
   auto f = filenodes->find(filename_str);
 
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
@@ -574,11 +572,12 @@ static NTSTATUS DOKAN_CALLBACK memfs_setallocationsize(
     LPCWSTR filename, LONGLONG alloc_size, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"SetAllocationSize: {} AllocSize {}", filename_str, alloc_size);
+  SPDLOG_INFO(L"SetAllocationSize: {} AllocSize {}", filename_str, alloc_size);
   auto f = filenodes->find(filename_str);
 
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
-  f->set_endoffile(alloc_size);
+  // An allocation past the end of file does not change its size.
+  if (alloc_size < f->get_filesize()) f->set_endoffile(alloc_size);
   return STATUS_SUCCESS;
 }
 
@@ -587,8 +586,8 @@ static NTSTATUS DOKAN_CALLBACK memfs_lockfile(LPCWSTR filename,
                                               LONGLONG length,
                                               PDOKAN_FILE_INFO dokanfileinfo) {
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"LockFile: {} ByteOffset {} Length {}", filename_str,
-               byte_offset, length);
+  SPDLOG_INFO(L"LockFile: {} ByteOffset {} Length {}", filename_str,
+              byte_offset, length);
   return STATUS_NOT_IMPLEMENTED;
 }
 
@@ -596,15 +595,15 @@ static NTSTATUS DOKAN_CALLBACK
 memfs_unlockfile(LPCWSTR filename, LONGLONG byte_offset, LONGLONG length,
                  PDOKAN_FILE_INFO dokanfileinfo) {
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"UnlockFile: {} ByteOffset {} Length {}", filename_str,
-               byte_offset, length);
+  SPDLOG_INFO(L"UnlockFile: {} ByteOffset {} Length {}", filename_str,
+              byte_offset, length);
   return STATUS_NOT_IMPLEMENTED;
 }
 
 static NTSTATUS DOKAN_CALLBACK memfs_getdiskfreespace(
     PULONGLONG free_bytes_available, PULONGLONG total_number_of_bytes,
     PULONGLONG total_number_of_free_bytes, PDOKAN_FILE_INFO dokanfileinfo) {
-  spdlog::info(L"GetDiskFreeSpace");
+  SPDLOG_INFO(L"GetDiskFreeSpace");
   *free_bytes_available = (ULONGLONG)(512 * 1024 * 1024);
   *total_number_of_bytes = MAXLONGLONG;
   *total_number_of_free_bytes = MAXLONGLONG;
@@ -616,13 +615,14 @@ static NTSTATUS DOKAN_CALLBACK memfs_getvolumeinformation(
     LPDWORD volume_serialnumber, LPDWORD maximum_component_length,
     LPDWORD filesystem_flags, LPWSTR filesystem_name_buffer,
     DWORD filesystem_name_size, PDOKAN_FILE_INFO /*dokanfileinfo*/) {
-  spdlog::info(L"GetVolumeInformation");
+  SPDLOG_INFO(L"GetVolumeInformation");
   wcscpy_s(volumename_buffer, volumename_size, L"Dokan MemFS");
   *volume_serialnumber = g_volumserial;
   *maximum_component_length = 255;
   *filesystem_flags = FILE_CASE_SENSITIVE_SEARCH | FILE_CASE_PRESERVED_NAMES |
                       FILE_SUPPORTS_REMOTE_STORAGE | FILE_UNICODE_ON_DISK |
-                      FILE_NAMED_STREAMS;
+                      FILE_NAMED_STREAMS | FILE_SUPPORTS_BLOCK_REFCOUNTING |
+                      FILE_SUPPORTS_SPARSE_FILES;
 
   wcscpy_s(filesystem_name_buffer, filesystem_name_size, L"NTFS");
   return STATUS_SUCCESS;
@@ -630,7 +630,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_getvolumeinformation(
 
 static NTSTATUS DOKAN_CALLBACK
 memfs_mounted(LPCWSTR MountPoint, PDOKAN_FILE_INFO dokanfileinfo) {
-  spdlog::info(L"Mounted as {}", MountPoint);
+  SPDLOG_INFO(L"Mounted as {}", MountPoint);
   WCHAR *mount_point =
       (reinterpret_cast<memfs *>(dokanfileinfo->DokanOptions->GlobalContext))
           ->mount_point;
@@ -640,7 +640,7 @@ memfs_mounted(LPCWSTR MountPoint, PDOKAN_FILE_INFO dokanfileinfo) {
 
 static NTSTATUS DOKAN_CALLBACK
 memfs_unmounted(PDOKAN_FILE_INFO /*dokanfileinfo*/) {
-  spdlog::info(L"Unmounted");
+  SPDLOG_INFO(L"Unmounted");
   return STATUS_SUCCESS;
 }
 
@@ -650,7 +650,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_getfilesecurity(
     PULONG length_needed, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"GetFileSecurity: {}", filename_str);
+  SPDLOG_INFO(L"GetFileSecurity: {}", filename_str);
   auto f = filenodes->find(filename_str);
 
   if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
@@ -699,7 +699,7 @@ static NTSTATUS DOKAN_CALLBACK memfs_setfilesecurity(
     PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"SetFileSecurity: {}", filename_str);
+  SPDLOG_INFO(L"SetFileSecurity: {}", filename_str);
   static GENERIC_MAPPING memfs_mapping = {FILE_GENERIC_READ, FILE_GENERIC_WRITE,
                                           FILE_GENERIC_EXECUTE,
                                           FILE_ALL_ACCESS};
@@ -738,7 +738,7 @@ memfs_findstreams(LPCWSTR filename, PFillFindStreamData fill_findstreamdata,
                   PVOID findstreamcontext, PDOKAN_FILE_INFO dokanfileinfo) {
   auto filenodes = GET_FS_INSTANCE;
   auto filename_str = std::wstring(filename);
-  spdlog::info(L"FindStreams: {}", filename_str);
+  SPDLOG_INFO(L"FindStreams: {}", filename_str);
   auto f = filenodes->find(filename_str);
 
   if (!f)
@@ -769,26 +769,26 @@ memfs_findstreams(LPCWSTR filename, PFillFindStreamData fill_findstreamdata,
   // Add the alternated stream attached
   // for \foo:bar we need to return in the form of bar:$DATA
   for (const auto &stream : streams) {
-    auto stream_names = memfs_helper::GetStreamNames(stream.first);
-    if (stream_names.second.length() +
+    const auto &stream_name = stream.first;
+    if (stream_name.length() +
             memfs_helper::DataStreamNameStr.length() + 1 >
         sizeof(stream_data.cStreamName))
       continue;
     // Copy the filename foo
-    std::copy(stream_names.second.begin(), stream_names.second.end(),
+    std::copy(stream_name.begin(), stream_name.end(),
               std::begin(stream_data.cStreamName) + 1);
     // Concat :$DATA
     std::copy(memfs_helper::DataStreamNameStr.begin(),
               memfs_helper::DataStreamNameStr.end(),
               std::begin(stream_data.cStreamName) +
-                  stream_names.second.length() + 1);
+                  stream_name.length() + 1);
     stream_data.cStreamName[0] = ':';
-    stream_data.cStreamName[stream_names.second.length() +
+    stream_data.cStreamName[stream_name.length() +
                             memfs_helper::DataStreamNameStr.length() + 1] =
         L'\0';
     stream_data.StreamSize.QuadPart = stream.second->get_filesize();
-    spdlog::info(L"FindStreams: {} StreamName: {} Size: {:x}", filename_str,
-                 stream_names.second, stream_data.StreamSize.QuadPart);
+    SPDLOG_INFO(L"FindStreams: {} StreamName: {} Size: {:x}", filename_str,
+                stream_name, stream_data.StreamSize.QuadPart);
     if (!fill_findstreamdata(&stream_data, findstreamcontext)) {
       return STATUS_BUFFER_OVERFLOW;
     }
@@ -796,6 +796,70 @@ memfs_findstreams(LPCWSTR filename, PFillFindStreamData fill_findstreamdata,
   return STATUS_SUCCESS;
 }
 
+static NTSTATUS DOKAN_CALLBACK memfs_copyfilerange(
+    LPCWSTR filename, LONGLONG target_offset, LPCWSTR source_filename,
+    LONGLONG source_offset, LONGLONG length, PDOKAN_FILE_INFO dokanfileinfo) {
+  auto filenodes = GET_FS_INSTANCE;
+  auto filename_str = std::wstring(filename);
+  SPDLOG_INFO(L"CopyFileRange: {} from {}", filename_str,
+              std::wstring(source_filename));
+  auto f = filenodes->find(filename_str);
+  auto source = filenodes->find(source_filename);
+  if (!f || !source) return STATUS_OBJECT_NAME_NOT_FOUND;
+  // Copied front to back where the chunks cannot be shared
+  if (f == source && source_offset < target_offset &&
+      target_offset < source_offset + length)
+    return STATUS_INVALID_PARAMETER;
+  f->copy_range(*source, source_offset, target_offset, length);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK memfs_setsparsefile(
+    LPCWSTR filename, BOOL sparse, PDOKAN_FILE_INFO dokanfileinfo) {
+  auto filenodes = GET_FS_INSTANCE;
+  auto filename_str = std::wstring(filename);
+  SPDLOG_INFO(L"SetSparseFile: {} sparse {}", filename_str, sparse);
+  auto f = filenodes->find(filename_str);
+  if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
+  // The content always is stored with holes, only the attribute changes
+  if (sparse)
+    f->attributes = (f->attributes & ~static_cast<DWORD>(
+                                         FILE_ATTRIBUTE_NORMAL)) |
+                    FILE_ATTRIBUTE_SPARSE_FILE;
+  else
+    f->attributes &= ~static_cast<DWORD>(FILE_ATTRIBUTE_SPARSE_FILE);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK memfs_zerofilerange(
+    LPCWSTR filename, LONGLONG offset, LONGLONG length,
+    PDOKAN_FILE_INFO dokanfileinfo) {
+  auto filenodes = GET_FS_INSTANCE;
+  auto filename_str = std::wstring(filename);
+  SPDLOG_INFO(L"ZeroFileRange: {} offset {} length {}", filename_str, offset,
+              length);
+  auto f = filenodes->find(filename_str);
+  if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
+  f->zero_range(offset, length);
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK memfs_queryallocatedranges(
+    LPCWSTR filename, LONGLONG offset, LONGLONG length,
+    PFILE_ALLOCATED_RANGE_BUFFER ranges, DWORD max_range_count,
+    LPDWORD range_count, PDOKAN_FILE_INFO dokanfileinfo) {
+  auto filenodes = GET_FS_INSTANCE;
+  auto filename_str = std::wstring(filename);
+  SPDLOG_INFO(L"QueryAllocatedRanges: {} offset {} length {}", filename_str,
+              offset, length);
+  auto f = filenodes->find(filename_str);
+  if (!f) return STATUS_OBJECT_NAME_NOT_FOUND;
+  bool more;
+  *range_count =
+      f->get_allocated_ranges(offset, length, ranges, max_range_count, more);
+  return more ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
 DOKAN_OPERATIONS memfs_operations = {memfs_createfile,
                                      memfs_cleanup,
                                      memfs_closeFile,
@@ -820,5 +884,10 @@ DOKAN_OPERATIONS memfs_operations = {memfs_createfile,
                                      memfs_unmounted,
                                      memfs_getfilesecurity,
                                      memfs_setfilesecurity,
-                                     memfs_findstreams};
+                                     memfs_findstreams,
+                                     nullptr,  // FindFilesWithCursor
+                                     memfs_copyfilerange,
+                                     memfs_setsparsefile,
+                                     memfs_zerofilerange,
+                                     memfs_queryallocatedranges};
 }  // namespace memfs
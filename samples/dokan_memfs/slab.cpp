@@ -0,0 +1,53 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "slab.h"
+
+namespace memfs {
+slab_pool::slab_pool(size_t block_size)
+    : _block_size((block_size + __STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1) &
+                  ~(__STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1)) {}
+
+void* slab_pool::allocate() {
+  std::scoped_lock lock(_mutex);
+  if (_free_blocks.empty()) {
+    _slabs.push_back(
+        std::make_unique<std::byte[]>(_block_size * blocks_per_slab));
+    std::byte* slab = _slabs.back().get();
+    _free_blocks.reserve(_free_blocks.size() + blocks_per_slab);
+    for (size_t i = blocks_per_slab; i > 0; --i)
+      _free_blocks.push_back(slab + (i - 1) * _block_size);
+  }
+  void* block = _free_blocks.back();
+  _free_blocks.pop_back();
+  return block;
+}
+
+void slab_pool::deallocate(void* block) {
+  std::scoped_lock lock(_mutex);
+  _free_blocks.push_back(block);
+}
+}  // namespace memfs
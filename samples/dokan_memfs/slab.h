@@ -0,0 +1,99 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace memfs {
+// Pool of fixed size blocks carved out of large slabs. Freed blocks are kept
+// for reuse and slabs are never released.
+class slab_pool {
+ public:
+  explicit slab_pool(size_t block_size);
+  slab_pool(const slab_pool&) = delete;
+  slab_pool& operator=(const slab_pool&) = delete;
+
+  void* allocate();
+  void deallocate(void* block);
+
+ private:
+  static constexpr size_t blocks_per_slab = 256;
+
+  const size_t _block_size;
+  std::mutex _mutex;
+  // _mutex need to be aquired
+  std::vector<void*> _free_blocks;
+  std::vector<std::unique_ptr<std::byte[]>> _slabs;
+};
+
+// Allocator of single objects from a slab_pool per object size, for
+// std::allocate_shared to put an object and its reference count in one slab
+// block instead of one heap allocation each.
+template <typename T>
+class slab_allocator {
+ public:
+  using value_type = T;
+
+  slab_allocator() = default;
+  template <typename U>
+  slab_allocator(const slab_allocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if (n != 1) return std::allocator<T>().allocate(n);
+    return static_cast<T*>(pool().allocate());
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n != 1) return std::allocator<T>().deallocate(p, n);
+    pool().deallocate(p);
+  }
+
+  template <typename U>
+  bool operator==(const slab_allocator<U>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const slab_allocator<U>&) const {
+    return false;
+  }
+
+ private:
+  static slab_pool& pool() {
+    static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                  "slab blocks are only aligned as operator new");
+    // Never destroyed as objects can outlive the static destructors
+    static slab_pool* pool = new slab_pool(sizeof(T));
+    return *pool;
+  }
+};
+}  // namespace memfs
+
+#endif  // SLAB_H_
@@ -49,6 +49,9 @@ BOOL g_DebugMode;
 BOOL g_CaseSensitive;
 BOOL g_HasSeSecurityPrivilege;
 BOOL g_ImpersonateCallerUser;
+BOOL g_OverlappedIo;
+BOOL g_HandleCache;
+BOOL g_UnbufferedIo;
 
 static void DbgPrint(LPCWSTR format, ...) {
   if (g_DebugMode) {
@@ -89,6 +92,721 @@ static void GetFilePath(PWCHAR filePath, ULONG numberOfElements,
   wcsncat_s(filePath, numberOfElements, FileName, wcslen(FileName));
 }
 
+// Read or write issued on an overlapped backing handle, completed from the
+// thread pool once the backing I/O is done.
+typedef struct _MIRROR_IO_REQUEST {
+  OVERLAPPED Overlapped;
+  PDOKAN_FILE_INFO DokanFileInfo;
+  LPDWORD TransferredLength;
+} MIRROR_IO_REQUEST, *PMIRROR_IO_REQUEST;
+
+static VOID CALLBACK MirrorIoCompletion(DWORD ErrorCode,
+                                        DWORD NumberOfBytesTransferred,
+                                        LPOVERLAPPED Overlapped) {
+  PMIRROR_IO_REQUEST request =
+      CONTAINING_RECORD(Overlapped, MIRROR_IO_REQUEST, Overlapped);
+  NTSTATUS status = STATUS_SUCCESS;
+
+  if (ErrorCode != ERROR_SUCCESS) {
+    DbgPrint(L"\toverlapped io error = %u\n\n", ErrorCode);
+    status = DokanNtStatusFromWin32(ErrorCode);
+  }
+  *request->TransferredLength = NumberOfBytesTransferred;
+  DokanCompleteOperation(request->DokanFileInfo, status,
+                         NumberOfBytesTransferred);
+  free(request);
+}
+
+// Starts reading or writing Length bytes at the offset of Overlap on Handle,
+// opened for overlapped I/O and bound to MirrorIoCompletion. Returns
+// STATUS_PENDING when the operation is left to the completion, which also
+// happens when the I/O completes immediately.
+static NTSTATUS MirrorStartOverlappedIo(HANDLE Handle, BOOL Write,
+                                        LPVOID Buffer, DWORD Length,
+                                        LPDWORD TransferredLength,
+                                        LPOVERLAPPED Overlap,
+                                        PDOKAN_FILE_INFO DokanFileInfo) {
+  PMIRROR_IO_REQUEST request = malloc(sizeof(MIRROR_IO_REQUEST));
+  BOOL result;
+
+  if (!request) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  request->Overlapped = *Overlap;
+  request->DokanFileInfo = DokanFileInfo;
+  request->TransferredLength = TransferredLength;
+  if (Write) {
+    result = WriteFile(Handle, Buffer, Length, NULL, &request->Overlapped);
+  } else {
+    result = ReadFile(Handle, Buffer, Length, NULL, &request->Overlapped);
+  }
+  if (!result && GetLastError() != ERROR_IO_PENDING) {
+    DWORD error = GetLastError();
+    DbgPrint(L"\toverlapped %s error = %u, length = %d\n\n",
+             Write ? L"write" : L"read", error, Length);
+    free(request);
+    return DokanNtStatusFromWin32(error);
+  }
+  return STATUS_PENDING;
+}
+
+// Aligned paging and non cached I/O are done on handles opened with
+// FILE_FLAG_NO_BUFFERING, so that the data cached above Dokan is not cached a
+// second time by the backing file system. Other I/O keeps using the buffered
+// handle, the backing file system keeps both coherent.
+// The unbuffered handles of a backing handle are opened on first use and
+// closed with it.
+#define MIRROR_UNBUFFERED_ALIGNMENT 4096
+#define MIRROR_UNBUFFERED_BUCKET_COUNT 64
+
+typedef struct _MIRROR_UNBUFFERED_HANDLES {
+  struct _MIRROR_UNBUFFERED_HANDLES *Next;
+  HANDLE Handle;
+  // NULL until opened, INVALID_HANDLE_VALUE if it could not be
+  HANDLE Read;
+  HANDLE Write;
+} MIRROR_UNBUFFERED_HANDLES, *PMIRROR_UNBUFFERED_HANDLES;
+
+static SRWLOCK g_UnbufferedHandlesLock = SRWLOCK_INIT;
+// g_UnbufferedHandlesLock need to be aquired
+static PMIRROR_UNBUFFERED_HANDLES
+    g_UnbufferedHandles[MIRROR_UNBUFFERED_BUCKET_COUNT];
+
+static PMIRROR_UNBUFFERED_HANDLES *MirrorUnbufferedBucket(HANDLE Handle) {
+  return &g_UnbufferedHandles[((ULONG_PTR)Handle >> 2) %
+                              MIRROR_UNBUFFERED_BUCKET_COUNT];
+}
+
+// Whether the I/O meets the alignment FILE_FLAG_NO_BUFFERING requires and
+// comes from the cache above Dokan, or bypasses it.
+static BOOL MirrorIsUnbufferedIo(LPCVOID Buffer, DWORD Length, LONGLONG Offset,
+                                 PDOKAN_FILE_INFO DokanFileInfo) {
+  return g_UnbufferedIo &&
+         (DokanFileInfo->PagingIo || DokanFileInfo->Nocache) && Length &&
+         !DokanFileInfo->WriteToEndOfFile &&
+         (ULONG_PTR)Buffer % MIRROR_UNBUFFERED_ALIGNMENT == 0 &&
+         Length % MIRROR_UNBUFFERED_ALIGNMENT == 0 &&
+         Offset % MIRROR_UNBUFFERED_ALIGNMENT == 0;
+}
+
+// Returns the unbuffered handle to read or Write the file of Handle, or
+// INVALID_HANDLE_VALUE if it cannot be opened with the share modes in place.
+// It is overlapped and bound to MirrorIoCompletion when Overlapped is set.
+static HANDLE MirrorGetUnbufferedHandle(HANDLE Handle, BOOL Write,
+                                        BOOL Overlapped) {
+  PMIRROR_UNBUFFERED_HANDLES *bucket = MirrorUnbufferedBucket(Handle);
+  PMIRROR_UNBUFFERED_HANDLES handles;
+  HANDLE unbuffered = NULL;
+
+  AcquireSRWLockShared(&g_UnbufferedHandlesLock);
+  for (handles = *bucket; handles; handles = handles->Next) {
+    if (handles->Handle == Handle) {
+      unbuffered = Write ? handles->Write : handles->Read;
+      break;
+    }
+  }
+  ReleaseSRWLockShared(&g_UnbufferedHandlesLock);
+  if (unbuffered)
+    return unbuffered;
+
+  unbuffered = ReOpenFile(
+      Handle, Write ? GENERIC_WRITE : GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      FILE_FLAG_NO_BUFFERING | (Overlapped ? FILE_FLAG_OVERLAPPED : 0));
+  if (unbuffered == INVALID_HANDLE_VALUE) {
+    DbgPrint(L"\tReOpenFile unbuffered error = %u\n", GetLastError());
+  } else if (Overlapped &&
+             !BindIoCompletionCallback(unbuffered, MirrorIoCompletion, 0)) {
+    CloseHandle(unbuffered);
+    unbuffered = INVALID_HANDLE_VALUE;
+  }
+
+  AcquireSRWLockExclusive(&g_UnbufferedHandlesLock);
+  for (handles = *bucket; handles; handles = handles->Next) {
+    if (handles->Handle == Handle)
+      break;
+  }
+  if (!handles) {
+    handles = calloc(1, sizeof(MIRROR_UNBUFFERED_HANDLES));
+    if (handles) {
+      handles->Handle = Handle;
+      handles->Next = *bucket;
+      *bucket = handles;
+    }
+  }
+  if (handles && !(Write ? handles->Write : handles->Read)) {
+    if (Write)
+      handles->Write = unbuffered;
+    else
+      handles->Read = unbuffered;
+  } else {
+    // Opened by another request meanwhile, or out of memory
+    if (unbuffered != INVALID_HANDLE_VALUE)
+      CloseHandle(unbuffered);
+    unbuffered = handles ? (Write ? handles->Write : handles->Read)
+                         : INVALID_HANDLE_VALUE;
+  }
+  ReleaseSRWLockExclusive(&g_UnbufferedHandlesLock);
+  return unbuffered;
+}
+
+// Closes the unbuffered handles of Handle, which is being closed.
+static void MirrorCloseUnbufferedHandles(HANDLE Handle) {
+  PMIRROR_UNBUFFERED_HANDLES *link;
+  PMIRROR_UNBUFFERED_HANDLES handles = NULL;
+
+  if (!g_UnbufferedIo)
+    return;
+  AcquireSRWLockExclusive(&g_UnbufferedHandlesLock);
+  for (link = MirrorUnbufferedBucket(Handle); *link; link = &(*link)->Next) {
+    if ((*link)->Handle == Handle) {
+      handles = *link;
+      *link = handles->Next;
+      break;
+    }
+  }
+  ReleaseSRWLockExclusive(&g_UnbufferedHandlesLock);
+  if (handles) {
+    if (handles->Read && handles->Read != INVALID_HANDLE_VALUE)
+      CloseHandle(handles->Read);
+    if (handles->Write && handles->Write != INVALID_HANDLE_VALUE)
+      CloseHandle(handles->Write);
+    free(handles);
+  }
+}
+
+// Backing handles are kept open for MIRROR_HANDLE_CACHE_DELAY ms after their
+// last use, so that a file reopened with the same access, share mode and flags
+// meanwhile reuses it instead of opening the backing file again.
+#define MIRROR_HANDLE_CACHE_SIZE 256
+#define MIRROR_HANDLE_CACHE_DELAY 1000
+
+typedef struct _MIRROR_CACHED_HANDLE {
+  PWCHAR FilePath;
+  DWORD DesiredAccess;
+  DWORD ShareMode;
+  DWORD FlagsAndAttributes;
+  HANDLE Handle;
+  BOOL Parked;
+  ULONGLONG ParkedTime;
+} MIRROR_CACHED_HANDLE, *PMIRROR_CACHED_HANDLE;
+
+static CRITICAL_SECTION g_HandleCacheLock;
+// g_HandleCacheLock need to be aquired
+// Handles opened by the mirror, in use or parked. FilePath is NULL for a free
+// entry.
+static MIRROR_CACHED_HANDLE g_HandleCacheEntries[MIRROR_HANDLE_CACHE_SIZE];
+static PTP_TIMER g_HandleCacheTimer;
+
+// Whether EntryPath is FilePath, or a file or stream under it when Subtree is
+// set.
+static BOOL MirrorIsPathUnder(LPCWSTR EntryPath, LPCWSTR FilePath,
+                              BOOL Subtree) {
+  size_t length = wcslen(FilePath);
+  int diff = g_CaseSensitive ? wcsncmp(EntryPath, FilePath, length)
+                             : _wcsnicmp(EntryPath, FilePath, length);
+  if (diff != 0)
+    return FALSE;
+  return EntryPath[length] == L'\0' ||
+         (Subtree &&
+          (EntryPath[length] == L'\\' || EntryPath[length] == L':'));
+}
+
+static void MirrorFreeCachedHandle(PMIRROR_CACHED_HANDLE Entry, BOOL Close) {
+  if (Close) {
+    MirrorCloseUnbufferedHandles(Entry->Handle);
+    CloseHandle(Entry->Handle);
+  }
+  free(Entry->FilePath);
+  ZeroMemory(Entry, sizeof(MIRROR_CACHED_HANDLE));
+}
+
+// Returns a parked handle of FilePath opened with the same arguments, now in
+// use, or INVALID_HANDLE_VALUE.
+static HANDLE MirrorTakeCachedHandle(LPCWSTR FilePath, DWORD DesiredAccess,
+                                     DWORD ShareMode,
+                                     DWORD FlagsAndAttributes) {
+  HANDLE handle = INVALID_HANDLE_VALUE;
+  ULONG i;
+
+  if (!g_HandleCache)
+    return INVALID_HANDLE_VALUE;
+  EnterCriticalSection(&g_HandleCacheLock);
+  for (i = 0; i < MIRROR_HANDLE_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_HANDLE entry = &g_HandleCacheEntries[i];
+    if (entry->FilePath && entry->Parked &&
+        entry->DesiredAccess == DesiredAccess &&
+        entry->ShareMode == ShareMode &&
+        entry->FlagsAndAttributes == FlagsAndAttributes &&
+        MirrorIsPathUnder(entry->FilePath, FilePath, FALSE)) {
+      entry->Parked = FALSE;
+      handle = entry->Handle;
+      break;
+    }
+  }
+  LeaveCriticalSection(&g_HandleCacheLock);
+  return handle;
+}
+
+// Keeps track of Handle so that it is parked instead of closed by
+// MirrorCloseHandle. Nothing is done when the cache is full.
+static void MirrorRegisterHandle(LPCWSTR FilePath, DWORD DesiredAccess,
+                                 DWORD ShareMode, DWORD FlagsAndAttributes,
+                                 HANDLE Handle) {
+  DWORD lastError = GetLastError();
+  ULONG i;
+
+  if (!g_HandleCache || (FlagsAndAttributes & FILE_FLAG_DELETE_ON_CLOSE))
+    return;
+  EnterCriticalSection(&g_HandleCacheLock);
+  for (i = 0; i < MIRROR_HANDLE_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_HANDLE entry = &g_HandleCacheEntries[i];
+    if (!entry->FilePath) {
+      entry->FilePath = _wcsdup(FilePath);
+      entry->DesiredAccess = DesiredAccess;
+      entry->ShareMode = ShareMode;
+      entry->FlagsAndAttributes = FlagsAndAttributes;
+      entry->Handle = Handle;
+      entry->Parked = FALSE;
+      break;
+    }
+  }
+  LeaveCriticalSection(&g_HandleCacheLock);
+  SetLastError(lastError);
+}
+
+// Closes Handle, or parks it when Park is set and it is registered.
+static void MirrorCloseHandle(HANDLE Handle, BOOL Park) {
+  ULONG i;
+
+  if (g_HandleCache) {
+    EnterCriticalSection(&g_HandleCacheLock);
+    for (i = 0; i < MIRROR_HANDLE_CACHE_SIZE; ++i) {
+      PMIRROR_CACHED_HANDLE entry = &g_HandleCacheEntries[i];
+      if (entry->FilePath && entry->Handle == Handle && !entry->Parked) {
+        if (!Park) {
+          MirrorFreeCachedHandle(entry, FALSE);
+          break;
+        }
+        entry->Parked = TRUE;
+        entry->ParkedTime = GetTickCount64();
+        LeaveCriticalSection(&g_HandleCacheLock);
+        return;
+      }
+    }
+    LeaveCriticalSection(&g_HandleCacheLock);
+  }
+  MirrorCloseUnbufferedHandles(Handle);
+  CloseHandle(Handle);
+}
+
+// Closes the parked handles of FilePath, and of the files and streams under it
+// when Subtree is set. The handles in use are forgotten so that they get
+// closed instead of parked under a path they may no longer have. Returns
+// whether a parked handle was closed.
+static BOOL MirrorFlushCachedHandles(LPCWSTR FilePath, BOOL Subtree) {
+  BOOL closed = FALSE;
+  ULONG i;
+
+  if (!g_HandleCache)
+    return FALSE;
+  EnterCriticalSection(&g_HandleCacheLock);
+  for (i = 0; i < MIRROR_HANDLE_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_HANDLE entry = &g_HandleCacheEntries[i];
+    if (entry->FilePath &&
+        MirrorIsPathUnder(entry->FilePath, FilePath, Subtree)) {
+      closed |= entry->Parked;
+      MirrorFreeCachedHandle(entry, entry->Parked);
+    }
+  }
+  LeaveCriticalSection(&g_HandleCacheLock);
+  return closed;
+}
+
+static VOID CALLBACK MirrorHandleCacheTimer(PTP_CALLBACK_INSTANCE Instance,
+                                            PVOID Context, PTP_TIMER Timer) {
+  ULONGLONG now = GetTickCount64();
+  ULONG i;
+  UNREFERENCED_PARAMETER(Instance);
+  UNREFERENCED_PARAMETER(Context);
+  UNREFERENCED_PARAMETER(Timer);
+
+  EnterCriticalSection(&g_HandleCacheLock);
+  for (i = 0; i < MIRROR_HANDLE_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_HANDLE entry = &g_HandleCacheEntries[i];
+    if (entry->FilePath && entry->Parked &&
+        now - entry->ParkedTime >= MIRROR_HANDLE_CACHE_DELAY) {
+      MirrorFreeCachedHandle(entry, TRUE);
+    }
+  }
+  LeaveCriticalSection(&g_HandleCacheLock);
+}
+
+static BOOL MirrorStartHandleCache() {
+  FILETIME dueTime;
+  ULARGE_INTEGER due;
+
+  InitializeCriticalSection(&g_HandleCacheLock);
+  g_HandleCacheTimer =
+      CreateThreadpoolTimer(MirrorHandleCacheTimer, NULL, NULL);
+  if (!g_HandleCacheTimer) {
+    DeleteCriticalSection(&g_HandleCacheLock);
+    return FALSE;
+  }
+  // Relative due time, in 100ns units
+  due.QuadPart = (ULONGLONG)(-(LONGLONG)MIRROR_HANDLE_CACHE_DELAY * 10000);
+  dueTime.dwLowDateTime = due.LowPart;
+  dueTime.dwHighDateTime = due.HighPart;
+  SetThreadpoolTimer(g_HandleCacheTimer, &dueTime,
+                     MIRROR_HANDLE_CACHE_DELAY / 2, 0);
+  return TRUE;
+}
+
+static void MirrorStopHandleCache() {
+  ULONG i;
+
+  SetThreadpoolTimer(g_HandleCacheTimer, NULL, 0, 0);
+  WaitForThreadpoolTimerCallbacks(g_HandleCacheTimer, TRUE);
+  CloseThreadpoolTimer(g_HandleCacheTimer);
+  for (i = 0; i < MIRROR_HANDLE_CACHE_SIZE; ++i) {
+    if (g_HandleCacheEntries[i].FilePath)
+      MirrorFreeCachedHandle(&g_HandleCacheEntries[i],
+                             g_HandleCacheEntries[i].Parked);
+  }
+  DeleteCriticalSection(&g_HandleCacheLock);
+}
+
+// CreateFile going through the handle cache. A parked handle is reused for
+// OPEN_EXISTING, setting Reused, and the parked handles of FilePath are closed
+// and the open retried when they cause a sharing violation.
+static HANDLE MirrorCreateCachedFile(LPCWSTR FilePath, DWORD DesiredAccess,
+                                     DWORD ShareMode,
+                                     LPSECURITY_ATTRIBUTES SecurityAttributes,
+                                     DWORD CreationDisposition,
+                                     DWORD FlagsAndAttributes, PBOOL Reused) {
+  HANDLE handle = INVALID_HANDLE_VALUE;
+
+  if (Reused)
+    *Reused = FALSE;
+  if (CreationDisposition == OPEN_EXISTING) {
+    handle = MirrorTakeCachedHandle(FilePath, DesiredAccess, ShareMode,
+                                    FlagsAndAttributes);
+    if (handle != INVALID_HANDLE_VALUE) {
+      if (Reused)
+        *Reused = TRUE;
+      return handle;
+    }
+  }
+  handle = CreateFile(FilePath, DesiredAccess, ShareMode, SecurityAttributes,
+                      CreationDisposition, FlagsAndAttributes, NULL);
+  if (handle == INVALID_HANDLE_VALUE &&
+      GetLastError() == ERROR_SHARING_VIOLATION &&
+      MirrorFlushCachedHandles(FilePath, FALSE)) {
+    handle = CreateFile(FilePath, DesiredAccess, ShareMode, SecurityAttributes,
+                        CreationDisposition, FlagsAndAttributes, NULL);
+  }
+  if (handle != INVALID_HANDLE_VALUE) {
+    MirrorRegisterHandle(FilePath, DesiredAccess, ShareMode,
+                         FlagsAndAttributes, handle);
+  }
+  return handle;
+}
+
+// Security descriptors returned by MirrorGetFileSecurity are kept for
+// MIRROR_SECURITY_CACHE_DELAY ms by path and SECURITY_INFORMATION, which
+// serves the query made to get the descriptor size and the one that follows.
+// The entries of a file are dropped when the mirror changes its descriptor,
+// moves or deletes it. Changes made directly on the backing files show up once
+// the entries are too old.
+#define MIRROR_SECURITY_CACHE_SIZE 64
+#define MIRROR_SECURITY_CACHE_DELAY 1000
+
+typedef struct _MIRROR_CACHED_SECURITY {
+  // NULL for a free entry
+  PWCHAR FilePath;
+  SECURITY_INFORMATION SecurityInformation;
+  PSECURITY_DESCRIPTOR SecurityDescriptor;
+  DWORD Length;
+  ULONGLONG Time;
+} MIRROR_CACHED_SECURITY, *PMIRROR_CACHED_SECURITY;
+
+static SRWLOCK g_SecurityCacheLock = SRWLOCK_INIT;
+// g_SecurityCacheLock need to be aquired
+// Indexed by MirrorSecurityCacheSlot, an entry replaces the one of its slot.
+static MIRROR_CACHED_SECURITY
+    g_SecurityCacheEntries[MIRROR_SECURITY_CACHE_SIZE];
+
+static PMIRROR_CACHED_SECURITY
+MirrorSecurityCacheSlot(LPCWSTR FilePath,
+                        SECURITY_INFORMATION SecurityInformation) {
+  ULONG hash = 2166136261 ^ SecurityInformation;
+  for (; *FilePath; ++FilePath) {
+    hash ^= g_CaseSensitive ? *FilePath : towlower(*FilePath);
+    hash *= 16777619;
+  }
+  return &g_SecurityCacheEntries[hash % MIRROR_SECURITY_CACHE_SIZE];
+}
+
+static void MirrorFreeCachedSecurity(PMIRROR_CACHED_SECURITY Entry) {
+  free(Entry->FilePath);
+  free(Entry->SecurityDescriptor);
+  memset(Entry, 0, sizeof(MIRROR_CACHED_SECURITY));
+}
+
+// Copies the cached descriptor of FilePath to SecurityDescriptor when it fits
+// in BufferLength. Returns STATUS_BUFFER_OVERFLOW when it does not and
+// STATUS_NOT_FOUND when there is no recent one.
+static NTSTATUS
+MirrorGetCachedSecurity(LPCWSTR FilePath,
+                        SECURITY_INFORMATION SecurityInformation,
+                        PSECURITY_DESCRIPTOR SecurityDescriptor,
+                        ULONG BufferLength, PULONG LengthNeeded) {
+  PMIRROR_CACHED_SECURITY entry =
+      MirrorSecurityCacheSlot(FilePath, SecurityInformation);
+  NTSTATUS status = STATUS_NOT_FOUND;
+
+  AcquireSRWLockShared(&g_SecurityCacheLock);
+  if (entry->FilePath &&
+      entry->SecurityInformation == SecurityInformation &&
+      GetTickCount64() - entry->Time < MIRROR_SECURITY_CACHE_DELAY &&
+      MirrorIsPathUnder(entry->FilePath, FilePath, FALSE)) {
+    *LengthNeeded = entry->Length;
+    if (BufferLength < entry->Length) {
+      status = STATUS_BUFFER_OVERFLOW;
+    } else {
+      memcpy(SecurityDescriptor, entry->SecurityDescriptor, entry->Length);
+      status = STATUS_SUCCESS;
+    }
+  }
+  ReleaseSRWLockShared(&g_SecurityCacheLock);
+  return status;
+}
+
+static void MirrorCacheSecurity(LPCWSTR FilePath,
+                                SECURITY_INFORMATION SecurityInformation,
+                                PSECURITY_DESCRIPTOR SecurityDescriptor,
+                                DWORD Length) {
+  PMIRROR_CACHED_SECURITY entry =
+      MirrorSecurityCacheSlot(FilePath, SecurityInformation);
+  PWCHAR filePath = _wcsdup(FilePath);
+  PSECURITY_DESCRIPTOR securityDescriptor = malloc(Length);
+
+  if (!filePath || !securityDescriptor) {
+    free(filePath);
+    free(securityDescriptor);
+    return;
+  }
+  memcpy(securityDescriptor, SecurityDescriptor, Length);
+  AcquireSRWLockExclusive(&g_SecurityCacheLock);
+  MirrorFreeCachedSecurity(entry);
+  entry->FilePath = filePath;
+  entry->SecurityInformation = SecurityInformation;
+  entry->SecurityDescriptor = securityDescriptor;
+  entry->Length = Length;
+  entry->Time = GetTickCount64();
+  ReleaseSRWLockExclusive(&g_SecurityCacheLock);
+}
+
+// Drops the cached descriptors of FilePath, and of the files and streams under
+// it when Subtree is set.
+static void MirrorForgetCachedSecurity(LPCWSTR FilePath, BOOL Subtree) {
+  ULONG i;
+
+  AcquireSRWLockExclusive(&g_SecurityCacheLock);
+  for (i = 0; i < MIRROR_SECURITY_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_SECURITY entry = &g_SecurityCacheEntries[i];
+    if (entry->FilePath &&
+        MirrorIsPathUnder(entry->FilePath, FilePath, Subtree))
+      MirrorFreeCachedSecurity(entry);
+  }
+  ReleaseSRWLockExclusive(&g_SecurityCacheLock);
+}
+
+// Enumeration state of a directory handle used by MirrorFindFilesWithCursor.
+// NtQueryDirectoryFile only moves forward, so the entries read from the handle
+// and not consumed yet are kept to be given first by the next request.
+#define MIRROR_DIRECTORY_SCAN_BUFFER_SIZE (64 * 1024)
+
+typedef struct _MIRROR_DIRECTORY_SCAN {
+  struct _MIRROR_DIRECTORY_SCAN *Next;
+  HANDLE Handle;
+  CRITICAL_SECTION Lock;
+  // Lock need to be aquired
+  BOOL Started;
+  BOOL Ended;
+  // Position in the listing of the entry at Offset
+  ULONG Index;
+  ULONG Offset;
+  ULONG Length;
+  PUCHAR Buffer;
+} MIRROR_DIRECTORY_SCAN, *PMIRROR_DIRECTORY_SCAN;
+
+static SRWLOCK g_DirectoryScansLock = SRWLOCK_INIT;
+// g_DirectoryScansLock need to be aquired
+static PMIRROR_DIRECTORY_SCAN g_DirectoryScans;
+
+// Returns the scan of Handle, created if needed, or NULL if out of memory.
+static PMIRROR_DIRECTORY_SCAN MirrorGetDirectoryScan(HANDLE Handle) {
+  PMIRROR_DIRECTORY_SCAN scan;
+
+  AcquireSRWLockExclusive(&g_DirectoryScansLock);
+  for (scan = g_DirectoryScans; scan; scan = scan->Next) {
+    if (scan->Handle == Handle)
+      break;
+  }
+  if (!scan) {
+    scan = calloc(1, sizeof(MIRROR_DIRECTORY_SCAN));
+    if (scan) {
+      scan->Buffer = malloc(MIRROR_DIRECTORY_SCAN_BUFFER_SIZE);
+      if (!scan->Buffer) {
+        free(scan);
+        scan = NULL;
+      }
+    }
+    if (scan) {
+      scan->Handle = Handle;
+      InitializeCriticalSection(&scan->Lock);
+      scan->Next = g_DirectoryScans;
+      g_DirectoryScans = scan;
+    }
+  }
+  ReleaseSRWLockExclusive(&g_DirectoryScansLock);
+  return scan;
+}
+
+// Releases the scan of Handle, if any. The handle must not be used anymore.
+static void MirrorFreeDirectoryScan(HANDLE Handle) {
+  PMIRROR_DIRECTORY_SCAN *link;
+  PMIRROR_DIRECTORY_SCAN scan = NULL;
+
+  AcquireSRWLockExclusive(&g_DirectoryScansLock);
+  for (link = &g_DirectoryScans; *link; link = &(*link)->Next) {
+    if ((*link)->Handle == Handle) {
+      scan = *link;
+      *link = scan->Next;
+      break;
+    }
+  }
+  ReleaseSRWLockExclusive(&g_DirectoryScansLock);
+  if (scan) {
+    DeleteCriticalSection(&scan->Lock);
+    free(scan->Buffer);
+    free(scan);
+  }
+}
+
+// Requestor tokens opened for caller impersonation, kept for the next creates
+// of the same token, identified by the ids the driver gives with each create,
+// instead of asking the driver for the token again. Entries unused for
+// MIRROR_TOKEN_CACHE_TIMEOUT ms are closed when room is needed.
+#define MIRROR_TOKEN_CACHE_SIZE 64
+#define MIRROR_TOKEN_CACHE_TIMEOUT (60 * 1000)
+
+typedef struct _MIRROR_CACHED_TOKEN {
+  LUID AuthenticationId;
+  LUID TokenId;
+  HANDLE Token;
+  // Number of creates impersonating with Token
+  LONG RefCount;
+  ULONGLONG LastUseTime;
+} MIRROR_CACHED_TOKEN, *PMIRROR_CACHED_TOKEN;
+
+static SRWLOCK g_TokenCacheLock = SRWLOCK_INIT;
+// g_TokenCacheLock need to be aquired
+// Token is NULL for a free entry.
+static MIRROR_CACHED_TOKEN g_TokenCacheEntries[MIRROR_TOKEN_CACHE_SIZE];
+
+static BOOL MirrorIsSameLuid(PLUID Left, PLUID Right) {
+  return Left->LowPart == Right->LowPart && Left->HighPart == Right->HighPart;
+}
+
+// Returns the cached token with the given ids, referenced, or NULL.
+// g_TokenCacheLock need to be aquired exclusively
+static HANDLE MirrorReferenceCachedToken(PLUID AuthenticationId,
+                                         PLUID TokenId) {
+  ULONG i;
+  for (i = 0; i < MIRROR_TOKEN_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_TOKEN entry = &g_TokenCacheEntries[i];
+    if (entry->Token && MirrorIsSameLuid(&entry->TokenId, TokenId) &&
+        MirrorIsSameLuid(&entry->AuthenticationId, AuthenticationId)) {
+      ++entry->RefCount;
+      entry->LastUseTime = GetTickCount64();
+      return entry->Token;
+    }
+  }
+  return NULL;
+}
+
+// Replaces DokanOpenRequestorToken. The token has to be released with
+// MirrorReleaseRequestorToken.
+static HANDLE MirrorOpenRequestorToken(PDOKAN_FILE_INFO DokanFileInfo) {
+  LUID authenticationId;
+  LUID tokenId;
+  HANDLE token;
+  HANDLE cachedToken;
+  PMIRROR_CACHED_TOKEN freeEntry = NULL;
+  ULONGLONG now;
+  ULONG i;
+
+  if (!DokanGetRequestorTokenIds(DokanFileInfo, &authenticationId, &tokenId))
+    return DokanOpenRequestorToken(DokanFileInfo);
+
+  AcquireSRWLockExclusive(&g_TokenCacheLock);
+  token = MirrorReferenceCachedToken(&authenticationId, &tokenId);
+  ReleaseSRWLockExclusive(&g_TokenCacheLock);
+  if (token)
+    return token;
+
+  token = DokanOpenRequestorToken(DokanFileInfo);
+  if (token == INVALID_HANDLE_VALUE)
+    return token;
+
+  AcquireSRWLockExclusive(&g_TokenCacheLock);
+  // Opened by another create meanwhile
+  cachedToken = MirrorReferenceCachedToken(&authenticationId, &tokenId);
+  if (cachedToken) {
+    ReleaseSRWLockExclusive(&g_TokenCacheLock);
+    CloseHandle(token);
+    return cachedToken;
+  }
+  now = GetTickCount64();
+  for (i = 0; i < MIRROR_TOKEN_CACHE_SIZE; ++i) {
+    PMIRROR_CACHED_TOKEN entry = &g_TokenCacheEntries[i];
+    if (entry->Token && entry->RefCount == 0 &&
+        now - entry->LastUseTime >= MIRROR_TOKEN_CACHE_TIMEOUT) {
+      CloseHandle(entry->Token);
+      ZeroMemory(entry, sizeof(MIRROR_CACHED_TOKEN));
+    }
+    if (!entry->Token && !freeEntry)
+      freeEntry = entry;
+  }
+  // Otherwise the token is just not cached
+  if (freeEntry) {
+    freeEntry->AuthenticationId = authenticationId;
+    freeEntry->TokenId = tokenId;
+    freeEntry->Token = token;
+    freeEntry->RefCount = 1;
+    freeEntry->LastUseTime = now;
+  }
+  ReleaseSRWLockExclusive(&g_TokenCacheLock);
+  return token;
+}
+
+static void MirrorReleaseRequestorToken(HANDLE Token) {
+  ULONG i;
+
+  AcquireSRWLockExclusive(&g_TokenCacheLock);
+  for (i = 0; i < MIRROR_TOKEN_CACHE_SIZE; ++i) {
+    if (g_TokenCacheEntries[i].Token == Token) {
+      --g_TokenCacheEntries[i].RefCount;
+      ReleaseSRWLockExclusive(&g_TokenCacheLock);
+      return;
+    }
+  }
+  ReleaseSRWLockExclusive(&g_TokenCacheLock);
+  CloseHandle(Token);
+}
+
 static void PrintUserName(PDOKAN_FILE_INFO DokanFileInfo) {
   HANDLE handle;
   UCHAR buffer[1024];
@@ -207,6 +925,7 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
   ACCESS_MASK genericDesiredAccess;
   // userTokenHandle is for Impersonate Caller User Option
   HANDLE userTokenHandle = INVALID_HANDLE_VALUE;
+  BOOL reused = FALSE;
 
   securityAttrib.nLength = sizeof(securityAttrib);
   securityAttrib.lpSecurityDescriptor =
@@ -308,6 +1027,10 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
   if (g_CaseSensitive)
     fileAttributesAndFlags |= FILE_FLAG_POSIX_SEMANTICS;
 
+  // Reads and writes of files are completed from the backing I/O completion
+  if (g_OverlappedIo && !DokanFileInfo->IsDirectory)
+    fileAttributesAndFlags |= FILE_FLAG_OVERLAPPED;
+
   if (creationDisposition == CREATE_NEW) {
     DbgPrint(L"\tCREATE_NEW\n");
   } else if (creationDisposition == OPEN_ALWAYS) {
@@ -323,7 +1046,7 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
   }
 
   if (g_ImpersonateCallerUser) {
-    userTokenHandle = DokanOpenRequestorToken(DokanFileInfo);
+    userTokenHandle = MirrorOpenRequestorToken(DokanFileInfo);
 
     if (userTokenHandle == INVALID_HANDLE_VALUE) {
       DbgPrint(L"  DokanOpenRequestorToken failed\n");
@@ -360,7 +1083,7 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
         // Clean Up operation for impersonate
         DWORD lastError = GetLastError();
         if (status != STATUS_SUCCESS) //Keep the handle open for CreateFile
-          CloseHandle(userTokenHandle);
+          MirrorReleaseRequestorToken(userTokenHandle);
         RevertToSelf();
         SetLastError(lastError);
       }
@@ -372,6 +1095,8 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
       if (fileAttr != INVALID_FILE_ATTRIBUTES &&
           !(fileAttr & FILE_ATTRIBUTE_DIRECTORY) &&
           (CreateOptions & FILE_DIRECTORY_FILE)) {
+        if (userTokenHandle != INVALID_HANDLE_VALUE)
+          MirrorReleaseRequestorToken(userTokenHandle);
         return STATUS_NOT_A_DIRECTORY;
       }
 
@@ -392,7 +1117,7 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
       if (g_ImpersonateCallerUser && userTokenHandle != INVALID_HANDLE_VALUE) {
         // Clean Up operation for impersonate
         DWORD lastError = GetLastError();
-        CloseHandle(userTokenHandle);
+        MirrorReleaseRequestorToken(userTokenHandle);
         RevertToSelf();
         SetLastError(lastError);
       }
@@ -423,15 +1148,21 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
          (!(fileAttributesAndFlags & FILE_ATTRIBUTE_SYSTEM) &&
           (fileAttr & FILE_ATTRIBUTE_SYSTEM))) &&
         (creationDisposition == TRUNCATE_EXISTING ||
-         creationDisposition == CREATE_ALWAYS))
+         creationDisposition == CREATE_ALWAYS)) {
+      if (userTokenHandle != INVALID_HANDLE_VALUE)
+        MirrorReleaseRequestorToken(userTokenHandle);
       return STATUS_ACCESS_DENIED;
+    }
 
     // Cannot delete a read only file
     if ((fileAttr != INVALID_FILE_ATTRIBUTES &&
          (fileAttr & FILE_ATTRIBUTE_READONLY) ||
          (fileAttributesAndFlags & FILE_ATTRIBUTE_READONLY)) &&
-        (fileAttributesAndFlags & FILE_FLAG_DELETE_ON_CLOSE))
+        (fileAttributesAndFlags & FILE_FLAG_DELETE_ON_CLOSE)) {
+      if (userTokenHandle != INVALID_HANDLE_VALUE)
+        MirrorReleaseRequestorToken(userTokenHandle);
       return STATUS_CANNOT_DELETE;
+    }
 
     // Truncate should always be used with write access
     if (creationDisposition == TRUNCATE_EXISTING)
@@ -445,14 +1176,14 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
       }
     }
 
-    handle =
-        CreateFile(filePath, genericDesiredAccess, ShareAccess, &securityAttrib,
-                   creationDisposition, fileAttributesAndFlags, NULL); 
+    handle = MirrorCreateCachedFile(filePath, genericDesiredAccess, ShareAccess,
+                                    &securityAttrib, creationDisposition,
+                                    fileAttributesAndFlags, &reused);
 
     if (g_ImpersonateCallerUser && userTokenHandle != INVALID_HANDLE_VALUE) {
       // Clean Up operation for impersonate
       DWORD lastError = GetLastError();
-      CloseHandle(userTokenHandle);
+      MirrorReleaseRequestorToken(userTokenHandle);
       RevertToSelf();
       SetLastError(lastError);
     }
@@ -483,6 +1214,15 @@ MirrorCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
           status = STATUS_OBJECT_NAME_COLLISION;
         }
       }
+
+      if (g_OverlappedIo && !reused &&
+          !BindIoCompletionCallback(handle, MirrorIoCompletion, 0)) {
+        error = GetLastError();
+        DbgPrint(L"\tBindIoCompletionCallback error code = %d\n\n", error);
+        MirrorCloseHandle(handle, FALSE);
+        DokanFileInfo->Context = 0;
+        return DokanNtStatusFromWin32(error);
+      }
     }
   }
 
@@ -501,7 +1241,9 @@ static void DOKAN_CALLBACK MirrorCloseFile(LPCWSTR FileName,
   if (DokanFileInfo->Context) {
     DbgPrint(L"CloseFile: %s\n", filePath);
     DbgPrint(L"\terror : not cleanuped file\n\n");
-    CloseHandle((HANDLE)DokanFileInfo->Context);
+    if (DokanFileInfo->IsDirectory)
+      MirrorFreeDirectoryScan((HANDLE)DokanFileInfo->Context);
+    MirrorCloseHandle((HANDLE)DokanFileInfo->Context, FALSE);
     DokanFileInfo->Context = 0;
   } else {
     DbgPrint(L"Close: %s\n\n", filePath);
@@ -515,7 +1257,10 @@ static void DOKAN_CALLBACK MirrorCleanup(LPCWSTR FileName,
 
   if (DokanFileInfo->Context) {
     DbgPrint(L"Cleanup: %s\n\n", filePath);
-    CloseHandle((HANDLE)(DokanFileInfo->Context));
+    if (DokanFileInfo->IsDirectory)
+      MirrorFreeDirectoryScan((HANDLE)DokanFileInfo->Context);
+    MirrorCloseHandle((HANDLE)(DokanFileInfo->Context),
+                      !DokanFileInfo->DeleteOnClose);
     DokanFileInfo->Context = 0;
   } else {
     DbgPrint(L"Cleanup: %s\n\tinvalid handle\n\n", filePath);
@@ -525,6 +1270,9 @@ static void DOKAN_CALLBACK MirrorCleanup(LPCWSTR FileName,
     // Should already be deleted by CloseHandle
     // if open with FILE_FLAG_DELETE_ON_CLOSE
     DbgPrint(L"\tDeleteOnClose\n");
+    // Parked handles would keep the file from being deleted
+    MirrorFlushCachedHandles(filePath, DokanFileInfo->IsDirectory);
+    MirrorForgetCachedSecurity(filePath, DokanFileInfo->IsDirectory);
     if (DokanFileInfo->IsDirectory) {
       DbgPrint(L"  DeleteDirectory ");
       if (!RemoveDirectory(filePath)) {
@@ -550,6 +1298,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorReadFile(LPCWSTR FileName, LPVOID Buffer,
                                               PDOKAN_FILE_INFO DokanFileInfo) {
   WCHAR filePath[DOKAN_MAX_PATH];
   HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  HANDLE ioHandle;
   ULONG offset = (ULONG)Offset;
   BOOL opened = FALSE;
 
@@ -559,8 +1308,8 @@ static NTSTATUS DOKAN_CALLBACK MirrorReadFile(LPCWSTR FileName, LPVOID Buffer,
 
   if (!handle || handle == INVALID_HANDLE_VALUE) {
     DbgPrint(L"\tinvalid handle, cleanuped?\n");
-    handle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL,
-                        OPEN_EXISTING, 0, NULL);
+    handle = MirrorCreateCachedFile(filePath, GENERIC_READ, FILE_SHARE_READ,
+                                    NULL, OPEN_EXISTING, 0, NULL);
     if (handle == INVALID_HANDLE_VALUE) {
       DWORD error = GetLastError();
       DbgPrint(L"\tCreateFile error : %d\n\n", error);
@@ -569,16 +1318,27 @@ static NTSTATUS DOKAN_CALLBACK MirrorReadFile(LPCWSTR FileName, LPVOID Buffer,
     opened = TRUE;
   }
 
+  ioHandle = handle;
   OVERLAPPED overlap;
   memset(&overlap, 0, sizeof(OVERLAPPED));
   overlap.Offset = Offset & 0xFFFFFFFF;
   overlap.OffsetHigh = (Offset >> 32) & 0xFFFFFFFF;
-  if (!ReadFile(handle, Buffer, BufferLength, ReadLength, &overlap)) {
+  if (MirrorIsUnbufferedIo(Buffer, BufferLength, Offset, DokanFileInfo)) {
+    HANDLE unbuffered =
+        MirrorGetUnbufferedHandle(handle, FALSE, g_OverlappedIo && !opened);
+    if (unbuffered != INVALID_HANDLE_VALUE)
+      ioHandle = unbuffered;
+  }
+  if (g_OverlappedIo && !opened) {
+    return MirrorStartOverlappedIo(ioHandle, FALSE, Buffer, BufferLength,
+                                   ReadLength, &overlap, DokanFileInfo);
+  }
+  if (!ReadFile(ioHandle, Buffer, BufferLength, ReadLength, &overlap)) {
     DWORD error = GetLastError();
     DbgPrint(L"\tread error = %u, buffer length = %d, read length = %d\n\n",
              error, BufferLength, *ReadLength);
     if (opened)
-      CloseHandle(handle);
+      MirrorCloseHandle(handle, TRUE);
     return DokanNtStatusFromWin32(error);
 
   } else {
@@ -587,7 +1347,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorReadFile(LPCWSTR FileName, LPVOID Buffer,
   }
 
   if (opened)
-    CloseHandle(handle);
+    MirrorCloseHandle(handle, TRUE);
 
   return STATUS_SUCCESS;
 }
@@ -599,6 +1359,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
                                                PDOKAN_FILE_INFO DokanFileInfo) {
   WCHAR filePath[DOKAN_MAX_PATH];
   HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  HANDLE ioHandle;
   BOOL opened = FALSE;
 
   GetFilePath(filePath, DOKAN_MAX_PATH, FileName);
@@ -609,8 +1370,8 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
   // reopen the file
   if (!handle || handle == INVALID_HANDLE_VALUE) {
     DbgPrint(L"\tinvalid handle, cleanuped?\n");
-    handle = CreateFile(filePath, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
-                        OPEN_EXISTING, 0, NULL);
+    handle = MirrorCreateCachedFile(filePath, GENERIC_WRITE, FILE_SHARE_WRITE,
+                                    NULL, OPEN_EXISTING, 0, NULL);
     if (handle == INVALID_HANDLE_VALUE) {
       DWORD error = GetLastError();
       DbgPrint(L"\tCreateFile error : %d\n\n", error);
@@ -627,7 +1388,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
     DWORD error = GetLastError();
     DbgPrint(L"\tcan not get a file size error = %d\n", error);
     if (opened)
-      CloseHandle(handle);
+      MirrorCloseHandle(handle, TRUE);
     return DokanNtStatusFromWin32(error);
   }
 
@@ -644,7 +1405,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
       if ((UINT64)Offset >= fileSize) {
         *NumberOfBytesWritten = 0;
         if (opened)
-          CloseHandle(handle);
+          MirrorCloseHandle(handle, TRUE);
         return STATUS_SUCCESS;
       }
 
@@ -669,13 +1430,28 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
     overlap.OffsetHigh = (Offset >> 32) & 0xFFFFFFFF;
   }
 
-  if (!WriteFile(handle, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten,
+  // Checked once the length is cut to the file size, as unbuffered writes
+  // cannot end in the middle of a sector
+  ioHandle = handle;
+  if (MirrorIsUnbufferedIo(Buffer, NumberOfBytesToWrite, Offset,
+                           DokanFileInfo)) {
+    HANDLE unbuffered =
+        MirrorGetUnbufferedHandle(handle, TRUE, g_OverlappedIo && !opened);
+    if (unbuffered != INVALID_HANDLE_VALUE)
+      ioHandle = unbuffered;
+  }
+  if (g_OverlappedIo && !opened) {
+    return MirrorStartOverlappedIo(ioHandle, TRUE, (LPVOID)Buffer,
+                                   NumberOfBytesToWrite, NumberOfBytesWritten,
+                                   &overlap, DokanFileInfo);
+  }
+  if (!WriteFile(ioHandle, Buffer, NumberOfBytesToWrite, NumberOfBytesWritten,
                  &overlap)) {
     DWORD error = GetLastError();
     DbgPrint(L"\twrite error = %u, buffer length = %d, write length = %d\n",
              error, NumberOfBytesToWrite, *NumberOfBytesWritten);
     if (opened)
-      CloseHandle(handle);
+      MirrorCloseHandle(handle, TRUE);
     return DokanNtStatusFromWin32(error);
 
   } else {
@@ -684,7 +1460,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorWriteFile(LPCWSTR FileName, LPCVOID Buffer,
 
   // close the file when it is reopened
   if (opened)
-    CloseHandle(handle);
+    MirrorCloseHandle(handle, TRUE);
 
   return STATUS_SUCCESS;
 }
@@ -712,6 +1488,262 @@ MirrorFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
   }
 }
 
+#define MIRROR_COPY_CHUNK_SIZE (1024 * 1024)
+
+// Prepares Overlap for a request waited for with MirrorWaitIo. The low bit set
+// on the event keeps the completion from being queued to MirrorIoCompletion
+// when the handle is bound to it.
+static LPOVERLAPPED MirrorSetWaitableOverlap(LPOVERLAPPED Overlap,
+                                             HANDLE Event, LONGLONG Offset) {
+  memset(Overlap, 0, sizeof(OVERLAPPED));
+  Overlap->Offset = Offset & 0xFFFFFFFF;
+  Overlap->OffsetHigh = (Offset >> 32) & 0xFFFFFFFF;
+  Overlap->hEvent = (HANDLE)((ULONG_PTR)Event | 1);
+  return Overlap;
+}
+
+// Waits for the request issued on Handle with Issued as result, whether the
+// handle is opened for overlapped I/O or not.
+static BOOL MirrorWaitIo(HANDLE Handle, BOOL Issued, LPOVERLAPPED Overlap,
+                         LPDWORD Transferred) {
+  if (!Issued && GetLastError() != ERROR_IO_PENDING)
+    return FALSE;
+  return GetOverlappedResult(Handle, Overlap, Transferred, TRUE);
+}
+
+static NTSTATUS DOKAN_CALLBACK
+MirrorCopyFileRange(LPCWSTR FileName, LONGLONG TargetOffset,
+                    LPCWSTR SourceFileName, LONGLONG SourceOffset,
+                    LONGLONG Length, PDOKAN_FILE_INFO DokanFileInfo) {
+  WCHAR filePath[DOKAN_MAX_PATH];
+  WCHAR sourcePath[DOKAN_MAX_PATH];
+  HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  HANDLE source;
+  HANDLE event;
+  OVERLAPPED overlap;
+  DUPLICATE_EXTENTS_DATA duplicate;
+  DWORD transferred;
+  PCHAR buffer;
+  DWORD error = ERROR_SUCCESS;
+
+  GetFilePath(filePath, DOKAN_MAX_PATH, FileName);
+  GetFilePath(sourcePath, DOKAN_MAX_PATH, SourceFileName);
+
+  DbgPrint(L"CopyFileRange : %s, offset %I64d from %s, offset %I64d, "
+           L"length %I64d\n",
+           filePath, TargetOffset, sourcePath, SourceOffset, Length);
+
+  if (!handle || handle == INVALID_HANDLE_VALUE) {
+    DbgPrint(L"\tinvalid handle\n\n");
+    return STATUS_INVALID_HANDLE;
+  }
+
+  source = CreateFile(sourcePath, GENERIC_READ,
+                      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                      NULL, OPEN_EXISTING, 0, NULL);
+  if (source == INVALID_HANDLE_VALUE) {
+    error = GetLastError();
+    DbgPrint(L"\tCreateFile error : %d\n\n", error);
+    return DokanNtStatusFromWin32(error);
+  }
+  event = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (!event) {
+    error = GetLastError();
+    CloseHandle(source);
+    return DokanNtStatusFromWin32(error);
+  }
+
+  // Block cloning when the backing file system has it, like ReFS
+  duplicate.FileHandle = source;
+  duplicate.SourceFileOffset.QuadPart = SourceOffset;
+  duplicate.TargetFileOffset.QuadPart = TargetOffset;
+  duplicate.ByteCount.QuadPart = Length;
+  if (MirrorWaitIo(handle,
+                   DeviceIoControl(handle, FSCTL_DUPLICATE_EXTENTS_TO_FILE,
+                                   &duplicate, sizeof(duplicate), NULL, 0,
+                                   NULL,
+                                   MirrorSetWaitableOverlap(&overlap, event,
+                                                            0)),
+                   &overlap, &transferred)) {
+    DbgPrint(L"\tcloned\n\n");
+    CloseHandle(event);
+    CloseHandle(source);
+    return STATUS_SUCCESS;
+  }
+  DbgPrint(L"\tclone error = %u, copying\n", GetLastError());
+
+  // Otherwise the data is copied here, which still saves its trips to the
+  // caller. Front to back, so overlapping ranges of a file cannot be copied.
+  if (_wcsicmp(filePath, sourcePath) == 0 && SourceOffset < TargetOffset &&
+      TargetOffset < SourceOffset + Length) {
+    CloseHandle(event);
+    CloseHandle(source);
+    return STATUS_INVALID_PARAMETER;
+  }
+  buffer = malloc(MIRROR_COPY_CHUNK_SIZE);
+  if (!buffer) {
+    CloseHandle(event);
+    CloseHandle(source);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  while (Length > 0) {
+    DWORD read;
+    if (!MirrorWaitIo(source,
+                      ReadFile(source, buffer,
+                               (DWORD)min(Length, MIRROR_COPY_CHUNK_SIZE),
+                               NULL,
+                               MirrorSetWaitableOverlap(&overlap, event,
+                                                        SourceOffset)),
+                      &overlap, &read)) {
+      error = GetLastError();
+      if (error == ERROR_HANDLE_EOF)
+        error = ERROR_SUCCESS;
+      break;
+    }
+    if (read == 0)
+      break;
+    if (!MirrorWaitIo(handle,
+                      WriteFile(handle, buffer, read, NULL,
+                                MirrorSetWaitableOverlap(&overlap, event,
+                                                         TargetOffset)),
+                      &overlap, &transferred)) {
+      error = GetLastError();
+      break;
+    }
+    SourceOffset += read;
+    TargetOffset += read;
+    Length -= read;
+  }
+  free(buffer);
+  CloseHandle(event);
+  CloseHandle(source);
+
+  if (error != ERROR_SUCCESS) {
+    DbgPrint(L"\tcopy error = %u\n\n", error);
+    return DokanNtStatusFromWin32(error);
+  }
+  DbgPrint(L"\tcopied\n\n");
+  return STATUS_SUCCESS;
+}
+
+// Sends a file system control request to the backing file, waiting for it
+// when the handle is opened for overlapped I/O.
+static BOOL MirrorFsControl(HANDLE Handle, DWORD FsControlCode, LPVOID In,
+                            DWORD InLength, LPVOID Out, DWORD OutLength,
+                            LPDWORD Returned) {
+  OVERLAPPED overlap;
+  HANDLE event;
+  BOOL result;
+  DWORD error;
+
+  event = CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (!event)
+    return FALSE;
+  result = MirrorWaitIo(Handle,
+                        DeviceIoControl(Handle, FsControlCode, In, InLength,
+                                        Out, OutLength, NULL,
+                                        MirrorSetWaitableOverlap(&overlap,
+                                                                 event, 0)),
+                        &overlap, Returned);
+  error = GetLastError();
+  CloseHandle(event);
+  SetLastError(error);
+  return result;
+}
+
+static NTSTATUS DOKAN_CALLBACK MirrorSetSparseFile(
+    LPCWSTR FileName, BOOL Sparse, PDOKAN_FILE_INFO DokanFileInfo) {
+  WCHAR filePath[DOKAN_MAX_PATH];
+  HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  FILE_SET_SPARSE_BUFFER sparse;
+  DWORD returned;
+
+  GetFilePath(filePath, DOKAN_MAX_PATH, FileName);
+
+  DbgPrint(L"SetSparseFile : %s, %d\n", filePath, Sparse);
+
+  if (!handle || handle == INVALID_HANDLE_VALUE) {
+    DbgPrint(L"\tinvalid handle\n\n");
+    return STATUS_INVALID_HANDLE;
+  }
+
+  sparse.SetSparse = Sparse ? TRUE : FALSE;
+  if (!MirrorFsControl(handle, FSCTL_SET_SPARSE, &sparse, sizeof(sparse),
+                       NULL, 0, &returned)) {
+    DWORD error = GetLastError();
+    DbgPrint(L"\tFSCTL_SET_SPARSE error = %u\n\n", error);
+    return DokanNtStatusFromWin32(error);
+  }
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK
+MirrorZeroFileRange(LPCWSTR FileName, LONGLONG Offset, LONGLONG Length,
+                    PDOKAN_FILE_INFO DokanFileInfo) {
+  WCHAR filePath[DOKAN_MAX_PATH];
+  HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  FILE_ZERO_DATA_INFORMATION zero;
+  DWORD returned;
+
+  GetFilePath(filePath, DOKAN_MAX_PATH, FileName);
+
+  DbgPrint(L"ZeroFileRange : %s, offset %I64d, length %I64d\n", filePath,
+           Offset, Length);
+
+  if (!handle || handle == INVALID_HANDLE_VALUE) {
+    DbgPrint(L"\tinvalid handle\n\n");
+    return STATUS_INVALID_HANDLE;
+  }
+
+  zero.FileOffset.QuadPart = Offset;
+  zero.BeyondFinalZero.QuadPart = Offset + Length;
+  if (!MirrorFsControl(handle, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL,
+                       0, &returned)) {
+    DWORD error = GetLastError();
+    DbgPrint(L"\tFSCTL_SET_ZERO_DATA error = %u\n\n", error);
+    return DokanNtStatusFromWin32(error);
+  }
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK MirrorQueryAllocatedRanges(
+    LPCWSTR FileName, LONGLONG Offset, LONGLONG Length,
+    PFILE_ALLOCATED_RANGE_BUFFER Ranges, DWORD MaxRangeCount,
+    LPDWORD RangeCount, PDOKAN_FILE_INFO DokanFileInfo) {
+  WCHAR filePath[DOKAN_MAX_PATH];
+  HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  FILE_ALLOCATED_RANGE_BUFFER query;
+  DWORD returned = 0;
+
+  GetFilePath(filePath, DOKAN_MAX_PATH, FileName);
+
+  DbgPrint(L"QueryAllocatedRanges : %s, offset %I64d, length %I64d\n",
+           filePath, Offset, Length);
+
+  if (!handle || handle == INVALID_HANDLE_VALUE) {
+    DbgPrint(L"\tinvalid handle\n\n");
+    return STATUS_INVALID_HANDLE;
+  }
+
+  query.FileOffset.QuadPart = Offset;
+  query.Length.QuadPart = Length;
+  if (!MirrorFsControl(handle, FSCTL_QUERY_ALLOCATED_RANGES, &query,
+                       sizeof(query), Ranges,
+                       MaxRangeCount * sizeof(FILE_ALLOCATED_RANGE_BUFFER),
+                       &returned)) {
+    DWORD error = GetLastError();
+    if (error == ERROR_MORE_DATA) {
+      *RangeCount = returned / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+      return STATUS_BUFFER_OVERFLOW;
+    }
+    DbgPrint(L"\tFSCTL_QUERY_ALLOCATED_RANGES error = %u\n\n", error);
+    return DokanNtStatusFromWin32(error);
+  }
+  *RangeCount = returned / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+  DbgPrint(L"\t%u ranges\n\n", *RangeCount);
+  return STATUS_SUCCESS;
+}
+
 static NTSTATUS DOKAN_CALLBACK MirrorGetFileInformation(
   LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION HandleFileInformation,
   PDOKAN_FILE_INFO DokanFileInfo) {
@@ -725,8 +1757,8 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetFileInformation(
 
   if (!handle || handle == INVALID_HANDLE_VALUE) {
     DbgPrint(L"\tinvalid handle, cleanuped?\n");
-    handle = CreateFile(filePath, GENERIC_READ, FILE_SHARE_READ, NULL,
-                        OPEN_EXISTING, 0, NULL);
+    handle = MirrorCreateCachedFile(filePath, GENERIC_READ, FILE_SHARE_READ,
+                                    NULL, OPEN_EXISTING, 0, NULL);
     if (handle == INVALID_HANDLE_VALUE) {
       DWORD error = GetLastError();
       DbgPrint(L"\tCreateFile error : %d\n\n", error);
@@ -752,7 +1784,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetFileInformation(
         DWORD error = GetLastError();
         DbgPrint(L"\tFindFirstFile error code = %d\n\n", error);
         if (opened)
-          CloseHandle(handle);
+          MirrorCloseHandle(handle, TRUE);
         return DokanNtStatusFromWin32(error);
       }
       HandleFileInformation->dwFileAttributes = find.dwFileAttributes;
@@ -772,7 +1804,7 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetFileInformation(
   DbgPrint(L"FILE ATTRIBUTE  = %d\n", HandleFileInformation->dwFileAttributes);
 
   if (opened)
-    CloseHandle(handle);
+    MirrorCloseHandle(handle, TRUE);
 
   return STATUS_SUCCESS;
 }
@@ -941,6 +1973,15 @@ MirrorMoveFile(LPCWSTR FileName, // existing file name
     return STATUS_INVALID_HANDLE;
   }
 
+  // Handles under the old name must not be reused, and parked ones would
+  // prevent the rename or the replacement of the target
+  MirrorFlushCachedHandles(filePath, DokanFileInfo->IsDirectory);
+  if (newFilePath[0] != L':')
+    MirrorFlushCachedHandles(newFilePath, FALSE);
+  MirrorForgetCachedSecurity(filePath, DokanFileInfo->IsDirectory);
+  if (newFilePath[0] != L':')
+    MirrorForgetCachedSecurity(newFilePath, FALSE);
+
   newFilePathLen = wcslen(newFilePath);
 
   // the PFILE_RENAME_INFO struct has space for one WCHAR for the name at
@@ -1212,6 +2253,14 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetFileSecurity(
     *SecurityInformation &= ~BACKUP_SECURITY_INFORMATION;
   }
 
+  NTSTATUS status =
+      MirrorGetCachedSecurity(filePath, *SecurityInformation,
+                              SecurityDescriptor, BufferLength, LengthNeeded);
+  if (status != STATUS_NOT_FOUND) {
+    DbgPrint(L"  Cached security descriptor, length %u\n", *LengthNeeded);
+    return status;
+  }
+
   DbgPrint(L"  Opening new handle with READ_CONTROL access\n");
   HANDLE handle = CreateFile(
       filePath,
@@ -1235,6 +2284,17 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetFileSecurity(
     int error = GetLastError();
     if (error == ERROR_INSUFFICIENT_BUFFER) {
       DbgPrint(L"  GetUserObjectSecurity error: ERROR_INSUFFICIENT_BUFFER\n");
+      // Read now for the query that follows with a large enough buffer
+      ULONG length = *LengthNeeded;
+      PSECURITY_DESCRIPTOR securityDescriptor = malloc(length);
+      if (securityDescriptor &&
+          GetUserObjectSecurity(handle, SecurityInformation,
+                                securityDescriptor, length, LengthNeeded)) {
+        *LengthNeeded = GetSecurityDescriptorLength(securityDescriptor);
+        MirrorCacheSecurity(filePath, *SecurityInformation,
+                            securityDescriptor, *LengthNeeded);
+      }
+      free(securityDescriptor);
       CloseHandle(handle);
       return STATUS_BUFFER_OVERFLOW;
     } else {
@@ -1250,6 +2310,8 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetFileSecurity(
   DbgPrint(L"  GetUserObjectSecurity return true,  *LengthNeeded = "
            L"securityDescriptorLength \n");
   *LengthNeeded = securityDescriptorLength;
+  MirrorCacheSecurity(filePath, *SecurityInformation, SecurityDescriptor,
+                      securityDescriptorLength);
 
   CloseHandle(handle);
 
@@ -1275,8 +2337,13 @@ static NTSTATUS DOKAN_CALLBACK MirrorSetFileSecurity(
     return STATUS_INVALID_HANDLE;
   }
 
-  if (!SetUserObjectSecurity(handle, SecurityInformation, SecurityDescriptor)) {
-    int error = GetLastError();
+  int error = SetUserObjectSecurity(handle, SecurityInformation,
+                                    SecurityDescriptor)
+                  ? ERROR_SUCCESS
+                  : GetLastError();
+  // Also the inherited parts of the descriptors below a directory may change
+  MirrorForgetCachedSecurity(filePath, DokanFileInfo->IsDirectory);
+  if (error != ERROR_SUCCESS) {
     DbgPrint(L"  SetUserObjectSecurity error: %d\n", error);
     return DokanNtStatusFromWin32(error);
   }
@@ -1301,7 +2368,8 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetVolumeInformation(
     *MaximumComponentLength = 255;
   if (FileSystemFlags) {
     *FileSystemFlags = FILE_SUPPORTS_REMOTE_STORAGE | FILE_UNICODE_ON_DISK |
-                       FILE_PERSISTENT_ACLS | FILE_NAMED_STREAMS;
+                       FILE_PERSISTENT_ACLS | FILE_NAMED_STREAMS |
+                       FILE_SUPPORTS_SPARSE_FILES;
     if (g_CaseSensitive)
       *FileSystemFlags = FILE_CASE_SENSITIVE_SEARCH | FILE_CASE_PRESERVED_NAMES;
   }
@@ -1315,8 +2383,12 @@ static NTSTATUS DOKAN_CALLBACK MirrorGetVolumeInformation(
                            &fsFlags, FileSystemNameBuffer,
                            FileSystemNameSize)) {
 
-    if (FileSystemFlags)
+    if (FileSystemFlags) {
       *FileSystemFlags &= fsFlags;
+      // MirrorCopyFileRange copies the data when the backing file system
+      // cannot clone it.
+      *FileSystemFlags |= FILE_SUPPORTS_BLOCK_REFCOUNTING;
+    }
 
     if (MaximumComponentLength) {
       DbgPrint(L"GetVolumeInformation: max component length %u\n",
@@ -1388,7 +2460,8 @@ static NTSTATUS DOKAN_CALLBACK MirrorDokanGetDiskFreeSpace(
 /**
  * Avoid #include <winternl.h> which as conflict with FILE_INFORMATION_CLASS
  * definition.
- * This only for MirrorFindStreams. Link with ntdll.lib still required.
+ * This only for NtQueryInformationFile and NtQueryDirectoryFile. Link with
+ * ntdll.lib still required.
  *
  * Not needed if you're not using NtQueryInformationFile!
  *
@@ -1410,10 +2483,131 @@ NTSYSCALLAPI NTSTATUS NTAPI NtQueryInformationFile(
     _In_ HANDLE FileHandle, _Out_ PIO_STATUS_BLOCK IoStatusBlock,
     _Out_writes_bytes_(Length) PVOID FileInformation, _In_ ULONG Length,
     _In_ FILE_INFORMATION_CLASS FileInformationClass);
+
+NTSYSCALLAPI NTSTATUS NTAPI NtQueryDirectoryFile(
+    _In_ HANDLE FileHandle, _In_opt_ HANDLE Event, _In_opt_ PVOID ApcRoutine,
+    _In_opt_ PVOID ApcContext, _Out_ PIO_STATUS_BLOCK IoStatusBlock,
+    _Out_writes_bytes_(Length) PVOID FileInformation, _In_ ULONG Length,
+    _In_ FILE_INFORMATION_CLASS FileInformationClass,
+    _In_ BOOLEAN ReturnSingleEntry, _In_opt_ PUNICODE_STRING FileName,
+    _In_ BOOLEAN RestartScan);
 /**
  * END
  */
 
+static FILETIME MirrorToFileTime(LARGE_INTEGER Time) {
+  FILETIME fileTime;
+  fileTime.dwLowDateTime = Time.LowPart;
+  fileTime.dwHighDateTime = (DWORD)Time.HighPart;
+  return fileTime;
+}
+
+// Lists the directory with NtQueryDirectoryFile on its handle, in large
+// batches, and gives the entries to Dokan as they are returned by the backing
+// file system, the names pointing into the query buffer. "." and ".." are
+// not given and take no position.
+static NTSTATUS DOKAN_CALLBACK MirrorFindFilesWithCursor(
+    LPCWSTR PathName, LPCWSTR SearchPattern, ULONG StartIndex,
+    LPCWSTR LastFileName, PFillDirectoryEntry FillDirectoryEntry,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  HANDLE handle = (HANDLE)DokanFileInfo->Context;
+  PMIRROR_DIRECTORY_SCAN scan;
+  UNICODE_STRING pattern;
+  BOOLEAN restart = FALSE;
+  NTSTATUS status = STATUS_SUCCESS;
+  int count = 0;
+  UNREFERENCED_PARAMETER(LastFileName);
+
+  DbgPrint(L"FindFilesWithCursor : %s from %lu\n", PathName, StartIndex);
+
+  if (!handle || handle == INVALID_HANDLE_VALUE) {
+    DbgPrint(L"\tinvalid handle\n\n");
+    return STATUS_NOT_IMPLEMENTED;
+  }
+  scan = MirrorGetDirectoryScan(handle);
+  if (!scan)
+    return STATUS_INSUFFICIENT_RESOURCES;
+
+  pattern.Buffer = (PWSTR)SearchPattern;
+  pattern.Length = (USHORT)(wcslen(SearchPattern) * sizeof(WCHAR));
+  pattern.MaximumLength = pattern.Length;
+
+  EnterCriticalSection(&scan->Lock);
+  // Rewound, list again from the start
+  if (!scan->Started || StartIndex < scan->Index) {
+    restart = TRUE;
+    scan->Ended = FALSE;
+    scan->Index = 0;
+    scan->Offset = 0;
+    scan->Length = 0;
+  }
+  for (;;) {
+    PFILE_ID_FULL_DIR_INFORMATION info;
+    ULONG nameLength;
+    BOOL dotEntry;
+
+    if (scan->Offset >= scan->Length) {
+      IO_STATUS_BLOCK ioStatus;
+      if (scan->Ended)
+        break;
+      status = NtQueryDirectoryFile(
+          handle, NULL, NULL, NULL, &ioStatus, scan->Buffer,
+          MIRROR_DIRECTORY_SCAN_BUFFER_SIZE, FileIdFullDirectoryInformation,
+          FALSE, restart ? &pattern : NULL, restart);
+      if (status == STATUS_NO_MORE_FILES || status == STATUS_NO_SUCH_FILE) {
+        scan->Started = TRUE;
+        scan->Ended = TRUE;
+        status = STATUS_SUCCESS;
+        break;
+      }
+      if (status != STATUS_SUCCESS) {
+        DbgPrint(L"\tNtQueryDirectoryFile error = 0x%x\n\n", status);
+        // Likely not opened to be listed, let FindFiles do it
+        if (restart) {
+          scan->Started = FALSE;
+          status = STATUS_NOT_IMPLEMENTED;
+        }
+        break;
+      }
+      restart = FALSE;
+      scan->Started = TRUE;
+      scan->Offset = 0;
+      scan->Length = (ULONG)ioStatus.Information;
+      continue;
+    }
+
+    info = (PFILE_ID_FULL_DIR_INFORMATION)(scan->Buffer + scan->Offset);
+    nameLength = info->FileNameLength / sizeof(WCHAR);
+    dotEntry = info->FileName[0] == L'.' &&
+               (nameLength == 1 ||
+                (nameLength == 2 && info->FileName[1] == L'.'));
+    if (!dotEntry && scan->Index >= StartIndex) {
+      DOKAN_DIRECTORY_ENTRY entry;
+      entry.FileAttributes = info->FileAttributes;
+      entry.CreationTime = MirrorToFileTime(info->CreationTime);
+      entry.LastAccessTime = MirrorToFileTime(info->LastAccessTime);
+      entry.LastWriteTime = MirrorToFileTime(info->LastWriteTime);
+      entry.FileSize = (ULONG64)info->EndOfFile.QuadPart;
+      entry.FileId = (ULONG64)info->FileId.QuadPart;
+      entry.FileNameLength = nameLength;
+      entry.FileName = info->FileName;
+      // The entry is given again first by the next request
+      if (FillDirectoryEntry(&entry, DokanFileInfo))
+        break;
+      ++count;
+    }
+    if (!dotEntry)
+      ++scan->Index;
+    scan->Offset = info->NextEntryOffset ? scan->Offset + info->NextEntryOffset
+                                         : scan->Length;
+  }
+  LeaveCriticalSection(&scan->Lock);
+
+  DbgPrint(L"\tFindFilesWithCursor return %d entries in %s\n\n", count,
+           PathName);
+  return status;
+}
+
 NTSTATUS DOKAN_CALLBACK
 MirrorFindStreams(LPCWSTR FileName, PFillFindStreamData FillFindStreamData,
                   PVOID FindStreamContext,
@@ -1509,6 +2703,10 @@ void ShowUsage() {
           "  /l MountPoint (ex. /l m)\t\t\t Mount point. Can be M:\\ (drive letter) or empty NTFS folder C:\\mount\\dokan .\n"
           "  /t Single thread\t\t\t\t Only use a single thread to process events.\n\t\t\t\t\t\t This is highly not recommended as can easily create a bottleneck.\n"
           "  /g IPC Batching\t\t\t\t Pull batches of events from the driver instead of a single one and execute them parallelly.\n\t\t\t\t\t\t Only recommended for slow (remote) mirrored device.\n"
+          "  /q Event ring\t\t\t\t\t Exchange small events with the driver through shared memory instead of an ioctl each.\n"
+          "  /y Overlapped I/O\t\t\t\t Open files for overlapped I/O and complete reads and writes from their completion.\n\t\t\t\t\t\t Keeps many requests in flight on a high latency mirrored device.\n"
+          "  /z Unbuffered I/O\t\t\t\t Do aligned paging I/O on backing files opened without buffering, so data is only cached once.\n"
+          "  /h Handle cache\t\t\t\t Keep backing handles open a moment after use and reuse them for identical opens.\n"
           "  /d (enable debug output)\t\t\t Enable debug output to an attached debugger.\n"
           "  /s (use stderr for output)\t\t\t Enable debug output to stderr.\n"
           "  /m (use removable drive)\t\t\t Show device as removable media.\n"
@@ -1524,7 +2722,9 @@ void ShowUsage() {
           "  /i Timeout in Milliseconds (ex. /i 30000)\t Timeout until a running operation is aborted and the device is unmounted.\n"
           "  /x Network unmount\t\t\t\t Allows unmounting network drive from file explorer.\n"
           "  /e Enable Driver Logs\t\t\t\t Forward Driver logs to userland.\n"
-          "  /v Volume name\t\t\t\t Personalize the volume name.\n\n"
+          "  /v Volume name\t\t\t\t Personalize the volume name.\n"
+          "  /j Options (ex. /j 0x200000)\t\t\t Additional DOKAN_OPTION_* flags, e.g. for the options that have no switch.\n"
+          "  /u Cache timeout in Milliseconds (ex. /u 1000)\t Cache missing paths and directory listings for that time.\n\n"
           "Examples:\n"
           "\tmirror.exe /r C:\\Users /l M:\t\t\t# Mirror C:\\Users as RootDirectory into a drive of letter M:\\.\n"
           "\tmirror.exe /r C:\\Users /l C:\\mount\\dokan\t# Mirror C:\\Users as RootDirectory into NTFS folder C:\\mount\\dokan.\n"
@@ -1610,6 +2810,19 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
     case L'g':
       dokanOptions.Options |= DOKAN_OPTION_ALLOW_IPC_BATCHING;
       break;
+    case L'q':
+      dokanOptions.Options |= DOKAN_OPTION_EVENT_RING;
+      break;
+    case L'y':
+      dokanOptions.Options |= DOKAN_OPTION_ASYNC_OPERATIONS;
+      g_OverlappedIo = TRUE;
+      break;
+    case L'h':
+      g_HandleCache = TRUE;
+      break;
+    case L'z':
+      g_UnbufferedIo = TRUE;
+      break;
     case L'b':
       // Only work when mirroring a folder with setCaseSensitiveInfo option enabled on win10
       dokanOptions.Options |= DOKAN_OPTION_CASE_SENSITIVE;
@@ -1642,6 +2855,15 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
       CHECK_CMD_ARG(command, argc)
       dokanOptions.SectorSize = (ULONG)_wtol(argv[command]);
       break;
+    case L'j':
+      CHECK_CMD_ARG(command, argc)
+      dokanOptions.Options |= wcstoul(argv[command], NULL, 0);
+      break;
+    case L'u':
+      CHECK_CMD_ARG(command, argc)
+      dokanOptions.NegativeCacheTimeoutMs = (ULONG)_wtol(argv[command]);
+      dokanOptions.DirectoryListCacheTimeoutMs = (ULONG)_wtol(argv[command]);
+      break;
     default:
       fwprintf(stderr, L"unknown command: %ls\n", argv[command]);
       return EXIT_FAILURE;
@@ -1696,6 +2918,17 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
         L"\t=> Please restart mirror sample with administrator rights to fix it\n");
   }
 
+  if (g_HandleCache && g_ImpersonateCallerUser) {
+    fwprintf(stderr, L"[Mirror] Handle cache disabled, handles opened for a "
+                     L"user cannot be reused for another\n");
+    g_HandleCache = FALSE;
+  }
+
+  if (g_HandleCache && !MirrorStartHandleCache()) {
+    fwprintf(stderr, L"[Mirror] Failed to start the handle cache\n");
+    g_HandleCache = FALSE;
+  }
+
   if (g_DebugMode) {
     dokanOptions.Options |= DOKAN_OPTION_DEBUG;
   }
@@ -1712,9 +2945,14 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
   dokanOperations.ReadFile = MirrorReadFile;
   dokanOperations.WriteFile = MirrorWriteFile;
   dokanOperations.FlushFileBuffers = MirrorFlushFileBuffers;
+  dokanOperations.CopyFileRange = MirrorCopyFileRange;
+  dokanOperations.SetSparseFile = MirrorSetSparseFile;
+  dokanOperations.ZeroFileRange = MirrorZeroFileRange;
+  dokanOperations.QueryAllocatedRanges = MirrorQueryAllocatedRanges;
   dokanOperations.GetFileInformation = MirrorGetFileInformation;
   dokanOperations.FindFiles = MirrorFindFiles;
   dokanOperations.FindFilesWithPattern = NULL;
+  dokanOperations.FindFilesWithCursor = MirrorFindFilesWithCursor;
   dokanOperations.SetFileAttributes = MirrorSetFileAttributes;
   dokanOperations.SetFileTime = MirrorSetFileTime;
   dokanOperations.DeleteFile = MirrorDeleteFile;
@@ -1735,6 +2973,8 @@ int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
   DokanInit();
   status = DokanMain(&dokanOptions, &dokanOperations);
   DokanShutdown();
+  if (g_HandleCache)
+    MirrorStopHandleCache();
   switch (status) {
   case DOKAN_SUCCESS:
     fprintf(stderr, "Success\n");
@@ -0,0 +1,170 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "nullfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static WCHAR gMountPoint[MAX_PATH] = L"N:\\";
+
+BOOL WINAPI CtrlHandler(DWORD dwCtrlType) {
+  switch (dwCtrlType) {
+  case CTRL_C_EVENT:
+  case CTRL_BREAK_EVENT:
+  case CTRL_CLOSE_EVENT:
+  case CTRL_LOGOFF_EVENT:
+  case CTRL_SHUTDOWN_EVENT:
+    SetConsoleCtrlHandler(CtrlHandler, FALSE);
+    DokanRemoveMountPoint(gMountPoint);
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+void ShowUsage() {
+  // clang-format off
+  fprintf(stderr, "nullfs.exe - Null file system answering every operation from constant data.\n"
+          "  /l MountPoint (ex. /l n)\t\t\t Mount point. Can be N:\\ (drive letter) or empty NTFS folder C:\\mount\\dokan .\n"
+          "  /n Entries (ex. /n 10000)\t\t\t Number of entries listed in \\dir.\n"
+          "  /t Single thread\t\t\t\t Only use a single thread to process events.\n"
+          "  /g IPC Batching\t\t\t\t Pull batches of events from the driver instead of a single one.\n"
+          "  /q Event ring\t\t\t\t\t Exchange small events with the driver through shared memory.\n"
+          "  /y Async operations\t\t\t\t Complete reads, writes and flushes with DokanCompleteOperation.\n"
+          "  /p Threads (ex. /p 4)\t\t\t\t Number of threads processing the requests.\n"
+          "  /d (enable debug output)\t\t\t Enable debug output to an attached debugger.\n"
+          "  /s (use stderr for output)\t\t\t Enable debug output to stderr.\n\n"
+          "Examples:\n"
+          "\tnullfs.exe /l N\t\t\t\t# Null file system as N:\\ drive letter.\n"
+          "\tnullfs.exe /l N /y /n 100000\t\t# Using the async completion path with 100000 entries in \\dir.\n\n"
+          "Unmount the drive with CTRL + C in the console or alternatively via \"dokanctl /u MountPoint\".\n");
+  // clang-format on
+}
+
+#define CHECK_CMD_ARG(commad, argc)                                            \
+  {                                                                            \
+    if (++command == argc) {                                                   \
+      fwprintf(stderr, L"Option is missing an argument.\n");                   \
+      return EXIT_FAILURE;                                                     \
+    }                                                                          \
+  }
+
+int __cdecl wmain(ULONG argc, PWCHAR argv[]) {
+  int status;
+  ULONG command;
+  ULONG entryCount = 1000;
+  DOKAN_OPERATIONS dokanOperations;
+  DOKAN_OPTIONS dokanOptions;
+
+  if (argc < 2) {
+    ShowUsage();
+    return EXIT_FAILURE;
+  }
+
+  ZeroMemory(&dokanOptions, sizeof(DOKAN_OPTIONS));
+  dokanOptions.Version = DOKAN_VERSION;
+  dokanOptions.MountPoint = gMountPoint;
+
+  for (command = 1; command < argc; command++) {
+    switch (towlower(argv[command][1])) {
+    case L'l':
+      CHECK_CMD_ARG(command, argc)
+      wcscpy_s(gMountPoint, sizeof(gMountPoint) / sizeof(WCHAR), argv[command]);
+      break;
+    case L'n':
+      CHECK_CMD_ARG(command, argc)
+      entryCount = (ULONG)_wtol(argv[command]);
+      break;
+    case L't':
+      dokanOptions.SingleThread = TRUE;
+      break;
+    case L'g':
+      dokanOptions.Options |= DOKAN_OPTION_ALLOW_IPC_BATCHING;
+      break;
+    case L'q':
+      dokanOptions.Options |= DOKAN_OPTION_EVENT_RING;
+      break;
+    case L'y':
+      dokanOptions.Options |= DOKAN_OPTION_ASYNC_OPERATIONS;
+      break;
+    case L'p':
+      CHECK_CMD_ARG(command, argc)
+      dokanOptions.MinThreads = (ULONG)_wtol(argv[command]);
+      dokanOptions.MaxThreads = dokanOptions.MinThreads;
+      break;
+    case L'd':
+      dokanOptions.Options |= DOKAN_OPTION_DEBUG;
+      break;
+    case L's':
+      dokanOptions.Options |= DOKAN_OPTION_STDERR;
+      break;
+    default:
+      fwprintf(stderr, L"unknown command: %ls\n", argv[command]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!SetConsoleCtrlHandler(CtrlHandler, TRUE)) {
+    fwprintf(stderr, L"Control Handler is not set.\n");
+  }
+
+  NullFsInitialize(entryCount, &dokanOperations);
+
+  DokanInit();
+  status = DokanMain(&dokanOptions, &dokanOperations);
+  DokanShutdown();
+  switch (status) {
+  case DOKAN_SUCCESS:
+    fprintf(stderr, "Success\n");
+    break;
+  case DOKAN_ERROR:
+    fprintf(stderr, "Error\n");
+    break;
+  case DOKAN_DRIVE_LETTER_ERROR:
+    fprintf(stderr, "Bad Drive letter\n");
+    break;
+  case DOKAN_DRIVER_INSTALL_ERROR:
+    fprintf(stderr, "Can't install driver\n");
+    break;
+  case DOKAN_START_ERROR:
+    fprintf(stderr, "Driver something wrong\n");
+    break;
+  case DOKAN_MOUNT_ERROR:
+    fprintf(stderr, "Can't assign a drive letter\n");
+    break;
+  case DOKAN_MOUNT_POINT_ERROR:
+    fprintf(stderr, "Mount point error\n");
+    break;
+  case DOKAN_VERSION_ERROR:
+    fprintf(stderr, "Version error\n");
+    break;
+  default:
+    fprintf(stderr, "Unknown error: %d\n", status);
+    break;
+  }
+  return EXIT_SUCCESS;
+}
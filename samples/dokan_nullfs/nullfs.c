@@ -0,0 +1,275 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "nullfs.h"
+
+#include <stdio.h>
+
+typedef enum _NULLFS_NODE {
+  NULLFS_NODE_NONE = 0,
+  NULLFS_NODE_ROOT,
+  NULLFS_NODE_FILE,
+  NULLFS_NODE_DIR,
+  NULLFS_NODE_DIR_ENTRY,
+} NULLFS_NODE;
+
+static FILETIME g_FileTime;
+static ULONG g_EntryCount;
+
+static NULLFS_NODE GetNode(LPCWSTR FileName) {
+  static const WCHAR dirEntryPrefix[] = L"\\dir\\f";
+  const size_t prefixLength = ARRAYSIZE(dirEntryPrefix) - 1;
+  ULONG index = 0;
+  LPCWSTR digit;
+
+  if (wcscmp(FileName, L"\\") == 0) {
+    return NULLFS_NODE_ROOT;
+  }
+  if (_wcsicmp(FileName, L"\\file") == 0) {
+    return NULLFS_NODE_FILE;
+  }
+  if (_wcsicmp(FileName, L"\\dir") == 0) {
+    return NULLFS_NODE_DIR;
+  }
+  if (_wcsnicmp(FileName, dirEntryPrefix, prefixLength) != 0 ||
+      FileName[prefixLength] == L'\0') {
+    return NULLFS_NODE_NONE;
+  }
+  for (digit = FileName + prefixLength; *digit != L'\0'; ++digit) {
+    if (*digit < L'0' || *digit > L'9' || index > NULLFS_MAX_ENTRY_COUNT) {
+      return NULLFS_NODE_NONE;
+    }
+    index = index * 10 + (*digit - L'0');
+  }
+  return index < g_EntryCount ? NULLFS_NODE_DIR_ENTRY : NULLFS_NODE_NONE;
+}
+
+static BOOL IsDirectoryNode(NULLFS_NODE Node) {
+  return Node == NULLFS_NODE_ROOT || Node == NULLFS_NODE_DIR;
+}
+
+// Returns what the callback has to return for Status, completing it first
+// through the async path when the mount uses it.
+static NTSTATUS CompleteOperation(PDOKAN_FILE_INFO DokanFileInfo,
+                                  NTSTATUS Status, ULONG Information) {
+  if (!(DokanFileInfo->DokanOptions->Options &
+        DOKAN_OPTION_ASYNC_OPERATIONS)) {
+    return Status;
+  }
+  DokanCompleteOperation(DokanFileInfo, Status, Information);
+  return STATUS_PENDING;
+}
+
+static NTSTATUS DOKAN_CALLBACK
+NullCreateFile(LPCWSTR FileName, PDOKAN_IO_SECURITY_CONTEXT SecurityContext,
+               ACCESS_MASK DesiredAccess, ULONG FileAttributes,
+               ULONG ShareAccess, ULONG CreateDisposition,
+               ULONG CreateOptions, PDOKAN_FILE_INFO DokanFileInfo) {
+  NULLFS_NODE node = GetNode(FileName);
+  UNREFERENCED_PARAMETER(SecurityContext);
+  UNREFERENCED_PARAMETER(DesiredAccess);
+  UNREFERENCED_PARAMETER(FileAttributes);
+  UNREFERENCED_PARAMETER(ShareAccess);
+
+  if (node == NULLFS_NODE_NONE) {
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+  }
+  if (CreateDisposition == FILE_CREATE) {
+    return STATUS_OBJECT_NAME_COLLISION;
+  }
+  if (IsDirectoryNode(node)) {
+    if (CreateOptions & FILE_NON_DIRECTORY_FILE) {
+      return STATUS_FILE_IS_A_DIRECTORY;
+    }
+    DokanFileInfo->IsDirectory = TRUE;
+  } else if (CreateOptions & FILE_DIRECTORY_FILE) {
+    return STATUS_NOT_A_DIRECTORY;
+  }
+  DokanFileInfo->Context = node;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK NullReadFile(LPCWSTR FileName, LPVOID Buffer,
+                                            DWORD BufferLength,
+                                            LPDWORD ReadLength,
+                                            LONGLONG Offset,
+                                            PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(FileName);
+
+  *ReadLength = 0;
+  if (DokanFileInfo->Context == NULLFS_NODE_FILE &&
+      Offset < NULLFS_FILE_SIZE) {
+    *ReadLength =
+        (DWORD)min((LONGLONG)BufferLength, NULLFS_FILE_SIZE - Offset);
+    ZeroMemory(Buffer, *ReadLength);
+  }
+  return CompleteOperation(DokanFileInfo, STATUS_SUCCESS, *ReadLength);
+}
+
+static NTSTATUS DOKAN_CALLBACK NullWriteFile(LPCWSTR FileName, LPCVOID Buffer,
+                                             DWORD NumberOfBytesToWrite,
+                                             LPDWORD NumberOfBytesWritten,
+                                             LONGLONG Offset,
+                                             PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(FileName);
+  UNREFERENCED_PARAMETER(Buffer);
+  UNREFERENCED_PARAMETER(Offset);
+
+  *NumberOfBytesWritten = 0;
+  if (DokanFileInfo->Context != NULLFS_NODE_FILE) {
+    return CompleteOperation(DokanFileInfo, STATUS_ACCESS_DENIED, 0);
+  }
+  *NumberOfBytesWritten = NumberOfBytesToWrite;
+  return CompleteOperation(DokanFileInfo, STATUS_SUCCESS,
+                           NumberOfBytesToWrite);
+}
+
+static NTSTATUS DOKAN_CALLBACK
+NullFlushFileBuffers(LPCWSTR FileName, PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(FileName);
+  return CompleteOperation(DokanFileInfo, STATUS_SUCCESS, 0);
+}
+
+static NTSTATUS DOKAN_CALLBACK
+NullGetFileInformation(LPCWSTR FileName, LPBY_HANDLE_FILE_INFORMATION Buffer,
+                       PDOKAN_FILE_INFO DokanFileInfo) {
+  NULLFS_NODE node = (NULLFS_NODE)DokanFileInfo->Context;
+  UNREFERENCED_PARAMETER(FileName);
+
+  ZeroMemory(Buffer, sizeof(BY_HANDLE_FILE_INFORMATION));
+  Buffer->dwFileAttributes =
+      IsDirectoryNode(node) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+  Buffer->ftCreationTime = g_FileTime;
+  Buffer->ftLastAccessTime = g_FileTime;
+  Buffer->ftLastWriteTime = g_FileTime;
+  Buffer->dwVolumeSerialNumber = 0x19831116;
+  Buffer->nNumberOfLinks = 1;
+  Buffer->nFileIndexLow = node;
+  if (node == NULLFS_NODE_FILE) {
+    Buffer->nFileSizeHigh = (DWORD)(NULLFS_FILE_SIZE >> 32);
+    Buffer->nFileSizeLow = (DWORD)NULLFS_FILE_SIZE;
+  }
+  return STATUS_SUCCESS;
+}
+
+static VOID SetDirectoryEntry(PDOKAN_DIRECTORY_ENTRY Entry, LPCWSTR FileName,
+                              ULONG FileNameLength, DWORD FileAttributes,
+                              ULONG64 FileSize, ULONG64 FileId) {
+  Entry->FileAttributes = FileAttributes;
+  Entry->CreationTime = g_FileTime;
+  Entry->LastAccessTime = g_FileTime;
+  Entry->LastWriteTime = g_FileTime;
+  Entry->FileSize = FileSize;
+  Entry->FileId = FileId;
+  Entry->FileNameLength = FileNameLength;
+  Entry->FileName = FileName;
+}
+
+// Entries are generated at their position, so the listing is never held.
+static NTSTATUS DOKAN_CALLBACK NullFindFilesWithCursor(
+    LPCWSTR PathName, LPCWSTR SearchPattern, ULONG StartIndex,
+    LPCWSTR LastFileName, PFillDirectoryEntry FillDirectoryEntry,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  DOKAN_DIRECTORY_ENTRY entry;
+  WCHAR name[16];
+  UNREFERENCED_PARAMETER(PathName);
+  UNREFERENCED_PARAMETER(SearchPattern);
+  UNREFERENCED_PARAMETER(LastFileName);
+
+  switch (DokanFileInfo->Context) {
+  case NULLFS_NODE_ROOT:
+    if (StartIndex == 0) {
+      SetDirectoryEntry(&entry, L"file", 4, FILE_ATTRIBUTE_NORMAL,
+                        NULLFS_FILE_SIZE, NULLFS_NODE_FILE);
+      if (FillDirectoryEntry(&entry, DokanFileInfo) == 1) {
+        return STATUS_SUCCESS;
+      }
+      ++StartIndex;
+    }
+    if (StartIndex == 1) {
+      SetDirectoryEntry(&entry, L"dir", 3, FILE_ATTRIBUTE_DIRECTORY, 0,
+                        NULLFS_NODE_DIR);
+      FillDirectoryEntry(&entry, DokanFileInfo);
+    }
+    return STATUS_SUCCESS;
+  case NULLFS_NODE_DIR:
+    for (ULONG i = StartIndex; i < g_EntryCount; ++i) {
+      int length = swprintf_s(name, ARRAYSIZE(name), L"f%07lu", i);
+      SetDirectoryEntry(&entry, name, (ULONG)length, FILE_ATTRIBUTE_NORMAL, 0,
+                        NULLFS_NODE_DIR_ENTRY + (ULONG64)i);
+      if (FillDirectoryEntry(&entry, DokanFileInfo) == 1) {
+        break;
+      }
+    }
+    return STATUS_SUCCESS;
+  default:
+    return STATUS_NOT_A_DIRECTORY;
+  }
+}
+
+static NTSTATUS DOKAN_CALLBACK NullGetDiskFreeSpace(
+    PULONGLONG FreeBytesAvailable, PULONGLONG TotalNumberOfBytes,
+    PULONGLONG TotalNumberOfFreeBytes, PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(DokanFileInfo);
+
+  *FreeBytesAvailable = NULLFS_FILE_SIZE;
+  *TotalNumberOfBytes = 2 * NULLFS_FILE_SIZE;
+  *TotalNumberOfFreeBytes = NULLFS_FILE_SIZE;
+  return STATUS_SUCCESS;
+}
+
+static NTSTATUS DOKAN_CALLBACK NullGetVolumeInformation(
+    LPWSTR VolumeNameBuffer, DWORD VolumeNameSize, LPDWORD VolumeSerialNumber,
+    LPDWORD MaximumComponentLength, LPDWORD FileSystemFlags,
+    LPWSTR FileSystemNameBuffer, DWORD FileSystemNameSize,
+    PDOKAN_FILE_INFO DokanFileInfo) {
+  UNREFERENCED_PARAMETER(DokanFileInfo);
+
+  wcscpy_s(VolumeNameBuffer, VolumeNameSize, L"NullFS");
+  if (VolumeSerialNumber)
+    *VolumeSerialNumber = 0x19831116;
+  if (MaximumComponentLength)
+    *MaximumComponentLength = 255;
+  if (FileSystemFlags)
+    *FileSystemFlags = FILE_CASE_PRESERVED_NAMES | FILE_UNICODE_ON_DISK;
+  wcscpy_s(FileSystemNameBuffer, FileSystemNameSize, L"NTFS");
+  return STATUS_SUCCESS;
+}
+
+VOID NullFsInitialize(ULONG EntryCount, PDOKAN_OPERATIONS Operations) {
+  g_EntryCount = min(EntryCount, NULLFS_MAX_ENTRY_COUNT);
+  GetSystemTimeAsFileTime(&g_FileTime);
+
+  ZeroMemory(Operations, sizeof(DOKAN_OPERATIONS));
+  Operations->ZwCreateFile = NullCreateFile;
+  Operations->ReadFile = NullReadFile;
+  Operations->WriteFile = NullWriteFile;
+  Operations->FlushFileBuffers = NullFlushFileBuffers;
+  Operations->GetFileInformation = NullGetFileInformation;
+  Operations->GetDiskFreeSpace = NullGetDiskFreeSpace;
+  Operations->GetVolumeInformation = NullGetVolumeInformation;
+  Operations->FindFilesWithCursor = NullFindFilesWithCursor;
+}
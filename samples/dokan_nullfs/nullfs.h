@@ -0,0 +1,51 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef NULLFS_H_
+#define NULLFS_H_
+
+#include "../../dokan/dokan.h"
+
+// Null file system, answering every operation from constant data without
+// allocating, to measure the overhead of Dokan alone.
+//
+// The volume holds:
+//   \file  a file of NULLFS_FILE_SIZE bytes, reads return zeros and writes
+//          are dropped.
+//   \dir   a directory with the entry count given to NullFsInitialize, named
+//          f0000000 upwards, which are empty files.
+//
+// Reads, writes and flushes are completed with DokanCompleteOperation when the
+// mount has DOKAN_OPTION_ASYNC_OPERATIONS, and returned directly otherwise.
+
+#define NULLFS_FILE_SIZE (1024LL * 1024 * 1024)
+#define NULLFS_MAX_ENTRY_COUNT 10000000
+
+// Fills Operations with the callbacks of the null file system, whose \dir
+// lists EntryCount entries.
+VOID NullFsInitialize(ULONG EntryCount, PDOKAN_OPERATIONS Operations);
+
+#endif // NULLFS_H_
@@ -1,5 +1,7 @@
 param(
-    [Parameter(Mandatory=$false)][Array] $Memfs = @("..\x64\Release\memfs.exe", "..\Win32\Release\memfs.exe")
+    [Parameter(Mandatory=$false)][Array] $Memfs = @("..\x64\Release\memfs.exe", "..\Win32\Release\memfs.exe"),
+    # Library of the bitness of PowerShell the pattern test compares the listings with.
+    [Parameter(Mandatory=$false)][string] $DokanLibrary = (Join-Path (Split-Path $Memfs[0]) "dokan2.dll")
 )
 #TODO: enable specifying own mirror-commands and own test-commands
 #TODO: move compilation of test tools to separate scripts in scripts
@@ -15,6 +17,55 @@ function Exec-External {
   }
 }
 
+function Assert-True {
+  param(
+	[Parameter(Position=0,Mandatory=1)][bool] $condition,
+	[Parameter(Position=1,Mandatory=1)][string] $message
+  )
+  if (!$condition) {
+	throw ("Memfs test failed: $message")
+  }
+}
+
+# Alternate streams, which memfs keeps apart from the files that have none.
+function Test-MemfsStreams {
+  param(
+	[Parameter(Position=0,Mandatory=1)][string] $root
+  )
+  $file = Join-Path $root "memfsstreams"
+  Set-Content -Path $file -Value "data"
+  Assert-True (@(Get-Item -Path $file -Stream *).Count -eq 1) "$file has alternate streams"
+  Set-Content -Path $file -Stream "extra" -Value "stream"
+  Assert-True ((Get-Content -Path $file -Stream "extra") -eq "stream") "stream extra of $file does not read back"
+  Assert-True ((Get-Content -Path $file) -eq "data") "$file changed with its stream"
+  Assert-True (@(Get-Item -Path $file -Stream *).Count -eq 2) "stream extra of $file is not listed"
+  Remove-Item -Path $file -Stream "extra"
+  Assert-True (@(Get-Item -Path $file -Stream *).Count -eq 1) "removed stream extra of $file is still listed"
+  Remove-Item $file
+}
+
+# Directory trees, which memfs detaches at once when removed and frees later.
+function Test-MemfsTreeRemoval {
+  param(
+	[Parameter(Position=0,Mandatory=1)][string] $root
+  )
+  $tree = Join-Path $root "memfstree"
+  for ($round = 0; $round -lt 3; ++$round) {
+	foreach ($dir in "a", "a\b", "a\b\c", "d") {
+	  New-Item "$tree\$dir" -ItemType Directory -Force | Out-Null
+	  for ($i = 0; $i -lt 20; ++$i) {
+		Set-Content -Path "$tree\$dir\$i" -Value "$round"
+	  }
+	}
+	Remove-Item -Recurse -Force $tree
+	Assert-True (!(Test-Path $tree)) "removed $tree still exists"
+	# The same paths are reused right away.
+	New-Item "$tree\a\b" -ItemType Directory -Force | Out-Null
+	Assert-True (@(Get-ChildItem -Force "$tree\a\b").Count -eq 0) "recreated $tree\a\b is not empty"
+	Remove-Item -Recurse -Force $tree
+  }
+}
+
 $ifstest_user = "dokan_ifstest"
 $ifstest_pass = "D0kan_1fstest"
 # TODO: read password from command-line or file to keep dev-machines secure
@@ -27,6 +78,13 @@ $Configs = @(
 		"MemFSArguments" = "/l $DokanDriverLetter";
 		"Destination" = "$($DokanDriverLetter):";
 		"Name" = "drive";
+	},
+	@{
+		"MemFSArguments" = "/l $DokanDriverLetter /k 1000 /j 0x10600000";
+		"Destination" = "$($DokanDriverLetter):";
+		"Name" = "driveOptIn";
+		# The opt-in options relax what IFSTest checks, see options_test.ps1.
+		"OptIn" = $true;
 	}
 )
 
@@ -156,7 +214,20 @@ foreach ($mfs in $Memfs) {
 		Exec-External {& .\winfstest\TestSuite\run-winfstest.bat . "$($destination)\"}
 		Write-Host "WinFSTest finished" -ForegroundColor Green
 
-		if ($destination -match "[a-zA-Z]:") {
+		Write-Host "Start pattern test" -ForegroundColor Green
+		& .\pattern_test.ps1 -Destination "$($destination)\" -DokanLibrary $DokanLibrary -CaseSensitive
+		Write-Host "Pattern test finished" -ForegroundColor Green
+
+		Write-Host "Start memfs test" -ForegroundColor Green
+		Test-MemfsStreams "$($destination)\"
+		Test-MemfsTreeRemoval "$($destination)\"
+		Write-Host "Memfs test finished" -ForegroundColor Green
+
+		if ($Config.Item("OptIn")) {
+			Write-Host "Start options test" -ForegroundColor Green
+			& .\options_test.ps1 -Destination "$($destination)\"
+			Write-Host "Options test finished" -ForegroundColor Green
+		} elseif ($destination -match "[a-zA-Z]:") {
 			Write-Host "Start IFSTest" -ForegroundColor Green
 			Exec-External {& "..\scripts\run_ifstest.ps1" @ifstestParameters "$($destination)\"}
 			Write-Host "IFSTest finished" -ForegroundColor Green
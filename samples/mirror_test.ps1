@@ -1,5 +1,7 @@
 param(
-    [Parameter(Mandatory=$false)][Array] $Mirrors = @("..\x64\Release\mirror.exe", "..\Win32\Release\mirror.exe")
+    [Parameter(Mandatory=$false)][Array] $Mirrors = @("..\x64\Release\mirror.exe", "..\Win32\Release\mirror.exe"),
+    # Library of the bitness of PowerShell the pattern test compares the listings with.
+    [Parameter(Mandatory=$false)][string] $DokanLibrary = (Join-Path (Split-Path $Mirrors[0]) "dokan2.dll")
 )
 #TODO: enable specifying own mirror-commands and own test-commands
 #TODO: move compilation of test tools to separate scripts in scripts
@@ -53,6 +55,13 @@ $Configs = @(
 		"MirrorArguments" = "/l $DokanDriverLetter /n \myfs\dokan";
 		"Destination" = "\\myfs\dokan";
 		"Name" = "netUnc";
+	},
+	@{
+		"MirrorArguments" = "/l $DokanDriverLetter /u 1000 /j 0x10600000";
+		"Destination" = "$($DokanDriverLetter):";
+		"Name" = "driveOptIn";
+		# The opt-in options relax what IFSTest checks, see options_test.ps1.
+		"OptIn" = $true;
 	}
 )
 
@@ -189,7 +198,15 @@ foreach ($mirror in $Mirrors) {
 		Exec-External {& .\winfstest\TestSuite\run-winfstest.bat . "$($destination)\"}
 		Write-Host "WinFSTest finished" -ForegroundColor Green
 
-		if ($destination -match "[a-zA-Z]:") {
+		Write-Host "Start pattern test" -ForegroundColor Green
+		& .\pattern_test.ps1 -Destination "$($destination)\" -DokanLibrary $DokanLibrary
+		Write-Host "Pattern test finished" -ForegroundColor Green
+
+		if ($Config.Item("OptIn")) {
+			Write-Host "Start options test" -ForegroundColor Green
+			& .\options_test.ps1 -Destination "$($destination)\"
+			Write-Host "Options test finished" -ForegroundColor Green
+		} elseif ($destination -match "[a-zA-Z]:") {
 			Write-Host "Start IFSTest" -ForegroundColor Green
 			Exec-External {& "..\scripts\run_ifstest.ps1" @ifstestParameters "$($destination)\"}
 			Write-Host "IFSTest finished" -ForegroundColor Green
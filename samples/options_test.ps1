@@ -0,0 +1,105 @@
+param(
+    [Parameter(Mandatory=$true)][string] $Destination
+)
+# Checks what the opt-in options of the library and the driver must keep
+# visible to applications, on a file system mounted with them. The generic
+# test suites do not look at these cases.
+
+function Assert-True([bool] $Condition, [string] $Message) {
+	if (!$Condition) {
+		throw ("Options test failed: $Message")
+	}
+}
+
+$root = Join-Path $Destination "optionstest"
+if (Test-Path $root) { Remove-Item -Recurse -Force $root }
+New-Item $root -type directory | Out-Null
+
+# NegativeCacheTimeoutMs: the paths created through the mount show up right
+# away, however they get there.
+Write-Host "Check negative cache" -ForegroundColor Green
+$missing = Join-Path $root "missing"
+Assert-True (!(Test-Path $missing)) "$missing exists"
+Assert-True (!(Test-Path $missing)) "$missing exists"
+New-Item $missing -ItemType File | Out-Null
+Assert-True (Test-Path $missing) "created $missing is not found"
+$renamed = Join-Path $root "renamed"
+Assert-True (!(Test-Path $renamed)) "$renamed exists"
+Rename-Item $missing "renamed"
+Assert-True (Test-Path $renamed) "rename target $renamed is not found"
+Assert-True (!(Test-Path $missing)) "rename source $missing still exists"
+$missingDir = Join-Path $root "missingdir"
+Assert-True (!(Test-Path "$missingDir\child")) "$missingDir\child exists"
+New-Item "$missingDir\child" -ItemType Directory -Force | Out-Null
+Assert-True (Test-Path "$missingDir\child") "created $missingDir\child is not found"
+
+function Get-Listing([string] $Path) {
+	@(Get-ChildItem -Force $Path | ForEach-Object { $_.Name } | Sort-Object) -join "/"
+}
+
+# DirectoryListCacheTimeoutMs: the listings follow the changes made through the
+# mount, and the sizes of the files written through a handle once it is closed.
+Write-Host "Check directory listing cache" -ForegroundColor Green
+$list = Join-Path $root "list"
+New-Item "$list\a" -ItemType File -Force | Out-Null
+Assert-True ((Get-Listing $list) -eq "a") "listing of $list is not a"
+New-Item "$list\b" -ItemType File | Out-Null
+Assert-True ((Get-Listing $list) -eq "a/b") "created file missing from the listing of $list"
+Remove-Item "$list\a"
+Assert-True ((Get-Listing $list) -eq "b") "deleted file still in the listing of $list"
+$stream = [System.IO.File]::Open("$list\b", "Open", "Write")
+$stream.Write((New-Object byte[] 100), 0, 100)
+$stream.Dispose()
+Assert-True ((Get-ChildItem $list | Where-Object { $_.Name -eq "b" }).Length -eq 100) "listing of $list does not show the written size"
+New-Item "$list\sub\inner\f1" -ItemType File -Force | Out-Null
+Assert-True ((Get-Listing "$list\sub\inner") -eq "f1") "listing of $list\sub\inner is not f1"
+Rename-Item "$list\sub" "sub2"
+New-Item "$list\sub\inner" -ItemType Directory -Force | Out-Null
+Assert-True ((Get-Listing "$list\sub\inner") -eq "") "listing of the renamed directory $list\sub\inner is kept"
+Assert-True ((Get-Listing "$list\sub2\inner") -eq "f1") "listing of $list\sub2\inner is not f1"
+
+# DOKAN_OPTION_BATCH_CLOSE: the files closed in batches can be deleted and their
+# directory removed right after.
+Write-Host "Check batched closes" -ForegroundColor Green
+$closes = Join-Path $root "closes"
+New-Item $closes -ItemType Directory | Out-Null
+for ($i = 0; $i -lt 200; ++$i) {
+	[System.IO.File]::Create("$closes\$i").Dispose()
+	[System.IO.File]::OpenRead("$closes\$i").Dispose()
+}
+for ($i = 0; $i -lt 200; ++$i) {
+	Remove-Item "$closes\$i"
+}
+Remove-Item $closes
+Assert-True (!(Test-Path $closes)) "$closes still exists"
+
+# DOKAN_OPTION_DEFER_BASIC_INFO: the times and attributes set through a handle
+# are seen by new handles and listings once it is closed.
+Write-Host "Check deferred basic information" -ForegroundColor Green
+$times = Join-Path $root "times"
+New-Item $times -ItemType File | Out-Null
+$time = New-Object DateTime 2001, 2, 3, 4, 5, 6, ([DateTimeKind]::Utc)
+[System.IO.File]::SetLastWriteTimeUtc($times, $time)
+Assert-True ((Get-Item $times).LastWriteTimeUtc -eq $time) "$times does not have the time set"
+Assert-True ((Get-ChildItem $root | Where-Object { $_.Name -eq "times" }).LastWriteTimeUtc -eq $time) "listing of $root does not show the time set"
+[System.IO.File]::SetAttributes($times, "Hidden")
+Assert-True (((Get-Item -Force $times).Attributes -band [System.IO.FileAttributes]::Hidden) -ne 0) "$times is not hidden"
+Assert-True (((Get-ChildItem -Force $root | Where-Object { $_.Name -eq "times" }).Attributes -band [System.IO.FileAttributes]::Hidden) -ne 0) "listing of $root does not show $times hidden"
+[System.IO.File]::SetAttributes($times, "Normal")
+
+# DOKAN_OPTION_ASYNC_CLEANUP: closing a handle does not wait for Cleanup, which
+# must not make the next opens of the file fail, exclusive or not.
+Write-Host "Check asynchronous cleanup" -ForegroundColor Green
+$cleanup = Join-Path $root "cleanup"
+[System.IO.File]::WriteAllBytes($cleanup, (New-Object byte[] 10))
+for ($i = 0; $i -lt 200; ++$i) {
+	[System.IO.File]::Open($cleanup, "Open", "Read", "None").Dispose()
+	[System.IO.File]::Open($cleanup, "Open", "Read", "ReadWrite, Delete").Dispose()
+	[System.IO.File]::Open($cleanup, "Open", "ReadWrite", "None").Dispose()
+}
+$stream = [System.IO.File]::Open($cleanup, "Open", "Read", "ReadWrite, Delete")
+$stream.Dispose()
+Remove-Item $cleanup
+Assert-True (!(Test-Path $cleanup)) "$cleanup still exists"
+
+Remove-Item -Recurse -Force $root
@@ -0,0 +1,182 @@
+param(
+    [Parameter(Mandatory=$true)][string] $Destination,
+    [Parameter(Mandatory=$false)][string] $DokanLibrary = "..\x64\Release\dokan2.dll",
+    [Parameter(Mandatory=$false)][int] $Iterations = 2000,
+    [Parameter(Mandatory=$false)][int] $Seed = (Get-Random),
+    # Whether the file system is mounted with DOKAN_OPTION_CASE_SENSITIVE.
+    [Parameter(Mandatory=$false)][switch] $CaseSensitive
+)
+# Compares the directory listings filtered by the library, which compiles the
+# search pattern of each query, with DokanIsNameInExpression over randomized
+# names and patterns. $Destination has to be the root of a mounted file system
+# that implements FindFiles or FindFilesWithCursor but not
+# FindFilesWithPattern, like memfs and mirror.
+
+if (-not ("DokanPatternTest" -as [type])) {
+	Add-Type -TypeDefinition @"
+using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+using Microsoft.Win32.SafeHandles;
+
+public static class DokanPatternTest {
+	[StructLayout(LayoutKind.Sequential)]
+	struct IO_STATUS_BLOCK { public IntPtr Status; public IntPtr Information; }
+
+	[StructLayout(LayoutKind.Sequential)]
+	struct UNICODE_STRING { public ushort Length; public ushort MaximumLength; public IntPtr Buffer; }
+
+	const int FileNamesInformation = 12;
+	const int STATUS_NO_MORE_FILES = unchecked((int)0x80000006);
+	const int STATUS_NO_SUCH_FILE = unchecked((int)0xC000000F);
+
+	[DllImport("kernel32.dll", CharSet = CharSet.Unicode, SetLastError = true)]
+	static extern IntPtr LoadLibraryW(string lpLibFileName);
+
+	[DllImport("kernel32.dll", CharSet = CharSet.Unicode, SetLastError = true)]
+	static extern SafeFileHandle CreateFileW(string lpFileName, uint dwDesiredAccess,
+		uint dwShareMode, IntPtr lpSecurityAttributes, uint dwCreationDisposition,
+		uint dwFlagsAndAttributes, IntPtr hTemplateFile);
+
+	[DllImport("ntdll.dll")]
+	static extern int NtQueryDirectoryFile(SafeFileHandle FileHandle, IntPtr Event,
+		IntPtr ApcRoutine, IntPtr ApcContext, out IO_STATUS_BLOCK IoStatusBlock,
+		IntPtr FileInformation, uint Length, int FileInformationClass,
+		[MarshalAs(UnmanagedType.U1)] bool ReturnSingleEntry, ref UNICODE_STRING FileName,
+		[MarshalAs(UnmanagedType.U1)] bool RestartScan);
+
+	[DllImport("dokan2.dll", CharSet = CharSet.Unicode)]
+	[return: MarshalAs(UnmanagedType.Bool)]
+	public static extern bool DokanIsNameInExpression(string Expression, string Name,
+		[MarshalAs(UnmanagedType.Bool)] bool IgnoreCase);
+
+	public static List<string> Filter(List<string> names, string pattern, bool ignoreCase) {
+		var matches = new List<string>();
+		foreach (var name in names) {
+			if (DokanIsNameInExpression(pattern, name, ignoreCase)) {
+				matches.Add(name);
+			}
+		}
+		return matches;
+	}
+
+	public static void Load(string path) {
+		if (LoadLibraryW(path) == IntPtr.Zero) {
+			throw new System.ComponentModel.Win32Exception();
+		}
+	}
+
+	// Lists Directory with Pattern given as is to the file system, unlike
+	// FindFirstFile which rewrites some wildcards.
+	public static List<string> Query(string directory, string pattern) {
+		var names = new List<string>();
+		using (var handle = CreateFileW(directory, 1 /* FILE_LIST_DIRECTORY */, 7, IntPtr.Zero,
+			3 /* OPEN_EXISTING */, 0x02000000 /* FILE_FLAG_BACKUP_SEMANTICS */, IntPtr.Zero)) {
+			if (handle.IsInvalid) {
+				throw new System.ComponentModel.Win32Exception();
+			}
+			int size = 64 * 1024;
+			IntPtr buffer = Marshal.AllocHGlobal(size);
+			IntPtr patternBuffer = Marshal.StringToHGlobalUni(pattern);
+			try {
+				var fileName = new UNICODE_STRING {
+					Length = (ushort)(pattern.Length * 2),
+					MaximumLength = (ushort)(pattern.Length * 2),
+					Buffer = patternBuffer
+				};
+				bool restart = true;
+				while (true) {
+					IO_STATUS_BLOCK iosb;
+					int status = NtQueryDirectoryFile(handle, IntPtr.Zero, IntPtr.Zero, IntPtr.Zero,
+						out iosb, buffer, (uint)size, FileNamesInformation, false, ref fileName,
+						restart);
+					restart = false;
+					if (status == STATUS_NO_MORE_FILES || status == STATUS_NO_SUCH_FILE) {
+						break;
+					}
+					if (status < 0) {
+						throw new InvalidOperationException(String.Format(
+							"NtQueryDirectoryFile failed with 0x{0:X8} for pattern {1}", status, pattern));
+					}
+					int offset = 0;
+					while (true) {
+						IntPtr entry = IntPtr.Add(buffer, offset);
+						int next = Marshal.ReadInt32(entry, 0);
+						int length = Marshal.ReadInt32(entry, 8);
+						names.Add(Marshal.PtrToStringUni(IntPtr.Add(entry, 12), length / 2));
+						if (next == 0) {
+							break;
+						}
+						offset += next;
+					}
+				}
+			} finally {
+				Marshal.FreeHGlobal(patternBuffer);
+				Marshal.FreeHGlobal(buffer);
+			}
+		}
+		return names;
+	}
+}
+"@
+}
+
+[DokanPatternTest]::Load((Resolve-Path $DokanLibrary).Path)
+
+Write-Host "Pattern test with seed $Seed" -ForegroundColor Green
+$random = New-Object System.Random $Seed
+
+# Long names go through the vectorized upcasing, the accented ones through the
+# scalar one.
+$nameChars = "aAbBcCxX09_-.~" + [char]0x00E9 + [char]0x00C9 + [char]0x00DF
+$patternChars = $nameChars + "*?<>`""
+
+function Get-RandomString([string] $chars, [int] $length) {
+	-join (1..$length | ForEach-Object { $chars[$random.Next($chars.Length)] })
+}
+
+function Get-RandomCase([string] $text) {
+	-join ($text.ToCharArray() | ForEach-Object {
+		if ($random.Next(2) -eq 0) { [char]::ToUpperInvariant($_) } else { [char]::ToLowerInvariant($_) }
+	})
+}
+
+$directory = Join-Path $Destination "patterntest"
+if (Test-Path $directory) { Remove-Item -Recurse -Force $directory }
+New-Item $directory -type directory | Out-Null
+
+$names = New-Object System.Collections.Generic.List[string]
+$comparer = if ($CaseSensitive) { [StringComparer]::Ordinal } else { [StringComparer]::OrdinalIgnoreCase }
+$seen = New-Object System.Collections.Generic.HashSet[string] ($comparer)
+while ($names.Count -lt 200) {
+	$length = if ($random.Next(4) -eq 0) { $random.Next(16, 48) } else { $random.Next(1, 16) }
+	$name = Get-RandomString $nameChars $length
+	# Windows strips the trailing dots and does not accept the "." and ".." names.
+	if ($name.EndsWith(".") -or -not $seen.Add($name)) { continue }
+	New-Item -Path (Join-Path $directory $name) -ItemType File | Out-Null
+	$names.Add($name)
+}
+
+for ($i = 0; $i -lt $Iterations; ++$i) {
+	$name = $names[$random.Next($names.Count)]
+	$start = $random.Next($name.Length)
+	$part = $name.Substring($start, $random.Next(1, $name.Length - $start + 1))
+	# The common forms the compiled patterns have a fast path for, and others.
+	switch ($random.Next(7)) {
+		0 { $pattern = "*" }
+		1 { $pattern = Get-RandomCase $name }
+		2 { $pattern = (Get-RandomCase $name.Substring(0, $start + 1)) + "*" }
+		3 { $pattern = "*" + (Get-RandomCase $name.Substring($start)) }
+		4 { $pattern = "*" + (Get-RandomCase $part) + "*" }
+		default { $pattern = Get-RandomString $patternChars ($random.Next(1, 12)) }
+	}
+
+	$expected = @([DokanPatternTest]::Filter($names, $pattern, -not $CaseSensitive) | Sort-Object -CaseSensitive) -join "/"
+	$actual = @([DokanPatternTest]::Query($directory, $pattern) | Where-Object { $_ -ne "." -and $_ -ne ".." } | Sort-Object -CaseSensitive) -join "/"
+	if ($expected -cne $actual) {
+		throw ("Listing of pattern `"$pattern`" (seed $Seed) returned [$actual] instead of [$expected]")
+	}
+}
+
+Remove-Item -Recurse -Force $directory
+Write-Host "Pattern test passed $Iterations patterns" -ForegroundColor Green
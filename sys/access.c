@@ -26,7 +26,6 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 NTSTATUS
 DokanGetAccessToken(__in PREQUEST_CONTEXT RequestContext) {
   KIRQL oldIrql = 0;
-  PLIST_ENTRY thisEntry, nextEntry, listHead;
   PIRP_ENTRY irpEntry;
   PEVENT_INFORMATION eventInfo = NULL;
   PACCESS_TOKEN accessToken;
@@ -57,26 +56,13 @@ DokanGetAccessToken(__in PREQUEST_CONTEXT RequestContext) {
     KeAcquireSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, &oldIrql);
     hasLock = TRUE;
 
-    // search corresponding IRP through pending IRP list
-    listHead = &RequestContext->Dcb->PendingIrp.ListHead;
-
-    for (thisEntry = listHead->Flink; thisEntry != listHead;
-         thisEntry = nextEntry) {
-
-      nextEntry = thisEntry->Flink;
-
-      irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-      if (irpEntry->SerialNumber != eventInfo->SerialNumber) {
-        continue;
-      }
-
-      // this irp must be IRP_MJ_CREATE
-      if (irpEntry->RequestContext.IrpSp->Parameters.Create.SecurityContext) {
-        accessState = irpEntry->RequestContext.IrpSp->Parameters.Create
-                          .SecurityContext->AccessState;
-      }
-      break;
+    irpEntry =
+        DokanLookupPendingIrp(RequestContext->Dcb, eventInfo->SerialNumber);
+    // this irp must be IRP_MJ_CREATE
+    if (irpEntry != NULL &&
+        irpEntry->RequestContext.IrpSp->Parameters.Create.SecurityContext) {
+      accessState = irpEntry->RequestContext.IrpSp->Parameters.Create
+                        .SecurityContext->AccessState;
     }
     KeReleaseSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, oldIrql);
     hasLock = FALSE;
@@ -113,3 +99,23 @@ DokanGetAccessToken(__in PREQUEST_CONTEXT RequestContext) {
   }
   return status;
 }
+
+VOID DokanQueryRequestorTokenIds(__in PSECURITY_SUBJECT_CONTEXT SubjectContext,
+                                 __out PLUID AuthenticationId,
+                                 __out PLUID TokenId) {
+  PACCESS_TOKEN accessToken;
+  PTOKEN_STATISTICS statistics = NULL;
+
+  RtlZeroMemory(AuthenticationId, sizeof(LUID));
+  RtlZeroMemory(TokenId, sizeof(LUID));
+  accessToken = SeQuerySubjectContextToken(SubjectContext);
+  if (accessToken == NULL) {
+    return;
+  }
+  if (NT_SUCCESS(SeQueryInformationToken(accessToken, TokenStatistics,
+                                         (PVOID *)&statistics))) {
+    *AuthenticationId = statistics->AuthenticationId;
+    *TokenId = statistics->TokenId;
+    ExFreePool(statistics);
+  }
+}
@@ -22,6 +22,78 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokan.h"
 
+// Whether the cleanup can be completed without waiting for user mode, with
+// DOKAN_EVENT_ASYNC_CLEANUP. Deleting the file, releasing byte range locks,
+// ending the last write access to it and closing a handle that denied some
+// sharing stay synchronous, as the next opens of the file depend on user mode
+// having handled them. File systems commonly keep the share mode of a handle
+// in a backing handle they close in Cleanup. Called with the FCB lock.
+static BOOLEAN CanCleanupAsynchronously(__in PREQUEST_CONTEXT RequestContext,
+                                        __in PDokanFCB Fcb,
+                                        __in PDokanCCB Ccb,
+                                        __in PFILE_OBJECT FileObject) {
+  if (!RequestContext->Dcb->AsyncCleanup ||
+      RequestContext->Dcb->FileLockInUserMode) {
+    return FALSE;
+  }
+  if (DokanCCBFlagsIsSet(Ccb, DOKAN_DELETE_ON_CLOSE) ||
+      DokanFCBFlagsIsSet(Fcb, DOKAN_DELETE_ON_CLOSE)) {
+    return FALSE;
+  }
+  if (FsRtlAreThereCurrentOrInProgressFileLocks(&Fcb->FileLock)) {
+    return FALSE;
+  }
+  if ((FileObject->ReadAccess || FileObject->WriteAccess ||
+       FileObject->DeleteAccess) &&
+      !(FileObject->SharedRead && FileObject->SharedWrite &&
+        FileObject->SharedDelete)) {
+    return FALSE;
+  }
+  return !FileObject->WriteAccess || Fcb->ShareAccess.Writers > 1;
+}
+
+// What is left of the cleanup once user mode handled it, or right away for an
+// asynchronous cleanup.
+static VOID CompleteCleanup(__in PREQUEST_CONTEXT RequestContext,
+                            __in PDokanCCB Ccb,
+                            __in PFILE_OBJECT FileObject) {
+  PDokanFCB fcb = Ccb->Fcb;
+
+  // File systems commonly update the times of the file on cleanup.
+  DokanInvalidateFileInfoCache(fcb);
+
+  DokanFCBLockRW(fcb);
+
+  IoRemoveShareAccess(FileObject, &fcb->ShareAccess);
+
+  if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_CHANGE_LAST_WRITE)) {
+    DokanNotifyReportChange(RequestContext, fcb,
+                            FILE_NOTIFY_CHANGE_LAST_WRITE,
+                            FILE_ACTION_MODIFIED);
+  }
+
+  if (DokanFCBFlagsIsSet(fcb, DOKAN_DELETE_ON_CLOSE)) {
+    if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
+      DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_DIR_NAME,
+                              FILE_ACTION_REMOVED);
+    } else {
+      DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_FILE_NAME,
+                              FILE_ACTION_REMOVED);
+    }
+  }
+  DokanFCBUnlock(fcb);
+  //
+  //  Unlock all outstanding file locks.
+  //
+  (VOID) FsRtlFastUnlockAll(&fcb->FileLock, FileObject,
+                            IoGetRequestorProcess(RequestContext->Irp), NULL);
+
+  if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
+    FsRtlNotifyCleanup(RequestContext->Vcb->NotifySync,
+                       &RequestContext->Vcb->DirNotifyList, Ccb);
+  }
+}
+
 NTSTATUS
 DokanDispatchCleanup(__in PREQUEST_CONTEXT RequestContext)
 
@@ -48,12 +120,20 @@ Return Value:
   PDokanFCB fcb = NULL;
   PEVENT_CONTEXT eventContext;
   ULONG eventLength;
+  BOOLEAN asynchronous = FALSE;
   DOKAN_INIT_LOGGER(logger, RequestContext->DeviceObject->DriverObject,
                     IRP_MJ_CLEANUP);
 
   fileObject = RequestContext->IrpSp->FileObject;
   DOKAN_LOG_FINE_IRP(RequestContext, "FileObject=%p", fileObject);
 
+  // The handle that registered the event ring is going away: unlock the ring
+  // pages while we are still in the context of the owning process.
+  if (fileObject != NULL && RequestContext->Vcb == NULL &&
+      RequestContext->Dcb != NULL) {
+    DokanEventRingRelease(RequestContext->Dcb, fileObject);
+  }
+
   // Cleanup must be success in any case
   if (fileObject == NULL || RequestContext->Vcb == NULL ||
       !DokanCheckCCB(RequestContext, fileObject->FsContext2)) {
@@ -67,6 +147,8 @@ Return Value:
   ASSERT(fcb != NULL);
 
   OplockDebugRecordMajorFunction(fcb, IRP_MJ_CLEANUP);
+  // Nobody is left to report a failure of the writes held back by the handle.
+  (VOID)DokanFlushWriteBehind(RequestContext, ccb);
   if (fcb->IsKeepalive) {
     DokanFCBLockRW(fcb);
     BOOLEAN shouldUnmount = ccb->IsKeepaliveActive;
@@ -110,6 +192,11 @@ Return Value:
   eventContext->Context = ccb->UserContext;
   eventContext->FileFlags |= DokanCCBFlagsGet(ccb);
 
+  if (RequestContext->Dcb->DeferBasicInfo) {
+    DokanTakeDeferredBasicInfo(fcb,
+                               &eventContext->Operation.Cleanup.DeferredBasicInfo);
+  }
+
   // copy the filename to EventContext from ccb
   eventContext->Operation.Cleanup.FileNameLength = fcb->FileName.Length;
   RtlCopyMemory(eventContext->Operation.Cleanup.FileName,
@@ -119,6 +206,14 @@ Return Value:
   status = DokanCheckOplock(fcb, RequestContext->Irp, eventContext,
                             DokanOplockComplete,
                             DokanPrePostIrp);
+  // Decided once the IRP can no longer be posted, as a posted cleanup waits
+  // for the reply of user mode.
+  if (status == STATUS_SUCCESS &&
+      CanCleanupAsynchronously(RequestContext, fcb, ccb, fileObject)) {
+    asynchronous = TRUE;
+    DokanCCBFlagsSetBit(ccb, DOKAN_ASYNC_CLEANUP);
+    eventContext->FileFlags |= DOKAN_ASYNC_CLEANUP;
+  }
   DokanFCBUnlock(fcb);
 
   //
@@ -134,6 +229,13 @@ Return Value:
     return status;
   }
 
+  if (asynchronous) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Cleanup completed asynchronously");
+    CompleteCleanup(RequestContext, ccb, fileObject);
+    DokanEventNotification(RequestContext, eventContext);
+    return STATUS_SUCCESS;
+  }
+
   // register this IRP to pending IRP list
   return DokanRegisterPendingIrp(RequestContext, eventContext);
 }
@@ -141,7 +243,6 @@ Return Value:
 VOID DokanCompleteCleanup(__in PREQUEST_CONTEXT RequestContext,
                           __in PEVENT_INFORMATION EventInfo) {
   PDokanCCB ccb;
-  PDokanFCB fcb;
   PFILE_OBJECT fileObject;
 
   DOKAN_LOG_FINE_IRP(RequestContext, "FileObject=%p",
@@ -154,39 +255,7 @@ VOID DokanCompleteCleanup(__in PREQUEST_CONTEXT RequestContext,
   ASSERT(ccb != NULL);
   ccb->UserContext = EventInfo->Context;
 
-  fcb = ccb->Fcb;
-  ASSERT(fcb != NULL);
-
-  DokanFCBLockRW(fcb);
-
-  IoRemoveShareAccess(RequestContext->IrpSp->FileObject, &fcb->ShareAccess);
-
-  if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_CHANGE_LAST_WRITE)) {
-    DokanNotifyReportChange(RequestContext, fcb,
-                            FILE_NOTIFY_CHANGE_LAST_WRITE,
-                            FILE_ACTION_MODIFIED);
-  }
-
-  if (DokanFCBFlagsIsSet(fcb, DOKAN_DELETE_ON_CLOSE)) {
-    if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
-      DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_DIR_NAME,
-                              FILE_ACTION_REMOVED);
-    } else {
-      DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_FILE_NAME,
-                              FILE_ACTION_REMOVED);
-    }
-  }
-  DokanFCBUnlock(fcb);
-  //
-  //  Unlock all outstanding file locks.
-  //
-  (VOID) FsRtlFastUnlockAll(&fcb->FileLock, fileObject,
-                            IoGetRequestorProcess(RequestContext->Irp), NULL);
-
-  if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
-    FsRtlNotifyCleanup(RequestContext->Vcb->NotifySync,
-                       &RequestContext->Vcb->DirNotifyList, ccb);
-  }
+  CompleteCleanup(RequestContext, ccb, fileObject);
 
   RequestContext->Irp->IoStatus.Status = EventInfo->Status;
 }
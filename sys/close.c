@@ -94,6 +94,15 @@ Return Value:
     return STATUS_SUCCESS;
   }
 
+  if (DokanBatchClose(RequestContext, ccb, &fcb->FileName)) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Batched UserContext:%X",
+                       (ULONG)ccb->UserContext);
+    DokanFreeCCB(RequestContext, ccb);
+    DokanFCBUnlock(fcb);
+    DokanFreeFCB(RequestContext->Vcb, fcb);
+    return STATUS_SUCCESS;
+  }
+
   eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
   eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
 
@@ -121,7 +130,7 @@ Return Value:
   // Close can not be pending status don't register this IRP
 
   // inform it to user-mode
-  DokanEventNotification(RequestContext, &RequestContext->Dcb->NotifyEvent, eventContext);
+  DokanEventNotification(RequestContext, eventContext);
 
   return STATUS_SUCCESS;
 }
@@ -0,0 +1,128 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Batched delivery of closes.
+//
+// With DOKAN_EVENT_BATCH_CLOSE set, DokanDispatchClose does not send an
+// IRP_MJ_CLOSE event per handle. It appends the user context, the file flags
+// and the file name of the handle to a single DOKAN_IRP_CLOSE_BATCH event,
+// which is sent once DOKAN_CLOSE_BATCH_SIZE is reached or DOKAN_CLOSE_BATCH_DELAY
+// after its first close, by the notification thread. Closes are completed
+// before being sent either way, so holding them back only delays when the file
+// system releases the handle.
+
+#define CLOSE_BATCH_HEADER_LENGTH                                              \
+  (sizeof(EVENT_CONTEXT) + FIELD_OFFSET(DOKAN_CLOSE_BATCH, Entries[0]))
+
+static PDOKAN_CLOSE_BATCH GetCloseBatch(__in PEVENT_CONTEXT EventContext) {
+  return (PDOKAN_CLOSE_BATCH)((PCHAR)EventContext + sizeof(EVENT_CONTEXT));
+}
+
+BOOLEAN DokanBatchClose(__in PREQUEST_CONTEXT RequestContext,
+                        __in PDokanCCB Ccb, __in PUNICODE_STRING FileName) {
+  PDokanDCB dcb = RequestContext->Dcb;
+  PEVENT_CONTEXT fullBatch = NULL;
+  PEVENT_CONTEXT eventContext;
+  PDOKAN_CLOSE_BATCH batch;
+  PDOKAN_CLOSE_BATCH_ENTRY entry;
+  ULONG entryLength;
+  LARGE_INTEGER dueTime;
+  BOOLEAN batched = FALSE;
+  KIRQL oldIrql;
+
+  if (!dcb->BatchClose || IsUnmountPendingVcb(RequestContext->Vcb)) {
+    return FALSE;
+  }
+  entryLength =
+      ALIGN_UP_BY(FIELD_OFFSET(DOKAN_CLOSE_BATCH_ENTRY, FileName[0]) +
+                      FileName->Length + sizeof(WCHAR),
+                  sizeof(ULONG64));
+  if (CLOSE_BATCH_HEADER_LENGTH + entryLength > DOKAN_CLOSE_BATCH_SIZE) {
+    return FALSE;
+  }
+
+  KeAcquireSpinLock(&dcb->CloseBatchLock, &oldIrql);
+  if (dcb->CloseBatch != NULL &&
+      dcb->CloseBatch->Length + entryLength > DOKAN_CLOSE_BATCH_SIZE) {
+    fullBatch = dcb->CloseBatch;
+    dcb->CloseBatch = NULL;
+  }
+  if (dcb->CloseBatch == NULL) {
+    eventContext = AllocateEventContextRaw(DOKAN_CLOSE_BATCH_SIZE);
+    if (eventContext != NULL) {
+      eventContext->Length = CLOSE_BATCH_HEADER_LENGTH;
+      eventContext->MountId = dcb->MountId;
+      eventContext->MajorFunction = DOKAN_IRP_CLOSE_BATCH;
+      dcb->CloseBatch = eventContext;
+      dueTime.QuadPart = -(LONGLONG)DOKAN_CLOSE_BATCH_DELAY * 10000;
+      KeSetTimer(&dcb->CloseBatchTimer, dueTime, NULL);
+    }
+  }
+  eventContext = dcb->CloseBatch;
+  if (eventContext != NULL) {
+    batch = GetCloseBatch(eventContext);
+    entry = (PDOKAN_CLOSE_BATCH_ENTRY)((PCHAR)eventContext +
+                                       eventContext->Length);
+    entry->Context = Ccb->UserContext;
+    entry->FileFlags = DokanCCBFlagsGet(Ccb);
+    entry->NextEntryOffset = entryLength;
+    entry->FileNameLength = FileName->Length;
+    RtlCopyMemory(entry->FileName, FileName->Buffer, FileName->Length);
+    entry->FileName[FileName->Length / sizeof(WCHAR)] = L'\0';
+    eventContext->Length += entryLength;
+    ++batch->EntryCount;
+    batched = TRUE;
+  }
+  KeReleaseSpinLock(&dcb->CloseBatchLock, oldIrql);
+
+  if (fullBatch != NULL) {
+    DokanQueueEvent(dcb, fullBatch);
+  }
+  return batched;
+}
+
+VOID DokanFlushCloseBatch(__in PDokanDCB Dcb) {
+  PEVENT_CONTEXT eventContext;
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&Dcb->CloseBatchLock, &oldIrql);
+  eventContext = Dcb->CloseBatch;
+  Dcb->CloseBatch = NULL;
+  KeReleaseSpinLock(&Dcb->CloseBatchLock, oldIrql);
+  if (eventContext != NULL) {
+    DokanQueueEvent(Dcb, eventContext);
+  }
+}
+
+VOID DokanFreeCloseBatch(__in PDokanDCB Dcb) {
+  PEVENT_CONTEXT eventContext;
+  KIRQL oldIrql;
+
+  KeCancelTimer(&Dcb->CloseBatchTimer);
+  KeAcquireSpinLock(&Dcb->CloseBatchLock, &oldIrql);
+  eventContext = Dcb->CloseBatch;
+  Dcb->CloseBatch = NULL;
+  KeReleaseSpinLock(&Dcb->CloseBatchLock, oldIrql);
+  if (eventContext != NULL) {
+    DokanFreeEventContext(eventContext);
+  }
+}
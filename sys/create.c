@@ -106,6 +106,7 @@ DokanFreeCCB(__in PREQUEST_CONTEXT RequestContext, __in PDokanCCB ccb) {
   if (ccb->SearchPattern) {
     ExFreePool(ccb->SearchPattern);
   }
+  DokanFreeWriteBehind(ccb);
 
   ExFreeToLookasideListEx(&g_DokanCCBLookasideList, ccb);
   InterlockedIncrement(&fcb->Vcb->CcbFreed);
@@ -343,6 +344,17 @@ VOID DokanRetryCreateAfterOplockBreak(__in PVOID Context, __in PIRP Irp) {
   }
 }
 
+// Returns whether the create can only succeed if the file already exists, which
+// makes a STATUS_OBJECT_NAME_NOT_FOUND failure suitable for the negative cache.
+static BOOLEAN IsNegativeCacheableOpen(__in PREQUEST_CONTEXT RequestContext) {
+  ULONG options = RequestContext->IrpSp->Parameters.Create.Options;
+  DWORD disposition = (options >> 24) & 0x000000ff;
+
+  return (disposition == FILE_OPEN || disposition == FILE_OVERWRITE) &&
+         !(options & FILE_OPEN_BY_FILE_ID) &&
+         !(RequestContext->IrpSp->Flags & SL_OPEN_TARGET_DIRECTORY);
+}
+
 NTSTATUS
 DokanDispatchCreate(__in PREQUEST_CONTEXT RequestContext)
 
@@ -674,6 +686,18 @@ Return Value:
         fileName = NULL;
       }
     }
+    if (allocateCcb && IsNegativeCacheableOpen(RequestContext)) {
+      UNICODE_STRING fileNameUS =
+          DokanWrapUnicodeString(fileName, fileNameLength);
+      if (DokanLookupNegativeCache(RequestContext->Vcb, &fileNameUS)) {
+        DOKAN_LOG_FINE_IRP(RequestContext, "Known missing \"%wZ\"",
+                           &fileNameUS);
+        status = STATUS_OBJECT_NAME_NOT_FOUND;
+        ExFreePool(fileName);
+        fileName = NULL;
+        __leave;
+      }
+    }
     if (allocateCcb) {
       // Allocate an FCB or find one in the open list.
       if (RequestContext->IrpSp->Flags & SL_OPEN_TARGET_DIRECTORY) {
@@ -903,6 +927,20 @@ Return Value:
     }
     eventContext->Operation.Create.ShareAccess =
         RequestContext->IrpSp->Parameters.Create.ShareAccess;
+    if (RequestContext->IrpSp->Parameters.Create.SecurityContext->AccessState) {
+      DokanQueryRequestorTokenIds(
+          &RequestContext->IrpSp->Parameters.Create.SecurityContext
+               ->AccessState->SubjectSecurityContext,
+          &eventContext->Operation.Create.AuthenticationId,
+          &eventContext->Operation.Create.TokenId);
+    }
+    // Only plain opens of the file itself: anything that may create it needs
+    // the access of the requestor to its parent.
+    if (disposition == FILE_OPEN && parentDir == NULL &&
+        DokanCheckCachedAccess(RequestContext, fcb)) {
+      DOKAN_LOG_FINE_IRP(RequestContext, "Access granted from the cache");
+      eventContext->Operation.Create.Flags |= DOKAN_CREATE_ACCESS_CHECKED;
+    }
     eventContext->Operation.Create.FileNameLength =
         parentDir ? fileNameLength : fcb->FileName.Length;
     eventContext->Operation.Create.FileNameOffset =
@@ -1293,6 +1331,7 @@ VOID DokanCompleteCreate(__in PREQUEST_CONTEXT RequestContext,
                          __in PEVENT_INFORMATION EventInfo) {
   PDokanCCB ccb = NULL;
   PDokanFCB fcb = NULL;
+  PDOKAN_CREATE_FILE_INFO inlineInfo = NULL;
 
 
   ccb = RequestContext->IrpSp->FileObject->FsContext2;
@@ -1312,6 +1351,38 @@ VOID DokanCompleteCreate(__in PREQUEST_CONTEXT RequestContext,
       RequestContext->IrpSp->FileObject,
       DokanGetCreateInformationStr(RequestContext->Irp->IoStatus.Information));
 
+  // The reply can carry the attributes of the file, which replace the cached
+  // ones. Otherwise an overwrite or supersede makes them stale.
+  if (NT_SUCCESS(RequestContext->Irp->IoStatus.Status)) {
+    if (EventInfo->BufferLength >= sizeof(DOKAN_CREATE_FILE_INFO)) {
+      PDOKAN_CREATE_FILE_INFO createInfo =
+          (PDOKAN_CREATE_FILE_INFO)EventInfo->Buffer;
+      DokanFillFileInfoCacheFromCreate(RequestContext, fcb, createInfo);
+      // The sizes are only taken for the first open, later ones may race
+      // with cached writes.
+      if (fcb->FileCount == 1 &&
+          fcb->SectionObjectPointers.DataSectionObject == NULL) {
+        InterlockedExchange64(&fcb->AdvancedFCBHeader.AllocationSize.QuadPart,
+                              createInfo->AllocationSize.QuadPart);
+        InterlockedExchange64(&fcb->AdvancedFCBHeader.FileSize.QuadPart,
+                              createInfo->EndOfFile.QuadPart);
+      }
+      DOKAN_LOG_FINE_IRP(RequestContext,
+                         "Create reply attributes=0x%x EndOfFile=%lld",
+                         createInfo->FileAttributes,
+                         createInfo->EndOfFile.QuadPart);
+      // The start of a file opened as it is can follow, for its first reads.
+      if (createInfo->InlineDataLength > 0 &&
+          createInfo->InlineDataLength <=
+              EventInfo->BufferLength - sizeof(DOKAN_CREATE_FILE_INFO) &&
+          RequestContext->Irp->IoStatus.Information == FILE_OPENED) {
+        inlineInfo = createInfo;
+      }
+    } else if (RequestContext->Irp->IoStatus.Information != FILE_OPENED) {
+      DokanInvalidateFileInfoCache(fcb);
+    }
+  }
+
   // If volume is write-protected, we subbed FILE_OPEN for FILE_OPEN_IF
   // before call to userland in DokanDispatchCreate.
   // In this case, a not found error should return write protected status.
@@ -1340,6 +1411,11 @@ VOID DokanCompleteCreate(__in PREQUEST_CONTEXT RequestContext,
 
   if (NT_SUCCESS(RequestContext->Irp->IoStatus.Status)) {
     DokanCCBFlagsSetBit(ccb, DOKAN_FILE_OPENED);
+    DokanGrantLease(RequestContext, fcb, EventInfo->Operation.Create.LeaseLevel,
+                    EventInfo->Operation.Create.LeaseDurationMs);
+    DokanSetCacheHints(ccb, RequestContext->IrpSp->FileObject,
+                       EventInfo->Operation.Create.CacheHints,
+                       EventInfo->Operation.Create.ReadAheadGranularity);
   }
 
   // On Windows 8 and above, you can mark the file
@@ -1355,6 +1431,7 @@ VOID DokanCompleteCreate(__in PREQUEST_CONTEXT RequestContext,
 
   if (NT_SUCCESS(RequestContext->Irp->IoStatus.Status)) {
     if (RequestContext->Irp->IoStatus.Information == FILE_CREATED) {
+      DokanRemoveNegativeCacheEntry(RequestContext->Vcb, &fcb->FileName);
       if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
         DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_DIR_NAME,
                                 FILE_ACTION_ADDED);
@@ -1365,6 +1442,10 @@ VOID DokanCompleteCreate(__in PREQUEST_CONTEXT RequestContext,
     }
     ccb->AtomicOplockRequestPending = FALSE;
   } else {
+    if (RequestContext->Irp->IoStatus.Status == STATUS_OBJECT_NAME_NOT_FOUND &&
+        IsNegativeCacheableOpen(RequestContext)) {
+      DokanAddNegativeCacheEntry(RequestContext, &fcb->FileName);
+    }
     DokanMaybeBackOutAtomicOplockRequest(ccb, RequestContext->Irp);
     DokanFreeCCB(RequestContext, ccb);
     IoRemoveShareAccess(RequestContext->IrpSp->FileObject, &fcb->ShareAccess);
@@ -1376,4 +1457,11 @@ VOID DokanCompleteCreate(__in PREQUEST_CONTEXT RequestContext,
 
   if (fcb)
     DokanFCBUnlock(fcb);
+
+  if (fcb && inlineInfo) {
+    DokanFillReadAhead(
+        RequestContext, fcb, 0, (PCHAR)inlineInfo + sizeof(DOKAN_CREATE_FILE_INFO),
+        inlineInfo->InlineDataLength,
+        inlineInfo->EndOfFile.QuadPart <= inlineInfo->InlineDataLength);
+  }
 }
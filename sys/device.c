@@ -38,13 +38,67 @@ GlobalDeviceControl(__in PREQUEST_CONTEXT RequestContext) {
   return status;
 }
 
-VOID DokanPopulateDiskGeometry(__out PDISK_GEOMETRY DiskGeometry) {
+VOID DokanPopulateDiskGeometry(__out PDISK_GEOMETRY DiskGeometry,
+                               __in ULONG SectorSize) {
   DiskGeometry->Cylinders.QuadPart =
-      DOKAN_DEFAULT_DISK_SIZE / DOKAN_DEFAULT_SECTOR_SIZE / 32 / 2;
+      DOKAN_DEFAULT_DISK_SIZE / SectorSize / 32 / 2;
   DiskGeometry->MediaType = FixedMedia;
   DiskGeometry->TracksPerCylinder = 2;
   DiskGeometry->SectorsPerTrack = 32;
-  DiskGeometry->BytesPerSector = DOKAN_DEFAULT_SECTOR_SIZE;
+  DiskGeometry->BytesPerSector = SectorSize;
+}
+
+// Returns the Size bytes of a storage property descriptor, or only its
+// STORAGE_DESCRIPTOR_HEADER when the output buffer is too small for the rest,
+// which is how callers learn the size to allocate.
+static NTSTATUS ReturnStorageDescriptor(__in PREQUEST_CONTEXT RequestContext,
+                                        __in PVOID Descriptor,
+                                        __in ULONG Size) {
+  PVOID buffer;
+
+  ((PSTORAGE_DESCRIPTOR_HEADER)Descriptor)->Version = Size;
+  ((PSTORAGE_DESCRIPTOR_HEADER)Descriptor)->Size = Size;
+  if (RequestContext->IrpSp->Parameters.DeviceIoControl.OutputBufferLength <
+      Size) {
+    Size = sizeof(STORAGE_DESCRIPTOR_HEADER);
+  }
+  buffer = PrepareOutputWithSize(RequestContext->Irp, Size,
+                                 /*SetInformationOnFailure=*/FALSE);
+  if (buffer == NULL) {
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+  RtlCopyMemory(buffer, Descriptor, Size);
+  return STATUS_SUCCESS;
+}
+
+// Describes the disk device as a virtual adapter moving up to MaxTransferSize
+// bytes per request, so that applications sizing their I/O on the adapter
+// issue transfers that large.
+static NTSTATUS QueryStorageAdapter(__in PREQUEST_CONTEXT RequestContext,
+                                    __in PDokanDCB Dcb) {
+  STORAGE_ADAPTER_DESCRIPTOR adapter;
+
+  RtlZeroMemory(&adapter, sizeof(adapter));
+  adapter.MaximumTransferLength = Dcb->MaxTransferSize;
+  adapter.MaximumPhysicalPages = Dcb->MaxTransferSize / PAGE_SIZE + 1;
+  adapter.AlignmentMask = FILE_BYTE_ALIGNMENT;
+  adapter.CommandQueueing = TRUE;
+  adapter.BusType = BusTypeVirtual;
+  return ReturnStorageDescriptor(RequestContext, &adapter, sizeof(adapter));
+}
+
+// Reports the sector size of the volume as both its logical and physical
+// sector size, with no alignment offset.
+static NTSTATUS QueryStorageAccessAlignment(__in PREQUEST_CONTEXT RequestContext,
+                                            __in PDokanDCB Dcb) {
+  STORAGE_ACCESS_ALIGNMENT_DESCRIPTOR alignment;
+
+  RtlZeroMemory(&alignment, sizeof(alignment));
+  alignment.BytesPerCacheLine = SYSTEM_CACHE_ALIGNMENT_SIZE;
+  alignment.BytesPerLogicalSector = Dcb->SectorSize;
+  alignment.BytesPerPhysicalSector = Dcb->SectorSize;
+  return ReturnStorageDescriptor(RequestContext, &alignment,
+                                 sizeof(alignment));
 }
 
 VOID DokanPopulatePartitionInfo(__out PPARTITION_INFORMATION Info) {
@@ -112,7 +166,7 @@ DiskDeviceControl(__in PREQUEST_CONTEXT RequestContext,
         status = STATUS_BUFFER_TOO_SMALL;
         break;
       }
-      DokanPopulateDiskGeometry(diskGeometry);
+      DokanPopulateDiskGeometry(diskGeometry, dcb->SectorSize);
       status = STATUS_SUCCESS;
     } break;
 
@@ -233,7 +287,12 @@ DiskDeviceControl(__in PREQUEST_CONTEXT RequestContext,
       GET_IRP_BUFFER_OR_BREAK(RequestContext->Irp, query);
 
       if (query->QueryType == PropertyExistsQuery) {
-        if (query->PropertyId == StorageDeviceUniqueIdProperty) {
+        if (query->PropertyId == StorageAdapterProperty ||
+            query->PropertyId == StorageAccessAlignmentProperty) {
+          DOKAN_LOG_FINE_IRP(RequestContext, "PropertyExistsQuery %d",
+                             query->PropertyId);
+          status = STATUS_SUCCESS;
+        } else if (query->PropertyId == StorageDeviceUniqueIdProperty) {
           DOKAN_LOG_FINE_IRP(
               RequestContext,
               "PropertyExistsQuery StorageDeviceUniqueIdProperty");
@@ -264,7 +323,13 @@ DiskDeviceControl(__in PREQUEST_CONTEXT RequestContext,
         } else if (query->PropertyId == StorageAdapterProperty) {
           DOKAN_LOG_FINE_IRP(RequestContext,
                              "PropertyStandardQuery StorageAdapterProperty");
-          status = STATUS_NOT_SUPPORTED;
+          // The query shares the buffer with the output, which is cleared.
+          status = QueryStorageAdapter(RequestContext, dcb);
+        } else if (query->PropertyId == StorageAccessAlignmentProperty) {
+          DOKAN_LOG_FINE_IRP(
+              RequestContext,
+              "PropertyStandardQuery StorageAccessAlignmentProperty");
+          status = QueryStorageAccessAlignment(RequestContext, dcb);
         } else {
           DOKAN_LOG_FINE_IRP(RequestContext, "PropertyStandardQuery Unknown %d",
                              query->PropertyId);
@@ -430,14 +495,8 @@ DiskDeviceControl(__in PREQUEST_CONTEXT RequestContext,
       // Update the mount point in dokan's global list, so that other dokan
       // functions (e.g. for unmounting) can look up the drive by mount point
       // later.
-      PMOUNT_ENTRY mountEntry =
-          FindMountEntryByName(dcb->Global, dcb->DiskDeviceName, dcb->UNCName,
-                               /*ExclusiveLock=*/TRUE);
-      if (mountEntry != NULL) {
-        RtlStringCchCopyUnicodeString(mountEntry->MountControl.MountPoint,
-                                      MAXIMUM_FILENAME_LENGTH, dcb->MountPoint);
-        ExReleaseResourceLite(&mountEntry->Resource);
-      } else {
+      if (!UpdateMountEntryMountPoint(dcb->Global, dcb->DiskDeviceName,
+                                      dcb->UNCName, dcb->MountPoint)) {
         DokanLogInfo(&logger, L"Cannot find associated MountEntry to update.");
       }
     } break;
@@ -617,7 +676,7 @@ DiskDeviceControl(__in PREQUEST_CONTEXT RequestContext,
         status = STATUS_INSUFFICIENT_RESOURCES;
         break;
       }
-      DokanPopulateDiskGeometry(diskGeometry);
+      DokanPopulateDiskGeometry(diskGeometry, dcb->SectorSize);
       mediaInfo->DeviceSpecific.DiskInfo.MediaType = diskGeometry->MediaType;
       mediaInfo->DeviceSpecific.DiskInfo.NumberMediaSides = 1;
       mediaInfo->DeviceSpecific.DiskInfo.MediaCharacteristics =
@@ -716,6 +775,109 @@ NTSTATUS DokanGetVolumeMetrics(__in PREQUEST_CONTEXT RequestContext) {
   return STATUS_SUCCESS;
 }
 
+// Returns the VOLUME_METRICS_EX of the volume, truncated to the size of the
+// output buffer so that callers built against an older version of the struct
+// keep working.
+NTSTATUS DokanGetVolumeMetricsEx(__in PREQUEST_CONTEXT RequestContext) {
+  PDokanVCB vcb = RequestContext->Vcb;
+  PVOLUME_METRICS_EX metrics;
+  PVOID outputBuffer;
+  ULONG outputLength =
+      RequestContext->IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+
+  if (outputLength < FIELD_OFFSET(VOLUME_METRICS_EX, Volume)) {
+    RequestContext->Irp->IoStatus.Information = sizeof(VOLUME_METRICS_EX);
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+  outputLength = min(outputLength, sizeof(VOLUME_METRICS_EX));
+  outputBuffer = PrepareOutputWithSize(RequestContext->Irp, outputLength,
+                                       /*SetInformationOnFailure=*/FALSE);
+  if (outputBuffer == NULL) {
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+  metrics = DokanAllocZero(sizeof(VOLUME_METRICS_EX));
+  if (metrics == NULL) {
+    RequestContext->Irp->IoStatus.Information = 0;
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  metrics->Version = DOKAN_VOLUME_METRICS_EX_VERSION;
+  metrics->Length = outputLength;
+  DokanVCBLockRO(vcb);
+  metrics->Volume = vcb->VolumeMetrics;
+  metrics->FcbCache = vcb->FcbCacheMetrics;
+  DokanVCBUnlock(vcb);
+  metrics->MajorFunctionCount = DOKAN_METRICS_MAJOR_FUNCTION_COUNT;
+  metrics->LatencyBucketCount = DOKAN_LATENCY_BUCKET_COUNT;
+  // The operation metrics are updated without lock. Each counter is consistent
+  // on its own, which is all a scraper needs.
+  RtlCopyMemory(metrics->Operations, vcb->OperationMetrics,
+                sizeof(metrics->Operations));
+  DokanGetAllocationMetrics(metrics);
+  metrics->QueuedEvents = (ULONG64)max(
+      InterlockedCompareExchange(&vcb->Dcb->NotifyEventCount, 0, 0), 0);
+  RtlCopyMemory(outputBuffer, metrics, outputLength);
+  ExFreePool(metrics);
+  return STATUS_SUCCESS;
+}
+
+ULONG DokanGetLatencyBucket(__in LONGLONG Ticks, __in LONGLONG Frequency) {
+  ULONG64 microseconds;
+  ULONG bucket = 0;
+
+  if (Ticks <= 0 || Frequency <= 0) {
+    return 0;
+  }
+  microseconds = (ULONG64)Ticks * 1000000 / (ULONG64)Frequency;
+  while (microseconds != 0 && bucket < DOKAN_LATENCY_BUCKET_COUNT - 1) {
+    microseconds >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+// Accounts the answer of the file system to the IRP of IrpEntry in the
+// operation metrics of the volume. Must be called before the IRP is completed.
+VOID DokanRecordOperationMetrics(__in PDokanVCB Vcb,
+                                 __in PIRP_ENTRY IrpEntry,
+                                 __in PEVENT_INFORMATION EventInfo) {
+  PDOKAN_OPERATION_METRICS metrics;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now = KeQueryPerformanceCounter(&frequency);
+  LONGLONG arrivalTime = IrpEntry->RequestContext.ArrivalTime.QuadPart;
+  LONGLONG pulledTime = IrpEntry->PulledTime.QuadPart;
+  UCHAR majorFunction = IrpEntry->RequestContext.IrpSp->MajorFunction;
+
+  if (Vcb == NULL || arrivalTime == 0 ||
+      majorFunction >= DOKAN_METRICS_MAJOR_FUNCTION_COUNT) {
+    return;
+  }
+  metrics = &Vcb->OperationMetrics[majorFunction];
+  InterlockedIncrement64((LONG64*)&metrics->Requests);
+  if (NT_SUCCESS(EventInfo->Status) ||
+      EventInfo->Status == STATUS_BUFFER_OVERFLOW) {
+    InterlockedAdd64((LONG64*)&metrics->Bytes, EventInfo->BufferLength);
+  }
+  InterlockedIncrement64(
+      (LONG64*)&metrics->TotalLatency[DokanGetLatencyBucket(
+          now.QuadPart - arrivalTime, frequency.QuadPart)]);
+  if (pulledTime == 0) {
+    // Handed over through the event ring; there is no driver side queue.
+    pulledTime = arrivalTime;
+  } else {
+    InterlockedIncrement64(
+        (LONG64*)&metrics->QueuedLatency[DokanGetLatencyBucket(
+            pulledTime - arrivalTime, frequency.QuadPart)]);
+  }
+  InterlockedIncrement64(
+      (LONG64*)&metrics->UserModeLatency[DokanGetLatencyBucket(
+          now.QuadPart - pulledTime, frequency.QuadPart)]);
+  if (Vcb->Dcb->ProfileSampleRate != 0) {
+    DokanProfileRequest(
+        Vcb, &IrpEntry->RequestContext,
+        (ULONG64)(now.QuadPart - arrivalTime) * 1000000 / frequency.QuadPart);
+  }
+}
+
 NTSTATUS
 VolumeDeviceControl(__in PREQUEST_CONTEXT RequestContext) {
   NTSTATUS status = STATUS_INVALID_DEVICE_REQUEST;
@@ -93,6 +93,7 @@ NTSTATUS DokanBuildRequestContext(_In_ PDEVICE_OBJECT DeviceObject,
                                   _In_ PIRP Irp, BOOLEAN IsTopLevelIrp,
                                   _Outptr_ PREQUEST_CONTEXT RequestContext) {
   RtlZeroMemory(RequestContext, sizeof(REQUEST_CONTEXT));
+  RequestContext->ArrivalTime = KeQueryPerformanceCounter(NULL);
   RequestContext->DeviceObject = DeviceObject;
   RequestContext->Irp = Irp;
   RequestContext->Irp->IoStatus.Information = 0;
@@ -136,6 +137,7 @@ DokanDispatchRequest(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
   }
 
   DOKAN_LOG_BEGIN_MJ((&requestContext));
+  DOKAN_TRACE_IRP_START((&requestContext));
 
   __try {
     if (requestContext.IrpSp->MajorFunction != IRP_MJ_FILE_SYSTEM_CONTROL &&
@@ -163,8 +165,14 @@ DokanDispatchRequest(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
            IRP_MJ_SET_VOLUME_INFORMATION) ||
           (requestContext.IrpSp->MajorFunction == IRP_MJ_FILE_SYSTEM_CONTROL &&
            requestContext.IrpSp->MinorFunction == IRP_MN_USER_FS_REQUEST &&
-           requestContext.IrpSp->Parameters.FileSystemControl.FsControlCode ==
-               FSCTL_MARK_VOLUME_DIRTY)) {
+           (requestContext.IrpSp->Parameters.FileSystemControl.FsControlCode ==
+                FSCTL_MARK_VOLUME_DIRTY ||
+            requestContext.IrpSp->Parameters.FileSystemControl.FsControlCode ==
+                FSCTL_DUPLICATE_EXTENTS_TO_FILE ||
+            requestContext.IrpSp->Parameters.FileSystemControl.FsControlCode ==
+                FSCTL_SET_SPARSE ||
+            requestContext.IrpSp->Parameters.FileSystemControl.FsControlCode ==
+                FSCTL_SET_ZERO_DATA))) {
         DOKAN_LOG_FINE_IRP((&requestContext), "Media is write protected");
         status = STATUS_MEDIA_WRITE_PROTECTED;
         __leave;
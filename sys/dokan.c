@@ -39,6 +39,10 @@ LOOKASIDE_LIST_EX g_DokanEResourceLookasideList;
 BOOLEAN g_FixFileNameForReparseMountPoint;
 
 NPAGED_LOOKASIDE_LIST DokanIrpEntryLookasideList;
+// {129494F3-FD19-4E66-8B69-1B9852398DD8}
+TRACELOGGING_DEFINE_PROVIDER(g_DokanTraceProvider, "Dokan.Driver",
+                             (0x129494f3, 0xfd19, 0x4e66, 0x8b, 0x69, 0x1b,
+                              0x98, 0x52, 0x39, 0x8d, 0xd8));
 ULONG DokanMdlSafePriority = 0;
 
 FAST_IO_DISPATCH FastIoDispatch;
@@ -245,10 +249,6 @@ Return Value:
 
   UNREFERENCED_PARAMETER(RegistryPath);
 
-  // Initialize log entry list first before any log.
-  InitializeListHead(&g_DokanLogEntryList.Log);
-  ExInitializeResourceLite(&g_DokanLogEntryList.Resource);
-
 #ifdef DEBUG_
   DOKAN_LOG_("ver.%x, %s %s", DOKAN_DRIVER_VERSION, __DATE__,
             __TIME__);
@@ -298,6 +298,9 @@ Return Value:
   // FastIoDispatch.FastIoRead = DokanFastIoRead;
   FastIoDispatch.FastIoRead = FsRtlCopyRead;
   FastIoDispatch.FastIoWrite = FsRtlCopyWrite;
+  FastIoDispatch.FastIoQueryBasicInfo = DokanFastIoQueryBasicInfo;
+  FastIoDispatch.FastIoQueryStandardInfo = DokanFastIoQueryStandardInfo;
+  FastIoDispatch.FastIoQueryNetworkOpenInfo = DokanFastIoQueryNetworkOpenInfo;
   FastIoDispatch.AcquireFileForNtCreateSection = DokanAcquireForCreateSection;
   FastIoDispatch.ReleaseFileForNtCreateSection = DokanReleaseForCreateSection;
   FastIoDispatch.AcquireForCcFlush = DokanAcquireForCcFlush;
@@ -353,6 +356,15 @@ Return Value:
     return STATUS_INSUFFICIENT_RESOURCES;
   }
 
+  if (!DokanInitEventContextLookasideLists()) {
+    DOKAN_LOG("DokanInitEventContextLookasideLists failed");
+    CleanupGlobalDiskDevice(dokanGlobal);
+    ExDeleteLookasideListEx(&g_DokanCCBLookasideList);
+    ExDeleteLookasideListEx(&g_DokanFCBLookasideList);
+    ExDeleteLookasideListEx(&g_DokanEResourceLookasideList);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
   // Detect if we are running on a older version than NTDDI_WIN10_RS4
   // needing to fix FileName during Reparse MountPoint.
   g_FixFileNameForReparseMountPoint =
@@ -361,6 +373,13 @@ Return Value:
   DOKAN_LOG_("%s FixFileNameForReparseMountPoint=%d",
              DokanGetNTSTATUSStr(status), g_FixFileNameForReparseMountPoint);
 
+  // Tracing is optional, the events are dropped if this fails.
+  NTSTATUS traceStatus = TraceLoggingRegister(g_DokanTraceProvider);
+  if (!NT_SUCCESS(traceStatus)) {
+    DOKAN_LOG_("TraceLoggingRegister failed %s",
+               DokanGetNTSTATUSStr(traceStatus));
+  }
+
   return (status);
 }
 
@@ -399,6 +418,9 @@ Return Value:
   ExDeleteLookasideListEx(&g_DokanCCBLookasideList);
   ExDeleteLookasideListEx(&g_DokanFCBLookasideList);
   ExDeleteLookasideListEx(&g_DokanEResourceLookasideList);
+  DokanDeleteEventContextLookasideLists();
+  DokanFreeLogRings();
+  TraceLoggingUnregister(g_DokanTraceProvider);
 
   DOKAN_LOG("All resources released");
 }
@@ -454,18 +476,21 @@ NTSTATUS DokanCheckOplock(
 
 VOID DokanCompleteIrpRequest(__in PIRP Irp, __in NTSTATUS Status) {
   if (Status != STATUS_PENDING) {
+    // Failed IRP_MN_MDL reads do not get an IRP_MN_COMPLETE, whichever way
+    // they end (reply, timeout, cancel, unmount or oplock break).
+    DokanReleaseMdlReadBuffer(Irp, Status);
     Irp->IoStatus.Status = Status;
+    DOKAN_TRACE_IRP_STOP(Irp, Status);
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
   }
 }
 
-NTSTATUS DokanNotifyReportChange0(__in PREQUEST_CONTEXT RequestContext,
-                                  __in PDokanFCB Fcb,
-                                  __in PUNICODE_STRING FileName,
-                                  __in ULONG FilterMatch, __in ULONG Action) {
+NTSTATUS DokanNotifyVolumeChange(__in PDokanVCB Vcb,
+                                 __in PUNICODE_STRING FileName,
+                                 __in ULONG FilterMatch, __in ULONG Action) {
   USHORT nameOffset;
 
-  ASSERT(Fcb != NULL);
+  ASSERT(Vcb != NULL);
   ASSERT(FileName != NULL);
 
   // Alternate streams are supposed to use a different set of action
@@ -510,7 +535,7 @@ NTSTATUS DokanNotifyReportChange0(__in PREQUEST_CONTEXT RequestContext,
   nameOffset *= sizeof(WCHAR);  // Offset is in bytes
 
   __try {
-    FsRtlNotifyFullReportChange(Fcb->Vcb->NotifySync, &Fcb->Vcb->DirNotifyList,
+    FsRtlNotifyFullReportChange(Vcb->NotifySync, &Vcb->DirNotifyList,
                                 (PSTRING)FileName, nameOffset,
                                 NULL,  // StreamName
                                 NULL,  // NormalizedParentName
@@ -519,7 +544,7 @@ NTSTATUS DokanNotifyReportChange0(__in PREQUEST_CONTEXT RequestContext,
   } __except (GetExceptionCode() == STATUS_ACCESS_VIOLATION
                   ? EXCEPTION_EXECUTE_HANDLER
                   : EXCEPTION_CONTINUE_SEARCH) {
-    DOKAN_INIT_LOGGER(logger, Fcb->Vcb->Dcb->DriverObject, 0);
+    DOKAN_INIT_LOGGER(logger, Vcb->Dcb->DriverObject, 0);
     try {
       // This case is attested in the wild but very rare. We don't know why it
       // happens.
@@ -537,12 +562,25 @@ NTSTATUS DokanNotifyReportChange0(__in PREQUEST_CONTEXT RequestContext,
           L"Access violation on the file name passed in a notification.");
     }
   }
-  DOKAN_LOG_FINE_IRP(RequestContext,
-                     "FCB=%p NameOffset=%x FilterMatch=%x Action=%x Success",
-                     Fcb, nameOffset, FilterMatch, Action);
   return STATUS_SUCCESS;
 }
 
+NTSTATUS DokanNotifyReportChange0(__in PREQUEST_CONTEXT RequestContext,
+                                  __in PDokanFCB Fcb,
+                                  __in PUNICODE_STRING FileName,
+                                  __in ULONG FilterMatch, __in ULONG Action) {
+  NTSTATUS status;
+
+  ASSERT(Fcb != NULL);
+  status = DokanNotifyVolumeChange(Fcb->Vcb, FileName, FilterMatch, Action);
+  if (NT_SUCCESS(status)) {
+    DOKAN_LOG_FINE_IRP(RequestContext,
+                       "FCB=%p FilterMatch=%x Action=%x Success", Fcb,
+                       FilterMatch, Action);
+  }
+  return status;
+}
+
 // DokanNotifyReportChange should be called with the Fcb at least share-locked.
 // due to the ro access to the FileName field.
 NTSTATUS DokanNotifyReportChange(__in PREQUEST_CONTEXT RequestContext,
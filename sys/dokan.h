@@ -35,6 +35,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "public.h"
 #include "util/log.h"
+#include "util/trace.h"
 
 //
 // DEFINES
@@ -107,6 +108,8 @@ extern DokanPtr_FsRtlAreThereWaitingFileLocks
 #define TAG (ULONG)'AKOD'
 
 #define DOKAN_MDL_ALLOCATED 0x1
+// The read asks the file system for a read-ahead window past the IRP range.
+#define DOKAN_READ_AHEAD_REQUESTED 0x2
 
 #define DokanAlloc(size) ExAllocatePoolWithTag(NonPagedPool, size, TAG)
 
@@ -120,6 +123,12 @@ extern ULONG DokanMdlSafePriority;
 #define MmGetSystemAddressForMdlNormalSafe(mdl)                                \
   MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | DokanMdlSafePriority)
 
+// Mapping of the buffer of a write while its IRP is posted for an oplock
+// break. See DokanDispatchWrite.
+// Buffer an IRP_MN_MDL read allocated to return its data in, which
+// DokanCompleteIrpRequest frees if the read fails. See DokanDispatchRead.
+#define DRIVER_CONTEXT_MDL_READ_BUFFER 0
+#define DRIVER_CONTEXT_USER_MAPPING 1
 #define DRIVER_CONTEXT_EVENT 2
 #define DRIVER_CONTEXT_IRP_ENTRY 3
 
@@ -127,6 +136,96 @@ extern ULONG DokanMdlSafePriority;
 #define DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX (1000 * 60 * 5) // in millisecond
 #define DOKAN_CHECK_INTERVAL (1000 * 5)                     // in millisecond
 
+// The entries of PendingIrp are kept in a wheel of buckets of
+// DOKAN_CHECK_INTERVAL each, keyed by the interval in which they time out, so
+// that the timeout thread only looks at the ones that are due. The wheel has to
+// span more than DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX.
+#define DOKAN_TIMEOUT_WHEEL_SIZE 128
+
+// Longest accepted EVENT_START.FileInfoCacheTimeoutMs.
+#define DOKAN_FILE_INFO_CACHE_MAX_TIMEOUT (1000 * 60) // in millisecond
+
+// Longest accepted EVENT_START.NegativeCacheTimeoutMs, and the number of missing
+// paths remembered per volume beyond which the oldest ones are dropped.
+#define DOKAN_NEGATIVE_CACHE_MAX_TIMEOUT (1000 * 60) // in millisecond
+#define DOKAN_NEGATIVE_CACHE_MAX_ENTRIES 4096
+
+// Longest accepted EVENT_START.VolumeInfoCacheTimeoutMs.
+#define DOKAN_VOLUME_INFO_CACHE_MAX_TIMEOUT (1000 * 60 * 10) // in millisecond
+
+// Longest accepted EVENT_START.SecurityCacheTimeoutMs, and the size of the
+// largest descriptor kept per file.
+#define DOKAN_SECURITY_CACHE_MAX_TIMEOUT (1000 * 60) // in millisecond
+#define DOKAN_SECURITY_CACHE_MAX_SIZE (1024 * 4)
+
+// Largest accepted EVENT_START.ReadAheadWindowSize, and the default and largest
+// EVENT_START.ReadAheadMemoryLimit.
+#define DOKAN_READ_AHEAD_MAX_WINDOW (1024 * 1024 * 8)
+#define DOKAN_READ_AHEAD_DEFAULT_MEMORY_LIMIT (1024 * 1024 * 64)
+#define DOKAN_READ_AHEAD_MAX_MEMORY_LIMIT (1024 * 1024 * 1024)
+
+// Largest accepted EVENT_START.WriteBehindMaxSize, and the default and longest
+// EVENT_START.WriteBehindTimeoutMs.
+#define DOKAN_WRITE_BEHIND_MAX_SIZE (1024 * 1024)
+#define DOKAN_WRITE_BEHIND_DEFAULT_TIMEOUT 1000 // in millisecond
+#define DOKAN_WRITE_BEHIND_MAX_TIMEOUT (1000 * 60) // in millisecond
+
+// Size of the event carrying batched closes and longest they are held, with
+// DOKAN_EVENT_BATCH_CLOSE.
+#define DOKAN_CLOSE_BATCH_SIZE (1024 * 8)
+#define DOKAN_CLOSE_BATCH_DELAY 10 // in millisecond
+
+// Longest directory change notifications are held to be merged, and most held
+// at once before they are dropped for a rescan, with
+// DOKAN_EVENT_COALESCE_NOTIFICATIONS.
+#define DOKAN_NOTIFY_BATCH_DELAY 20 // in millisecond
+#define DOKAN_NOTIFY_BATCH_MAX_ENTRIES 256
+
+// Default, smallest and largest EVENT_START.MaxTransferSize.
+#define DOKAN_DEFAULT_MAX_TRANSFER_SIZE (1024 * 1024)
+#define DOKAN_MIN_MAX_TRANSFER_SIZE (1024 * 64)
+#define DOKAN_MAX_MAX_TRANSFER_SIZE (1024 * 1024 * 8)
+
+// Largest accepted EVENT_START.AllocationStepSize.
+#define DOKAN_ALLOCATION_STEP_MAX_SIZE (1024 * 1024 * 64)
+
+// Default and largest EVENT_START.FcbCacheMemoryLimit.
+#define DOKAN_FCB_CACHE_DEFAULT_MEMORY_LIMIT (1024 * 1024 * 32)
+#define DOKAN_FCB_CACHE_MAX_MEMORY_LIMIT (1024 * 1024 * 1024)
+
+// Longest lease a create reply can grant.
+#define DOKAN_LEASE_MAX_DURATION (1000 * 60 * 60) // in millisecond
+
+// Number of volume information classes whose answer can be cached: volume,
+// size, attribute and full size information.
+#define DOKAN_VOLUME_INFO_CACHE_CLASS_COUNT 4
+
+// Number of buckets used to index the pending IRPs by serial number. Must be a
+// power of two.
+// Number of buckets of the mount entries indexed by device name and by mount
+// point in DOKAN_GLOBAL.
+#define DOKAN_MOUNT_ENTRY_TABLE_SIZE 256
+
+#define DOKAN_PENDING_IRP_TABLE_SIZE 1024
+#define DokanPendingIrpBucket(Dcb, SerialNumber)                               \
+  (&(Dcb)->PendingIrpTable[(SerialNumber) & (DOKAN_PENDING_IRP_TABLE_SIZE - 1)])
+
+// Maximum number of queues the events to send to userland are spread over.
+// There is one queue per active processor up to that number.
+#define DOKAN_NOTIFY_QUEUE_MAX_COUNT 64
+
+// Lanes of the notify queues. Metadata requests (create, cleanup, query
+// information, directory control...) are pulled ahead of the bulk data ones
+// (read, write and flush) so that they do not wait behind large transfers.
+#define DOKAN_EVENT_LANE_METADATA 0
+#define DOKAN_EVENT_LANE_BULK 1
+#define DOKAN_EVENT_LANE_COUNT 2
+
+// Number of metadata events pulled for each bulk event when both lanes have
+// events waiting. See EVENT_START.MetadataLaneWeight.
+#define DOKAN_METADATA_LANE_DEFAULT_WEIGHT 8
+#define DOKAN_METADATA_LANE_MAX_WEIGHT 1024
+
 extern NPAGED_LOOKASIDE_LIST DokanIrpEntryLookasideList;
 #define DokanAllocateIrpEntry()                                                \
   ExAllocateFromNPagedLookasideList(&DokanIrpEntryLookasideList)
@@ -182,6 +281,34 @@ typedef struct _IRP_LIST {
   KSPIN_LOCK ListLock;
 } IRP_LIST, *PIRP_LIST;
 
+// Events waiting to be pulled by userland, queued by the processors closest to
+// it. Each queue gets its own cache line so that the processors do not fight
+// over the locks of their neighbours.
+typedef struct DECLSPEC_CACHEALIGN _DOKAN_NOTIFY_QUEUE {
+  IRP_LIST NotifyEvent[DOKAN_EVENT_LANE_COUNT];
+} DOKAN_NOTIFY_QUEUE, *PDOKAN_NOTIFY_QUEUE;
+
+// Kernel side of the event ring shared with the DLL. See EVENT_RING_HEADER.
+typedef struct _DOKAN_EVENT_RING {
+  PMDL Mdl;
+  // System address of the shared region. Its content is untrusted.
+  PEVENT_RING_HEADER Header;
+  ULONG SlotCount;
+  PKEVENT SubmissionEvent;
+  // The handle the ring was registered with. The ring is released when it is
+  // cleaned up.
+  PFILE_OBJECT FileObject;
+  // Next submission position to produce. Protected by Dcb->EventRingLock.
+  ULONG SubmissionTail;
+  // Next completion position to consume, and the buffer replies are copied to.
+  // Owned by the thread that has set Draining.
+  ULONG CompletionHead;
+  PVOID Buffer;
+  LONG Draining;
+  // Held by the doorbell processing while it accesses the ring.
+  EX_RUNDOWN_REF RundownRef;
+} DOKAN_EVENT_RING, *PDOKAN_EVENT_RING;
+
 typedef struct _DOKAN_GLOBAL {
   FSD_IDENTIFIER Identifier;
   ERESOURCE Resource;
@@ -192,8 +319,19 @@ typedef struct _DOKAN_GLOBAL {
 
   PKTHREAD DeviceDeleteThread;
 
+  // Taken shared to look mount entries up and exclusively to insert, remove or
+  // rename them.
   ERESOURCE MountPointListLock;
+  // The mount entries in mount order, and hashed by device name and by mount
+  // point. See DokanMountEntryBucket.
   LIST_ENTRY MountPointList;
+  LIST_ENTRY MountEntriesByDeviceName[DOKAN_MOUNT_ENTRY_TABLE_SIZE];
+  LIST_ENTRY MountEntriesByMountPoint[DOKAN_MOUNT_ENTRY_TABLE_SIZE];
+  // Incremented on every change of MountPointList, with MountPointListLock
+  // held exclusively.
+  ULONG MountPointListGeneration;
+  // FSCTL_MOUNTPOINT_LIST_CHANGE IRPs waiting for the generation to change.
+  IRP_LIST MountPointListWaiters;
 
   LIST_ENTRY DeviceDeleteList;
   KEVENT KillDeleteDeviceEvent;
@@ -222,10 +360,85 @@ typedef struct _DokanDiskControlBlock {
 
   // Pending IRPs
   IRP_LIST PendingIrp;
-  // Pending IRPs waiting to be dispatched to userland
-  IRP_LIST NotifyEvent;
+  // The entries of PendingIrp that were sent to userland, hashed by serial
+  // number so that replies can be matched without walking the whole list.
+  // Protected by PendingIrp.ListLock.
+  LIST_ENTRY PendingIrpTable[DOKAN_PENDING_IRP_TABLE_SIZE];
+  // The entries of PendingIrp by timeout interval, and the next interval the
+  // timeout thread has to check. Protected by PendingIrp.ListLock.
+  LIST_ENTRY PendingIrpTimeoutWheel[DOKAN_TIMEOUT_WHEEL_SIZE];
+  ULONG64 PendingIrpTimeoutNextSlot;
+  // Pending IRPs waiting to be dispatched to userland. An event is queued to
+  // the queue of the processor it is produced on and pulled from the queue of
+  // the processor of the pulling thread first, then from the other queues.
+  DOKAN_NOTIFY_QUEUE NotifyQueues[DOKAN_NOTIFY_QUEUE_MAX_COUNT];
+  ULONG NotifyQueueCount;
+  // Number of events in all of NotifyQueues.
+  LONG NotifyEventCount;
+  // Number of metadata events pulled for each bulk event, and how many can
+  // still be pulled before a waiting bulk event gets its turn.
+  ULONG MetadataLaneWeight;
+  LONG MetadataLaneCredit;
+  // How long the attributes returned by the file system are used to answer
+  // queries from the kernel. 0 disables the cache. See DOKAN_FILE_INFO_CACHE.
+  ULONG FileInfoCacheTimeoutMs;
+  // How long opens of paths the file system reported missing are failed
+  // without asking it again. 0 disables the cache. See negcache.c.
+  ULONG NegativeCacheTimeoutMs;
+  // How long the answers to volume information queries are reused. 0 disables
+  // the cache. See DOKAN_VOLUME_INFO_CACHE_ENTRY.
+  ULONG VolumeInfoCacheTimeoutMs;
+  // How long the security descriptors returned by the file system are used to
+  // answer queries. 0 disables the cache. See DOKAN_SECURITY_CACHE.
+  ULONG SecurityCacheTimeoutMs;
+  // Size of the windows read ahead of sequential readers, 0 when disabled, the
+  // most memory they can take together and the memory they take now. See
+  // readahead.c.
+  ULONG ReadAheadWindowSize;
+  LONG64 ReadAheadMemoryLimit;
+  LONG64 ReadAheadMemoryUsed;
+  // Size of the buffer of the handles coalescing small non-cached writes, 0
+  // when disabled, and how long they can hold data. See writebehind.c.
+  ULONG WriteBehindMaxSize;
+  ULONG WriteBehindTimeoutMs;
+  // Sector size of the volume and largest transfer its disk device advertises
+  // to IOCTL_STORAGE_QUERY_PROPERTY. See device.c.
+  ULONG SectorSize;
+  ULONG MaxTransferSize;
+  // Step by which the allocation of a growing file is extended, 0 when
+  // disabled. See FCB.PreallocatedSize.
+  ULONG AllocationStepSize;
+  // EVENT_START.ProfileSampleRate. See profile.c.
+  ULONG ProfileSampleRate;
+  // NotifyIrpEventQueueList is inserted in NotifyIrpEventQueue to wake up a
+  // pulling thread when there are events, unless it is already there as
+  // indicated by NotifyIrpEventQueueSignaled. See DokanSignalNotifyEvent.
   LIST_ENTRY NotifyIrpEventQueueList;
   KQUEUE NotifyIrpEventQueue;
+  LONG NotifyIrpEventQueueSignaled;
+  // Pulls pended by FSCTL_EVENT_PULL_ASYNC until events arrive, and the event
+  // waking up the notification thread to complete them. See
+  // DokanCompletePendingPulls.
+  IRP_LIST PendingPullIrp;
+  KEVENT PendingPullWakeEvent;
+  // Optional event ring shared with the DLL. Set and cleared under
+  // EventRingLock.
+  PDOKAN_EVENT_RING EventRing;
+  KSPIN_LOCK EventRingLock;
+  // DOKAN_IRP_CLOSE_BATCH event being filled by DokanBatchClose, sent when it
+  // is full or when CloseBatchTimer expires. Set and cleared under
+  // CloseBatchLock. See closebatch.c.
+  PEVENT_CONTEXT CloseBatch;
+  KSPIN_LOCK CloseBatchLock;
+  KTIMER CloseBatchTimer;
+  // DOKAN_NOTIFY_BATCH_ENTRY list of the directory change notifications held
+  // by DokanBatchNotification, reported when NotifyBatchTimer expires. Changed
+  // under NotifyBatchLock. See notifybatch.c.
+  LIST_ENTRY NotifyBatch;
+  ULONG NotifyBatchCount;
+  BOOLEAN NotifyBatchOverflow;
+  KSPIN_LOCK NotifyBatchLock;
+  KTIMER NotifyBatchTimer;
   // IRPs that need to be retried in kernel mode, e.g. due to oplock breaks
   // asynchronously requested on an earlier try. These are IRPs that have never
   // yet been dispatched to user mode. The IRPs are supposed to be added here at
@@ -273,6 +486,10 @@ typedef struct _DokanDiskControlBlock {
   CACHE_MANAGER_CALLBACKS CacheManagerNoOpCallbacks;
 
   ULONG IrpTimeout;
+  // With HeartbeatTimeout, requests only time out once the tick count is past
+  // HeartbeatDeadline, which each FSCTL_HEARTBEAT pushes IrpTimeout away.
+  BOOLEAN HeartbeatTimeout;
+  LARGE_INTEGER HeartbeatDeadline;
   ULONG SessionId;
   IO_REMOVE_LOCK RemoveLock;
   
@@ -290,6 +507,35 @@ typedef struct _DokanDiskControlBlock {
   // strictly one for each DeviceIoControl that the DLL issues to fetch a
   // request.
   BOOLEAN AllowIpcBatching;
+  // Map page aligned read buffers in the file system process so that the DLL
+  // reads straight into them. See DokanMapReadBuffer.
+  BOOLEAN ZeroCopyRead;
+  // Map the page aligned buffers of large writes read-only in the file system
+  // process instead of having the DLL fetch them. See DokanMapWriteBuffer.
+  BOOLEAN ZeroCopyWrite;
+  // Send closes to user mode in DOKAN_IRP_CLOSE_BATCH events.
+  BOOLEAN BatchClose;
+  // Complete FileBasicInformation sets in the driver and send them merged with
+  // the next cleanup or flush of the file. See DokanTakeDeferredBasicInfo.
+  BOOLEAN DeferBasicInfo;
+  // Check the access asked by opens of existing files against their cached
+  // security descriptor. See DokanCheckCachedAccess.
+  BOOLEAN KernelAccessCheck;
+  // The file system makes writes durable before completing them. Flushes are
+  // then completed once the cached data reached it. See DokanDispatchFlush.
+  BOOLEAN WriteThrough;
+  // Hold the change notifications of the file system for
+  // DOKAN_NOTIFY_BATCH_DELAY to merge them. See DokanBatchNotification.
+  BOOLEAN CoalesceNotifications;
+  // Grant non conflicting byte range locks in the driver and report them to
+  // user mode afterwards. See DokanDispatchLock.
+  BOOLEAN FileLockHybrid;
+  // Complete the cleanups that need no answer from user mode without waiting
+  // for it. See DokanDispatchCleanup.
+  BOOLEAN AsyncCleanup;
+  // File system process that mounted the volume. Only referenced when
+  // ZeroCopyRead or ZeroCopyWrite is set.
+  PEPROCESS UserProcess;
 
   // How often to garbage-collect FCBs. If this is 0, we use the historical
   // default behavior of freeing them on the spot and in the current context
@@ -300,6 +546,9 @@ typedef struct _DokanDiskControlBlock {
   // exponentially slowing down procedures like zip file extraction due to
   // repeatedly rebuilding state that they attach to the FCB header.
   ULONG FcbGarbageCollectionIntervalMs;
+  // Most memory the FCBs waiting for garbage collection can take. Past it, the
+  // least recently used ones are deleted right away.
+  ULONG FcbCacheMemoryLimit;
 
   // Contains mount options from user space. See DOKAN_EVENT_* in public.h
   // for possible values.
@@ -332,6 +581,11 @@ typedef struct _DOKAN_CONTROL {
 
 typedef struct _MOUNT_ENTRY {
   LIST_ENTRY ListEntry;
+  // Links in the DOKAN_GLOBAL buckets of the device name and the mount point
+  // of MountControl, which only change with MountPointListLock held
+  // exclusively.
+  LIST_ENTRY DeviceNameLink;
+  LIST_ENTRY MountPointLink;
   // Lock automatically acquired by FindMountEntry which must be released
   // when the object access is no longer required.
   ERESOURCE Resource;
@@ -358,6 +612,17 @@ typedef struct _DokanResourceDebugInfo {
   ULONG ExclusiveLockCount;
 } DokanResourceDebugInfo, *PDokanResourceDebugInfo;
 
+// The answer to a volume information query, either returned by the file
+// system or pushed by it with FSCTL_UPDATE_VOLUME_INFO.
+typedef struct _DOKAN_VOLUME_INFO_CACHE_ENTRY {
+  // KeQueryPerformanceCounter value of the last change of the entry. Answers to
+  // queries that arrived before it are not cached.
+  LONGLONG Time;
+  // Number of bytes of Buffer, 0 if there is no answer cached.
+  ULONG Length;
+  UCHAR Buffer[DOKAN_VOLUME_INFO_CACHE_MAX_SIZE];
+} DOKAN_VOLUME_INFO_CACHE_ENTRY, *PDOKAN_VOLUME_INFO_CACHE_ENTRY;
+
 typedef struct _DokanVolumeControlBlock {
 
   FSD_IDENTIFIER Identifier;
@@ -402,8 +667,48 @@ typedef struct _DokanVolumeControlBlock {
   PKTHREAD FcbGarbageCollectorThread;
   LIST_ENTRY FcbGarbageList;
   KEVENT FcbGarbageListNotEmpty;
+  // Locking: VCB lock. Counts the FCBs of FcbGarbageList.
+  DOKAN_FCB_CACHE_METRICS FcbCacheMetrics;
 
   VOLUME_METRICS VolumeMetrics;
+
+  // Per IRP major function metrics of the requests answered by the file
+  // system, updated without lock. See DokanRecordOperationMetrics.
+  DOKAN_OPERATION_METRICS OperationMetrics[DOKAN_METRICS_MAJOR_FUNCTION_COUNT];
+
+  // Processes and files sampled the most when Dcb->ProfileSampleRate is set.
+  // ProfileCounter counts the answers without lock; Profile is changed under
+  // ProfileLock. See profile.c.
+  LONG ProfileCounter;
+  KSPIN_LOCK ProfileLock;
+  DOKAN_VOLUME_PROFILE Profile;
+
+  // Invalidates the DOKAN_FILE_INFO_CACHE of all the FCBs at once, for changes
+  // reported by the file system that are not tied to a handle.
+  LONGLONG FileInfoCacheInvalidatedTime;
+  // Same for the DOKAN_SECURITY_CACHE of all the FCBs.
+  LONGLONG SecurityCacheInvalidatedTime;
+  // Same for the DOKAN_READ_AHEAD_BUFFER of all the FCBs.
+  LONGLONG ReadAheadInvalidatedTime;
+
+  // Paths recently reported missing by the file system, see negcache.c. The
+  // table holds the entries by name and the list from the oldest to the newest,
+  // both guarded by NegativeCacheMutex.
+  RTL_AVL_TABLE NegativeCacheTable;
+  LIST_ENTRY NegativeCacheList;
+  ULONG NegativeCacheCount;
+  FAST_MUTEX NegativeCacheMutex;
+  // KeQueryPerformanceCounter value of the last removal from the cache.
+  LONGLONG NegativeCacheInvalidatedTime;
+
+  // Answers to volume information queries, guarded by VolumeInfoCacheLock.
+  KSPIN_LOCK VolumeInfoCacheLock;
+  DOKAN_VOLUME_INFO_CACHE_ENTRY VolumeInfoCache[DOKAN_VOLUME_INFO_CACHE_CLASS_COUNT];
+
+  // The DOKAN_WRITE_BEHIND buffers holding data, from the oldest to the
+  // newest, for the timeout thread. Guarded by WriteBehindListLock.
+  LIST_ENTRY WriteBehindList;
+  KSPIN_LOCK WriteBehindListLock;
 } DokanVCB, *PDokanVCB;
 
 // Flags for volume
@@ -465,6 +770,54 @@ typedef struct _DokanOplockDebugInfo {
 #define DOKAN_OPLOCK_DEBUG_CREATE_RETRY_QUEUED 64
 #define DOKAN_OPLOCK_DEBUG_CREATE_RETRIED 128
 
+// Attributes last returned by the file system for a file, used to answer
+// IRP_MJ_QUERY_INFORMATION without going to user mode when the mount has a
+// FileInfoCacheTimeoutMs. The times are KeQueryPerformanceCounter values. An
+// entry is only valid if it was filled from a request that arrived after the
+// last invalidation of the FCB and of the volume, and less than the timeout
+// ago.
+typedef struct _DOKAN_FILE_INFO_CACHE {
+  LONGLONG InvalidatedTime;
+  LONGLONG BasicTime;
+  LONGLONG StandardTime;
+  FILE_BASIC_INFORMATION Basic;
+  FILE_STANDARD_INFORMATION Standard;
+} DOKAN_FILE_INFO_CACHE, *PDOKAN_FILE_INFO_CACHE;
+
+// Self-relative security descriptor last returned by the file system for a
+// file, used to answer IRP_MJ_QUERY_SECURITY without going to user mode when
+// the mount has a SecurityCacheTimeoutMs. It only answers queries asking for
+// the same SecurityInformation, including the ones probing for the size, and
+// is valid under the same conditions as DOKAN_FILE_INFO_CACHE.
+typedef struct _DOKAN_SECURITY_CACHE {
+  LONGLONG InvalidatedTime;
+  LONGLONG Time;
+  SECURITY_INFORMATION SecurityInformation;
+  ULONG Length;
+  PSECURITY_DESCRIPTOR Descriptor;
+} DOKAN_SECURITY_CACHE, *PDOKAN_SECURITY_CACHE;
+
+// Data of a file read ahead of a sequential reader, see readahead.c. It is
+// valid under the same conditions as DOKAN_FILE_INFO_CACHE, without timeout.
+typedef struct _DOKAN_READ_AHEAD_BUFFER {
+  LONGLONG InvalidatedTime;
+  LONGLONG Time;
+  LARGE_INTEGER ByteOffset;
+  ULONG Length;
+  // Whether the file system returned less than asked, so that the data ends at
+  // the end of the file.
+  BOOLEAN EndOfFile;
+  PVOID Buffer;
+} DOKAN_READ_AHEAD_BUFFER, *PDOKAN_READ_AHEAD_BUFFER;
+
+// Caching lease granted on a file by the file system, see lease.c.
+typedef struct _DOKAN_LEASE {
+  // DOKAN_LEASE_* granted, 0 if none.
+  ULONG Level;
+  // KeQueryPerformanceCounter value at which the lease expires.
+  LONGLONG ExpiryTime;
+} DOKAN_LEASE, *PDOKAN_LEASE;
+
 typedef struct _DokanFileControlBlock {
   // Locking: Identifier is read-only, no locks needed.
   FSD_IDENTIFIER Identifier;
@@ -499,6 +852,14 @@ typedef struct _DokanFileControlBlock {
   // Modifications must lock the VCB followed by the FCB. Reads may
   // lock either one.
   UNICODE_STRING FileName;
+  // Locking: same as FileName. Hash of the upcased FileName, unless the volume
+  // is case sensitive, by which DokanVCB.FcbTable is ordered first so that
+  // lookups only compare the names of the FCBs with the same hash.
+  ULONG FileNameHash;
+  // Locking: same as FileName. Upcased copy of FileName on volumes that are not
+  // case sensitive, so that DokanCompareFcb compares the names without folding
+  // their case each time. Empty if it could not be allocated.
+  UNICODE_STRING UpcaseFileName;
 
   // Locking: FsRtl routines should be enough after initialization.
   FILE_LOCK FileLock;
@@ -559,8 +920,56 @@ typedef struct _DokanFileControlBlock {
   // but due to a Dokan bug, this is actually possible. Until it is fixed, we
   // reproduce the behavior prior to the Avl table.
   BOOLEAN ReplacedByRename;
+
+  // Locking: DokanFCBLock{RO,RW} to read and fill the entries,
+  // InvalidatedTime is set with atomics without lock.
+  DOKAN_FILE_INFO_CACHE FileInfoCache;
+
+  // Locking: same as FileInfoCache. Descriptor is freed with the FCB.
+  DOKAN_SECURITY_CACHE SecurityCache;
+
+  // Locking: same as FileInfoCache. Buffer is freed with the FCB.
+  DOKAN_READ_AHEAD_BUFFER ReadAhead;
+
+  // Locking: DokanFCBLockRO to read, DokanFCBLockRW to grant or break it.
+  DOKAN_LEASE Lease;
+
+  // Locking: atomics. Number of DOKAN_WRITE_BEHIND buffers of the handles of
+  // the file that hold data.
+  LONG WriteBehindCount;
+
+  // Locking: DokanFCBLockRO to read, DokanFCBLockRW to merge or take it. Times
+  // and attributes set with DeferBasicInfo, not sent to user mode yet.
+  DOKAN_DEFERRED_BASIC_INFO DeferredBasicInfo;
+
+  // Locking: DokanFCBLockRO to read, DokanFCBLockRW to write. Allocation the
+  // file system was last asked for, extended to a multiple of
+  // AllocationStepSize. The allocation sets from the file size up to it are
+  // completed by the driver. 0 when unknown.
+  LONGLONG PreallocatedSize;
 } DokanFCB, *PDokanFCB;
 
+// Small non-cached writes of a handle held before being sent together, see
+// writebehind.c.
+typedef struct _DOKAN_WRITE_BEHIND {
+  // Locking: DokanVCB.WriteBehindListLock.
+  LIST_ENTRY ListEntry;
+  BOOLEAN Listed;
+  // Guards the fields below and stays taken while FlushIrp is in flight.
+  KEVENT Lock;
+  PDokanFCB Fcb;
+  PFILE_OBJECT FileObject;
+  PIRP FlushIrp;
+  // Locking: atomics. First failure of a flush not reported to the handle yet.
+  LONG DeferredStatus;
+  LARGE_INTEGER ByteOffset;
+  // KeQueryPerformanceCounter value of the oldest write held.
+  LONGLONG FirstWriteTime;
+  ULONG Capacity;
+  ULONG Length;
+  UCHAR Buffer[1];
+} DOKAN_WRITE_BEHIND, *PDOKAN_WRITE_BEHIND;
+
 #define DokanResourceLockRO(resource)                                          \
   {                                                                            \
     KeEnterCriticalRegion();                                                   \
@@ -759,6 +1168,20 @@ typedef struct _DokanContextControlBlock {
 
   // The process that created the CCB, for debugging purposes.
   HANDLE ProcessId;
+
+  // Locking: none, they only drive the read-ahead heuristic. Where the next
+  // non-cached read starts if the handle reads sequentially, and how many
+  // reads in a row did so.
+  LONGLONG ReadAheadNextOffset;
+  ULONG ReadAheadSequentialReads;
+
+  // Set by the create reply. DOKAN_CACHE_HINT_* of the handle, and its
+  // read-ahead window, 0 for the one of the mount.
+  ULONG CacheHints;
+  ULONG ReadAheadWindowSize;
+
+  // Allocated with the first write held back and freed with the CCB.
+  PDOKAN_WRITE_BEHIND WriteBehind;
 } DokanCCB, *PDokanCCB;
 
 //
@@ -781,6 +1204,19 @@ NTSTATUS DokanCheckOplock(
     __in_opt POPLOCK_WAIT_COMPLETE_ROUTINE CompletionRoutine,
     __in_opt POPLOCK_FS_PREPOST_IRP PostIrpRoutine);
 
+// Mapping in the file system process of the buffer of a zero-copy read or
+// write. See zerocopy.c.
+typedef struct _DOKAN_USER_MAPPING {
+  PIRP Irp;
+  PMDL Mdl;
+  PVOID UserAddress;
+  PEPROCESS Process;
+  // Used to unmap the buffer and complete the IRP when this has to happen
+  // above APC_LEVEL, e.g. from the cancel routine.
+  PIO_WORKITEM WorkItem;
+  NTSTATUS CompletionStatus;
+} DOKAN_USER_MAPPING, *PDOKAN_USER_MAPPING;
+
 typedef struct _REQUEST_CONTEXT {
   PDEVICE_OBJECT DeviceObject;
   ULONG ProcessId;
@@ -807,17 +1243,34 @@ typedef struct _REQUEST_CONTEXT {
 
   // Whether if we are the top-level IRP.
   BOOLEAN IsTopLevelIrp;
+
+  // Set when the buffer of a read or write is mapped in the file system
+  // process.
+  PDOKAN_USER_MAPPING UserMapping;
+
+  // KeQueryPerformanceCounter value at the arrival of the IRP.
+  LARGE_INTEGER ArrivalTime;
 } REQUEST_CONTEXT, *PREQUEST_CONTEXT;
 
 // IRP list which has pending status
 // this structure is also used to store event notification IRP
 typedef struct _IRP_ENTRY {
   LIST_ENTRY ListEntry;
+  // Link in the Dcb PendingIrpTable bucket of SerialNumber. Self-linked when
+  // the entry is not indexed.
+  LIST_ENTRY SerialNumberEntry;
+  // Link in the Dcb PendingIrpTimeoutWheel bucket of TickCount. Self-linked
+  // when the entry is not in PendingIrp.
+  LIST_ENTRY TimeoutEntry;
   ULONG SerialNumber;
   REQUEST_CONTEXT RequestContext;
   BOOLEAN CancelRoutineFreeMemory;
   NTSTATUS AsyncStatus;
   LARGE_INTEGER TickCount;
+  // KeQueryPerformanceCounter value when the event of the IRP was pulled by
+  // the file system, or 0 if it was not pulled through
+  // FSCTL_EVENT_PROCESS_N_PULL.
+  LARGE_INTEGER PulledTime;
   PIRP_LIST IrpList;
 } IRP_ENTRY, *PIRP_ENTRY;
 
@@ -832,6 +1285,9 @@ typedef struct _DEVICE_ENTRY {
 
 typedef struct _DRIVER_EVENT_CONTEXT {
   LIST_ENTRY ListEntry;
+  // Lookaside list the context comes from, or
+  // DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT if it was allocated from the pool.
+  ULONG SizeClass;
   EVENT_CONTEXT EventContext;
 } DRIVER_EVENT_CONTEXT, *PDRIVER_EVENT_CONTEXT;
 
@@ -957,11 +1413,29 @@ VOID DokanPrePostIrp(IN PVOID Context, IN PIRP Irp);
 NTSTATUS
 DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext);
 
+NTSTATUS
+DokanCompleteEventInformation(__in PREQUEST_CONTEXT RequestContext,
+                              __in PCHAR Buffer, __in ULONG BufferLength);
+
 NTSTATUS DokanResetPendingIrpTimeout(__in PREQUEST_CONTEXT RequestContext);
 
+NTSTATUS DokanResetAllPendingIrpTimeouts(__in PREQUEST_CONTEXT RequestContext);
+
+NTSTATUS DokanHeartbeat(__in PREQUEST_CONTEXT RequestContext);
+
+// FSCTL_ECHO handler, and the completion of each of its events.
+NTSTATUS DokanEcho(__in PREQUEST_CONTEXT RequestContext);
+
+VOID DokanCompleteEcho(__in PREQUEST_CONTEXT RequestContext,
+                       __in PEVENT_INFORMATION EventInfo);
+
 NTSTATUS
 DokanGetAccessToken(__in PREQUEST_CONTEXT RequestContext);
 
+VOID DokanQueryRequestorTokenIds(__in PSECURITY_SUBJECT_CONTEXT SubjectContext,
+                                 __out PLUID AuthenticationId,
+                                 __out PLUID TokenId);
+
 NTSTATUS
 DokanCheckShareAccess(_In_ PREQUEST_CONTEXT RequestContext,
                       _In_ PFILE_OBJECT FileObject, _In_ PDokanFCB FcbOrDcb,
@@ -970,6 +1444,11 @@ DokanCheckShareAccess(_In_ PREQUEST_CONTEXT RequestContext,
 NTSTATUS
 DokanGetMountPointList(__in PREQUEST_CONTEXT RequestContext);
 
+// Handles FSCTL_MOUNTPOINT_LIST_CHANGE. Returns STATUS_PENDING when the IRP
+// waits for the next change of the mount point list.
+NTSTATUS
+DokanWaitMountPointListChange(__in PREQUEST_CONTEXT RequestContext);
+
 NTSTATUS
 DokanDispatchRequest(__in PDEVICE_OBJECT DeviceObject, __in PIRP Irp,
                      BOOLEAN IsTopLevelIrp);
@@ -996,6 +1475,26 @@ DokanEventWrite(__in PREQUEST_CONTEXT RequestContext);
 
 NTSTATUS DokanGetVolumeMetrics(__in PREQUEST_CONTEXT RequestContext);
 
+NTSTATUS DokanGetVolumeMetricsEx(__in PREQUEST_CONTEXT RequestContext);
+
+NTSTATUS DokanUpdateVolumeInfo(__in PREQUEST_CONTEXT RequestContext);
+
+// Returns the DOKAN_LATENCY_BUCKET_COUNT bucket of a latency given in
+// performance counter ticks.
+ULONG DokanGetLatencyBucket(__in LONGLONG Ticks, __in LONGLONG Frequency);
+
+VOID DokanRecordOperationMetrics(__in PDokanVCB Vcb,
+                                 __in PIRP_ENTRY IrpEntry,
+                                 __in PEVENT_INFORMATION EventInfo);
+
+// Counts the request in the profile of the volume if it is sampled. Latency is
+// in microseconds.
+VOID DokanProfileRequest(__in PDokanVCB Vcb,
+                         __in PREQUEST_CONTEXT RequestContext,
+                         __in ULONG64 Latency);
+
+NTSTATUS DokanGetVolumeProfile(__in PREQUEST_CONTEXT RequestContext);
+
 PEVENT_CONTEXT
 AllocateEventContextRaw(__in ULONG EventContextLength);
 
@@ -1005,28 +1504,249 @@ AllocateEventContext(__in PREQUEST_CONTEXT RequestContext,
 
 VOID DokanFreeEventContext(__in PEVENT_CONTEXT EventContext);
 
+BOOLEAN DokanInitEventContextLookasideLists();
+
+VOID DokanDeleteEventContextLookasideLists();
+
+// Fills the driver wide allocation metrics of Metrics.
+VOID DokanGetAllocationMetrics(__out PVOLUME_METRICS_EX Metrics);
+
 NTSTATUS
 DokanRegisterPendingIrp(__in PREQUEST_CONTEXT RequestContext,
                         __in PEVENT_CONTEXT EventContext);
 
+// Marks the IRP pending and queues it in IrpList, where it stays until it is
+// completed by its owner or canceled.
+NTSTATUS
+RegisterPendingIrpMain(__in PREQUEST_CONTEXT RequestContext,
+                       __in_opt PEVENT_CONTEXT EventContext,
+                       __in PIRP_LIST IrpList, __in ULONG CheckMount,
+                       __in NTSTATUS CurrentStatus);
+
 VOID DokanRegisterPendingRetryIrp(__in PREQUEST_CONTEXT RequestContext);
 
+// Moves the IRPs of Source to Dest after clearing their cancel routine.
+VOID MoveIrpList(__in PIRP_LIST Source, __out LIST_ENTRY* Dest);
+
+// Removes the first IRP of Source that is not canceled after clearing its
+// cancel routine, or returns NULL if there is none.
+PIRP_ENTRY PopIrpList(__in PIRP_LIST Source);
+
+PIRP_ENTRY
+DokanLookupPendingIrp(__in PDokanDCB Dcb, __in ULONG SerialNumber);
+
+VOID DokanRemoveIrpEntry(__in PIRP_ENTRY IrpEntry);
+
 VOID DokanRegisterAsyncCreateFailure(__in PREQUEST_CONTEXT RequestContext,
                                      __in NTSTATUS Status);
 
+VOID DokanQueueEvent(__in PDokanDCB Dcb, __in PEVENT_CONTEXT EventContext);
+
 VOID DokanEventNotification(__in PREQUEST_CONTEXT RequestContext,
-                            __in PIRP_LIST NotifyEvent,
                             __in PEVENT_CONTEXT EventContext);
 
+VOID DokanSignalNotifyEvent(__in PDokanDCB Dcb);
+
+VOID DokanCompletePendingPulls(__in PDokanDCB Dcb);
+
+NTSTATUS
+DokanEventRingRegister(__in PREQUEST_CONTEXT RequestContext);
+
+NTSTATUS
+DokanEventRingDoorbell(__in PREQUEST_CONTEXT RequestContext);
+
+VOID DokanEventRingRelease(__in PDokanDCB Dcb,
+                           __in_opt PFILE_OBJECT FileObject);
+
+BOOLEAN DokanEventRingPost(__in PDokanDCB Dcb,
+                           __in PEVENT_CONTEXT EventContext);
+
 VOID DokanCompleteDirectoryControl(__in PREQUEST_CONTEXT RequestContext,
                                    __in PEVENT_INFORMATION EventInfo);
 
+// Frees the buffer of an IRP_MN_MDL read that failed with Status. Does nothing
+// for other IRPs.
+VOID DokanReleaseMdlReadBuffer(__in PIRP Irp, __in NTSTATUS Status);
+
 VOID DokanCompleteRead(__in PREQUEST_CONTEXT RequestContext,
                        __in PEVENT_INFORMATION EventInfo);
 
+VOID DokanMapReadBuffer(__in PREQUEST_CONTEXT RequestContext,
+                        __in PEVENT_CONTEXT EventContext);
+
+ULONG64 DokanMapWriteBuffer(__in PREQUEST_CONTEXT RequestContext);
+
+VOID DokanUnmapUserBuffer(__in PREQUEST_CONTEXT RequestContext);
+
+VOID DokanCompleteMappedIrpRequest(__in PREQUEST_CONTEXT RequestContext,
+                                   __in NTSTATUS Status);
+
 VOID DokanCompleteWrite(__in PREQUEST_CONTEXT RequestContext,
                         __in PEVENT_INFORMATION EventInfo);
 
+VOID DokanInvalidateFileInfoCache(__in PDokanFCB Fcb);
+
+// Moves the times and attributes held for the file with DeferBasicInfo to
+// Info, for the cleanup or flush event about to be sent. The caller must hold
+// the FCB lock exclusively.
+VOID DokanTakeDeferredBasicInfo(__in PDokanFCB Fcb,
+                                __out PDOKAN_DEFERRED_BASIC_INFO Info);
+
+VOID DokanInvalidateVolumeFileInfoCache(__in PDokanVCB Vcb);
+
+// Fills the file info cache of Fcb from the attributes carried by the reply to
+// its create. The caller must hold the FCB lock exclusively.
+VOID DokanFillFileInfoCacheFromCreate(__in PREQUEST_CONTEXT RequestContext,
+                                      __in PDokanFCB Fcb,
+                                      __in PDOKAN_CREATE_FILE_INFO CreateInfo);
+
+// Fast I/O attribute queries, answered from DOKAN_FILE_INFO_CACHE only.
+FAST_IO_QUERY_BASIC_INFO DokanFastIoQueryBasicInfo;
+FAST_IO_QUERY_STANDARD_INFO DokanFastIoQueryStandardInfo;
+FAST_IO_QUERY_NETWORK_OPEN_INFO DokanFastIoQueryNetworkOpenInfo;
+
+VOID DokanInvalidateSecurityCache(__in PDokanFCB Fcb);
+
+VOID DokanInvalidateVolumeSecurityCache(__in PDokanVCB Vcb);
+
+VOID DokanFreeSecurityCache(__in PDokanFCB Fcb);
+
+// Whether the create can be granted from the security cache of Fcb alone.
+// See DOKAN_CREATE_ACCESS_CHECKED.
+BOOLEAN DokanCheckCachedAccess(__in PREQUEST_CONTEXT RequestContext,
+                               __in PDokanFCB Fcb);
+
+// Drops the read-ahead window of the file after a change made through the
+// driver.
+VOID DokanInvalidateReadAhead(__in PDokanFCB Fcb);
+
+// Drops the read-ahead windows of all the files of the volume, for a change
+// reported by the file system.
+VOID DokanInvalidateVolumeReadAhead(__in PDokanVCB Vcb);
+
+// Frees the read-ahead window of the file. The caller must hold the FCB lock
+// exclusively.
+VOID DokanFreeReadAhead(__in PDokanFCB Fcb);
+
+// Records a non-cached read of the handle and returns whether it continues a
+// sequential run.
+BOOLEAN DokanIsSequentialRead(__in PDokanCCB Ccb, __in LONGLONG ByteOffset,
+                              __in ULONG Length);
+
+// Copies the data of the read from the read-ahead window of the file into
+// Buffer if it holds it. The caller must hold the FCB lock.
+BOOLEAN DokanReadFromReadAhead(__in PDokanFCB Fcb, __in LONGLONG ByteOffset,
+                               __in ULONG Length, __out PVOID Buffer,
+                               __out PULONG ReadLength);
+
+// Applies the DOKAN_CACHE_HINT_* and read-ahead granularity given by the file
+// system for a handle it opened.
+VOID DokanSetCacheHints(__in PDokanCCB Ccb, __in PFILE_OBJECT FileObject,
+                        __in ULONG CacheHints,
+                        __in ULONG ReadAheadGranularity);
+
+// Returns the read-ahead window of the handle.
+ULONG DokanGetReadAheadWindowSize(__in PDokanCCB Ccb);
+
+// Returns how many bytes to read ahead of a sequential read of the handle, or
+// 0 if it does not read ahead or the memory limit of the windows is reached.
+ULONG DokanGetReadAheadWindow(__in PDokanCCB Ccb);
+
+// Keeps the Length bytes of Buffer, read ahead at ByteOffset, as the window of
+// the file unless it changed since the read arrived.
+VOID DokanFillReadAhead(__in PREQUEST_CONTEXT RequestContext,
+                        __in PDokanFCB Fcb, __in LONGLONG ByteOffset,
+                        __in PVOID Buffer, __in ULONG Length,
+                        __in BOOLEAN EndOfFile);
+
+// Keeps the data of a file handed over with FSCTL_HYDRATE_RANGE in its window.
+NTSTATUS DokanHydrateRange(__in PREQUEST_CONTEXT RequestContext);
+
+// Grants the lease replied to the create of the file, if any. The caller must
+// hold the FCB lock exclusively.
+VOID DokanGrantLease(__in PREQUEST_CONTEXT RequestContext, __in PDokanFCB Fcb,
+                     __in ULONG Level, __in ULONG DurationMs);
+
+// Returns whether the file has an unexpired lease of Level. The caller must
+// hold the FCB lock.
+BOOLEAN DokanHasLease(__in PDokanFCB Fcb, __in ULONG Level);
+
+// FSCTL_BREAK_LEASE handler.
+NTSTATUS DokanBreakLease(__in PREQUEST_CONTEXT RequestContext);
+
+VOID DokanInitWriteBehind(__in PDokanVCB Vcb);
+
+VOID DokanFreeWriteBehind(__in PDokanCCB Ccb);
+
+// Returns whether Irp is the write sending the data held by the handle.
+BOOLEAN DokanIsWriteBehindFlush(__in PDokanCCB Ccb, __in PIRP Irp);
+
+// Sends the data held by the handle, waits for it to be written and returns
+// the first failure of its held writes not reported yet.
+NTSTATUS DokanFlushWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                               __in PDokanCCB Ccb);
+
+// Sends the data held by the handles of the file that overlaps the range.
+VOID DokanFlushConflictingWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                                      __in PDokanFCB Fcb,
+                                      __in LONGLONG ByteOffset,
+                                      __in ULONG Length);
+
+// Holds the non-cached write of the handle back when it can be coalesced with
+// the next ones, in which case Handled is set and the write is complete.
+// Otherwise the data already held is sent first and the write must be sent.
+NTSTATUS DokanWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                          __in PDokanCCB Ccb, __in LARGE_INTEGER ByteOffset,
+                          __in PVOID Buffer, __in ULONG Length,
+                          __out PBOOLEAN Handled);
+
+// Sends the data held longer than EVENT_START.WriteBehindTimeoutMs, or all of
+// it with Force.
+VOID DokanCheckWriteBehindTimeout(__in PDokanDCB Dcb, __in BOOLEAN Force);
+
+// Adds the close of the handle to the pending DOKAN_IRP_CLOSE_BATCH event.
+// Returns FALSE when it must be sent as its own IRP_MJ_CLOSE event instead.
+BOOLEAN DokanBatchClose(__in PREQUEST_CONTEXT RequestContext,
+                        __in PDokanCCB Ccb, __in PUNICODE_STRING FileName);
+
+// Sends the pending DOKAN_IRP_CLOSE_BATCH event, if any.
+VOID DokanFlushCloseBatch(__in PDokanDCB Dcb);
+
+// Drops the pending DOKAN_IRP_CLOSE_BATCH event on unmount.
+VOID DokanFreeCloseBatch(__in PDokanDCB Dcb);
+
+// Holds a change notification of the file system to be reported by
+// DokanFlushNotificationBatch. Returns FALSE when it must be reported now.
+BOOLEAN DokanBatchNotification(__in PDokanDCB Dcb,
+                               __in PUNICODE_STRING FileName,
+                               __in ULONG CompletionFilter, __in ULONG Action);
+
+// Reports the held change notifications, or ends all the change notification
+// waits when too many were held.
+VOID DokanFlushNotificationBatch(__in PDokanDCB Dcb);
+
+// Drops the held change notifications on unmount.
+VOID DokanFreeNotificationBatch(__in PDokanDCB Dcb);
+
+VOID DokanInitNegativeCache(__in PDokanVCB Vcb);
+
+VOID DokanCleanupNegativeCache(__in PDokanVCB Vcb);
+
+// Returns whether FileName was recently reported missing by the file system.
+BOOLEAN DokanLookupNegativeCache(__in PDokanVCB Vcb,
+                                 __in PUNICODE_STRING FileName);
+
+// Remembers that the open of FileName made by RequestContext found nothing.
+VOID DokanAddNegativeCacheEntry(__in PREQUEST_CONTEXT RequestContext,
+                                __in PUNICODE_STRING FileName);
+
+// Forgets the miss of FileName, which was just created.
+VOID DokanRemoveNegativeCacheEntry(__in PDokanVCB Vcb,
+                                   __in PUNICODE_STRING FileName);
+
+// Forgets all the misses, for changes that may affect more than one name.
+VOID DokanFlushNegativeCache(__in PDokanVCB Vcb);
+
 VOID DokanCompleteQueryInformation(__in PREQUEST_CONTEXT RequestContext,
                                    __in PEVENT_INFORMATION EventInfo);
 
@@ -1053,6 +1773,9 @@ VOID DokanCompleteQueryVolumeInformation(__in PREQUEST_CONTEXT RequestContext,
 VOID DokanCompleteFlush(__in PREQUEST_CONTEXT RequestContext,
                         __in PEVENT_INFORMATION EventInfo);
 
+VOID DokanCompleteFileSystemControl(__in PREQUEST_CONTEXT RequestContext,
+                                    __in PEVENT_INFORMATION EventInfo);
+
 VOID DokanCompleteQuerySecurity(__in PREQUEST_CONTEXT RequestContext,
                                 __in PEVENT_INFORMATION EventInfo);
 
@@ -1127,6 +1850,11 @@ NTSTATUS DokanNotifyReportChange0(__in PREQUEST_CONTEXT RequestContext,
                                   __in ULONG FilterMatch,
                                   __in ULONG Action);
 
+// Reports a change to the waiters of the volume, outside of any request.
+NTSTATUS DokanNotifyVolumeChange(__in PDokanVCB Vcb,
+                                 __in PUNICODE_STRING FileName,
+                                 __in ULONG FilterMatch, __in ULONG Action);
+
 NTSTATUS DokanNotifyReportChange(__in PREQUEST_CONTEXT RequestContext,
                                  __in PDokanFCB Fcb,
                                  __in ULONG FilterMatch,
@@ -1159,6 +1887,8 @@ VOID DokanStopEventNotificationThread(__in PDokanDCB Dcb);
 
 VOID DokanUpdateTimeout(__out PLARGE_INTEGER KickCount, __in ULONG Timeout);
 
+VOID DokanTrackPendingIrpTimeout(__in PDokanDCB Dcb, __in PIRP_ENTRY IrpEntry);
+
 VOID DokanUnmount(__in_opt PREQUEST_CONTEXT RequestContext, __in PDokanDCB Dcb);
 
 BOOLEAN IsUnmountPending(__in PDEVICE_OBJECT DeviceObject);
@@ -1195,6 +1925,13 @@ PMOUNT_ENTRY FindMountEntryByName(__in PDOKAN_GLOBAL DokanGlobal,
                                   __in PUNICODE_STRING UNCName,
                                   __in BOOLEAN ExclusiveLock);
 
+// Changes the mount point of the mount entry of DiskDeviceName. Returns FALSE
+// if there is no such entry.
+BOOLEAN UpdateMountEntryMountPoint(__in PDOKAN_GLOBAL DokanGlobal,
+                                   __in PUNICODE_STRING DiskDeviceName,
+                                   __in PUNICODE_STRING UNCName,
+                                   __in PUNICODE_STRING MountPoint);
+
 NTSTATUS DokanAllocateMdl(__in PREQUEST_CONTEXT RequestContext,
                           __in ULONG Length);
 
@@ -0,0 +1,88 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Transport self-test.
+//
+// FSCTL_ECHO sends DOKAN_ECHO.EventCount DOKAN_IRP_ECHO events to user mode,
+// one after the other, each with the FSCTL as its pending IRP. dokan.dll
+// answers them without calling the file system, so their round trip, from
+// being queued to being answered, is the cost of the transport alone. The
+// FSCTL completes with the timings once the last one is answered.
+
+// Queues the next echo event of the FSCTL.
+static NTSTATUS SendEcho(__in PREQUEST_CONTEXT RequestContext) {
+  PEVENT_CONTEXT eventContext =
+      AllocateEventContext(RequestContext, sizeof(EVENT_CONTEXT), NULL);
+  if (eventContext == NULL) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  eventContext->MajorFunction = DOKAN_IRP_ECHO;
+  RequestContext->ArrivalTime = KeQueryPerformanceCounter(NULL);
+  return DokanRegisterPendingIrp(RequestContext, eventContext);
+}
+
+NTSTATUS DokanEcho(__in PREQUEST_CONTEXT RequestContext) {
+  PDOKAN_ECHO echo = NULL;
+  ULONG eventCount;
+
+  GET_IRP_BUFFER_OR_RETURN(RequestContext->Irp, echo);
+  eventCount = min(echo->EventCount, DOKAN_ECHO_MAX_EVENT_COUNT);
+  if (!PREPARE_OUTPUT(RequestContext->Irp, echo,
+                      /*SetInformationOnFailure=*/FALSE)) {
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+  echo->EventCount = eventCount;
+  if (eventCount == 0) {
+    return STATUS_SUCCESS;
+  }
+  echo->MinLatency = MAXULONG64;
+  return SendEcho(RequestContext);
+}
+
+VOID DokanCompleteEcho(__in PREQUEST_CONTEXT RequestContext,
+                       __in PEVENT_INFORMATION EventInfo) {
+  PDOKAN_ECHO echo = RequestContext->Irp->AssociatedIrp.SystemBuffer;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now = KeQueryPerformanceCounter(&frequency);
+  LONGLONG ticks = now.QuadPart - RequestContext->ArrivalTime.QuadPart;
+  ULONG64 latency = (ULONG64)max(ticks, 0) * 1000000 / frequency.QuadPart;
+  NTSTATUS status;
+
+  ++echo->AnsweredCount;
+  echo->TotalLatency += latency;
+  echo->MinLatency = min(echo->MinLatency, latency);
+  echo->MaxLatency = max(echo->MaxLatency, latency);
+  ++echo->Latency[DokanGetLatencyBucket(ticks, frequency.QuadPart)];
+
+  if (!NT_SUCCESS(EventInfo->Status) ||
+      echo->AnsweredCount == echo->EventCount) {
+    RequestContext->Irp->IoStatus.Status = EventInfo->Status;
+    return;
+  }
+  status = SendEcho(RequestContext);
+  if (status == STATUS_PENDING) {
+    // The IRP now belongs to the entry of the next event.
+    RequestContext->DoNotComplete = TRUE;
+    return;
+  }
+  RequestContext->Irp->IoStatus.Status = status;
+}
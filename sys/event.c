@@ -84,8 +84,7 @@ VOID DokanIrpCancelRoutine(_Inout_ PDEVICE_OBJECT DeviceObject,
 
     serialNumber = irpEntry->SerialNumber;
 
-    RemoveEntryList(&irpEntry->ListEntry);
-    InitializeListHead(&irpEntry->ListEntry);
+    DokanRemoveIrpEntry(irpEntry);
 
     // If Write is canceld before completion and buffer that saves writing
     // content is not freed, free it here
@@ -103,6 +102,8 @@ VOID DokanIrpCancelRoutine(_Inout_ PDEVICE_OBJECT DeviceObject,
     }
 
     irpEntry->RequestContext.Irp = NULL;
+    requestContext.UserMapping = irpEntry->RequestContext.UserMapping;
+    irpEntry->RequestContext.UserMapping = NULL;
 
     if (irpEntry->CancelRoutineFreeMemory == FALSE) {
       InitializeListHead(&irpEntry->ListEntry);
@@ -118,7 +119,7 @@ VOID DokanIrpCancelRoutine(_Inout_ PDEVICE_OBJECT DeviceObject,
   }
 
   Irp->IoStatus.Information = 0;
-  DokanCompleteIrpRequest(Irp, STATUS_CANCELLED);
+  DokanCompleteMappedIrpRequest(&requestContext, STATUS_CANCELLED);
 }
 
 VOID DokanOplockComplete(IN PVOID Context, IN PIRP Irp)
@@ -158,11 +159,21 @@ None.
   //
   //  Check on the return value in the Irp.
   //
+  if (irpSp->MajorFunction == IRP_MJ_WRITE) {
+    // The buffer of a large write may have been mapped before it was posted.
+    requestContext.UserMapping =
+        Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_USER_MAPPING];
+    Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_USER_MAPPING] = NULL;
+  }
+
   if (Irp->IoStatus.Status == STATUS_SUCCESS) {
-    DokanRegisterPendingIrp(&requestContext, (PEVENT_CONTEXT)Context);
+    if (DokanRegisterPendingIrp(&requestContext, (PEVENT_CONTEXT)Context) !=
+        STATUS_PENDING) {
+      DokanUnmapUserBuffer(&requestContext);
+    }
   } else {
     Irp->IoStatus.Information = 0;
-    DokanCompleteIrpRequest(Irp, Irp->IoStatus.Status);
+    DokanCompleteMappedIrpRequest(&requestContext, Irp->IoStatus.Status);
   }
 }
 
@@ -207,6 +218,8 @@ RegisterPendingIrpMain(__in PREQUEST_CONTEXT RequestContext,
   RtlZeroMemory(irpEntry, sizeof(IRP_ENTRY));
 
   InitializeListHead(&irpEntry->ListEntry);
+  InitializeListHead(&irpEntry->SerialNumberEntry);
+  InitializeListHead(&irpEntry->TimeoutEntry);
 
   irpEntry->SerialNumber = 0;
   irpEntry->RequestContext = *RequestContext;
@@ -240,6 +253,7 @@ RegisterPendingIrpMain(__in PREQUEST_CONTEXT RequestContext,
     EventContext->SerialNumber =
         InterlockedIncrement((LONG*)&RequestContext->Dcb->SerialNumber);
     irpEntry->SerialNumber = EventContext->SerialNumber;
+    DOKAN_TRACE_IRP_SEND(RequestContext, irpEntry->SerialNumber);
   }
   if (RequestContext->IrpSp->MajorFunction == IRP_MJ_CREATE) {
     IoSetCancelRoutine(RequestContext->Irp, DokanCreateIrpCancelRoutine);
@@ -258,6 +272,14 @@ RegisterPendingIrpMain(__in PREQUEST_CONTEXT RequestContext,
   IoMarkIrpPending(RequestContext->Irp);
 
   InsertTailList(&IrpList->ListHead, &irpEntry->ListEntry);
+  if (IrpList == &RequestContext->Dcb->PendingIrp) {
+    if (irpEntry->SerialNumber) {
+      InsertTailList(
+          DokanPendingIrpBucket(RequestContext->Dcb, irpEntry->SerialNumber),
+          &irpEntry->SerialNumberEntry);
+    }
+    DokanTrackPendingIrpTimeout(RequestContext->Dcb, irpEntry);
+  }
 
   irpEntry->CancelRoutineFreeMemory = FALSE;
 
@@ -274,6 +296,35 @@ RegisterPendingIrpMain(__in PREQUEST_CONTEXT RequestContext,
   return STATUS_PENDING;
 }
 
+// Finds the entry of PendingIrp that was sent to userland with the given serial
+// number. The caller must hold PendingIrp.ListLock.
+PIRP_ENTRY
+DokanLookupPendingIrp(__in PDokanDCB Dcb, __in ULONG SerialNumber) {
+  PLIST_ENTRY thisEntry, listHead;
+  PIRP_ENTRY irpEntry;
+
+  listHead = DokanPendingIrpBucket(Dcb, SerialNumber);
+  for (thisEntry = listHead->Flink; thisEntry != listHead;
+       thisEntry = thisEntry->Flink) {
+    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, SerialNumberEntry);
+    if (irpEntry->SerialNumber == SerialNumber) {
+      return irpEntry;
+    }
+  }
+  return NULL;
+}
+
+// Unlinks the entry from its IRP list, from the serial number index and from
+// the timeout wheel. The caller must hold the lock of the IRP list.
+VOID DokanRemoveIrpEntry(__in PIRP_ENTRY IrpEntry) {
+  RemoveEntryList(&IrpEntry->ListEntry);
+  InitializeListHead(&IrpEntry->ListEntry);
+  RemoveEntryList(&IrpEntry->SerialNumberEntry);
+  InitializeListHead(&IrpEntry->SerialNumberEntry);
+  RemoveEntryList(&IrpEntry->TimeoutEntry);
+  InitializeListHead(&IrpEntry->TimeoutEntry);
+}
+
 NTSTATUS
 DokanRegisterPendingIrp(__in PREQUEST_CONTEXT RequestContext,
                         __in PEVENT_CONTEXT EventContext) {
@@ -308,8 +359,7 @@ DokanRegisterPendingIrp(__in PREQUEST_CONTEXT RequestContext,
 
 
   if (status == STATUS_PENDING) {
-    DokanEventNotification(RequestContext, &RequestContext->Dcb->NotifyEvent,
-                           EventContext);
+    DokanEventNotification(RequestContext, EventContext);
   } else {
     DokanFreeEventContext(EventContext);
   }
@@ -394,6 +444,9 @@ void DokanDispatchCompletion(__in PDEVICE_OBJECT DeviceObject,
   case IRP_MJ_FLUSH_BUFFERS:
     DokanCompleteFlush(&irpEntry->RequestContext, eventInfo);
     break;
+  case IRP_MJ_FILE_SYSTEM_CONTROL:
+    DokanCompleteFileSystemControl(&irpEntry->RequestContext, eventInfo);
+    break;
   case IRP_MJ_QUERY_SECURITY:
     DokanCompleteQuerySecurity(&irpEntry->RequestContext, eventInfo);
     break;
@@ -402,15 +455,20 @@ void DokanDispatchCompletion(__in PDEVICE_OBJECT DeviceObject,
     break;
   }
 
+  // An IRP handed to FsRtl by DokanCompleteLock may already be completed.
   DOKAN_LOG_END_MJ((&irpEntry->RequestContext),
-                   irpEntry->RequestContext.Irp->IoStatus.Status);
+                   irpEntry->RequestContext.DoNotComplete
+                       ? STATUS_PENDING
+                       : irpEntry->RequestContext.Irp->IoStatus.Status);
 }
 
 ULONG
-GetEventInfoSize(__in ULONG MajorFunction, __in PEVENT_INFORMATION EventInfo) {
-  if (MajorFunction == IRP_MJ_WRITE) {
-    // For writes only, the reply is a fixed size and the BufferLength inside it
-    // is the "bytes written" value as opposed to the reply size.
+GetEventInfoSize(__in PIRP_ENTRY IrpEntry, __in PEVENT_INFORMATION EventInfo) {
+  if (IrpEntry->RequestContext.IrpSp->MajorFunction == IRP_MJ_WRITE ||
+      IrpEntry->RequestContext.UserMapping != NULL) {
+    // For writes and zero-copy reads, the reply is a fixed size and the
+    // BufferLength inside it is the "bytes written" or "bytes read" value as
+    // opposed to the reply size.
     return sizeof(EVENT_INFORMATION);
   }
   if (EventInfo->Status == STATUS_BUFFER_OVERFLOW) {
@@ -428,17 +486,6 @@ GetEventInfoSize(__in ULONG MajorFunction, __in PEVENT_INFORMATION EventInfo) {
 // search corresponding pending IRP and complete it
 NTSTATUS
 DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
-  DOKAN_INIT_LOGGER(logger, RequestContext->DeviceObject->DriverObject, 0);
-  KIRQL oldIrql;
-  NTSTATUS result = STATUS_SUCCESS;
-  PLIST_ENTRY thisEntry, nextEntry, listHead;
-  PIRP_ENTRY irpEntry;
-  LIST_ENTRY completeList;
-  ULONG offset = 0;
-  ULONG eventInfoSize = 0;
-  ULONG lastSerialNumber = 0;
-  PEVENT_INFORMATION eventInfo = NULL;
-  BOOLEAN badUsageByCaller = FALSE;
   ULONG bufferLength = 0;
   PCHAR buffer = NULL;
 
@@ -457,18 +504,35 @@ DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
   buffer = (PCHAR)RequestContext->Irp->AssociatedIrp.SystemBuffer;
   ASSERT(buffer != NULL);
 
+  return DokanCompleteEventInformation(RequestContext, buffer, bufferLength);
+}
+
+// Completes the pending IRPs answered by the batch of EVENT_INFORMATION sorted
+// by serial number held in Buffer. Buffer must not be accessible from user mode
+// as it is trusted once validated.
+NTSTATUS
+DokanCompleteEventInformation(__in PREQUEST_CONTEXT RequestContext,
+                              __in PCHAR Buffer, __in ULONG BufferLength) {
+  DOKAN_INIT_LOGGER(logger, RequestContext->DeviceObject->DriverObject, 0);
+  KIRQL oldIrql;
+  NTSTATUS result = STATUS_SUCCESS;
+  PLIST_ENTRY listHead;
+  PIRP_ENTRY irpEntry;
+  LIST_ENTRY completeList;
+  ULONG offset = 0;
+  ULONG eventInfoSize = 0;
+  ULONG lastSerialNumber = 0;
+  PEVENT_INFORMATION eventInfo = NULL;
+  BOOLEAN badUsageByCaller = FALSE;
+
   InitializeListHead(&completeList);
 
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, &oldIrql);
 
-  // search corresponding IRP through pending IRP list
-  listHead = &RequestContext->Dcb->PendingIrp.ListHead;
-  for (thisEntry = listHead->Flink; thisEntry != listHead;
-       thisEntry = nextEntry) {
-    nextEntry = thisEntry->Flink;
-    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-    eventInfo = (PEVENT_INFORMATION)(buffer + offset);
+  // search corresponding IRP through the pending IRP index
+  for (;;) {
+    eventInfo = (PEVENT_INFORMATION)(Buffer + offset);
     if (eventInfo->SerialNumber < lastSerialNumber) {
       // This would be a coding error in the DLL.
       result = DokanLogError(&logger,
@@ -478,10 +542,15 @@ DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
       break;
     }
     lastSerialNumber = eventInfo->SerialNumber;
-    if (irpEntry->SerialNumber != eventInfo->SerialNumber) {
-      continue;
+    irpEntry =
+        DokanLookupPendingIrp(RequestContext->Dcb, eventInfo->SerialNumber);
+    if (irpEntry == NULL) {
+      // The IRP is gone (e.g. timed out). Without it we cannot know the size of
+      // this reply, so the rest of the batch cannot be located either.
+      break;
     }
-    RemoveEntryList(thisEntry);
+    offset += GetEventInfoSize(irpEntry, eventInfo);
+    DokanRemoveIrpEntry(irpEntry);
     if (irpEntry->RequestContext.Irp == NULL) {
       // This IRP is already canceled; just discard it.
       ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
@@ -489,20 +558,17 @@ DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
     } else if (IoSetCancelRoutine(irpEntry->RequestContext.Irp, NULL) == NULL) {
       // Cancellation is already in progress, and the cancel routine will run as
       // soon as we release the lock.
-      InitializeListHead(&irpEntry->ListEntry);
       irpEntry->CancelRoutineFreeMemory = TRUE;
     } else {
       // IrpEntry is saved here for CancelRoutine
       // Clear it to prevent to be completed by CancelRoutine twice
       irpEntry->RequestContext.Irp->Tail.Overlay
           .DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
-      InsertTailList(&completeList, thisEntry);
+      InsertTailList(&completeList, &irpEntry->ListEntry);
     }
-    offset += GetEventInfoSize(irpEntry->RequestContext.IrpSp->MajorFunction,
-                               eventInfo);
     // Everything through offset - 1 must be readable by the completion function
     // that receives the EVENT_INFORMATION object.
-    if (offset > bufferLength) {
+    if (offset > BufferLength) {
       result = DokanLogError(
           &logger,
           STATUS_INVALID_PARAMETER,
@@ -521,7 +587,7 @@ DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
     // Don't loop if batching is not enabled; there should only be one reply at
     // a time in that case.
     if (!RequestContext->Dcb->AllowIpcBatching) {
-      if (offset < bufferLength) {
+      if (offset < BufferLength) {
         result = DokanLogError(
             &logger,
             STATUS_INVALID_PARAMETER,
@@ -531,12 +597,12 @@ DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
       break;
     }
     // Don't loop if this is the last reply in the batch.
-    if (offset == bufferLength) {
+    if (offset == BufferLength) {
       break;
     }
     // Don't loop if the next thing in the batch is a fragment of an
     // EVENT_INFORMATION object.
-    if (offset + sizeof(EVENT_INFORMATION) > bufferLength) {
+    if (offset + sizeof(EVENT_INFORMATION) > BufferLength) {
       DokanLogInfo(&logger, L"Wrong input buffer length.");
       badUsageByCaller = TRUE;
       break;
@@ -555,15 +621,16 @@ DokanCompleteIrp(__in PREQUEST_CONTEXT RequestContext) {
       return STATUS_NO_SUCH_DEVICE;
     }
     irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
-    if (offset >= bufferLength) {
+    if (offset >= BufferLength) {
       DokanLogInfo(&logger, L"Unexpected end of event info list.");
       irpEntry->RequestContext.Irp->IoStatus.Information = 0;
-      DokanCompleteIrpRequest(irpEntry->RequestContext.Irp, STATUS_CANCELLED);
+      DokanCompleteMappedIrpRequest(&irpEntry->RequestContext,
+                                    STATUS_CANCELLED);
     } else {
-      eventInfo = (PEVENT_INFORMATION)(buffer + offset);
-      eventInfoSize = GetEventInfoSize(
-          irpEntry->RequestContext.IrpSp->MajorFunction,
-                                       eventInfo);
+      eventInfo = (PEVENT_INFORMATION)(Buffer + offset);
+      eventInfoSize = GetEventInfoSize(irpEntry, eventInfo);
+      DokanRecordOperationMetrics(irpEntry->RequestContext.Vcb, irpEntry,
+                                  eventInfo);
       DokanDispatchCompletion(RequestContext->DeviceObject, irpEntry, eventInfo);
       offset += eventInfoSize;
     }
@@ -945,6 +1012,30 @@ DokanEventStart(__in PREQUEST_CONTEXT RequestContext) {
       (eventStart->Flags & DOKAN_EVENT_DISPATCH_DRIVER_LOGS) != 0;
   dcb->AllowIpcBatching =
       (eventStart->Flags & DOKAN_EVENT_ALLOW_IPC_BATCHING) != 0;
+  // The mapped buffers could end up out of reach of a 32-bit process.
+  dcb->ZeroCopyRead = (eventStart->Flags & DOKAN_EVENT_ZERO_COPY_READ) != 0 &&
+                      !IoIs32bitProcess(RequestContext->Irp);
+  // Read-only mappings (MdlMappingNoWrite) need Windows 8.
+  dcb->ZeroCopyWrite =
+      (eventStart->Flags & DOKAN_EVENT_ZERO_COPY_WRITE) != 0 &&
+      !IoIs32bitProcess(RequestContext->Irp) &&
+      RtlIsNtDdiVersionAvailable(NTDDI_WIN8);
+  dcb->BatchClose = (eventStart->Flags & DOKAN_EVENT_BATCH_CLOSE) != 0;
+  dcb->DeferBasicInfo =
+      (eventStart->Flags & DOKAN_EVENT_DEFER_BASIC_INFO) != 0;
+  // Only effective with a SecurityCacheTimeoutMs, as the check uses the
+  // descriptors of the security cache.
+  dcb->KernelAccessCheck =
+      (eventStart->Flags & DOKAN_EVENT_KERNEL_ACCESS_CHECK) != 0;
+  dcb->WriteThrough = (eventStart->Flags & DOKAN_EVENT_WRITE_THROUGH) != 0;
+  dcb->CoalesceNotifications =
+      (eventStart->Flags & DOKAN_EVENT_COALESCE_NOTIFICATIONS) != 0;
+  dcb->FileLockHybrid = (eventStart->Flags & DOKAN_EVENT_FILELOCK_HYBRID) != 0;
+  dcb->AsyncCleanup = (eventStart->Flags & DOKAN_EVENT_ASYNC_CLEANUP) != 0;
+  if (dcb->ZeroCopyRead || dcb->ZeroCopyWrite) {
+    dcb->UserProcess = PsGetCurrentProcess();
+    ObReferenceObject(dcb->UserProcess);
+  }
   isMountPointDriveLetter = IsMountPointDriveLetter(dcb->MountPoint);
 
   if (dcb->DispatchDriverLogs) {
@@ -1000,9 +1091,14 @@ DokanEventStart(__in PREQUEST_CONTEXT RequestContext) {
   }
   DokanLogInfo(&logger, L"Inserted new mount entry.");
 
+  // The mount point is now reserved by the entry: other mounts can go on while
+  // this one finishes its own setup.
+  ExReleaseResourceLite(&RequestContext->DokanGlobal->Resource);
+  KeLeaveCriticalRegion();
+
   dcb->FileLockInUserMode = fileLockUserMode;
-  driverInfo->DeviceNumber = RequestContext->DokanGlobal->MountId;
-  driverInfo->MountId = RequestContext->DokanGlobal->MountId;
+  driverInfo->DeviceNumber = dcb->MountId;
+  driverInfo->MountId = dcb->MountId;
   driverInfo->Status = DOKAN_MOUNTED;
   driverInfo->DriverVersion = DOKAN_DRIVER_VERSION;
 
@@ -1031,6 +1127,51 @@ DokanEventStart(__in PREQUEST_CONTEXT RequestContext) {
     }
     dcb->IrpTimeout = eventStart->IrpTimeout;
   }
+  dcb->HeartbeatTimeout =
+      (eventStart->Flags & DOKAN_EVENT_HEARTBEAT_TIMEOUT) != 0;
+  DokanUpdateTimeout(&dcb->HeartbeatDeadline, dcb->IrpTimeout);
+  dcb->FileInfoCacheTimeoutMs = min(eventStart->FileInfoCacheTimeoutMs,
+                                    DOKAN_FILE_INFO_CACHE_MAX_TIMEOUT);
+  dcb->NegativeCacheTimeoutMs = min(eventStart->NegativeCacheTimeoutMs,
+                                    DOKAN_NEGATIVE_CACHE_MAX_TIMEOUT);
+  dcb->VolumeInfoCacheTimeoutMs = min(eventStart->VolumeInfoCacheTimeoutMs,
+                                      DOKAN_VOLUME_INFO_CACHE_MAX_TIMEOUT);
+  dcb->SecurityCacheTimeoutMs = min(eventStart->SecurityCacheTimeoutMs,
+                                    DOKAN_SECURITY_CACHE_MAX_TIMEOUT);
+  dcb->ReadAheadWindowSize =
+      min(eventStart->ReadAheadWindowSize, DOKAN_READ_AHEAD_MAX_WINDOW);
+  dcb->ReadAheadMemoryLimit =
+      eventStart->ReadAheadMemoryLimit > 0
+          ? min(eventStart->ReadAheadMemoryLimit,
+                DOKAN_READ_AHEAD_MAX_MEMORY_LIMIT)
+          : DOKAN_READ_AHEAD_DEFAULT_MEMORY_LIMIT;
+  dcb->WriteBehindMaxSize =
+      min(eventStart->WriteBehindMaxSize, DOKAN_WRITE_BEHIND_MAX_SIZE);
+  dcb->WriteBehindTimeoutMs =
+      eventStart->WriteBehindTimeoutMs > 0
+          ? min(eventStart->WriteBehindTimeoutMs,
+                DOKAN_WRITE_BEHIND_MAX_TIMEOUT)
+          : DOKAN_WRITE_BEHIND_DEFAULT_TIMEOUT;
+  dcb->SectorSize = eventStart->SectorSize;
+  if (dcb->SectorSize < 512 || dcb->SectorSize > 65536 ||
+      (dcb->SectorSize & (dcb->SectorSize - 1)) != 0) {
+    dcb->SectorSize = DOKAN_DEFAULT_SECTOR_SIZE;
+  }
+  dcb->MaxTransferSize =
+      eventStart->MaxTransferSize > 0
+          ? min(max(eventStart->MaxTransferSize, DOKAN_MIN_MAX_TRANSFER_SIZE),
+                DOKAN_MAX_MAX_TRANSFER_SIZE)
+          : DOKAN_DEFAULT_MAX_TRANSFER_SIZE;
+  // Whole sectors, which the smallest size holds for any sector size.
+  dcb->MaxTransferSize -= dcb->MaxTransferSize % dcb->SectorSize;
+  dcb->AllocationStepSize =
+      min(eventStart->AllocationStepSize, DOKAN_ALLOCATION_STEP_MAX_SIZE);
+  dcb->ProfileSampleRate = eventStart->ProfileSampleRate;
+  if (eventStart->MetadataLaneWeight > 0) {
+    dcb->MetadataLaneWeight = min(eventStart->MetadataLaneWeight,
+                                  DOKAN_METADATA_LANE_MAX_WEIGHT);
+    dcb->MetadataLaneCredit = (LONG)dcb->MetadataLaneWeight;
+  }
   dcb->FcbGarbageCollectionIntervalMs =
       eventStart->FcbGarbageCollectionIntervalMs;
   // Sanitize the garbage collection parameter.
@@ -1043,6 +1184,11 @@ DokanEventStart(__in PREQUEST_CONTEXT RequestContext) {
       dcb->FcbGarbageCollectionIntervalMs = 0;
     }
   }
+  dcb->FcbCacheMemoryLimit =
+      eventStart->FcbCacheMemoryLimit > 0
+          ? min(eventStart->FcbCacheMemoryLimit,
+                DOKAN_FCB_CACHE_MAX_MEMORY_LIMIT)
+          : DOKAN_FCB_CACHE_DEFAULT_MEMORY_LIMIT;
 
   DokanLogInfo(&logger, L"Event start using mount ID: %d; device name: %s.",
                dcb->MountId, driverInfo->DeviceName);
@@ -1055,9 +1201,6 @@ DokanEventStart(__in PREQUEST_CONTEXT RequestContext) {
 
   DokanStartEventNotificationThread(dcb);
 
-  ExReleaseResourceLite(&RequestContext->DokanGlobal->Resource);
-  KeLeaveCriticalRegion();
-
   IoVerifyVolume(dcb->DeviceObject, FALSE);
 
   PMOUNT_ENTRY mountEntry =
@@ -1167,7 +1310,6 @@ DokanEventStart(__in PREQUEST_CONTEXT RequestContext) {
 NTSTATUS
 DokanEventWrite(__in PREQUEST_CONTEXT RequestContext) {
   KIRQL oldIrql;
-  PLIST_ENTRY thisEntry, nextEntry, listHead;
   PIRP_ENTRY irpEntry;
   PEVENT_INFORMATION eventInfo = NULL;
   PIRP writeIrp;
@@ -1179,42 +1321,31 @@ DokanEventWrite(__in PREQUEST_CONTEXT RequestContext) {
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, &oldIrql);
 
-  // search corresponding write IRP through pending IRP list
-  listHead = &RequestContext->Dcb->PendingIrp.ListHead;
-
-  for (thisEntry = listHead->Flink; thisEntry != listHead;
-       thisEntry = nextEntry) {
+  // search corresponding write IRP through the pending IRP index
+  irpEntry =
+      DokanLookupPendingIrp(RequestContext->Dcb, eventInfo->SerialNumber);
+  if (irpEntry != NULL && irpEntry->RequestContext.Irp == NULL) {
+    // this IRP has already been canceled
+    ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
+    DokanRemoveIrpEntry(irpEntry);
+    DokanFreeIrpEntry(irpEntry);
+    irpEntry = NULL;
+  } else if (irpEntry != NULL &&
+             IoSetCancelRoutine(irpEntry->RequestContext.Irp,
+                                DokanIrpCancelRoutine) == NULL) {
+    // Cancel routine will run as soon as we release the lock
+    DokanRemoveIrpEntry(irpEntry);
+    irpEntry->CancelRoutineFreeMemory = TRUE;
+    irpEntry = NULL;
+  }
 
+  if (irpEntry != NULL) {
     PIO_STACK_LOCATION writeIrpSp, eventIrpSp;
     PEVENT_CONTEXT eventContext;
     ULONG info = 0;
     NTSTATUS status;
 
-    nextEntry = thisEntry->Flink;
-    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-    // check whehter this is corresponding IRP
-    if (irpEntry->SerialNumber != eventInfo->SerialNumber) {
-      continue;
-    }
-
     writeIrp = irpEntry->RequestContext.Irp;
-    if (writeIrp == NULL) {
-      // this IRP has already been canceled
-      ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
-      RemoveEntryList(&irpEntry->ListEntry);
-      DokanFreeIrpEntry(irpEntry);
-      continue;
-    }
-
-    if (IoSetCancelRoutine(writeIrp, DokanIrpCancelRoutine) == NULL) {
-      // Cancel routine will run as soon as we release the lock
-      RemoveEntryList(&irpEntry->ListEntry);
-      InitializeListHead(&irpEntry->ListEntry);
-      irpEntry->CancelRoutineFreeMemory = TRUE;
-      continue;
-    }
-
     writeIrpSp = irpEntry->RequestContext.IrpSp;
     eventIrpSp = IoGetCurrentIrpStackLocation(RequestContext->Irp);
 
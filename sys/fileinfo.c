@@ -56,6 +56,440 @@ NTSTATUS FillNameInformation(__in PREQUEST_CONTEXT RequestContext,
   return STATUS_SUCCESS;
 }
 
+// Discards the attributes cached for the file after a change made through the
+// driver.
+VOID DokanInvalidateFileInfoCache(__in PDokanFCB Fcb) {
+  if (Fcb->Vcb->Dcb->FileInfoCacheTimeoutMs == 0) {
+    return;
+  }
+  InterlockedExchange64(&Fcb->FileInfoCache.InvalidatedTime,
+                        KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+// Discards the attributes cached for all the files of the volume, for a change
+// reported by the file system.
+VOID DokanInvalidateVolumeFileInfoCache(__in PDokanVCB Vcb) {
+  if (Vcb->Dcb->FileInfoCacheTimeoutMs == 0) {
+    return;
+  }
+  InterlockedExchange64(&Vcb->FileInfoCacheInvalidatedTime,
+                        KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+// Merges a FileBasicInformation set into the times and attributes held for the
+// file. The caller must hold the FCB lock exclusively.
+static VOID DeferBasicInfo(__in PDokanFCB Fcb,
+                           __in PFILE_BASIC_INFORMATION BasicInfo) {
+  PDOKAN_DEFERRED_BASIC_INFO deferred = &Fcb->DeferredBasicInfo;
+
+  if (BasicInfo->CreationTime.QuadPart != 0) {
+    deferred->CreationTime = BasicInfo->CreationTime;
+  }
+  if (BasicInfo->LastAccessTime.QuadPart != 0) {
+    deferred->LastAccessTime = BasicInfo->LastAccessTime;
+  }
+  if (BasicInfo->LastWriteTime.QuadPart != 0) {
+    deferred->LastWriteTime = BasicInfo->LastWriteTime;
+  }
+  if (BasicInfo->ChangeTime.QuadPart != 0) {
+    deferred->ChangeTime = BasicInfo->ChangeTime;
+  }
+  if (BasicInfo->FileAttributes != 0) {
+    deferred->FileAttributes = BasicInfo->FileAttributes;
+  }
+  ++deferred->Count;
+}
+
+VOID DokanTakeDeferredBasicInfo(__in PDokanFCB Fcb,
+                                __out PDOKAN_DEFERRED_BASIC_INFO Info) {
+  *Info = Fcb->DeferredBasicInfo;
+  RtlZeroMemory(&Fcb->DeferredBasicInfo, sizeof(DOKAN_DEFERRED_BASIC_INFO));
+}
+
+// Overrides what the file system returned with the times and attributes held
+// for the file, which it does not know about yet. The caller must hold the FCB
+// lock.
+static VOID ApplyDeferredBasicInfo(__in PDokanFCB Fcb,
+                                   __inout PLARGE_INTEGER CreationTime,
+                                   __inout PLARGE_INTEGER LastAccessTime,
+                                   __inout PLARGE_INTEGER LastWriteTime,
+                                   __inout PLARGE_INTEGER ChangeTime,
+                                   __inout PULONG FileAttributes) {
+  PDOKAN_DEFERRED_BASIC_INFO deferred = &Fcb->DeferredBasicInfo;
+
+  if (deferred->Count == 0) {
+    return;
+  }
+  // A negative time only changes how the handle updates the file.
+  if (deferred->CreationTime.QuadPart > 0) {
+    *CreationTime = deferred->CreationTime;
+  }
+  if (deferred->LastAccessTime.QuadPart > 0) {
+    *LastAccessTime = deferred->LastAccessTime;
+  }
+  if (deferred->LastWriteTime.QuadPart > 0) {
+    *LastWriteTime = deferred->LastWriteTime;
+  }
+  if (deferred->ChangeTime.QuadPart > 0) {
+    *ChangeTime = deferred->ChangeTime;
+  }
+  if (deferred->FileAttributes != 0) {
+    *FileAttributes = (deferred->FileAttributes & ~FILE_ATTRIBUTE_NORMAL) |
+                      (*FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    if (*FileAttributes == 0) {
+      *FileAttributes = FILE_ATTRIBUTE_NORMAL;
+    }
+  }
+}
+
+// Applies the times and attributes held for the file to the answer of a query
+// made by the file system.
+static VOID ApplyDeferredBasicInfoToQuery(__in PDokanFCB Fcb,
+                                          __in FILE_INFORMATION_CLASS InfoClass,
+                                          __inout PVOID Buffer,
+                                          __in ULONG BufferLength) {
+  PFILE_BASIC_INFORMATION basicInfo = NULL;
+  PFILE_NETWORK_OPEN_INFORMATION networkInfo;
+
+  switch (InfoClass) {
+    case FileBasicInformation:
+      if (BufferLength >= sizeof(FILE_BASIC_INFORMATION)) {
+        basicInfo = Buffer;
+      }
+      break;
+    case FileAllInformation:
+      if (BufferLength >=
+          FIELD_OFFSET(FILE_ALL_INFORMATION, StandardInformation)) {
+        basicInfo = &((PFILE_ALL_INFORMATION)Buffer)->BasicInformation;
+      }
+      break;
+    case FileNetworkOpenInformation:
+      if (BufferLength >= sizeof(FILE_NETWORK_OPEN_INFORMATION)) {
+        networkInfo = Buffer;
+        DokanFCBLockRO(Fcb);
+        ApplyDeferredBasicInfo(Fcb, &networkInfo->CreationTime,
+                               &networkInfo->LastAccessTime,
+                               &networkInfo->LastWriteTime,
+                               &networkInfo->ChangeTime,
+                               &networkInfo->FileAttributes);
+        DokanFCBUnlock(Fcb);
+      }
+      return;
+    default:
+      return;
+  }
+  if (basicInfo == NULL) {
+    return;
+  }
+  DokanFCBLockRO(Fcb);
+  ApplyDeferredBasicInfo(Fcb, &basicInfo->CreationTime,
+                         &basicInfo->LastAccessTime, &basicInfo->LastWriteTime,
+                         &basicInfo->ChangeTime, &basicInfo->FileAttributes);
+  DokanFCBUnlock(Fcb);
+}
+
+// Returns the allocation to ask the file system for when AllocationSize is set
+// with AllocationStepSize: the next multiple of the step, unless the set may
+// truncate the file.
+static LONGLONG GetPreextendedAllocationSize(__in PDokanFCB Fcb,
+                                             __in LONGLONG AllocationSize) {
+  ULONG step = Fcb->Vcb->Dcb->AllocationStepSize;
+  if (step == 0 || AllocationSize <= 0 ||
+      AllocationSize < Fcb->AdvancedFCBHeader.FileSize.QuadPart ||
+      AllocationSize > MAXLONGLONG - step) {
+    return AllocationSize;
+  }
+  return (AllocationSize + step - 1) / step * step;
+}
+
+// Completes an allocation set that stays within the allocation the file system
+// was already asked for. Returns whether it did.
+static BOOLEAN CompletePreallocatedSet(__in PREQUEST_CONTEXT RequestContext,
+                                       __in PDokanFCB Fcb,
+                                       __in PVOID Buffer) {
+  LONGLONG allocationSize;
+  BOOLEAN completed;
+
+  if (RequestContext->IrpSp->Parameters.SetFile.Length <
+      sizeof(FILE_ALLOCATION_INFORMATION)) {
+    return FALSE;
+  }
+  allocationSize =
+      ((PFILE_ALLOCATION_INFORMATION)Buffer)->AllocationSize.QuadPart;
+  DokanFCBLockRO(Fcb);
+  completed = allocationSize <= Fcb->PreallocatedSize &&
+              allocationSize >= Fcb->AdvancedFCBHeader.FileSize.QuadPart;
+  if (completed) {
+    DokanNotifyReportChange(RequestContext, Fcb, FILE_NOTIFY_CHANGE_SIZE,
+                            FILE_ACTION_MODIFIED);
+  }
+  DokanFCBUnlock(Fcb);
+  DOKAN_LOG_FINE_IRP(RequestContext, "AllocationSize %lld %s", allocationSize,
+                     completed ? "within preallocation" : "sent");
+  return completed;
+}
+
+// Returns whether the entry of the file info cache of Fcb filled from a request
+// that arrived at EntryTime can still be used.
+static BOOLEAN IsFileInfoCacheEntryValid(__in PDokanFCB Fcb,
+                                         __in LONGLONG EntryTime) {
+  ULONG timeoutMs = Fcb->Vcb->Dcb->FileInfoCacheTimeoutMs;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+
+  if (timeoutMs == 0 || EntryTime == 0 ||
+      EntryTime <= InterlockedCompareExchange64(
+                       &Fcb->FileInfoCache.InvalidatedTime, 0, 0) ||
+      EntryTime <= InterlockedCompareExchange64(
+                       &Fcb->Vcb->FileInfoCacheInvalidatedTime, 0, 0)) {
+    return FALSE;
+  }
+  if (DokanHasLease(Fcb, DOKAN_LEASE_ATTRIBUTES)) {
+    return TRUE;
+  }
+  now = KeQueryPerformanceCounter(&frequency);
+  return now.QuadPart - EntryTime <
+         (LONGLONG)timeoutMs * frequency.QuadPart / 1000;
+}
+
+// Attributes the file info cache can answer with.
+typedef union _DOKAN_CACHED_FILE_INFO {
+  FILE_BASIC_INFORMATION Basic;
+  FILE_STANDARD_INFORMATION Standard;
+  FILE_NETWORK_OPEN_INFORMATION NetworkOpen;
+} DOKAN_CACHED_FILE_INFO, *PDOKAN_CACHED_FILE_INFO;
+
+// Copies the answer to an InfoClass query from the file info cache of Fcb into
+// Info and returns its length, or 0 when the cache does not hold it. The
+// caller must hold the FCB lock.
+static ULONG GetCachedFileInfo(__in PDokanFCB Fcb,
+                               __in FILE_INFORMATION_CLASS InfoClass,
+                               __out PDOKAN_CACHED_FILE_INFO Info) {
+  PDOKAN_FILE_INFO_CACHE cache = &Fcb->FileInfoCache;
+
+  switch (InfoClass) {
+    case FileBasicInformation:
+      if (!IsFileInfoCacheEntryValid(Fcb, cache->BasicTime)) {
+        return 0;
+      }
+      Info->Basic = cache->Basic;
+      return sizeof(FILE_BASIC_INFORMATION);
+    case FileStandardInformation:
+      if (!IsFileInfoCacheEntryValid(Fcb, cache->StandardTime)) {
+        return 0;
+      }
+      Info->Standard = cache->Standard;
+      return sizeof(FILE_STANDARD_INFORMATION);
+    case FileNetworkOpenInformation:
+      if (!IsFileInfoCacheEntryValid(Fcb, cache->BasicTime) ||
+          !IsFileInfoCacheEntryValid(Fcb, cache->StandardTime)) {
+        return 0;
+      }
+      Info->NetworkOpen.CreationTime = cache->Basic.CreationTime;
+      Info->NetworkOpen.LastAccessTime = cache->Basic.LastAccessTime;
+      Info->NetworkOpen.LastWriteTime = cache->Basic.LastWriteTime;
+      Info->NetworkOpen.ChangeTime = cache->Basic.ChangeTime;
+      Info->NetworkOpen.AllocationSize = cache->Standard.AllocationSize;
+      Info->NetworkOpen.EndOfFile = cache->Standard.EndOfFile;
+      Info->NetworkOpen.FileAttributes = cache->Basic.FileAttributes;
+      return sizeof(FILE_NETWORK_OPEN_INFORMATION);
+    default:
+      return 0;
+  }
+}
+
+// Answers the query from the file info cache of Fcb when it holds what the
+// information class needs. Returns FALSE when the query has to go to user
+// mode. The caller must hold the FCB lock.
+static BOOLEAN QueryCachedFileInfo(__in PREQUEST_CONTEXT RequestContext,
+                                   __in PDokanFCB Fcb,
+                                   __in FILE_INFORMATION_CLASS InfoClass) {
+  DOKAN_CACHED_FILE_INFO info;
+  ULONG infoLength = GetCachedFileInfo(Fcb, InfoClass, &info);
+  PVOID buffer;
+
+  if (infoLength == 0) {
+    return FALSE;
+  }
+  buffer = PrepareOutputWithSize(RequestContext->Irp, infoLength,
+                                 /*SetInformationOnFailure=*/FALSE);
+  if (buffer == NULL) {
+    return FALSE;
+  }
+  RtlCopyMemory(buffer, &info, infoLength);
+  return TRUE;
+}
+
+// Answers a fast I/O attribute query from the file info cache. Returns FALSE
+// to have the I/O manager send the IRP instead.
+static BOOLEAN FastIoQueryCachedFileInfo(__in PFILE_OBJECT FileObject,
+                                         __in BOOLEAN Wait,
+                                         __in FILE_INFORMATION_CLASS InfoClass,
+                                         __out PVOID Buffer,
+                                         __out PIO_STATUS_BLOCK IoStatus) {
+  DOKAN_CACHED_FILE_INFO info;
+  ULONG infoLength;
+  PDokanCCB ccb;
+  PDokanFCB fcb;
+
+  // The FCB lock may have to be waited for.
+  if (!Wait || FileObject == NULL) {
+    return FALSE;
+  }
+  ccb = FileObject->FsContext2;
+  if (ccb == NULL || GetIdentifierType(ccb) != CCB) {
+    return FALSE;
+  }
+  fcb = ccb->Fcb;
+  if (fcb == NULL || fcb->Vcb->Dcb->FileInfoCacheTimeoutMs == 0) {
+    return FALSE;
+  }
+  DokanFCBLockRO(fcb);
+  infoLength = GetCachedFileInfo(fcb, InfoClass, &info);
+  DokanFCBUnlock(fcb);
+  if (infoLength == 0) {
+    return FALSE;
+  }
+  // Copied without the lock as Buffer may be a user buffer.
+  RtlCopyMemory(Buffer, &info, infoLength);
+  IoStatus->Status = STATUS_SUCCESS;
+  IoStatus->Information = infoLength;
+  return TRUE;
+}
+
+BOOLEAN DokanFastIoQueryBasicInfo(__in PFILE_OBJECT FileObject,
+                                  __in BOOLEAN Wait,
+                                  __out PFILE_BASIC_INFORMATION Buffer,
+                                  __out PIO_STATUS_BLOCK IoStatus,
+                                  __in PDEVICE_OBJECT DeviceObject) {
+  UNREFERENCED_PARAMETER(DeviceObject);
+  return FastIoQueryCachedFileInfo(FileObject, Wait, FileBasicInformation,
+                                   Buffer, IoStatus);
+}
+
+BOOLEAN DokanFastIoQueryStandardInfo(__in PFILE_OBJECT FileObject,
+                                     __in BOOLEAN Wait,
+                                     __out PFILE_STANDARD_INFORMATION Buffer,
+                                     __out PIO_STATUS_BLOCK IoStatus,
+                                     __in PDEVICE_OBJECT DeviceObject) {
+  UNREFERENCED_PARAMETER(DeviceObject);
+  return FastIoQueryCachedFileInfo(FileObject, Wait, FileStandardInformation,
+                                   Buffer, IoStatus);
+}
+
+BOOLEAN DokanFastIoQueryNetworkOpenInfo(
+    __in PFILE_OBJECT FileObject, __in BOOLEAN Wait,
+    __out PFILE_NETWORK_OPEN_INFORMATION Buffer,
+    __out PIO_STATUS_BLOCK IoStatus, __in PDEVICE_OBJECT DeviceObject) {
+  UNREFERENCED_PARAMETER(DeviceObject);
+  return FastIoQueryCachedFileInfo(FileObject, Wait, FileNetworkOpenInformation,
+                                   Buffer, IoStatus);
+}
+
+// Keeps the attributes given for a request that arrived at ArrivalTime in the
+// file info cache of Fcb, unless the file was changed since then. The caller
+// must hold the FCB lock exclusively.
+static VOID StoreFileInfoCache(__in PDokanFCB Fcb, __in LONGLONG ArrivalTime,
+                               __in_opt PFILE_BASIC_INFORMATION BasicInfo,
+                               __in_opt PFILE_STANDARD_INFORMATION StandardInfo) {
+  PDOKAN_FILE_INFO_CACHE cache = &Fcb->FileInfoCache;
+
+  if (ArrivalTime > InterlockedCompareExchange64(&cache->InvalidatedTime, 0,
+                                                 0) &&
+      ArrivalTime > InterlockedCompareExchange64(
+                        &Fcb->Vcb->FileInfoCacheInvalidatedTime, 0, 0)) {
+    if (BasicInfo != NULL && ArrivalTime > cache->BasicTime) {
+      cache->Basic = *BasicInfo;
+      cache->BasicTime = ArrivalTime;
+    }
+    if (StandardInfo != NULL && ArrivalTime > cache->StandardTime) {
+      cache->Standard = *StandardInfo;
+      cache->StandardTime = ArrivalTime;
+    }
+  }
+}
+
+// Keeps the attributes returned by the file system for a query in the file
+// info cache of Fcb, unless the file was changed since the query arrived.
+static VOID FillFileInfoCache(__in PREQUEST_CONTEXT RequestContext,
+                              __in PDokanFCB Fcb,
+                              __in FILE_INFORMATION_CLASS InfoClass,
+                              __in PVOID Buffer, __in ULONG BufferLength) {
+  LONGLONG arrivalTime = RequestContext->ArrivalTime.QuadPart;
+  PFILE_BASIC_INFORMATION basicInfo = NULL;
+  PFILE_STANDARD_INFORMATION standardInfo = NULL;
+  FILE_BASIC_INFORMATION networkBasicInfo;
+
+  if (RequestContext->Dcb->FileInfoCacheTimeoutMs == 0 || arrivalTime == 0) {
+    return;
+  }
+  switch (InfoClass) {
+    case FileBasicInformation:
+      if (BufferLength >= sizeof(FILE_BASIC_INFORMATION)) {
+        basicInfo = Buffer;
+      }
+      break;
+    case FileStandardInformation:
+      if (BufferLength >= sizeof(FILE_STANDARD_INFORMATION)) {
+        standardInfo = Buffer;
+      }
+      break;
+    case FileAllInformation:
+      if (BufferLength >=
+          FIELD_OFFSET(FILE_ALL_INFORMATION, InternalInformation)) {
+        basicInfo = &((PFILE_ALL_INFORMATION)Buffer)->BasicInformation;
+        standardInfo = &((PFILE_ALL_INFORMATION)Buffer)->StandardInformation;
+      }
+      break;
+    case FileNetworkOpenInformation:
+      if (BufferLength >= sizeof(FILE_NETWORK_OPEN_INFORMATION)) {
+        PFILE_NETWORK_OPEN_INFORMATION networkInfo = Buffer;
+        networkBasicInfo.CreationTime = networkInfo->CreationTime;
+        networkBasicInfo.LastAccessTime = networkInfo->LastAccessTime;
+        networkBasicInfo.LastWriteTime = networkInfo->LastWriteTime;
+        networkBasicInfo.ChangeTime = networkInfo->ChangeTime;
+        networkBasicInfo.FileAttributes = networkInfo->FileAttributes;
+        basicInfo = &networkBasicInfo;
+      }
+      break;
+    default:
+      break;
+  }
+  if (basicInfo == NULL && standardInfo == NULL) {
+    return;
+  }
+
+  DokanFCBLockRW(Fcb);
+  StoreFileInfoCache(Fcb, arrivalTime, basicInfo, standardInfo);
+  DokanFCBUnlock(Fcb);
+}
+
+VOID DokanFillFileInfoCacheFromCreate(__in PREQUEST_CONTEXT RequestContext,
+                                      __in PDokanFCB Fcb,
+                                      __in PDOKAN_CREATE_FILE_INFO CreateInfo) {
+  FILE_BASIC_INFORMATION basicInfo;
+  FILE_STANDARD_INFORMATION standardInfo;
+
+  if (RequestContext->Dcb->FileInfoCacheTimeoutMs == 0 ||
+      RequestContext->ArrivalTime.QuadPart == 0) {
+    return;
+  }
+  basicInfo.CreationTime = CreateInfo->CreationTime;
+  basicInfo.LastAccessTime = CreateInfo->LastAccessTime;
+  basicInfo.LastWriteTime = CreateInfo->LastWriteTime;
+  basicInfo.ChangeTime = CreateInfo->ChangeTime;
+  basicInfo.FileAttributes = CreateInfo->FileAttributes;
+  standardInfo.AllocationSize = CreateInfo->AllocationSize;
+  standardInfo.EndOfFile = CreateInfo->EndOfFile;
+  standardInfo.NumberOfLinks = CreateInfo->NumberOfLinks;
+  // A pending delete invalidates the cache when it is set.
+  standardInfo.DeletePending = FALSE;
+  standardInfo.Directory =
+      (CreateInfo->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+  StoreFileInfoCache(Fcb, RequestContext->ArrivalTime.QuadPart, &basicInfo,
+                     &standardInfo);
+}
+
 NTSTATUS
 DokanDispatchQueryInformation(__in PREQUEST_CONTEXT RequestContext) {
   NTSTATUS status = STATUS_INVALID_PARAMETER;
@@ -118,6 +552,22 @@ DokanDispatchQueryInformation(__in PREQUEST_CONTEXT RequestContext) {
       status = FillNameInformation(RequestContext, fcb, nameInfo);
       __leave;
     } break;
+    case FileBasicInformation:
+      // Held until the next cleanup or flush of the file, which sends all the
+      // sets made meanwhile at once.
+      if (RequestContext->Dcb->DeferBasicInfo) {
+        DokanFCBLockRW(fcb);
+        DeferBasicInfo(fcb, (PFILE_BASIC_INFORMATION)buffer);
+        DokanNotifyReportChange(
+            RequestContext, fcb,
+            FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_LAST_WRITE |
+                FILE_NOTIFY_CHANGE_LAST_ACCESS | FILE_NOTIFY_CHANGE_CREATION,
+            FILE_ACTION_MODIFIED);
+        DokanFCBUnlock(fcb);
+        status = STATUS_SUCCESS;
+        __leave;
+      }
+      break;
     case FilePositionInformation: {
       PFILE_POSITION_INFORMATION posInfo;
       if (!PREPARE_OUTPUT(RequestContext->Irp, posInfo,
@@ -185,6 +635,12 @@ DokanDispatchQueryInformation(__in PREQUEST_CONTEXT RequestContext) {
       fcbLocked = TRUE;
     }
 
+    if (QueryCachedFileInfo(RequestContext, fcb, infoClass)) {
+      DOKAN_LOG_FINE_IRP(RequestContext, "Answered from the file info cache");
+      status = STATUS_SUCCESS;
+      __leave;
+    }
+
     // If the request is not handled by the switch case we send it to userland.
     eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
     eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
@@ -313,6 +769,21 @@ VOID DokanCompleteQueryInformation(__in PREQUEST_CONTEXT RequestContext,
                          "AllocationSize: %llu, EndOfFile: %llu",
                          allocationSize, fileSize);
     }
+
+    if (NT_SUCCESS(RequestContext->Irp->IoStatus.Status) &&
+        RequestContext->Dcb->DeferBasicInfo) {
+      ApplyDeferredBasicInfoToQuery(
+          ccb->Fcb,
+          RequestContext->IrpSp->Parameters.QueryFile.FileInformationClass,
+          buffer, EventInfo->BufferLength);
+    }
+
+    if (NT_SUCCESS(RequestContext->Irp->IoStatus.Status)) {
+      FillFileInfoCache(
+          RequestContext, ccb->Fcb,
+          RequestContext->IrpSp->Parameters.QueryFile.FileInformationClass,
+          buffer, EventInfo->BufferLength);
+    }
   }
 }
 
@@ -534,8 +1005,16 @@ DokanDispatchSetInformation(__in PREQUEST_CONTEXT RequestContext) {
     fcb = ccb->Fcb;
     ASSERT(fcb != NULL);
     OplockDebugRecordMajorFunction(fcb, IRP_MJ_SET_INFORMATION);
+    DokanInvalidateFileInfoCache(fcb);
+    DokanInvalidateReadAhead(fcb);
     switch (RequestContext->IrpSp->Parameters.SetFile.FileInformationClass) {
     case FileAllocationInformation: {
+      // The file system already allocated the step this set falls in.
+      if (RequestContext->Dcb->AllocationStepSize > 0 && !isPagingIo &&
+          CompletePreallocatedSet(RequestContext, fcb, buffer)) {
+        status = STATUS_SUCCESS;
+        __leave;
+      }
       if ((fileObject->SectionObjectPointer != NULL) &&
           (fileObject->SectionObjectPointer->DataSectionObject != NULL)) {
 
@@ -711,6 +1190,18 @@ DokanDispatchSetInformation(__in PREQUEST_CONTEXT RequestContext) {
           (PCHAR)eventContext + eventContext->Operation.SetFile.BufferOffset,
           RequestContext->Irp->AssociatedIrp.SystemBuffer,
           RequestContext->IrpSp->Parameters.SetFile.Length);
+      // A growing file is given its allocation a step at a time.
+      if (RequestContext->IrpSp->Parameters.SetFile.FileInformationClass ==
+              FileAllocationInformation &&
+          RequestContext->IrpSp->Parameters.SetFile.Length >=
+              sizeof(FILE_ALLOCATION_INFORMATION)) {
+        PFILE_ALLOCATION_INFORMATION allocationInfo =
+            (PFILE_ALLOCATION_INFORMATION)(
+                (PCHAR)eventContext +
+                eventContext->Operation.SetFile.BufferOffset);
+        allocationInfo->AllocationSize.QuadPart = GetPreextendedAllocationSize(
+            fcb, allocationInfo->AllocationSize.QuadPart);
+      }
     }
 
     // copy the file name
@@ -812,6 +1303,10 @@ VOID DokanCompleteSetInformation(__in PREQUEST_CONTEXT RequestContext,
     fcb = ccb->Fcb;
     ASSERT(fcb != NULL);
 
+    // Whatever the outcome, the file system may have changed the file.
+    DokanInvalidateFileInfoCache(fcb);
+    DokanInvalidateReadAhead(fcb);
+
     infoClass = RequestContext->IrpSp->Parameters.SetFile.FileInformationClass;
     DOKAN_LOG_FINE_IRP(RequestContext, "FileObject=%p infoClass=%s",
                        RequestContext->IrpSp->FileObject,
@@ -877,6 +1372,15 @@ VOID DokanCompleteSetInformation(__in PREQUEST_CONTEXT RequestContext,
       RtlCopyMemory(buffer, EventInfo->Buffer, EventInfo->BufferLength);
       DokanRenameFcb(RequestContext, fcb, buffer,
                      (USHORT)EventInfo->BufferLength);
+      // A renamed directory brings the names below it along.
+      // Inherited security may differ under the new parent as well.
+      if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
+        DokanFlushNegativeCache(RequestContext->Vcb);
+        DokanInvalidateVolumeSecurityCache(RequestContext->Vcb);
+      } else {
+        DokanRemoveNegativeCacheEntry(RequestContext->Vcb, &fcb->FileName);
+        DokanInvalidateSecurityCache(fcb);
+      }
       DOKAN_LOG_FINE_IRP(RequestContext, "Fcb=%p renamed \"%wZ\"", fcb,
                          &fcb->FileName);
       break;
@@ -885,6 +1389,16 @@ VOID DokanCompleteSetInformation(__in PREQUEST_CONTEXT RequestContext,
 
     switch (infoClass) {
     case FileAllocationInformation:
+      if (fcbLocked && RequestContext->Dcb->AllocationStepSize > 0) {
+        LONGLONG allocationSize =
+            ((PFILE_ALLOCATION_INFORMATION)
+                 RequestContext->Irp->AssociatedIrp.SystemBuffer)
+                ->AllocationSize.QuadPart;
+        LONGLONG preextendedSize =
+            GetPreextendedAllocationSize(fcb, allocationSize);
+        fcb->PreallocatedSize =
+            preextendedSize != allocationSize ? preextendedSize : 0;
+      }
       DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_SIZE,
                               FILE_ACTION_MODIFIED);
       break;
@@ -896,6 +1410,14 @@ VOID DokanCompleteSetInformation(__in PREQUEST_CONTEXT RequestContext,
           FILE_ACTION_MODIFIED);
       break;
     case FileEndOfFileInformation:
+      // A truncation may free the allocation past the new end.
+      if (fcbLocked &&
+          ((PFILE_END_OF_FILE_INFORMATION)
+               RequestContext->Irp->AssociatedIrp.SystemBuffer)
+                  ->EndOfFile.QuadPart <
+              fcb->AdvancedFCBHeader.FileSize.QuadPart) {
+        fcb->PreallocatedSize = 0;
+      }
       DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_SIZE,
                               FILE_ACTION_MODIFIED);
       break;
@@ -931,6 +1453,11 @@ VOID DokanCompleteSetInformation(__in PREQUEST_CONTEXT RequestContext,
       DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_SIZE,
                               FILE_ACTION_MODIFIED);
       break;
+    case FileLinkInformation:
+    case FileLinkInformationEx:
+      // The new name is only known to the file system.
+      DokanFlushNegativeCache(RequestContext->Vcb);
+      break;
     }
 
   } __finally {
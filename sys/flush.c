@@ -22,6 +22,32 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokan.h"
 
+// With WriteThrough, the data the file system completed is already durable, so
+// the flush only has to write the data cached for the file. It still goes to
+// user mode with times and attributes held by DeferBasicInfo. Returns whether
+// the flush was completed, with the status to complete it with.
+static BOOLEAN CompleteWriteThroughFlush(__in PREQUEST_CONTEXT RequestContext,
+                                         __in PDokanFCB Fcb,
+                                         __out NTSTATUS* Status) {
+  IO_STATUS_BLOCK ioStatus;
+  BOOLEAN deferred;
+
+  DokanFCBLockRO(Fcb);
+  deferred = Fcb->DeferredBasicInfo.Count != 0;
+  DokanFCBUnlock(Fcb);
+  if (deferred) {
+    return FALSE;
+  }
+  ioStatus.Status = STATUS_SUCCESS;
+  if (Fcb->SectionObjectPointers.DataSectionObject != NULL) {
+    CcFlushCache(&Fcb->SectionObjectPointers, NULL, 0, &ioStatus);
+  }
+  DOKAN_LOG_FINE_IRP(RequestContext, "Write-through flush: 0x%x %s",
+                     ioStatus.Status, DokanGetNTSTATUSStr(ioStatus.Status));
+  *Status = ioStatus.Status;
+  return TRUE;
+}
+
 NTSTATUS
 DokanDispatchFlush(__in PREQUEST_CONTEXT RequestContext) {
   PFILE_OBJECT fileObject;
@@ -44,10 +70,27 @@ DokanDispatchFlush(__in PREQUEST_CONTEXT RequestContext) {
     ccb = fileObject->FsContext2;
     ASSERT(ccb != NULL);
 
+    // The file system gets the writes the handle held back before the flush,
+    // and their failure is reported by it.
+    status = DokanFlushWriteBehind(RequestContext, ccb);
+    if (!NT_SUCCESS(status)) {
+      __leave;
+    }
+
     fcb = ccb->Fcb;
     ASSERT(fcb != NULL);
     OplockDebugRecordMajorFunction(fcb, IRP_MJ_FLUSH_BUFFERS);
-    DokanFCBLockRO(fcb);
+    if (RequestContext->Dcb->WriteThrough &&
+        CompleteWriteThroughFlush(RequestContext, fcb, &status)) {
+      fcb = NULL;
+      __leave;
+    }
+    // The times and attributes held for the file are taken along.
+    if (RequestContext->Dcb->DeferBasicInfo) {
+      DokanFCBLockRW(fcb);
+    } else {
+      DokanFCBLockRO(fcb);
+    }
 
     eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
     eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
@@ -60,6 +103,11 @@ DokanDispatchFlush(__in PREQUEST_CONTEXT RequestContext) {
     eventContext->Context = ccb->UserContext;
     DOKAN_LOG_FINE_IRP(RequestContext, "Get Context %X", (ULONG)ccb->UserContext);
 
+    if (RequestContext->Dcb->DeferBasicInfo) {
+      DokanTakeDeferredBasicInfo(
+          fcb, &eventContext->Operation.Flush.DeferredBasicInfo);
+    }
+
     // copy file name to be flushed
     eventContext->Operation.Flush.FileNameLength = fcb->FileName.Length;
     RtlCopyMemory(eventContext->Operation.Flush.FileName, fcb->FileName.Buffer,
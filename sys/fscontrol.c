@@ -290,6 +290,650 @@ NTSTATUS DokanOplockRequest(__in PREQUEST_CONTEXT RequestContext) {
 NTSTATUS
 DokanDiskUserFsRequest(__in PREQUEST_CONTEXT RequestContext);
 
+// The paths notified by the file system are not tied to an FCB we could find
+// cheaply, so any change it reports drops the whole caches of the volume.
+static VOID InvalidateVolumeCachesForNotification(__in PDokanVCB Vcb) {
+  DokanInvalidateVolumeFileInfoCache(Vcb);
+  DokanInvalidateVolumeSecurityCache(Vcb);
+  DokanInvalidateVolumeReadAhead(Vcb);
+}
+
+// Reports a change the file system notified for FileName. The negative cache
+// is flushed at most once per call of the caller, as tracked by
+// NegativeCacheFlushed. The caller must hold the FCB lock shared.
+static NTSTATUS ReportNotifiedPath(__in PREQUEST_CONTEXT RequestContext,
+                                   __in PDokanFCB Fcb,
+                                   __in PUNICODE_STRING FileName,
+                                   __in ULONG CompletionFilter,
+                                   __in ULONG Action,
+                                   __inout PBOOLEAN NegativeCacheFlushed) {
+  DOKAN_LOG_FINE_IRP(RequestContext,
+                     "CompletionFilter: %lu, Action: %lu, "
+                     "Length: %i, Path: \"%wZ\"",
+                     CompletionFilter, Action, FileName->Length, FileName);
+  if ((Action == FILE_ACTION_ADDED || Action == FILE_ACTION_RENAMED_NEW_NAME) &&
+      !*NegativeCacheFlushed) {
+    if (CompletionFilter & FILE_NOTIFY_CHANGE_DIR_NAME) {
+      DokanFlushNegativeCache(Fcb->Vcb);
+      *NegativeCacheFlushed = TRUE;
+    } else {
+      DokanRemoveNegativeCacheEntry(Fcb->Vcb, FileName);
+    }
+  }
+  if (DokanBatchNotification(Fcb->Vcb->Dcb, FileName, CompletionFilter,
+                             Action)) {
+    return STATUS_SUCCESS;
+  }
+  return DokanNotifyReportChange0(RequestContext, Fcb, FileName,
+                                  CompletionFilter, Action);
+}
+
+static BOOLEAN
+IsSameNotification(__in PDOKAN_NOTIFY_PATH_BATCH_ENTRY Entry1,
+                   __in PDOKAN_NOTIFY_PATH_BATCH_ENTRY Entry2) {
+  return Entry1->CompletionFilter == Entry2->CompletionFilter &&
+         Entry1->Action == Entry2->Action &&
+         Entry1->Length == Entry2->Length &&
+         RtlEqualMemory(Entry1->Buffer, Entry2->Buffer, Entry1->Length);
+}
+
+// Handles FSCTL_NOTIFY_PATH_BATCH. The whole chain is validated before any
+// entry is reported. The caches of the volume are invalidated once for the
+// batch and the FCB is locked once. An entry repeating the previous one, as a
+// sync engine applying several changes to a file in a row sends, is only
+// reported once.
+static NTSTATUS NotifyPathBatch(__in PREQUEST_CONTEXT RequestContext,
+                                __in PDokanFCB Fcb) {
+  PCHAR buffer = GetInputBuffer(RequestContext->Irp);
+  ULONG bufferLength = GetProvidedInputSize(RequestContext->Irp);
+  PDOKAN_NOTIFY_PATH_BATCH_ENTRY entry = NULL;
+  PDOKAN_NOTIFY_PATH_BATCH_ENTRY previousEntry = NULL;
+  BOOLEAN negativeCacheFlushed = FALSE;
+  BOOLEAN nameInvalid = FALSE;
+  ULONG offset = 0;
+  ULONG count = 0;
+  ULONG reported = 0;
+
+  if (buffer == NULL || bufferLength > DOKAN_NOTIFY_PATH_BATCH_MAX_SIZE) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  for (;;) {
+    entry = (PDOKAN_NOTIFY_PATH_BATCH_ENTRY)(buffer + offset);
+    if (bufferLength - offset <
+            FIELD_OFFSET(DOKAN_NOTIFY_PATH_BATCH_ENTRY, Buffer[0]) ||
+        entry->Length == 0 || entry->Length % sizeof(WCHAR) != 0 ||
+        bufferLength - offset -
+                FIELD_OFFSET(DOKAN_NOTIFY_PATH_BATCH_ENTRY, Buffer[0]) <
+            entry->Length) {
+      DOKAN_LOG_FINE_IRP(RequestContext, "Invalid entry at offset %lu",
+                         offset);
+      return STATUS_INVALID_PARAMETER;
+    }
+    ++count;
+    if (entry->NextEntryOffset == 0) {
+      break;
+    }
+    if (entry->NextEntryOffset % sizeof(ULONGLONG) != 0 ||
+        entry->NextEntryOffset <
+            FIELD_OFFSET(DOKAN_NOTIFY_PATH_BATCH_ENTRY, Buffer[0]) +
+                entry->Length ||
+        entry->NextEntryOffset > bufferLength - offset) {
+      DOKAN_LOG_FINE_IRP(RequestContext, "Invalid next entry at offset %lu",
+                         offset);
+      return STATUS_INVALID_PARAMETER;
+    }
+    offset += entry->NextEntryOffset;
+  }
+
+  InvalidateVolumeCachesForNotification(Fcb->Vcb);
+  DokanFCBLockRO(Fcb);
+  offset = 0;
+  for (ULONG i = 0; i < count; ++i) {
+    entry = (PDOKAN_NOTIFY_PATH_BATCH_ENTRY)(buffer + offset);
+    if (previousEntry == NULL || !IsSameNotification(previousEntry, entry)) {
+      UNICODE_STRING fileName;
+      fileName.Length = entry->Length;
+      fileName.MaximumLength = entry->Length;
+      fileName.Buffer = entry->Buffer;
+      if (ReportNotifiedPath(RequestContext, Fcb, &fileName,
+                             entry->CompletionFilter, entry->Action,
+                             &negativeCacheFlushed) ==
+          STATUS_OBJECT_NAME_INVALID) {
+        nameInvalid = TRUE;
+      }
+      ++reported;
+    }
+    previousEntry = entry;
+    offset += entry->NextEntryOffset;
+  }
+  DokanFCBUnlock(Fcb);
+  DOKAN_LOG_FINE_IRP(RequestContext, "Reported %lu of %lu notifications",
+                     reported, count);
+  if (nameInvalid) {
+    DokanCleanupAllChangeNotificationWaiters(Fcb->Vcb);
+    return STATUS_OBJECT_NAME_INVALID;
+  }
+  return STATUS_SUCCESS;
+}
+
+// Reads the input of FSCTL_DUPLICATE_EXTENTS_TO_FILE, which has a 32-bit handle
+// when it comes from a 32-bit process.
+static BOOLEAN GetDuplicateExtentsData(__in PREQUEST_CONTEXT RequestContext,
+                                       __out PHANDLE SourceHandle,
+                                       __out PLARGE_INTEGER SourceOffset,
+                                       __out PLARGE_INTEGER TargetOffset,
+                                       __out PLARGE_INTEGER Length) {
+  PVOID buffer = RequestContext->Irp->AssociatedIrp.SystemBuffer;
+  ULONG bufferLength =
+      RequestContext->IrpSp->Parameters.FileSystemControl.InputBufferLength;
+
+  if (buffer == NULL) {
+    return FALSE;
+  }
+#if defined(_WIN64)
+  if (IoIs32bitProcess(RequestContext->Irp)) {
+    PDUPLICATE_EXTENTS_DATA32 data = buffer;
+    if (bufferLength < sizeof(DUPLICATE_EXTENTS_DATA32)) {
+      return FALSE;
+    }
+    *SourceHandle = Handle32ToHandle((const void* POINTER_32)data->FileHandle);
+    *SourceOffset = data->SourceFileOffset;
+    *TargetOffset = data->TargetFileOffset;
+    *Length = data->ByteCount;
+    return TRUE;
+  }
+#endif
+  PDUPLICATE_EXTENTS_DATA data = buffer;
+  if (bufferLength < sizeof(DUPLICATE_EXTENTS_DATA)) {
+    return FALSE;
+  }
+  *SourceHandle = data->FileHandle;
+  *SourceOffset = data->SourceFileOffset;
+  *TargetOffset = data->TargetFileOffset;
+  *Length = data->ByteCount;
+  return TRUE;
+}
+
+// Writes the cached data of a range of the file to the file system and, if
+// Purge is set, drops it from the cache. Ranges of 4GB or more are done on the
+// whole file.
+static VOID FlushCachedRange(__in PDokanFCB Fcb, __in PLARGE_INTEGER Offset,
+                             __in LONGLONG Length, __in BOOLEAN Purge) {
+  PLARGE_INTEGER offset = Length > MAXULONG ? NULL : Offset;
+  ULONG length = Length > MAXULONG ? 0 : (ULONG)Length;
+
+  if (Fcb->SectionObjectPointers.DataSectionObject == NULL) {
+    return;
+  }
+  CcFlushCache(&Fcb->SectionObjectPointers, offset, length, NULL);
+  if (Purge) {
+    DokanPagingIoLockRW(Fcb);
+    DokanPagingIoUnlock(Fcb);
+    CcPurgeCacheSection(&Fcb->SectionObjectPointers, offset, length, FALSE);
+  }
+}
+
+// Sends the writes held back on the range by the handles of the file.
+static VOID FlushWriteBehindRange(__in PREQUEST_CONTEXT RequestContext,
+                                  __in PDokanFCB Fcb, __in LONGLONG Offset,
+                                  __in LONGLONG Length) {
+  for (LONGLONG done = 0; done < Length; done += MAXULONG) {
+    DokanFlushConflictingWriteBehind(RequestContext, Fcb, Offset + done,
+                                     (ULONG)min(Length - done, MAXULONG));
+  }
+}
+
+// Handles FSCTL_DUPLICATE_EXTENTS_TO_FILE by having the file system copy the
+// range itself, so that the data does not go through the caller. The source
+// handle is only referenced for the time of the dispatch, the file system gets
+// the name of its file.
+static NTSTATUS DuplicateExtents(__in PREQUEST_CONTEXT RequestContext) {
+  PFILE_OBJECT fileObject = RequestContext->IrpSp->FileObject;
+  PFILE_OBJECT sourceFileObject = NULL;
+  PDokanCCB ccb;
+  PDokanCCB sourceCcb;
+  PDokanFCB fcb = NULL;
+  PDokanFCB sourceFcb;
+  UNICODE_STRING sourceFileName = {0, 0, NULL};
+  HANDLE sourceHandle;
+  LARGE_INTEGER sourceOffset;
+  LARGE_INTEGER targetOffset;
+  LARGE_INTEGER length;
+  PEVENT_CONTEXT eventContext;
+  PCOPY_RANGE_CONTEXT copyRange;
+  ULONG eventLength;
+  NTSTATUS status;
+
+  if (fileObject == NULL ||
+      !DokanCheckCCB(RequestContext, fileObject->FsContext2)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  ccb = fileObject->FsContext2;
+  if (!GetDuplicateExtentsData(RequestContext, &sourceHandle, &sourceOffset,
+                               &targetOffset, &length)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  if (sourceOffset.QuadPart < 0 || targetOffset.QuadPart < 0 ||
+      length.QuadPart < 0 ||
+      sourceOffset.QuadPart > MAXLONGLONG - length.QuadPart ||
+      targetOffset.QuadPart > MAXLONGLONG - length.QuadPart) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  if (DokanFCBFlagsIsSet(ccb->Fcb, DOKAN_FILE_DIRECTORY)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  if (!fileObject->WriteAccess) {
+    return STATUS_ACCESS_DENIED;
+  }
+
+  status = ObReferenceObjectByHandle(
+      sourceHandle, FILE_READ_DATA, *IoFileObjectType,
+      RequestContext->Irp->RequestorMode, (PVOID*)&sourceFileObject, NULL);
+  if (!NT_SUCCESS(status)) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Failed to get source file object - %s",
+                       DokanGetNTSTATUSStr(status));
+    return status;
+  }
+
+  __try {
+    // Checked before looking at FsContext2, which only is a CCB of ours on
+    // our own device.
+    if (sourceFileObject->DeviceObject != fileObject->DeviceObject) {
+      status = STATUS_NOT_SAME_DEVICE;
+      __leave;
+    }
+    sourceCcb = sourceFileObject->FsContext2;
+    if (!DokanCheckCCB(RequestContext, sourceCcb) ||
+        sourceCcb->Identifier.Type != CCB) {
+      status = STATUS_NOT_SAME_DEVICE;
+      __leave;
+    }
+    sourceFcb = sourceCcb->Fcb;
+    if (DokanFCBFlagsIsSet(sourceFcb, DOKAN_FILE_DIRECTORY)) {
+      status = STATUS_INVALID_PARAMETER;
+      __leave;
+    }
+    DOKAN_LOG_FINE_IRP(RequestContext,
+                       "Source FCB=%p SourceOffset=%I64d TargetOffset=%I64d "
+                       "Length=%I64d",
+                       sourceFcb, sourceOffset.QuadPart, targetOffset.QuadPart,
+                       length.QuadPart);
+    if (length.QuadPart == 0) {
+      status = STATUS_SUCCESS;
+      __leave;
+    }
+
+    // The file system copies what it holds, so what is still cached or held
+    // back for the source is sent to it first, and the cache of the target is
+    // dropped for the range it overwrites.
+    FlushWriteBehindRange(RequestContext, sourceFcb, sourceOffset.QuadPart,
+                          length.QuadPart);
+    FlushCachedRange(sourceFcb, &sourceOffset, length.QuadPart, FALSE);
+    status = DokanFlushWriteBehind(RequestContext, ccb);
+    if (!NT_SUCCESS(status)) {
+      __leave;
+    }
+    FlushCachedRange(ccb->Fcb, &targetOffset, length.QuadPart, TRUE);
+
+    // Taken apart from the lock of the target, the two files can be the same.
+    DokanFCBLockRO(sourceFcb);
+    sourceFileName.Length = sourceFcb->FileName.Length;
+    sourceFileName.Buffer = DokanAlloc(sourceFileName.Length);
+    if (sourceFileName.Buffer != NULL) {
+      RtlCopyMemory(sourceFileName.Buffer, sourceFcb->FileName.Buffer,
+                    sourceFileName.Length);
+    }
+    DokanFCBUnlock(sourceFcb);
+    if (sourceFileName.Buffer == NULL) {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      __leave;
+    }
+
+    fcb = ccb->Fcb;
+    OplockDebugRecordMajorFunction(fcb, IRP_MJ_FILE_SYSTEM_CONTROL);
+    DokanFCBLockRO(fcb);
+
+    eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length +
+                  sourceFileName.Length + sizeof(WCHAR);
+    eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
+    if (eventContext == NULL) {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      __leave;
+    }
+
+    eventContext->Context = ccb->UserContext;
+    copyRange = &eventContext->Operation.CopyRange;
+    copyRange->FsControlCode = FSCTL_DUPLICATE_EXTENTS_TO_FILE;
+    copyRange->SourceOffset = sourceOffset;
+    copyRange->TargetOffset = targetOffset;
+    copyRange->Length = length;
+    copyRange->FileNameLength = fcb->FileName.Length;
+    RtlCopyMemory(copyRange->FileName, fcb->FileName.Buffer,
+                  fcb->FileName.Length);
+    copyRange->SourceFileNameLength = sourceFileName.Length;
+    copyRange->SourceFileNameOffset =
+        FIELD_OFFSET(COPY_RANGE_CONTEXT, FileName[0]) + fcb->FileName.Length +
+        sizeof(WCHAR);
+    RtlCopyMemory((PCHAR)copyRange + copyRange->SourceFileNameOffset,
+                  sourceFileName.Buffer, sourceFileName.Length);
+
+    // The target is written to, so its oplocks are broken as for a write.
+    status = DokanCheckOplock(fcb, RequestContext->Irp, eventContext,
+                              DokanOplockComplete, DokanPrePostIrp);
+    if (status != STATUS_SUCCESS) {
+      if (status == STATUS_PENDING) {
+        DOKAN_LOG_FINE_IRP(RequestContext,
+                           "FsRtlCheckOplock returned STATUS_PENDING");
+      } else {
+        DokanFreeEventContext(eventContext);
+      }
+      __leave;
+    }
+
+    status = DokanRegisterPendingIrp(RequestContext, eventContext);
+  } __finally {
+    if (fcb) {
+      DokanFCBUnlock(fcb);
+    }
+    if (sourceFileName.Buffer != NULL) {
+      ExFreePool(sourceFileName.Buffer);
+    }
+    ObDereferenceObject(sourceFileObject);
+  }
+  return status;
+}
+
+// Reads the range of FSCTL_SET_ZERO_DATA, from the offset to the first byte not
+// zeroed.
+static BOOLEAN GetZeroDataRange(__in PREQUEST_CONTEXT RequestContext,
+                                __out PLARGE_INTEGER Offset,
+                                __out PLARGE_INTEGER Length) {
+  PFILE_ZERO_DATA_INFORMATION data =
+      RequestContext->Irp->AssociatedIrp.SystemBuffer;
+
+  if (data == NULL ||
+      RequestContext->IrpSp->Parameters.FileSystemControl.InputBufferLength <
+          sizeof(FILE_ZERO_DATA_INFORMATION)) {
+    return FALSE;
+  }
+  if (data->FileOffset.QuadPart < 0 ||
+      data->BeyondFinalZero.QuadPart < data->FileOffset.QuadPart) {
+    return FALSE;
+  }
+  *Offset = data->FileOffset;
+  Length->QuadPart = data->BeyondFinalZero.QuadPart - data->FileOffset.QuadPart;
+  return TRUE;
+}
+
+// Reads the range of FSCTL_QUERY_ALLOCATED_RANGES, which is METHOD_NEITHER so
+// its input still is in the caller's memory.
+static BOOLEAN GetAllocatedRangesQuery(__in PREQUEST_CONTEXT RequestContext,
+                                       __out PLARGE_INTEGER Offset,
+                                       __out PLARGE_INTEGER Length) {
+  PFILE_ALLOCATED_RANGE_BUFFER query =
+      RequestContext->IrpSp->Parameters.FileSystemControl.Type3InputBuffer;
+
+  if (query == NULL ||
+      RequestContext->IrpSp->Parameters.FileSystemControl.InputBufferLength <
+          sizeof(FILE_ALLOCATED_RANGE_BUFFER)) {
+    return FALSE;
+  }
+  __try {
+    if (RequestContext->Irp->RequestorMode != KernelMode) {
+      ProbeForRead(query, sizeof(FILE_ALLOCATED_RANGE_BUFFER),
+                   sizeof(UCHAR));
+    }
+    *Offset = query->FileOffset;
+    *Length = query->Length;
+  } __except (EXCEPTION_EXECUTE_HANDLER) {
+    return FALSE;
+  }
+  return Offset->QuadPart >= 0 && Length->QuadPart >= 0 &&
+         Offset->QuadPart <= MAXLONGLONG - Length->QuadPart;
+}
+
+// Handles FSCTL_SET_SPARSE, FSCTL_SET_ZERO_DATA and
+// FSCTL_QUERY_ALLOCATED_RANGES by forwarding them to the file system, which
+// knows where the holes of its files are. The data cached or held back for the
+// range is sent to it first, so that the holes it reports or makes are the
+// ones the caller sees.
+static NTSTATUS SparseRequest(__in PREQUEST_CONTEXT RequestContext) {
+  ULONG fsControlCode =
+      RequestContext->IrpSp->Parameters.FileSystemControl.FsControlCode;
+  PFILE_OBJECT fileObject = RequestContext->IrpSp->FileObject;
+  PDokanCCB ccb;
+  PDokanFCB fcb;
+  BOOLEAN setSparse = TRUE;
+  LARGE_INTEGER offset = {0};
+  LARGE_INTEGER length = {0};
+  ULONG bufferLength = 0;
+  PEVENT_CONTEXT eventContext;
+  PSPARSE_CONTEXT sparse;
+  NTSTATUS status;
+
+  if (fileObject == NULL ||
+      !DokanCheckCCB(RequestContext, fileObject->FsContext2)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  ccb = fileObject->FsContext2;
+  fcb = ccb->Fcb;
+  if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  switch (fsControlCode) {
+    case FSCTL_SET_SPARSE: {
+      PFILE_SET_SPARSE_BUFFER buffer =
+          RequestContext->Irp->AssociatedIrp.SystemBuffer;
+      if (!fileObject->WriteAccess) {
+        return STATUS_ACCESS_DENIED;
+      }
+      // Without a buffer the file is made sparse.
+      if (buffer != NULL &&
+          RequestContext->IrpSp->Parameters.FileSystemControl
+                  .InputBufferLength >= sizeof(FILE_SET_SPARSE_BUFFER)) {
+        setSparse = buffer->SetSparse;
+      }
+      break;
+    }
+
+    case FSCTL_SET_ZERO_DATA:
+      if (!fileObject->WriteAccess) {
+        return STATUS_ACCESS_DENIED;
+      }
+      if (!GetZeroDataRange(RequestContext, &offset, &length)) {
+        return STATUS_INVALID_PARAMETER;
+      }
+      if (length.QuadPart == 0) {
+        return STATUS_SUCCESS;
+      }
+      FlushWriteBehindRange(RequestContext, fcb, offset.QuadPart,
+                            length.QuadPart);
+      status = DokanFlushWriteBehind(RequestContext, ccb);
+      if (!NT_SUCCESS(status)) {
+        return status;
+      }
+      FlushCachedRange(fcb, &offset, length.QuadPart, TRUE);
+      break;
+
+    case FSCTL_QUERY_ALLOCATED_RANGES:
+      if (!fileObject->ReadAccess) {
+        return STATUS_ACCESS_DENIED;
+      }
+      if (!GetAllocatedRangesQuery(RequestContext, &offset, &length)) {
+        return STATUS_INVALID_PARAMETER;
+      }
+      bufferLength =
+          RequestContext->IrpSp->Parameters.FileSystemControl
+              .OutputBufferLength /
+          sizeof(FILE_ALLOCATED_RANGE_BUFFER) *
+          sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+      if (bufferLength == 0) {
+        return STATUS_BUFFER_TOO_SMALL;
+      }
+      if (RequestContext->Irp->UserBuffer == NULL) {
+        return STATUS_INVALID_USER_BUFFER;
+      }
+      if (length.QuadPart == 0) {
+        return STATUS_SUCCESS;
+      }
+      FlushWriteBehindRange(RequestContext, fcb, offset.QuadPart,
+                            length.QuadPart);
+      FlushCachedRange(fcb, &offset, length.QuadPart, FALSE);
+      break;
+
+    default:
+      return STATUS_INVALID_DEVICE_REQUEST;
+  }
+
+  DOKAN_LOG_FINE_IRP(RequestContext,
+                     "FCB=%p SetSparse=%d Offset=%I64d Length=%I64d "
+                     "BufferLength=%lu",
+                     fcb, setSparse, offset.QuadPart, length.QuadPart,
+                     bufferLength);
+
+  OplockDebugRecordMajorFunction(fcb, IRP_MJ_FILE_SYSTEM_CONTROL);
+  DokanFCBLockRO(fcb);
+  eventContext = AllocateEventContext(
+      RequestContext, sizeof(EVENT_CONTEXT) + fcb->FileName.Length, ccb);
+  if (eventContext == NULL) {
+    DokanFCBUnlock(fcb);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+
+  if (bufferLength > 0 && RequestContext->Irp->MdlAddress == NULL) {
+    // The reply is written from another thread context.
+    status = DokanAllocateMdl(RequestContext, bufferLength);
+    if (!NT_SUCCESS(status)) {
+      DokanFreeEventContext(eventContext);
+      DokanFCBUnlock(fcb);
+      return status;
+    }
+    RequestContext->Flags = DOKAN_MDL_ALLOCATED;
+  }
+
+  eventContext->Context = ccb->UserContext;
+  sparse = &eventContext->Operation.Sparse;
+  sparse->FsControlCode = fsControlCode;
+  sparse->SetSparse = setSparse;
+  sparse->Offset = offset;
+  sparse->Length = length;
+  sparse->BufferLength = bufferLength;
+  sparse->FileNameLength = fcb->FileName.Length;
+  RtlCopyMemory(sparse->FileName, fcb->FileName.Buffer, fcb->FileName.Length);
+
+  if (fsControlCode == FSCTL_SET_ZERO_DATA) {
+    // The file is written to, so its oplocks are broken as for a write.
+    status = DokanCheckOplock(fcb, RequestContext->Irp, eventContext,
+                              DokanOplockComplete, DokanPrePostIrp);
+    if (status != STATUS_SUCCESS) {
+      if (status == STATUS_PENDING) {
+        DOKAN_LOG_FINE_IRP(RequestContext,
+                           "FsRtlCheckOplock returned STATUS_PENDING");
+      } else {
+        DokanFreeEventContext(eventContext);
+      }
+      DokanFCBUnlock(fcb);
+      return status;
+    }
+  }
+
+  status = DokanRegisterPendingIrp(RequestContext, eventContext);
+  DokanFCBUnlock(fcb);
+  return status;
+}
+
+// Copies the ranges returned by the file system for FSCTL_QUERY_ALLOCATED_RANGES
+// to the output buffer of the caller.
+static VOID CompleteQueryAllocatedRanges(__in PREQUEST_CONTEXT RequestContext,
+                                         __in PEVENT_INFORMATION EventInfo) {
+  ULONG bufferLength =
+      RequestContext->IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+  PVOID buffer = NULL;
+
+  if (RequestContext->Irp->MdlAddress != NULL) {
+    buffer =
+        MmGetSystemAddressForMdlNormalSafe(RequestContext->Irp->MdlAddress);
+  }
+
+  if ((EventInfo->Status == STATUS_SUCCESS ||
+       EventInfo->Status == STATUS_BUFFER_OVERFLOW) &&
+      EventInfo->BufferLength > 0) {
+    if (EventInfo->BufferLength > bufferLength ||
+        EventInfo->BufferLength % sizeof(FILE_ALLOCATED_RANGE_BUFFER) != 0) {
+      DOKAN_LOG_FINE_IRP(RequestContext, "Invalid reply length %lu",
+                         EventInfo->BufferLength);
+      RequestContext->Irp->IoStatus.Status = STATUS_INVALID_PARAMETER;
+    } else if (buffer == NULL) {
+      RequestContext->Irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+    } else {
+      RtlCopyMemory(buffer, EventInfo->Buffer, EventInfo->BufferLength);
+      RequestContext->Irp->IoStatus.Information = EventInfo->BufferLength;
+    }
+  }
+
+  if (RequestContext->Flags & DOKAN_MDL_ALLOCATED) {
+    DokanFreeMdl(RequestContext->Irp);
+    RequestContext->Flags &= ~DOKAN_MDL_ALLOCATED;
+  }
+}
+
+VOID DokanCompleteFileSystemControl(__in PREQUEST_CONTEXT RequestContext,
+                                    __in PEVENT_INFORMATION EventInfo) {
+  PFILE_OBJECT fileObject = RequestContext->IrpSp->FileObject;
+  PDokanCCB ccb;
+  HANDLE sourceHandle;
+  LARGE_INTEGER sourceOffset;
+  LARGE_INTEGER targetOffset;
+  LARGE_INTEGER length;
+
+  DOKAN_LOG_FINE_IRP(RequestContext, "FileObject=%p", fileObject);
+
+  // Sent to the disk device, which has no CCB.
+  if (RequestContext->IrpSp->Parameters.FileSystemControl.FsControlCode ==
+      FSCTL_ECHO) {
+    DokanCompleteEcho(RequestContext, EventInfo);
+    return;
+  }
+
+  ccb = fileObject->FsContext2;
+  ASSERT(ccb != NULL);
+
+  ccb->UserContext = EventInfo->Context;
+  DOKAN_LOG_FINE_IRP(RequestContext, "Set Context %X",
+                     (ULONG)ccb->UserContext);
+
+  RequestContext->Irp->IoStatus.Status = EventInfo->Status;
+
+  switch (RequestContext->IrpSp->Parameters.FileSystemControl.FsControlCode) {
+    case FSCTL_DUPLICATE_EXTENTS_TO_FILE:
+      if (GetDuplicateExtentsData(RequestContext, &sourceHandle,
+                                  &sourceOffset, &targetOffset, &length)) {
+        // What was read into the cache during the copy may be stale, even
+        // when it failed part way.
+        FlushCachedRange(ccb->Fcb, &targetOffset, length.QuadPart, TRUE);
+      }
+      break;
+
+    case FSCTL_SET_ZERO_DATA:
+      if (GetZeroDataRange(RequestContext, &targetOffset, &length)) {
+        FlushCachedRange(ccb->Fcb, &targetOffset, length.QuadPart, TRUE);
+      }
+      DokanInvalidateFileInfoCache(ccb->Fcb);
+      DokanInvalidateReadAhead(ccb->Fcb);
+      break;
+
+    case FSCTL_SET_SPARSE:
+      // FILE_ATTRIBUTE_SPARSE_FILE changed.
+      DokanInvalidateFileInfoCache(ccb->Fcb);
+      break;
+
+    case FSCTL_QUERY_ALLOCATED_RANGES:
+      CompleteQueryAllocatedRanges(RequestContext, EventInfo);
+      break;
+  }
+}
+
 NTSTATUS
 DokanVolumeUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
   PFILE_OBJECT fileObject = NULL;
@@ -362,18 +1006,15 @@ DokanVolumeUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
                              L"Received FSCTL_NOTIFY_PATH with no FCB.");
       }
       UNICODE_STRING receivedBuffer;
+      BOOLEAN negativeCacheFlushed = FALSE;
       receivedBuffer.Length = pNotifyPath->Length;
       receivedBuffer.MaximumLength = pNotifyPath->Length;
       receivedBuffer.Buffer = pNotifyPath->Buffer;
-      DOKAN_LOG_FINE_IRP(RequestContext,
-                         "CompletionFilter: %lu, Action: %lu, "
-                         "Length: %i, Path: \"%wZ\"",
-                         pNotifyPath->CompletionFilter, pNotifyPath->Action,
-                         receivedBuffer.Length, &receivedBuffer);
+      InvalidateVolumeCachesForNotification(fcb->Vcb);
       DokanFCBLockRO(fcb);
-      NTSTATUS status = DokanNotifyReportChange0(
+      NTSTATUS status = ReportNotifiedPath(
           RequestContext, fcb, &receivedBuffer, pNotifyPath->CompletionFilter,
-          pNotifyPath->Action);
+          pNotifyPath->Action, &negativeCacheFlushed);
       DokanFCBUnlock(fcb);
       if (status == STATUS_OBJECT_NAME_INVALID) {
         DokanCleanupAllChangeNotificationWaiters(fcb->Vcb);
@@ -381,6 +1022,26 @@ DokanVolumeUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
       return status;
     }
 
+    case FSCTL_NOTIFY_PATH_BATCH: {
+      fileObject = RequestContext->IrpSp->FileObject;
+      if (fileObject == NULL) {
+        return DokanLogError(
+            &logger, STATUS_INVALID_PARAMETER,
+            L"Received FSCTL_NOTIFY_PATH_BATCH with no FileObject.");
+      }
+      ccb = fileObject->FsContext2;
+      if (ccb == NULL || ccb->Identifier.Type != CCB) {
+        return DokanLogError(&logger, STATUS_INVALID_PARAMETER,
+                             L"Received FSCTL_NOTIFY_PATH_BATCH with no CCB.");
+      }
+      fcb = ccb->Fcb;
+      if (fcb == NULL || fcb->Identifier.Type != FCB) {
+        return DokanLogError(&logger, STATUS_INVALID_PARAMETER,
+                             L"Received FSCTL_NOTIFY_PATH_BATCH with no FCB.");
+      }
+      return NotifyPathBatch(RequestContext, fcb);
+    }
+
     case FSCTL_REQUEST_OPLOCK_LEVEL_1:
     case FSCTL_REQUEST_OPLOCK_LEVEL_2:
     case FSCTL_REQUEST_BATCH_OPLOCK:
@@ -399,6 +1060,14 @@ DokanVolumeUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
 
     case FSCTL_GET_REPARSE_POINT:
       return STATUS_NOT_A_REPARSE_POINT;
+
+    case FSCTL_DUPLICATE_EXTENTS_TO_FILE:
+      return DuplicateExtents(RequestContext);
+
+    case FSCTL_SET_SPARSE:
+    case FSCTL_SET_ZERO_DATA:
+    case FSCTL_QUERY_ALLOCATED_RANGES:
+      return SparseRequest(RequestContext);
   }
   // TODO(someone): Find if there is a way to send FSCTL to Disk type for DokanRedirector
   if (RequestContext->Dcb && RequestContext->Dcb->VolumeDeviceType ==
@@ -434,6 +1103,12 @@ DokanGlobalUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
     case FSCTL_EVENT_MOUNTPOINT_LIST:
       return DokanGetMountPointList(RequestContext);
 
+    case FSCTL_MOUNTPOINT_LIST_CHANGE:
+      return DokanWaitMountPointListChange(RequestContext);
+
+    case FSCTL_GET_DRIVER_LOGS:
+      return DokanGetDriverLogs(RequestContext);
+
     case FSCTL_GET_VERSION: {
       ULONG *version;
       if (!PREPARE_OUTPUT(RequestContext->Irp, version,
@@ -454,21 +1129,23 @@ DokanGlobalUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
   return STATUS_INVALID_DEVICE_REQUEST;
 }
 
-NTSTATUS PullEvents(__in PREQUEST_CONTEXT RequestContext,
-                    __in PIRP_LIST NotifyEvent) {
+// Moves as many events of NotifyEvent as fit to the output buffer of the
+// pulling IOCTL, up to *MaxEvents which is decremented by the number of events
+// moved. Returns FALSE when the IOCTL does not take more events.
+static BOOLEAN PullEventsFromQueue(
+    __in PREQUEST_CONTEXT RequestContext, __in PIRP_LIST NotifyEvent,
+    __inout PULONG MaxEvents, __inout PCHAR* CurrentIoctlBuffer,
+    __inout PULONG CurrentIoctlBufferBytesRemaining) {
   PDRIVER_EVENT_CONTEXT workItem = NULL;
   PDRIVER_EVENT_CONTEXT alreadySeenWorkItem = NULL;
   PLIST_ENTRY workItemListEntry = NULL;
   KIRQL workQueueIrql;
   ULONG workItemBytes = 0;
-  ULONG currentIoctlBufferBytesRemaining =
-      RequestContext->IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
-  PCHAR currentIoctlBuffer =
-      (PCHAR)RequestContext->Irp->AssociatedIrp.SystemBuffer;
+  BOOLEAN moreEvents = TRUE;
 
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&NotifyEvent->ListLock, &workQueueIrql);
-  while (!IsListEmpty(&NotifyEvent->ListHead)) {
+  while (*MaxEvents > 0 && !IsListEmpty(&NotifyEvent->ListHead)) {
     workItemListEntry = RemoveHeadList(&NotifyEvent->ListHead);
     workItem =
         CONTAINING_RECORD(workItemListEntry, DRIVER_EVENT_CONTEXT, ListEntry);
@@ -476,7 +1153,7 @@ NTSTATUS PullEvents(__in PREQUEST_CONTEXT RequestContext,
     // Buffer is not specified or short of length (this may mean we filled the
     // space in one of the DLL's buffers in batch mode). Put the IRP back in
     // the work queue; it will have to go in a different buffer.
-    if (currentIoctlBufferBytesRemaining < workItemBytes) {
+    if (*CurrentIoctlBufferBytesRemaining < workItemBytes) {
       InsertTailList(&NotifyEvent->ListHead, &workItem->ListEntry);
       if (alreadySeenWorkItem == workItem) {
         // We have reached the end of the list
@@ -488,27 +1165,184 @@ NTSTATUS PullEvents(__in PREQUEST_CONTEXT RequestContext,
       continue;
     }
     // Send the work item back in the response to the current IOCTL.
-    RtlCopyMemory(currentIoctlBuffer, &workItem->EventContext, workItemBytes);
-    currentIoctlBufferBytesRemaining -= workItemBytes;
-    currentIoctlBuffer += workItemBytes;
+    RtlCopyMemory(*CurrentIoctlBuffer, &workItem->EventContext, workItemBytes);
+    *CurrentIoctlBufferBytesRemaining -= workItemBytes;
+    *CurrentIoctlBuffer += workItemBytes;
     RequestContext->Irp->IoStatus.Information += workItemBytes;
-    ExFreePool(workItem);
+    DokanFreeEventContext(&workItem->EventContext);
+    InterlockedDecrement(&RequestContext->Dcb->NotifyEventCount);
+    --*MaxEvents;
     if (!RequestContext->Dcb->AllowIpcBatching) {
+      moreEvents = FALSE;
+      break;
+    }
+  }
+  KeReleaseSpinLock(&NotifyEvent->ListLock, workQueueIrql);
+  return moreEvents &&
+         *CurrentIoctlBufferBytesRemaining >= sizeof(EVENT_CONTEXT);
+}
+
+// Stamps the pending IRPs of the events pulled in Buffer with their pull time,
+// to tell the time they spent queued from the time spent in user mode in the
+// operation metrics.
+static VOID SetPulledTime(__in PDokanDCB Dcb, __in PCHAR Buffer,
+                          __in ULONG Length) {
+  PEVENT_CONTEXT eventContext;
+  PIRP_ENTRY irpEntry;
+  LARGE_INTEGER now;
+  ULONG offset = 0;
+  KIRQL oldIrql;
+
+  if (Length == 0) {
+    return;
+  }
+  now = KeQueryPerformanceCounter(NULL);
+  ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+  KeAcquireSpinLock(&Dcb->PendingIrp.ListLock, &oldIrql);
+  while (offset < Length) {
+    eventContext = (PEVENT_CONTEXT)(Buffer + offset);
+    // Events with no pending IRP, like the ones of IRP_MJ_CLOSE, are not found.
+    irpEntry = DokanLookupPendingIrp(Dcb, eventContext->SerialNumber);
+    if (irpEntry != NULL) {
+      irpEntry->PulledTime = now;
+    }
+    offset += eventContext->Length;
+  }
+  KeReleaseSpinLock(&Dcb->PendingIrp.ListLock, oldIrql);
+}
+
+// Pulls up to MaxEvents events of the given lane, from the queue of the current
+// processor first and then from the ones of the other processors. Returns the
+// number of events pulled and sets *MoreRoom to whether the IOCTL takes more.
+static ULONG PullEventsFromLane(__in PREQUEST_CONTEXT RequestContext,
+                                __in ULONG Lane, __in ULONG MaxEvents,
+                                __inout PCHAR* CurrentIoctlBuffer,
+                                __inout PULONG CurrentIoctlBufferBytesRemaining,
+                                __out PBOOLEAN MoreRoom) {
+  PDokanDCB dcb = RequestContext->Dcb;
+  ULONG localQueue = KeGetCurrentProcessorNumberEx(NULL) % dcb->NotifyQueueCount;
+  ULONG eventsLeft = MaxEvents;
+  PIRP_LIST notifyEvent;
+
+  *MoreRoom = TRUE;
+  for (ULONG i = 0; i < dcb->NotifyQueueCount && eventsLeft > 0; ++i) {
+    notifyEvent =
+        &dcb->NotifyQueues[(localQueue + i) % dcb->NotifyQueueCount]
+             .NotifyEvent[Lane];
+    // Racy peek to skip the empty queues without touching their lock. An event
+    // missed that way is accounted for in NotifyEventCount.
+    if (IsListEmpty(&notifyEvent->ListHead)) {
+      continue;
+    }
+    if (!PullEventsFromQueue(RequestContext, notifyEvent, &eventsLeft,
+                             CurrentIoctlBuffer,
+                             CurrentIoctlBufferBytesRemaining)) {
+      *MoreRoom = FALSE;
       break;
     }
   }
+  return MaxEvents - eventsLeft;
+}
+
+// Pulls the waiting events, the metadata ones first. When both lanes have
+// events waiting, a bulk event is pulled every MetadataLaneWeight metadata
+// events so that the data transfers are not starved. The credit left is kept in
+// the Dcb across IOCTLs, as without IPC batching each one takes a single event.
+NTSTATUS PullEvents(__in PREQUEST_CONTEXT RequestContext) {
+  PDokanDCB dcb = RequestContext->Dcb;
+  ULONG currentIoctlBufferBytesRemaining =
+      RequestContext->IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
+  PCHAR currentIoctlBuffer =
+      (PCHAR)RequestContext->Irp->AssociatedIrp.SystemBuffer;
+  BOOLEAN moreRoom = TRUE;
+  LONG credit;
+  ULONG pulled;
+
+  for (;;) {
+    credit = InterlockedCompareExchange(&dcb->MetadataLaneCredit, 0, 0);
+    if (credit <= 0) {
+      PullEventsFromLane(RequestContext, DOKAN_EVENT_LANE_BULK, 1,
+                         &currentIoctlBuffer,
+                         &currentIoctlBufferBytesRemaining, &moreRoom);
+      credit = (LONG)dcb->MetadataLaneWeight;
+      InterlockedExchange(&dcb->MetadataLaneCredit, credit);
+      if (!moreRoom) {
+        break;
+      }
+    }
+    pulled = PullEventsFromLane(RequestContext, DOKAN_EVENT_LANE_METADATA,
+                                (ULONG)credit, &currentIoctlBuffer,
+                                &currentIoctlBufferBytesRemaining, &moreRoom);
+    InterlockedAdd(&dcb->MetadataLaneCredit, -(LONG)pulled);
+    if (!moreRoom) {
+      break;
+    }
+    if (pulled < (ULONG)credit) {
+      // No other metadata event fits; the bulk ones get the rest of the IOCTL.
+      PullEventsFromLane(RequestContext, DOKAN_EVENT_LANE_BULK, MAXULONG,
+                         &currentIoctlBuffer,
+                         &currentIoctlBufferBytesRemaining, &moreRoom);
+      break;
+    }
+  }
+  SetPulledTime(dcb, (PCHAR)RequestContext->Irp->AssociatedIrp.SystemBuffer,
+                (ULONG)(currentIoctlBuffer -
+                        (PCHAR)RequestContext->Irp->AssociatedIrp.SystemBuffer));
   // If there is still pending items we need to reflag the queue for when we come back
-  if (!IsListEmpty(&NotifyEvent->ListHead) &&
-       !KeReadStateQueue(&RequestContext->Dcb->NotifyIrpEventQueue)) {
-     KeInsertQueue(&RequestContext->Dcb->NotifyIrpEventQueue,
-                   &RequestContext->Dcb->NotifyIrpEventQueueList);
+  if (InterlockedCompareExchange(&dcb->NotifyEventCount, 0, 0) > 0) {
+    DokanSignalNotifyEvent(dcb);
   }
-  KeReleaseSpinLock(&NotifyEvent->ListLock, workQueueIrql);
   RequestContext->Irp->IoStatus.Status = STATUS_SUCCESS;
   return RequestContext->Irp->IoStatus.Status;
 }
 
 
+// Completes the pulls pended by DokanPullEventsAsync with the waiting events,
+// one IRP at a time while there are events left.
+VOID DokanCompletePendingPulls(__in PDokanDCB Dcb) {
+  PIRP_ENTRY irpEntry;
+
+  while (InterlockedCompareExchange(&Dcb->NotifyEventCount, 0, 0) > 0) {
+    irpEntry = PopIrpList(&Dcb->PendingPullIrp);
+    if (irpEntry == NULL) {
+      return;
+    }
+    irpEntry->RequestContext.Irp->IoStatus.Information = 0;
+    PullEvents(&irpEntry->RequestContext);
+    DokanCompleteIrpRequest(irpEntry->RequestContext.Irp, STATUS_SUCCESS);
+    DokanFreeIrpEntry(irpEntry);
+  }
+}
+
+// Pulls the waiting events like DokanProcessAndPullEvents, but pends the IRP
+// instead of blocking the thread when there are none.
+NTSTATUS DokanPullEventsAsync(__in PREQUEST_CONTEXT RequestContext) {
+  PDokanDCB dcb = RequestContext->Dcb;
+  NTSTATUS status;
+
+  if (RequestContext->IrpSp->Parameters.DeviceIoControl.OutputBufferLength <
+      sizeof(EVENT_CONTEXT)) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "No output buffer provided");
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+  if (RequestContext->Vcb == NULL || IsUnmountPendingVcb(RequestContext->Vcb)) {
+    return STATUS_NO_SUCH_DEVICE;
+  }
+  RequestContext->Vcb->HasEventWait = TRUE;
+
+  if (InterlockedCompareExchange(&dcb->NotifyEventCount, 0, 0) > 0) {
+    return PullEvents(RequestContext);
+  }
+  status = RegisterPendingIrpMain(RequestContext, /*EventContext=*/NULL,
+                                  &dcb->PendingPullIrp, /*CheckMount=*/TRUE,
+                                  /*CurrentStatus=*/STATUS_SUCCESS);
+  if (status == STATUS_PENDING) {
+    // Events queued before the IRP was in the list did not wake it up.
+    DokanCompletePendingPulls(dcb);
+  }
+  return status;
+}
+
 NTSTATUS DokanProcessAndPullEvents(__in PREQUEST_CONTEXT RequestContext) {
   // 1 - Complete the optional event.
   // Main pull thread will not have events to complete when:
@@ -560,8 +1394,12 @@ NTSTATUS DokanProcessAndPullEvents(__in PREQUEST_CONTEXT RequestContext) {
     return STATUS_SUCCESS;
   }
 
+  // This thread now owns the wake up. Anything queued from now on signals the
+  // next one.
+  InterlockedExchange(&RequestContext->Dcb->NotifyIrpEventQueueSignaled, 0);
+
   // 5 - Fill the provided buffer as much as we can with events.
-  return PullEvents(RequestContext, &RequestContext->Dcb->NotifyEvent);
+  return PullEvents(RequestContext);
 }
 
 NTSTATUS
@@ -573,16 +1411,38 @@ DokanDiskUserFsRequest(__in PREQUEST_CONTEXT RequestContext) {
   switch (RequestContext->IrpSp->Parameters.FileSystemControl.FsControlCode) {
     case FSCTL_EVENT_PROCESS_N_PULL:
       return DokanProcessAndPullEvents(&requestContext);
+    case FSCTL_EVENT_PULL_ASYNC:
+      return DokanPullEventsAsync(&requestContext);
     case FSCTL_EVENT_RELEASE:
       return DokanEventRelease(&requestContext, requestContext.Vcb->DeviceObject);
     case FSCTL_EVENT_WRITE:
       return DokanEventWrite(&requestContext);
     case FSCTL_GET_VOLUME_METRICS:
       return DokanGetVolumeMetrics(&requestContext);
+    case FSCTL_GET_VOLUME_METRICS_EX:
+      return DokanGetVolumeMetricsEx(&requestContext);
+    case FSCTL_UPDATE_VOLUME_INFO:
+      return DokanUpdateVolumeInfo(&requestContext);
+    case FSCTL_BREAK_LEASE:
+      return DokanBreakLease(&requestContext);
     case FSCTL_RESET_TIMEOUT:
       return DokanResetPendingIrpTimeout(&requestContext);
+    case FSCTL_RESET_ALL_TIMEOUTS:
+      return DokanResetAllPendingIrpTimeouts(&requestContext);
+    case FSCTL_HEARTBEAT:
+      return DokanHeartbeat(&requestContext);
+    case FSCTL_HYDRATE_RANGE:
+      return DokanHydrateRange(&requestContext);
+    case FSCTL_ECHO:
+      return DokanEcho(&requestContext);
+    case FSCTL_GET_VOLUME_PROFILE:
+      return DokanGetVolumeProfile(&requestContext);
     case FSCTL_GET_ACCESS_TOKEN:
       return DokanGetAccessToken(&requestContext);
+    case FSCTL_EVENT_RING_REGISTER:
+      return DokanEventRingRegister(&requestContext);
+    case FSCTL_EVENT_RING_DOORBELL:
+      return DokanEventRingDoorbell(&requestContext);
   }
   DOKAN_LOG_FINE_IRP(
       RequestContext, "Unsupported FsControlCode %x",
@@ -866,6 +1726,10 @@ NTSTATUS DokanMountVolume(__in PREQUEST_CONTEXT RequestContext) {
 
   RtlInitializeGenericTableAvl(&vcb->FcbTable, DokanCompareFcb,
                                DokanAllocateFcbAvl, DokanFreeFcbAvl, vcb);
+  DokanInitNegativeCache(vcb);
+  KeInitializeSpinLock(&vcb->VolumeInfoCacheLock);
+  KeInitializeSpinLock(&vcb->ProfileLock);
+  DokanInitWriteBehind(vcb);
 
   InitializeListHead(&vcb->DirNotifyList);
   FsRtlNotifyInitializeSync(&vcb->NotifySync);
@@ -117,6 +117,39 @@ InsertDcbToDelete(PDokanDCB Dcb, PDEVICE_OBJECT VolumeDeviceObject,
                               Dcb->MountPoint);
 }
 
+// Moves the mount point list to a new generation and completes the
+// FSCTL_MOUNTPOINT_LIST_CHANGE IRPs waiting for it. The caller has just changed
+// the list and holds MountPointListLock exclusively.
+static VOID DokanSignalMountPointListChange(__in PDOKAN_GLOBAL DokanGlobal) {
+  LIST_ENTRY completeList;
+  PLIST_ENTRY listHead;
+  PIRP_ENTRY irpEntry;
+  PIRP irp;
+
+  ++DokanGlobal->MountPointListGeneration;
+  MoveIrpList(&DokanGlobal->MountPointListWaiters, &completeList);
+  while (!IsListEmpty(&completeList)) {
+    listHead = RemoveHeadList(&completeList);
+    irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
+    irp = irpEntry->RequestContext.Irp;
+    *(PULONG)irp->AssociatedIrp.SystemBuffer =
+        DokanGlobal->MountPointListGeneration;
+    irp->IoStatus.Information = sizeof(ULONG);
+    DokanCompleteIrpRequest(irp, STATUS_SUCCESS);
+    DokanFreeIrpEntry(irpEntry);
+  }
+}
+
+// Returns the bucket of Table for the device name or mount point Name.
+static PLIST_ENTRY DokanMountEntryBucket(__in PLIST_ENTRY Table,
+                                         __in PCWSTR Name) {
+  ULONG hash = 0;
+  for (; *Name != L'\0'; ++Name) {
+    hash = hash * 31 + *Name;
+  }
+  return &Table[hash & (DOKAN_MOUNT_ENTRY_TABLE_SIZE - 1)];
+}
+
 BOOLEAN
 InsertMountEntry(PDOKAN_GLOBAL DokanGlobal, PDOKAN_CONTROL DokanControl) {
   PMOUNT_ENTRY mountEntry = DokanAllocZero(sizeof(MOUNT_ENTRY));
@@ -129,6 +162,15 @@ InsertMountEntry(PDOKAN_GLOBAL DokanGlobal, PDOKAN_CONTROL DokanControl) {
   RtlCopyMemory(&mountEntry->MountControl, DokanControl, sizeof(DOKAN_CONTROL));
   ExAcquireResourceExclusiveLite(&DokanGlobal->MountPointListLock, TRUE);
   InsertTailList(&DokanGlobal->MountPointList, &mountEntry->ListEntry);
+  InsertTailList(
+      DokanMountEntryBucket(DokanGlobal->MountEntriesByDeviceName,
+                            mountEntry->MountControl.DeviceName),
+      &mountEntry->DeviceNameLink);
+  InsertTailList(
+      DokanMountEntryBucket(DokanGlobal->MountEntriesByMountPoint,
+                            mountEntry->MountControl.MountPoint),
+      &mountEntry->MountPointLink);
+  DokanSignalMountPointListChange(DokanGlobal);
   ExReleaseResourceLite(&DokanGlobal->MountPointListLock);
   return TRUE;
 }
@@ -221,6 +263,10 @@ VOID DeleteDeviceDelayed(PDOKAN_GLOBAL dokanGlobal) {
               }
 
               FreeDcbNames(dcb);
+              if (dcb->UserProcess != NULL) {
+                ObDereferenceObject(dcb->UserProcess);
+                dcb->UserProcess = NULL;
+              }
 
               DOKAN_LOG_("Delete the volume device. ReferenceCount %lu",
                         deviceEntry->VolumeDeviceObject->ReferenceCount);
@@ -358,13 +404,17 @@ VOID RemoveMountEntry(__in PDOKAN_GLOBAL DokanGlobal,
       FindMountEntry(DokanGlobal, DokanControl, /*ExclusiveLock=*/TRUE);
   if (!mountEntry) {
     // Already removed
+    ExReleaseResourceLite(&DokanGlobal->MountPointListLock);
     return;
   }
   RemoveEntryList(&mountEntry->ListEntry);
   InitializeListHead(&mountEntry->ListEntry);
+  RemoveEntryList(&mountEntry->DeviceNameLink);
+  RemoveEntryList(&mountEntry->MountPointLink);
   ExReleaseResourceLite(&mountEntry->Resource);
   ExDeleteResourceLite(&mountEntry->Resource);
   ExFreePool(mountEntry);
+  DokanSignalMountPointListChange(DokanGlobal);
 
   ExReleaseResourceLite(&DokanGlobal->MountPointListLock);
 }
@@ -482,6 +532,7 @@ PMOUNT_ENTRY FindMountEntry(__in PDOKAN_GLOBAL DokanGlobal,
                             __in PDOKAN_CONTROL DokanControl,
                             __in BOOLEAN ExclusiveLock) {
   PMOUNT_ENTRY mountEntry = NULL;
+  PLIST_ENTRY listHead;
   PLIST_ENTRY listEntry;
   PMOUNT_ENTRY mountEntryLookup = NULL;
   PDOKAN_CONTROL dokanControlLookup = NULL;
@@ -494,16 +545,19 @@ PMOUNT_ENTRY FindMountEntry(__in PDOKAN_GLOBAL DokanGlobal,
   DokanLogInfo(&logger, L"Finding mount entry; mount point = %s.",
                DokanControl->MountPoint);
 
+  // The names of the entries only change with the list lock held exclusively,
+  // so they can be compared without holding the resource of each entry.
   if (lockMountEntryList) {
-    ExAcquireResourceExclusiveLite(&DokanGlobal->MountPointListLock, TRUE);
-  }
-  for (listEntry = DokanGlobal->MountPointList.Flink;
-       listEntry != &DokanGlobal->MountPointList;
-       listEntry = listEntry->Flink) {
-    mountEntryLookup = CONTAINING_RECORD(listEntry, MOUNT_ENTRY, ListEntry);
-    ExAcquireResourceSharedLite(&mountEntryLookup->Resource, TRUE);
-    dokanControlLookup = &mountEntryLookup->MountControl;
-    if (useMountPoint) {
+    ExAcquireResourceSharedLite(&DokanGlobal->MountPointListLock, TRUE);
+  }
+  if (useMountPoint) {
+    listHead = DokanMountEntryBucket(DokanGlobal->MountEntriesByMountPoint,
+                                     DokanControl->MountPoint);
+    for (listEntry = listHead->Flink; listEntry != listHead;
+         listEntry = listEntry->Flink) {
+      mountEntryLookup =
+          CONTAINING_RECORD(listEntry, MOUNT_ENTRY, MountPointLink);
+      dokanControlLookup = &mountEntryLookup->MountControl;
       isSessionIdMatch =
           (DokanControl->SessionId == dokanControlLookup->SessionId) ||
           (dokanControlLookup->SessionId == (ULONG)-1);
@@ -513,23 +567,30 @@ PMOUNT_ENTRY FindMountEntry(__in PDOKAN_GLOBAL DokanGlobal,
         mountEntry = mountEntryLookup;
         break;
       }
-      DokanLogInfo(&logger, L"Skipping entry with non-matching mount point: %s",
-                   dokanControlLookup->MountPoint);
-    } else if (wcscmp(DokanControl->DeviceName,
-                      dokanControlLookup->DeviceName) == 0) {
-      DokanLogInfo(&logger, L"Found entry with matching device name: %s",
-                   dokanControlLookup->DeviceName);
-      mountEntry = mountEntryLookup;
-      break;
     }
-    ExReleaseResourceLite(&mountEntryLookup->Resource);
+  } else {
+    listHead = DokanMountEntryBucket(DokanGlobal->MountEntriesByDeviceName,
+                                     DokanControl->DeviceName);
+    for (listEntry = listHead->Flink; listEntry != listHead;
+         listEntry = listEntry->Flink) {
+      mountEntryLookup =
+          CONTAINING_RECORD(listEntry, MOUNT_ENTRY, DeviceNameLink);
+      dokanControlLookup = &mountEntryLookup->MountControl;
+      if (wcscmp(DokanControl->DeviceName, dokanControlLookup->DeviceName) ==
+          0) {
+        DokanLogInfo(&logger, L"Found entry with matching device name: %s",
+                     dokanControlLookup->DeviceName);
+        mountEntry = mountEntryLookup;
+        break;
+      }
+    }
   }
 
   if (mountEntry) {
     if (ExclusiveLock) {
-      // Convert owned Shared lock to Exclusive
-      ExReleaseResourceLite(&mountEntry->Resource);
       ExAcquireResourceExclusiveLite(&mountEntry->Resource, TRUE);
+    } else {
+      ExAcquireResourceSharedLite(&mountEntry->Resource, TRUE);
     }
     DokanLogInfo(&logger, L"Mount entry found: %s -> %s",
                  mountEntry->MountControl.MountPoint,
@@ -569,6 +630,28 @@ PMOUNT_ENTRY FindMountEntryByName(__in PDOKAN_GLOBAL DokanGlobal,
   return mountEntry;
 }
 
+BOOLEAN UpdateMountEntryMountPoint(__in PDOKAN_GLOBAL DokanGlobal,
+                                   __in PUNICODE_STRING DiskDeviceName,
+                                   __in PUNICODE_STRING UNCName,
+                                   __in PUNICODE_STRING MountPoint) {
+  ExAcquireResourceExclusiveLite(&DokanGlobal->MountPointListLock, TRUE);
+  PMOUNT_ENTRY mountEntry = FindMountEntryByName(
+      DokanGlobal, DiskDeviceName, UNCName, /*ExclusiveLock=*/TRUE);
+  if (mountEntry != NULL) {
+    RtlStringCchCopyUnicodeString(mountEntry->MountControl.MountPoint,
+                                  MAXIMUM_FILENAME_LENGTH, MountPoint);
+    RemoveEntryList(&mountEntry->MountPointLink);
+    InsertTailList(
+        DokanMountEntryBucket(DokanGlobal->MountEntriesByMountPoint,
+                              mountEntry->MountControl.MountPoint),
+        &mountEntry->MountPointLink);
+    ExReleaseResourceLite(&mountEntry->Resource);
+    DokanSignalMountPointListChange(DokanGlobal);
+  }
+  ExReleaseResourceLite(&DokanGlobal->MountPointListLock);
+  return mountEntry != NULL;
+}
+
 NTSTATUS
 DokanGetMountPointList(__in PREQUEST_CONTEXT RequestContext) {
   NTSTATUS status = STATUS_SUCCESS;
@@ -586,7 +669,7 @@ DokanGetMountPointList(__in PREQUEST_CONTEXT RequestContext) {
     sessionId = 0;
   }
 
-  ExAcquireResourceExclusiveLite(
+  ExAcquireResourceSharedLite(
       &RequestContext->DokanGlobal->MountPointListLock, TRUE);
 
   dokanMountPointInfo =
@@ -638,6 +721,36 @@ DokanGetMountPointList(__in PREQUEST_CONTEXT RequestContext) {
   return status;
 }
 
+NTSTATUS
+DokanWaitMountPointListChange(__in PREQUEST_CONTEXT RequestContext) {
+  PDOKAN_GLOBAL dokanGlobal = RequestContext->DokanGlobal;
+  PIO_STACK_LOCATION irpSp = RequestContext->IrpSp;
+  PULONG generation = RequestContext->Irp->AssociatedIrp.SystemBuffer;
+  NTSTATUS status;
+
+  if (irpSp->Parameters.FileSystemControl.OutputBufferLength <
+      sizeof(ULONG)) {
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+
+  // Shared is enough to keep the generation from moving: it only changes with
+  // the lock held exclusively, so the IRP cannot miss the change it waits for.
+  ExAcquireResourceSharedLite(&dokanGlobal->MountPointListLock, TRUE);
+  if (irpSp->Parameters.FileSystemControl.InputBufferLength < sizeof(ULONG) ||
+      *generation != dokanGlobal->MountPointListGeneration) {
+    *generation = dokanGlobal->MountPointListGeneration;
+    RequestContext->Irp->IoStatus.Information = sizeof(ULONG);
+    status = STATUS_SUCCESS;
+  } else {
+    status = RegisterPendingIrpMain(RequestContext, /*EventContext=*/NULL,
+                                    &dokanGlobal->MountPointListWaiters,
+                                    /*CheckMount=*/FALSE,
+                                    /*CurrentStatus=*/STATUS_SUCCESS);
+  }
+  ExReleaseResourceLite(&dokanGlobal->MountPointListLock);
+  return status;
+}
+
 NTSTATUS
 DokanCreateGlobalDiskDevice(__in PDRIVER_OBJECT DriverObject,
                             __out PDOKAN_GLOBAL *DokanGlobal) {
@@ -735,6 +848,12 @@ DokanCreateGlobalDiskDevice(__in PDRIVER_OBJECT DriverObject,
   dokanGlobal->DriverVersion = DOKAN_DRIVER_VERSION;
 
   InitializeListHead(&dokanGlobal->MountPointList);
+  for (ULONG i = 0; i < DOKAN_MOUNT_ENTRY_TABLE_SIZE; ++i) {
+    InitializeListHead(&dokanGlobal->MountEntriesByDeviceName[i]);
+    InitializeListHead(&dokanGlobal->MountEntriesByMountPoint[i]);
+  }
+  DokanInitIrpList(&dokanGlobal->MountPointListWaiters,
+                   /*EventEnabled=*/FALSE);
   InitializeListHead(&dokanGlobal->DeviceDeleteList);
   ExInitializeResourceLite(&dokanGlobal->Resource);
   ExInitializeResourceLite(&dokanGlobal->MountPointListLock);
@@ -1077,11 +1196,35 @@ DokanCreateDiskDevice(__in PDRIVER_OBJECT DriverObject, __in ULONG MountId,
 
     // initialize Event and Event queue
     DokanInitIrpList(&dcb->PendingIrp, /*EventEnabled=*/FALSE);
-    DokanInitIrpList(&dcb->NotifyEvent, /*EventEnabled=*/TRUE);
+    for (ULONG i = 0; i < DOKAN_PENDING_IRP_TABLE_SIZE; ++i) {
+      InitializeListHead(&dcb->PendingIrpTable[i]);
+    }
+    for (ULONG i = 0; i < DOKAN_TIMEOUT_WHEEL_SIZE; ++i) {
+      InitializeListHead(&dcb->PendingIrpTimeoutWheel[i]);
+    }
+    dcb->NotifyQueueCount = min(
+        KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS),
+        DOKAN_NOTIFY_QUEUE_MAX_COUNT);
+    for (ULONG i = 0; i < dcb->NotifyQueueCount; ++i) {
+      for (ULONG lane = 0; lane < DOKAN_EVENT_LANE_COUNT; ++lane) {
+        DokanInitIrpList(&dcb->NotifyQueues[i].NotifyEvent[lane],
+                         /*EventEnabled=*/TRUE);
+      }
+    }
+    dcb->MetadataLaneWeight = DOKAN_METADATA_LANE_DEFAULT_WEIGHT;
+    dcb->MetadataLaneCredit = DOKAN_METADATA_LANE_DEFAULT_WEIGHT;
     DokanInitIrpList(&dcb->PendingRetryIrp, /*EventEnabled=*/TRUE);
+    DokanInitIrpList(&dcb->PendingPullIrp, /*EventEnabled=*/FALSE);
+    KeInitializeEvent(&dcb->PendingPullWakeEvent, SynchronizationEvent, FALSE);
     RtlZeroMemory(&dcb->NotifyIrpEventQueueList, sizeof(LIST_ENTRY));
     InitializeListHead(&dcb->NotifyIrpEventQueueList);
     KeInitializeQueue(&dcb->NotifyIrpEventQueue, 0);
+    KeInitializeSpinLock(&dcb->EventRingLock);
+    KeInitializeSpinLock(&dcb->CloseBatchLock);
+    KeInitializeTimerEx(&dcb->CloseBatchTimer, SynchronizationTimer);
+    InitializeListHead(&dcb->NotifyBatch);
+    KeInitializeSpinLock(&dcb->NotifyBatchLock);
+    KeInitializeTimerEx(&dcb->NotifyBatchTimer, SynchronizationTimer);
 
     KeInitializeEvent(&dcb->ReleaseEvent, NotificationEvent, FALSE);
     ExInitializeResourceLite(&dcb->Resource);
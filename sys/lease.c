@@ -0,0 +1,90 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokan.h"
+#include "util/fcb.h"
+#include "util/irp_buffer_helper.h"
+
+// Caching leases.
+//
+// A create reply can grant a lease on the file for up to
+// DOKAN_LEASE_MAX_DURATION, for content the file system knows will not change
+// behind the driver, e.g. read-mostly package caches. While it holds
+// DOKAN_LEASE_ATTRIBUTES, the file info and security caches of the file are
+// used beyond the cache timeouts of the mount. While it holds DOKAN_LEASE_DATA,
+// every non-cached read of the file fetches a read-ahead window, as if it were
+// sequential. The caches still have to be enabled on the mount, and are still
+// dropped by the changes made through the driver and the notifications of the
+// file system.
+//
+// The file system revokes a lease before it expires with FSCTL_BREAK_LEASE,
+// which also drops what the driver cached for the file.
+
+VOID DokanGrantLease(__in PREQUEST_CONTEXT RequestContext, __in PDokanFCB Fcb,
+                     __in ULONG Level, __in ULONG DurationMs) {
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+
+  Level &= DOKAN_LEASE_ATTRIBUTES | DOKAN_LEASE_DATA;
+  if (Level == 0 || DurationMs == 0) {
+    return;
+  }
+  DurationMs = min(DurationMs, DOKAN_LEASE_MAX_DURATION);
+  now = KeQueryPerformanceCounter(&frequency);
+  Fcb->Lease.Level = Level;
+  Fcb->Lease.ExpiryTime =
+      now.QuadPart + (LONGLONG)DurationMs * frequency.QuadPart / 1000;
+  DOKAN_LOG_FINE_IRP(RequestContext, "Lease %lu granted for %lu ms", Level,
+                     DurationMs);
+}
+
+BOOLEAN DokanHasLease(__in PDokanFCB Fcb, __in ULONG Level) {
+  return (Fcb->Lease.Level & Level) == Level &&
+         KeQueryPerformanceCounter(NULL).QuadPart < Fcb->Lease.ExpiryTime;
+}
+
+NTSTATUS DokanBreakLease(__in PREQUEST_CONTEXT RequestContext) {
+  PDOKAN_UNICODE_STRING_INTERMEDIATE fileName = NULL;
+  UNICODE_STRING name;
+  PDokanVCB vcb = RequestContext->Vcb;
+  PDokanFCB fcb;
+
+  GET_IRP_UNICODE_STRING_INTERMEDIATE_OR_RETURN(RequestContext->Irp, fileName);
+  name.Length = fileName->Length;
+  name.MaximumLength = fileName->Length;
+  name.Buffer = fileName->Buffer;
+  DOKAN_LOG_FINE_IRP(RequestContext, "FileName=\"%wZ\"", &name);
+
+  DokanVCBLockRO(vcb);
+  fcb = DokanFindFCB(vcb, &name);
+  if (fcb != NULL) {
+    DokanFCBLockRW(fcb);
+    fcb->Lease.Level = 0;
+    fcb->Lease.ExpiryTime = 0;
+    DokanFCBUnlock(fcb);
+    DokanInvalidateFileInfoCache(fcb);
+    DokanInvalidateSecurityCache(fcb);
+    DokanInvalidateReadAhead(fcb);
+  }
+  DokanVCBUnlock(vcb);
+  // Nothing is cached for a file without FCB.
+  return STATUS_SUCCESS;
+}
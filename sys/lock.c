@@ -108,6 +108,85 @@ DokanCommonLockControl(__in PREQUEST_CONTEXT RequestContext) {
   return status;
 }
 
+// Copies the parameters of the lock request to the event sent to user mode.
+static VOID FillLockContext(__in PREQUEST_CONTEXT RequestContext,
+                            __in PDokanFCB Fcb,
+                            __in PEVENT_CONTEXT EventContext) {
+  // copy file name to be locked
+  EventContext->Operation.Lock.FileNameLength = Fcb->FileName.Length;
+  RtlCopyMemory(EventContext->Operation.Lock.FileName, Fcb->FileName.Buffer,
+                Fcb->FileName.Length);
+
+  // parameters of Lock
+  EventContext->Operation.Lock.ByteOffset =
+      RequestContext->IrpSp->Parameters.LockControl.ByteOffset;
+  if (RequestContext->IrpSp->Parameters.LockControl.Length != NULL) {
+    EventContext->Operation.Lock.Length.QuadPart =
+        RequestContext->IrpSp->Parameters.LockControl.Length->QuadPart;
+  } else {
+    DOKAN_LOG_FINE_IRP(RequestContext, "LockControl.Length = NULL");
+  }
+  EventContext->Operation.Lock.Key =
+      RequestContext->IrpSp->Parameters.LockControl.Key;
+}
+
+// Returns whether the lock request conflicts with a lock held through another
+// handle, in which case DOKAN_EVENT_FILELOCK_HYBRID has user mode look at it
+// before the driver does.
+static BOOLEAN IsLockConflicting(__in PREQUEST_CONTEXT RequestContext,
+                                 __in PDokanFCB Fcb) {
+  PIO_STACK_LOCATION irpSp = RequestContext->IrpSp;
+  PEPROCESS process;
+
+  if (irpSp->MinorFunction != IRP_MN_LOCK ||
+      irpSp->Parameters.LockControl.Length == NULL) {
+    return FALSE;
+  }
+  process = IoGetRequestorProcess(RequestContext->Irp);
+  // An exclusive lock cannot overlap a range others may write, and a shared
+  // one a range others may read.
+  if (FlagOn(irpSp->Flags, SL_EXCLUSIVE_LOCK)) {
+    return !FsRtlFastCheckLockForWrite(
+        &Fcb->FileLock, &irpSp->Parameters.LockControl.ByteOffset,
+        irpSp->Parameters.LockControl.Length,
+        irpSp->Parameters.LockControl.Key, irpSp->FileObject, process);
+  }
+  return !FsRtlFastCheckLockForRead(
+      &Fcb->FileLock, &irpSp->Parameters.LockControl.ByteOffset,
+      irpSp->Parameters.LockControl.Length, irpSp->Parameters.LockControl.Key,
+      irpSp->FileObject, process);
+}
+
+// Grants or releases the lock with the FileLock of the FCB and, once it is
+// granted or released, tells user mode without waiting for it.
+static NTSTATUS ProcessLockInKernel(__in PREQUEST_CONTEXT RequestContext,
+                                    __in PDokanFCB Fcb) {
+  PEVENT_CONTEXT eventContext = NULL;
+  NTSTATUS status;
+
+  // Unlocking everything is not reported, as DispatchLock ignores it.
+  if (RequestContext->IrpSp->MinorFunction == IRP_MN_LOCK ||
+      RequestContext->IrpSp->MinorFunction == IRP_MN_UNLOCK_SINGLE) {
+    // Built before the IRP is handed to FsRtl, which completes it. The handle
+    // may be closed before the event is handled, so it only names the file.
+    eventContext = AllocateEventContext(
+        RequestContext, sizeof(EVENT_CONTEXT) + Fcb->FileName.Length, NULL);
+    if (eventContext != NULL) {
+      FillLockContext(RequestContext, Fcb, eventContext);
+      eventContext->Operation.Lock.Flags = DOKAN_LOCK_NOTIFICATION;
+    }
+  }
+  status = DokanCommonLockControl(RequestContext);
+  if (eventContext != NULL) {
+    if (status == STATUS_SUCCESS) {
+      DokanEventNotification(RequestContext, eventContext);
+    } else {
+      DokanFreeEventContext(eventContext);
+    }
+  }
+  return status;
+}
+
 NTSTATUS
 DokanDispatchLock(__in PREQUEST_CONTEXT RequestContext) {
   NTSTATUS status = STATUS_INVALID_PARAMETER;
@@ -135,7 +214,12 @@ DokanDispatchLock(__in PREQUEST_CONTEXT RequestContext) {
     DokanFCBLockRW(fcb);
 
     OplockDebugRecordMajorFunction(fcb, IRP_MJ_LOCK_CONTROL);
-    if (!RequestContext->Dcb->FileLockInUserMode) {
+    if (RequestContext->Dcb->FileLockHybrid) {
+      if (!IsLockConflicting(RequestContext, fcb)) {
+        status = ProcessLockInKernel(RequestContext, fcb);
+        __leave;
+      }
+    } else if (!RequestContext->Dcb->FileLockInUserMode) {
       status = DokanCommonLockControl(RequestContext);
       __leave;
     }
@@ -151,22 +235,7 @@ DokanDispatchLock(__in PREQUEST_CONTEXT RequestContext) {
     eventContext->Context = ccb->UserContext;
     DOKAN_LOG_FINE_IRP(RequestContext, "Get Context %X", (ULONG)ccb->UserContext);
 
-    // copy file name to be locked
-    eventContext->Operation.Lock.FileNameLength = fcb->FileName.Length;
-    RtlCopyMemory(eventContext->Operation.Lock.FileName, fcb->FileName.Buffer,
-                  fcb->FileName.Length);
-
-    // parameters of Lock
-    eventContext->Operation.Lock.ByteOffset =
-        RequestContext->IrpSp->Parameters.LockControl.ByteOffset;
-    if (RequestContext->IrpSp->Parameters.LockControl.Length != NULL) {
-      eventContext->Operation.Lock.Length.QuadPart =
-          RequestContext->IrpSp->Parameters.LockControl.Length->QuadPart;
-    } else {
-      DOKAN_LOG_FINE_IRP(RequestContext, "LockControl.Length = NULL");
-    }
-    eventContext->Operation.Lock.Key =
-        RequestContext->IrpSp->Parameters.LockControl.Key;
+    FillLockContext(RequestContext, fcb, eventContext);
 
     // register this IRP to waiting IRP list and make it pending status
     status = DokanRegisterPendingIrp(RequestContext, eventContext);
@@ -181,5 +250,21 @@ DokanDispatchLock(__in PREQUEST_CONTEXT RequestContext) {
 
 VOID DokanCompleteLock(__in PREQUEST_CONTEXT RequestContext,
                        __in PEVENT_INFORMATION EventInfo) {
-  RequestContext->Irp->IoStatus.Status = EventInfo->Status;
+  PDokanFCB fcb;
+  NTSTATUS status;
+
+  if (!RequestContext->Dcb->FileLockHybrid ||
+      EventInfo->Status != STATUS_SUCCESS) {
+    RequestContext->Irp->IoStatus.Status = EventInfo->Status;
+    return;
+  }
+  // User mode agreed to a lock that conflicts with one held on this machine.
+  // The FileLock of the FCB then fails it or has it wait as usual.
+  fcb = ((PDokanCCB)RequestContext->IrpSp->FileObject->FsContext2)->Fcb;
+  DokanFCBLockRW(fcb);
+  status = DokanCommonLockControl(RequestContext);
+  DokanFCBUnlock(fcb);
+  if (!RequestContext->DoNotComplete) {
+    RequestContext->Irp->IoStatus.Status = status;
+  }
 }
@@ -0,0 +1,232 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Negative lookup cache.
+//
+// Opens of existing files only (FILE_OPEN, FILE_OVERWRITE) that the file system
+// failed with STATUS_OBJECT_NAME_NOT_FOUND are remembered by path for
+// EVENT_START.NegativeCacheTimeoutMs, and the next ones are failed by
+// DokanDispatchCreate without going to user mode. Only that status is cached:
+// it means the parent directory exists, so the entry can only become wrong when
+// that very name is created, or when a directory holding it is renamed or
+// reported by the file system. Creating a name removes its entry and anything
+// else flushes the whole cache.
+//
+// A miss is only cached if nothing was removed from the cache since its request
+// arrived, since its answer may predate the change.
+
+typedef struct _DOKAN_NEGATIVE_CACHE_ENTRY {
+  // Link in DokanVCB.NegativeCacheList.
+  LIST_ENTRY ListEntry;
+  // KeQueryPerformanceCounter value of the arrival of the request that missed.
+  LONGLONG Time;
+  UNICODE_STRING FileName;
+} DOKAN_NEGATIVE_CACHE_ENTRY, *PDOKAN_NEGATIVE_CACHE_ENTRY;
+
+static RTL_GENERIC_COMPARE_RESULTS
+CompareNegativeCacheEntry(__in struct _RTL_AVL_TABLE* Table,
+                          __in PVOID FirstStruct, __in PVOID SecondStruct) {
+  PDokanVCB vcb = (PDokanVCB)Table->TableContext;
+  PDOKAN_NEGATIVE_CACHE_ENTRY first = *(PDOKAN_NEGATIVE_CACHE_ENTRY*)FirstStruct;
+  PDOKAN_NEGATIVE_CACHE_ENTRY second =
+      *(PDOKAN_NEGATIVE_CACHE_ENTRY*)SecondStruct;
+  LONG result = RtlCompareUnicodeString(
+      &first->FileName, &second->FileName,
+      !(vcb->Dcb->MountOptions & DOKAN_EVENT_CASE_SENSITIVE));
+  if (result < 0) {
+    return GenericLessThan;
+  } else if (result > 0) {
+    return GenericGreaterThan;
+  }
+  return GenericEqual;
+}
+
+static PVOID AllocateNegativeCacheAvl(__in struct _RTL_AVL_TABLE* Table,
+                                      __in CLONG ByteSize) {
+  UNREFERENCED_PARAMETER(Table);
+  return DokanAlloc(ByteSize);
+}
+
+static VOID FreeNegativeCacheAvl(__in struct _RTL_AVL_TABLE* Table,
+                                 __in PVOID Buffer) {
+  UNREFERENCED_PARAMETER(Table);
+  ExFreePool(Buffer);
+}
+
+VOID DokanInitNegativeCache(__in PDokanVCB Vcb) {
+  RtlInitializeGenericTableAvl(&Vcb->NegativeCacheTable,
+                               CompareNegativeCacheEntry,
+                               AllocateNegativeCacheAvl, FreeNegativeCacheAvl,
+                               Vcb);
+  InitializeListHead(&Vcb->NegativeCacheList);
+  ExInitializeFastMutex(&Vcb->NegativeCacheMutex);
+}
+
+// Removes Entry from the cache and frees it. Must be called with
+// NegativeCacheMutex held.
+static VOID DeleteNegativeCacheEntry(__in PDokanVCB Vcb,
+                                     __in PDOKAN_NEGATIVE_CACHE_ENTRY Entry) {
+  BOOLEAN removed =
+      RtlDeleteElementGenericTableAvl(&Vcb->NegativeCacheTable, &Entry);
+  ASSERT(removed);
+  UNREFERENCED_PARAMETER(removed);
+  RemoveEntryList(&Entry->ListEntry);
+  --Vcb->NegativeCacheCount;
+  ExFreePool(Entry);
+}
+
+// Frees all the entries. Must be called with NegativeCacheMutex held.
+static VOID DeleteAllNegativeCacheEntries(__in PDokanVCB Vcb) {
+  while (!IsListEmpty(&Vcb->NegativeCacheList)) {
+    DeleteNegativeCacheEntry(
+        Vcb, CONTAINING_RECORD(Vcb->NegativeCacheList.Flink,
+                               DOKAN_NEGATIVE_CACHE_ENTRY, ListEntry));
+  }
+}
+
+VOID DokanCleanupNegativeCache(__in PDokanVCB Vcb) {
+  ExAcquireFastMutex(&Vcb->NegativeCacheMutex);
+  DeleteAllNegativeCacheEntries(Vcb);
+  ExReleaseFastMutex(&Vcb->NegativeCacheMutex);
+}
+
+// Must be called with NegativeCacheMutex held.
+static PDOKAN_NEGATIVE_CACHE_ENTRY
+FindNegativeCacheEntry(__in PDokanVCB Vcb, __in PUNICODE_STRING FileName) {
+  DOKAN_NEGATIVE_CACHE_ENTRY key;
+  PDOKAN_NEGATIVE_CACHE_ENTRY keyPointer = &key;
+  PDOKAN_NEGATIVE_CACHE_ENTRY* entry;
+
+  key.FileName = *FileName;
+  entry = (PDOKAN_NEGATIVE_CACHE_ENTRY*)RtlLookupElementGenericTableAvl(
+      &Vcb->NegativeCacheTable, &keyPointer);
+  return entry != NULL ? *entry : NULL;
+}
+
+BOOLEAN DokanLookupNegativeCache(__in PDokanVCB Vcb,
+                                 __in PUNICODE_STRING FileName) {
+  ULONG timeoutMs = Vcb->Dcb->NegativeCacheTimeoutMs;
+  PDOKAN_NEGATIVE_CACHE_ENTRY entry;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+  BOOLEAN found = FALSE;
+
+  if (timeoutMs == 0 || Vcb->NegativeCacheCount == 0) {
+    return FALSE;
+  }
+  now = KeQueryPerformanceCounter(&frequency);
+  ExAcquireFastMutex(&Vcb->NegativeCacheMutex);
+  entry = FindNegativeCacheEntry(Vcb, FileName);
+  if (entry != NULL) {
+    if (now.QuadPart - entry->Time <
+        (LONGLONG)timeoutMs * frequency.QuadPart / 1000) {
+      found = TRUE;
+    } else {
+      DeleteNegativeCacheEntry(Vcb, entry);
+    }
+  }
+  ExReleaseFastMutex(&Vcb->NegativeCacheMutex);
+  return found;
+}
+
+VOID DokanAddNegativeCacheEntry(__in PREQUEST_CONTEXT RequestContext,
+                                __in PUNICODE_STRING FileName) {
+  PDokanVCB vcb = RequestContext->Vcb;
+  LONGLONG arrivalTime = RequestContext->ArrivalTime.QuadPart;
+  PDOKAN_NEGATIVE_CACHE_ENTRY entry;
+  BOOLEAN newElement = FALSE;
+
+  if (RequestContext->Dcb->NegativeCacheTimeoutMs == 0 || arrivalTime == 0 ||
+      FileName->Length == 0) {
+    return;
+  }
+  entry = DokanAlloc(sizeof(DOKAN_NEGATIVE_CACHE_ENTRY) + FileName->Length);
+  if (entry == NULL) {
+    return;
+  }
+  entry->Time = arrivalTime;
+  entry->FileName.Buffer = (PWCH)(entry + 1);
+  entry->FileName.Length = FileName->Length;
+  entry->FileName.MaximumLength = FileName->Length;
+  RtlCopyMemory(entry->FileName.Buffer, FileName->Buffer, FileName->Length);
+
+  ExAcquireFastMutex(&vcb->NegativeCacheMutex);
+  if (arrivalTime <= vcb->NegativeCacheInvalidatedTime) {
+    ExReleaseFastMutex(&vcb->NegativeCacheMutex);
+    ExFreePool(entry);
+    return;
+  }
+  PDOKAN_NEGATIVE_CACHE_ENTRY* entryInTable =
+      (PDOKAN_NEGATIVE_CACHE_ENTRY*)RtlInsertElementGenericTableAvl(
+          &vcb->NegativeCacheTable, &entry, sizeof(PDOKAN_NEGATIVE_CACHE_ENTRY),
+          &newElement);
+  if (entryInTable == NULL) {
+    ExReleaseFastMutex(&vcb->NegativeCacheMutex);
+    ExFreePool(entry);
+    return;
+  }
+  if (!newElement) {
+    // Refresh the existing entry and make it the newest.
+    ExFreePool(entry);
+    entry = *entryInTable;
+    if (arrivalTime > entry->Time) {
+      entry->Time = arrivalTime;
+    }
+    RemoveEntryList(&entry->ListEntry);
+    InsertTailList(&vcb->NegativeCacheList, &entry->ListEntry);
+  } else {
+    InsertTailList(&vcb->NegativeCacheList, &entry->ListEntry);
+    if (++vcb->NegativeCacheCount > DOKAN_NEGATIVE_CACHE_MAX_ENTRIES) {
+      DeleteNegativeCacheEntry(
+          vcb, CONTAINING_RECORD(vcb->NegativeCacheList.Flink,
+                                 DOKAN_NEGATIVE_CACHE_ENTRY, ListEntry));
+    }
+  }
+  ExReleaseFastMutex(&vcb->NegativeCacheMutex);
+  DOKAN_LOG_FINE_IRP(RequestContext, "Cached miss of \"%wZ\"", FileName);
+}
+
+VOID DokanRemoveNegativeCacheEntry(__in PDokanVCB Vcb,
+                                   __in PUNICODE_STRING FileName) {
+  PDOKAN_NEGATIVE_CACHE_ENTRY entry;
+
+  if (Vcb->Dcb->NegativeCacheTimeoutMs == 0) {
+    return;
+  }
+  ExAcquireFastMutex(&Vcb->NegativeCacheMutex);
+  Vcb->NegativeCacheInvalidatedTime = KeQueryPerformanceCounter(NULL).QuadPart;
+  entry = FindNegativeCacheEntry(Vcb, FileName);
+  if (entry != NULL) {
+    DeleteNegativeCacheEntry(Vcb, entry);
+  }
+  ExReleaseFastMutex(&Vcb->NegativeCacheMutex);
+}
+
+VOID DokanFlushNegativeCache(__in PDokanVCB Vcb) {
+  if (Vcb->Dcb->NegativeCacheTimeoutMs == 0) {
+    return;
+  }
+  ExAcquireFastMutex(&Vcb->NegativeCacheMutex);
+  Vcb->NegativeCacheInvalidatedTime = KeQueryPerformanceCounter(NULL).QuadPart;
+  DeleteAllNegativeCacheEntries(Vcb);
+  ExReleaseFastMutex(&Vcb->NegativeCacheMutex);
+}
@@ -26,25 +26,77 @@ DokanDispatchRead
   DokanRegisterPendingIrp
     # add IRP_MJ_READ to PendingIrp list
     RegisterPendingIrpMain(PendingIrp)
-    # put MJ_READ event into NotifyEvent
-    DokanEventNotification(NotifyEvent, EventContext)
+    # put MJ_READ event into the bulk lane of the NotifyQueues of the current
+    # processor
+    DokanEventNotification(EventContext)
 
 FSCTL_EVENT_PROCESS_N_PULL:
   DokanProcessAndPullEvents
     # Pull the previously registered event
-    PullEvents(NotifyEvent)
+    PullEvents(NotifyQueues)
 
 FSCTL_EVENT_PROCESS_N_PULL:
   DokanProcessAndPullEvents
     # Complete the IRP process by userland
     DokanCompleteIrp
     # Pull the new registered event
-    PullEvents(NotifyEvent)
+    PullEvents(NotifyQueues)
 */
 
 #include "dokan.h"
+#include "util/fcb.h"
 #include "util/irp_buffer_helper.h"
 
+// Largest DRIVER_EVENT_CONTEXT allocation of each size class. Event contexts
+// up to the largest one come from the lookaside list of their class, the
+// others straight from the pool.
+static const ULONG g_EventContextSizeClasses
+    [DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT] = {512, 1024 * 4, 1024 * 64};
+static LOOKASIDE_LIST_EX
+    g_EventContextLookasideLists[DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT];
+static LONG64 g_EventContextPoolAllocations;
+
+BOOLEAN DokanInitEventContextLookasideLists() {
+  for (ULONG i = 0; i < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT; ++i) {
+    if (!DokanLookasideCreate(&g_EventContextLookasideLists[i],
+                              g_EventContextSizeClasses[i])) {
+      while (i > 0) {
+        ExDeleteLookasideListEx(&g_EventContextLookasideLists[--i]);
+      }
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+VOID DokanDeleteEventContextLookasideLists() {
+  for (ULONG i = 0; i < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT; ++i) {
+    ExDeleteLookasideListEx(&g_EventContextLookasideLists[i]);
+  }
+}
+
+// Works with the GENERAL_LOOKASIDE and GENERAL_LOOKASIDE_POOL of both kinds
+// of lookaside lists.
+#define GET_LOOKASIDE_METRICS(Lookaside, Metrics)                              \
+  {                                                                            \
+    (Metrics)->Allocations = (Lookaside).TotalAllocates;                       \
+    (Metrics)->Hits =                                                          \
+        (Lookaside).TotalAllocates - (Lookaside).AllocateMisses;               \
+  }
+
+VOID DokanGetAllocationMetrics(__out PVOLUME_METRICS_EX Metrics) {
+  // The lookaside counters are updated without lock, which is good enough
+  // for metrics.
+  for (ULONG i = 0; i < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT; ++i) {
+    GET_LOOKASIDE_METRICS(g_EventContextLookasideLists[i].L,
+                          &Metrics->EventContextLookaside[i]);
+  }
+  Metrics->EventContextPoolAllocations =
+      InterlockedCompareExchange64(&g_EventContextPoolAllocations, 0, 0);
+  GET_LOOKASIDE_METRICS(DokanIrpEntryLookasideList.L,
+                        &Metrics->IrpEntryLookaside);
+}
+
 VOID SetCommonEventContext(__in PREQUEST_CONTEXT RequestContext,
                            __in PEVENT_CONTEXT EventContext,
                            __in_opt PDokanCCB Ccb) {
@@ -74,10 +126,26 @@ AllocateEventContextRaw(__in ULONG EventContextLength) {
 
   driverContextLength =
       EventContextLength - sizeof(EVENT_CONTEXT) + sizeof(DRIVER_EVENT_CONTEXT);
-  driverEventContext = DokanAllocZero(driverContextLength);
-  if (driverEventContext == NULL) {
-    return NULL;
+  ULONG sizeClass = 0;
+  while (sizeClass < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT &&
+         driverContextLength > g_EventContextSizeClasses[sizeClass]) {
+    ++sizeClass;
+  }
+  if (sizeClass < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT) {
+    driverEventContext =
+        ExAllocateFromLookasideListEx(&g_EventContextLookasideLists[sizeClass]);
+    if (driverEventContext == NULL) {
+      return NULL;
+    }
+    RtlZeroMemory(driverEventContext, driverContextLength);
+  } else {
+    driverEventContext = DokanAllocZero(driverContextLength);
+    if (driverEventContext == NULL) {
+      return NULL;
+    }
+    InterlockedIncrement64(&g_EventContextPoolAllocations);
   }
+  driverEventContext->SizeClass = sizeClass;
 
   InitializeListHead(&driverEventContext->ListEntry);
 
@@ -102,27 +170,80 @@ AllocateEventContext(__in PREQUEST_CONTEXT RequestContext,
 VOID DokanFreeEventContext(__in PEVENT_CONTEXT EventContext) {
   PDRIVER_EVENT_CONTEXT driverEventContext =
       CONTAINING_RECORD(EventContext, DRIVER_EVENT_CONTEXT, EventContext);
-  ExFreePool(driverEventContext);
+  if (driverEventContext->SizeClass < DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT) {
+    ExFreeToLookasideListEx(
+        &g_EventContextLookasideLists[driverEventContext->SizeClass],
+        driverEventContext);
+  } else {
+    ExFreePool(driverEventContext);
+  }
 }
 
-VOID DokanEventNotification(__in PREQUEST_CONTEXT RequestContext,
-                            __in PIRP_LIST NotifyEvent,
-                            __in PEVENT_CONTEXT EventContext) {
+// Wakes up a thread waiting in DokanProcessAndPullEvents, unless one has
+// already been woken up and has not started pulling yet.
+VOID DokanSignalNotifyEvent(__in PDokanDCB Dcb) {
+  if (InterlockedCompareExchange(&Dcb->NotifyIrpEventQueueSignaled, 1, 0) ==
+      0) {
+    KeInsertQueue(&Dcb->NotifyIrpEventQueue, &Dcb->NotifyIrpEventQueueList);
+  }
+}
+
+// Returns the notify queue lane of the event.
+static ULONG GetEventLane(__in PEVENT_CONTEXT EventContext) {
+  switch (EventContext->MajorFunction) {
+    case IRP_MJ_READ:
+    case IRP_MJ_WRITE:
+    case IRP_MJ_FLUSH_BUFFERS:
+      return DOKAN_EVENT_LANE_BULK;
+    default:
+      return DOKAN_EVENT_LANE_METADATA;
+  }
+}
+
+// Queues the event for the file system to pull, or posts it to the event ring.
+VOID DokanQueueEvent(__in PDokanDCB Dcb, __in PEVENT_CONTEXT EventContext) {
   PDRIVER_EVENT_CONTEXT driverEventContext =
       CONTAINING_RECORD(EventContext, DRIVER_EVENT_CONTEXT, EventContext);
+  PIRP_LIST notifyEvent;
+  BOOLEAN posted;
+  KIRQL oldIrql;
 
   InitializeListHead(&driverEventContext->ListEntry);
 
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
 
-  KIRQL oldIrql;
-  KeAcquireSpinLock(&NotifyEvent->ListLock, &oldIrql);
-  InsertTailList(&NotifyEvent->ListHead, &driverEventContext->ListEntry);
-  if (!KeReadStateQueue(&RequestContext->Dcb->NotifyIrpEventQueue)) {
-    KeInsertQueue(&RequestContext->Dcb->NotifyIrpEventQueue,
-                  &RequestContext->Dcb->NotifyIrpEventQueueList);
+  // Hand the event over through the shared ring when the DLL registered one
+  // and it has room; otherwise it is pulled by FSCTL_EVENT_PROCESS_N_PULL.
+  if (Dcb->EventRing != NULL) {
+    KeAcquireSpinLock(&Dcb->EventRingLock, &oldIrql);
+    posted = DokanEventRingPost(Dcb, EventContext);
+    KeReleaseSpinLock(&Dcb->EventRingLock, oldIrql);
+    if (posted) {
+      DokanFreeEventContext(EventContext);
+      return;
+    }
   }
-  KeReleaseSpinLock(&NotifyEvent->ListLock, oldIrql);
+
+  notifyEvent =
+      &Dcb->NotifyQueues[KeGetCurrentProcessorNumberEx(NULL) %
+                         Dcb->NotifyQueueCount]
+           .NotifyEvent[GetEventLane(EventContext)];
+  KeAcquireSpinLock(&notifyEvent->ListLock, &oldIrql);
+  InsertTailList(&notifyEvent->ListHead, &driverEventContext->ListEntry);
+  InterlockedIncrement(&Dcb->NotifyEventCount);
+  KeReleaseSpinLock(&notifyEvent->ListLock, oldIrql);
+  DokanSignalNotifyEvent(Dcb);
+  // The pended pulls are completed by the notification thread, as this can be
+  // reached with locks held that pulling takes. A pull pended after this racy
+  // peek checks NotifyEventCount itself.
+  if (!IsListEmpty(&Dcb->PendingPullIrp.ListHead)) {
+    KeSetEvent(&Dcb->PendingPullWakeEvent, IO_NO_INCREMENT, FALSE);
+  }
+}
+
+VOID DokanEventNotification(__in PREQUEST_CONTEXT RequestContext,
+                            __in PEVENT_CONTEXT EventContext) {
+  DokanQueueEvent(RequestContext->Dcb, EventContext);
 }
 
 // Moves the contents of the given Source list to Dest, discarding IRPs that
@@ -141,8 +262,9 @@ VOID MoveIrpList(__in PIRP_LIST Source, __out LIST_ENTRY* Dest) {
   KeAcquireSpinLock(&Source->ListLock, &oldIrql);
 
   while (!IsListEmpty(&Source->ListHead)) {
-    listHead = RemoveHeadList(&Source->ListHead);
+    listHead = Source->ListHead.Flink;
     irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
+    DokanRemoveIrpEntry(irpEntry);
     irp = irpEntry->RequestContext.Irp;
     if (irp == NULL) {
       // this IRP has already been canceled
@@ -153,7 +275,6 @@ VOID MoveIrpList(__in PIRP_LIST Source, __out LIST_ENTRY* Dest) {
 
     if (IoSetCancelRoutine(irp, NULL) == NULL) {
       // Cancel routine will run as soon as we release the lock
-      InitializeListHead(&irpEntry->ListEntry);
       irpEntry->CancelRoutineFreeMemory = TRUE;
       continue;
     }
@@ -164,40 +285,92 @@ VOID MoveIrpList(__in PIRP_LIST Source, __out LIST_ENTRY* Dest) {
   KeReleaseSpinLock(&Source->ListLock, oldIrql);
 }
 
-VOID ReleasePendingIrp(__in PIRP_LIST PendingIrp) {
+PIRP_ENTRY PopIrpList(__in PIRP_LIST Source) {
+  PIRP_ENTRY irpEntry;
+  PIRP_ENTRY found = NULL;
+  KIRQL oldIrql;
+  PIRP irp;
+
+  ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+  KeAcquireSpinLock(&Source->ListLock, &oldIrql);
+
+  while (found == NULL && !IsListEmpty(&Source->ListHead)) {
+    irpEntry = CONTAINING_RECORD(Source->ListHead.Flink, IRP_ENTRY, ListEntry);
+    DokanRemoveIrpEntry(irpEntry);
+    irp = irpEntry->RequestContext.Irp;
+    if (irp == NULL) {
+      // this IRP has already been canceled
+      ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
+      DokanFreeIrpEntry(irpEntry);
+      continue;
+    }
+
+    if (IoSetCancelRoutine(irp, NULL) == NULL) {
+      // Cancel routine will run as soon as we release the lock
+      irpEntry->CancelRoutineFreeMemory = TRUE;
+      continue;
+    }
+    found = irpEntry;
+  }
+
+  if (IsListEmpty(&Source->ListHead)) {
+    KeClearEvent(&Source->NotEmpty);
+  }
+  KeReleaseSpinLock(&Source->ListLock, oldIrql);
+  return found;
+}
+
+// Cancels the IRPs of all the given lists in one pass. They are all taken out
+// of their lists before any is completed, so that none of them is retried or
+// timed out while the others are being completed.
+static VOID ReleasePendingIrpLists(__in PIRP_LIST PendingIrpLists[],
+                                   __in ULONG Count) {
   PLIST_ENTRY listHead;
   LIST_ENTRY completeList;
+  LIST_ENTRY movedList;
   PIRP_ENTRY irpEntry;
   PIRP irp;
 
-  MoveIrpList(PendingIrp, &completeList);
+  InitializeListHead(&completeList);
+  for (ULONG i = 0; i < Count; ++i) {
+    MoveIrpList(PendingIrpLists[i], &movedList);
+    if (!IsListEmpty(&movedList)) {
+      AppendTailList(&completeList, &movedList);
+      RemoveEntryList(&movedList);
+    }
+  }
   while (!IsListEmpty(&completeList)) {
     listHead = RemoveHeadList(&completeList);
     irpEntry = CONTAINING_RECORD(listHead, IRP_ENTRY, ListEntry);
     irp = irpEntry->RequestContext.Irp;
-    DokanFreeIrpEntry(irpEntry);
     irp->IoStatus.Information = 0;
-    DokanCompleteIrpRequest(irp, STATUS_CANCELLED);
+    DokanCompleteMappedIrpRequest(&irpEntry->RequestContext, STATUS_CANCELLED);
+    DokanFreeIrpEntry(irpEntry);
   }
 }
 
-VOID ReleaseNotifyEvent(__in PIRP_LIST NotifyEvent) {
+VOID ReleaseNotifyEvent(__in PDokanDCB Dcb) {
   PDRIVER_EVENT_CONTEXT driverEventContext;
+  PIRP_LIST notifyEvent;
   PLIST_ENTRY listHead;
   KIRQL oldIrql;
 
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
-  KeAcquireSpinLock(&NotifyEvent->ListLock, &oldIrql);
-
-  while (!IsListEmpty(&NotifyEvent->ListHead)) {
-    listHead = RemoveHeadList(&NotifyEvent->ListHead);
-    driverEventContext =
-        CONTAINING_RECORD(listHead, DRIVER_EVENT_CONTEXT, ListEntry);
-    ExFreePool(driverEventContext);
+  for (ULONG i = 0; i < Dcb->NotifyQueueCount; ++i) {
+    for (ULONG lane = 0; lane < DOKAN_EVENT_LANE_COUNT; ++lane) {
+      notifyEvent = &Dcb->NotifyQueues[i].NotifyEvent[lane];
+      KeAcquireSpinLock(&notifyEvent->ListLock, &oldIrql);
+      while (!IsListEmpty(&notifyEvent->ListHead)) {
+        listHead = RemoveHeadList(&notifyEvent->ListHead);
+        driverEventContext =
+            CONTAINING_RECORD(listHead, DRIVER_EVENT_CONTEXT, ListEntry);
+        DokanFreeEventContext(&driverEventContext->EventContext);
+        InterlockedDecrement(&Dcb->NotifyEventCount);
+      }
+      KeClearEvent(&notifyEvent->NotEmpty);
+      KeReleaseSpinLock(&notifyEvent->ListLock, oldIrql);
+    }
   }
-
-  KeClearEvent(&NotifyEvent->NotEmpty);
-  KeReleaseSpinLock(&NotifyEvent->ListLock, oldIrql);
 }
 
 VOID RetryIrps(__in PIRP_LIST PendingRetryIrp) {
@@ -220,7 +393,7 @@ VOID RetryIrps(__in PIRP_LIST PendingRetryIrp) {
 
 KSTART_ROUTINE NotificationThread;
 VOID NotificationThread(__in PVOID pDcb) {
-  PKEVENT events[2];
+  PVOID events[5];
   PKWAIT_BLOCK waitBlock;
   NTSTATUS status;
   PDokanDCB Dcb = pDcb;
@@ -234,11 +407,20 @@ VOID NotificationThread(__in PVOID pDcb) {
   }
   events[0] = &Dcb->ReleaseEvent;
   events[1] = &Dcb->PendingRetryIrp.NotEmpty;
+  events[2] = &Dcb->PendingPullWakeEvent;
+  events[3] = &Dcb->CloseBatchTimer;
+  events[4] = &Dcb->NotifyBatchTimer;
   do {
-    status = KeWaitForMultipleObjects(2, events, WaitAny, Executive, KernelMode,
+    status = KeWaitForMultipleObjects(5, events, WaitAny, Executive, KernelMode,
                                       FALSE, NULL, waitBlock);
     if (status == STATUS_WAIT_1) {
       RetryIrps(&Dcb->PendingRetryIrp);
+    } else if (status == STATUS_WAIT_2) {
+      DokanCompletePendingPulls(Dcb);
+    } else if (status == STATUS_WAIT_3) {
+      DokanFlushCloseBatch(Dcb);
+    } else if (status == STATUS_WAIT_4) {
+      DokanFlushNotificationBatch(Dcb);
     }
   } while (status != STATUS_WAIT_0);
 
@@ -293,19 +475,52 @@ VOID DokanCleanupAllChangeNotificationWaiters(__in PDokanVCB Vcb) {
   DokanVCBUnlock(Vcb);
 }
 
-VOID DokanStopFcbGarbageCollectorThread(__in PDokanVCB Vcb) {
+// Tells the timeout, notification and FCB garbage collector threads of the
+// volume to stop, without waiting, so that they wind down while the queues are
+// drained. See WaitForVolumeThreads.
+static VOID SignalVolumeThreadsToStop(__in PDokanDCB Dcb) {
+  KeSetEvent(&Dcb->KillEvent, 0, FALSE);
+  KeSetEvent(&Dcb->ReleaseEvent, 0, FALSE);
+}
+
+// Waits for the threads told to stop by SignalVolumeThreadsToStop, all at
+// once rather than one after the other.
+static VOID WaitForVolumeThreads(__in PDokanDCB Dcb, __in PDokanVCB Vcb) {
+  PKTHREAD* threads[3];
+  PVOID waitObjects[3];
+  ULONG count = 0;
+
+  ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+  if (Dcb->TimeoutThread != NULL) {
+    threads[count++] = &Dcb->TimeoutThread;
+  }
+  if (Dcb->EventNotificationThread != NULL) {
+    threads[count++] = &Dcb->EventNotificationThread;
+  }
   if (Vcb->FcbGarbageCollectorThread != NULL) {
-    KeWaitForSingleObject(Vcb->FcbGarbageCollectorThread, Executive, KernelMode,
-                          FALSE, NULL);
-    ObDereferenceObject(Vcb->FcbGarbageCollectorThread);
-    Vcb->FcbGarbageCollectorThread = NULL;
+    threads[count++] = &Vcb->FcbGarbageCollectorThread;
   }
+  if (count == 0) {
+    return;
+  }
+  for (ULONG i = 0; i < count; ++i) {
+    waitObjects[i] = *threads[i];
+  }
+  // At most THREAD_WAIT_OBJECTS, which need no wait block array.
+  KeWaitForMultipleObjects(count, waitObjects, WaitAll, Executive, KernelMode,
+                           FALSE, NULL, NULL);
+  for (ULONG i = 0; i < count; ++i) {
+    ObDereferenceObject(*threads[i]);
+    *threads[i] = NULL;
+  }
+  DOKAN_LOG_("%lu threads terminated", count);
 }
 
 NTSTATUS DokanEventRelease(__in_opt PREQUEST_CONTEXT RequestContext,
                            __in PDEVICE_OBJECT DeviceObject) {
   PDokanDCB dcb;
   PDokanVCB vcb;
+  PIRP_LIST pendingIrpLists[3];
   NTSTATUS status = STATUS_SUCCESS;
   DOKAN_INIT_LOGGER(logger,
                     DeviceObject == NULL ? NULL
@@ -353,22 +568,28 @@ NTSTATUS DokanEventRelease(__in_opt PREQUEST_CONTEXT RequestContext,
   DokanLogInfo(&logger, L"Starting unmount for device \"%wZ\"",
                         dcb->DiskDeviceName);
 
-  ReleasePendingIrp(&dcb->PendingIrp);
-  ReleasePendingIrp(&dcb->PendingRetryIrp);
-  ReleaseNotifyEvent(&dcb->NotifyEvent);
-  DokanStopCheckThread(dcb);
-  DokanStopEventNotificationThread(dcb);
+  // The threads stop while the queues are drained. Note that the garbage
+  // collector thread stops on the ReleaseEvent of the notification thread.
+  SignalVolumeThreadsToStop(dcb);
+  pendingIrpLists[0] = &dcb->PendingIrp;
+  pendingIrpLists[1] = &dcb->PendingRetryIrp;
+  pendingIrpLists[2] = &dcb->PendingPullIrp;
+  ReleasePendingIrpLists(pendingIrpLists, ARRAYSIZE(pendingIrpLists));
+  ReleaseNotifyEvent(dcb);
+  DokanEventRingRelease(dcb, NULL);
+  WaitForVolumeThreads(dcb, vcb);
+  // The writes fail now, but their buffers give back the file objects.
+  DokanCheckWriteBehindTimeout(dcb, /*Force=*/TRUE);
+  DokanFreeCloseBatch(dcb);
+  DokanFreeNotificationBatch(dcb);
   KeRundownQueue(&dcb->NotifyIrpEventQueue);
-
-  // Note that the garbage collector thread also gets signalled to stop by
-  // DokanStopEventNotificationThread. TODO(drivefs-team): maybe seperate out
-  // the signal to stop.
-  DokanStopFcbGarbageCollectorThread(vcb);
   ClearLongFlag(vcb->Flags, VCB_MOUNTED);
+  DokanReleaseFcbGarbage(vcb);
 
   if (vcb->FCBAvlNodeLookasideListInit) {
     ExDeleteLookasideListEx(&vcb->FCBAvlNodeLookasideList);
   }
+  DokanCleanupNegativeCache(vcb);
   DokanCleanupAllChangeNotificationWaiters(vcb);
   IoReleaseRemoveLockAndWait(&dcb->RemoveLock, RequestContext);
 
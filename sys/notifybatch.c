@@ -0,0 +1,196 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Coalesced delivery of the change notifications of the file system.
+//
+// With DOKAN_EVENT_COALESCE_NOTIFICATIONS set, the notifications sent with
+// FSCTL_NOTIFY_PATH(_BATCH) are not reported to the directory change waiters
+// as they arrive. They are held for DOKAN_NOTIFY_BATCH_DELAY after the first
+// one and reported together by the notification thread, so that a watcher
+// wakes once for a burst of changes. A modification of a name that was already
+// modified in the window, with nothing else reported for that name since, only
+// adds its filter to the held one. When more than
+// DOKAN_NOTIFY_BATCH_MAX_ENTRIES are held, they are all dropped and the waits
+// are ended instead, which makes the watchers list their directories again.
+//
+// Only the reports are held: the caches of the volume are still invalidated
+// when the notification is received.
+
+typedef struct _DOKAN_NOTIFY_BATCH_ENTRY {
+  LIST_ENTRY ListEntry;
+  ULONG CompletionFilter;
+  ULONG Action;
+  UNICODE_STRING FileName;
+  WCHAR Buffer[1];
+} DOKAN_NOTIFY_BATCH_ENTRY, *PDOKAN_NOTIFY_BATCH_ENTRY;
+
+static VOID FreeNotificationList(__in PLIST_ENTRY ListHead) {
+  PLIST_ENTRY listEntry;
+
+  while (!IsListEmpty(ListHead)) {
+    listEntry = RemoveHeadList(ListHead);
+    ExFreePool(
+        CONTAINING_RECORD(listEntry, DOKAN_NOTIFY_BATCH_ENTRY, ListEntry));
+  }
+}
+
+// Finds the last held notification for the name. Called with NotifyBatchLock.
+static PDOKAN_NOTIFY_BATCH_ENTRY
+FindLastNotification(__in PDokanDCB Dcb, __in PUNICODE_STRING FileName) {
+  PLIST_ENTRY listEntry;
+  PDOKAN_NOTIFY_BATCH_ENTRY entry;
+
+  for (listEntry = Dcb->NotifyBatch.Blink; listEntry != &Dcb->NotifyBatch;
+       listEntry = listEntry->Blink) {
+    entry = CONTAINING_RECORD(listEntry, DOKAN_NOTIFY_BATCH_ENTRY, ListEntry);
+    if (entry->FileName.Length == FileName->Length &&
+        RtlEqualMemory(entry->Buffer, FileName->Buffer, FileName->Length)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+BOOLEAN DokanBatchNotification(__in PDokanDCB Dcb,
+                               __in PUNICODE_STRING FileName,
+                               __in ULONG CompletionFilter, __in ULONG Action) {
+  PDOKAN_NOTIFY_BATCH_ENTRY newEntry;
+  PDOKAN_NOTIFY_BATCH_ENTRY lastEntry;
+  LIST_ENTRY dropped;
+  LARGE_INTEGER dueTime;
+  KIRQL oldIrql;
+
+  if (!Dcb->CoalesceNotifications || Dcb->Vcb == NULL ||
+      IsUnmountPendingVcb((PDokanVCB)Dcb->Vcb)) {
+    return FALSE;
+  }
+  // Allocated before taking the lock; freed below if it is not needed.
+  newEntry = DokanAlloc(
+      FIELD_OFFSET(DOKAN_NOTIFY_BATCH_ENTRY, Buffer[0]) + FileName->Length);
+  if (newEntry == NULL) {
+    return FALSE;
+  }
+  newEntry->CompletionFilter = CompletionFilter;
+  newEntry->Action = Action;
+  newEntry->FileName.Length = FileName->Length;
+  newEntry->FileName.MaximumLength = FileName->Length;
+  newEntry->FileName.Buffer = newEntry->Buffer;
+  RtlCopyMemory(newEntry->Buffer, FileName->Buffer, FileName->Length);
+
+  InitializeListHead(&dropped);
+  KeAcquireSpinLock(&Dcb->NotifyBatchLock, &oldIrql);
+  if (Dcb->NotifyBatchOverflow) {
+    // The watchers rescan anyway.
+    InsertTailList(&dropped, &newEntry->ListEntry);
+  } else {
+    lastEntry = Action == FILE_ACTION_MODIFIED
+                    ? FindLastNotification(Dcb, FileName)
+                    : NULL;
+    if (lastEntry != NULL && lastEntry->Action == FILE_ACTION_MODIFIED) {
+      lastEntry->CompletionFilter |= CompletionFilter;
+      InsertTailList(&dropped, &newEntry->ListEntry);
+    } else if (Dcb->NotifyBatchCount >= DOKAN_NOTIFY_BATCH_MAX_ENTRIES) {
+      AppendTailList(&dropped, &Dcb->NotifyBatch);
+      RemoveEntryList(&Dcb->NotifyBatch);
+      InitializeListHead(&Dcb->NotifyBatch);
+      InsertTailList(&dropped, &newEntry->ListEntry);
+      Dcb->NotifyBatchCount = 0;
+      Dcb->NotifyBatchOverflow = TRUE;
+    } else {
+      if (IsListEmpty(&Dcb->NotifyBatch)) {
+        dueTime.QuadPart = -(LONGLONG)DOKAN_NOTIFY_BATCH_DELAY * 10000;
+        KeSetTimer(&Dcb->NotifyBatchTimer, dueTime, NULL);
+      }
+      InsertTailList(&Dcb->NotifyBatch, &newEntry->ListEntry);
+      ++Dcb->NotifyBatchCount;
+    }
+  }
+  KeReleaseSpinLock(&Dcb->NotifyBatchLock, oldIrql);
+
+  FreeNotificationList(&dropped);
+  return TRUE;
+}
+
+VOID DokanFlushNotificationBatch(__in PDokanDCB Dcb) {
+  PDokanVCB vcb = Dcb->Vcb;
+  PDOKAN_NOTIFY_BATCH_ENTRY entry;
+  PLIST_ENTRY listEntry;
+  LIST_ENTRY batch;
+  BOOLEAN overflow;
+  BOOLEAN nameInvalid = FALSE;
+  ULONG count = 0;
+  KIRQL oldIrql;
+
+  InitializeListHead(&batch);
+  KeAcquireSpinLock(&Dcb->NotifyBatchLock, &oldIrql);
+  if (!IsListEmpty(&Dcb->NotifyBatch)) {
+    AppendTailList(&batch, &Dcb->NotifyBatch);
+    RemoveEntryList(&Dcb->NotifyBatch);
+    InitializeListHead(&Dcb->NotifyBatch);
+  }
+  Dcb->NotifyBatchCount = 0;
+  overflow = Dcb->NotifyBatchOverflow;
+  Dcb->NotifyBatchOverflow = FALSE;
+  KeReleaseSpinLock(&Dcb->NotifyBatchLock, oldIrql);
+
+  if (vcb == NULL || IsUnmountPendingVcb(vcb)) {
+    FreeNotificationList(&batch);
+    return;
+  }
+  if (overflow) {
+    DokanCleanupAllChangeNotificationWaiters(vcb);
+    FreeNotificationList(&batch);
+    return;
+  }
+  for (listEntry = batch.Flink; listEntry != &batch;
+       listEntry = listEntry->Flink) {
+    entry = CONTAINING_RECORD(listEntry, DOKAN_NOTIFY_BATCH_ENTRY, ListEntry);
+    if (DokanNotifyVolumeChange(vcb, &entry->FileName, entry->CompletionFilter,
+                                entry->Action) == STATUS_OBJECT_NAME_INVALID) {
+      nameInvalid = TRUE;
+    }
+    ++count;
+  }
+  FreeNotificationList(&batch);
+  DOKAN_LOG_("Reported %lu held notifications", count);
+  if (nameInvalid) {
+    DokanCleanupAllChangeNotificationWaiters(vcb);
+  }
+}
+
+VOID DokanFreeNotificationBatch(__in PDokanDCB Dcb) {
+  LIST_ENTRY batch;
+  KIRQL oldIrql;
+
+  KeCancelTimer(&Dcb->NotifyBatchTimer);
+  InitializeListHead(&batch);
+  KeAcquireSpinLock(&Dcb->NotifyBatchLock, &oldIrql);
+  if (!IsListEmpty(&Dcb->NotifyBatch)) {
+    AppendTailList(&batch, &Dcb->NotifyBatch);
+    RemoveEntryList(&Dcb->NotifyBatch);
+    InitializeListHead(&Dcb->NotifyBatch);
+  }
+  Dcb->NotifyBatchCount = 0;
+  Dcb->NotifyBatchOverflow = FALSE;
+  KeReleaseSpinLock(&Dcb->NotifyBatchLock, oldIrql);
+  FreeNotificationList(&batch);
+}
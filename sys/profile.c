@@ -0,0 +1,154 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "dokan.h"
+
+// Sampled profile of the load of a volume.
+//
+// With EVENT_START.ProfileSampleRate set, one in that many requests answered
+// by the file system is sampled by DokanRecordOperationMetrics: its process,
+// the name of its file, its major function and its latency. The
+// DOKAN_PROFILE_TOP_COUNT processes and files sampled the most are kept in
+// VCB.Profile with the Space-Saving algorithm: a key that is not there takes
+// over the least sampled entry and inherits its count as error. Any key
+// sampled more than Samples / DOKAN_PROFILE_TOP_COUNT times is thus kept,
+// with a bounded memory and a bounded cost per sample.
+// FSCTL_GET_VOLUME_PROFILE returns them.
+
+// Whether Entry is the process, or the file when FileName is given.
+static BOOLEAN IsSameProfileKey(__in PDOKAN_PROFILE_ENTRY Entry,
+                                __in ULONG ProcessId,
+                                __in_opt PUNICODE_STRING FileName) {
+  if (FileName == NULL) {
+    return Entry->ProcessId == ProcessId;
+  }
+  return Entry->FileNameLength == FileName->Length &&
+         RtlEqualMemory(Entry->FileName, FileName->Buffer, FileName->Length);
+}
+
+// Counts a sample in the DOKAN_PROFILE_TOP_COUNT Entries. Called with
+// ProfileLock.
+static VOID CountProfileSample(__in PDOKAN_PROFILE_ENTRY Entries,
+                               __in ULONG ProcessId,
+                               __in_opt PUNICODE_STRING FileName,
+                               __in UCHAR MajorFunction,
+                               __in ULONG64 Latency) {
+  PDOKAN_PROFILE_ENTRY entry = NULL;
+  PDOKAN_PROFILE_ENTRY leastSampled = &Entries[0];
+  ULONG i;
+
+  // The entries are used in order, so the first unused one ends the search.
+  for (i = 0; i < DOKAN_PROFILE_TOP_COUNT; ++i) {
+    if (Entries[i].Samples == 0 ||
+        IsSameProfileKey(&Entries[i], ProcessId, FileName)) {
+      entry = &Entries[i];
+      break;
+    }
+    if (Entries[i].Samples < leastSampled->Samples) {
+      leastSampled = &Entries[i];
+    }
+  }
+  if (entry == NULL) {
+    entry = leastSampled;
+    entry->Error = entry->Samples;
+    entry->TotalLatency = 0;
+    entry->MajorFunctions = 0;
+    entry->FileNameLength = 0;
+  }
+  if (entry->Samples == entry->Error && FileName != NULL) {
+    // New in the entry.
+    entry->FileNameLength = FileName->Length;
+    RtlCopyMemory(entry->FileName, FileName->Buffer, FileName->Length);
+  }
+  entry->ProcessId = ProcessId;
+  ++entry->Samples;
+  entry->TotalLatency += Latency;
+  entry->MajorFunctions |= 1 << MajorFunction;
+}
+
+VOID DokanProfileRequest(__in PDokanVCB Vcb,
+                         __in PREQUEST_CONTEXT RequestContext,
+                         __in ULONG64 Latency) {
+  ULONG sampleRate = Vcb->Dcb->ProfileSampleRate;
+  PFILE_OBJECT fileObject = RequestContext->IrpSp->FileObject;
+  PDokanCCB ccb;
+  PDokanFCB fcb;
+  WCHAR nameBuffer[DOKAN_PROFILE_NAME_LENGTH];
+  UNICODE_STRING fileName;
+  KIRQL oldIrql;
+
+  if (sampleRate == 0 ||
+      (ULONG)InterlockedIncrement(&Vcb->ProfileCounter) % sampleRate != 0) {
+    return;
+  }
+  fileName.Length = 0;
+  fileName.MaximumLength = sizeof(nameBuffer);
+  fileName.Buffer = nameBuffer;
+  // Requests of the disk device, like FSCTL_ECHO, have no file of the volume.
+  if (RequestContext->DeviceObject == Vcb->DeviceObject && fileObject != NULL &&
+      fileObject->FsContext2 != NULL &&
+      GetIdentifierType(fileObject->FsContext2) == CCB) {
+    ccb = fileObject->FsContext2;
+    fcb = ccb->Fcb;
+    DokanFCBLockRO(fcb);
+    fileName.Length = min(fcb->FileName.Length, fileName.MaximumLength);
+    RtlCopyMemory(nameBuffer, fcb->FileName.Buffer, fileName.Length);
+    DokanFCBUnlock(fcb);
+  }
+
+  KeAcquireSpinLock(&Vcb->ProfileLock, &oldIrql);
+  ++Vcb->Profile.Samples;
+  CountProfileSample(Vcb->Profile.Processes, RequestContext->ProcessId, NULL,
+                     RequestContext->IrpSp->MajorFunction, Latency);
+  if (fileName.Length > 0) {
+    CountProfileSample(Vcb->Profile.Files, RequestContext->ProcessId,
+                       &fileName, RequestContext->IrpSp->MajorFunction,
+                       Latency);
+  }
+  KeReleaseSpinLock(&Vcb->ProfileLock, oldIrql);
+}
+
+NTSTATUS DokanGetVolumeProfile(__in PREQUEST_CONTEXT RequestContext) {
+  PDokanVCB vcb = RequestContext->Vcb;
+  PDOKAN_VOLUME_PROFILE profile = NULL;
+  PULONG flags = NULL;
+  BOOLEAN reset = FALSE;
+  KIRQL oldIrql;
+
+  // The flags are optional.
+  if (RequestContext->IrpSp->Parameters.FileSystemControl.InputBufferLength >=
+      sizeof(ULONG)) {
+    GET_IRP_BUFFER_OR_RETURN(RequestContext->Irp, flags);
+    reset = (*flags & DOKAN_PROFILE_RESET) != 0;
+  }
+  if (!PREPARE_OUTPUT(RequestContext->Irp, profile,
+                      /*SetInformationOnFailure=*/TRUE)) {
+    return STATUS_BUFFER_TOO_SMALL;
+  }
+  KeAcquireSpinLock(&vcb->ProfileLock, &oldIrql);
+  *profile = vcb->Profile;
+  if (reset) {
+    RtlZeroMemory(&vcb->Profile, sizeof(vcb->Profile));
+  }
+  KeReleaseSpinLock(&vcb->ProfileLock, oldIrql);
+  profile->SampleRate = vcb->Dcb->ProfileSampleRate;
+  return STATUS_SUCCESS;
+}
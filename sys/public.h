@@ -28,7 +28,9 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include <minwindef.h>
 #endif
 
-#define DOKAN_DRIVER_VERSION 0x0000190
+// Changes with the layout of the structures shared by the driver and the
+// library, which refuse to work together when their versions differ.
+#define DOKAN_DRIVER_VERSION 0x0000191
 
 #define EVENT_CONTEXT_MAX_SIZE (1024 * 32)
 // This is arbitrary. There isn't really an absolute max, but we marshal it in
@@ -79,6 +81,88 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define FSCTL_EVENT_PROCESS_N_PULL                                                     \
   CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x812, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+// DeviceIoControl code to share an event ring with the targeted volume. See
+// EVENT_RING_REGISTER.
+#define FSCTL_EVENT_RING_REGISTER                                              \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x813, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to make the driver process the replies posted in the
+// completion ring of the targeted volume.
+#define FSCTL_EVENT_RING_DOORBELL                                              \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x814, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to retrieve the VOLUME_METRICS_EX struct for the
+// targeted volume.
+#define FSCTL_GET_VOLUME_METRICS_EX                                            \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x815, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to replace or drop an answer to volume information
+// queries cached by the targeted volume. See DOKAN_VOLUME_INFO_UPDATE.
+#define FSCTL_UPDATE_VOLUME_INFO                                               \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x816, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to break the lease of a file of the targeted volume.
+// The input is a DOKAN_UNICODE_STRING_INTERMEDIATE holding the file name.
+#define FSCTL_BREAK_LEASE                                                      \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x817, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to read the driver log ring of the global device.
+// The input is a LONGLONG holding the Time of the last DOKAN_LOG_RECORD
+// already read, or 0. The output is an array of the following
+// DOKAN_LOG_RECORD, from the oldest to the newest.
+#define FSCTL_GET_DRIVER_LOGS                                                  \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x818, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to send many path notifications at once. The input is
+// a chain of DOKAN_NOTIFY_PATH_BATCH_ENTRY.
+#define FSCTL_NOTIFY_PATH_BATCH                                                \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x819, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to wait for a change of the mount point list of the
+// global device. The input is the ULONG generation of the list known by the
+// caller, or nothing to query the current one. The IOCTL completes once the
+// generation differs from the input, with the current generation as output.
+#define FSCTL_MOUNTPOINT_LIST_CHANGE                                           \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x81A, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to pull the events of the targeted volume without
+// blocking the calling thread. There is no input; results are still sent with
+// FSCTL_EVENT_PROCESS_N_PULL. When no event is waiting, the IOCTL is pended
+// until one arrives, so that it can be issued overlapped. It completes with
+// nothing pulled if another pull took the event first.
+#define FSCTL_EVENT_PULL_ASYNC                                                 \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x81B, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to give all the requests pending in user mode for the
+// targeted volume at least the input ULONG timeout, in milliseconds, like
+// FSCTL_RESET_TIMEOUT does for a single one.
+#define FSCTL_RESET_ALL_TIMEOUTS                                               \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x81C, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to tell the targeted volume, mounted with
+// DOKAN_EVENT_HEARTBEAT_TIMEOUT, that the file system is alive. There is no
+// input.
+#define FSCTL_HEARTBEAT                                                        \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x81D, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to hand data of a file of the targeted volume to the
+// driver before it is read. The input is a DOKAN_HYDRATE_RANGE.
+#define FSCTL_HYDRATE_RANGE                                                    \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x81E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to measure the round trip of events between the driver
+// and the file system process of the targeted volume, without calling the
+// file system. The input and output are a DOKAN_ECHO.
+#define FSCTL_ECHO                                                             \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x81F, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// DeviceIoControl code to get the processes and the files that were sampled
+// the most on the targeted volume, mounted with EVENT_START.ProfileSampleRate.
+// The optional input is a ULONG of DOKAN_PROFILE_* flags and the output is a
+// DOKAN_VOLUME_PROFILE.
+#define FSCTL_GET_VOLUME_PROFILE                                               \
+  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x820, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
 #define DRIVER_FUNC_INSTALL 0x01
 #define DRIVER_FUNC_REMOVE 0x02
 
@@ -103,6 +187,26 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define DOKAN_WRITE_TO_END_OF_FILE 128
 #define DOKAN_NOCACHE 256
 #define DOKAN_RETRY_CREATE 512
+// Only in EVENT_CONTEXT.FileFlags of reads: the handle reads the file
+// sequentially, so what follows the read is likely to be read next.
+#define DOKAN_SEQUENTIAL_READ 4096
+// The cleanup of the handle was completed without waiting for user mode, with
+// DOKAN_EVENT_ASYNC_CLEANUP. Its cleanup event expects no reply and can be
+// handled after the close of the handle.
+#define DOKAN_ASYNC_CLEANUP 8192
+
+// Lease levels a create reply can grant in EVENT_INFORMATION.Operation.Create.
+// The attributes and security descriptor of the file are then cached beyond
+// the cache timeouts of the mount, and its data is read ahead of every reader.
+#define DOKAN_LEASE_ATTRIBUTES 1
+#define DOKAN_LEASE_DATA 2
+
+// Cache hints a create reply can give for the opened handle in
+// EVENT_INFORMATION.Operation.Create.
+#define DOKAN_CACHE_HINT_SEQUENTIAL 1
+#define DOKAN_CACHE_HINT_RANDOM 2
+#define DOKAN_CACHE_HINT_TEMPORARY 4
+#define DOKAN_CACHE_HINT_NO_READ_AHEAD 8
 #define DOKAN_EVER_USED_IN_NOTIFY_LIST 1024
 #define DOKAN_FILE_CHANGE_LAST_WRITE 2048
 
@@ -131,6 +235,18 @@ typedef struct _DOKAN_UNICODE_STRING_INTERMEDIATE {
   WCHAR Buffer[1];
 } DOKAN_UNICODE_STRING_INTERMEDIATE, *PDOKAN_UNICODE_STRING_INTERMEDIATE;
 
+// Input of FSCTL_HYDRATE_RANGE: DataLength bytes of the file FileName from
+// ByteOffset, stored at DataOffset from the start of the structure.
+typedef struct _DOKAN_HYDRATE_RANGE {
+  LARGE_INTEGER ByteOffset;
+  ULONG DataOffset;
+  ULONG DataLength;
+  // Whether the data ends at the end of the file.
+  BOOLEAN EndOfFile;
+  USHORT FileNameLength;
+  WCHAR FileName[1];
+} DOKAN_HYDRATE_RANGE, *PDOKAN_HYDRATE_RANGE;
+
 /*
  * This structure is used for sending notify path information from the user mode
  * driver to the kernel mode driver. See below links for parameter details for
@@ -145,6 +261,21 @@ typedef struct _DOKAN_NOTIFY_PATH_INTERMEDIATE {
   WCHAR Buffer[1];
 } DOKAN_NOTIFY_PATH_INTERMEDIATE, *PDOKAN_NOTIFY_PATH_INTERMEDIATE;
 
+// Notification of FSCTL_NOTIFY_PATH_BATCH, with the fields of
+// DOKAN_NOTIFY_PATH_INTERMEDIATE. NextEntryOffset is the offset in bytes of the
+// next entry from the start of this one, a multiple of 8, or 0 for the last
+// entry.
+typedef struct _DOKAN_NOTIFY_PATH_BATCH_ENTRY {
+  ULONG NextEntryOffset;
+  ULONG CompletionFilter;
+  ULONG Action;
+  USHORT Length;
+  WCHAR Buffer[1];
+} DOKAN_NOTIFY_PATH_BATCH_ENTRY, *PDOKAN_NOTIFY_PATH_BATCH_ENTRY;
+
+// Largest input accepted by FSCTL_NOTIFY_PATH_BATCH.
+#define DOKAN_NOTIFY_PATH_BATCH_MAX_SIZE (1024 * 1024)
+
 /*
  * This structure is used for copying ACCESS_STATE from the kernel mode driver
  * into the user mode driver.
@@ -212,9 +343,37 @@ typedef struct _CREATE_CONTEXT {
 
   // Offset from the beginning of this structure to the string
   ULONG FileNameOffset;
+
+  // Authentication and token ids of the requestor token, zero if unknown. A
+  // token id is never reused, so what was derived from a token can be
+  // reused for the requests carrying the same id.
+  LUID AuthenticationId;
+  LUID TokenId;
+
+  // DOKAN_CREATE_* flags
+  ULONG Flags;
 } CREATE_CONTEXT, *PCREATE_CONTEXT;
 
+// The driver checked the access asked by the open against the security
+// descriptor it cached for the file and the requestor was granted all of it,
+// so the file system does not have to authorize it again.
+#define DOKAN_CREATE_ACCESS_CHECKED 1
+
+// File times and attributes set through FileBasicInformation and held by the
+// driver with DOKAN_EVENT_DEFER_BASIC_INFO, merged in the order they were set.
+// Zero fields are left unchanged, as in FILE_BASIC_INFORMATION. Count is the
+// number of sets merged, 0 when there is nothing to apply.
+typedef struct _DOKAN_DEFERRED_BASIC_INFO {
+  LARGE_INTEGER CreationTime;
+  LARGE_INTEGER LastAccessTime;
+  LARGE_INTEGER LastWriteTime;
+  LARGE_INTEGER ChangeTime;
+  ULONG FileAttributes;
+  ULONG Count;
+} DOKAN_DEFERRED_BASIC_INFO, *PDOKAN_DEFERRED_BASIC_INFO;
+
 typedef struct _CLEANUP_CONTEXT {
+  DOKAN_DEFERRED_BASIC_INFO DeferredBasicInfo;
   ULONG FileNameLength;
   WCHAR FileName[1];
 
@@ -241,6 +400,10 @@ typedef struct _DIRECTORY_CONTEXT {
 typedef struct _READ_CONTEXT {
   LARGE_INTEGER ByteOffset;
   ULONG BufferLength;
+  // Address of the caller's buffer in the file system process when the driver
+  // mapped it there (see DOKAN_EVENT_ZERO_COPY_READ), 0 otherwise. When set,
+  // the data has to be read into it and the reply only carries the length.
+  ULONG64 MappedBuffer;
   ULONG FileNameLength;
   WCHAR FileName[1];
 } READ_CONTEXT, *PREAD_CONTEXT;
@@ -250,6 +413,10 @@ typedef struct _WRITE_CONTEXT {
   ULONG BufferLength;
   ULONG BufferOffset;
   ULONG RequestLength;
+  // Address of the caller's buffer in the file system process when the driver
+  // mapped it there (see DOKAN_EVENT_ZERO_COPY_WRITE), 0 otherwise. When set,
+  // the data is read from it and nothing follows the file name.
+  ULONG64 MappedBuffer;
   ULONG FileNameLength;
   WCHAR FileName[2];
   // "2" means to keep last null of contents to write
@@ -275,15 +442,21 @@ typedef struct _VOLUME_CONTEXT {
   ULONG BufferLength;
 } VOLUME_CONTEXT, *PVOLUME_CONTEXT;
 
+// LOCK_CONTEXT.Flags of a lock or unlock already done by the driver, with
+// DOKAN_EVENT_FILELOCK_HYBRID. No reply is expected.
+#define DOKAN_LOCK_NOTIFICATION 1
+
 typedef struct _LOCK_CONTEXT {
   LARGE_INTEGER ByteOffset;
   LARGE_INTEGER Length;
   ULONG Key;
+  ULONG Flags;
   ULONG FileNameLength;
   WCHAR FileName[1];
 } LOCK_CONTEXT, *PLOCK_CONTEXT;
 
 typedef struct _FLUSH_CONTEXT {
+  DOKAN_DEFERRED_BASIC_INFO DeferredBasicInfo;
   ULONG FileNameLength;
   WCHAR FileName[1];
 } FLUSH_CONTEXT, *PFLUSH_CONTEXT;
@@ -308,6 +481,36 @@ typedef struct _SET_SECURITY_CONTEXT {
   WCHAR FileName[1];
 } SET_SECURITY_CONTEXT, *PSET_SECURITY_CONTEXT;
 
+// The requests sent with IRP_MJ_FILE_SYSTEM_CONTROL and IRP_MN_USER_FS_REQUEST
+// have a context starting with their control code, which tells them apart.
+
+// FSCTL_DUPLICATE_EXTENTS_TO_FILE. The file of the request is the target.
+typedef struct _COPY_RANGE_CONTEXT {
+  ULONG FsControlCode;
+  LARGE_INTEGER SourceOffset;
+  LARGE_INTEGER TargetOffset;
+  LARGE_INTEGER Length;
+  ULONG SourceFileNameLength;
+  // Offset from the beginning of this structure to the source file name
+  ULONG SourceFileNameOffset;
+  ULONG FileNameLength;
+  WCHAR FileName[1];
+} COPY_RANGE_CONTEXT, *PCOPY_RANGE_CONTEXT;
+
+// FSCTL_SET_SPARSE, FSCTL_SET_ZERO_DATA and FSCTL_QUERY_ALLOCATED_RANGES.
+typedef struct _SPARSE_CONTEXT {
+  ULONG FsControlCode;
+  // FSCTL_SET_SPARSE: whether the file is made sparse or not
+  BOOLEAN SetSparse;
+  // Range to zero or to query
+  LARGE_INTEGER Offset;
+  LARGE_INTEGER Length;
+  // FSCTL_QUERY_ALLOCATED_RANGES: room for the ranges in the reply, in bytes
+  ULONG BufferLength;
+  ULONG FileNameLength;
+  WCHAR FileName[1];
+} SPARSE_CONTEXT, *PSPARSE_CONTEXT;
+
 typedef struct _EVENT_CONTEXT {
   ULONG Length;
   ULONG MountId;
@@ -333,6 +536,10 @@ typedef struct _EVENT_CONTEXT {
     UNMOUNT_CONTEXT Unmount;
     SECURITY_CONTEXT Security;
     SET_SECURITY_CONTEXT SetSecurity;
+    // First member of the IRP_MJ_FILE_SYSTEM_CONTROL contexts
+    ULONG FsControlCode;
+    COPY_RANGE_CONTEXT CopyRange;
+    SPARSE_CONTEXT Sparse;
   } Operation;
 } EVENT_CONTEXT, *PEVENT_CONTEXT;
 
@@ -351,12 +558,183 @@ typedef struct _VOLUME_METRICS {
   ULONG64 LargeIRPRegistrationCanceled;
 } VOLUME_METRICS, *PVOLUME_METRICS;
 
+// Number of latency buckets of DOKAN_OPERATION_METRICS. Bucket 0 counts the
+// requests that took less than 1 microsecond and bucket i the ones that took
+// [2^(i-1), 2^i) microseconds. The last bucket also counts anything longer.
+#define DOKAN_LATENCY_BUCKET_COUNT 32
+
+// Number of DOKAN_OPERATION_METRICS in VOLUME_METRICS_EX, indexed by IRP major
+// function (IRP_MJ_MAXIMUM_FUNCTION + 1).
+#define DOKAN_METRICS_MAJOR_FUNCTION_COUNT 28
+
+// Metrics of the requests of one IRP major function that were answered by the
+// file system. The latencies are measured from the arrival of the IRP in the
+// driver.
+typedef struct _DOKAN_OPERATION_METRICS {
+  // Number of requests answered.
+  ULONG64 Requests;
+  // Total number of bytes reported as transferred by the answers.
+  ULONG64 Bytes;
+  // Time spent waiting in the driver for the file system to pull the request.
+  // Requests handed over through an event ring are not counted here; for them
+  // the time spent in the ring is part of the user mode latency.
+  ULONG64 QueuedLatency[DOKAN_LATENCY_BUCKET_COUNT];
+  // Time from the request being pulled by the file system to its answer.
+  ULONG64 UserModeLatency[DOKAN_LATENCY_BUCKET_COUNT];
+  // Time from the arrival of the IRP to the answer.
+  ULONG64 TotalLatency[DOKAN_LATENCY_BUCKET_COUNT];
+} DOKAN_OPERATION_METRICS, *PDOKAN_OPERATION_METRICS;
+
+// Most events sent by a single FSCTL_ECHO.
+#define DOKAN_ECHO_MAX_EVENT_COUNT (1024 * 1024)
+
+// Input and output of FSCTL_ECHO. The events are sent one at a time and their
+// round trip is measured from being queued to being answered, in
+// microseconds.
+typedef struct _DOKAN_ECHO {
+  // Number of DOKAN_IRP_ECHO events to send, at most
+  // DOKAN_ECHO_MAX_EVENT_COUNT.
+  ULONG EventCount;
+  // Number of events answered. Less than EventCount if an event failed.
+  ULONG AnsweredCount;
+  ULONG64 MinLatency;
+  ULONG64 MaxLatency;
+  ULONG64 TotalLatency;
+  // Round trips per DOKAN_LATENCY_BUCKET_COUNT bucket.
+  ULONG64 Latency[DOKAN_LATENCY_BUCKET_COUNT];
+} DOKAN_ECHO, *PDOKAN_ECHO;
+
+// Number of processes, and of files, kept by the profile of a volume.
+#define DOKAN_PROFILE_TOP_COUNT 16
+// Longest file name kept by the profile of a volume, in WCHARs. Longer names
+// are truncated.
+#define DOKAN_PROFILE_NAME_LENGTH 128
+
+// FSCTL_GET_VOLUME_PROFILE flag to clear the profile once it is returned.
+#define DOKAN_PROFILE_RESET 1
+
+// Process or file of DOKAN_VOLUME_PROFILE.
+typedef struct _DOKAN_PROFILE_ENTRY {
+  // Samples counted for the entry. An entry replacing the least sampled one
+  // inherits its count, so this is an upper bound of the real count.
+  ULONG64 Samples;
+  // Part of Samples inherited from the replaced entry. Samples - Error is a
+  // lower bound of the real count.
+  ULONG64 Error;
+  // Latency of the samples, from the arrival of the IRP to the answer, in
+  // microseconds.
+  ULONG64 TotalLatency;
+  // 1 << IRP_MJ_* of the major functions sampled.
+  ULONG MajorFunctions;
+  // Requesting process, or for a file the last process that was sampled on it.
+  ULONG ProcessId;
+  // Length of FileName in bytes, 0 for a process.
+  USHORT FileNameLength;
+  WCHAR FileName[DOKAN_PROFILE_NAME_LENGTH];
+} DOKAN_PROFILE_ENTRY, *PDOKAN_PROFILE_ENTRY;
+
+// Output of FSCTL_GET_VOLUME_PROFILE. The entries are not sorted; the unused
+// ones have no samples.
+typedef struct _DOKAN_VOLUME_PROFILE {
+  // EVENT_START.ProfileSampleRate of the volume, 0 if it is not profiled.
+  ULONG SampleRate;
+  // Number of requests sampled.
+  ULONG64 Samples;
+  DOKAN_PROFILE_ENTRY Processes[DOKAN_PROFILE_TOP_COUNT];
+  DOKAN_PROFILE_ENTRY Files[DOKAN_PROFILE_TOP_COUNT];
+} DOKAN_VOLUME_PROFILE, *PDOKAN_VOLUME_PROFILE;
+
+// Metrics of the FCBs kept for reuse after their last handle was closed, when
+// FCB garbage collection is enabled.
+typedef struct _DOKAN_FCB_CACHE_METRICS {
+  // Opens that found their FCB kept for reuse.
+  ULONG64 Hits;
+  // Opens that allocated a new FCB.
+  ULONG64 Misses;
+  // FCBs deleted before their time to stay under the memory limit.
+  ULONG64 Evictions;
+  // FCBs kept for reuse now, and the memory they take.
+  ULONG64 Count;
+  ULONG64 Bytes;
+} DOKAN_FCB_CACHE_METRICS, *PDOKAN_FCB_CACHE_METRICS;
+
+// Number of size classes of the event contexts allocated by the driver, see
+// VOLUME_METRICS_EX.EventContextLookaside.
+#define DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT 3
+
+// Allocations from a lookaside list of the driver.
+typedef struct _DOKAN_LOOKASIDE_METRICS {
+  ULONG64 Allocations;
+  // Allocations served from the list without going to the pool.
+  ULONG64 Hits;
+} DOKAN_LOOKASIDE_METRICS, *PDOKAN_LOOKASIDE_METRICS;
+
+// Version 2 added FcbCache, version 3 the allocation metrics, version 4
+// QueuedEvents.
+#define DOKAN_VOLUME_METRICS_EX_VERSION 4
+
+// The output from FSCTL_GET_VOLUME_METRICS_EX. New versions of the struct only
+// add fields at the end. The driver fills as much of it as the output buffer
+// holds, so callers must check Version and Length before reading past them.
+typedef struct _VOLUME_METRICS_EX {
+  // DOKAN_VOLUME_METRICS_EX_VERSION of the driver.
+  ULONG Version;
+  // Number of bytes of the struct filled by the driver.
+  ULONG Length;
+  VOLUME_METRICS Volume;
+  // Number of entries of Operations and of their latency arrays.
+  ULONG MajorFunctionCount;
+  ULONG LatencyBucketCount;
+  DOKAN_OPERATION_METRICS Operations[DOKAN_METRICS_MAJOR_FUNCTION_COUNT];
+  DOKAN_FCB_CACHE_METRICS FcbCache;
+  // Driver wide, shared by all the volumes. The event contexts of up to 512B,
+  // 4KB and 64KB come from one lookaside list each, and the larger ones from
+  // the pool.
+  DOKAN_LOOKASIDE_METRICS EventContextLookaside
+      [DOKAN_EVENT_CONTEXT_SIZE_CLASS_COUNT];
+  ULONG64 EventContextPoolAllocations;
+  DOKAN_LOOKASIDE_METRICS IrpEntryLookaside;
+  // Events waiting in the driver for the file system to pull them.
+  ULONG64 QueuedEvents;
+} VOLUME_METRICS_EX, *PVOLUME_METRICS_EX;
+
+// Largest answer to a volume information query that the driver caches.
+#define DOKAN_VOLUME_INFO_CACHE_MAX_SIZE 512
+
+// The input of FSCTL_UPDATE_VOLUME_INFO. Buffer holds the Length bytes of the
+// answer to the FsInformationClass query, as the file system would return it.
+// A Length of 0 drops the cached answer so that the next query goes to the
+// file system again.
+typedef struct _DOKAN_VOLUME_INFO_UPDATE {
+  ULONG FsInformationClass;
+  ULONG Length;
+  UCHAR Buffer[1];
+} DOKAN_VOLUME_INFO_UPDATE, *PDOKAN_VOLUME_INFO_UPDATE;
+
 #define WRITE_MAX_SIZE                                                         \
   (EVENT_CONTEXT_MAX_SIZE - sizeof(EVENT_CONTEXT) - 256 * sizeof(WCHAR))
 
 #define DOKAN_EVENT_INFO_MIN_BUFFER_SIZE 8
 #define DOKAN_EVENT_INFO_DEFAULT_BUFFER_SIZE (1024 * 4)
 
+// Attributes of the opened file that a successful create reply can carry in its
+// Buffer, with a BufferLength of sizeof(DOKAN_CREATE_FILE_INFO), so that the
+// first attribute queries of the file do not have to go to the file system.
+// It can be followed by the first InlineDataLength bytes of the file, which
+// then answer its first reads.
+typedef struct _DOKAN_CREATE_FILE_INFO {
+  LARGE_INTEGER CreationTime;
+  LARGE_INTEGER LastAccessTime;
+  LARGE_INTEGER LastWriteTime;
+  LARGE_INTEGER ChangeTime;
+  LARGE_INTEGER AllocationSize;
+  LARGE_INTEGER EndOfFile;
+  ULONG FileAttributes;
+  ULONG NumberOfLinks;
+  ULONG InlineDataLength;
+  ULONG Reserved;
+} DOKAN_CREATE_FILE_INFO, *PDOKAN_CREATE_FILE_INFO;
+
 typedef struct _EVENT_INFORMATION {
   ULONG SerialNumber;
   NTSTATUS Status;
@@ -368,6 +746,14 @@ typedef struct _EVENT_INFORMATION {
     struct {
       ULONG Flags;
       ULONG Information;
+      // DOKAN_LEASE_* granted on the file for LeaseDurationMs. 0 leaves the
+      // current lease of the file as it is.
+      ULONG LeaseLevel;
+      ULONG LeaseDurationMs;
+      // DOKAN_CACHE_HINT_* of the handle, and the read-ahead window of its
+      // sequential reads. 0 keeps EVENT_START.ReadAheadWindowSize.
+      ULONG CacheHints;
+      ULONG ReadAheadGranularity;
     } Create;
     struct {
       LARGE_INTEGER CurrentByteOffset;
@@ -420,6 +806,25 @@ typedef struct _EVENT_INFORMATION {
 #define DOKAN_EVENT_DISPATCH_DRIVER_LOGS                            (1 << 8)
 #define DOKAN_EVENT_ALLOW_IPC_BATCHING                              (1 << 9)
 #define DOKAN_EVENT_DRIVE_LETTER_IN_USE                             (1 << 10)
+#define DOKAN_EVENT_ZERO_COPY_READ                                  (1 << 11)
+#define DOKAN_EVENT_ZERO_COPY_WRITE                                 (1 << 12)
+#define DOKAN_EVENT_BATCH_CLOSE                                     (1 << 13)
+#define DOKAN_EVENT_DEFER_BASIC_INFO                                (1 << 14)
+#define DOKAN_EVENT_KERNEL_ACCESS_CHECK                             (1 << 15)
+// Only time out requests once no FSCTL_HEARTBEAT was received for IrpTimeout.
+#define DOKAN_EVENT_HEARTBEAT_TIMEOUT                               (1 << 16)
+// Writes are durable once the file system completed them, so flushes without
+// deferred changes are completed by the driver.
+#define DOKAN_EVENT_WRITE_THROUGH                                   (1 << 17)
+// Hold the notifications sent with FSCTL_NOTIFY_PATH(_BATCH) briefly to merge
+// repeated modifications and report them together.
+#define DOKAN_EVENT_COALESCE_NOTIFICATIONS                          (1 << 18)
+// Grant the locks that conflict with no other in the driver and tell user mode
+// afterwards. Only conflicting locks wait for user mode.
+#define DOKAN_EVENT_FILELOCK_HYBRID                                 (1 << 19)
+// Complete the cleanups that do not delete the file, release locks or end the
+// last write access to it without waiting for user mode.
+#define DOKAN_EVENT_ASYNC_CLEANUP                                   (1 << 20)
 
 // Non-exclusive bits that can be set in EVENT_DRIVER_INFO.Flags for the driver
 // to send back extra info about what happened during a mount attempt, whether
@@ -471,8 +876,115 @@ typedef struct _EVENT_START {
   ULONG FcbGarbageCollectionIntervalMs;
   ULONG VolumeSecurityDescriptorLength;
   CHAR VolumeSecurityDescriptor[VOLUME_SECURITY_DESCRIPTOR_MAX_SIZE];
+  // Number of metadata requests pulled for each bulk data request (read, write
+  // and flush) when both are waiting. 0 selects the driver default.
+  ULONG MetadataLaneWeight;
+  // How long in milliseconds the driver answers basic, standard and network
+  // open information queries with the attributes last returned by the file
+  // system. 0 disables the cache.
+  ULONG FileInfoCacheTimeoutMs;
+  // How long in milliseconds opens of existing files that the file system
+  // answered with STATUS_OBJECT_NAME_NOT_FOUND are failed by the driver without
+  // asking it again. 0 disables the cache.
+  ULONG NegativeCacheTimeoutMs;
+  // How long in milliseconds the answers of the file system to volume, size and
+  // attribute information queries are reused by the driver. 0 disables it.
+  ULONG VolumeInfoCacheTimeoutMs;
+  // How long in milliseconds the driver answers security queries of a file
+  // with the descriptor last returned by the file system. 0 disables the cache.
+  ULONG SecurityCacheTimeoutMs;
+  // How many bytes past a non-cached read are asked of the file system once a
+  // handle reads sequentially, to answer its next reads locally. 0 disables it.
+  ULONG ReadAheadWindowSize;
+  // Most bytes the read-ahead windows of the volume can hold together. 0
+  // selects the driver default.
+  ULONG ReadAheadMemoryLimit;
+  // Size of the per handle buffer coalescing small sequential non-cached
+  // writes before they are sent to the file system. 0 disables it.
+  ULONG WriteBehindMaxSize;
+  // Longest time in milliseconds a write is held back. 0 selects the driver
+  // default.
+  ULONG WriteBehindTimeoutMs;
+  // Most bytes the FCBs kept for reuse by the garbage collector can take
+  // before the least recently used ones are deleted. 0 selects the driver
+  // default.
+  ULONG FcbCacheMemoryLimit;
+  // Sector size of the volume, reported by its disk device. 0 selects
+  // DOKAN_DEFAULT_SECTOR_SIZE.
+  ULONG SectorSize;
+  // Largest transfer advertised by the disk device of the volume. 0 selects
+  // the driver default.
+  ULONG MaxTransferSize;
+  // Step by which the allocation of a growing file is extended when it is set
+  // past what the file system was last asked for. The allocation sets within
+  // it are then completed by the driver. 0 disables it.
+  ULONG AllocationStepSize;
+  // One in how many requests answered by the file system is sampled for
+  // FSCTL_GET_VOLUME_PROFILE. 0 disables the profile.
+  ULONG ProfileSampleRate;
 } EVENT_START, *PEVENT_START;
 
+// Shared event ring.
+//
+// The DLL can share with the driver a memory region holding two rings of fixed
+// size slots: the submission ring, where the driver posts the EVENT_CONTEXTs
+// that fit in a slot, and the completion ring, where the DLL posts the
+// EVENT_INFORMATIONs that fit in a slot. Both rings are bounded MPMC queues: a
+// slot is free for position P when its Sequence is P, and filled when it is
+// P + 1. Consuming it sets Sequence to P + SlotCount.
+//
+// Anything that does not fit in a slot, or that arrives while the ring is full,
+// keeps going through FSCTL_EVENT_PROCESS_N_PULL.
+
+// Size of a slot, including its EVENT_RING_SLOT header. The EVENT_RING_HEADER
+// occupies the first slot of the region.
+#define EVENT_RING_SLOT_SIZE (1024 * 4)
+#define EVENT_RING_SLOT_DATA_SIZE                                              \
+  (EVENT_RING_SLOT_SIZE - FIELD_OFFSET(EVENT_RING_SLOT, Data))
+// Slot count of each ring: must be a power of two.
+#define EVENT_RING_DEFAULT_SLOT_COUNT 256
+#define EVENT_RING_MAX_SLOT_COUNT 4096
+#define EVENT_RING_SIZE(SlotCount)                                             \
+  (((SIZE_T)(SlotCount) * 2 + 1) * EVENT_RING_SLOT_SIZE)
+#define EVENT_RING_SUBMISSION_SLOT(Header, SlotCount, Position)                \
+  ((PEVENT_RING_SLOT)((PCHAR)(Header) +                                        \
+                      EVENT_RING_SLOT_SIZE *                                   \
+                          (1 + ((Position) & ((SlotCount) - 1)))))
+#define EVENT_RING_COMPLETION_SLOT(Header, SlotCount, Position)                \
+  ((PEVENT_RING_SLOT)((PCHAR)(Header) +                                        \
+                      EVENT_RING_SLOT_SIZE *                                   \
+                          (1 + (SlotCount) + ((Position) & ((SlotCount) - 1)))))
+
+typedef struct _EVENT_RING_SLOT {
+  volatile LONG Sequence;
+  ULONG Length;
+  ULONG64 Data[1];
+} EVENT_RING_SLOT, *PEVENT_RING_SLOT;
+
+typedef struct _EVENT_RING_HEADER {
+  // Next submission position to be consumed by the DLL.
+  volatile LONG SubmissionHead;
+  // Next completion position to be produced by the DLL.
+  volatile LONG CompletionTail;
+  // Set by the DLL before sending FSCTL_EVENT_RING_DOORBELL, cleared by the
+  // driver before it drains the completion ring. The DLL only needs to ring
+  // the doorbell when it changes it from 0 to 1.
+  volatile LONG CompletionDoorbell;
+} EVENT_RING_HEADER, *PEVENT_RING_HEADER;
+
+// Input of FSCTL_EVENT_RING_REGISTER. The region must be page aligned and
+// EVENT_RING_SIZE(SlotCount) bytes long, with all the slot sequences
+// initialized. The ring is released when the handle used to register it is
+// closed.
+typedef struct _EVENT_RING_REGISTER {
+  // Address of the region in the calling process.
+  ULONG64 Address;
+  // Handle to an auto-reset event the driver signals when it posts a
+  // submission.
+  ULONG64 SubmissionEvent;
+  ULONG SlotCount;
+} EVENT_RING_REGISTER, *PEVENT_RING_REGISTER;
+
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4201)
@@ -515,6 +1027,9 @@ typedef struct _DOKAN_MOUNT_POINT_INFO {
 // Dokan Major IRP values dispatched to userland for custom request with
 // EVENT_CONTEXT.
 #define DOKAN_IRP_LOG_MESSAGE 0x20
+#define DOKAN_IRP_CLOSE_BATCH 0x21
+// Event of FSCTL_ECHO, answered by the library without calling the file system.
+#define DOKAN_IRP_ECHO 0x22
 
 // Driver log message disptached during DOKAN_IRP_LOG_MESSAGE event.
 typedef struct _DOKAN_LOG_MESSAGE {
@@ -522,4 +1037,40 @@ typedef struct _DOKAN_LOG_MESSAGE {
   CHAR Message[1];
 } DOKAN_LOG_MESSAGE, *PDOKAN_LOG_MESSAGE;
 
+// Close of one handle in a DOKAN_CLOSE_BATCH, as it would have been sent in
+// the CLOSE_CONTEXT of its own IRP_MJ_CLOSE event.
+typedef struct _DOKAN_CLOSE_BATCH_ENTRY {
+  ULONG64 Context;
+  ULONG FileFlags;
+  // Offset of the next entry from the start of this one.
+  ULONG NextEntryOffset;
+  ULONG FileNameLength;
+  // Null terminated.
+  WCHAR FileName[1];
+} DOKAN_CLOSE_BATCH_ENTRY, *PDOKAN_CLOSE_BATCH_ENTRY;
+
+// Closes dispatched together during DOKAN_IRP_CLOSE_BATCH event when
+// DOKAN_EVENT_BATCH_CLOSE is set. The entries are 8-byte aligned.
+typedef struct _DOKAN_CLOSE_BATCH {
+  ULONG EntryCount;
+  ULONG Reserved;
+  DOKAN_CLOSE_BATCH_ENTRY Entries[1];
+} DOKAN_CLOSE_BATCH, *PDOKAN_CLOSE_BATCH;
+
+#define DOKAN_LOG_RECORD_MESSAGE_SIZE 488
+
+// Driver log message returned by FSCTL_GET_DRIVER_LOGS.
+typedef struct _DOKAN_LOG_RECORD {
+  // System time at which the message was logged.
+  LONGLONG Time;
+  // MountId of the volume that logged the message. Only meaningful when
+  // IsVolumeLog is set, which is not the case for global logs.
+  ULONG MountId;
+  USHORT IsVolumeLog;
+  // Processor on which the message was logged.
+  USHORT Processor;
+  ULONG MessageLength;
+  CHAR Message[DOKAN_LOG_RECORD_MESSAGE_SIZE];
+} DOKAN_LOG_RECORD, *PDOKAN_LOG_RECORD;
+
 #endif // PUBLIC_H_
@@ -22,6 +22,64 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokan.h"
 
+// Whether the read is an IRP_MN_MDL one, whose data is returned in a buffer of
+// the driver described by the MDL left in Irp->MdlAddress. The caller, e.g.
+// the SMB server, sends it from there and gives it back with IRP_MN_COMPLETE.
+static BOOLEAN IsMdlRead(__in PIO_STACK_LOCATION IrpSp) {
+  return FlagOn(IrpSp->MinorFunction, IRP_MN_MDL) &&
+         !FlagOn(IrpSp->MinorFunction, IRP_MN_COMPLETE);
+}
+
+// Allocates the buffer an IRP_MN_MDL read returns its data in.
+static NTSTATUS AllocateMdlReadBuffer(__in PREQUEST_CONTEXT RequestContext,
+                                      __in ULONG Length) {
+  PVOID buffer = DokanAlloc(Length);
+  PMDL mdl;
+  if (buffer == NULL) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  mdl = IoAllocateMdl(buffer, Length, FALSE, FALSE, NULL);
+  if (mdl == NULL) {
+    ExFreePool(buffer);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  MmBuildMdlForNonPagedPool(mdl);
+  RequestContext->Irp->MdlAddress = mdl;
+  RequestContext->Irp->Tail.Overlay.DriverContext
+      [DRIVER_CONTEXT_MDL_READ_BUFFER] = mdl;
+  return STATUS_SUCCESS;
+}
+
+// Frees the MDL chain returned by IRP_MN_MDL reads along with their buffers.
+static VOID FreeMdlReadBuffer(__in PIRP Irp) {
+  PMDL mdl = Irp->MdlAddress;
+  while (mdl != NULL) {
+    PMDL next = mdl->Next;
+    ExFreePool(MmGetMdlVirtualAddress(mdl));
+    IoFreeMdl(mdl);
+    mdl = next;
+  }
+  Irp->MdlAddress = NULL;
+  Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_MDL_READ_BUFFER] = NULL;
+}
+
+VOID DokanReleaseMdlReadBuffer(__in PIRP Irp, __in NTSTATUS Status) {
+  PIO_STACK_LOCATION irpSp = IoGetCurrentIrpStackLocation(Irp);
+  // The driver context of an IRP we did not set it for can hold anything.
+  if (irpSp->MajorFunction != IRP_MJ_READ || !IsMdlRead(irpSp) ||
+      Irp->MdlAddress == NULL ||
+      Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_MDL_READ_BUFFER] !=
+          Irp->MdlAddress) {
+    return;
+  }
+  if (NT_SUCCESS(Status)) {
+    // The caller gives it back with IRP_MN_COMPLETE.
+    Irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_MDL_READ_BUFFER] = NULL;
+  } else {
+    FreeMdlReadBuffer(Irp);
+  }
+}
+
 NTSTATUS
 DokanDispatchRead(__in PREQUEST_CONTEXT RequestContext)
 
@@ -55,6 +113,8 @@ Return Value:
   BOOLEAN isPagingIo = FALSE;
   BOOLEAN isSynchronousIo = FALSE;
   BOOLEAN noCache = FALSE;
+  BOOLEAN sequential = FALSE;
+  ULONG readAheadLength = 0;
 
   __try {
     fileObject = RequestContext->IrpSp->FileObject;
@@ -74,8 +134,9 @@ Return Value:
       __leave;
     }
 
-    if (RequestContext->IrpSp->MinorFunction == IRP_MN_COMPLETE) {
-      RequestContext->Irp->MdlAddress = NULL;
+    if (FlagOn(RequestContext->IrpSp->MinorFunction, IRP_MN_COMPLETE)) {
+      // The MDLs come from the IRP_MN_MDL reads below.
+      FreeMdlReadBuffer(RequestContext->Irp);
       status = STATUS_SUCCESS;
       __leave;
     }
@@ -119,6 +180,14 @@ Return Value:
       __leave;
     }
 
+    if (IsMdlRead(RequestContext->IrpSp) &&
+        RequestContext->Irp->MdlAddress == NULL) {
+      status = AllocateMdlReadBuffer(RequestContext, bufferLength);
+      if (!NT_SUCCESS(status)) {
+        __leave;
+      }
+    }
+
     // make a MDL for UserBuffer that can be used later on another thread
     // context
     if (RequestContext->Irp->MdlAddress == NULL) {
@@ -157,6 +226,19 @@ Return Value:
       noCache = TRUE;
     }
 
+    // Reads must see the writes held back by the handles of the file, and
+    // report the failures of the ones of this handle.
+    if (RequestContext->Dcb->WriteBehindMaxSize > 0) {
+      if (!isPagingIo) {
+        status = DokanFlushWriteBehind(RequestContext, ccb);
+        if (!NT_SUCCESS(status)) {
+          __leave;
+        }
+      }
+      DokanFlushConflictingWriteBehind(RequestContext, fcb, byteOffset.QuadPart,
+                                       bufferLength);
+    }
+
     if (!isPagingIo && (fileObject->SectionObjectPointer != NULL) &&
         (fileObject->SectionObjectPointer->DataSectionObject != NULL)) {
       CcFlushCache(&fcb->SectionObjectPointers,
@@ -166,6 +248,44 @@ Return Value:
 
     DokanFCBLockRO(fcb);
     fcbLocked = TRUE;
+
+    if (noCache && RequestContext->Dcb->ReadAheadWindowSize > 0) {
+      sequential =
+          DokanIsSequentialRead(ccb, byteOffset.QuadPart, bufferLength) ||
+          (ccb->CacheHints & DOKAN_CACHE_HINT_SEQUENTIAL);
+      // Answering from the window skips the oplock and byte range lock checks
+      // below, which paging reads do not go through anyway. Other reads only
+      // use it when they would pass them without waiting.
+      if (isPagingIo ||
+          (FsRtlOplockIsFastIoPossible(DokanGetFcbOplock(fcb)) &&
+           FsRtlCheckLockForReadAccess(&fcb->FileLock,
+                                       RequestContext->Irp))) {
+        ULONG readLength = 0;
+        currentAddress = MmGetSystemAddressForMdlNormalSafe(
+            RequestContext->Irp->MdlAddress);
+        if (currentAddress != NULL &&
+            DokanReadFromReadAhead(fcb, byteOffset.QuadPart, bufferLength,
+                                   currentAddress, &readLength)) {
+          DOKAN_LOG_FINE_IRP(RequestContext, "Read %lu bytes from read-ahead",
+                             readLength);
+          if (readLength < bufferLength) {
+            RtlZeroMemory((PCHAR)currentAddress + readLength,
+                          bufferLength - readLength);
+          }
+          RequestContext->Irp->IoStatus.Information = readLength;
+          if (isSynchronousIo && !isPagingIo) {
+            fileObject->CurrentByteOffset.QuadPart =
+                byteOffset.QuadPart + readLength;
+          }
+          status = STATUS_SUCCESS;
+          __leave;
+        }
+      }
+      if (sequential || DokanHasLease(fcb, DOKAN_LEASE_DATA)) {
+        readAheadLength = DokanGetReadAheadWindow(ccb);
+      }
+    }
+
     // length of EventContext is sum of file name length and itself
     eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
     eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
@@ -189,6 +309,9 @@ Return Value:
       DOKAN_LOG_FINE_IRP(RequestContext, "Nocache");
       eventContext->FileFlags |= DOKAN_NOCACHE;
     }
+    if (sequential) {
+      eventContext->FileFlags |= DOKAN_SEQUENTIAL_READ;
+    }
 
     // offset of file to read
     eventContext->Operation.Read.ByteOffset = byteOffset;
@@ -236,8 +359,23 @@ Return Value:
       }
     }
 
+    // Only done once past the oplock check, which can post the IRP with a new
+    // request context. The window does not fit in the buffer of the IRP, so
+    // it cannot be mapped.
+    if (readAheadLength > 0) {
+      DOKAN_LOG_FINE_IRP(RequestContext, "Reading ahead %lu bytes",
+                         readAheadLength);
+      eventContext->Operation.Read.BufferLength += readAheadLength;
+      RequestContext->Flags |= DOKAN_READ_AHEAD_REQUESTED;
+    } else {
+      DokanMapReadBuffer(RequestContext, eventContext);
+    }
+
     // register this IRP to pending IPR list and make it pending status
     status = DokanRegisterPendingIrp(RequestContext, eventContext);
+    if (status != STATUS_PENDING) {
+      DokanUnmapUserBuffer(RequestContext);
+    }
   } __finally {
     if (fcbLocked)
       DokanFCBUnlock(fcb);
@@ -249,6 +387,7 @@ Return Value:
 VOID DokanCompleteRead(__in PREQUEST_CONTEXT RequestContext,
                        __in PEVENT_INFORMATION EventInfo) {
   ULONG bufferLen = 0;
+  ULONG readLength = EventInfo->BufferLength;
   PVOID buffer = NULL;
   PDokanCCB ccb;
   PFILE_OBJECT fileObject;
@@ -277,32 +416,55 @@ VOID DokanCompleteRead(__in PREQUEST_CONTEXT RequestContext,
   DOKAN_LOG_FINE_IRP(RequestContext, "BufferLen %lu, Event.BufferLen %lu", bufferLen,
                 EventInfo->BufferLength);
 
+  // Whatever was read past the IRP range goes to the read-ahead window.
+  if ((RequestContext->Flags & DOKAN_READ_AHEAD_REQUESTED) &&
+      readLength > bufferLen) {
+    readLength = bufferLen;
+    if (NT_SUCCESS(EventInfo->Status) && buffer != NULL) {
+      DokanFillReadAhead(
+          RequestContext, ccb->Fcb,
+          EventInfo->Operation.Read.CurrentByteOffset.QuadPart -
+              EventInfo->BufferLength + bufferLen,
+          EventInfo->Buffer + bufferLen, EventInfo->BufferLength - bufferLen,
+          EventInfo->BufferLength - bufferLen <
+              DokanGetReadAheadWindowSize(ccb));
+    }
+  }
+
   // buffer is not specified or short of length
-  if (bufferLen == 0 || buffer == NULL || bufferLen < EventInfo->BufferLength) {
+  if (bufferLen == 0 || buffer == NULL || bufferLen < readLength) {
 
     RequestContext->Irp->IoStatus.Information = 0;
     RequestContext->Irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
 
   } else {
-    RtlZeroMemory(buffer, bufferLen);
-    RtlCopyMemory(buffer, EventInfo->Buffer, EventInfo->BufferLength);
+    if (RequestContext->UserMapping != NULL) {
+      // The DLL has read straight into the buffer.
+      RtlZeroMemory((PCHAR)buffer + readLength, bufferLen - readLength);
+    } else {
+      RtlZeroMemory(buffer, bufferLen);
+      RtlCopyMemory(buffer, EventInfo->Buffer, readLength);
+    }
 
     // read length which is actually read
-    RequestContext->Irp->IoStatus.Information = EventInfo->BufferLength;
+    RequestContext->Irp->IoStatus.Information = readLength;
     RequestContext->Irp->IoStatus.Status = EventInfo->Status;
 
     if (NT_SUCCESS(RequestContext->Irp->IoStatus.Status) &&
-        EventInfo->BufferLength > 0 &&
+        readLength > 0 &&
         (fileObject->Flags & FO_SYNCHRONOUS_IO) &&
         !(RequestContext->Irp->Flags & IRP_PAGING_IO)) {
       // update current byte offset only when synchronous IO and not pagind IO
       fileObject->CurrentByteOffset.QuadPart =
-          EventInfo->Operation.Read.CurrentByteOffset.QuadPart;
+          EventInfo->Operation.Read.CurrentByteOffset.QuadPart -
+          (EventInfo->BufferLength - readLength);
       DOKAN_LOG_FINE_IRP(RequestContext, "Updated CurrentByteOffset %I64u",
                 fileObject->CurrentByteOffset.QuadPart);
     }
   }
 
+  DokanUnmapUserBuffer(RequestContext);
+
   if (RequestContext->Flags & DOKAN_MDL_ALLOCATED) {
     DokanFreeMdl(RequestContext->Irp);
     RequestContext->Flags &= ~DOKAN_MDL_ALLOCATED;
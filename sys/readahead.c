@@ -0,0 +1,302 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Sequential read-ahead.
+//
+// Non-cached reads, which include the paging reads of the cache manager, are
+// sent to the file system with exactly the requested range. Once a handle has
+// read a file sequentially, its next non-cached read that cannot be answered
+// locally asks the file system for EVENT_START.ReadAheadWindowSize more bytes
+// in the same round trip. The surplus is kept in the DOKAN_READ_AHEAD_BUFFER of
+// the FCB, from which the following reads of any handle are answered without
+// going to user mode. A single window is kept per file, and the windows of a
+// mount hold at most EVENT_START.ReadAheadMemoryLimit bytes.
+//
+// The reply to a create can also fill the window with the start of the file,
+// when DOKAN_CREATE_FILE_INFO.InlineDataLength is set. A file system fetching
+// files from remote storage can hand their data over as it arrives with
+// FSCTL_HYDRATE_RANGE, and learns from DOKAN_SEQUENTIAL_READ which reads are
+// worth fetching ahead of.
+//
+// Changes made through the driver and the ones reported by the file system
+// invalidate the windows, which are only filled from reads that arrived after
+// the last invalidation.
+
+// Number of reads in a row, each starting where the previous one ended, after
+// which a handle is considered to read sequentially.
+#define DOKAN_READ_AHEAD_SEQUENTIAL_READS 2
+
+VOID DokanInvalidateReadAhead(__in PDokanFCB Fcb) {
+  if (Fcb->Vcb->Dcb->ReadAheadWindowSize == 0) {
+    return;
+  }
+  InterlockedExchange64(&Fcb->ReadAhead.InvalidatedTime,
+                        KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+VOID DokanInvalidateVolumeReadAhead(__in PDokanVCB Vcb) {
+  if (Vcb->Dcb->ReadAheadWindowSize == 0) {
+    return;
+  }
+  InterlockedExchange64(&Vcb->ReadAheadInvalidatedTime,
+                        KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+VOID DokanFreeReadAhead(__in PDokanFCB Fcb) {
+  PDOKAN_READ_AHEAD_BUFFER readAhead = &Fcb->ReadAhead;
+  if (readAhead->Buffer != NULL) {
+    ExFreePool(readAhead->Buffer);
+    readAhead->Buffer = NULL;
+    InterlockedAdd64(&Fcb->Vcb->Dcb->ReadAheadMemoryUsed,
+                     -(LONG64)readAhead->Length);
+  }
+  readAhead->Length = 0;
+  readAhead->Time = 0;
+}
+
+BOOLEAN DokanIsSequentialRead(__in PDokanCCB Ccb, __in LONGLONG ByteOffset,
+                              __in ULONG Length) {
+  BOOLEAN sequential = FALSE;
+  if (ByteOffset == Ccb->ReadAheadNextOffset &&
+      Ccb->ReadAheadSequentialReads > 0) {
+    if (Ccb->ReadAheadSequentialReads < DOKAN_READ_AHEAD_SEQUENTIAL_READS) {
+      ++Ccb->ReadAheadSequentialReads;
+    }
+    sequential =
+        Ccb->ReadAheadSequentialReads >= DOKAN_READ_AHEAD_SEQUENTIAL_READS;
+  } else {
+    Ccb->ReadAheadSequentialReads = 1;
+  }
+  Ccb->ReadAheadNextOffset = ByteOffset + Length;
+  return sequential;
+}
+
+// Returns whether the window of Fcb holds data that can be given to readers.
+// The caller must hold the FCB lock.
+static BOOLEAN IsReadAheadValid(__in PDokanFCB Fcb) {
+  PDOKAN_READ_AHEAD_BUFFER readAhead = &Fcb->ReadAhead;
+  return readAhead->Buffer != NULL && readAhead->Time != 0 &&
+         readAhead->Time > InterlockedCompareExchange64(
+                               &readAhead->InvalidatedTime, 0, 0) &&
+         readAhead->Time > InterlockedCompareExchange64(
+                               &Fcb->Vcb->ReadAheadInvalidatedTime, 0, 0);
+}
+
+BOOLEAN DokanReadFromReadAhead(__in PDokanFCB Fcb, __in LONGLONG ByteOffset,
+                               __in ULONG Length, __out PVOID Buffer,
+                               __out PULONG ReadLength) {
+  PDOKAN_READ_AHEAD_BUFFER readAhead = &Fcb->ReadAhead;
+  LONGLONG end;
+  ULONG offsetInBuffer;
+  ULONG available;
+
+  if (Fcb->Vcb->Dcb->ReadAheadWindowSize == 0 || !IsReadAheadValid(Fcb)) {
+    return FALSE;
+  }
+  end = readAhead->ByteOffset.QuadPart + readAhead->Length;
+  if (ByteOffset < readAhead->ByteOffset.QuadPart || ByteOffset >= end) {
+    return FALSE;
+  }
+  offsetInBuffer = (ULONG)(ByteOffset - readAhead->ByteOffset.QuadPart);
+  available = readAhead->Length - offsetInBuffer;
+  // Only the end of the file can be given short.
+  if (available < Length && !readAhead->EndOfFile) {
+    return FALSE;
+  }
+  *ReadLength = min(available, Length);
+  RtlCopyMemory(Buffer, (PCHAR)readAhead->Buffer + offsetInBuffer,
+                *ReadLength);
+  return TRUE;
+}
+
+VOID DokanSetCacheHints(__in PDokanCCB Ccb, __in PFILE_OBJECT FileObject,
+                        __in ULONG CacheHints,
+                        __in ULONG ReadAheadGranularity) {
+  Ccb->CacheHints = CacheHints;
+  Ccb->ReadAheadWindowSize =
+      min(ReadAheadGranularity, DOKAN_READ_AHEAD_MAX_WINDOW);
+  // For the filters and the memory manager, which read the flags too.
+  if (CacheHints & DOKAN_CACHE_HINT_SEQUENTIAL) {
+    SetFlag(FileObject->Flags, FO_SEQUENTIAL_ONLY);
+  }
+  if (CacheHints & DOKAN_CACHE_HINT_RANDOM) {
+    SetFlag(FileObject->Flags, FO_RANDOM_ACCESS);
+  }
+  if (CacheHints & DOKAN_CACHE_HINT_TEMPORARY) {
+    SetFlag(FileObject->Flags, FO_TEMPORARY_FILE);
+  }
+}
+
+ULONG DokanGetReadAheadWindowSize(__in PDokanCCB Ccb) {
+  return Ccb->ReadAheadWindowSize != 0
+             ? Ccb->ReadAheadWindowSize
+             : Ccb->Fcb->Vcb->Dcb->ReadAheadWindowSize;
+}
+
+ULONG DokanGetReadAheadWindow(__in PDokanCCB Ccb) {
+  PDokanDCB dcb = Ccb->Fcb->Vcb->Dcb;
+  ULONG window = DokanGetReadAheadWindowSize(Ccb);
+  if (window == 0 ||
+      (Ccb->CacheHints &
+       (DOKAN_CACHE_HINT_RANDOM | DOKAN_CACHE_HINT_NO_READ_AHEAD)) ||
+      InterlockedCompareExchange64(&dcb->ReadAheadMemoryUsed, 0, 0) + window >
+          dcb->ReadAheadMemoryLimit) {
+    return 0;
+  }
+  return window;
+}
+
+VOID DokanFillReadAhead(__in PREQUEST_CONTEXT RequestContext,
+                        __in PDokanFCB Fcb, __in LONGLONG ByteOffset,
+                        __in PVOID Buffer, __in ULONG Length,
+                        __in BOOLEAN EndOfFile) {
+  PDOKAN_READ_AHEAD_BUFFER readAhead = &Fcb->ReadAhead;
+  PDokanDCB dcb = RequestContext->Dcb;
+  LONGLONG arrivalTime = RequestContext->ArrivalTime.QuadPart;
+  PVOID copy;
+
+  if (dcb->ReadAheadWindowSize == 0 || arrivalTime == 0 || Length == 0) {
+    return;
+  }
+  if (InterlockedAdd64(&dcb->ReadAheadMemoryUsed, Length) >
+      dcb->ReadAheadMemoryLimit) {
+    InterlockedAdd64(&dcb->ReadAheadMemoryUsed, -(LONG64)Length);
+    return;
+  }
+  copy = DokanAlloc(Length);
+  if (copy == NULL) {
+    InterlockedAdd64(&dcb->ReadAheadMemoryUsed, -(LONG64)Length);
+    return;
+  }
+  RtlCopyMemory(copy, Buffer, Length);
+
+  DokanFCBLockRW(Fcb);
+  if (arrivalTime > readAhead->Time &&
+      arrivalTime > InterlockedCompareExchange64(&readAhead->InvalidatedTime,
+                                                 0, 0) &&
+      arrivalTime > InterlockedCompareExchange64(
+                        &Fcb->Vcb->ReadAheadInvalidatedTime, 0, 0)) {
+    DokanFreeReadAhead(Fcb);
+    readAhead->Buffer = copy;
+    readAhead->Length = Length;
+    readAhead->ByteOffset.QuadPart = ByteOffset;
+    readAhead->EndOfFile = EndOfFile;
+    readAhead->Time = arrivalTime;
+    copy = NULL;
+  }
+  DokanFCBUnlock(Fcb);
+  if (copy != NULL) {
+    ExFreePool(copy);
+    InterlockedAdd64(&dcb->ReadAheadMemoryUsed, -(LONG64)Length);
+  } else {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Read ahead %lu bytes at %I64d", Length,
+                       ByteOffset);
+  }
+}
+
+// Handles FSCTL_HYDRATE_RANGE. The data becomes the window of the file, or
+// extends it when it starts where the window ends, so that a file system
+// streaming a file in pieces keeps up to DOKAN_READ_AHEAD_MAX_WINDOW of it
+// ready for the readers. Nothing is kept for a file without FCB, as its first
+// open goes to the file system anyway.
+NTSTATUS DokanHydrateRange(__in PREQUEST_CONTEXT RequestContext) {
+  PDOKAN_HYDRATE_RANGE range = GetInputBuffer(RequestContext->Irp);
+  ULONG inputLength = GetProvidedInputSize(RequestContext->Irp);
+  PDokanDCB dcb = RequestContext->Dcb;
+  PDokanVCB vcb = RequestContext->Vcb;
+  PDOKAN_READ_AHEAD_BUFFER readAhead;
+  LARGE_INTEGER byteOffset;
+  UNICODE_STRING name;
+  PDokanFCB fcb;
+  PCHAR data;
+  PVOID copy;
+  ULONG keptLength;
+  ULONG length;
+
+  if (range == NULL ||
+      inputLength < FIELD_OFFSET(DOKAN_HYDRATE_RANGE, FileName[0]) ||
+      range->FileNameLength >
+          inputLength - FIELD_OFFSET(DOKAN_HYDRATE_RANGE, FileName[0]) ||
+      range->DataOffset <
+          FIELD_OFFSET(DOKAN_HYDRATE_RANGE, FileName[0]) +
+              range->FileNameLength ||
+      range->DataOffset > inputLength ||
+      range->DataLength > inputLength - range->DataOffset ||
+      range->DataLength == 0 || range->ByteOffset.QuadPart < 0) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  if (dcb->ReadAheadWindowSize == 0) {
+    return STATUS_NOT_SUPPORTED;
+  }
+  name.Length = range->FileNameLength;
+  name.MaximumLength = range->FileNameLength;
+  name.Buffer = range->FileName;
+  data = (PCHAR)range + range->DataOffset;
+  DOKAN_LOG_FINE_IRP(RequestContext, "FileName=\"%wZ\" %lu bytes at %I64d",
+                     &name, range->DataLength, range->ByteOffset.QuadPart);
+
+  DokanVCBLockRO(vcb);
+  fcb = DokanFindFCB(vcb, &name);
+  if (fcb == NULL) {
+    DokanVCBUnlock(vcb);
+    return STATUS_SUCCESS;
+  }
+  DokanFCBLockRW(fcb);
+  readAhead = &fcb->ReadAhead;
+  keptLength = 0;
+  byteOffset = range->ByteOffset;
+  if (IsReadAheadValid(fcb) && !readAhead->EndOfFile &&
+      range->ByteOffset.QuadPart ==
+          readAhead->ByteOffset.QuadPart + readAhead->Length &&
+      readAhead->Length + range->DataLength <= DOKAN_READ_AHEAD_MAX_WINDOW) {
+    keptLength = readAhead->Length;
+    byteOffset = readAhead->ByteOffset;
+  }
+  length = keptLength + min(range->DataLength, DOKAN_READ_AHEAD_MAX_WINDOW);
+  // The new buffer is accounted whole; freeing the old one gives back the
+  // part that is kept.
+  copy = NULL;
+  if (InterlockedAdd64(&dcb->ReadAheadMemoryUsed, length) <=
+      dcb->ReadAheadMemoryLimit) {
+    copy = DokanAlloc(length);
+  }
+  if (copy == NULL) {
+    InterlockedAdd64(&dcb->ReadAheadMemoryUsed, -(LONG64)length);
+    DokanFCBUnlock(fcb);
+    DokanVCBUnlock(vcb);
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  if (keptLength > 0) {
+    RtlCopyMemory(copy, readAhead->Buffer, keptLength);
+  }
+  RtlCopyMemory((PCHAR)copy + keptLength, data, length - keptLength);
+  DokanFreeReadAhead(fcb);
+  readAhead->Buffer = copy;
+  readAhead->Length = length;
+  readAhead->ByteOffset = byteOffset;
+  readAhead->EndOfFile =
+      range->EndOfFile && length - keptLength == range->DataLength;
+  readAhead->Time = RequestContext->ArrivalTime.QuadPart;
+  DokanFCBUnlock(fcb);
+  DokanVCBUnlock(vcb);
+  return STATUS_SUCCESS;
+}
@@ -0,0 +1,261 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+#include "util/irp_buffer_helper.h"
+
+// The shared event ring lets the DLL receive events and send replies without a
+// DeviceIoControl for each of them. See EVENT_RING_HEADER in public.h for the
+// layout of the shared region.
+//
+// The memory is owned by the DLL and can be modified by it at any time, so the
+// driver only trusts its own copy of the ring geometry and positions, and
+// copies every reply out of the region before looking at it.
+
+static VOID FreeEventRing(__in PDOKAN_EVENT_RING Ring) {
+  if (Ring->Mdl) {
+    if (Ring->Header) {
+      MmUnlockPages(Ring->Mdl);
+    }
+    IoFreeMdl(Ring->Mdl);
+  }
+  if (Ring->SubmissionEvent) {
+    ObDereferenceObject(Ring->SubmissionEvent);
+  }
+  if (Ring->Buffer) {
+    ExFreePool(Ring->Buffer);
+  }
+  ExFreePool(Ring);
+}
+
+NTSTATUS
+DokanEventRingRegister(__in PREQUEST_CONTEXT RequestContext) {
+  PEVENT_RING_REGISTER ringRegister = NULL;
+  PDOKAN_EVENT_RING ring = NULL;
+  PDokanDCB dcb = RequestContext->Dcb;
+  SIZE_T ringSize;
+  KIRQL oldIrql;
+  NTSTATUS status;
+  DOKAN_INIT_LOGGER(logger, RequestContext->DeviceObject->DriverObject,
+                    IRP_MJ_FILE_SYSTEM_CONTROL);
+
+  GET_IRP_BUFFER_OR_RETURN(RequestContext->Irp, ringRegister);
+
+  if (RequestContext->Irp->RequestorMode != UserMode ||
+      RequestContext->IrpSp->FileObject == NULL) {
+    return DokanLogError(&logger, STATUS_INVALID_PARAMETER,
+                         L"Event ring has to be registered from user mode.");
+  }
+  if (ringRegister->SlotCount == 0 ||
+      ringRegister->SlotCount > EVENT_RING_MAX_SLOT_COUNT ||
+      (ringRegister->SlotCount & (ringRegister->SlotCount - 1)) != 0 ||
+      (ringRegister->Address & (PAGE_SIZE - 1)) != 0) {
+    return DokanLogError(&logger, STATUS_INVALID_PARAMETER,
+                         L"Invalid event ring geometry. SlotCount: %lu",
+                         ringRegister->SlotCount);
+  }
+  if (dcb->EventRing != NULL) {
+    return DokanLogError(&logger, STATUS_INVALID_PARAMETER,
+                         L"An event ring is already registered.");
+  }
+
+  ring = DokanAllocZero(sizeof(DOKAN_EVENT_RING));
+  if (ring == NULL) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  ExInitializeRundownProtection(&ring->RundownRef);
+  ring->SlotCount = ringRegister->SlotCount;
+  ring->FileObject = RequestContext->IrpSp->FileObject;
+  ringSize = EVENT_RING_SIZE(ring->SlotCount);
+
+  __try {
+    // Replies are copied here before being processed.
+    ring->Buffer = DokanAlloc(EVENT_RING_SLOT_DATA_SIZE);
+    if (ring->Buffer == NULL) {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      __leave;
+    }
+
+    status = ObReferenceObjectByHandle(
+        (HANDLE)(ULONG_PTR)ringRegister->SubmissionEvent, EVENT_MODIFY_STATE,
+        *ExEventObjectType, UserMode, (PVOID*)&ring->SubmissionEvent, NULL);
+    if (!NT_SUCCESS(status)) {
+      DokanLogError(&logger, status,
+                    L"Failed to reference the event ring submission event.");
+      ring->SubmissionEvent = NULL;
+      __leave;
+    }
+
+    ring->Mdl = IoAllocateMdl((PVOID)(ULONG_PTR)ringRegister->Address,
+                              (ULONG)ringSize, FALSE, FALSE, NULL);
+    if (ring->Mdl == NULL) {
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      __leave;
+    }
+    __try {
+      MmProbeAndLockPages(ring->Mdl, UserMode, IoWriteAccess);
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+      status = GetExceptionCode();
+    }
+    if (!NT_SUCCESS(status)) {
+      DokanLogError(&logger, status, L"Failed to lock the event ring pages.");
+      __leave;
+    }
+    ring->Header = MmGetSystemAddressForMdlNormalSafe(ring->Mdl);
+    if (ring->Header == NULL) {
+      MmUnlockPages(ring->Mdl);
+      status = STATUS_INSUFFICIENT_RESOURCES;
+      __leave;
+    }
+
+    KeAcquireSpinLock(&dcb->EventRingLock, &oldIrql);
+    if (dcb->EventRing == NULL && !IsUnmountPendingVcb(RequestContext->Vcb)) {
+      dcb->EventRing = ring;
+      status = STATUS_SUCCESS;
+    } else {
+      status = STATUS_INVALID_PARAMETER;
+    }
+    KeReleaseSpinLock(&dcb->EventRingLock, oldIrql);
+  } __finally {
+    if (!NT_SUCCESS(status)) {
+      FreeEventRing(ring);
+    }
+  }
+
+  if (NT_SUCCESS(status)) {
+    DokanLogInfo(&logger, L"Registered event ring with %lu slots.",
+                 ringRegister->SlotCount);
+  }
+  return status;
+}
+
+VOID DokanEventRingRelease(__in PDokanDCB Dcb,
+                           __in_opt PFILE_OBJECT FileObject) {
+  PDOKAN_EVENT_RING ring = NULL;
+  KIRQL oldIrql;
+
+  KeAcquireSpinLock(&Dcb->EventRingLock, &oldIrql);
+  if (Dcb->EventRing != NULL &&
+      (FileObject == NULL || Dcb->EventRing->FileObject == FileObject)) {
+    ring = Dcb->EventRing;
+    Dcb->EventRing = NULL;
+  }
+  KeReleaseSpinLock(&Dcb->EventRingLock, oldIrql);
+
+  if (ring == NULL) {
+    return;
+  }
+  // Events still sitting in the submission ring are never going to be seen by
+  // anyone; their IRPs are canceled by the unmount or time out like any other
+  // IRP left unanswered.
+  ExWaitForRundownProtectionRelease(&ring->RundownRef);
+  FreeEventRing(ring);
+}
+
+BOOLEAN DokanEventRingPost(__in PDokanDCB Dcb,
+                           __in PEVENT_CONTEXT EventContext) {
+  PDOKAN_EVENT_RING ring = Dcb->EventRing;
+  PEVENT_RING_SLOT slot;
+  LONG sequence;
+
+  if (ring == NULL || EventContext->Length > EVENT_RING_SLOT_DATA_SIZE) {
+    return FALSE;
+  }
+  slot = EVENT_RING_SUBMISSION_SLOT(ring->Header, ring->SlotCount,
+                                    ring->SubmissionTail);
+  sequence = InterlockedCompareExchange(&slot->Sequence, 0, 0);
+  if (sequence != (LONG)ring->SubmissionTail) {
+    // The DLL has not consumed this slot yet: the ring is full.
+    return FALSE;
+  }
+  RtlCopyMemory(slot->Data, EventContext, EventContext->Length);
+  slot->Length = EventContext->Length;
+  InterlockedExchange(&slot->Sequence, (LONG)(ring->SubmissionTail + 1));
+  ++ring->SubmissionTail;
+  KeSetEvent(ring->SubmissionEvent, IO_NO_INCREMENT, FALSE);
+  return TRUE;
+}
+
+// Completes the replies found in the completion ring. Only one thread drains
+// at a time; a doorbell that arrives meanwhile is picked up by the draining
+// thread before it leaves.
+NTSTATUS
+DokanEventRingDoorbell(__in PREQUEST_CONTEXT RequestContext) {
+  PDokanDCB dcb = RequestContext->Dcb;
+  PDOKAN_EVENT_RING ring = NULL;
+  PEVENT_RING_SLOT slot;
+  ULONG length;
+  KIRQL oldIrql;
+  NTSTATUS status = STATUS_SUCCESS;
+  DOKAN_INIT_LOGGER(logger, RequestContext->DeviceObject->DriverObject,
+                    IRP_MJ_FILE_SYSTEM_CONTROL);
+
+  KeAcquireSpinLock(&dcb->EventRingLock, &oldIrql);
+  if (dcb->EventRing != NULL &&
+      ExAcquireRundownProtection(&dcb->EventRing->RundownRef)) {
+    ring = dcb->EventRing;
+  }
+  KeReleaseSpinLock(&dcb->EventRingLock, oldIrql);
+  if (ring == NULL) {
+    return STATUS_INVALID_PARAMETER;
+  }
+
+  while (NT_SUCCESS(status) &&
+         InterlockedCompareExchange(&ring->Draining, 1, 0) == 0) {
+    InterlockedExchange(&ring->Header->CompletionDoorbell, 0);
+    for (;;) {
+      if (IsUnmountPendingVcb(RequestContext->Vcb)) {
+        status = STATUS_NO_SUCH_DEVICE;
+        break;
+      }
+      slot = EVENT_RING_COMPLETION_SLOT(ring->Header, ring->SlotCount,
+                                        ring->CompletionHead);
+      if (InterlockedCompareExchange(&slot->Sequence, 0, 0) !=
+          (LONG)(ring->CompletionHead + 1)) {
+        break;
+      }
+      length = slot->Length;
+      if (length < sizeof(EVENT_INFORMATION) ||
+          length > EVENT_RING_SLOT_DATA_SIZE) {
+        // This would be a coding error in the DLL.
+        status = DokanLogError(&logger, STATUS_INVALID_PARAMETER,
+                               L"Invalid event ring reply length %lu.", length);
+      } else {
+        RtlCopyMemory(ring->Buffer, slot->Data, length);
+      }
+      InterlockedExchange(&slot->Sequence,
+                          (LONG)(ring->CompletionHead + ring->SlotCount));
+      ++ring->CompletionHead;
+      if (!NT_SUCCESS(status)) {
+        break;
+      }
+      status = DokanCompleteEventInformation(RequestContext, ring->Buffer,
+                                             length);
+    }
+    InterlockedExchange(&ring->Draining, 0);
+    if (InterlockedCompareExchange(&ring->Header->CompletionDoorbell, 0, 0) ==
+        0) {
+      break;
+    }
+  }
+
+  ExReleaseRundownProtection(&ring->RundownRef);
+  return status;
+}
@@ -22,6 +22,187 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 
 #include "dokan.h"
 
+// Discards the security descriptor cached for the file after a change made
+// through the driver.
+VOID DokanInvalidateSecurityCache(__in PDokanFCB Fcb) {
+  if (Fcb->Vcb->Dcb->SecurityCacheTimeoutMs == 0) {
+    return;
+  }
+  InterlockedExchange64(&Fcb->SecurityCache.InvalidatedTime,
+                        KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+// Discards the security descriptors cached for all the files of the volume,
+// for a change reported by the file system.
+VOID DokanInvalidateVolumeSecurityCache(__in PDokanVCB Vcb) {
+  if (Vcb->Dcb->SecurityCacheTimeoutMs == 0) {
+    return;
+  }
+  InterlockedExchange64(&Vcb->SecurityCacheInvalidatedTime,
+                        KeQueryPerformanceCounter(NULL).QuadPart);
+}
+
+VOID DokanFreeSecurityCache(__in PDokanFCB Fcb) {
+  if (Fcb->SecurityCache.Descriptor != NULL) {
+    ExFreePool(Fcb->SecurityCache.Descriptor);
+    Fcb->SecurityCache.Descriptor = NULL;
+  }
+  Fcb->SecurityCache.Length = 0;
+}
+
+// Returns whether the descriptor cached for Fcb is still current, whatever
+// it was queried for. The caller must hold the FCB lock.
+static BOOLEAN IsSecurityCacheCurrent(__in PDokanFCB Fcb) {
+  PDOKAN_SECURITY_CACHE cache = &Fcb->SecurityCache;
+  ULONG timeoutMs = Fcb->Vcb->Dcb->SecurityCacheTimeoutMs;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+
+  if (timeoutMs == 0 || cache->Descriptor == NULL || cache->Time == 0 ||
+      cache->Time <= InterlockedCompareExchange64(&cache->InvalidatedTime, 0,
+                                                  0) ||
+      cache->Time <= InterlockedCompareExchange64(
+                         &Fcb->Vcb->SecurityCacheInvalidatedTime, 0, 0)) {
+    return FALSE;
+  }
+  if (DokanHasLease(Fcb, DOKAN_LEASE_ATTRIBUTES)) {
+    return TRUE;
+  }
+  now = KeQueryPerformanceCounter(&frequency);
+  return now.QuadPart - cache->Time <
+         (LONGLONG)timeoutMs * frequency.QuadPart / 1000;
+}
+
+// Returns whether the descriptor cached for Fcb can answer a query for
+// SecurityInformation. The caller must hold the FCB lock.
+static BOOLEAN IsSecurityCacheValid(__in PDokanFCB Fcb,
+                                    __in SECURITY_INFORMATION SecurityInfo) {
+  return Fcb->SecurityCache.SecurityInformation == SecurityInfo &&
+         IsSecurityCacheCurrent(Fcb);
+}
+
+// Checks the access asked by a create against the descriptor cached for Fcb.
+// Returns TRUE only when the cache holds the owner, the group and the DACL of
+// the file and they grant all of it; the file system is left to decide
+// otherwise, including when the check fails. The caller must hold the FCB
+// lock.
+BOOLEAN DokanCheckCachedAccess(__in PREQUEST_CONTEXT RequestContext,
+                               __in PDokanFCB Fcb) {
+  PIO_SECURITY_CONTEXT securityContext =
+      RequestContext->IrpSp->Parameters.Create.SecurityContext;
+  PACCESS_STATE accessState = securityContext->AccessState;
+  ACCESS_MASK grantedAccess = 0;
+  NTSTATUS accessStatus = STATUS_ACCESS_DENIED;
+  BOOLEAN granted;
+  const SECURITY_INFORMATION requiredInfo = OWNER_SECURITY_INFORMATION |
+                                            GROUP_SECURITY_INFORMATION |
+                                            DACL_SECURITY_INFORMATION;
+
+  if (!RequestContext->Dcb->KernelAccessCheck || accessState == NULL ||
+      (Fcb->SecurityCache.SecurityInformation & requiredInfo) !=
+          requiredInfo ||
+      !IsSecurityCacheCurrent(Fcb)) {
+    return FALSE;
+  }
+  SeLockSubjectContext(&accessState->SubjectSecurityContext);
+  granted = SeAccessCheck(Fcb->SecurityCache.Descriptor,
+                          &accessState->SubjectSecurityContext,
+                          /*SubjectContextLocked=*/TRUE,
+                          securityContext->DesiredAccess,
+                          accessState->PreviouslyGrantedAccess,
+                          /*Privileges=*/NULL, IoGetFileObjectGenericMapping(),
+                          RequestContext->Irp->RequestorMode, &grantedAccess,
+                          &accessStatus);
+  SeUnlockSubjectContext(&accessState->SubjectSecurityContext);
+  return granted && NT_SUCCESS(accessStatus);
+}
+
+// Answers the query from the security cache of Fcb. Returns FALSE when the
+// query has to go to user mode, otherwise sets the status to complete the IRP
+// with. Size probes only need the length, so they do not touch the buffer.
+// The caller must hold the FCB lock.
+static BOOLEAN QueryCachedSecurity(__in PREQUEST_CONTEXT RequestContext,
+                                   __in PDokanFCB Fcb,
+                                   __out NTSTATUS* Status) {
+  PDOKAN_SECURITY_CACHE cache = &Fcb->SecurityCache;
+  ULONG bufferLength = RequestContext->IrpSp->Parameters.QuerySecurity.Length;
+  PVOID buffer;
+
+  if (!IsSecurityCacheValid(
+          Fcb,
+          RequestContext->IrpSp->Parameters.QuerySecurity.SecurityInformation)) {
+    return FALSE;
+  }
+  if (bufferLength < cache->Length) {
+    RequestContext->Irp->IoStatus.Information = cache->Length;
+    *Status = STATUS_BUFFER_OVERFLOW;
+    return TRUE;
+  }
+  if (RequestContext->Irp->UserBuffer == NULL) {
+    return FALSE;
+  }
+  if (RequestContext->Irp->MdlAddress == NULL) {
+    if (!NT_SUCCESS(DokanAllocateMdl(RequestContext, bufferLength))) {
+      return FALSE;
+    }
+    RequestContext->Flags = DOKAN_MDL_ALLOCATED;
+  }
+  buffer = MmGetSystemAddressForMdlNormalSafe(RequestContext->Irp->MdlAddress);
+  if (buffer != NULL) {
+    RtlCopyMemory(buffer, cache->Descriptor, cache->Length);
+  }
+  if (RequestContext->Flags & DOKAN_MDL_ALLOCATED) {
+    DokanFreeMdl(RequestContext->Irp);
+    RequestContext->Flags &= ~DOKAN_MDL_ALLOCATED;
+  }
+  if (buffer == NULL) {
+    return FALSE;
+  }
+  RequestContext->Irp->IoStatus.Information = cache->Length;
+  *Status = STATUS_SUCCESS;
+  return TRUE;
+}
+
+// Keeps a copy of the descriptor returned by the file system in the security
+// cache of Fcb, unless the file was changed since the query arrived.
+static VOID FillSecurityCache(__in PREQUEST_CONTEXT RequestContext,
+                              __in PDokanFCB Fcb,
+                              __in PSECURITY_DESCRIPTOR Descriptor,
+                              __in ULONG Length) {
+  PDOKAN_SECURITY_CACHE cache = &Fcb->SecurityCache;
+  LONGLONG arrivalTime = RequestContext->ArrivalTime.QuadPart;
+  PSECURITY_DESCRIPTOR copy;
+
+  if (RequestContext->Dcb->SecurityCacheTimeoutMs == 0 || arrivalTime == 0 ||
+      Length == 0 || Length > DOKAN_SECURITY_CACHE_MAX_SIZE) {
+    return;
+  }
+  copy = DokanAlloc(Length);
+  if (copy == NULL) {
+    return;
+  }
+  RtlCopyMemory(copy, Descriptor, Length);
+
+  DokanFCBLockRW(Fcb);
+  if (arrivalTime > cache->Time &&
+      arrivalTime > InterlockedCompareExchange64(&cache->InvalidatedTime, 0,
+                                                 0) &&
+      arrivalTime > InterlockedCompareExchange64(
+                        &Fcb->Vcb->SecurityCacheInvalidatedTime, 0, 0)) {
+    DokanFreeSecurityCache(Fcb);
+    cache->Descriptor = copy;
+    cache->Length = Length;
+    cache->SecurityInformation =
+        RequestContext->IrpSp->Parameters.QuerySecurity.SecurityInformation;
+    cache->Time = arrivalTime;
+    copy = NULL;
+  }
+  DokanFCBUnlock(Fcb);
+  if (copy != NULL) {
+    ExFreePool(copy);
+  }
+}
+
 NTSTATUS
 DokanDispatchQuerySecurity(__in PREQUEST_CONTEXT RequestContext) {
   NTSTATUS status = STATUS_INVALID_PARAMETER;
@@ -71,6 +252,11 @@ DokanDispatchQuerySecurity(__in PREQUEST_CONTEXT RequestContext) {
   }
 
   DokanFCBLockRO(fcb);
+  if (QueryCachedSecurity(RequestContext, fcb, &status)) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Answered from the security cache");
+    DokanFCBUnlock(fcb);
+    return status;
+  }
   eventLength = sizeof(EVENT_CONTEXT) + fcb->FileName.Length;
   eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
 
@@ -136,6 +322,11 @@ VOID DokanCompleteQuerySecurity(__in PREQUEST_CONTEXT RequestContext,
       RtlCopyMemory(buffer, EventInfo->Buffer, EventInfo->BufferLength);
       RequestContext->Irp->IoStatus.Information = EventInfo->BufferLength;
       RequestContext->Irp->IoStatus.Status = STATUS_SUCCESS;
+      ccb = fileObject->FsContext2;
+      if (ccb != NULL && ccb->Fcb != NULL) {
+        FillSecurityCache(RequestContext, ccb->Fcb, EventInfo->Buffer,
+                          EventInfo->BufferLength);
+      }
     }
   } else if (EventInfo->Status == STATUS_BUFFER_OVERFLOW ||
              (EventInfo->Status == STATUS_SUCCESS &&
@@ -210,6 +401,8 @@ DokanDispatchSetSecurity(__in PREQUEST_CONTEXT RequestContext) {
   securityDescriptor =
       RequestContext->IrpSp->Parameters.SetSecurity.SecurityDescriptor;
 
+  DokanInvalidateSecurityCache(fcb);
+
   // Assumes the parameter is self relative SD.
   securityDescLength = RtlLengthSecurityDescriptor(securityDescriptor);
 
@@ -270,6 +463,12 @@ VOID DokanCompleteSetSecurity(__in PREQUEST_CONTEXT RequestContext,
     DOKAN_LOG_FINE_IRP(RequestContext, "Ccb == NULL");
   }
 
+  if (fcb) {
+    // Also invalidated on failure, as the file system may have applied a part
+    // of the change.
+    DokanInvalidateSecurityCache(fcb);
+  }
+
   if (fcb && NT_SUCCESS(EventInfo->Status)) {
     DokanFCBLockRO(fcb);
     DokanNotifyReportChange(RequestContext, fcb, FILE_NOTIFY_CHANGE_SECURITY,
@@ -34,8 +34,85 @@ VOID DokanUnmount(__in_opt PREQUEST_CONTEXT RequestContext, __in PDokanDCB Dcb)
   DOKAN_LOG("End");
 }
 
+// Returns the timeout wheel interval of the given tick count.
+static ULONG64 GetTimeoutSlot(__in LONGLONG TickCount) {
+  return (ULONG64)TickCount /
+         (DOKAN_CHECK_INTERVAL * 1000ULL * 10 / KeQueryTimeIncrement());
+}
+
+// Files the entry of PendingIrp in the bucket of the timeout wheel of its
+// TickCount. Must be called with PendingIrp.ListLock held whenever TickCount
+// changes.
+VOID DokanTrackPendingIrpTimeout(__in PDokanDCB Dcb, __in PIRP_ENTRY IrpEntry) {
+  ULONG64 slot = GetTimeoutSlot(IrpEntry->TickCount.QuadPart);
+
+  // An interval the timeout thread already went past is checked again on its
+  // next pass through the one it stopped at.
+  if (slot < Dcb->PendingIrpTimeoutNextSlot) {
+    slot = Dcb->PendingIrpTimeoutNextSlot;
+  }
+  RemoveEntryList(&IrpEntry->TimeoutEntry);
+  InsertTailList(&Dcb->PendingIrpTimeoutWheel[slot % DOKAN_TIMEOUT_WHEEL_SIZE],
+                 &IrpEntry->TimeoutEntry);
+}
+
+// Moves the entry of PendingIrp to CompleteList if it timed out or was failed
+// asynchronously. The caller must hold PendingIrp.ListLock.
+static VOID CollectTimeoutPendingIrp(__in PIRP_ENTRY IrpEntry,
+                                     __in PLARGE_INTEGER TickCount,
+                                     __inout PLIST_ENTRY CompleteList) {
+  PIRP irp;
+
+  // If an async operation (like an oplock break or CancelIoEx call from user
+  // mode) has set the AsyncStatus to a failure status, then we clean up that
+  // IRP as if it had timed out but use the status. The normal way an IRP gets
+  // timed out is by its TickCount being too long ago. Returning here means the
+  // IRP is not eligible for cleanup in either way.
+  if (IrpEntry->AsyncStatus == STATUS_SUCCESS &&
+      TickCount->QuadPart < IrpEntry->TickCount.QuadPart) {
+    return;
+  }
+
+  DokanRemoveIrpEntry(IrpEntry);
+
+  DOKAN_LOG_("Timeout Irp %p", IrpEntry->SerialNumber);
+
+  irp = IrpEntry->RequestContext.Irp;
+
+  // Create IRPs (ForcedCanceled) are special in that this routine is always
+  // their place of effective cancellation. So we only care about races with
+  // the cancel routine for other IRPs (which can be effectively canceled in
+  // either place).
+  if (!IrpEntry->RequestContext.ForcedCanceled) {
+    if (irp == NULL) {
+      // Already canceled previously.
+      ASSERT(IrpEntry->CancelRoutineFreeMemory == FALSE);
+      DokanFreeIrpEntry(IrpEntry);
+      return;
+    }
+    if (IoSetCancelRoutine(irp, NULL) == NULL) {
+      // Cancel routine is already destined to run.
+      IrpEntry->CancelRoutineFreeMemory = TRUE;
+      return;
+    }
+  } else {
+    // Cleanup ForcedCanceled IRP of the attached CancelRoutine before
+    // Completion.
+    IoSetCancelRoutine(irp, NULL);
+  }
+
+  // Prevent possible future runs of the cancel routine from doing anything.
+  irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
+
+  InsertTailList(CompleteList, &IrpEntry->ListEntry);
+}
+
+// Completes the pending IRPs that timed out. On the periodic pass, only the
+// buckets of the timeout wheel that are due are looked at. The async failures
+// signaled by ForceTimeoutEvent do not move their entry in the wheel, so that
+// pass goes through the whole PendingIrp list instead.
 NTSTATUS
-ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
+ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb, __in BOOLEAN Forced) {
   KIRQL oldIrql;
   PLIST_ENTRY thisEntry, nextEntry, listHead;
   PIRP_ENTRY irpEntry;
@@ -44,6 +121,8 @@ ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
   PIRP irp;
   BOOLEAN shouldUnmount = FALSE;
   PDokanVCB vcb = Dcb->Vcb;
+  ULONG64 currentSlot;
+  ULONG64 slot;
   DOKAN_INIT_LOGGER(logger, Dcb->DeviceObject->DriverObject, 0);
 
   DOKAN_LOG("Start");
@@ -52,68 +131,57 @@ ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&Dcb->PendingIrp.ListLock, &oldIrql);
 
+  KeQueryTickCount(&tickCount);
+  currentSlot = GetTimeoutSlot(tickCount.QuadPart);
+  if (Dcb->HeartbeatTimeout &&
+      tickCount.QuadPart <
+          InterlockedCompareExchange64(&Dcb->HeartbeatDeadline.QuadPart, 0,
+                                       0)) {
+    // The file system is alive, so only the async failures are collected.
+    // The periodic pass is skipped without moving PendingIrpTimeoutNextSlot,
+    // for the intervals to be checked once the heartbeats stop.
+    if (!Forced) {
+      KeReleaseSpinLock(&Dcb->PendingIrp.ListLock, oldIrql);
+      DOKAN_LOG("File system is alive");
+      return STATUS_SUCCESS;
+    }
+    tickCount.QuadPart = 0;
+  }
+
   // when IRP queue is empty, there is nothing to do
   if (IsListEmpty(&Dcb->PendingIrp.ListHead)) {
+    Dcb->PendingIrpTimeoutNextSlot = currentSlot;
     KeReleaseSpinLock(&Dcb->PendingIrp.ListLock, oldIrql);
     DOKAN_LOG("IrpQueue is Empty");
     return STATUS_SUCCESS;
   }
 
-  KeQueryTickCount(&tickCount);
-
-  // search timeout IRP through pending IRP list
-  listHead = &Dcb->PendingIrp.ListHead;
-
-  for (thisEntry = listHead->Flink; thisEntry != listHead;
-       thisEntry = nextEntry) {
-
-    nextEntry = thisEntry->Flink;
-
-    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
-
-    // If an async operation (like an oplock break or CancelIoEx call from user
-    // mode) has set the AsyncStatus to a failure status, then we clean up that
-    // IRP as if it had timed out but use the status. The normal way an IRP gets
-    // timed out is by its TickCount being too long ago. Continuing here means
-    // the IRP is not eligible for cleanup in either way.
-    if (irpEntry->AsyncStatus == STATUS_SUCCESS &&
-        tickCount.QuadPart < irpEntry->TickCount.QuadPart) {
-      continue;
+  if (Forced) {
+    // search timeout IRP through pending IRP list
+    listHead = &Dcb->PendingIrp.ListHead;
+    for (thisEntry = listHead->Flink; thisEntry != listHead;
+         thisEntry = nextEntry) {
+      nextEntry = thisEntry->Flink;
+      irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
+      CollectTimeoutPendingIrp(irpEntry, &tickCount, &completeList);
     }
-
-    RemoveEntryList(thisEntry);
-
-    DOKAN_LOG_("Timeout Irp %p", irpEntry->SerialNumber);
-
-    irp = irpEntry->RequestContext.Irp;
-
-    // Create IRPs (ForcedCanceled) are special in that this routine is always
-    // their place of effective cancellation. So we only care about races with
-    // the cancel routine for other IRPs (which can be effectively canceled in
-    // either place).
-    if (!irpEntry->RequestContext.ForcedCanceled) {
-      if (irp == NULL) {
-        // Already canceled previously.
-        ASSERT(irpEntry->CancelRoutineFreeMemory == FALSE);
-        DokanFreeIrpEntry(irpEntry);
-        continue;
-      }
-      if (IoSetCancelRoutine(irp, NULL) == NULL) {
-        // Cancel routine is already destined to run.
-        InitializeListHead(&irpEntry->ListEntry);
-        irpEntry->CancelRoutineFreeMemory = TRUE;
-        continue;
+  } else {
+    // Check the intervals elapsed since the last pass, up to a full turn of
+    // the wheel, including the current one which is checked again next time.
+    slot = Dcb->PendingIrpTimeoutNextSlot;
+    if (slot + DOKAN_TIMEOUT_WHEEL_SIZE <= currentSlot) {
+      slot = currentSlot - DOKAN_TIMEOUT_WHEEL_SIZE + 1;
+    }
+    for (; slot <= currentSlot; ++slot) {
+      listHead = &Dcb->PendingIrpTimeoutWheel[slot % DOKAN_TIMEOUT_WHEEL_SIZE];
+      for (thisEntry = listHead->Flink; thisEntry != listHead;
+           thisEntry = nextEntry) {
+        nextEntry = thisEntry->Flink;
+        irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, TimeoutEntry);
+        CollectTimeoutPendingIrp(irpEntry, &tickCount, &completeList);
       }
-    } else {
-      // Cleanup ForcedCanceled IRP of the attached CancelRoutine before
-      // Completion.
-      IoSetCancelRoutine(irp, NULL);
     }
-
-    // Prevent possible future runs of the cancel routine from doing anything.
-    irp->Tail.Overlay.DriverContext[DRIVER_CONTEXT_IRP_ENTRY] = NULL;
-
-    InsertTailList(&completeList, &irpEntry->ListEntry);
+    Dcb->PendingIrpTimeoutNextSlot = currentSlot;
   }
 
   if (IsListEmpty(&Dcb->PendingIrp.ListHead)) {
@@ -143,7 +211,8 @@ ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
           canceled ? STATUS_CANCELLED : STATUS_INSUFFICIENT_RESOURCES);
     } else {
       irp->IoStatus.Information = 0;
-      DokanCompleteIrpRequest(irp, STATUS_INSUFFICIENT_RESOURCES);
+      DokanCompleteMappedIrpRequest(&irpEntry->RequestContext,
+                                    STATUS_INSUFFICIENT_RESOURCES);
     }
     DokanFreeIrpEntry(irpEntry);
   }
@@ -168,7 +237,6 @@ ReleaseTimeoutPendingIrp(__in PDokanDCB Dcb) {
 NTSTATUS
 DokanResetPendingIrpTimeout(__in PREQUEST_CONTEXT RequestContext) {
   KIRQL oldIrql;
-  PLIST_ENTRY thisEntry, nextEntry, listHead;
   PIRP_ENTRY irpEntry;
   PEVENT_INFORMATION eventInfo = NULL;
   ULONG timeout; // in milisecond
@@ -183,24 +251,67 @@ DokanResetPendingIrpTimeout(__in PREQUEST_CONTEXT RequestContext) {
   ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
   KeAcquireSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, &oldIrql);
 
-  // search corresponding IRP through pending IRP list
-  listHead = &RequestContext->Dcb->PendingIrp.ListHead;
+  irpEntry =
+      DokanLookupPendingIrp(RequestContext->Dcb, eventInfo->SerialNumber);
+  if (irpEntry != NULL) {
+    DokanUpdateTimeout(&irpEntry->TickCount, timeout);
+    DokanTrackPendingIrpTimeout(RequestContext->Dcb, irpEntry);
+  }
+  KeReleaseSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, oldIrql);
+  return STATUS_SUCCESS;
+}
 
-  for (thisEntry = listHead->Flink; thisEntry != listHead;
-       thisEntry = nextEntry) {
+// Extends the timeout of all the pending IRPs in one pass, for a file system
+// waiting on a stalled backend. Timeouts already further away are kept.
+NTSTATUS
+DokanResetAllPendingIrpTimeouts(__in PREQUEST_CONTEXT RequestContext) {
+  KIRQL oldIrql;
+  PLIST_ENTRY thisEntry, listHead;
+  PIRP_ENTRY irpEntry;
+  LARGE_INTEGER tickCount;
+  PULONG timeoutBuffer = NULL;
+  ULONG timeout; // in milisecond
+  ULONG count = 0;
 
-    nextEntry = thisEntry->Flink;
+  GET_IRP_BUFFER_OR_RETURN(RequestContext->Irp, timeoutBuffer);
 
-    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
+  timeout = *timeoutBuffer;
+  if (DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX < timeout) {
+    timeout = DOKAN_IRP_PENDING_TIMEOUT_RESET_MAX;
+  }
+  DokanUpdateTimeout(&tickCount, timeout);
 
-    if (irpEntry->SerialNumber != eventInfo->SerialNumber) {
+  ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+  KeAcquireSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, &oldIrql);
+  listHead = &RequestContext->Dcb->PendingIrp.ListHead;
+  for (thisEntry = listHead->Flink; thisEntry != listHead;
+       thisEntry = thisEntry->Flink) {
+    irpEntry = CONTAINING_RECORD(thisEntry, IRP_ENTRY, ListEntry);
+    // A zero TickCount marks a canceled IRP, left for the timeout thread.
+    if (irpEntry->TickCount.QuadPart == 0 ||
+        irpEntry->TickCount.QuadPart >= tickCount.QuadPart) {
       continue;
     }
-
-    DokanUpdateTimeout(&irpEntry->TickCount, timeout);
-    break;
+    irpEntry->TickCount = tickCount;
+    DokanTrackPendingIrpTimeout(RequestContext->Dcb, irpEntry);
+    ++count;
   }
   KeReleaseSpinLock(&RequestContext->Dcb->PendingIrp.ListLock, oldIrql);
+  DOKAN_LOG_FINE_IRP(RequestContext, "Extended %lu pending IRPs by %lu ms",
+                     count, timeout);
+  return STATUS_SUCCESS;
+}
+
+NTSTATUS
+DokanHeartbeat(__in PREQUEST_CONTEXT RequestContext) {
+  LARGE_INTEGER deadline;
+
+  if (!RequestContext->Dcb->HeartbeatTimeout) {
+    return STATUS_INVALID_DEVICE_REQUEST;
+  }
+  DokanUpdateTimeout(&deadline, RequestContext->Dcb->IrpTimeout);
+  InterlockedExchange64(&RequestContext->Dcb->HeartbeatDeadline.QuadPart,
+                        deadline.QuadPart);
   return STATUS_SUCCESS;
 }
 
@@ -245,6 +356,7 @@ Routine Description:
       // KillEvent or something error is occurred
       waitObj = FALSE;
     } else {
+      BOOLEAN forced = (status == STATUS_WAIT_1);
       KeClearEvent(&Dcb->ForceTimeoutEvent);
       // In this case the timer was executed and we are checking if the timer
       // occurred regulary using the period DOKAN_CHECK_INTERVAL. If not, this
@@ -254,7 +366,8 @@ Routine Description:
           ((DOKAN_CHECK_INTERVAL + 2000) * 10000)) {
         DokanLogInfo(&logger, L"Wake from sleep detected.");
       } else {
-        ReleaseTimeoutPendingIrp(Dcb);
+        ReleaseTimeoutPendingIrp(Dcb, forced);
+        DokanCheckWriteBehindTimeout(Dcb, /*Force=*/FALSE);
       }
       KeQuerySystemTime(&LastTime);
     }
@@ -80,6 +80,41 @@ BOOLEAN DokanInitializeFcb(__in PREQUEST_CONTEXT RequestContext,
   return TRUE;
 }
 
+static VOID FreeFcbUpcaseName(__in PDokanFCB Fcb) {
+  if (Fcb->UpcaseFileName.Buffer != NULL) {
+    ExFreePool(Fcb->UpcaseFileName.Buffer);
+  }
+  RtlZeroMemory(&Fcb->UpcaseFileName, sizeof(UNICODE_STRING));
+}
+
+// Sets the name of the FCB along with what DokanCompareFcb orders the FCBs of
+// the volume with: its hash and, unless the volume is case sensitive, its
+// upcased copy. The name is case folded once here instead of on every
+// comparison.
+static VOID SetFcbName(__in PDokanVCB Vcb, __in PDokanFCB Fcb,
+                       __in PUNICODE_STRING FileName) {
+  BOOLEAN caseInsensitive =
+      !(Vcb->Dcb->MountOptions & DOKAN_EVENT_CASE_SENSITIVE);
+  PUNICODE_STRING hashedName = FileName;
+
+  Fcb->FileName = *FileName;
+  RtlZeroMemory(&Fcb->UpcaseFileName, sizeof(UNICODE_STRING));
+  if (caseInsensitive && FileName->Length > 0) {
+    Fcb->UpcaseFileName.Buffer = DokanAlloc(FileName->Length);
+    if (Fcb->UpcaseFileName.Buffer != NULL) {
+      Fcb->UpcaseFileName.MaximumLength = FileName->Length;
+      (VOID)RtlUpcaseUnicodeString(&Fcb->UpcaseFileName, FileName, FALSE);
+      hashedName = &Fcb->UpcaseFileName;
+      caseInsensitive = FALSE;
+    }
+  }
+  Fcb->FileNameHash = 0;
+  // A failure leaves every name with the same hash, which is only slower.
+  (VOID)RtlHashUnicodeString(hashedName, caseInsensitive,
+                             HASH_STRING_ALGORITHM_X65599,
+                             &Fcb->FileNameHash);
+}
+
 PDokanFCB GetOrCreateUninitializedFcb(__in PREQUEST_CONTEXT RequestContext,
                                       __in PUNICODE_STRING FileName,
                                       __in PBOOLEAN NewElement) {
@@ -95,15 +130,17 @@ PDokanFCB GetOrCreateUninitializedFcb(__in PREQUEST_CONTEXT RequestContext,
     return NULL;
   }
   RtlZeroMemory(fcb, sizeof(DokanFCB));
-  fcb->FileName = *FileName;
+  SetFcbName(RequestContext->Vcb, fcb, FileName);
 
   PDokanFCB *fcbInTable = (PDokanFCB *)RtlInsertElementGenericTableAvl(
       &RequestContext->Vcb->FcbTable, &fcb, sizeof(PDokanFCB), NewElement);
   if (!fcbInTable) {
+    FreeFcbUpcaseName(fcb);
     ExFreeToLookasideListEx(&g_DokanFCBLookasideList, fcb);
     return NULL;
   }
   if (!(*NewElement)) {
+    FreeFcbUpcaseName(fcb);
     ExFreeToLookasideListEx(&g_DokanFCBLookasideList, fcb);
   }
   return *fcbInTable;
@@ -128,6 +165,7 @@ PDokanFCB DokanGetFCB(__in PREQUEST_CONTEXT RequestContext,
   }
 
   if (newElement) {
+    ++RequestContext->Vcb->FcbCacheMetrics.Misses;
     DOKAN_LOG_FINE_IRP(RequestContext, "New FCB %p allocated for %wZ", fcb,
                        &fcb->FileName);
     if (!DokanInitializeFcb(RequestContext, fcb)) {
@@ -138,6 +176,7 @@ PDokanFCB DokanGetFCB(__in PREQUEST_CONTEXT RequestContext,
       DOKAN_LOG_FINE_IRP(RequestContext, "Failed to init FCB %p for %wZ", fcb,
                          &fcb->FileName);
       ExFreePool(FileName);
+      FreeFcbUpcaseName(fcb);
       ExFreeToLookasideListEx(&g_DokanFCBLookasideList, fcb);
       DokanVCBUnlock(RequestContext->Vcb);
       return NULL;
@@ -153,6 +192,44 @@ PDokanFCB DokanGetFCB(__in PREQUEST_CONTEXT RequestContext,
   return fcb;
 }
 
+PDokanFCB DokanFindFCB(__in PDokanVCB Vcb, __in PUNICODE_STRING FileName) {
+  PDokanFCB *fcbInTable;
+  // The key only needs what DokanCompareFcb looks at.
+  PDokanFCB key = ExAllocateFromLookasideListEx(&g_DokanFCBLookasideList);
+  if (key == NULL) {
+    return NULL;
+  }
+  SetFcbName(Vcb, key, FileName);
+  fcbInTable =
+      (PDokanFCB *)RtlLookupElementGenericTableAvl(&Vcb->FcbTable, &key);
+  FreeFcbUpcaseName(key);
+  ExFreeToLookasideListEx(&g_DokanFCBLookasideList, key);
+  return fcbInTable != NULL ? *fcbInTable : NULL;
+}
+
+// Memory accounted to an FCB waiting for garbage collection.
+static ULONG64 GetFcbGarbageSize(__in PDokanFCB Fcb) {
+  return sizeof(DokanFCB) + Fcb->FileName.MaximumLength +
+         Fcb->UpcaseFileName.MaximumLength;
+}
+
+VOID GarbageCollectFCB(__in PDokanVCB Vcb, __in PDokanFCB Fcb,
+                       __in BOOLEAN RemoveFromTable);
+
+// Called with the VCB locked. Deletes the least recently scheduled FCBs until
+// the scheduled ones fit in EVENT_START.FcbCacheMemoryLimit, so that bursts of
+// closes do not wait for the timer to give memory back.
+static VOID TrimFcbGarbage(__in PDokanVCB Vcb) {
+  while (Vcb->FcbCacheMetrics.Bytes > Vcb->Dcb->FcbCacheMemoryLimit &&
+         !IsListEmpty(&Vcb->FcbGarbageList)) {
+    ++Vcb->FcbCacheMetrics.Evictions;
+    GarbageCollectFCB(Vcb,
+                      CONTAINING_RECORD(Vcb->FcbGarbageList.Flink, DokanFCB,
+                                        NextGarbageCollectableFcb),
+                      /*RemoveFromTable=*/TRUE);
+  }
+}
+
 NTSTATUS
 DokanFreeFCB(__in PDokanVCB Vcb, __in PDokanFCB Fcb) {
   DOKAN_INIT_LOGGER(logger, Vcb->DeviceObject->DriverObject, 0);
@@ -214,6 +291,7 @@ DokanFreeFCB(__in PDokanVCB Vcb, __in PDokanFCB Fcb) {
     DokanDeleteFcb(Vcb, Fcb, /*RemoveFromTable=*/!Fcb->ReplacedByRename);
   } else {
     DokanFCBUnlock(Fcb);
+    TrimFcbGarbage(Vcb);
   }
 
   DokanVCBUnlock(Vcb);
@@ -237,6 +315,10 @@ VOID DokanDeleteFcb(__in PDokanVCB Vcb, __in PDokanFCB Fcb,
   Fcb->FileName.Buffer = NULL;
   Fcb->FileName.Length = 0;
   Fcb->FileName.MaximumLength = 0;
+  FreeFcbUpcaseName(Fcb);
+
+  DokanFreeSecurityCache(Fcb);
+  DokanFreeReadAhead(Fcb);
 
   FsRtlUninitializeOplock(DokanGetFcbOplock(Fcb));
 
@@ -270,7 +352,10 @@ BOOLEAN DokanScheduleFcbForGarbageCollection(__in PDokanVCB Vcb,
     return TRUE;
   }
   Fcb->GarbageCollectionGracePeriodPassed = FALSE;
+  // The list goes from the least to the most recently used FCB.
   InsertTailList(&Vcb->FcbGarbageList, &Fcb->NextGarbageCollectableFcb);
+  ++Vcb->FcbCacheMetrics.Count;
+  Vcb->FcbCacheMetrics.Bytes += GetFcbGarbageSize(Fcb);
   KeSetEvent(&Vcb->FcbGarbageListNotEmpty, IO_NO_INCREMENT, FALSE);
   return TRUE;
 }
@@ -279,6 +364,9 @@ VOID DokanCancelFcbGarbageCollection(__in PDokanFCB Fcb,
                                      _Inout_ PUNICODE_STRING NewFileName) {
   if (Fcb->NextGarbageCollectableFcb.Flink != NULL) {
     ++Fcb->Vcb->VolumeMetrics.FcbGarbageCollectionCancellations;
+    ++Fcb->Vcb->FcbCacheMetrics.Hits;
+    --Fcb->Vcb->FcbCacheMetrics.Count;
+    Fcb->Vcb->FcbCacheMetrics.Bytes -= GetFcbGarbageSize(Fcb);
     // Update the case of the file name and clear flags. Note that there cannot
     // be concurrent use of an FCB in the GC list while we are in this function.
     ASSERT(Fcb->FileName.Length == NewFileName->Length);
@@ -302,6 +390,8 @@ VOID DokanCancelFcbGarbageCollection(__in PDokanFCB Fcb,
 VOID GarbageCollectFCB(__in PDokanVCB Vcb, __in PDokanFCB Fcb,
                        __in BOOLEAN RemoveFromTable) {
   RemoveEntryList(&Fcb->NextGarbageCollectableFcb);
+  --Vcb->FcbCacheMetrics.Count;
+  Vcb->FcbCacheMetrics.Bytes -= GetFcbGarbageSize(Fcb);
   DokanFCBLockRW(Fcb);
   DokanDeleteFcb(Vcb, Fcb, RemoveFromTable);
 }
@@ -350,6 +440,28 @@ BOOLEAN DokanForceFcbGarbageCollection(__in PDokanVCB Vcb) {
   return TRUE;
 }
 
+VOID DokanReleaseFcbGarbage(__in PDokanVCB Vcb) {
+  ULONG count;
+  BOOLEAN empty;
+
+  if (Vcb->Dcb->FcbGarbageCollectionIntervalMs == 0) {
+    return;
+  }
+  do {
+    DokanVCBLockRW(Vcb);
+    for (count = 0; count < DOKAN_FCB_GARBAGE_RELEASE_BATCH &&
+                    !IsListEmpty(&Vcb->FcbGarbageList);
+         ++count) {
+      GarbageCollectFCB(Vcb,
+                        CONTAINING_RECORD(Vcb->FcbGarbageList.Flink, DokanFCB,
+                                          NextGarbageCollectableFcb),
+                        /*RemoveFromTable=*/TRUE);
+    }
+    empty = IsListEmpty(&Vcb->FcbGarbageList);
+    DokanVCBUnlock(Vcb);
+  } while (!empty);
+}
+
 // Called when there are no pending garbage FCBs and we may need to wait
 // indefinitely for one to appear.
 NTSTATUS WaitForNewFcbGarbage(__in PDokanVCB Vcb) {
@@ -450,11 +562,24 @@ RTL_GENERIC_COMPARE_RESULTS DokanCompareFcb(__in struct _RTL_AVL_TABLE *Table,
   PDokanVCB vcb = (PDokanVCB)Table->TableContext;
   PDokanFCB firstFcb = *(PDokanFCB *)FirstStruct;
   PDokanFCB secondFcb = *(PDokanFCB *)SecondStruct;
-  LONG result = RtlCompareUnicodeString(
-      &firstFcb->FileName, &secondFcb->FileName,
-      !(vcb->Dcb->MountOptions & DOKAN_EVENT_CASE_SENSITIVE));
-  DOKAN_LOG_VCB(vcb, "First: %p %wZ Second: %p %wZ - Result: %ld", firstFcb,
-                &firstFcb->FileName, secondFcb, &secondFcb->FileName, result);
+  LONG result;
+  // The table is ordered by hash first, so that the names are only compared
+  // for the FCB being looked up in the common case.
+  if (firstFcb->FileNameHash != secondFcb->FileNameHash) {
+    return firstFcb->FileNameHash < secondFcb->FileNameHash
+               ? GenericLessThan
+               : GenericGreaterThan;
+  }
+  if (firstFcb->UpcaseFileName.Buffer != NULL &&
+      secondFcb->UpcaseFileName.Buffer != NULL) {
+    // Same order as the case insensitive comparison of the names.
+    result = RtlCompareUnicodeString(&firstFcb->UpcaseFileName,
+                                     &secondFcb->UpcaseFileName, FALSE);
+  } else {
+    result = RtlCompareUnicodeString(
+        &firstFcb->FileName, &secondFcb->FileName,
+        !(vcb->Dcb->MountOptions & DOKAN_EVENT_CASE_SENSITIVE));
+  }
   if (result < 0) {
     return GenericLessThan;
   } else if (result > 0) {
@@ -482,18 +607,12 @@ VOID DokanFreeFcbAvl(__in struct _RTL_AVL_TABLE *Table, __in PVOID Buffer) {
   ExFreeToLookasideListEx(&vcb->FCBAvlNodeLookasideList, Buffer);
 }
 
-VOID DokanRenameFcb(__in PREQUEST_CONTEXT RequestContext, __in PDokanFCB Fcb,
-                    __in PWCH FileName, __in USHORT FileNameLength) {
-  BOOLEAN removed =
-      RtlDeleteElementGenericTableAvl(&RequestContext->Vcb->FcbTable, &Fcb);
-  ASSERT(removed);
-  UNREFERENCED_PARAMETER(removed);
-
-  Fcb->FileName = DokanWrapUnicodeString(FileName, FileNameLength);
-
+// Inserts in the table of the volume an FCB whose name changed. An FCB already
+// in the table with the same name is replaced.
+static VOID InsertRenamedFcb(__in PDokanVCB Vcb, __in PDokanFCB Fcb) {
   BOOLEAN newElement = FALSE;
   PDokanFCB *fcbInTable = (PDokanFCB *)RtlInsertElementGenericTableAvl(
-      &RequestContext->Vcb->FcbTable, &Fcb, sizeof(PDokanFCB), &newElement);
+      &Vcb->FcbTable, &Fcb, sizeof(PDokanFCB), &newElement);
   ASSERT(fcbInTable);
   if (newElement) {
     return;
@@ -505,8 +624,7 @@ VOID DokanRenameFcb(__in PREQUEST_CONTEXT RequestContext, __in PDokanFCB Fcb,
   // removed to allow the new Fcb to take over.
   if (conflictingFcb->NextGarbageCollectableFcb.Flink) {
     // The Fcb is pending GC. Force it's deletion now.
-    GarbageCollectFCB(RequestContext->Vcb, conflictingFcb,
-                      /*RemoveFromTable=*/FALSE);
+    GarbageCollectFCB(Vcb, conflictingFcb, /*RemoveFromTable=*/FALSE);
   } else {
     // This cannot happen on NTFS. See Fcb::PendingDeletion doc.
     conflictingFcb->ReplacedByRename = TRUE;
@@ -514,4 +632,132 @@ VOID DokanRenameFcb(__in PREQUEST_CONTEXT RequestContext, __in PDokanFCB Fcb,
 
   // Reinsert the Fcb with the updated name
   *fcbInTable = Fcb;
-}
\ No newline at end of file
+}
+
+// Whether the FCB is below the directory or one of its streams. The upcased
+// names are compared when both exist, in the order used by DokanCompareFcb.
+static BOOLEAN IsFcbDescendant(__in PDokanVCB Vcb, __in PDokanFCB Fcb,
+                               __in PUNICODE_STRING DirectoryName,
+                               __in PUNICODE_STRING UpcaseDirectoryName) {
+  WCHAR separator;
+  if (Fcb->FileName.Length <= DirectoryName->Length) {
+    return FALSE;
+  }
+  separator = Fcb->FileName.Buffer[DirectoryName->Length / sizeof(WCHAR)];
+  if (separator != L'\\' && separator != L':') {
+    return FALSE;
+  }
+  if (Fcb->UpcaseFileName.Buffer != NULL &&
+      UpcaseDirectoryName->Buffer != NULL) {
+    return RtlEqualMemory(Fcb->UpcaseFileName.Buffer,
+                          UpcaseDirectoryName->Buffer,
+                          UpcaseDirectoryName->Length);
+  }
+  return RtlPrefixUnicodeString(
+      DirectoryName, &Fcb->FileName,
+      !(Vcb->Dcb->MountOptions & DOKAN_EVENT_CASE_SENSITIVE));
+}
+
+// Gives the FCBs below a renamed directory the names under its new one, so
+// that the requests on the files still open in it carry their new paths
+// instead of being fixed up later. The unused FCBs waiting for garbage
+// collection are deleted instead. Called with the VCB locked.
+static VOID RenameFcbDescendants(__in PDokanVCB Vcb,
+                                 __in PUNICODE_STRING OldFileName,
+                                 __in PUNICODE_STRING OldUpcaseFileName,
+                                 __in PUNICODE_STRING NewFileName) {
+  PDokanFCB *descendants;
+  PDokanFCB *fcbInTable;
+  ULONG count = 0;
+  ULONG renamed = 0;
+
+  // The table cannot be changed while enumerated, so the descendants are
+  // collected first.
+  for (fcbInTable = (PDokanFCB *)RtlEnumerateGenericTableAvl(&Vcb->FcbTable,
+                                                            /*Restart=*/TRUE);
+       fcbInTable != NULL;
+       fcbInTable = (PDokanFCB *)RtlEnumerateGenericTableAvl(
+           &Vcb->FcbTable, /*Restart=*/FALSE)) {
+    if (IsFcbDescendant(Vcb, *fcbInTable, OldFileName, OldUpcaseFileName)) {
+      ++count;
+    }
+  }
+  if (count == 0) {
+    return;
+  }
+  descendants = DokanAlloc(count * sizeof(PDokanFCB));
+  if (descendants == NULL) {
+    DOKAN_LOG_("Failed to allocate the %lu FCBs below \"%wZ\" renamed \"%wZ\"",
+               count, OldFileName, NewFileName);
+    return;
+  }
+  count = 0;
+  for (fcbInTable = (PDokanFCB *)RtlEnumerateGenericTableAvl(&Vcb->FcbTable,
+                                                            /*Restart=*/TRUE);
+       fcbInTable != NULL;
+       fcbInTable = (PDokanFCB *)RtlEnumerateGenericTableAvl(
+           &Vcb->FcbTable, /*Restart=*/FALSE)) {
+    if (IsFcbDescendant(Vcb, *fcbInTable, OldFileName, OldUpcaseFileName)) {
+      descendants[count++] = *fcbInTable;
+    }
+  }
+
+  for (ULONG i = 0; i < count; ++i) {
+    PDokanFCB fcb = descendants[i];
+    ULONG length =
+        NewFileName->Length + fcb->FileName.Length - OldFileName->Length;
+    PWCH buffer;
+    UNICODE_STRING newFileName;
+
+    if (fcb->NextGarbageCollectableFcb.Flink != NULL) {
+      GarbageCollectFCB(Vcb, fcb, /*RemoveFromTable=*/TRUE);
+      continue;
+    }
+    if (length > MAXUSHORT - sizeof(WCHAR) ||
+        (buffer = DokanAllocZero(length + sizeof(WCHAR))) == NULL) {
+      DOKAN_LOG_("Failed to rename FCB %p \"%wZ\"", fcb, &fcb->FileName);
+      continue;
+    }
+    RtlCopyMemory(buffer, NewFileName->Buffer, NewFileName->Length);
+    RtlCopyMemory((PCHAR)buffer + NewFileName->Length,
+                  (PCHAR)fcb->FileName.Buffer + OldFileName->Length,
+                  fcb->FileName.Length - OldFileName->Length);
+    newFileName = DokanWrapUnicodeString(buffer, (USHORT)length);
+
+    DokanFCBLockRW(fcb);
+    BOOLEAN removed = RtlDeleteElementGenericTableAvl(&Vcb->FcbTable, &fcb);
+    ASSERT(removed);
+    UNREFERENCED_PARAMETER(removed);
+    ExFreePool(fcb->FileName.Buffer);
+    FreeFcbUpcaseName(fcb);
+    SetFcbName(Vcb, fcb, &newFileName);
+    InsertRenamedFcb(Vcb, fcb);
+    DokanFCBUnlock(fcb);
+    ++renamed;
+  }
+  ExFreePool(descendants);
+  DOKAN_LOG_("Renamed %lu FCBs below \"%wZ\"", renamed, NewFileName);
+}
+
+VOID DokanRenameFcb(__in PREQUEST_CONTEXT RequestContext, __in PDokanFCB Fcb,
+                    __in PWCH FileName, __in USHORT FileNameLength) {
+  PDokanVCB vcb = RequestContext->Vcb;
+  BOOLEAN removed = RtlDeleteElementGenericTableAvl(&vcb->FcbTable, &Fcb);
+  ASSERT(removed);
+  UNREFERENCED_PARAMETER(removed);
+
+  // The old name is freed by the caller.
+  UNICODE_STRING oldFileName = Fcb->FileName;
+  UNICODE_STRING oldUpcaseFileName = Fcb->UpcaseFileName;
+  UNICODE_STRING newFileName = DokanWrapUnicodeString(FileName, FileNameLength);
+  SetFcbName(vcb, Fcb, &newFileName);
+  InsertRenamedFcb(vcb, Fcb);
+
+  if (DokanFCBFlagsIsSet(Fcb, DOKAN_FILE_DIRECTORY)) {
+    RenameFcbDescendants(vcb, &oldFileName, &oldUpcaseFileName,
+                         &Fcb->FileName);
+  }
+  if (oldUpcaseFileName.Buffer != NULL) {
+    ExFreePool(oldUpcaseFileName.Buffer);
+  }
+}
@@ -37,6 +37,10 @@ DokanFreeFCB(__in PDokanVCB Vcb, __in PDokanFCB Fcb);
 PDokanFCB DokanGetFCB(__in PREQUEST_CONTEXT RequestContext,
                       __in PWCHAR FileName, __in ULONG FileNameLength);
 
+// Returns the FCB of FileName in the table of the volume, or NULL if there is
+// none. It must be called with the VCB locked.
+PDokanFCB DokanFindFCB(__in PDokanVCB Vcb, __in PUNICODE_STRING FileName);
+
 // Starts the FCB garbage collector thread for the given volume. If the
 // Vcb->FcbGarbageCollectorThread is NULL after this then it could not be
 // started.
@@ -62,6 +66,14 @@ VOID DokanCancelFcbGarbageCollection(__in PDokanFCB Fcb,
 // deleted as a consequence. This must be called with the VCB locked RW.
 BOOLEAN DokanForceFcbGarbageCollection(__in PDokanVCB Vcb);
 
+// Most FCBs deleted by DokanReleaseFcbGarbage per hold of the VCB lock.
+#define DOKAN_FCB_GARBAGE_RELEASE_BATCH 1024
+
+// Deletes all the FCBs scheduled for garbage collection, by batches of
+// DOKAN_FCB_GARBAGE_RELEASE_BATCH. Called at unmount once the garbage
+// collector thread is stopped.
+VOID DokanReleaseFcbGarbage(__in PDokanVCB Vcb);
+
 // Deletes the given FCB with no questions asked. This should only be used as a
 // helper by e.g. the garbage collector, and not by an I/O handling function.
 // The VCB and FCB must both be locked RW when this is called. After it returns,
@@ -83,7 +95,8 @@ PVOID DokanAllocateFcbAvl(__in struct _RTL_AVL_TABLE* Table,
 // Deallocation callback routine for the AVL table.
 VOID DokanFreeFcbAvl(__in struct _RTL_AVL_TABLE* Table, __in PVOID Buffer);
 
-// Update the filename of the given Fcb.
+// Update the filename of the given Fcb, and of the Fcbs below it when it is a
+// directory.
 // The Vcb & Fcb must be acquired priore to the call.
 VOID DokanRenameFcb(__in PREQUEST_CONTEXT Request, __in PDokanFCB Fcb,
                     __in PWCH FileName, __in USHORT FileNameLength);
@@ -79,6 +79,11 @@ PVOID GetInputBuffer(_In_ PIRP Irp);
            (DokanUnicodeString)->MaximumLength) > (BufferLen) ||           \
    (DokanUnicodeString)->Length > (DokanUnicodeString)->MaximumLength)
 
+#define DOKAN_VOLUME_INFO_UPDATE_SIZE_COMPARE(VolumeInfoUpdate, BufferLen) \
+  (GENERIC_SIZE_COMPARE(VolumeInfoUpdate, BufferLen) ||                  \
+   (ULONG)(FIELD_OFFSET(DOKAN_VOLUME_INFO_UPDATE, Buffer[0]) +           \
+           (VolumeInfoUpdate)->Length) > (BufferLen))
+
 // Exit types in size check failure
 #define DOKAN_EXIT_NONE(Irp, Status, InformationSize)
 
@@ -118,6 +123,11 @@ PVOID GetInputBuffer(_In_ PIRP Irp);
                             DOKAN_EXIT_RETURN, STATUS_BUFFER_TOO_SMALL, 0)
 
 // DOKAN_UNICODE_STRING_INTERMEDIATE
+#define GET_IRP_VOLUME_INFO_UPDATE_OR_RETURN(Irp, Buffer)                  \
+  GET_IRP_GENERIC_BUFFER_EX(Irp, Buffer,                                \
+                            DOKAN_VOLUME_INFO_UPDATE_SIZE_COMPARE,      \
+                            DOKAN_EXIT_RETURN, STATUS_BUFFER_TOO_SMALL, 0)
+
 #define GET_IRP_UNICODE_STRING_INTERMEDIATE_OR_RETURN(Irp, Buffer)          \
   GET_IRP_GENERIC_BUFFER_EX(Irp, Buffer,                                    \
                             DOKAN_UNICODE_STRING_INTERMEDIATE_SIZE_COMPARE, \
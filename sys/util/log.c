@@ -22,6 +22,7 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #define _NO_CRT_STDIO_INLINE
 
 #include "../dokan.h"
+#include "irp_buffer_helper.h"
 #include "log.h"
 
 #include <mountdev.h>
@@ -37,17 +38,48 @@ ULONG g_Debug = DOKAN_DEBUG_DEFAULT;
 BOOLEAN g_DokanDriverLogCacheEnabled = FALSE;
 // Number of current Dokan Volume having Drive log caching enabled.
 LONG g_DokanVcbDriverLogCacheCount = 0;
-DOKAN_LOG_CACHE g_DokanLogEntryList;
 
-VOID PopDokanLogEntry(_In_opt_ PVOID RequestContext, _In_ PDokanVCB Vcb);
+// Number of messages a processor ring holds before overwriting the oldest.
+#define DOKAN_LOG_RING_SIZE 128
+
+typedef struct _DOKAN_LOG_RING_SLOT {
+  // Ticket of the record held, its opposite while a writer fills the slot, or 0
+  // if it was never written.
+  volatile LONG64 Sequence;
+  DOKAN_LOG_RECORD Record;
+} DOKAN_LOG_RING_SLOT, *PDOKAN_LOG_RING_SLOT;
+
+typedef struct _DOKAN_LOG_RING {
+  // Last ticket handed out to a writer. Ticket N goes to the slot
+  // (N - 1) % DOKAN_LOG_RING_SIZE.
+  volatile LONG64 Head;
+  DOKAN_LOG_RING_SLOT Slots[DOKAN_LOG_RING_SIZE];
+} DOKAN_LOG_RING, *PDOKAN_LOG_RING;
+
+typedef struct _DOKAN_LOG_RINGS {
+  ULONG Count;
+  DOKAN_LOG_RING Rings[1];
+} DOKAN_LOG_RINGS, *PDOKAN_LOG_RINGS;
+
+// State of FSCTL_GET_DRIVER_LOGS for one ring.
+typedef struct _DOKAN_LOG_RING_READER {
+  LONG64 Next;
+  LONG64 Head;
+  BOOLEAN Valid;
+  DOKAN_LOG_RECORD Record;
+} DOKAN_LOG_RING_READER, *PDOKAN_LOG_RING_READER;
+
+// One ring per processor, allocated when the first volume dispatching driver
+// logs is mounted. Writers only reserve a slot of the ring of their processor
+// by incrementing its head, so logging takes no lock and allocates nothing.
+static PDOKAN_LOG_RINGS volatile g_DokanLogRings = NULL;
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, PushDokanLogEntry)
-#pragma alloc_text(PAGE, PopDokanLogEntry)
 #pragma alloc_text(PAGE, CleanDokanLogEntry)
+#pragma alloc_text(PAGE, DokanGetDriverLogs)
 #endif
 
-#define DOKAN_LOG_MAX_ENTRY_CACHED 1024
-
 #define DOKAN_LOG_MAX_CHAR_COUNT 2048
 #define DOKAN_LOG_MAX_PACKET_BYTES \
   (ERROR_LOG_MAXIMUM_SIZE - sizeof(IO_ERROR_LOG_PACKET))
@@ -489,116 +521,103 @@ PCHAR DokanGetIoctlStr(ULONG ControlCode) {
     CASE_STR(FSCTL_GET_VOLUME_METRICS)
     CASE_STR(FSCTL_MOUNTPOINT_CLEANUP)
     CASE_STR(FSCTL_EVENT_PROCESS_N_PULL)
+    CASE_STR(FSCTL_EVENT_RING_REGISTER)
+    CASE_STR(FSCTL_EVENT_RING_DOORBELL)
+    CASE_STR(FSCTL_GET_VOLUME_METRICS_EX)
+    CASE_STR(FSCTL_UPDATE_VOLUME_INFO)
+    CASE_STR(FSCTL_BREAK_LEASE)
+    CASE_STR(FSCTL_GET_DRIVER_LOGS)
+    CASE_STR(FSCTL_NOTIFY_PATH_BATCH)
+    CASE_STR(FSCTL_MOUNTPOINT_LIST_CHANGE)
+    CASE_STR(FSCTL_EVENT_PULL_ASYNC)
+    CASE_STR(FSCTL_ECHO)
+    CASE_STR(FSCTL_GET_VOLUME_PROFILE)
 #include "ioctl.inc"
   }
   return "Unknown";
 }
 
+// Send a volume log to the file system as a DOKAN_IRP_LOG_MESSAGE event.
+static VOID DispatchDokanLogRecord(_In_ PREQUEST_CONTEXT RequestContext,
+                                   _In_ PDOKAN_LOG_RECORD Record) {
+  PDOKAN_LOG_MESSAGE dokanLogString;
+  ULONG messageFullSize =
+      Record->MessageLength + FIELD_OFFSET(DOKAN_LOG_MESSAGE, Message[0]);
+  PEVENT_CONTEXT eventContext =
+      AllocateEventContextRaw(sizeof(EVENT_CONTEXT) + messageFullSize);
+  if (!eventContext) {
+    return;
+  }
+  eventContext->MountId = RequestContext->Vcb->Dcb->MountId;
+  eventContext->MajorFunction = DOKAN_IRP_LOG_MESSAGE;
+  dokanLogString =
+      (PDOKAN_LOG_MESSAGE)((PCHAR)eventContext + sizeof(EVENT_CONTEXT));
+  dokanLogString->MessageLength = Record->MessageLength;
+  RtlCopyMemory(dokanLogString->Message, Record->Message,
+                Record->MessageLength);
+  DokanEventNotification(RequestContext, eventContext);
+}
+
 VOID PushDokanLogEntry(_In_opt_ PVOID RequestContext, _In_ PCSTR Format, ...) {
   PREQUEST_CONTEXT requestContext = RequestContext;
-  PDOKAN_LOG_ENTRY logEntry;
+  PDOKAN_LOG_RINGS rings = g_DokanLogRings;
+  PDOKAN_LOG_RING ring;
+  PDOKAN_LOG_RING_SLOT slot;
+  PDOKAN_LOG_RECORD record;
+  ULONG processor;
+  LONG64 ticket;
+  LONG64 previous;
+  LARGE_INTEGER time;
+  BOOLEAN isVolumeLog;
 
   PAGED_CODE();
 
+  isVolumeLog =
+      requestContext && requestContext->Vcb && requestContext->Vcb->Dcb;
   // Is that a global log or a Vcb log that has driver log disptached
   // enabled ?
-  if (requestContext && requestContext->Vcb && requestContext->Vcb->Dcb &&
-      !requestContext->Vcb->Dcb->DispatchDriverLogs) {
+  if ((isVolumeLog && !requestContext->Vcb->Dcb->DispatchDriverLogs) ||
+      !rings) {
     return;
   }
 
-  __try {
-    DokanResourceLockRW(&(g_DokanLogEntryList.Resource));
-    if (g_DokanLogEntryList.NumberOfCachedEntries >=
-        DOKAN_LOG_MAX_ENTRY_CACHED) {
-      ASSERT(!IsListEmpty(&g_DokanLogEntryList.Log));
-      PLIST_ENTRY listEntry = g_DokanLogEntryList.Log.Flink;
-      RemoveEntryList(listEntry);
-      logEntry = CONTAINING_RECORD(listEntry, DOKAN_LOG_ENTRY, ListEntry);
-      ExFreePool(logEntry);
-      --g_DokanLogEntryList.NumberOfCachedEntries;
-    }
-
-    logEntry =
-        DokanAllocZero(sizeof(DOKAN_LOG_ENTRY) + DOKAN_LOG_MAX_CHAR_COUNT);
-    if (!logEntry) {
-      DOKAN_NO_CACHE_LOG("Failed to allocate DOKAN_LOG_ENTRY");
-      __leave;
-    }
-    InitializeListHead(&logEntry->ListEntry);
-    if (requestContext) {
-      logEntry->Vcb = requestContext->Vcb;
-    }
-
-    PSTR ppszDestEnd = NULL;
-    va_list args;
-    va_start(args, Format);
-    NTSTATUS status =
-        RtlStringCchVPrintfExA(logEntry->Log.Message, DOKAN_LOG_MAX_CHAR_COUNT,
-                               &ppszDestEnd, NULL, 0, Format, args);
-    logEntry->Log.MessageLength = (ULONG)(ppszDestEnd - logEntry->Log.Message);
-    va_end(args);
-    if (status != STATUS_SUCCESS && status != STATUS_BUFFER_OVERFLOW) {
-      ExFreePool(logEntry);
-      __leave;
-    }
-
-    ++g_DokanLogEntryList.NumberOfCachedEntries;
-    InsertTailList(&g_DokanLogEntryList.Log, &logEntry->ListEntry);
-
-    if (requestContext && requestContext->Vcb && requestContext->Vcb->Dcb) {
-      PopDokanLogEntry(requestContext, requestContext->Vcb);
-    }
-  } __finally {
-    DokanResourceUnlock(&(g_DokanLogEntryList.Resource));
+  processor = KeGetCurrentProcessorNumberEx(NULL);
+  ring = &rings->Rings[processor % rings->Count];
+  ticket = InterlockedIncrement64(&ring->Head);
+  slot = &ring->Slots[(ticket - 1) % DOKAN_LOG_RING_SIZE];
+  // The oldest message is overwritten, unless a writer that was preempted a
+  // whole ring ago still fills the slot, in which case this one is dropped.
+  previous = InterlockedCompareExchange64(&slot->Sequence, 0, 0);
+  if (previous < 0 || InterlockedCompareExchange64(&slot->Sequence, -ticket,
+                                                   previous) != previous) {
+    return;
   }
-}
 
-// Dispatch global and specific Vcb log messages from global
-// log entry cache list to userland.
-// Need to be called with g_DokanLogEntryList Lock RW.
-VOID PopDokanLogEntry(_In_opt_ PVOID RequestContext, _In_ PDokanVCB Vcb) {
-  PLIST_ENTRY listEntry;
-  PLIST_ENTRY nextListEntry;
-  PDOKAN_LOG_ENTRY logEntry;
-  PDOKAN_LOG_MESSAGE dokanLogString;
-  ULONG messageFullSize;
+  record = &slot->Record;
+  DokanQuerySystemTime(&time);
+  record->Time = time.QuadPart;
+  record->MountId = isVolumeLog ? requestContext->Vcb->Dcb->MountId : 0;
+  record->IsVolumeLog = isVolumeLog;
+  record->Processor = (USHORT)processor;
 
-  PAGED_CODE();
-
-  listEntry = g_DokanLogEntryList.Log.Flink;
-  while (listEntry != &(g_DokanLogEntryList.Log)) {
-    logEntry = CONTAINING_RECORD(listEntry, DOKAN_LOG_ENTRY, ListEntry);
-
-    // Only Pop global and the Vcb logs.
-    if (logEntry->Vcb != NULL && logEntry->Vcb != Vcb) {
-      listEntry = listEntry->Flink;
-      continue;
-    }
-
-    messageFullSize = logEntry->Log.MessageLength +
-                      FIELD_OFFSET(DOKAN_LOG_MESSAGE, Message[0]);
-    PEVENT_CONTEXT eventContext =
-        AllocateEventContextRaw(sizeof(EVENT_CONTEXT) + messageFullSize);
-    if (!eventContext) {
-      return;
-    }
-    eventContext->MountId = Vcb->Dcb->MountId;
-    eventContext->MajorFunction = DOKAN_IRP_LOG_MESSAGE;
-    dokanLogString = (PDOKAN_LOG_MESSAGE)((PCHAR)(PCHAR)eventContext +
-                                          sizeof(EVENT_CONTEXT));
-    RtlCopyMemory(dokanLogString, &logEntry->Log, messageFullSize);
-    if (RequestContext) {
-      DokanEventNotification(RequestContext, &Vcb->Dcb->NotifyEvent,
-                             eventContext);
-    }
+  PSTR ppszDestEnd = NULL;
+  va_list args;
+  va_start(args, Format);
+  NTSTATUS status = RtlStringCchVPrintfExA(record->Message,
+                                           DOKAN_LOG_RECORD_MESSAGE_SIZE,
+                                           &ppszDestEnd, NULL, 0, Format, args);
+  va_end(args);
+  if (status != STATUS_SUCCESS && status != STATUS_BUFFER_OVERFLOW) {
+    // Left unpublished, so that readers skip it.
+    InterlockedExchange64(&slot->Sequence, 0);
+    return;
+  }
+  record->MessageLength = (ULONG)(ppszDestEnd - record->Message);
 
-    nextListEntry = listEntry->Flink;
-    RemoveEntryList(listEntry);
-    ExFreePool(logEntry);
-    --g_DokanLogEntryList.NumberOfCachedEntries;
-    listEntry = nextListEntry;
+  if (isVolumeLog) {
+    DispatchDokanLogRecord(requestContext, record);
   }
+  InterlockedExchange64(&slot->Sequence, ticket);
 }
 
 // Is it a global log (NULL IRP) and we have the global cache enabled or it is a
@@ -609,6 +628,20 @@ BOOLEAN IsLogCacheEnabled(_In_opt_ PVOID RequestContext) {
 }
 
 VOID IncrementVcbLogCacheCount() {
+  if (!g_DokanLogRings) {
+    ULONG count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    PDOKAN_LOG_RINGS rings = DokanAllocZero(
+        FIELD_OFFSET(DOKAN_LOG_RINGS, Rings) + count * sizeof(DOKAN_LOG_RING));
+    if (!rings) {
+      DOKAN_NO_CACHE_LOG("Failed to allocate the log rings");
+    } else {
+      rings->Count = count;
+      if (InterlockedCompareExchangePointer((PVOID volatile *)&g_DokanLogRings,
+                                            rings, NULL) != NULL) {
+        ExFreePool(rings);
+      }
+    }
+  }
   InterlockedIncrement(&g_DokanVcbDriverLogCacheCount);
   if (!g_DokanDriverLogCacheEnabled) {
     g_DokanDriverLogCacheEnabled = TRUE;
@@ -616,9 +649,6 @@ VOID IncrementVcbLogCacheCount() {
 }
 
 VOID CleanDokanLogEntry(_In_ PVOID Vcb) {
-  PLIST_ENTRY listEntry;
-  PLIST_ENTRY nextListEntry;
-  PDOKAN_LOG_ENTRY logEntry;
   PDokanVCB vcb = Vcb;
 
   PAGED_CODE();
@@ -627,26 +657,90 @@ VOID CleanDokanLogEntry(_In_ PVOID Vcb) {
     return;
   }
 
+  // The records of the volume are left to be overwritten in the rings.
   InterlockedDecrement(&g_DokanVcbDriverLogCacheCount);
+}
 
-  __try {
-    DokanResourceLockRW(&(g_DokanLogEntryList.Resource));
-    listEntry = g_DokanLogEntryList.Log.Flink;
-    while (listEntry != &(g_DokanLogEntryList.Log)) {
-      logEntry = CONTAINING_RECORD(listEntry, DOKAN_LOG_ENTRY, ListEntry);
-
-      if (logEntry->Vcb != Vcb) {
-        listEntry = listEntry->Flink;
-        continue;
-      }
+VOID DokanFreeLogRings() {
+  if (g_DokanLogRings) {
+    ExFreePool(g_DokanLogRings);
+    g_DokanLogRings = NULL;
+  }
+}
+
+// Copy to the reader the next published record of Ring newer than Cursor, if
+// any is left up to the head it started from.
+static VOID ReadNextDokanLogRecord(_In_ PDOKAN_LOG_RING Ring,
+                                   _Inout_ PDOKAN_LOG_RING_READER Reader,
+                                   _In_ LONGLONG Cursor) {
+  Reader->Valid = FALSE;
+  while (!Reader->Valid && Reader->Next <= Reader->Head) {
+    LONG64 ticket = Reader->Next++;
+    PDOKAN_LOG_RING_SLOT slot =
+        &Ring->Slots[(ticket - 1) % DOKAN_LOG_RING_SIZE];
+    // Overwritten, or still being written.
+    if (InterlockedCompareExchange64(&slot->Sequence, 0, 0) != ticket) {
+      continue;
+    }
+    RtlCopyMemory(&Reader->Record, &slot->Record, sizeof(DOKAN_LOG_RECORD));
+    // A writer may have taken the slot during the copy.
+    Reader->Valid =
+        InterlockedCompareExchange64(&slot->Sequence, 0, 0) == ticket &&
+        Reader->Record.Time > Cursor;
+  }
+}
+
+NTSTATUS DokanGetDriverLogs(_In_ PVOID RequestContext) {
+  PREQUEST_CONTEXT requestContext = RequestContext;
+  PDOKAN_LOG_RINGS rings = g_DokanLogRings;
+  PDOKAN_LOG_RING_READER readers;
+  PDOKAN_LOG_RECORD records;
+  PLONGLONG cursorBuffer = NULL;
+  LONGLONG cursor;
+  ULONG count = 0;
+  ULONG i;
+
+  PAGED_CODE();
 
-      nextListEntry = listEntry->Flink;
-      RemoveEntryList(listEntry);
-      ExFreePool(logEntry);
-      --g_DokanLogEntryList.NumberOfCachedEntries;
-      listEntry = nextListEntry;
+  GET_IRP_BUFFER_OR_RETURN(requestContext->Irp, cursorBuffer);
+  cursor = *cursorBuffer;
+  if (!rings) {
+    return STATUS_SUCCESS;
+  }
+  readers = DokanAllocZero(rings->Count * sizeof(DOKAN_LOG_RING_READER));
+  if (!readers) {
+    return STATUS_INSUFFICIENT_RESOURCES;
+  }
+  for (i = 0; i < rings->Count; ++i) {
+    readers[i].Head = InterlockedCompareExchange64(&rings->Rings[i].Head, 0, 0);
+    readers[i].Next = readers[i].Head > DOKAN_LOG_RING_SIZE
+                          ? readers[i].Head - DOKAN_LOG_RING_SIZE + 1
+                          : 1;
+    ReadNextDokanLogRecord(&rings->Rings[i], &readers[i], cursor);
+  }
+
+  // Merge the rings from the oldest record to the newest, so that the caller
+  // can pass the time of the last one as the cursor of its next call.
+  records = (PDOKAN_LOG_RECORD)requestContext->Irp->AssociatedIrp.SystemBuffer;
+  for (;;) {
+    PDOKAN_LOG_RING_READER oldest = NULL;
+    ULONG oldestIndex = 0;
+    for (i = 0; i < rings->Count; ++i) {
+      if (readers[i].Valid &&
+          (!oldest || readers[i].Record.Time < oldest->Record.Time)) {
+        oldest = &readers[i];
+        oldestIndex = i;
+      }
     }
-  } __finally {
-    DokanResourceUnlock(&(g_DokanLogEntryList.Resource));
+    if (!oldest || !ExtendOutputBufferBySize(
+                       requestContext->Irp, sizeof(DOKAN_LOG_RECORD),
+                       /*UpdateInformationOnFailure=*/FALSE)) {
+      break;
+    }
+    RtlCopyMemory(&records[count++], &oldest->Record, sizeof(DOKAN_LOG_RECORD));
+    ReadNextDokanLogRecord(&rings->Rings[oldestIndex], oldest, cursor);
   }
+  ExFreePool(readers);
+  DOKAN_LOG_FINE_IRP(requestContext, "Returned %lu driver logs", count);
+  return STATUS_SUCCESS;
 }
@@ -32,35 +32,28 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 // Whether DbgPrint is enabled or not.
 extern ULONG g_Debug;
 
-typedef struct _DOKAN_LOG_ENTRY {
-  LIST_ENTRY ListEntry;
-  PVOID Vcb;
-  DOKAN_LOG_MESSAGE Log;
-} DOKAN_LOG_ENTRY, *PDOKAN_LOG_ENTRY;
-
-typedef struct _DOKAN_LOG_CACHE {
-  LONG NumberOfCachedEntries;
-  ERESOURCE Resource;
-  LIST_ENTRY Log;
-} DOKAN_LOG_CACHE, *PDOKAN_LOG_CACHE;
-
-// Global cache for driver global and specific volume logs.
-extern DOKAN_LOG_CACHE g_DokanLogEntryList;
-
-// Push log into the global log entry cache list.
+// Push log into the log ring of the current processor, and dispatch it to the
+// volume if it is a volume log.
 VOID PushDokanLogEntry(_In_opt_ PVOID RequestContext,
                        _In_ PCSTR Format, ...);
 
-// Remove all logs attached to a specific volume from the global cache.
+// Stop caching the logs of a specific volume.
 VOID CleanDokanLogEntry(_In_ PVOID Vcb);
 
+// Copy the ring records newer than the input cursor to the output buffer of
+// FSCTL_GET_DRIVER_LOGS.
+NTSTATUS DokanGetDriverLogs(_In_ PVOID RequestContext);
+
+// Free the log rings. Called at driver unload.
+VOID DokanFreeLogRings();
+
 // Whether the IRP log should be cached.
 // Used as an early check to unnecessary avoid computing the arguments when it
 // is not needed.
 BOOLEAN IsLogCacheEnabled(_In_opt_ PVOID RequestContext);
 
 // Increment the active Volume having the cache log enabled and active the
-// global caching if not already.
+// global caching if not already. The log rings are allocated on first use.
 VOID IncrementVcbLogCacheCount();
 
 // Stringify variable name
@@ -155,8 +148,10 @@ VOID IncrementVcbLogCacheCount();
 #define DOKAN_DENIED_LOG_EVENT(IrpSp)                                          \
   (IrpSp->MajorFunction == IRP_MJ_FILE_SYSTEM_CONTROL &&                       \
    IrpSp->MinorFunction == IRP_MN_USER_FS_REQUEST &&                           \
-   IrpSp->Parameters.FileSystemControl.FsControlCode ==                        \
-       FSCTL_EVENT_PROCESS_N_PULL)
+   (IrpSp->Parameters.FileSystemControl.FsControlCode ==                       \
+        FSCTL_EVENT_PROCESS_N_PULL ||                                          \
+    IrpSp->Parameters.FileSystemControl.FsControlCode ==                       \
+        FSCTL_EVENT_PULL_ASYNC))
 
 // Log the Irp FSCTL or IOCTL Control code.
 #define DOKAN_LOG_IOCTL(RequestContext, ControlCode, format, ...)              \
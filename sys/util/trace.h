@@ -0,0 +1,77 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <ntifs.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+// Manifest-free TraceLogging provider "Dokan.Driver" of the driver, registered
+// for the lifetime of the driver. Its events cost a check of a global flag
+// when no session listens to it, so unlike the DOKAN_LOG_* macros they can be
+// left in the hot paths.
+TRACELOGGING_DECLARE_PROVIDER(g_DokanTraceProvider);
+
+// Keyword of the events following the IRPs of the volumes.
+#define DOKAN_TRACE_KEYWORD_IRP 0x1
+
+// Start of the dispatch of an IRP. Its IrpStop has the same Irp pointer.
+#define DOKAN_TRACE_IRP_START(RequestContext)                                  \
+  TraceLoggingWrite(                                                           \
+      g_DokanTraceProvider, "IrpStart",                                        \
+      TraceLoggingOpcode(WINEVENT_OPCODE_START),                               \
+      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                               \
+      TraceLoggingKeyword(DOKAN_TRACE_KEYWORD_IRP),                            \
+      TraceLoggingPointer((RequestContext)->Irp, "Irp"),                       \
+      TraceLoggingUInt8((RequestContext)->IrpSp->MajorFunction,                \
+                        "MajorFunction"),                                      \
+      TraceLoggingUInt8((RequestContext)->IrpSp->MinorFunction,                \
+                        "MinorFunction"),                                      \
+      TraceLoggingUInt32((RequestContext)->ProcessId, "ProcessId"))
+
+// The IRP is queued for the file system, which replies to SerialNumber.
+#define DOKAN_TRACE_IRP_SEND(RequestContext, SerialNumber)                     \
+  TraceLoggingWrite(                                                           \
+      g_DokanTraceProvider, "IrpSend",                                         \
+      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                               \
+      TraceLoggingKeyword(DOKAN_TRACE_KEYWORD_IRP),                            \
+      TraceLoggingPointer((RequestContext)->Irp, "Irp"),                       \
+      TraceLoggingUInt8((RequestContext)->IrpSp->MajorFunction,                \
+                        "MajorFunction"),                                      \
+      TraceLoggingUInt32((SerialNumber), "SerialNumber"))
+
+// Completion of an IRP. Bytes is its IoStatus.Information, the bytes
+// transferred for reads and writes.
+#define DOKAN_TRACE_IRP_STOP(Irp, Status)                                      \
+  TraceLoggingWrite(                                                           \
+      g_DokanTraceProvider, "IrpStop",                                         \
+      TraceLoggingOpcode(WINEVENT_OPCODE_STOP),                                \
+      TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),                               \
+      TraceLoggingKeyword(DOKAN_TRACE_KEYWORD_IRP),                            \
+      TraceLoggingPointer((Irp), "Irp"),                                       \
+      TraceLoggingUInt8(IoGetCurrentIrpStackLocation(Irp)->MajorFunction,      \
+                        "MajorFunction"),                                      \
+      TraceLoggingNTStatus((Status), "Status"),                                \
+      TraceLoggingUInt64((Irp)->IoStatus.Information, "Bytes"))
+
+#endif  // TRACE_H_
@@ -23,6 +23,106 @@ with this program. If not, see <http://www.gnu.org/licenses/>.
 #include "dokan.h"
 #include "util/irp_buffer_helper.h"
 
+// Returns the index in DokanVCB.VolumeInfoCache of the answers to the
+// InfoClass queries, or -1 if they are not cached.
+static LONG GetVolumeInfoCacheIndex(__in FS_INFORMATION_CLASS InfoClass) {
+  switch (InfoClass) {
+    case FileFsVolumeInformation:
+      return 0;
+    case FileFsSizeInformation:
+      return 1;
+    case FileFsAttributeInformation:
+      return 2;
+    case FileFsFullSizeInformation:
+      return 3;
+    default:
+      return -1;
+  }
+}
+
+// Answers the query with the cached answer of the file system if it is recent
+// enough and fits in the output buffer.
+static BOOLEAN QueryCachedVolumeInfo(__in PREQUEST_CONTEXT RequestContext) {
+  ULONG timeoutMs = RequestContext->Dcb->VolumeInfoCacheTimeoutMs;
+  LONG index = GetVolumeInfoCacheIndex(
+      RequestContext->IrpSp->Parameters.QueryVolume.FsInformationClass);
+  PDOKAN_VOLUME_INFO_CACHE_ENTRY entry;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+  KIRQL oldIrql;
+  BOOLEAN found = FALSE;
+
+  if (timeoutMs == 0 || index < 0) {
+    return FALSE;
+  }
+  entry = &RequestContext->Vcb->VolumeInfoCache[index];
+  now = KeQueryPerformanceCounter(&frequency);
+  KeAcquireSpinLock(&RequestContext->Vcb->VolumeInfoCacheLock, &oldIrql);
+  if (entry->Length != 0 &&
+      entry->Length <= RequestContext->IrpSp->Parameters.QueryVolume.Length &&
+      now.QuadPart - entry->Time <
+          (LONGLONG)timeoutMs * frequency.QuadPart / 1000) {
+    RtlZeroMemory(RequestContext->Irp->AssociatedIrp.SystemBuffer,
+                  RequestContext->IrpSp->Parameters.QueryVolume.Length);
+    RtlCopyMemory(RequestContext->Irp->AssociatedIrp.SystemBuffer,
+                  entry->Buffer, entry->Length);
+    RequestContext->Irp->IoStatus.Information = entry->Length;
+    found = TRUE;
+  }
+  KeReleaseSpinLock(&RequestContext->Vcb->VolumeInfoCacheLock, oldIrql);
+  return found;
+}
+
+// Replaces the cached answer to the InfoClass queries with the Length bytes of
+// Buffer, or drops it if Length is 0, unless the entry changed after Time.
+static VOID CacheVolumeInfo(__in PDokanVCB Vcb,
+                            __in FS_INFORMATION_CLASS InfoClass,
+                            __in_opt PVOID Buffer, __in ULONG Length,
+                            __in LONGLONG Time) {
+  LONG index = GetVolumeInfoCacheIndex(InfoClass);
+  PDOKAN_VOLUME_INFO_CACHE_ENTRY entry;
+  KIRQL oldIrql;
+
+  if (Vcb->Dcb->VolumeInfoCacheTimeoutMs == 0 || index < 0 ||
+      Length > DOKAN_VOLUME_INFO_CACHE_MAX_SIZE) {
+    return;
+  }
+  entry = &Vcb->VolumeInfoCache[index];
+  KeAcquireSpinLock(&Vcb->VolumeInfoCacheLock, &oldIrql);
+  if (Time > entry->Time) {
+    entry->Time = Time;
+    entry->Length = Length;
+    if (Length != 0) {
+      RtlCopyMemory(entry->Buffer, Buffer, Length);
+    }
+  }
+  KeReleaseSpinLock(&Vcb->VolumeInfoCacheLock, oldIrql);
+}
+
+NTSTATUS DokanUpdateVolumeInfo(__in PREQUEST_CONTEXT RequestContext) {
+  PDOKAN_VOLUME_INFO_UPDATE update = NULL;
+
+  GET_IRP_VOLUME_INFO_UPDATE_OR_RETURN(RequestContext->Irp, update);
+  DOKAN_LOG_FINE_IRP(
+      RequestContext, "FsInfoClass=%s Length=%lu",
+      DokanGetFsInformationClassStr(update->FsInformationClass),
+      update->Length);
+  if (GetVolumeInfoCacheIndex(update->FsInformationClass) < 0 ||
+      update->Length > DOKAN_VOLUME_INFO_CACHE_MAX_SIZE) {
+    return STATUS_INVALID_PARAMETER;
+  }
+  if (update->FsInformationClass == FileFsAttributeInformation &&
+      update->Length >= sizeof(FILE_FS_ATTRIBUTE_INFORMATION) &&
+      IS_DEVICE_READ_ONLY(RequestContext->Vcb->DeviceObject)) {
+    ((PFILE_FS_ATTRIBUTE_INFORMATION)update->Buffer)->FileSystemAttributes |=
+        FILE_READ_ONLY_VOLUME;
+  }
+  CacheVolumeInfo(RequestContext->Vcb, update->FsInformationClass,
+                  update->Buffer, update->Length,
+                  KeQueryPerformanceCounter(NULL).QuadPart);
+  return STATUS_SUCCESS;
+}
+
 NTSTATUS
 DokanDispatchQueryVolumeInformation(__in PREQUEST_CONTEXT RequestContext) {
   NTSTATUS status = STATUS_INVALID_PARAMETER;
@@ -46,6 +146,11 @@ DokanDispatchQueryVolumeInformation(__in PREQUEST_CONTEXT RequestContext) {
     return STATUS_INVALID_PARAMETER;
   }
 
+  if (QueryCachedVolumeInfo(RequestContext)) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Answered from the volume info cache");
+    return STATUS_SUCCESS;
+  }
+
   ULONGLONG freeBytesAvailable = 512 * 1024 * 1024;
   ULONGLONG totalBytes = 1024 * 1024 * 1024;
 
@@ -131,6 +236,27 @@ DokanDispatchQueryVolumeInformation(__in PREQUEST_CONTEXT RequestContext) {
       return STATUS_SUCCESS;
     }
 
+    case FileFsSectorSizeInformation: {
+      // Same sizes as the disk device reports, so that applications aligning
+      // their I/O on either agree.
+      PFILE_FS_SECTOR_SIZE_INFORMATION sectorInfo;
+      ULONG sectorSize = RequestContext->Dcb->SectorSize;
+      if (!PREPARE_OUTPUT(RequestContext->Irp, sectorInfo,
+                          /*SetInformationOnFailure=*/FALSE)) {
+        return STATUS_BUFFER_TOO_SMALL;
+      }
+      sectorInfo->LogicalBytesPerSector = sectorSize;
+      sectorInfo->PhysicalBytesPerSectorForAtomicity = sectorSize;
+      sectorInfo->PhysicalBytesPerSectorForPerformance = sectorSize;
+      sectorInfo->FileSystemEffectivePhysicalBytesPerSectorForAtomicity =
+          sectorSize;
+      sectorInfo->Flags = SSINFO_FLAGS_ALIGNED_DEVICE |
+                          SSINFO_FLAGS_PARTITION_ALIGNED_ON_DEVICE;
+      sectorInfo->ByteOffsetForSectorAlignment = 0;
+      sectorInfo->ByteOffsetForPartitionAlignment = 0;
+      return STATUS_SUCCESS;
+    }
+
     case FileFsAttributeInformation: {
       if (RequestContext->Vcb->HasEventWait) {
         break;
@@ -297,6 +423,21 @@ VOID DokanCompleteQueryVolumeInformation(__in PREQUEST_CONTEXT RequestContext,
   // the written length
   RequestContext->Irp->IoStatus.Information = EventInfo->BufferLength;
   RequestContext->Irp->IoStatus.Status = EventInfo->Status;
+
+  // The names in volume and attribute information are silently cut to the
+  // buffer, so only answers that did not fill it are known to be whole.
+  if (EventInfo->Status == STATUS_SUCCESS &&
+      (EventInfo->BufferLength < bufferLen ||
+       RequestContext->IrpSp->Parameters.QueryVolume.FsInformationClass ==
+           FileFsSizeInformation ||
+       RequestContext->IrpSp->Parameters.QueryVolume.FsInformationClass ==
+           FileFsFullSizeInformation)) {
+    CacheVolumeInfo(
+        RequestContext->Vcb,
+        RequestContext->IrpSp->Parameters.QueryVolume.FsInformationClass,
+        buffer, EventInfo->BufferLength,
+        RequestContext->ArrivalTime.QuadPart);
+  }
 }
 
 NTSTATUS
@@ -340,6 +481,8 @@ DokanDispatchSetVolumeInformation(__in PREQUEST_CONTEXT RequestContext) {
       ExReleaseResourceLite(&RequestContext->Dcb->Resource);
       DOKAN_LOG_FINE_IRP(RequestContext, "Volume label changed to %ws",
                          RequestContext->Dcb->VolumeLabel);
+      CacheVolumeInfo(RequestContext->Vcb, FileFsVolumeInformation, NULL, 0,
+                      KeQueryPerformanceCounter(NULL).QuadPart);
 
       return STATUS_SUCCESS;
     }
@@ -36,6 +36,8 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
   BOOLEAN isNonCached = FALSE;
   BOOLEAN isSynchronousIo = FALSE;
   BOOLEAN fcbLocked = FALSE;
+  BOOLEAN isWriteBehindFlush = FALSE;
+  ULONG64 mappedBuffer = 0;
 
   __try {
     fileObject = RequestContext->IrpSp->FileObject;
@@ -71,6 +73,8 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
     ASSERT(fcb != NULL);
 
     OplockDebugRecordMajorFunction(fcb, IRP_MJ_WRITE);
+    DokanInvalidateFileInfoCache(fcb);
+    DokanInvalidateReadAhead(fcb);
     if (DokanFCBFlagsIsSet(fcb, DOKAN_FILE_DIRECTORY)) {
       status = STATUS_INVALID_PARAMETER;
       __leave;
@@ -104,7 +108,11 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
       isSynchronousIo = TRUE;
     }
 
-    if (!isPagingIo && (fileObject->SectionObjectPointer != NULL) &&
+    // The cache was already purged for the writes held back by the handle.
+    isWriteBehindFlush = DokanIsWriteBehindFlush(ccb, RequestContext->Irp);
+
+    if (!isPagingIo && !isWriteBehindFlush &&
+        (fileObject->SectionObjectPointer != NULL) &&
         (fileObject->SectionObjectPointer->DataSectionObject != NULL)) {
 
       CcFlushCache(&fcb->SectionObjectPointers,
@@ -130,6 +138,39 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
       __leave;
     }
 
+    if (RequestContext->Dcb->WriteBehindMaxSize > 0 && !isPagingIo &&
+        !isWriteBehindFlush) {
+      BOOLEAN handled = FALSE;
+      LARGE_INTEGER byteOffset =
+          RequestContext->IrpSp->Parameters.Write.ByteOffset;
+      BOOLEAN useFilePointer =
+          byteOffset.LowPart == FILE_USE_FILE_POINTER_POSITION &&
+          byteOffset.HighPart == -1;
+      if (useFilePointer && isSynchronousIo) {
+        byteOffset = fileObject->CurrentByteOffset;
+      }
+      if (isNonCached && !writeToEoF && (!useFilePointer || isSynchronousIo)) {
+        status = DokanWriteBehind(RequestContext, ccb, byteOffset, buffer,
+                                  RequestContext->IrpSp->Parameters.Write.Length,
+                                  &handled);
+        if (handled && NT_SUCCESS(status)) {
+          SetFlag(fileObject->Flags, FO_FILE_MODIFIED);
+          DokanFCBFlagsSetBit(fcb, DOKAN_FILE_CHANGE_LAST_WRITE);
+          if (isSynchronousIo) {
+            fileObject->CurrentByteOffset.QuadPart =
+                byteOffset.QuadPart +
+                RequestContext->IrpSp->Parameters.Write.Length;
+          }
+        }
+      } else {
+        // Sent after the writes the handle held back.
+        status = DokanFlushWriteBehind(RequestContext, ccb);
+      }
+      if (handled || !NT_SUCCESS(status)) {
+        __leave;
+      }
+    }
+
     // the length of EventContext is sum of length to write and length of file
     // name
     DokanFCBLockRO(fcb);
@@ -150,10 +191,27 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
       __leave;
     }
     eventLength = safeEventLength.LowPart;
+
+    // Rather than making user mode come back for the contents of a large write
+    // with FSCTL_EVENT_WRITE, hand it a mapping of them when we can.
+    if (eventLength > EVENT_CONTEXT_MAX_SIZE) {
+      mappedBuffer = DokanMapWriteBuffer(RequestContext);
+      if (mappedBuffer != 0) {
+        eventLength -= RequestContext->IrpSp->Parameters.Write.Length;
+      }
+    }
+    // DokanOplockComplete picks the mapping up from there if the IRP gets
+    // posted.
+    RequestContext->Irp->Tail.Overlay.DriverContext
+        [DRIVER_CONTEXT_USER_MAPPING] = RequestContext->UserMapping;
+
     eventContext = AllocateEventContext(RequestContext, eventLength, ccb);
 
     // no more memory!
     if (eventContext == NULL) {
+      RequestContext->Irp->Tail.Overlay.DriverContext
+          [DRIVER_CONTEXT_USER_MAPPING] = NULL;
+      DokanUnmapUserBuffer(RequestContext);
       status = STATUS_INSUFFICIENT_RESOURCES;
       __leave;
     }
@@ -210,10 +268,14 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
         FIELD_OFFSET(EVENT_CONTEXT, Operation.Write.FileName[0]) +
         fcb->FileName.Length + sizeof(WCHAR); // adds last null char
 
-    // copies the content to write to EventContext
-    RtlCopyMemory((PCHAR)eventContext +
-                      eventContext->Operation.Write.BufferOffset,
-        buffer, RequestContext->IrpSp->Parameters.Write.Length);
+    // copies the content to write to EventContext, unless user mode reads it
+    // from the mapping
+    eventContext->Operation.Write.MappedBuffer = mappedBuffer;
+    if (mappedBuffer == 0) {
+      RtlCopyMemory((PCHAR)eventContext +
+                        eventContext->Operation.Write.BufferOffset,
+                    buffer, RequestContext->IrpSp->Parameters.Write.Length);
+    }
 
     // copies file name
     eventContext->Operation.Write.FileNameLength = fcb->FileName.Length;
@@ -245,14 +307,22 @@ DokanDispatchWrite(__in PREQUEST_CONTEXT RequestContext) {
           if (status == STATUS_PENDING) {
             DOKAN_LOG_FINE_IRP(RequestContext, "FsRtlCheckOplock returned STATUS_PENDING");
           } else {
+            RequestContext->Irp->Tail.Overlay.DriverContext
+                [DRIVER_CONTEXT_USER_MAPPING] = NULL;
+            DokanUnmapUserBuffer(RequestContext);
             DokanFreeEventContext(eventContext);
           }
           __leave;
         }
       }
+      RequestContext->Irp->Tail.Overlay.DriverContext
+          [DRIVER_CONTEXT_USER_MAPPING] = NULL;
 
       // register this IRP to IRP waiting list and make it pending status
       status = DokanRegisterPendingIrp(RequestContext, eventContext);
+      if (status != STATUS_PENDING) {
+        DokanUnmapUserBuffer(RequestContext);
+      }
 
       // Resuests bigger memory
       // eventContext will be freed later using
@@ -342,6 +412,8 @@ VOID DokanCompleteWrite(__in PREQUEST_CONTEXT RequestContext,
   ASSERT(fcb != NULL);
 
   ccb->UserContext = EventInfo->Context;
+  DokanInvalidateFileInfoCache(fcb);
+  DokanInvalidateReadAhead(fcb);
 
   RequestContext->Irp->IoStatus.Status = EventInfo->Status;
   RequestContext->Irp->IoStatus.Information = EventInfo->BufferLength;
@@ -375,8 +447,10 @@ VOID DokanCompleteWrite(__in PREQUEST_CONTEXT RequestContext,
       SetFlag(fileObject->Flags, FO_FILE_MODIFIED);
     }
 
+    // The writes held back by the handle already moved the file pointer, which
+    // may have moved again since.
     if (EventInfo->BufferLength != 0 && fileObject->Flags & FO_SYNCHRONOUS_IO &&
-        !isPagingIo) {
+        !isPagingIo && !DokanIsWriteBehindFlush(ccb, RequestContext->Irp)) {
       // update current byte offset only when synchronous IO and not paging IO
       fileObject->CurrentByteOffset.QuadPart =
           EventInfo->Operation.Write.CurrentByteOffset.QuadPart;
@@ -384,4 +458,6 @@ VOID DokanCompleteWrite(__in PREQUEST_CONTEXT RequestContext,
                          fileObject->CurrentByteOffset.QuadPart);
     }
   }
+
+  DokanUnmapUserBuffer(RequestContext);
 }
@@ -0,0 +1,382 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Write-behind of small non-cached writes.
+//
+// With EVENT_START.WriteBehindMaxSize set, non-cached, non-paging writes of a
+// handle that each start where the previous one ended are completed as soon as
+// they are copied in the DOKAN_WRITE_BEHIND buffer of the CCB, and sent to the
+// file system as a single write once the buffer is full, after
+// EVENT_START.WriteBehindTimeoutMs, or before any other operation that must see
+// them: a write that does not follow, a flush, the cleanup of the handle or a
+// read of the buffered range through any handle.
+//
+// The data is sent with a write IRP built here and dispatched to the volume
+// like any other, which DokanDispatchWrite recognizes as FlushIrp. The buffer
+// stays locked while that IRP is in flight. The file object is referenced
+// while the buffer holds data, so that the CCB outlives asynchronous flushes.
+// A failure of the file system is returned by the next write, flush or read of
+// the handle, as the writes it covers were already completed.
+
+// Most buffers the timeout thread flushes at each pass.
+#define DOKAN_WRITE_BEHIND_TIMEOUT_BATCH 16
+
+static VOID LockWriteBehind(__in PDOKAN_WRITE_BEHIND WriteBehind) {
+  KeWaitForSingleObject(&WriteBehind->Lock, Executive, KernelMode, FALSE, NULL);
+}
+
+static BOOLEAN TryLockWriteBehind(__in PDOKAN_WRITE_BEHIND WriteBehind) {
+  LARGE_INTEGER timeout = {0};
+  return KeWaitForSingleObject(&WriteBehind->Lock, Executive, KernelMode, FALSE,
+                               &timeout) == STATUS_SUCCESS;
+}
+
+static VOID UnlockWriteBehind(__in PDOKAN_WRITE_BEHIND WriteBehind) {
+  KeSetEvent(&WriteBehind->Lock, IO_NO_INCREMENT, FALSE);
+}
+
+VOID DokanInitWriteBehind(__in PDokanVCB Vcb) {
+  InitializeListHead(&Vcb->WriteBehindList);
+  KeInitializeSpinLock(&Vcb->WriteBehindListLock);
+}
+
+VOID DokanFreeWriteBehind(__in PDokanCCB Ccb) {
+  if (Ccb->WriteBehind != NULL) {
+    ASSERT(Ccb->WriteBehind->Length == 0);
+    ExFreePool(Ccb->WriteBehind);
+    Ccb->WriteBehind = NULL;
+  }
+}
+
+BOOLEAN DokanIsWriteBehindFlush(__in PDokanCCB Ccb, __in PIRP Irp) {
+  return Ccb->WriteBehind != NULL && Ccb->WriteBehind->FlushIrp == Irp;
+}
+
+// Empties the buffer once its data was sent with Status, and releases its
+// lock. Can be called up to DISPATCH_LEVEL.
+static VOID FinishWriteBehind(__in PDOKAN_WRITE_BEHIND WriteBehind,
+                              __in NTSTATUS Status) {
+  PFILE_OBJECT fileObject = WriteBehind->FileObject;
+
+  // Only the first failure is kept until the handle reports it.
+  if (!NT_SUCCESS(Status)) {
+    InterlockedCompareExchange(&WriteBehind->DeferredStatus, Status,
+                               STATUS_SUCCESS);
+  }
+  WriteBehind->Length = 0;
+  WriteBehind->FlushIrp = NULL;
+  InterlockedDecrement(&WriteBehind->Fcb->WriteBehindCount);
+  UnlockWriteBehind(WriteBehind);
+  // Drops the reference taken when the buffer got data, which may close the
+  // file object and free WriteBehind.
+  ObDereferenceObject(fileObject);
+}
+
+static IO_COMPLETION_ROUTINE WriteBehindFlushCompletion;
+
+static NTSTATUS WriteBehindFlushCompletion(__in PDEVICE_OBJECT DeviceObject,
+                                           __in PIRP Irp,
+                                           __in_opt PVOID Context) {
+  NTSTATUS status = Irp->IoStatus.Status;
+
+  UNREFERENCED_PARAMETER(DeviceObject);
+
+  IoFreeMdl(Irp->MdlAddress);
+  Irp->MdlAddress = NULL;
+  IoFreeIrp(Irp);
+  FinishWriteBehind(Context, status);
+  return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+// Removes the buffer from the list watched by the timeout thread.
+static VOID UnlistWriteBehind(__in PDokanVCB Vcb,
+                              __in PDOKAN_WRITE_BEHIND WriteBehind) {
+  KIRQL oldIrql;
+  KeAcquireSpinLock(&Vcb->WriteBehindListLock, &oldIrql);
+  if (WriteBehind->Listed) {
+    RemoveEntryList(&WriteBehind->ListEntry);
+    WriteBehind->Listed = FALSE;
+  }
+  KeReleaseSpinLock(&Vcb->WriteBehindListLock, oldIrql);
+}
+
+// Sends the buffered data to the file system and gives up the lock of the
+// buffer, which the completion of the write releases. The caller must hold it.
+static VOID SendWriteBehind(__in PDokanVCB Vcb,
+                            __in PDOKAN_WRITE_BEHIND WriteBehind) {
+  PIRP irp;
+  PMDL mdl = NULL;
+  PIO_STACK_LOCATION irpSp;
+
+  if (WriteBehind->Length == 0) {
+    UnlockWriteBehind(WriteBehind);
+    return;
+  }
+  UnlistWriteBehind(Vcb, WriteBehind);
+
+  irp = IoAllocateIrp(Vcb->DeviceObject->StackSize, FALSE);
+  if (irp != NULL) {
+    mdl = IoAllocateMdl(WriteBehind->Buffer, WriteBehind->Length, FALSE, FALSE,
+                        irp);
+  }
+  if (mdl == NULL) {
+    DOKAN_LOG_("Cannot allocate the write-behind IRP, Length=%lu",
+               WriteBehind->Length);
+    if (irp != NULL) {
+      IoFreeIrp(irp);
+    }
+    FinishWriteBehind(WriteBehind, STATUS_INSUFFICIENT_RESOURCES);
+    return;
+  }
+  MmBuildMdlForNonPagedPool(mdl);
+
+  irp->MdlAddress = mdl;
+  irp->UserBuffer = MmGetMdlVirtualAddress(mdl);
+  irp->Flags = IRP_NOCACHE | IRP_WRITE_OPERATION;
+  irp->RequestorMode = KernelMode;
+  irp->Tail.Overlay.Thread = PsGetCurrentThread();
+  irp->Tail.Overlay.OriginalFileObject = WriteBehind->FileObject;
+
+  irpSp = IoGetNextIrpStackLocation(irp);
+  irpSp->MajorFunction = IRP_MJ_WRITE;
+  irpSp->DeviceObject = Vcb->DeviceObject;
+  irpSp->FileObject = WriteBehind->FileObject;
+  irpSp->Parameters.Write.Length = WriteBehind->Length;
+  irpSp->Parameters.Write.ByteOffset = WriteBehind->ByteOffset;
+
+  IoSetCompletionRoutine(irp, WriteBehindFlushCompletion, WriteBehind, TRUE,
+                         TRUE, TRUE);
+  WriteBehind->FlushIrp = irp;
+  IoCallDriver(Vcb->DeviceObject, irp);
+}
+
+// Sends the data buffered by the CCB, if any, and waits for the file system
+// to have it.
+static VOID FlushWriteBehind(__in PDokanVCB Vcb, __in PDokanCCB Ccb) {
+  PDOKAN_WRITE_BEHIND writeBehind = Ccb->WriteBehind;
+  if (writeBehind == NULL || writeBehind->Length == 0) {
+    return;
+  }
+  LockWriteBehind(writeBehind);
+  SendWriteBehind(Vcb, writeBehind);
+  LockWriteBehind(writeBehind);
+  UnlockWriteBehind(writeBehind);
+}
+
+// Returns the failure of a write-behind of the handle not reported yet.
+static NTSTATUS TakeDeferredStatus(__in PDokanCCB Ccb) {
+  if (Ccb->WriteBehind == NULL) {
+    return STATUS_SUCCESS;
+  }
+  return InterlockedExchange(&Ccb->WriteBehind->DeferredStatus,
+                             STATUS_SUCCESS);
+}
+
+NTSTATUS DokanFlushWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                               __in PDokanCCB Ccb) {
+  FlushWriteBehind(RequestContext->Vcb, Ccb);
+  return TakeDeferredStatus(Ccb);
+}
+
+VOID DokanFlushConflictingWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                                      __in PDokanFCB Fcb,
+                                      __in LONGLONG ByteOffset,
+                                      __in ULONG Length) {
+  // Bounded in case writes keep filling buffers behind us.
+  for (ULONG attempt = 0;
+       attempt < 64 && InterlockedCompareExchange(&Fcb->WriteBehindCount, 0,
+                                                  0) > 0;
+       ++attempt) {
+    PDokanCCB conflictingCcb = NULL;
+    PFILE_OBJECT fileObject = NULL;
+
+    DokanFCBLockRO(Fcb);
+    for (PLIST_ENTRY listEntry = Fcb->NextCCB.Flink;
+         listEntry != &Fcb->NextCCB; listEntry = listEntry->Flink) {
+      PDokanCCB ccb = CONTAINING_RECORD(listEntry, DokanCCB, NextCCB);
+      PDOKAN_WRITE_BEHIND writeBehind = ccb->WriteBehind;
+      if (writeBehind != NULL && writeBehind->Length > 0 &&
+          ByteOffset < writeBehind->ByteOffset.QuadPart + writeBehind->Length &&
+          writeBehind->ByteOffset.QuadPart < ByteOffset + Length) {
+        conflictingCcb = ccb;
+        fileObject = writeBehind->FileObject;
+        ObReferenceObject(fileObject);
+        break;
+      }
+    }
+    DokanFCBUnlock(Fcb);
+    if (conflictingCcb == NULL) {
+      return;
+    }
+    DOKAN_LOG_FINE_IRP(RequestContext, "Flushing write-behind of CCB=%p",
+                       conflictingCcb);
+    FlushWriteBehind(RequestContext->Vcb, conflictingCcb);
+    ObDereferenceObject(fileObject);
+  }
+}
+
+// Allocates the buffer of the CCB when it first needs one.
+static PDOKAN_WRITE_BEHIND GetWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                                          __in PDokanCCB Ccb) {
+  PDOKAN_WRITE_BEHIND writeBehind = Ccb->WriteBehind;
+  if (writeBehind != NULL) {
+    return writeBehind;
+  }
+  writeBehind = DokanAllocZero(FIELD_OFFSET(DOKAN_WRITE_BEHIND, Buffer[0]) +
+                               RequestContext->Dcb->WriteBehindMaxSize);
+  if (writeBehind == NULL) {
+    return NULL;
+  }
+  KeInitializeEvent(&writeBehind->Lock, SynchronizationEvent, TRUE);
+  InitializeListHead(&writeBehind->ListEntry);
+  writeBehind->Fcb = Ccb->Fcb;
+  writeBehind->FileObject = RequestContext->IrpSp->FileObject;
+  writeBehind->Capacity = RequestContext->Dcb->WriteBehindMaxSize;
+  if (InterlockedCompareExchangePointer(&Ccb->WriteBehind, writeBehind,
+                                        NULL) != NULL) {
+    ExFreePool(writeBehind);
+  }
+  return Ccb->WriteBehind;
+}
+
+NTSTATUS DokanWriteBehind(__in PREQUEST_CONTEXT RequestContext,
+                          __in PDokanCCB Ccb, __in LARGE_INTEGER ByteOffset,
+                          __in PVOID Buffer, __in ULONG Length,
+                          __out PBOOLEAN Handled) {
+  PDOKAN_WRITE_BEHIND writeBehind;
+  NTSTATUS status;
+  KIRQL oldIrql;
+
+  *Handled = FALSE;
+  status = TakeDeferredStatus(Ccb);
+  if (!NT_SUCCESS(status)) {
+    *Handled = TRUE;
+    return status;
+  }
+  if (Length > RequestContext->Dcb->WriteBehindMaxSize / 2 ||
+      (RequestContext->IrpSp->Flags & SL_WRITE_THROUGH) ||
+      (RequestContext->IrpSp->FileObject->Flags & FO_WRITE_THROUGH) ||
+      !FsRtlOplockIsFastIoPossible(DokanGetFcbOplock(Ccb->Fcb)) ||
+      !FsRtlCheckLockForWriteAccess(&Ccb->Fcb->FileLock,
+                                    RequestContext->Irp)) {
+    // Written right away, after what is already buffered, so that oplock
+    // breaks and byte range lock conflicts are handled as usual.
+    return DokanFlushWriteBehind(RequestContext, Ccb);
+  }
+  writeBehind = GetWriteBehind(RequestContext, Ccb);
+  if (writeBehind == NULL) {
+    return STATUS_SUCCESS;
+  }
+
+  LockWriteBehind(writeBehind);
+  if (writeBehind->Length > 0 &&
+      (ByteOffset.QuadPart !=
+           writeBehind->ByteOffset.QuadPart + writeBehind->Length ||
+       writeBehind->Length + Length > writeBehind->Capacity)) {
+    SendWriteBehind(RequestContext->Vcb, writeBehind);
+    LockWriteBehind(writeBehind);
+    status = TakeDeferredStatus(Ccb);
+    if (!NT_SUCCESS(status)) {
+      UnlockWriteBehind(writeBehind);
+      *Handled = TRUE;
+      return status;
+    }
+  }
+  if (writeBehind->Length == 0) {
+    ObReferenceObject(writeBehind->FileObject);
+    InterlockedIncrement(&writeBehind->Fcb->WriteBehindCount);
+    writeBehind->ByteOffset = ByteOffset;
+    writeBehind->FirstWriteTime = KeQueryPerformanceCounter(NULL).QuadPart;
+  }
+  // Also listed again when the timeout thread found it busy.
+  if (!writeBehind->Listed) {
+    KeAcquireSpinLock(&RequestContext->Vcb->WriteBehindListLock, &oldIrql);
+    InsertTailList(&RequestContext->Vcb->WriteBehindList,
+                   &writeBehind->ListEntry);
+    writeBehind->Listed = TRUE;
+    KeReleaseSpinLock(&RequestContext->Vcb->WriteBehindListLock, oldIrql);
+  }
+  RtlCopyMemory((PCHAR)writeBehind->Buffer + writeBehind->Length, Buffer,
+                Length);
+  writeBehind->Length += Length;
+  DOKAN_LOG_FINE_IRP(RequestContext, "Buffered write, %lu bytes at %I64d",
+                     writeBehind->Length, writeBehind->ByteOffset.QuadPart);
+  UnlockWriteBehind(writeBehind);
+
+  RequestContext->Irp->IoStatus.Information = Length;
+  *Handled = TRUE;
+  return STATUS_SUCCESS;
+}
+
+// Sends up to DOKAN_WRITE_BEHIND_TIMEOUT_BATCH listed buffers, or only the ones
+// older than the timeout without Force, and returns how many were taken.
+static ULONG SendListedWriteBehind(__in PDokanDCB Dcb, __in BOOLEAN Force) {
+  PDokanVCB vcb = Dcb->Vcb;
+  PDOKAN_WRITE_BEHIND expired[DOKAN_WRITE_BEHIND_TIMEOUT_BATCH];
+  ULONG expiredCount = 0;
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+  KIRQL oldIrql;
+
+  now = KeQueryPerformanceCounter(&frequency);
+  KeAcquireSpinLock(&vcb->WriteBehindListLock, &oldIrql);
+  // The list goes from the oldest buffer to the newest.
+  while (!IsListEmpty(&vcb->WriteBehindList) &&
+         expiredCount < DOKAN_WRITE_BEHIND_TIMEOUT_BATCH) {
+    PDOKAN_WRITE_BEHIND writeBehind = CONTAINING_RECORD(
+        vcb->WriteBehindList.Flink, DOKAN_WRITE_BEHIND, ListEntry);
+    if (!Force &&
+        now.QuadPart - writeBehind->FirstWriteTime <
+            (LONGLONG)Dcb->WriteBehindTimeoutMs * frequency.QuadPart / 1000) {
+      break;
+    }
+    RemoveEntryList(&writeBehind->ListEntry);
+    writeBehind->Listed = FALSE;
+    ObReferenceObject(writeBehind->FileObject);
+    expired[expiredCount++] = writeBehind;
+  }
+  KeReleaseSpinLock(&vcb->WriteBehindListLock, oldIrql);
+
+  for (ULONG i = 0; i < expiredCount; ++i) {
+    PFILE_OBJECT fileObject = expired[i]->FileObject;
+    // The timeout thread never waits: a busy buffer is already being flushed,
+    // and that write may only time out through this thread.
+    if (Force) {
+      LockWriteBehind(expired[i]);
+      SendWriteBehind(vcb, expired[i]);
+    } else if (TryLockWriteBehind(expired[i])) {
+      SendWriteBehind(vcb, expired[i]);
+    }
+    ObDereferenceObject(fileObject);
+  }
+  return expiredCount;
+}
+
+VOID DokanCheckWriteBehindTimeout(__in PDokanDCB Dcb, __in BOOLEAN Force) {
+  if (Dcb->WriteBehindMaxSize == 0 || Dcb->Vcb == NULL) {
+    return;
+  }
+  // Every pass empties the list of the buffers it takes, busy or not.
+  while (!IsListEmpty(&Dcb->Vcb->WriteBehindList) &&
+         SendListedWriteBehind(Dcb, Force) == DOKAN_WRITE_BEHIND_TIMEOUT_BATCH)
+    ;
+}
@@ -0,0 +1,170 @@
+/*
+  Dokan : user-mode file system library for Windows
+
+  Copyright (C) 2024 Google, Inc.
+
+  http://dokan-dev.github.io
+
+This program is free software; you can redistribute it and/or modify it under
+the terms of the GNU Lesser General Public License as published by the Free
+Software Foundation; either version 3 of the License, or (at your option) any
+later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "dokan.h"
+
+// Zero-copy reads and writes.
+//
+// When the DLL mounts with DOKAN_EVENT_ZERO_COPY_READ, page aligned read
+// buffers are mapped in the file system process for the lifetime of the
+// request and the DLL reads straight into them instead of returning the data
+// in its reply. Likewise with DOKAN_EVENT_ZERO_COPY_WRITE, the buffer of a write
+// too large to be carried by its event is mapped read-only in the file system
+// process instead of being fetched by the DLL with FSCTL_EVENT_WRITE. Buffers
+// that do not cover whole pages are never mapped, as the rest of those pages is
+// none of the file system's business; they keep being copied.
+//
+// The mapping has to be removed before the IRP is completed, at most at
+// APC_LEVEL and attached to the file system process. Every path that completes
+// a pending IRP without going through DokanCompleteRead or DokanCompleteWrite
+// has to use DokanCompleteMappedIrpRequest for that reason.
+
+static VOID FreeUserMapping(__in PDOKAN_USER_MAPPING Mapping) {
+  KAPC_STATE apcState;
+
+  if (Mapping->UserAddress != NULL) {
+    KeStackAttachProcess(Mapping->Process, &apcState);
+    MmUnmapLockedPages(Mapping->UserAddress, Mapping->Mdl);
+    KeUnstackDetachProcess(&apcState);
+  }
+  ObDereferenceObject(Mapping->Process);
+  IoFreeWorkItem(Mapping->WorkItem);
+  ExFreePool(Mapping);
+}
+
+// Maps the whole MDL of the IRP in the file system process when it only covers
+// whole pages of Length bytes. Returns the user address, or NULL when the buffer
+// is not mapped.
+static PVOID MapUserBuffer(__in PREQUEST_CONTEXT RequestContext,
+                           __in ULONG Length, __in BOOLEAN ReadOnly) {
+  PMDL mdl = RequestContext->Irp->MdlAddress;
+  PDOKAN_USER_MAPPING mapping = NULL;
+  KAPC_STATE apcState;
+  ULONG priority = NormalPagePriority | DokanMdlSafePriority;
+
+  if (mdl == NULL || mdl->Next != NULL ||
+      (mdl->MdlFlags & MDL_SOURCE_IS_NONPAGED_POOL) ||
+      MmGetMdlByteOffset(mdl) != 0 || (Length & (PAGE_SIZE - 1)) != 0 ||
+      MmGetMdlByteCount(mdl) != Length) {
+    return NULL;
+  }
+  if (ReadOnly) {
+    priority |= MdlMappingNoWrite;
+  }
+
+  mapping = DokanAllocZero(sizeof(DOKAN_USER_MAPPING));
+  if (mapping == NULL) {
+    return NULL;
+  }
+  mapping->WorkItem = IoAllocateWorkItem(RequestContext->DeviceObject);
+  if (mapping->WorkItem == NULL) {
+    ExFreePool(mapping);
+    return NULL;
+  }
+  mapping->Irp = RequestContext->Irp;
+  mapping->Mdl = mdl;
+  mapping->Process = RequestContext->Dcb->UserProcess;
+  ObReferenceObject(mapping->Process);
+
+  KeStackAttachProcess(mapping->Process, &apcState);
+  __try {
+    mapping->UserAddress = MmMapLockedPagesSpecifyCache(
+        mdl, UserMode, MmCached, NULL, FALSE, priority);
+  } __except (EXCEPTION_EXECUTE_HANDLER) {
+    mapping->UserAddress = NULL;
+  }
+  KeUnstackDetachProcess(&apcState);
+
+  if (mapping->UserAddress == NULL) {
+    DOKAN_LOG_FINE_IRP(RequestContext, "Failed to map the buffer");
+    FreeUserMapping(mapping);
+    return NULL;
+  }
+  RequestContext->UserMapping = mapping;
+  return mapping->UserAddress;
+}
+
+// Maps the buffer of the read in the file system process when possible and
+// gives its address to the DLL in EventContext. Not being able to map it is not
+// an error; the read then simply goes through the regular path.
+VOID DokanMapReadBuffer(__in PREQUEST_CONTEXT RequestContext,
+                        __in PEVENT_CONTEXT EventContext) {
+  if (!RequestContext->Dcb->ZeroCopyRead) {
+    return;
+  }
+  EventContext->Operation.Read.MappedBuffer = (ULONG64)(ULONG_PTR)MapUserBuffer(
+      RequestContext, EventContext->Operation.Read.BufferLength,
+      /*ReadOnly=*/FALSE);
+}
+
+// Maps the buffer of the write in the file system process when possible.
+// Returns its user address, or 0 if the write has to go through the regular
+// path.
+ULONG64 DokanMapWriteBuffer(__in PREQUEST_CONTEXT RequestContext) {
+  if (!RequestContext->Dcb->ZeroCopyWrite) {
+    return 0;
+  }
+  return (ULONG64)(ULONG_PTR)MapUserBuffer(
+      RequestContext, RequestContext->IrpSp->Parameters.Write.Length,
+      /*ReadOnly=*/TRUE);
+}
+
+// Removes the mapping made by DokanMapReadBuffer or DokanMapWriteBuffer, if
+// any. Must be called at most at APC_LEVEL.
+VOID DokanUnmapUserBuffer(__in PREQUEST_CONTEXT RequestContext) {
+  if (RequestContext->UserMapping != NULL) {
+    FreeUserMapping(RequestContext->UserMapping);
+    RequestContext->UserMapping = NULL;
+  }
+}
+
+static VOID UnmapAndCompleteIrpWorker(__in PDEVICE_OBJECT DeviceObject,
+                                      __in_opt PVOID Context) {
+  PDOKAN_USER_MAPPING mapping = Context;
+  PIRP irp = mapping->Irp;
+  NTSTATUS status = mapping->CompletionStatus;
+
+  UNREFERENCED_PARAMETER(DeviceObject);
+
+  FreeUserMapping(mapping);
+  DokanCompleteIrpRequest(irp, status);
+}
+
+// Same as DokanCompleteIrpRequest for a pending IRP whose buffer may be mapped
+// in the file system process. Can be called up to DISPATCH_LEVEL, in which case
+// the completion is deferred to a work item.
+VOID DokanCompleteMappedIrpRequest(__in PREQUEST_CONTEXT RequestContext,
+                                   __in NTSTATUS Status) {
+  PDOKAN_USER_MAPPING mapping = RequestContext->UserMapping;
+
+  if (mapping == NULL) {
+    DokanCompleteIrpRequest(RequestContext->Irp, Status);
+    return;
+  }
+  RequestContext->UserMapping = NULL;
+  if (KeGetCurrentIrql() <= APC_LEVEL) {
+    FreeUserMapping(mapping);
+    DokanCompleteIrpRequest(RequestContext->Irp, Status);
+    return;
+  }
+  mapping->CompletionStatus = Status;
+  IoQueueWorkItem(mapping->WorkItem, UnmapAndCompleteIrpWorker,
+                  DelayedWorkQueue, mapping);
+}